@@ -119,3 +119,143 @@ strncmp_word(const gchar * s1, const gchar * s2, gsize n)
 
     return retval;
 }
+
+/*
+ * CompletionIndex
+ */
+
+typedef struct {
+    const gchar *word;          /* to the end of the string */
+    guint item;
+} CompletionIndexEntry;
+
+struct _CompletionIndex {
+    GPtrArray *items;           /* of CompletionData */
+    GArray *entries;            /* of CompletionIndexEntry, by word */
+};
+
+static gint
+completion_index_entry_compare(gconstpointer a, gconstpointer b)
+{
+    const CompletionIndexEntry *entry_a = a;
+    const CompletionIndexEntry *entry_b = b;
+    gint retval;
+
+    if ((retval = strcmp(entry_a->word, entry_b->word)) != 0)
+        return retval;
+
+    return entry_a->item < entry_b->item ? -1 : entry_a->item > entry_b->item;
+}
+
+CompletionIndex *
+completion_index_new(GList * items)
+{
+    CompletionIndex *idx;
+    GList *list;
+
+    idx = g_new(CompletionIndex, 1);
+    idx->items = g_ptr_array_new();
+    idx->entries = g_array_new(FALSE, FALSE, sizeof(CompletionIndexEntry));
+
+    for (list = items; list != NULL; list = list->next) {
+        CompletionData *data = list->data;
+        CompletionIndexEntry entry;
+        const gchar *word;
+
+        entry.item = idx->items->len;
+        g_ptr_array_add(idx->items, data);
+        if (data->string == NULL)
+            continue;
+
+        /* Every word, the way strncmp_word() walks them. */
+        word = data->string;
+        do {
+            entry.word = word;
+            g_array_append_val(idx->entries, entry);
+            if ((word = strchr(word, ' ')) != NULL)
+                ++word;
+        } while (word != NULL);
+    }
+
+    g_array_sort(idx->entries, completion_index_entry_compare);
+
+    return idx;
+}
+
+void
+completion_index_free(CompletionIndex * idx)
+{
+    if (idx == NULL)
+        return;
+
+    g_ptr_array_foreach(idx->items, (GFunc) completion_data_free, NULL);
+    g_ptr_array_free(idx->items, TRUE);
+    g_array_free(idx->entries, TRUE);
+    g_free(idx);
+}
+
+static gint
+completion_index_compare_uint(gconstpointer a, gconstpointer b)
+{
+    guint uint_a = *(const guint *) a;
+    guint uint_b = *(const guint *) b;
+
+    return uint_a < uint_b ? -1 : uint_a > uint_b;
+}
+
+GList *
+completion_index_lookup(CompletionIndex * idx, const gchar * prefix)
+{
+    GArray *found;
+    GList *res = NULL;
+    gsize len;
+    guint lo, hi, i;
+
+    g_return_val_if_fail(prefix != NULL, NULL);
+
+    if (idx == NULL)
+        return NULL;
+
+    if (*prefix == '\0') {
+        for (i = idx->items->len; i > 0; i--)
+            res = g_list_prepend(res, g_ptr_array_index(idx->items, i - 1));
+        return res;
+    }
+
+    /* The first word not less than prefix; those with prefix follow. */
+    lo = 0;
+    hi = idx->entries->len;
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (strcmp(g_array_index(idx->entries, CompletionIndexEntry, mid).word,
+                   prefix) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    len = strlen(prefix);
+    found = g_array_new(FALSE, FALSE, sizeof(guint));
+    for (i = lo; i < idx->entries->len; i++) {
+        CompletionIndexEntry *entry =
+            &g_array_index(idx->entries, CompletionIndexEntry, i);
+
+        if (strncmp(entry->word, prefix, len) != 0)
+            break;
+        g_array_append_val(found, entry->item);
+    }
+
+    /* An item may match in several words; keep the order of the book. */
+    g_array_sort(found, completion_index_compare_uint);
+    for (i = found->len; i > 0; i--) {
+        guint item = g_array_index(found, guint, i - 1);
+
+        if (i > 1 && g_array_index(found, guint, i - 2) == item)
+            continue;
+        res = g_list_prepend(res, g_ptr_array_index(idx->items, item));
+    }
+    g_array_free(found, TRUE);
+
+    return res;
+}
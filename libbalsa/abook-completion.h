@@ -39,4 +39,21 @@ void completion_data_free(CompletionData * data, gpointer unused);
 gchar *completion_data_extract(CompletionData * data);
 gint strncmp_word(const gchar * s1, const gchar * s2, gsize n);
 
+/*
+ * An index of CompletionData for completing a prefix: the items whose
+ * string has a word starting with the prefix, as strncmp_word() finds
+ * them, in the order they were given.  The words are the nick name,
+ * the words of the full name and the address.  A lookup is a binary
+ * search over the words, so it does not depend on the size of the book.
+ */
+typedef struct _CompletionIndex CompletionIndex;
+
+/* The index takes over the CompletionData in items. */
+CompletionIndex *completion_index_new(GList * items);
+void completion_index_free(CompletionIndex * idx);
+/* The CompletionData matching prefix, normalized and casefolded; free
+ * the list, not the data. */
+GList *completion_index_lookup(CompletionIndex * idx,
+                               const gchar * prefix);
+
 #endif
@@ -123,8 +123,6 @@ libbalsa_address_book_rubrica_init(LibBalsaAddressBookRubrica * ab_rubrica)
     libbalsa_address_book_text_set_item_list(ab_text, NULL);
     libbalsa_address_book_text_set_mtime(ab_text, 0);
 
-    if (libbalsa_address_book_text_get_name_complete(ab_text) != NULL)
-        libbalsa_completion_free(libbalsa_address_book_text_get_name_complete(ab_text));
     libbalsa_address_book_text_set_name_complete(ab_text,
                                                  libbalsa_completion_new((LibBalsaCompletionFunc)
                                                                           completion_data_extract));
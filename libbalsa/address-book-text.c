@@ -78,8 +78,10 @@ typedef struct {
     GSList *item_list;
 
     time_t mtime;
+    off_t size;
 
     LibBalsaCompletion *name_complete;
+    CompletionIndex *completion_index;
 } LibBalsaAddressBookTextPrivate;
 
 G_DEFINE_ABSTRACT_TYPE_WITH_PRIVATE(LibBalsaAddressBookText, libbalsa_address_book_text,
@@ -138,11 +140,9 @@ libbalsa_address_book_text_init(LibBalsaAddressBookText * ab_text)
     priv->path = NULL;
     priv->item_list = NULL;
     priv->mtime = 0;
-
-    priv->name_complete =
-        libbalsa_completion_new((LibBalsaCompletionFunc)
-                                completion_data_extract);
-    libbalsa_completion_set_compare(priv->name_complete, strncmp_word);
+    priv->size = 0;
+    priv->completion_index = NULL;
+    priv->name_complete = NULL;
 }
 
 static LibBalsaAddressBookTextItem *
@@ -167,9 +167,14 @@ libbalsa_address_book_text_finalize(GObject * object)
     g_slist_free_full(priv->item_list, ab_text_class->text_item_free_func);
     priv->item_list = NULL;
 
-    g_list_foreach(priv->name_complete->items,
-                   (GFunc) completion_data_free, NULL);
-    libbalsa_completion_free(priv->name_complete);
+    /* Text books complete through the completion index; only a
+     * subclass that sets a name completion has one to free. */
+    if (priv->name_complete != NULL) {
+        g_list_foreach(priv->name_complete->items,
+                       (GFunc) completion_data_free, NULL);
+        libbalsa_completion_free(priv->name_complete);
+    }
+    completion_index_free(priv->completion_index);
 
     G_OBJECT_CLASS(libbalsa_address_book_text_parent_class)->finalize(object);
 }
@@ -187,14 +192,29 @@ lbab_text_address_book_need_reload(LibBalsaAddressBookText * ab_text)
     if (stat(priv->path, &stat_buf) == -1)
         return TRUE;
 
-    if (stat_buf.st_mtime > priv->mtime) {
+    if (stat_buf.st_mtime != priv->mtime || stat_buf.st_size != priv->size) {
         priv->mtime = stat_buf.st_mtime;
+        priv->size = stat_buf.st_size;
         return TRUE;
     }
 
     return FALSE;
 }
 
+/* returns true if the book is loaded and has not changed since; unlike
+ * lbab_text_address_book_need_reload, it does not record the change */
+static gboolean
+lbab_text_address_book_is_current(LibBalsaAddressBookText * ab_text)
+{
+    LibBalsaAddressBookTextPrivate *priv =
+        libbalsa_address_book_text_get_instance_private(ab_text);
+    struct stat stat_buf;
+
+    return stat(priv->path, &stat_buf) == 0
+        && stat_buf.st_mtime == priv->mtime
+        && stat_buf.st_size == priv->size;
+}
+
 /* Case-insensitive utf-8 string-has-prefix */
 static gboolean
 lbab_text_starts_from(const gchar * str, const gchar * filter_hi)
@@ -293,9 +313,8 @@ lbab_text_load_file(LibBalsaAddressBookText * ab_text, FILE * stream)
     g_slist_free_full(priv->item_list, ab_text_class->text_item_free_func);
     priv->item_list = NULL;
 
-    g_list_foreach(priv->name_complete->items,
-                   (GFunc) completion_data_free, NULL);
-    libbalsa_completion_clear_items(priv->name_complete);
+    completion_index_free(priv->completion_index);
+    priv->completion_index = NULL;
 
     parse_address =
         LIBBALSA_ADDRESS_BOOK_TEXT_GET_CLASS(ab_text)->parse_address;
@@ -398,7 +417,7 @@ lbab_text_load_file(LibBalsaAddressBookText * ab_text, FILE * stream)
 #endif                          /* MAKE_GROUP_BY_ORGANIZATION */
 
     completion_list = g_list_reverse(completion_list);
-    libbalsa_completion_add_items(priv->name_complete, completion_list);
+    priv->completion_index = completion_index_new(completion_list);
     g_list_free(completion_list);
 
     return TRUE;
@@ -716,35 +735,40 @@ libbalsa_address_book_text_alias_complete(LibBalsaAddressBook * ab,
     LibBalsaAddressBookText *ab_text = LIBBALSA_ADDRESS_BOOK_TEXT(ab);
     LibBalsaAddressBookTextPrivate *priv =
         libbalsa_address_book_text_get_instance_private(ab_text);
-    FILE *stream;
+    GList *match;
     GList *list;
     GList *res = NULL;
 
     if (!libbalsa_address_book_get_expand_aliases(ab))
         return NULL;
 
-    stream = fopen(priv->path, "r");
-    if (!stream)
-        return NULL;
+    /* This is called on every keystroke: reread the book only if it
+     * has changed. */
+    if (!lbab_text_address_book_is_current(ab_text)) {
+        FILE *stream;
 
-    if (!lbab_text_lock_book(ab_text, stream, FALSE)) {
-        fclose(stream);
-        return NULL;
-    }
+        stream = fopen(priv->path, "r");
+        if (!stream)
+            return NULL;
+
+        if (!lbab_text_lock_book(ab_text, stream, FALSE)) {
+            fclose(stream);
+            return NULL;
+        }
 
-    lbab_text_load_file(ab_text, stream);
+        lbab_text_load_file(ab_text, stream);
 
-    lbab_text_unlock_book(ab_text, stream);
-    fclose(stream);
+        lbab_text_unlock_book(ab_text, stream);
+        fclose(stream);
+    }
 
-    for (list =
-         libbalsa_completion_complete(priv->name_complete,
-                                      (gchar *) prefix);
-         list; list = list->next) {
+    match = completion_index_lookup(priv->completion_index, prefix);
+    for (list = match; list; list = list->next) {
         InternetAddress *ia = ((CompletionData *) list->data)->ia;
         g_object_ref(ia);
         res = g_list_prepend(res, ia);
     }
+    g_list_free(match);
 
     return g_list_reverse(res);
 }
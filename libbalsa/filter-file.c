@@ -214,11 +214,8 @@ static LibBalsaCondition *
 libbalsa_condition_new_from_config()
 {
     LibBalsaCondition *newc;
-#if 0
     gchar **regexs;
     gint nbregexs, i;
-    LibBalsaConditionRegex *newreg;
-#endif
     struct tm date;
     gchar *str, *p;
     unsigned fields;
@@ -240,19 +237,20 @@ libbalsa_condition_new_from_config()
 	break;
     case CONDITION_REGEX:
 	newc->match.regex.fields = fields;
-#if 0
+	newc->match.regex.regexs = NULL;
+	newc->match.regex.user_header =
+	    CONDITION_CHKMATCH(newc, CONDITION_MATCH_US_HEAD) ?
+	    libbalsa_conf_get_string("User-header") : NULL;
 	libbalsa_conf_get_vector("Reg-exps", &nbregexs, &regexs);
-	for (i = 0; i < nbregexs && (filter_errno == FILTER_NOERR); i++) {
-	    newreg = g_new(LibBalsaConditionRegex, 1);
-	    newreg->string = regexs[i];
-	    newreg->compiled = NULL;
-	    newc->match.regexs =
-		g_slist_prepend(newc->match.regexs, newreg);
+	for (i = 0; i < nbregexs; i++) {
+	    LibBalsaConditionRegex *newreg = libbalsa_condition_regex_new();
+
+	    libbalsa_condition_regex_set(newreg, regexs[i]);
+	    libbalsa_condition_prepend_regex(newc, newreg);
 	}
-	newc->match.regexs = g_slist_reverse(newc->match.regexs);
+	newc->match.regex.regexs = g_slist_reverse(newc->match.regex.regexs);
 	/* Free the array of (gchar*)'s, but not the strings pointed by them */
 	g_free(regexs);
-#endif
 	break;
     case CONDITION_DATE:
 	str = libbalsa_conf_get_string("Low-date");
@@ -36,6 +36,7 @@
 
 #include "filter-funcs.h"
 #include "filter-private.h"
+#include "misc.h"
 
 /* Conditions */
 
@@ -76,7 +77,7 @@ lbcond_new(ConditionMatchType type, gboolean negated)
 {
     LibBalsaCondition *cond;
 
-    cond = g_new(LibBalsaCondition, 1);
+    cond = g_new0(LibBalsaCondition, 1);
     cond->type      = type;
     cond->negate    = !!negated;
     cond->ref_count = 1;
@@ -137,6 +138,66 @@ libbalsa_condition_new_string(gboolean negated, unsigned headers,
 
     return cond;
 }
+
+static LibBalsaCondition*
+libbalsa_condition_new_regex_parse(gboolean negated, gchar **string)
+{
+    char *user_header = NULL;
+    GSList *regexs = NULL;
+    int i, headers = atoi(*string);
+    for(i=0; (*string)[i] && isdigit((int)(*string)[i]); i++)
+        ;
+    if((*string)[i] != ' ')
+        return NULL;
+    *string += i+1;
+    if( headers & CONDITION_MATCH_US_HEAD) {
+        user_header = get_quoted_string(string);
+        if(!user_header)
+            return NULL;
+        if(*(*string)++ != ' ') {
+            g_free(user_header); return NULL;
+        }
+    }
+    /* One or more quoted regexs, separated by spaces; a condition
+     * following this one never starts with a quote. */
+    for (;;) {
+        LibBalsaConditionRegex *reg;
+
+        if (**string != '"') {
+            regexs_free(regexs);
+            g_free(user_header);
+            return NULL;
+        }
+        reg = libbalsa_condition_regex_new();
+        libbalsa_condition_regex_set(reg, get_quoted_string(string));
+        regexs = g_slist_prepend(regexs, reg);
+        if ((*string)[0] != ' ' || (*string)[1] != '"')
+            break;
+        ++*string;
+    }
+
+    return libbalsa_condition_new_regex(negated, headers,
+                                        g_slist_reverse(regexs),
+                                        user_header);
+}
+
+/* libbalsa_condition_new_regex:
+ * steals the list of LibBalsaConditionRegex and the user header.
+ */
+LibBalsaCondition*
+libbalsa_condition_new_regex(gboolean negated, unsigned headers,
+                             GSList *regexs, gchar *user_header)
+{
+    LibBalsaCondition *cond;
+
+    cond = lbcond_new(CONDITION_REGEX, negated);
+    cond->match.regex.fields      = headers;
+    cond->match.regex.regexs      = regexs;
+    cond->match.regex.user_header = user_header;
+
+    return cond;
+}
+
 LibBalsaCondition*
 libbalsa_condition_new_date(gboolean negated, time_t *from, time_t *to)
 {
@@ -285,6 +346,7 @@ libbalsa_condition_new_from_string(gchar **string)
         LibBalsaCondition *(*parser)(gboolean negate, gchar **str);
     } cond_types[] = {
         { "STRING ", 7, libbalsa_condition_new_string_parse },
+        { "REGEX ",  6, libbalsa_condition_new_regex_parse  },
         { "DATE ",   5, libbalsa_condition_new_date_parse   },
         { "FLAG ",   5, libbalsa_condition_new_flag   },
         { "AND ",    4, libbalsa_condition_new_and    },
@@ -308,6 +370,20 @@ libbalsa_condition_new_from_string(gchar **string)
     return NULL;    
 }
 
+static void
+append_regexs(LibBalsaCondition * cond, GString *res)
+{
+    GSList *list;
+
+    for (list = cond->match.regex.regexs; list; list = list->next) {
+        LibBalsaConditionRegex *reg = list->data;
+
+        if (list != cond->match.regex.regexs)
+            g_string_append_c(res, ' ');
+        append_quoted_string(res, reg->string);
+    }
+}
+
 static void
 cond_to_string(LibBalsaCondition * cond, GString *res)
 {
@@ -327,9 +403,12 @@ cond_to_string(LibBalsaCondition * cond, GString *res)
         append_quoted_string(res, cond->match.string.string);
 	break;
     case CONDITION_REGEX:
-#if 0
-        /* FIXME! */
-#endif        
+        g_string_append_printf(res, "REGEX %u ", cond->match.regex.fields);
+        if (CONDITION_CHKMATCH(cond, CONDITION_MATCH_US_HEAD)) {
+            append_quoted_string(res, cond->match.regex.user_header);
+            g_string_append_c(res, ' ');
+        }
+        append_regexs(cond, res);
 	break;
     case CONDITION_DATE:
         g_string_append(res, "DATE ");
@@ -445,9 +524,9 @@ libbalsa_condition_to_string_user(LibBalsaCondition *cond)
         append_quoted_string(res, cond->match.string.string);
 	break;
     case CONDITION_REGEX:
-#if 0
-        /* FIXME! */
-#endif        
+        append_header_names(cond, res);
+        g_string_append_c(res, ' ');
+        append_regexs(cond, res);
 	break;
     case CONDITION_DATE:
 	if (cond->match.date.date_low) {
@@ -477,6 +556,18 @@ libbalsa_condition_to_string_user(LibBalsaCondition *cond)
     return g_string_free(res, FALSE);
 }
 
+/*
+ * libbalsa_condition_regex_new()
+ *
+ * Allocates an empty filter_regex; set its string with
+ * libbalsa_condition_regex_set().
+ */
+LibBalsaConditionRegex*
+libbalsa_condition_regex_new(void)
+{
+    return g_new0(LibBalsaConditionRegex, 1);
+}
+
 /*
  * condition_delete_regex()
  *
@@ -495,6 +586,7 @@ libbalsa_condition_regex_free(LibBalsaConditionRegex* reg, gpointer throwaway)
     g_free(reg->string);
     if (reg->compiled) 
         g_regex_unref(reg->compiled);
+    g_free(reg);
 }				/* end condition_regex_free() */
 
 void 
@@ -520,9 +612,12 @@ libbalsa_condition_unref(LibBalsaCondition* cond)
     case CONDITION_STRING:
 	g_free(cond->match.string.string);
 	g_free(cond->match.string.user_header);
+	libbalsa_utf8_needle_unref(cond->match.string.needle);
 	break;
     case CONDITION_REGEX:
-	/* FIXME: regexs_free(cond->match.regexs); */
+	regexs_free(cond->match.regex.regexs);
+	g_free(cond->match.regex.user_header);
+	break;
     case CONDITION_DATE:
     case CONDITION_FLAG:
 	/* nothing to do */
@@ -555,33 +650,6 @@ libbalsa_condition_ref(LibBalsaCondition* cond)
     return cond;
 }
 
-/* Helper to compare regexs */
-#if 0
-static gboolean
-compare_regexs(GSList * c1,GSList * c2)
-{
-    GSList *l2 = g_slist_copy(c2);
-    LibBalsaConditionRegex * r1,* r2;
-
-    for (;c1 && l2;c1 = g_slist_next(c1)) {
-	GSList * tmp;
-	r1 = c1->data;
-	for (tmp = l2;tmp;tmp = g_slist_next(tmp)) {
-	    r2 = tmp->data;
-	    if (g_ascii_strcasecmp(r1->string,r2->string)==0) {
-		l2 = g_slist_remove(l2, r2);
-		break;
-	    }
-	}
-	/* Not found */
-	if (!tmp)  break;
-    }
-    if (!l2 && !c1)
-	return TRUE;
-    g_slist_free(l2);
-    return FALSE;
-}
-#endif
 /* Helper to compare conditions, a bit obscure at first glance
    but we have to compare complex structure, so we must check
    all fields.
@@ -602,6 +670,31 @@ lbcond_compare_string_conditions(LibBalsaCondition * c1,
                                c2->match.string.string) == 0);
 }
 
+static gboolean
+lbcond_compare_regex_conditions(LibBalsaCondition * c1,
+                                LibBalsaCondition * c2)
+{
+    GSList *l1, *l2;
+
+    if (c1->match.regex.fields != c2->match.regex.fields
+        || (CONDITION_CHKMATCH(c1, CONDITION_MATCH_US_HEAD)
+            && g_ascii_strcasecmp(c1->match.regex.user_header,
+                                  c2->match.regex.user_header)))
+        return FALSE;
+
+    /* Regexs are case sensitive, and are tried in order. */
+    for (l1 = c1->match.regex.regexs, l2 = c2->match.regex.regexs;
+         l1 && l2; l1 = l1->next, l2 = l2->next) {
+        LibBalsaConditionRegex *r1 = l1->data;
+        LibBalsaConditionRegex *r2 = l2->data;
+
+        if (g_strcmp0(r1->string, r2->string) != 0)
+            return FALSE;
+    }
+
+    return l1 == NULL && l2 == NULL;
+}
+
 gboolean
 libbalsa_condition_compare(LibBalsaCondition *c1,LibBalsaCondition *c2)
 {
@@ -619,11 +712,7 @@ libbalsa_condition_compare(LibBalsaCondition *c1,LibBalsaCondition *c2)
         res = lbcond_compare_string_conditions(c1, c2);
         break;
     case CONDITION_REGEX:
-#if 0
-        if ((c2->type == CONDITION_REGEX) && FIXME!
-            compare_regexs(c1->match.regexs,c2->match.regexs))
-            OK = TRUE;
-#endif
+        res = lbcond_compare_regex_conditions(c1, c2);
         break;
     case CONDITION_DATE:
         res = (c1->match.date.date_low == c2->match.date.date_low &&
@@ -649,10 +738,6 @@ libbalsa_condition_compare(LibBalsaCondition *c1,LibBalsaCondition *c2)
     return res;
 }
 
-/* BIG FIXME : result of certain function of regex compilation are useless
- * and we should have a way to tell which regexs we were unable to compile
- * that's for later
- */
 /*
  * condition_regcomp()
  *
@@ -663,48 +748,136 @@ libbalsa_condition_compare(LibBalsaCondition *c1,LibBalsaCondition *c2)
  * Returns : TRUE if compilation went well, FALSE else
  * Position filter_errno
  */
-#if 0
 static gboolean 
 condition_regcomp(LibBalsaConditionRegex* cre)
 {
-    gint rc;
-
-    filter_errno = FILTER_NOERR;
-    if (cre->compiled) return TRUE;
+    GRegex *compiled;
+    GError *err = NULL;
 
-    cre->compiled = g_new(regex_t,1);
-    rc = regcomp(cre->compiled, cre->string, FILTER_REGCOMP);
+    if (g_atomic_pointer_get(&cre->compiled) != NULL)
+        return TRUE;
 
-    if (rc != 0) {
-	gchar errorstring[256];
-	regerror(rc, cre->compiled, errorstring, 256);
+    compiled = g_regex_new(cre->string ? cre->string : "",
+                           FILTER_REGCOMP, FILTER_REGEXEC, &err);
+    if (compiled == NULL) {
+        libbalsa_information(LIBBALSA_INFORMATION_ERROR,
+                             _("Invalid regular expression “%s”: %s"),
+                             cre->string, err->message);
+        g_error_free(err);
 	filter_errno = FILTER_EREGSYN;
 	return FALSE;
     }
+
+    /* Conditions are shared with the threads that check for and
+     * filter new mail; if one of them got here first, keep its copy. */
+    if (!g_atomic_pointer_compare_and_exchange(&cre->compiled, NULL,
+                                               compiled))
+        g_regex_unref(compiled);
+
     return TRUE;
 }				/* end condition_regcomp() */
 
+/* Guards the needles of string conditions, which are shared with the
+ * threads that check for and filter new mail; a thread matching a
+ * needle holds a reference to it, so that it outlives a replacement. */
+G_LOCK_DEFINE_STATIC(condition_needle);
+
+/*
+ * libbalsa_condition_ref_needle()
+ *
+ * Returns the prepared string of a string condition with a reference,
+ * which the caller drops with libbalsa_utf8_needle_unref(), or NULL if
+ * the string is not prepared
+ */
+LibBalsaUtf8Needle *
+libbalsa_condition_ref_needle(LibBalsaCondition * cond)
+{
+    LibBalsaUtf8Needle *needle;
+
+    G_LOCK(condition_needle);
+    needle = cond->match.string.needle;
+    if (needle != NULL)
+        libbalsa_utf8_needle_ref(needle);
+    G_UNLOCK(condition_needle);
+
+    return needle;
+}
+
+/*
+ * condition_prepare_needle()
+ *
+ * Prepares the string of a string condition for matching, unless it
+ * is already prepared
+ */
+static void
+condition_prepare_needle(LibBalsaCondition * cond)
+{
+    LibBalsaUtf8Needle *needle;
+    LibBalsaUtf8Needle *new_needle;
+
+    needle = libbalsa_condition_ref_needle(cond);
+    if (needle != NULL
+        && g_strcmp0(libbalsa_utf8_needle_get_text(needle),
+                     cond->match.string.string) == 0) {
+        libbalsa_utf8_needle_unref(needle);
+        return;
+    }
+    libbalsa_utf8_needle_unref(needle);
+
+    /* If the string has changed (the find dialog reuses its
+     * condition), nothing is matching the old needle any more; a
+     * thread still matching it keeps it alive. */
+    new_needle = libbalsa_utf8_needle_new(cond->match.string.string);
+    G_LOCK(condition_needle);
+    needle = cond->match.string.needle;
+    cond->match.string.needle = new_needle;
+    G_UNLOCK(condition_needle);
+    libbalsa_utf8_needle_unref(needle);
+}
+
 /*
  * condition_compile_regexs
  *
- * Compiles all the regexs a condition has (if of type CONDITION_REGEX)
+ * Compiles all the regexs a condition has (if of type CONDITION_REGEX),
+ * or its subconditions have (if of type CONDITION_AND or CONDITION_OR);
+ * also prepares the strings of string conditions
  *
  * Arguments:
  *    condition * cond - the condition to compile
+ * Returns : TRUE if all regexs compiled, FALSE else
  *
  * Position filter_errno (by calling condition_regcomp)
  */
-void
+gboolean
 libbalsa_condition_compile_regexs(LibBalsaCondition* cond)
 {
     GSList * regex;
+    gboolean ok = TRUE;
 
-    if (cond->type==CONDITION_REGEX)
-	for(regex=cond->match.regexs;
-            regex && condition_regcomp((LibBalsaConditionRegex*)regex->data);
-            regex=g_slist_next(regex));
+    switch (cond->type) {
+    case CONDITION_STRING:
+        condition_prepare_needle(cond);
+        break;
+    case CONDITION_REGEX:
+        /* Compile them all, to report all the errors at once. */
+	for (regex = cond->match.regex.regexs; regex;
+             regex = g_slist_next(regex))
+            ok = condition_regcomp((LibBalsaConditionRegex*) regex->data)
+                && ok;
+        break;
+    case CONDITION_AND:
+    case CONDITION_OR:
+        ok = libbalsa_condition_compile_regexs(cond->match.andor.left);
+        ok = libbalsa_condition_compile_regexs(cond->match.andor.right)
+            && ok;
+        break;
+    default:
+        break;
+    }
+
+    return ok;
 }                       /* end of condition_compile_regexs */
-#endif
+
 /* Filters */
 
 /*
@@ -770,28 +943,19 @@ libbalsa_filter_prepend_condition(LibBalsaFilter* fil, LibBalsaCondition* cond,
 gboolean
 libbalsa_filter_compile_regexs(LibBalsaFilter* fil)
 {
-#if 0
-    FIXME;
     filter_errno = FILTER_NOERR;
 
-    if (fil->cond_tree.conditions) {
-	GSList * lst;
-	for (lst = fil->cond_tree.conditions;
-             lst && filter_errno == FILTER_NOERR;
-             lst = g_slist_next(lst))
-	    libbalsa_condition_compile_regexs((LibBalsaCondition*) lst->data);
-	if (filter_errno != FILTER_NOERR) {
-	    gchar * errorstring =
-                g_strdup_printf("Unable to compile filter %s", fil->name);
-	    filter_perror(errorstring);
-	    g_free(errorstring);
-	    FILTER_CLRFLAG(fil, FILTER_VALID);
-	    return FALSE;
-	}
-	
+    if (fil->condition
+        && !libbalsa_condition_compile_regexs(fil->condition)) {
+        gchar * errorstring =
+            g_strdup_printf("Unable to compile filter %s", fil->name);
+        filter_perror(errorstring);
+        g_free(errorstring);
+        FILTER_CLRFLAG(fil, FILTER_VALID);
+        return FALSE;
     }
     FILTER_SETFLAG(fil, FILTER_COMPILED);
-#endif
+
     return TRUE;
 }                       /* end of filter_compile_regexs */
 
@@ -31,10 +31,15 @@
 #endif
 
 
-/* regex options */
-#define FILTER_REGCOMP       (REG_NEWLINE | REG_NOSUB | REG_EXTENDED)
+/* regex options; G_REGEX_OPTIMIZE lets the engine JIT-compile the
+ * pattern where it can. */
+#define FILTER_REGCOMP       (G_REGEX_MULTILINE | G_REGEX_OPTIMIZE)
 #define FILTER_REGEXEC       0
 
+/* The prepared string of a string condition, with a reference. */
+struct _LibBalsaUtf8Needle *libbalsa_condition_ref_needle(LibBalsaCondition *
+                                                          cond);
+
 /* regex struct */
 struct _LibBalsaConditionRegex {
     gchar *string;
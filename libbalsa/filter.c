@@ -93,11 +93,48 @@ void
 libbalsa_condition_prepend_regex(LibBalsaCondition* cond,
                                  LibBalsaConditionRegex * new_reg)
 {
-    g_warning("%s: fixme!\n", __func__);
-#if 0
-  cond->match.regexs =
-      g_slist_prepend(cond->match.regexs, new_reg);
-#endif
+    g_return_if_fail(cond->type == CONDITION_REGEX);
+
+    cond->match.regex.regexs =
+        g_slist_prepend(cond->match.regex.regexs, new_reg);
+}
+
+/* libbalsa_condition_match_string:
+   matches the text of one field against a string or regex condition;
+   regexs must have been compiled, and strings are best prepared, see
+   libbalsa_condition_compile_regexs().
+*/
+gboolean
+libbalsa_condition_match_string(LibBalsaCondition * cond, const gchar * str)
+{
+    GSList *list;
+
+    if (cond->type == CONDITION_STRING) {
+        LibBalsaUtf8Needle *needle = libbalsa_condition_ref_needle(cond);
+        gboolean match;
+
+        if (needle == NULL)
+            return libbalsa_utf8_strstr(str, cond->match.string.string);
+
+        match = libbalsa_utf8_needle_match(needle, str);
+        libbalsa_utf8_needle_unref(needle);
+
+        return match;
+    }
+
+    if (str == NULL)
+        return FALSE;
+
+    for (list = cond->match.regex.regexs; list; list = list->next) {
+        LibBalsaConditionRegex *reg = list->data;
+        GRegex *compiled = g_atomic_pointer_get(&reg->compiled);
+
+        /* A regex that did not compile never matches. */
+        if (compiled && g_regex_match(compiled, str, FILTER_REGEXEC, NULL))
+            return TRUE;
+    }
+
+    return FALSE;
 }
 
 gboolean
@@ -116,6 +153,7 @@ libbalsa_condition_matches(LibBalsaCondition* cond,
 
     switch (cond->type) {
     case CONDITION_STRING:
+    case CONDITION_REGEX:
         will_ref =
             (CONDITION_CHKMATCH(cond,CONDITION_MATCH_CC) ||
              CONDITION_CHKMATCH(cond,CONDITION_MATCH_BODY));
@@ -132,26 +170,26 @@ libbalsa_condition_matches(LibBalsaCondition* cond,
         /* do the work */
 	if (CONDITION_CHKMATCH(cond,CONDITION_MATCH_TO) && headers->to_list != NULL) {
             str = internet_address_list_to_string(headers->to_list, NULL, FALSE);
-	    match = libbalsa_utf8_strstr(str,cond->match.string.string);
+	    match = libbalsa_condition_match_string(cond, str);
 	    g_free(str);
             if(match) break;
 	}
 	if (CONDITION_CHKMATCH(cond,CONDITION_MATCH_FROM) && headers->from != NULL) {
             str = internet_address_list_to_string(headers->from, NULL, FALSE);
-	    match=libbalsa_utf8_strstr(str,cond->match.string.string);
+	    match=libbalsa_condition_match_string(cond, str);
 	    g_free(str);
 	    if (match) break;
 	}
 	if (CONDITION_CHKMATCH(cond,CONDITION_MATCH_SUBJECT)) {
-	    if (libbalsa_utf8_strstr(LIBBALSA_MESSAGE_GET_SUBJECT(message),
-                                     cond->match.string.string)) {
+	    if (libbalsa_condition_match_string
+                (cond, LIBBALSA_MESSAGE_GET_SUBJECT(message))) {
                 match = TRUE;
                 break;
             }
 	}
 	if (CONDITION_CHKMATCH(cond,CONDITION_MATCH_CC) && headers->cc_list != NULL) {
             str = internet_address_list_to_string(headers->cc_list, NULL, FALSE);
-	    match=libbalsa_utf8_strstr(str,cond->match.string.string);
+	    match=libbalsa_condition_match_string(cond, str);
 	    g_free(str);
 	    if (match) break;
 	}
@@ -162,8 +200,7 @@ libbalsa_condition_matches(LibBalsaCondition* cond,
                                                      cond->match.string.
                                                      user_header);
 
-                if (libbalsa_utf8_strstr(header,
-                                         cond->match.string.string)) {
+                if (libbalsa_condition_match_string(cond, header)) {
                     match = TRUE;
                     break;
                 }
@@ -176,15 +213,12 @@ libbalsa_condition_matches(LibBalsaCondition* cond,
                                  NULL, 0, FALSE, FALSE);
 	    if (body) {
 		if (body->str)
-                    match = libbalsa_utf8_strstr(body->str,
-                                                 cond->match.string.string);
+                    match = libbalsa_condition_match_string(cond, body->str);
 		g_string_free(body,TRUE);
 	    }
 	}
         if(will_ref) libbalsa_message_body_unref(message);
 	break;
-    case CONDITION_REGEX:
-        break;
     case CONDITION_DATE:
         match = headers->date >= cond->match.date.date_low
 	       && (cond->match.date.date_high==0 ||
@@ -225,8 +259,10 @@ filters_prepare_to_run(GSList * filters)
                                      _("Invalid filter: %s"),fil->name);
 	    ok=FALSE;
 	}
-	else if (!FILTER_CHKFLAG(fil,FILTER_COMPILED))
-	    ok=libbalsa_filter_compile_regexs(fil);
+	/* Compiling is a no-op for regexs that are already compiled, so
+	 * we do not rely on FILTER_COMPILED. */
+	else if (!libbalsa_filter_compile_regexs(fil))
+	    ok=FALSE;
     }
 
     return ok;
@@ -365,6 +401,7 @@ libbalsa_condition_can_match(LibBalsaCondition * cond,
 
     switch (cond->type) {
     case CONDITION_STRING:
+    case CONDITION_REGEX:
 	return !(CONDITION_CHKMATCH(cond, CONDITION_MATCH_BODY)
 		 && libbalsa_message_get_body_list(message) == NULL)
 	    && !(CONDITION_CHKMATCH(cond, CONDITION_MATCH_US_HEAD)
@@ -81,12 +81,18 @@ struct _LibBalsaCondition {
                                   * we make the match if fields
                                   * includes
                                   * CONDITION_MATCH_US_HEAD. */
+            struct _LibBalsaUtf8Needle *needle; /* string, prepared
+                                  * for matching. */
         } string;
-        /* CONDITION_REGEX */
+        /* CONDITION_REGEX; the layout matches CONDITION_STRING, so
+         * that fields and user_header can be reached through either. */
         struct {
             unsigned fields;     /* Contains the header list for
                                   * that this search should look in. */
-            /* GSList * regexs; */
+            GSList * regexs;     /* List of LibBalsaConditionRegex; the
+                                  * condition matches when any of them
+                                  * matches. */
+            gchar * user_header; /* As for CONDITION_STRING. */
         } regex;
         /* CONDITION_DATE */
 	struct {
@@ -114,6 +120,10 @@ LibBalsaCondition* libbalsa_condition_new_string(gboolean negated,
                                                  unsigned headers,
                                                  gchar *str,
                                                  gchar *user_header);
+LibBalsaCondition* libbalsa_condition_new_regex(gboolean negated,
+                                                unsigned headers,
+                                                GSList *regexs,
+                                                gchar *user_header);
 LibBalsaCondition* libbalsa_condition_new_date(gboolean negated,
                                                time_t *from, time_t *to);
 LibBalsaCondition* libbalsa_condition_new_bool_ptr(gboolean negated,
@@ -214,6 +224,11 @@ const gchar* libbalsa_condition_regex_get(LibBalsaConditionRegex * reg);
 void libbalsa_condition_prepend_regex(LibBalsaCondition* cond,
                                       LibBalsaConditionRegex *new_reg);
 
+/** libbalsa_condition_match_string() checks whether the text of one
+ * field matches a string or regex condition. */
+gboolean libbalsa_condition_match_string(LibBalsaCondition *cond,
+                                         const gchar *str);
+
 /** libbalsa_condition_matches() checks whether given message matches the 
  * condition. */
 gboolean libbalsa_condition_matches(LibBalsaCondition* cond,
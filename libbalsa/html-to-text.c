@@ -0,0 +1,1113 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ *
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include "html-to-text.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Text is laid out when markup follows it, or when this much of it
+ * ends in white space. */
+#define LBH2T_MAX_RUN   4096
+/* Longer tags are read to their end, but only this much is kept. */
+#define LBH2T_MAX_TAG   8192
+#define LBH2T_RULE      "----------------------------------------"
+
+typedef enum {
+    LBH2T_TEXT,
+    LBH2T_LT,                   /* after '<' */
+    LBH2T_TAG,
+    LBH2T_DECL,                 /* <!...> or <?...> */
+    LBH2T_COMMENT
+} LibBalsaHtmlToTextState;
+
+struct _LibBalsaHtmlToText {
+    GMimeFilter parent_object;
+
+    /* Reading the markup. */
+    LibBalsaHtmlToTextState state;
+    gchar quote;                /* of the attribute value being read */
+    guint dashes;               /* ending the comment being read */
+    GString *run;               /* text not laid out yet */
+    GString *tag;               /* the tag being read, without <> */
+    const gchar *raw_end;       /* in a script or style: its name */
+    gchar *charset;             /* from a <meta> element */
+
+    /* Laying out the text. */
+    GString *out;
+    gboolean written;           /* something has been written */
+    gboolean line_start;        /* nothing on the current line yet */
+    gboolean space;             /* white space before the next word */
+    guint newlines;             /* to end the current line with */
+    guint blank_depth;          /* of the quote at the blank lines */
+    guint quote_depth;
+    guint pre;
+    gboolean pre_start;         /* a newline here is dropped */
+    guint skip;                 /* in the title, a script or a style */
+    GArray *lists;              /* -1 for <ul>, the next number for <ol> */
+    guint cells;                /* in the current table row */
+    gchar *href;                /* of the current link */
+    GString *link_text;
+};
+
+typedef struct {
+    GMimeFilterClass parent_class;
+} LibBalsaHtmlToTextClass;
+
+G_DEFINE_TYPE(LibBalsaHtmlToText, libbalsa_html_to_text, GMIME_TYPE_FILTER)
+
+/*
+ * Entities and charsets
+ */
+
+typedef struct {
+    const gchar *name;
+    gunichar c;
+} LibBalsaHtmlToTextEntity;
+
+/* The entities of HTML 4, and &apos;, sorted for bsearch(). */
+static const LibBalsaHtmlToTextEntity lbh2t_entities[] = {
+    {"AElig", 0x00C6}, {"Aacute", 0x00C1}, {"Acirc", 0x00C2},
+    {"Agrave", 0x00C0}, {"Alpha", 0x0391}, {"Aring", 0x00C5},
+    {"Atilde", 0x00C3}, {"Auml", 0x00C4}, {"Beta", 0x0392},
+    {"Ccedil", 0x00C7}, {"Chi", 0x03A7}, {"Dagger", 0x2021},
+    {"Delta", 0x0394}, {"ETH", 0x00D0}, {"Eacute", 0x00C9},
+    {"Ecirc", 0x00CA}, {"Egrave", 0x00C8}, {"Epsilon", 0x0395},
+    {"Eta", 0x0397}, {"Euml", 0x00CB}, {"Gamma", 0x0393},
+    {"Iacute", 0x00CD}, {"Icirc", 0x00CE}, {"Igrave", 0x00CC},
+    {"Iota", 0x0399}, {"Iuml", 0x00CF}, {"Kappa", 0x039A},
+    {"Lambda", 0x039B}, {"Mu", 0x039C}, {"Ntilde", 0x00D1}, {"Nu", 0x039D},
+    {"OElig", 0x0152}, {"Oacute", 0x00D3}, {"Ocirc", 0x00D4},
+    {"Ograve", 0x00D2}, {"Omega", 0x03A9}, {"Omicron", 0x039F},
+    {"Oslash", 0x00D8}, {"Otilde", 0x00D5}, {"Ouml", 0x00D6},
+    {"Phi", 0x03A6}, {"Pi", 0x03A0}, {"Prime", 0x2033}, {"Psi", 0x03A8},
+    {"Rho", 0x03A1}, {"Scaron", 0x0160}, {"Sigma", 0x03A3},
+    {"THORN", 0x00DE}, {"Tau", 0x03A4}, {"Theta", 0x0398},
+    {"Uacute", 0x00DA}, {"Ucirc", 0x00DB}, {"Ugrave", 0x00D9},
+    {"Upsilon", 0x03A5}, {"Uuml", 0x00DC}, {"Xi", 0x039E},
+    {"Yacute", 0x00DD}, {"Yuml", 0x0178}, {"Zeta", 0x0396},
+    {"aacute", 0x00E1}, {"acirc", 0x00E2}, {"acute", 0x00B4},
+    {"aelig", 0x00E6}, {"agrave", 0x00E0}, {"alefsym", 0x2135},
+    {"alpha", 0x03B1}, {"amp", 0x0026}, {"and", 0x2227}, {"ang", 0x2220},
+    {"apos", 0x0027}, {"aring", 0x00E5}, {"asymp", 0x2248},
+    {"atilde", 0x00E3}, {"auml", 0x00E4}, {"bdquo", 0x201E},
+    {"beta", 0x03B2}, {"brvbar", 0x00A6}, {"bull", 0x2022}, {"cap", 0x2229},
+    {"ccedil", 0x00E7}, {"cedil", 0x00B8}, {"cent", 0x00A2},
+    {"chi", 0x03C7}, {"circ", 0x02C6}, {"clubs", 0x2663}, {"cong", 0x2245},
+    {"copy", 0x00A9}, {"crarr", 0x21B5}, {"cup", 0x222A},
+    {"curren", 0x00A4}, {"dArr", 0x21D3}, {"dagger", 0x2020},
+    {"darr", 0x2193}, {"deg", 0x00B0}, {"delta", 0x03B4}, {"diams", 0x2666},
+    {"divide", 0x00F7}, {"eacute", 0x00E9}, {"ecirc", 0x00EA},
+    {"egrave", 0x00E8}, {"empty", 0x2205}, {"emsp", 0x2003},
+    {"ensp", 0x2002}, {"epsilon", 0x03B5}, {"equiv", 0x2261},
+    {"eta", 0x03B7}, {"eth", 0x00F0}, {"euml", 0x00EB}, {"euro", 0x20AC},
+    {"exist", 0x2203}, {"fnof", 0x0192}, {"forall", 0x2200},
+    {"frac12", 0x00BD}, {"frac14", 0x00BC}, {"frac34", 0x00BE},
+    {"frasl", 0x2044}, {"gamma", 0x03B3}, {"ge", 0x2265}, {"gt", 0x003E},
+    {"hArr", 0x21D4}, {"harr", 0x2194}, {"hearts", 0x2665},
+    {"hellip", 0x2026}, {"iacute", 0x00ED}, {"icirc", 0x00EE},
+    {"iexcl", 0x00A1}, {"igrave", 0x00EC}, {"image", 0x2111},
+    {"infin", 0x221E}, {"int", 0x222B}, {"iota", 0x03B9},
+    {"iquest", 0x00BF}, {"isin", 0x2208}, {"iuml", 0x00EF},
+    {"kappa", 0x03BA}, {"lArr", 0x21D0}, {"lambda", 0x03BB},
+    {"lang", 0x2329}, {"laquo", 0x00AB}, {"larr", 0x2190},
+    {"lceil", 0x2308}, {"ldquo", 0x201C}, {"le", 0x2264},
+    {"lfloor", 0x230A}, {"lowast", 0x2217}, {"loz", 0x25CA},
+    {"lrm", 0x200E}, {"lsaquo", 0x2039}, {"lsquo", 0x2018}, {"lt", 0x003C},
+    {"macr", 0x00AF}, {"mdash", 0x2014}, {"micro", 0x00B5},
+    {"middot", 0x00B7}, {"minus", 0x2212}, {"mu", 0x03BC},
+    {"nabla", 0x2207}, {"nbsp", 0x00A0}, {"ndash", 0x2013}, {"ne", 0x2260},
+    {"ni", 0x220B}, {"not", 0x00AC}, {"notin", 0x2209}, {"nsub", 0x2284},
+    {"ntilde", 0x00F1}, {"nu", 0x03BD}, {"oacute", 0x00F3},
+    {"ocirc", 0x00F4}, {"oelig", 0x0153}, {"ograve", 0x00F2},
+    {"oline", 0x203E}, {"omega", 0x03C9}, {"omicron", 0x03BF},
+    {"oplus", 0x2295}, {"or", 0x2228}, {"ordf", 0x00AA}, {"ordm", 0x00BA},
+    {"oslash", 0x00F8}, {"otilde", 0x00F5}, {"otimes", 0x2297},
+    {"ouml", 0x00F6}, {"para", 0x00B6}, {"part", 0x2202},
+    {"permil", 0x2030}, {"perp", 0x22A5}, {"phi", 0x03C6}, {"pi", 0x03C0},
+    {"piv", 0x03D6}, {"plusmn", 0x00B1}, {"pound", 0x00A3},
+    {"prime", 0x2032}, {"prod", 0x220F}, {"prop", 0x221D}, {"psi", 0x03C8},
+    {"quot", 0x0022}, {"rArr", 0x21D2}, {"radic", 0x221A}, {"rang", 0x232A},
+    {"raquo", 0x00BB}, {"rarr", 0x2192}, {"rceil", 0x2309},
+    {"rdquo", 0x201D}, {"real", 0x211C}, {"reg", 0x00AE},
+    {"rfloor", 0x230B}, {"rho", 0x03C1}, {"rlm", 0x200F},
+    {"rsaquo", 0x203A}, {"rsquo", 0x2019}, {"sbquo", 0x201A},
+    {"scaron", 0x0161}, {"sdot", 0x22C5}, {"sect", 0x00A7}, {"shy", 0x00AD},
+    {"sigma", 0x03C3}, {"sigmaf", 0x03C2}, {"sim", 0x223C},
+    {"spades", 0x2660}, {"sub", 0x2282}, {"sube", 0x2286}, {"sum", 0x2211},
+    {"sup", 0x2283}, {"sup1", 0x00B9}, {"sup2", 0x00B2}, {"sup3", 0x00B3},
+    {"supe", 0x2287}, {"szlig", 0x00DF}, {"tau", 0x03C4},
+    {"there4", 0x2234}, {"theta", 0x03B8}, {"thetasym", 0x03D1},
+    {"thinsp", 0x2009}, {"thorn", 0x00FE}, {"tilde", 0x02DC},
+    {"times", 0x00D7}, {"trade", 0x2122}, {"uArr", 0x21D1},
+    {"uacute", 0x00FA}, {"uarr", 0x2191}, {"ucirc", 0x00FB},
+    {"ugrave", 0x00F9}, {"uml", 0x00A8}, {"upsih", 0x03D2},
+    {"upsilon", 0x03C5}, {"uuml", 0x00FC}, {"weierp", 0x2118},
+    {"xi", 0x03BE}, {"yacute", 0x00FD}, {"yen", 0x00A5}, {"yuml", 0x00FF},
+    {"zeta", 0x03B6}, {"zwj", 0x200D}, {"zwnj", 0x200C}
+};
+
+/* Numeric references to 0x80-0x9f mean the Windows-1252 characters. */
+static const gunichar lbh2t_windows_1252[32] = {
+    0x20AC, 0xFFFD, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+    0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0xFFFD, 0x017D, 0xFFFD,
+    0xFFFD, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+    0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0xFFFD, 0x017E, 0x0178
+};
+
+static gint
+lbh2t_entity_cmp(gconstpointer a, gconstpointer b)
+{
+    const gchar *name = a;
+    const LibBalsaHtmlToTextEntity *entity = b;
+
+    return strcmp(name, entity->name);
+}
+
+/* Append str with its character references decoded. */
+static void
+lbh2t_decode(GString * res, const gchar * str, gsize len)
+{
+    const gchar *end = str + len;
+
+    while (str < end) {
+        const gchar *amp = memchr(str, '&', end - str);
+        const gchar *p;
+        gunichar c = 0;
+
+        if (amp == NULL) {
+            g_string_append_len(res, str, end - str);
+            break;
+        }
+        g_string_append_len(res, str, amp - str);
+        str = amp + 1;
+        p = str;
+
+        if (p < end && *p == '#') {
+            gboolean hex = ++p < end && (*p == 'x' || *p == 'X');
+            const gchar *digits;
+
+            if (hex)
+                ++p;
+            digits = p;
+            while (p < end
+                   && (hex ? g_ascii_isxdigit(*p) : g_ascii_isdigit(*p))) {
+                if (c <= 0x10FFFF)
+                    c = c * (hex ? 16 : 10)
+                        + (hex ? g_ascii_xdigit_value(*p) : *p - '0');
+                ++p;
+            }
+            if (p == digits) {
+                g_string_append_c(res, '&');
+                continue;
+            }
+            if (c >= 0x80 && c <= 0x9F)
+                c = lbh2t_windows_1252[c - 0x80];
+            else if (c == 0 || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF))
+                c = 0xFFFD;
+        } else {
+            gchar name[16];
+            gsize n = 0;
+            const LibBalsaHtmlToTextEntity *entity = NULL;
+
+            while (p < end && g_ascii_isalnum(*p) && n < sizeof name - 1)
+                name[n++] = *p++;
+            name[n] = '\0';
+            if (n > 0)
+                entity = bsearch(name, lbh2t_entities,
+                                 G_N_ELEMENTS(lbh2t_entities),
+                                 sizeof lbh2t_entities[0],
+                                 lbh2t_entity_cmp);
+            if (entity == NULL) {
+                g_string_append_c(res, '&');
+                continue;
+            }
+            c = entity->c;
+        }
+
+        if (p < end && *p == ';')
+            ++p;
+        g_string_append_unichar(res, c);
+        str = p;
+    }
+}
+
+/* Replace what is still not UTF-8. */
+static gchar *
+lbh2t_make_valid(const gchar * str, gsize len)
+{
+    GString *res = g_string_sized_new(len);
+    const gchar *end = str + len;
+    const gchar *bad;
+
+    while (!g_utf8_validate(str, end - str, &bad)) {
+        g_string_append_len(res, str, bad - str);
+        g_string_append(res, "\xEF\xBF\xBD");
+        str = bad + 1;
+    }
+    g_string_append_len(res, str, end - str);
+
+    return g_string_free(res, FALSE);
+}
+
+/* The UTF-8 text of len bytes of the input. */
+static gchar *
+lbh2t_utf8(LibBalsaHtmlToText * self, const gchar * str, gsize len)
+{
+    gchar *res;
+
+    if (g_utf8_validate(str, len, NULL))
+        return g_strndup(str, len);
+
+    res = NULL;
+    if (self->charset != NULL
+        && g_ascii_strcasecmp(self->charset, "utf-8") != 0)
+        res = g_convert(str, len, "UTF-8", self->charset, NULL, NULL,
+                        NULL);
+    if (res == NULL)
+        res = g_convert(str, len, "UTF-8", "WINDOWS-1252", NULL, NULL,
+                        NULL);
+
+    return res != NULL ? res : lbh2t_make_valid(str, len);
+}
+
+/*
+ * Laying out the text
+ */
+
+static void
+lbh2t_append(LibBalsaHtmlToText * self, const gchar * str, gsize len)
+{
+    g_string_append_len(self->out, str, len);
+    if (self->link_text != NULL)
+        g_string_append_len(self->link_text, str, len);
+}
+
+static void
+lbh2t_prefix(LibBalsaHtmlToText * self, guint depth, gboolean blank)
+{
+    guint i;
+
+    for (i = 0; i < depth; i++)
+        g_string_append(self->out, blank && i == depth - 1 ? ">" : "> ");
+    if (!blank && self->lists->len > 1)
+        for (i = 1; i < self->lists->len; i++)
+            g_string_append(self->out, "  ");
+}
+
+/* End the current line, followed by blank lines as needed. */
+static void
+lbh2t_end_lines(LibBalsaHtmlToText * self)
+{
+    guint depth = MIN(self->blank_depth, self->quote_depth);
+    guint n = self->newlines;
+
+    if (!self->line_start)
+        g_string_append_c(self->out, '\n');
+    while (--n > 0) {
+        lbh2t_prefix(self, depth, TRUE);
+        g_string_append_c(self->out, '\n');
+    }
+
+    self->newlines = 0;
+    self->line_start = TRUE;
+    self->space = FALSE;
+}
+
+static void
+lbh2t_put(LibBalsaHtmlToText * self, const gchar * str, gsize len)
+{
+    if (len == 0)
+        return;
+
+    if (self->newlines > 0) {
+        if (self->written)
+            lbh2t_end_lines(self);
+        else
+            self->newlines = 0;
+    }
+
+    if (self->line_start) {
+        lbh2t_prefix(self, self->quote_depth, FALSE);
+        self->line_start = FALSE;
+    } else if (self->space)
+        lbh2t_append(self, " ", 1);
+    self->space = FALSE;
+
+    lbh2t_append(self, str, len);
+    self->written = TRUE;
+}
+
+/* Make sure that the next text starts on a new line, after n - 1 blank
+ * lines. */
+static void
+lbh2t_block(LibBalsaHtmlToText * self, guint n)
+{
+    if (!self->written)
+        return;
+
+    if (self->newlines == 0)
+        self->blank_depth = self->quote_depth;
+    else
+        self->blank_depth = MIN(self->blank_depth, self->quote_depth);
+    self->newlines = MAX(self->newlines, n);
+    self->space = FALSE;
+}
+
+static void
+lbh2t_break(LibBalsaHtmlToText * self)
+{
+    if (self->written)
+        lbh2t_block(self, MIN(self->newlines + 1, 3));
+}
+
+static void
+lbh2t_pre_newline(LibBalsaHtmlToText * self)
+{
+    if (!self->written)
+        return;
+
+    if (self->newlines > 0)
+        lbh2t_end_lines(self);
+    if (self->line_start)
+        lbh2t_prefix(self, self->quote_depth, TRUE);
+    g_string_append_c(self->out, '\n');
+    self->line_start = TRUE;
+}
+
+/* Lay out text, with its references decoded already. */
+static void
+lbh2t_text(LibBalsaHtmlToText * self, const gchar * text, gsize len)
+{
+    const gchar *end = text + len;
+
+    if (self->pre > 0) {
+        while (text < end) {
+            const gchar *newline = memchr(text, '\n', end - text);
+            const gchar *line_end = newline != NULL ? newline : end;
+
+            if (line_end > text && line_end[-1] == '\r')
+                --line_end;
+            if (line_end > text)
+                self->pre_start = FALSE;
+            lbh2t_put(self, text, line_end - text);
+            if (newline == NULL)
+                break;
+            if (!self->pre_start)
+                lbh2t_pre_newline(self);
+            self->pre_start = FALSE;
+            text = newline + 1;
+        }
+        return;
+    }
+
+    while (text < end) {
+        const gchar *word = text;
+
+        /* A no-break space is kept, as a space. */
+        while (text < end && !g_ascii_isspace(*text)
+               && !(*text == '\xC2' && text + 1 < end
+                    && text[1] == '\xA0'))
+            ++text;
+        lbh2t_put(self, word, text - word);
+
+        if (text < end && *text == '\xC2') {
+            lbh2t_put(self, " ", 1);
+            text += 2;
+        } else if (text < end) {
+            if (!self->line_start)
+                self->space = TRUE;
+            ++text;
+        }
+    }
+}
+
+static void
+lbh2t_flush(LibBalsaHtmlToText * self)
+{
+    gchar *utf8;
+    GString *text;
+
+    if (self->run->len == 0)
+        return;
+
+    if (self->skip > 0) {
+        g_string_truncate(self->run, 0);
+        return;
+    }
+
+    utf8 = lbh2t_utf8(self, self->run->str, self->run->len);
+    g_string_truncate(self->run, 0);
+    text = g_string_sized_new(strlen(utf8));
+    lbh2t_decode(text, utf8, strlen(utf8));
+    g_free(utf8);
+    lbh2t_text(self, text->str, text->len);
+    g_string_free(text, TRUE);
+}
+
+/*
+ * Elements
+ */
+
+/* The value of an attribute in the tag, after its name, or NULL. */
+static gchar *
+lbh2t_attr(LibBalsaHtmlToText * self, const gchar * attrs,
+           const gchar * name)
+{
+    const gchar *p = attrs;
+
+    for (;;) {
+        const gchar *attr_name, *value = NULL;
+        gsize name_len, value_len = 0;
+
+        while (g_ascii_isspace(*p) || *p == '/')
+            ++p;
+        if (*p == '\0')
+            return NULL;
+
+        attr_name = p;
+        while (*p != '\0' && !g_ascii_isspace(*p) && *p != '='
+               && *p != '/')
+            ++p;
+        name_len = p - attr_name;
+        while (g_ascii_isspace(*p))
+            ++p;
+
+        if (*p == '=') {
+            ++p;
+            while (g_ascii_isspace(*p))
+                ++p;
+            if (*p == '"' || *p == '\'') {
+                const gchar *close = strchr(p + 1, *p);
+
+                value = p + 1;
+                value_len = close != NULL ? (gsize) (close - value)
+                    : strlen(value);
+                p = value + value_len + (close != NULL);
+            } else {
+                value = p;
+                while (*p != '\0' && !g_ascii_isspace(*p))
+                    ++p;
+                value_len = p - value;
+            }
+        }
+
+        if (name_len == strlen(name)
+            && g_ascii_strncasecmp(attr_name, name, name_len) == 0) {
+            gchar *utf8;
+            GString *res;
+
+            if (value == NULL)
+                return g_strdup("");
+            utf8 = lbh2t_utf8(self, value, value_len);
+            res = g_string_sized_new(value_len);
+            lbh2t_decode(res, utf8, strlen(utf8));
+            g_free(utf8);
+
+            return g_strstrip(g_string_free(res, FALSE));
+        }
+    }
+}
+
+static void
+lbh2t_meta(LibBalsaHtmlToText * self, const gchar * attrs)
+{
+    gchar *charset;
+
+    if (self->charset != NULL)
+        return;
+
+    charset = lbh2t_attr(self, attrs, "charset");
+    if (charset == NULL) {
+        gchar *content = lbh2t_attr(self, attrs, "content");
+
+        if (content != NULL) {
+            gchar *lower = g_ascii_strdown(content, -1);
+            const gchar *p = strstr(lower, "charset=");
+
+            if (p != NULL) {
+                p = content + (p - lower) + strlen("charset=");
+                p += strspn(p, "\"' ");
+                charset = g_strndup(p, strcspn(p, "\"'; "));
+            }
+            g_free(lower);
+        }
+        g_free(content);
+    }
+
+    if (charset != NULL && *charset != '\0')
+        self->charset = charset;
+    else
+        g_free(charset);
+}
+
+/* The part of a link that its text may show. */
+static const gchar *
+lbh2t_link_skip_scheme(const gchar * link, gsize * len)
+{
+    static const gchar *const schemes[] =
+        { "mailto:", "http://", "https://" };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(schemes); i++) {
+        gsize n = strlen(schemes[i]);
+
+        if (g_ascii_strncasecmp(link, schemes[i], n) == 0) {
+            link += n;
+            break;
+        }
+    }
+    *len = strlen(link);
+    if (*len > 0 && link[*len - 1] == '/')
+        --*len;
+
+    return link;
+}
+
+/* Whether the text of a link shows where it leads. */
+static gboolean
+lbh2t_same_link(const gchar * text, const gchar * url)
+{
+    gsize text_len, url_len;
+
+    text = lbh2t_link_skip_scheme(text, &text_len);
+    url = lbh2t_link_skip_scheme(url, &url_len);
+
+    return text_len == url_len
+        && g_ascii_strncasecmp(text, url, url_len) == 0;
+}
+
+static void
+lbh2t_link_end(LibBalsaHtmlToText * self)
+{
+    gchar *text, *target;
+    const gchar *url;
+
+    if (self->link_text == NULL)
+        return;
+
+    text = g_strstrip(g_string_free(self->link_text, FALSE));
+    self->link_text = NULL;
+    url = self->href;
+
+    if (url != NULL && *url != '\0' && *url != '#'
+        && g_ascii_strncasecmp(url, "javascript:", 11) != 0) {
+        const gchar *shown = url;
+
+        if (g_ascii_strncasecmp(shown, "mailto:", 7) == 0)
+            shown += 7;
+        if (!lbh2t_same_link(text, url)) {
+            target = g_strconcat("<", shown, ">", NULL);
+            if (*text != '\0')
+                self->space = TRUE;
+            lbh2t_put(self, target, strlen(target));
+            g_free(target);
+        }
+    }
+
+    g_free(text);
+    g_free(self->href);
+    self->href = NULL;
+}
+
+static void
+lbh2t_list_item(LibBalsaHtmlToText * self)
+{
+    gint *number;
+    gchar *marker;
+
+    lbh2t_block(self, 1);
+    if (self->lists->len == 0) {
+        lbh2t_put(self, "*", 1);
+    } else if (*(number =
+                 &g_array_index(self->lists, gint,
+                                self->lists->len - 1)) < 0) {
+        lbh2t_put(self, "*", 1);
+    } else {
+        marker = g_strdup_printf("%d.", (*number)++);
+        lbh2t_put(self, marker, strlen(marker));
+        g_free(marker);
+    }
+    self->space = TRUE;
+}
+
+static gboolean
+lbh2t_is_list(const gchar * name)
+{
+    return strcmp(name, "ul") == 0 || strcmp(name, "ol") == 0
+        || strcmp(name, "dir") == 0 || strcmp(name, "menu") == 0;
+}
+
+typedef struct {
+    const gchar *name;
+    guint newlines;
+} LibBalsaHtmlToTextBlock;
+
+/* The block elements, sorted for bsearch(), and the newlines before and
+ * after them. */
+static const LibBalsaHtmlToTextBlock lbh2t_blocks[] = {
+    {"address", 2}, {"article", 2}, {"aside", 2}, {"blockquote", 2},
+    {"body", 1}, {"caption", 1}, {"center", 1}, {"dd", 1}, {"details", 1},
+    {"dialog", 2}, {"dir", 2}, {"div", 1}, {"dl", 2}, {"dt", 1},
+    {"fieldset", 2}, {"figcaption", 1}, {"figure", 2}, {"footer", 1},
+    {"form", 1}, {"h1", 2}, {"h2", 2}, {"h3", 2}, {"h4", 2}, {"h5", 2},
+    {"h6", 2}, {"header", 1}, {"hr", 2}, {"li", 1}, {"main", 1},
+    {"menu", 2}, {"nav", 1}, {"ol", 2}, {"p", 2}, {"pre", 2},
+    {"section", 2}, {"summary", 1}, {"table", 2}, {"tr", 1}, {"ul", 2}
+};
+
+static gint
+lbh2t_block_cmp(gconstpointer a, gconstpointer b)
+{
+    const gchar *name = a;
+    const LibBalsaHtmlToTextBlock *block = b;
+
+    return strcmp(name, block->name);
+}
+
+static void
+lbh2t_start_tag(LibBalsaHtmlToText * self, const gchar * name,
+                const gchar * attrs, gboolean empty)
+{
+    const LibBalsaHtmlToTextBlock *block;
+
+    if (strcmp(name, "script") == 0 || strcmp(name, "style") == 0) {
+        if (!empty) {
+            self->raw_end = name[1] == 'c' ? "script" : "style";
+            self->skip++;
+        }
+        return;
+    }
+    if (strcmp(name, "title") == 0 || strcmp(name, "template") == 0) {
+        if (!empty)
+            self->skip++;
+        return;
+    }
+    if (strcmp(name, "meta") == 0) {
+        lbh2t_meta(self, attrs);
+        return;
+    }
+    if (self->skip > 0)
+        return;
+
+    block = bsearch(name, lbh2t_blocks, G_N_ELEMENTS(lbh2t_blocks),
+                    sizeof lbh2t_blocks[0], lbh2t_block_cmp);
+    if (block != NULL) {
+        /* A nested list follows its item without a blank line. */
+        if (lbh2t_is_list(name) && self->lists->len > 0)
+            lbh2t_block(self, 1);
+        else if (strcmp(name, "li") != 0)
+            lbh2t_block(self, block->newlines);
+    }
+
+    if (strcmp(name, "br") == 0) {
+        lbh2t_break(self);
+    } else if (strcmp(name, "hr") == 0) {
+        lbh2t_put(self, LBH2T_RULE, strlen(LBH2T_RULE));
+        lbh2t_block(self, 2);
+    } else if (strcmp(name, "li") == 0) {
+        lbh2t_list_item(self);
+    } else if (strcmp(name, "ul") == 0 || strcmp(name, "dir") == 0
+               || strcmp(name, "menu") == 0) {
+        gint number = -1;
+
+        g_array_append_val(self->lists, number);
+    } else if (strcmp(name, "ol") == 0) {
+        gchar *start = lbh2t_attr(self, attrs, "start");
+        gint number = start != NULL ? atoi(start) : 1;
+
+        g_array_append_val(self->lists, number);
+        g_free(start);
+    } else if (strcmp(name, "blockquote") == 0) {
+        self->quote_depth++;
+    } else if (strcmp(name, "pre") == 0) {
+        self->pre++;
+        self->pre_start = TRUE;
+    } else if (strcmp(name, "tr") == 0) {
+        self->cells = 0;
+    } else if (strcmp(name, "td") == 0 || strcmp(name, "th") == 0) {
+        if (self->cells++ > 0 && self->newlines == 0)
+            self->space = TRUE;
+    } else if (strcmp(name, "a") == 0) {
+        lbh2t_link_end(self);
+        self->href = lbh2t_attr(self, attrs, "href");
+        if (self->href != NULL)
+            self->link_text = g_string_new(NULL);
+    } else if (strcmp(name, "img") == 0) {
+        gchar *alt = lbh2t_attr(self, attrs, "alt");
+
+        if (alt != NULL)
+            lbh2t_text(self, alt, strlen(alt));
+        g_free(alt);
+    }
+}
+
+static void
+lbh2t_end_tag(LibBalsaHtmlToText * self, const gchar * name)
+{
+    const LibBalsaHtmlToTextBlock *block;
+
+    if (strcmp(name, "title") == 0 || strcmp(name, "template") == 0
+        || strcmp(name, "script") == 0 || strcmp(name, "style") == 0) {
+        if (self->skip > 0)
+            self->skip--;
+        return;
+    }
+    if (self->skip > 0)
+        return;
+
+    if (lbh2t_is_list(name)) {
+        if (self->lists->len > 0)
+            g_array_set_size(self->lists, self->lists->len - 1);
+    } else if (strcmp(name, "blockquote") == 0) {
+        if (self->quote_depth > 0)
+            self->quote_depth--;
+    } else if (strcmp(name, "pre") == 0) {
+        if (self->pre > 0)
+            self->pre--;
+    } else if (strcmp(name, "a") == 0) {
+        lbh2t_link_end(self);
+    } else if (strcmp(name, "p") == 0 && !self->written) {
+        /* </p> without <p> is a paragraph. */
+        return;
+    }
+
+    block = bsearch(name, lbh2t_blocks, G_N_ELEMENTS(lbh2t_blocks),
+                    sizeof lbh2t_blocks[0], lbh2t_block_cmp);
+    if (block != NULL)
+        lbh2t_block(self, lbh2t_is_list(name) && self->lists->len > 0
+                    ? 1 : block->newlines);
+}
+
+static void
+lbh2t_tag(LibBalsaHtmlToText * self)
+{
+    const gchar *p = self->tag->str;
+    gboolean end = *p == '/';
+    gchar name[16];
+    gsize n = 0;
+    gsize len;
+
+    if (end)
+        ++p;
+    while (g_ascii_isalnum(*p) || *p == '-' || *p == ':') {
+        if (n < sizeof name - 1)
+            name[n] = g_ascii_tolower(*p);
+        ++n;
+        ++p;
+    }
+    if (n == 0 || n >= sizeof name)
+        return;
+    name[n] = '\0';
+
+    if (self->raw_end != NULL) {
+        /* Only its end tag ends a script or a style. */
+        if (end && strcmp(name, self->raw_end) == 0) {
+            self->raw_end = NULL;
+            lbh2t_end_tag(self, name);
+        }
+        return;
+    }
+
+    len = self->tag->len;
+    if (end)
+        lbh2t_end_tag(self, name);
+    else
+        lbh2t_start_tag(self, name, p,
+                        len > 0 && self->tag->str[len - 1] == '/');
+}
+
+/*
+ * Reading the markup
+ */
+
+/* Whether a quote here starts an attribute value. */
+static gboolean
+lbh2t_after_equals(GString * tag)
+{
+    gsize i = tag->len;
+
+    while (i > 0 && g_ascii_isspace(tag->str[i - 1]))
+        --i;
+
+    return i > 0 && tag->str[i - 1] == '=';
+}
+
+static void
+lbh2t_read(LibBalsaHtmlToText * self, const gchar * in, gsize len)
+{
+    const gchar *end = in + len;
+
+    while (in < end) {
+        gchar c = *in;
+
+        switch (self->state) {
+        case LBH2T_TEXT:
+            {
+                const gchar *lt = memchr(in, '<', end - in);
+                const gchar *text_end = lt != NULL ? lt : end;
+
+                if (self->raw_end == NULL)
+                    g_string_append_len(self->run, in, text_end - in);
+                in = text_end;
+                if (lt != NULL) {
+                    lbh2t_flush(self);
+                    self->state = LBH2T_LT;
+                    ++in;
+                } else if (self->run->len > LBH2T_MAX_RUN
+                           && g_ascii_isspace(self->run->
+                                              str[self->run->len - 1]))
+                    lbh2t_flush(self);
+            }
+            continue;
+
+        case LBH2T_LT:
+            g_string_truncate(self->tag, 0);
+            self->quote = '\0';
+            if (c == '/' || (g_ascii_isalpha(c) && self->raw_end == NULL)) {
+                self->state = LBH2T_TAG;
+            } else if ((c == '!' || c == '?') && self->raw_end == NULL) {
+                self->state = LBH2T_DECL;
+                ++in;
+                continue;
+            } else {
+                /* Not markup. */
+                if (self->raw_end == NULL)
+                    g_string_append_c(self->run, '<');
+                self->state = LBH2T_TEXT;
+                continue;
+            }
+            break;
+
+        case LBH2T_TAG:
+            if (c == '>' && self->quote == '\0') {
+                lbh2t_tag(self);
+                self->state = LBH2T_TEXT;
+                ++in;
+                continue;
+            }
+            if (self->quote == c)
+                self->quote = '\0';
+            else if (self->quote == '\0' && self->raw_end == NULL
+                     && (c == '"' || c == '\'')
+                     && lbh2t_after_equals(self->tag))
+                self->quote = c;
+            break;
+
+        case LBH2T_DECL:
+            if (c == '>') {
+                self->state = LBH2T_TEXT;
+                ++in;
+                continue;
+            }
+            if (c == '-' && self->tag->len == 1 && self->tag->str[0] == '-') {
+                self->state = LBH2T_COMMENT;
+                self->dashes = 0;
+                ++in;
+                continue;
+            }
+            break;
+
+        case LBH2T_COMMENT:
+            if (c == '>' && self->dashes >= 2)
+                self->state = LBH2T_TEXT;
+            self->dashes = c == '-' ? self->dashes + 1 : 0;
+            ++in;
+            continue;
+        }
+
+        /* In a tag or a declaration. */
+        if (self->tag->len < LBH2T_MAX_TAG)
+            g_string_append_c(self->tag, c);
+        ++in;
+    }
+}
+
+static void
+lbh2t_finish(LibBalsaHtmlToText * self)
+{
+    if (self->state == LBH2T_LT && self->raw_end == NULL)
+        g_string_append_c(self->run, '<');
+    self->state = LBH2T_TEXT;
+    lbh2t_flush(self);
+    lbh2t_link_end(self);
+    if (self->written && !self->line_start)
+        g_string_append_c(self->out, '\n');
+    self->newlines = 0;
+    self->line_start = TRUE;
+}
+
+static void
+lbh2t_reset(LibBalsaHtmlToText * self)
+{
+    self->state = LBH2T_TEXT;
+    self->quote = '\0';
+    self->dashes = 0;
+    g_string_truncate(self->run, 0);
+    g_string_truncate(self->tag, 0);
+    self->raw_end = NULL;
+    g_free(self->charset);
+    self->charset = NULL;
+
+    g_string_truncate(self->out, 0);
+    self->written = FALSE;
+    self->line_start = TRUE;
+    self->space = FALSE;
+    self->newlines = 0;
+    self->blank_depth = 0;
+    self->quote_depth = 0;
+    self->pre = 0;
+    self->pre_start = FALSE;
+    self->skip = 0;
+    g_array_set_size(self->lists, 0);
+    self->cells = 0;
+    g_free(self->href);
+    self->href = NULL;
+    if (self->link_text != NULL) {
+        g_string_free(self->link_text, TRUE);
+        self->link_text = NULL;
+    }
+}
+
+/*
+ * The filter
+ */
+
+static void
+lbh2t_output(GMimeFilter * filter, char **outbuf, size_t * outlen,
+             size_t * outprespace)
+{
+    LibBalsaHtmlToText *self = LIBBALSA_HTML_TO_TEXT(filter);
+
+    g_mime_filter_set_size(filter, self->out->len, FALSE);
+    memcpy(filter->outbuf, self->out->str, self->out->len);
+    *outlen = self->out->len;
+    g_string_truncate(self->out, 0);
+
+    *outbuf = filter->outbuf;
+    *outprespace = filter->outpre;
+}
+
+static void
+lbh2t_filter(GMimeFilter * filter, char *inbuf, size_t inlen,
+             size_t prespace, char **outbuf, size_t * outlen,
+             size_t * outprespace)
+{
+    lbh2t_read(LIBBALSA_HTML_TO_TEXT(filter), inbuf, inlen);
+    lbh2t_output(filter, outbuf, outlen, outprespace);
+}
+
+static void
+lbh2t_complete(GMimeFilter * filter, char *inbuf, size_t inlen,
+               size_t prespace, char **outbuf, size_t * outlen,
+               size_t * outprespace)
+{
+    LibBalsaHtmlToText *self = LIBBALSA_HTML_TO_TEXT(filter);
+
+    lbh2t_read(self, inbuf, inlen);
+    lbh2t_finish(self);
+    lbh2t_output(filter, outbuf, outlen, outprespace);
+}
+
+static void
+lbh2t_filter_reset(GMimeFilter * filter)
+{
+    lbh2t_reset(LIBBALSA_HTML_TO_TEXT(filter));
+}
+
+static GMimeFilter *
+lbh2t_copy(GMimeFilter * filter)
+{
+    return libbalsa_html_to_text_new();
+}
+
+static void
+libbalsa_html_to_text_finalize(GObject * object)
+{
+    LibBalsaHtmlToText *self = LIBBALSA_HTML_TO_TEXT(object);
+
+    lbh2t_reset(self);
+    g_string_free(self->run, TRUE);
+    g_string_free(self->tag, TRUE);
+    g_string_free(self->out, TRUE);
+    g_array_free(self->lists, TRUE);
+
+    G_OBJECT_CLASS(libbalsa_html_to_text_parent_class)->finalize(object);
+}
+
+static void
+libbalsa_html_to_text_class_init(LibBalsaHtmlToTextClass * klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    GMimeFilterClass *filter_class = GMIME_FILTER_CLASS(klass);
+
+    object_class->finalize = libbalsa_html_to_text_finalize;
+
+    filter_class->copy = lbh2t_copy;
+    filter_class->filter = lbh2t_filter;
+    filter_class->complete = lbh2t_complete;
+    filter_class->reset = lbh2t_filter_reset;
+}
+
+static void
+libbalsa_html_to_text_init(LibBalsaHtmlToText * self)
+{
+    self->run = g_string_new(NULL);
+    self->tag = g_string_new(NULL);
+    self->out = g_string_new(NULL);
+    self->lists = g_array_new(FALSE, FALSE, sizeof(gint));
+    self->line_start = TRUE;
+}
+
+/*
+ * Public API
+ */
+
+GMimeFilter *
+libbalsa_html_to_text_new(void)
+{
+    return g_object_new(LIBBALSA_TYPE_HTML_TO_TEXT, NULL);
+}
+
+gchar *
+libbalsa_html_to_text_convert(const gchar * html, gssize len)
+{
+    GMimeFilter *filter;
+    char *out;
+    size_t outlen, outprespace;
+    gchar *text;
+
+    g_return_val_if_fail(html != NULL, NULL);
+
+    if (len < 0)
+        len = strlen(html);
+
+    filter = libbalsa_html_to_text_new();
+    g_mime_filter_complete(filter, (char *) html, len, 0, &out, &outlen,
+                           &outprespace);
+    text = g_strndup(out, outlen);
+    g_object_unref(filter);
+
+    return text;
+}
@@ -0,0 +1,64 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ *
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * html-to-text.h
+ *
+ * Convert HTML to plain text, for quoting and for searching HTML parts.
+ *
+ * The conversion is a GMime filter, so the HTML can be streamed through
+ * it: markup may be split anywhere between two chunks.  Entities are
+ * decoded, scripts, styles and the title are dropped, block elements
+ * start new lines, block quotes are prefixed with "> ", list items are
+ * marked, and the target of a link follows its text in angle brackets
+ * unless the text already shows it.  The output is not wrapped.
+ *
+ * The input should be UTF-8, as the text parts of a message body are;
+ * text that is not is taken to be in the charset a <meta> element
+ * names, or else in Windows-1252.
+ */
+
+#ifndef __LIBBALSA_HTML_TO_TEXT_H__
+#define __LIBBALSA_HTML_TO_TEXT_H__
+
+#include <gmime/gmime.h>
+
+G_BEGIN_DECLS
+
+#define LIBBALSA_TYPE_HTML_TO_TEXT (libbalsa_html_to_text_get_type())
+#define LIBBALSA_HTML_TO_TEXT(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST((obj), LIBBALSA_TYPE_HTML_TO_TEXT, \
+                                LibBalsaHtmlToText))
+#define LIBBALSA_IS_HTML_TO_TEXT(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE((obj), LIBBALSA_TYPE_HTML_TO_TEXT))
+
+typedef struct _LibBalsaHtmlToText LibBalsaHtmlToText;
+
+GType libbalsa_html_to_text_get_type(void);
+
+GMimeFilter *libbalsa_html_to_text_new(void);
+
+/* Convert len bytes of html, or all of it if len < 0; the result is
+ * newly allocated. */
+gchar *libbalsa_html_to_text_convert(const gchar * html, gssize len);
+
+G_END_DECLS
+
+#endif                          /* __LIBBALSA_HTML_TO_TEXT_H__ */
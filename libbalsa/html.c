@@ -30,6 +30,7 @@
 # include "config.h"
 #endif                          /* HAVE_CONFIG_H */
 #include "html.h"
+#include "html-to-text.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -86,63 +87,6 @@ lbh_get_body_content(LibBalsaMessageBody * body, gchar ** buf)
     return libbalsa_html_filter(html_type, buf, len);
 }
 
-#ifdef HTML2TEXT
-
-/* common function for all Webkit versions */
-static void
-html2text(gchar ** text, gsize len)
-{
-    gchar *html2text[] = { HTML2TEXT, NULL, NULL, NULL };
-    GFile *html_data;
-    GFileIOStream *stream;
-    GError *err = NULL;
-
-    html_data = g_file_new_tmp("balsa-conv-XXXXXX.html", &stream, &err);
-    if (html_data != NULL) {
-        gsize bytes_written;
-        GOutputStream *ostream =
-            g_io_stream_get_output_stream(G_IO_STREAM(stream));
-
-        if (g_output_stream_write_all(ostream, *text, len,
-                                      &bytes_written, NULL, &err)) {
-            gchar *result = NULL;
-            gint pathidx;
-
-            g_output_stream_flush(ostream, NULL, NULL);
-#if defined(HTML2TEXT_UCOPT)
-            html2text[1] = "--unicode-snob";
-            pathidx = 2;
-#else
-            pathidx = 1;
-#endif
-            html2text[pathidx] = g_file_get_path(html_data);
-            if (g_spawn_sync(NULL, html2text, NULL,
-                             G_SPAWN_STDERR_TO_DEV_NULL, NULL, NULL,
-                             &result, NULL, NULL, &err)) {
-                g_free(*text);
-                *text = result;
-            }
-            g_free(html2text[pathidx]);
-        }
-        g_output_stream_close(ostream, NULL, NULL);
-        g_object_unref(stream);
-        g_file_delete(html_data, NULL, NULL);
-        g_object_unref(html_data);
-    }
-    if (err != NULL) {
-        libbalsa_information(LIBBALSA_INFORMATION_ERROR,
-                             _("Could not convert HTML part to text: %s"),
-                             err ? err->message : "Unknown error");
-        g_error_free(err);
-    }
-}
-
-#else
-
-#define html2text(p, l)
-
-#endif
-
 /* WebKitContextMenuItem uses GtkAction, which is deprecated.
  * We don't use it, but it breaks the git-tree build, so we just mangle
  * it: */
@@ -780,13 +724,6 @@ libbalsa_html_new(LibBalsaMessageBody * body,
     return vbox;
 }
 
-void
-libbalsa_html_to_string(gchar ** text, size_t len)
-{
-    /* this widget does not support conversion to a string. */
-    html2text(text, len);
-}
-
 /*
  * We may be passed either the WebKitWebView or a container:
  */
@@ -1181,3 +1118,18 @@ libbalsa_html_type(const gchar * mime_type)
 }
 
 #endif				/* HAVE_HTML_WIDGET */
+
+/* Replace the HTML in text with its text, converted in process; len may
+ * count the terminating '\0', as libbalsa_html_filter returns it. */
+void
+libbalsa_html_to_string(gchar ** text, size_t len)
+{
+    const gchar *nul = memchr(*text, '\0', len);
+    gchar *res;
+
+    res = libbalsa_html_to_text_convert(*text,
+                                        nul != NULL ? nul - *text : len);
+
+    g_free(*text);
+    *text = res;
+}
@@ -43,7 +43,6 @@ typedef void (*LibBalsaHtmlCallback) (const gchar * uri);
 GtkWidget *libbalsa_html_new(LibBalsaMessageBody * body,
                              LibBalsaHtmlCallback hover_cb,
                              LibBalsaHtmlCallback clicked_cb);
-void libbalsa_html_to_string(gchar ** text, size_t len);
 gboolean libbalsa_html_can_zoom(GtkWidget * widget);
 void libbalsa_html_zoom(GtkWidget * widget, gint in_out);
 gboolean libbalsa_html_can_select(GtkWidget * widget);
@@ -80,5 +79,6 @@ cairo_surface_t *libbalsa_html_print_bitmap(LibBalsaMessageBody *body,
 # endif				/* HAVE_HTML_WIDGET */
 
 LibBalsaHTMLType libbalsa_html_type(const gchar * mime_type);
+void libbalsa_html_to_string(gchar ** text, size_t len);
 
 #endif				/* __LIBBALSA_HTML_H__ */
@@ -0,0 +1,862 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ *
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include "imap-body-cache.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#ifdef G_LOG_DOMAIN
+#  undef G_LOG_DOMAIN
+#endif
+#define G_LOG_DOMAIN "imap-cache"
+
+/*
+ * Data are appended to the active segment; a segment that has grown
+ * past LBIC_SEGMENT_SIZE is sealed and a new one started.  The index
+ * file is a journal of records: an entry added at a place in a segment,
+ * or removed.  When the journal has grown much longer than the index,
+ * it is rewritten, least recently used entry first, so that the order
+ * of eviction survives a restart.
+ *
+ * Evicting an entry only updates the counts of its segment: the
+ * segment file is deleted when nothing is left in it, and copied to the
+ * active segment by the compaction thread when less than half of it is
+ * in use.
+ */
+
+#define LBIC_INDEX_NAME     "packed-index"
+#define LBIC_SEGMENT_PREFIX "packed-"
+#define LBIC_SEGMENT_FORMAT LBIC_SEGMENT_PREFIX "%08x"
+#define LBIC_MAGIC          "BalsaPk1"
+#define LBIC_MAGIC_LEN      8
+#define LBIC_SEGMENT_SIZE   (8 * 1024 * 1024)
+#define LBIC_MAX_KEY        4096
+#define LBIC_COPY_BUFFER    65536
+
+enum {
+    LBIC_RECORD_ADD    = '+',
+    LBIC_RECORD_REMOVE = '-'
+};
+
+typedef struct {
+    guint id;
+    goffset size;               /* bytes written */
+    goffset live;               /* bytes of the entries in it */
+    GQueue entries;
+    gboolean compacting;
+} LbicSegment;
+
+typedef struct {
+    gchar *key;
+    LbicSegment *segment;
+    goffset offset;
+    goffset length;
+    GList *lru_link;            /* in cache->lru */
+    GList *segment_link;        /* in segment->entries */
+} LbicEntry;
+
+struct _LibBalsaImapBodyCache {
+    GMutex lock;
+    gchar *dir;
+    goffset max_size;
+    goffset size;               /* bytes of all the entries */
+
+    GHashTable *entries;        /* key -> LbicEntry */
+    GHashTable *segments;       /* id -> LbicSegment */
+    GQueue lru;                 /* most recently used first */
+
+    LbicSegment *active;
+    int active_fd;
+    guint next_id;
+
+    FILE *journal;
+    guint records;              /* in the journal */
+
+    GThreadPool *compactor;
+};
+
+static gchar *
+lbic_segment_path(LibBalsaImapBodyCache * cache, guint id)
+{
+    gchar *name = g_strdup_printf(LBIC_SEGMENT_FORMAT, id);
+    gchar *path = g_build_filename(cache->dir, name, NULL);
+
+    g_free(name);
+
+    return path;
+}
+
+static gchar *
+lbic_index_path(LibBalsaImapBodyCache * cache)
+{
+    return g_build_filename(cache->dir, LBIC_INDEX_NAME, NULL);
+}
+
+/* Segments. */
+
+static LbicSegment *
+lbic_segment_new(LibBalsaImapBodyCache * cache, guint id, goffset size)
+{
+    LbicSegment *segment = g_new0(LbicSegment, 1);
+
+    segment->id = id;
+    segment->size = size;
+    g_queue_init(&segment->entries);
+    g_hash_table_insert(cache->segments, GUINT_TO_POINTER(id), segment);
+    if (id >= cache->next_id)
+        cache->next_id = id + 1;
+
+    return segment;
+}
+
+static void
+lbic_segment_drop(LibBalsaImapBodyCache * cache, LbicSegment * segment)
+{
+    gchar *path = lbic_segment_path(cache, segment->id);
+
+    if (g_unlink(path) != 0 && errno != ENOENT)
+        g_debug("could not remove %s: %s", path, g_strerror(errno));
+    g_free(path);
+    g_hash_table_remove(cache->segments, GUINT_TO_POINTER(segment->id));
+}
+
+/* Called when entries have left a segment; nothing is dropped while the
+ * index is loaded, as later records may still refer to the segment. */
+static void
+lbic_segment_check(LibBalsaImapBodyCache * cache, LbicSegment * segment)
+{
+    if (segment == cache->active || cache->compactor == NULL)
+        return;
+
+    if (segment->entries.length == 0) {
+        if (!segment->compacting)
+            lbic_segment_drop(cache, segment);
+    } else if (segment->live * 2 < segment->size && !segment->compacting) {
+        segment->compacting = TRUE;
+        g_thread_pool_push(cache->compactor,
+                           GUINT_TO_POINTER(segment->id), NULL);
+    }
+}
+
+static gboolean
+lbic_start_segment(LibBalsaImapBodyCache * cache)
+{
+    LbicSegment *sealed = cache->active;
+    gchar *path;
+    int fd;
+
+    path = lbic_segment_path(cache, cache->next_id);
+    fd = g_open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        g_debug("could not create %s: %s", path, g_strerror(errno));
+        g_free(path);
+        return FALSE;
+    }
+    g_free(path);
+
+    if (cache->active_fd >= 0)
+        close(cache->active_fd);
+    cache->active_fd = fd;
+    cache->active = lbic_segment_new(cache, cache->next_id, 0);
+
+    if (sealed != NULL)
+        lbic_segment_check(cache, sealed);
+
+    return TRUE;
+}
+
+static gboolean
+lbic_open_active(LibBalsaImapBodyCache * cache)
+{
+    if (cache->active_fd < 0 && cache->active != NULL) {
+        gchar *path = lbic_segment_path(cache, cache->active->id);
+
+        cache->active_fd = g_open(path, O_WRONLY, 0);
+        g_free(path);
+    }
+
+    if (cache->active_fd < 0 || cache->active == NULL
+        || cache->active->size >= LBIC_SEGMENT_SIZE)
+        return lbic_start_segment(cache);
+
+    return TRUE;
+}
+
+/* Write to the end of the active segment. */
+static gboolean
+lbic_write(LibBalsaImapBodyCache * cache, const void *buf, gsize length)
+{
+    const gchar *p = buf;
+
+    while (length > 0) {
+        ssize_t written =
+            pwrite(cache->active_fd, p, length, cache->active->size);
+
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            g_debug("could not write segment %x: %s", cache->active->id,
+                    g_strerror(errno));
+            return FALSE;
+        }
+        p += written;
+        length -= written;
+        cache->active->size += written;
+    }
+
+    return TRUE;
+}
+
+/* The journal. */
+
+static gboolean
+lbic_put_record(FILE * journal, guint8 op, const LbicEntry * entry)
+{
+    guint32 segment = entry->segment->id;
+    guint64 offset = entry->offset;
+    guint64 length = entry->length;
+    guint32 key_len = strlen(entry->key);
+
+    return fwrite(&op, sizeof op, 1, journal) == 1
+        && fwrite(&segment, sizeof segment, 1, journal) == 1
+        && fwrite(&offset, sizeof offset, 1, journal) == 1
+        && fwrite(&length, sizeof length, 1, journal) == 1
+        && fwrite(&key_len, sizeof key_len, 1, journal) == 1
+        && fwrite(entry->key, 1, key_len, journal) == key_len;
+}
+
+static void
+lbic_journal(LibBalsaImapBodyCache * cache, guint8 op,
+             const LbicEntry * entry)
+{
+    if (cache->journal == NULL)
+        return;
+
+    if (lbic_put_record(cache->journal, op, entry)) {
+        cache->records++;
+    } else {
+        /* The index will be rewritten at the next sync. */
+        fclose(cache->journal);
+        cache->journal = NULL;
+    }
+}
+
+static void
+lbic_checkpoint(LibBalsaImapBodyCache * cache)
+{
+    gchar *path, *tmp_path;
+    FILE *index;
+    GList *list;
+    gboolean ok;
+
+    if (cache->journal != NULL) {
+        fclose(cache->journal);
+        cache->journal = NULL;
+    }
+
+    path = lbic_index_path(cache);
+    tmp_path = g_strconcat(path, ".new", NULL);
+    index = fopen(tmp_path, "wb");
+    ok = index != NULL
+        && fwrite(LBIC_MAGIC, 1, LBIC_MAGIC_LEN, index) == LBIC_MAGIC_LEN;
+    for (list = cache->lru.tail; ok && list != NULL; list = list->prev)
+        ok = lbic_put_record(index, LBIC_RECORD_ADD, list->data);
+    if (index != NULL && fclose(index) != 0)
+        ok = FALSE;
+
+    if (ok && g_rename(tmp_path, path) == 0) {
+        cache->records = g_hash_table_size(cache->entries);
+        cache->journal = fopen(path, "ab");
+    } else {
+        g_debug("could not write %s: %s", path, g_strerror(errno));
+        g_unlink(tmp_path);
+    }
+    g_free(tmp_path);
+    g_free(path);
+}
+
+/* Entries. */
+
+static void
+lbic_entry_free(LbicEntry * entry)
+{
+    g_free(entry->key);
+    g_free(entry);
+}
+
+static void
+lbic_entry_place(LbicEntry * entry, LbicSegment * segment, goffset offset)
+{
+    entry->segment = segment;
+    entry->offset = offset;
+    g_queue_push_tail(&segment->entries, entry);
+    entry->segment_link = segment->entries.tail;
+    segment->live += entry->length;
+}
+
+static void
+lbic_entry_unplace(LibBalsaImapBodyCache * cache, LbicEntry * entry)
+{
+    LbicSegment *segment = entry->segment;
+
+    g_queue_delete_link(&segment->entries, entry->segment_link);
+    segment->live -= entry->length;
+    entry->segment = NULL;
+    lbic_segment_check(cache, segment);
+}
+
+static void
+lbic_entry_remove(LibBalsaImapBodyCache * cache, LbicEntry * entry,
+                  gboolean journal)
+{
+    if (journal)
+        lbic_journal(cache, LBIC_RECORD_REMOVE, entry);
+    g_queue_delete_link(&cache->lru, entry->lru_link);
+    cache->size -= entry->length;
+    lbic_entry_unplace(cache, entry);
+    g_hash_table_remove(cache->entries, entry->key);
+}
+
+static LbicEntry *
+lbic_entry_insert(LibBalsaImapBodyCache * cache, const gchar * key,
+                  LbicSegment * segment, goffset offset, goffset length)
+{
+    LbicEntry *entry;
+
+    if ((entry = g_hash_table_lookup(cache->entries, key)) != NULL)
+        lbic_entry_remove(cache, entry, FALSE);
+
+    entry = g_new(LbicEntry, 1);
+    entry->key = g_strdup(key);
+    entry->length = length;
+    lbic_entry_place(entry, segment, offset);
+    g_queue_push_head(&cache->lru, entry);
+    entry->lru_link = cache->lru.head;
+    cache->size += length;
+    g_hash_table_insert(cache->entries, entry->key, entry);
+
+    return entry;
+}
+
+/* Evict entries until the cache holds at most size bytes, keeping the
+ * most recent one if keep_newest. */
+static void
+lbic_trim(LibBalsaImapBodyCache * cache, goffset size,
+          gboolean keep_newest)
+{
+    while (cache->size > size && cache->lru.tail != NULL
+           && !(keep_newest && cache->lru.tail == cache->lru.head))
+        lbic_entry_remove(cache, cache->lru.tail->data, TRUE);
+}
+
+/* Append the data of entry to the active segment; return the offset,
+ * or -1 on error. */
+static goffset
+lbic_copy_entry(LibBalsaImapBodyCache * cache, LbicEntry * entry)
+{
+    gchar *path;
+    int fd;
+    gchar *buf;
+    goffset offset, done;
+
+    if (!lbic_open_active(cache))
+        return -1;
+
+    path = lbic_segment_path(cache, entry->segment->id);
+    fd = g_open(path, O_RDONLY, 0);
+    g_free(path);
+    if (fd < 0)
+        return -1;
+
+    offset = cache->active->size;
+    buf = g_malloc(LBIC_COPY_BUFFER);
+    for (done = 0; done < entry->length; ) {
+        ssize_t count = pread(fd, buf,
+                              MIN(LBIC_COPY_BUFFER, entry->length - done),
+                              entry->offset + done);
+
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0 || !lbic_write(cache, buf, count))
+            break;
+        done += count;
+    }
+    g_free(buf);
+    close(fd);
+
+    return done == entry->length ? offset : -1;
+}
+
+/* The compaction thread: move the entries of a sealed segment to the
+ * active one, one at a time so that the cache is not blocked for long. */
+static void
+lbic_compact(gpointer data, gpointer user_data)
+{
+    LibBalsaImapBodyCache *cache = user_data;
+    guint id = GPOINTER_TO_UINT(data);
+    LbicSegment *segment;
+    GPtrArray *keys;
+    GList *list;
+    guint i;
+
+    g_mutex_lock(&cache->lock);
+    segment = g_hash_table_lookup(cache->segments, GUINT_TO_POINTER(id));
+    if (segment == NULL) {
+        g_mutex_unlock(&cache->lock);
+        return;
+    }
+    keys = g_ptr_array_new_with_free_func(g_free);
+    for (list = segment->entries.head; list != NULL; list = list->next)
+        g_ptr_array_add(keys, g_strdup(((LbicEntry *) list->data)->key));
+    g_mutex_unlock(&cache->lock);
+
+    for (i = 0; i < keys->len; i++) {
+        LbicEntry *entry;
+
+        g_mutex_lock(&cache->lock);
+        entry = g_hash_table_lookup(cache->entries, g_ptr_array_index(keys, i));
+        if (entry != NULL && entry->segment == segment) {
+            goffset offset = lbic_copy_entry(cache, entry);
+
+            if (offset >= 0) {
+                lbic_entry_unplace(cache, entry);
+                lbic_entry_place(entry, cache->active, offset);
+                lbic_journal(cache, LBIC_RECORD_ADD, entry);
+            }
+        }
+        g_mutex_unlock(&cache->lock);
+    }
+    g_ptr_array_free(keys, TRUE);
+
+    g_mutex_lock(&cache->lock);
+    segment->compacting = FALSE;
+    if (segment->entries.length == 0)
+        lbic_segment_drop(cache, segment);
+    g_mutex_unlock(&cache->lock);
+}
+
+/* Loading. */
+
+/* Remove the one file per message of the cache as it used to be. */
+static void
+lbic_remove_old_files(const gchar * dir_name)
+{
+    GDir *dir;
+    const gchar *name;
+
+    if ((dir = g_dir_open(dir_name, 0, NULL)) == NULL)
+        return;
+
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        if (g_str_has_suffix(name, "-body") || strstr(name, "-part-") != NULL) {
+            gchar *path = g_build_filename(dir_name, name, NULL);
+
+            g_unlink(path);
+            g_free(path);
+        }
+    }
+    g_dir_close(dir);
+}
+
+static void
+lbic_scan_segments(LibBalsaImapBodyCache * cache)
+{
+    GDir *dir;
+    const gchar *name;
+
+    if ((dir = g_dir_open(cache->dir, 0, NULL)) == NULL)
+        return;
+
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        guint id;
+        gint end = 0;
+        GStatBuf st;
+        gchar *path;
+
+        if (!g_str_has_prefix(name, LBIC_SEGMENT_PREFIX)
+            || sscanf(name, LBIC_SEGMENT_PREFIX "%x%n", &id, &end) != 1
+            || name[end] != '\0' || id == 0)
+            continue;
+        path = g_build_filename(cache->dir, name, NULL);
+        if (g_stat(path, &st) == 0 && S_ISREG(st.st_mode))
+            lbic_segment_new(cache, id, st.st_size);
+        g_free(path);
+    }
+    g_dir_close(dir);
+}
+
+static gboolean
+lbic_get_record(FILE * index, guint8 * op, guint32 * segment,
+                guint64 * offset, guint64 * length, gchar ** key)
+{
+    guint32 key_len;
+
+    if (fread(op, sizeof *op, 1, index) != 1
+        || fread(segment, sizeof *segment, 1, index) != 1
+        || fread(offset, sizeof *offset, 1, index) != 1
+        || fread(length, sizeof *length, 1, index) != 1
+        || fread(&key_len, sizeof key_len, 1, index) != 1
+        || key_len == 0 || key_len > LBIC_MAX_KEY)
+        return FALSE;
+
+    *key = g_malloc(key_len + 1);
+    if (fread(*key, 1, key_len, index) != key_len) {
+        g_free(*key);
+        return FALSE;
+    }
+    (*key)[key_len] = '\0';
+
+    return TRUE;
+}
+
+/* Replay the journal; return FALSE if it must be rewritten. */
+static gboolean
+lbic_load_index(LibBalsaImapBodyCache * cache)
+{
+    gchar *path = lbic_index_path(cache);
+    FILE *index;
+    gchar magic[LBIC_MAGIC_LEN];
+    guint8 op;
+    guint32 id;
+    guint64 offset, length;
+    gchar *key;
+    long good;
+    gboolean ok;
+
+    index = fopen(path, "rb");
+    if (index == NULL) {
+        g_free(path);
+        return FALSE;
+    }
+    if (fread(magic, 1, LBIC_MAGIC_LEN, index) != LBIC_MAGIC_LEN
+        || memcmp(magic, LBIC_MAGIC, LBIC_MAGIC_LEN) != 0) {
+        fclose(index);
+        g_free(path);
+        return FALSE;
+    }
+    good = ftell(index);
+
+    while (lbic_get_record(index, &op, &id, &offset, &length, &key)) {
+        LbicSegment *segment =
+            g_hash_table_lookup(cache->segments, GUINT_TO_POINTER(id));
+        LbicEntry *entry;
+
+        if (op == LBIC_RECORD_ADD && segment != NULL
+            && offset + length <= (guint64) segment->size) {
+            lbic_entry_insert(cache, key, segment, offset, length);
+        } else if ((entry = g_hash_table_lookup(cache->entries, key)) != NULL) {
+            /* Removed, or its data are gone. */
+            lbic_entry_remove(cache, entry, FALSE);
+        }
+        g_free(key);
+        cache->records++;
+        good = ftell(index);
+    }
+
+    /* A record torn by a crash must not stay in front of the ones we
+     * are going to append; cut it off, or have the index rewritten. */
+    ok = good >= 0 && fseek(index, 0, SEEK_END) == 0;
+    if (ok && ftell(index) != good)
+        ok = truncate(path, good) == 0;
+    fclose(index);
+    g_free(path);
+
+    return ok;
+}
+
+LibBalsaImapBodyCache *
+libbalsa_imap_body_cache_new(const gchar * dir, goffset max_size)
+{
+    LibBalsaImapBodyCache *cache;
+    gchar *index_path;
+    GHashTableIter iter;
+    gpointer value;
+    LbicSegment *last = NULL;
+
+    g_return_val_if_fail(dir != NULL, NULL);
+
+    cache = g_new0(LibBalsaImapBodyCache, 1);
+    g_mutex_init(&cache->lock);
+    cache->dir = g_strdup(dir);
+    cache->max_size = max_size;
+    cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                           (GDestroyNotify) lbic_entry_free);
+    cache->segments = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                            NULL, g_free);
+    g_queue_init(&cache->lru);
+    cache->active_fd = -1;
+    cache->next_id = 1;
+
+    g_mkdir_with_parents(dir, S_IRUSR | S_IWUSR | S_IXUSR);
+    index_path = lbic_index_path(cache);
+    if (!g_file_test(index_path, G_FILE_TEST_EXISTS))
+        lbic_remove_old_files(dir);
+    g_free(index_path);
+
+    lbic_scan_segments(cache);
+    if (lbic_load_index(cache)) {
+        gchar *path = lbic_index_path(cache);
+
+        cache->journal = fopen(path, "ab");
+        g_free(path);
+    }
+
+    /* Drop the segments that hold nothing, and keep appending to the
+     * last one. */
+    g_hash_table_iter_init(&iter, cache->segments);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        LbicSegment *segment = value;
+
+        if (segment->entries.length == 0) {
+            gchar *path = lbic_segment_path(cache, segment->id);
+
+            g_unlink(path);
+            g_free(path);
+            g_hash_table_iter_remove(&iter);
+        } else if (last == NULL || segment->id > last->id)
+            last = segment;
+    }
+    cache->active = last;
+
+    cache->compactor = g_thread_pool_new(lbic_compact, cache, 1, FALSE, NULL);
+    g_hash_table_iter_init(&iter, cache->segments);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+        lbic_segment_check(cache, value);
+
+    lbic_trim(cache, cache->max_size, FALSE);
+    if (cache->journal == NULL)
+        lbic_checkpoint(cache);
+
+    return cache;
+}
+
+void
+libbalsa_imap_body_cache_free(LibBalsaImapBodyCache * cache)
+{
+    if (cache == NULL)
+        return;
+
+    g_thread_pool_free(cache->compactor, TRUE, TRUE);
+    cache->compactor = NULL;
+    libbalsa_imap_body_cache_sync(cache);
+
+    if (cache->journal != NULL)
+        fclose(cache->journal);
+    if (cache->active_fd >= 0)
+        close(cache->active_fd);
+    g_hash_table_destroy(cache->entries);
+    g_hash_table_destroy(cache->segments);
+    g_queue_clear(&cache->lru);
+    g_free(cache->dir);
+    g_mutex_clear(&cache->lock);
+    g_free(cache);
+}
+
+void
+libbalsa_imap_body_cache_set_max_size(LibBalsaImapBodyCache * cache,
+                                      goffset max_size)
+{
+    g_return_if_fail(cache != NULL);
+
+    g_mutex_lock(&cache->lock);
+    cache->max_size = max_size;
+    lbic_trim(cache, max_size, FALSE);
+    g_mutex_unlock(&cache->lock);
+}
+
+void
+libbalsa_imap_body_cache_trim(LibBalsaImapBodyCache * cache, goffset size)
+{
+    g_return_if_fail(cache != NULL);
+
+    g_mutex_lock(&cache->lock);
+    lbic_trim(cache, size, FALSE);
+    g_mutex_unlock(&cache->lock);
+}
+
+void
+libbalsa_imap_body_cache_sync(LibBalsaImapBodyCache * cache)
+{
+    g_return_if_fail(cache != NULL);
+
+    g_mutex_lock(&cache->lock);
+    if (cache->journal == NULL
+        || cache->records > 2 * g_hash_table_size(cache->entries) + 1024)
+        lbic_checkpoint(cache);
+    else
+        fflush(cache->journal);
+    g_mutex_unlock(&cache->lock);
+}
+
+GMimeStream *
+libbalsa_imap_body_cache_lookup(LibBalsaImapBodyCache * cache,
+                                const gchar * key)
+{
+    LbicEntry *entry;
+    gchar *path;
+    int fd;
+    gint64 start;
+    gint64 end;
+
+    g_return_val_if_fail(cache != NULL, NULL);
+    g_return_val_if_fail(key != NULL, NULL);
+
+    g_mutex_lock(&cache->lock);
+    if ((entry = g_hash_table_lookup(cache->entries, key)) == NULL) {
+        g_mutex_unlock(&cache->lock);
+        return NULL;
+    }
+    g_queue_unlink(&cache->lru, entry->lru_link);
+    g_queue_push_head_link(&cache->lru, entry->lru_link);
+
+    /* Open the segment while we hold the lock, so that the compaction
+     * cannot remove it before; once opened, it stays readable. */
+    path = lbic_segment_path(cache, entry->segment->id);
+    fd = g_open(path, O_RDONLY, 0);
+    g_free(path);
+    start = entry->offset;
+    end = entry->offset + entry->length;
+    g_mutex_unlock(&cache->lock);
+
+    return fd >= 0 ? g_mime_stream_fs_new_with_bounds(fd, start, end) : NULL;
+}
+
+gboolean
+libbalsa_imap_body_cache_add(LibBalsaImapBodyCache * cache,
+                             const gchar * key, const void *data,
+                             gsize length)
+{
+    gboolean ok;
+
+    g_return_val_if_fail(cache != NULL, FALSE);
+    g_return_val_if_fail(key != NULL, FALSE);
+
+    /* The journal could not be read back with a longer key. */
+    if (strlen(key) > LBIC_MAX_KEY)
+        return FALSE;
+
+    g_mutex_lock(&cache->lock);
+    ok = lbic_open_active(cache);
+    if (ok) {
+        goffset offset = cache->active->size;
+
+        ok = lbic_write(cache, data, length);
+        if (ok) {
+            LbicEntry *entry =
+                lbic_entry_insert(cache, key, cache->active, offset, length);
+
+            lbic_journal(cache, LBIC_RECORD_ADD, entry);
+            lbic_trim(cache, cache->max_size, TRUE);
+        }
+    }
+    g_mutex_unlock(&cache->lock);
+
+    return ok;
+}
+
+gboolean
+libbalsa_imap_body_cache_add_file(LibBalsaImapBodyCache * cache,
+                                  const gchar * key, FILE * stream)
+{
+    gchar *buf;
+    gboolean ok;
+
+    g_return_val_if_fail(cache != NULL, FALSE);
+    g_return_val_if_fail(key != NULL, FALSE);
+    g_return_val_if_fail(stream != NULL, FALSE);
+
+    if (strlen(key) > LBIC_MAX_KEY || fseek(stream, 0, SEEK_SET) != 0)
+        return FALSE;
+
+    buf = g_malloc(LBIC_COPY_BUFFER);
+    g_mutex_lock(&cache->lock);
+    ok = lbic_open_active(cache);
+    if (ok) {
+        goffset offset = cache->active->size;
+        size_t count;
+
+        while (ok && (count = fread(buf, 1, LBIC_COPY_BUFFER, stream)) > 0)
+            ok = lbic_write(cache, buf, count);
+        if (ok && !ferror(stream)) {
+            LbicEntry *entry =
+                lbic_entry_insert(cache, key, cache->active, offset,
+                                  cache->active->size - offset);
+
+            lbic_journal(cache, LBIC_RECORD_ADD, entry);
+            lbic_trim(cache, cache->max_size, TRUE);
+        } else
+            ok = FALSE;
+    }
+    g_mutex_unlock(&cache->lock);
+    g_free(buf);
+
+    return ok;
+}
+
+gboolean
+libbalsa_imap_body_cache_copy(LibBalsaImapBodyCache * cache,
+                              const gchar * src_key,
+                              const gchar * dst_key)
+{
+    LbicEntry *entry;
+    goffset offset = -1;
+
+    g_return_val_if_fail(cache != NULL, FALSE);
+    g_return_val_if_fail(src_key != NULL && dst_key != NULL, FALSE);
+
+    if (strlen(dst_key) > LBIC_MAX_KEY)
+        return FALSE;
+
+    g_mutex_lock(&cache->lock);
+    if ((entry = g_hash_table_lookup(cache->entries, src_key)) != NULL
+        && (offset = lbic_copy_entry(cache, entry)) >= 0) {
+        entry = lbic_entry_insert(cache, dst_key, cache->active, offset,
+                                  entry->length);
+        lbic_journal(cache, LBIC_RECORD_ADD, entry);
+        lbic_trim(cache, cache->max_size, TRUE);
+    }
+    g_mutex_unlock(&cache->lock);
+
+    return offset >= 0;
+}
+
+void
+libbalsa_imap_body_cache_remove(LibBalsaImapBodyCache * cache,
+                                const gchar * key)
+{
+    LbicEntry *entry;
+
+    g_return_if_fail(cache != NULL);
+    g_return_if_fail(key != NULL);
+
+    g_mutex_lock(&cache->lock);
+    if ((entry = g_hash_table_lookup(cache->entries, key)) != NULL)
+        lbic_entry_remove(cache, entry, TRUE);
+    g_mutex_unlock(&cache->lock);
+}
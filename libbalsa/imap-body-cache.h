@@ -0,0 +1,71 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ *
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * imap-body-cache.h
+ *
+ * The cache of IMAP message bodies and parts.
+ *
+ * The cached data are packed into segment files in the cache directory,
+ * and found through an index kept in memory and journalled to disk; the
+ * key names the server, the mailbox, its UIDVALIDITY and the UID.  The
+ * least recently used entries are evicted as soon as the cache grows
+ * past its size, and segments that are mostly evicted are compacted by
+ * a background thread.
+ */
+
+#ifndef __LIBBALSA_IMAP_BODY_CACHE_H__
+#define __LIBBALSA_IMAP_BODY_CACHE_H__
+
+#include <stdio.h>
+#include <gmime/gmime.h>
+
+typedef struct _LibBalsaImapBodyCache LibBalsaImapBodyCache;
+
+LibBalsaImapBodyCache *libbalsa_imap_body_cache_new(const gchar * dir,
+                                                    goffset max_size);
+void libbalsa_imap_body_cache_free(LibBalsaImapBodyCache * cache);
+
+void libbalsa_imap_body_cache_set_max_size(LibBalsaImapBodyCache * cache,
+                                           goffset max_size);
+/* Evict the least recently used entries until the cache holds at most
+ * size bytes. */
+void libbalsa_imap_body_cache_trim(LibBalsaImapBodyCache * cache,
+                                   goffset size);
+/* Write the index to disk. */
+void libbalsa_imap_body_cache_sync(LibBalsaImapBodyCache * cache);
+
+/* A stream over the cached data, or NULL if key is not cached. */
+GMimeStream *libbalsa_imap_body_cache_lookup(LibBalsaImapBodyCache * cache,
+                                             const gchar * key);
+gboolean libbalsa_imap_body_cache_add(LibBalsaImapBodyCache * cache,
+                                      const gchar * key,
+                                      const void *data, gsize length);
+/* Cache everything from the start of stream. */
+gboolean libbalsa_imap_body_cache_add_file(LibBalsaImapBodyCache * cache,
+                                           const gchar * key,
+                                           FILE * stream);
+gboolean libbalsa_imap_body_cache_copy(LibBalsaImapBodyCache * cache,
+                                       const gchar * src_key,
+                                       const gchar * dst_key);
+void libbalsa_imap_body_cache_remove(LibBalsaImapBodyCache * cache,
+                                     const gchar * key);
+
+#endif                          /* __LIBBALSA_IMAP_BODY_CACHE_H__ */
@@ -0,0 +1,181 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ *
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include "imap-prefetch.h"
+
+#include <stdlib.h>
+
+/* The read-ahead starts at LBIP_MIN_CHUNK rows, the chunk the index
+ * used to fetch, and doubles up to LBIP_MAX_CHUNK.  At most
+ * LBIP_MAX_VISIBLE rows are taken as shown. */
+#define LBIP_MIN_CHUNK   20
+#define LBIP_MAX_CHUNK   640
+#define LBIP_MAX_VISIBLE 256
+
+struct _LibBalsaImapPrefetch {
+    LibBalsaImapPrefetchWalk walk;
+    LibBalsaImapPrefetchHave have;
+    gpointer data;
+
+    guint chunk;                /* the current read-ahead */
+    gint direction;             /* of the last read-ahead */
+    guint frontier;             /* the last row read ahead, or 0 */
+    guint *rows;                /* scratch */
+};
+
+LibBalsaImapPrefetch *
+libbalsa_imap_prefetch_new(LibBalsaImapPrefetchWalk walk,
+                           LibBalsaImapPrefetchHave have, gpointer data)
+{
+    LibBalsaImapPrefetch *prefetch;
+
+    prefetch = g_new0(LibBalsaImapPrefetch, 1);
+    prefetch->walk = walk;
+    prefetch->have = have;
+    prefetch->data = data;
+    prefetch->chunk = LBIP_MIN_CHUNK;
+    prefetch->direction = 1;
+    prefetch->rows =
+        g_new(guint, MAX(LBIP_MAX_CHUNK, LBIP_MAX_VISIBLE + 1));
+
+    return prefetch;
+}
+
+void
+libbalsa_imap_prefetch_free(LibBalsaImapPrefetch * prefetch)
+{
+    if (prefetch == NULL)
+        return;
+
+    g_free(prefetch->rows);
+    g_free(prefetch);
+}
+
+static void
+lbip_add(LibBalsaImapPrefetch * prefetch, GArray * set, guint msgno)
+{
+    if (msgno > 0 && !prefetch->have(msgno, prefetch->data))
+        g_array_append_val(set, msgno);
+}
+
+/* Walk count rows from msgno, adding the ones not cached; returns the
+ * last row walked, or msgno if there was none. */
+static guint
+lbip_add_rows(LibBalsaImapPrefetch * prefetch, GArray * set,
+              guint msgno, gint direction, guint count)
+{
+    guint n, i;
+
+    n = prefetch->walk(msgno, direction, count, prefetch->rows,
+                       prefetch->data);
+    for (i = 0; i < n; i++)
+        lbip_add(prefetch, set, prefetch->rows[i]);
+
+    return n > 0 ? prefetch->rows[n - 1] : msgno;
+}
+
+static gint
+lbip_cmp_msgno(gconstpointer a, gconstpointer b)
+{
+    guint msgno_a = *(const guint *) a;
+    guint msgno_b = *(const guint *) b;
+
+    return msgno_a < msgno_b ? -1 : msgno_a > msgno_b;
+}
+
+GArray *
+libbalsa_imap_prefetch_plan(LibBalsaImapPrefetch * prefetch, guint msgno,
+                            guint first_visible, guint last_visible,
+                            gint direction)
+{
+    GArray *set;
+    gboolean visible = FALSE;
+    gboolean continued = FALSE;
+    guint ahead_from = msgno;
+    guint n_rows = 0;
+    guint i;
+
+    set = g_array_new(FALSE, FALSE, sizeof(guint));
+    lbip_add(prefetch, set, msgno);
+
+    if (direction == 0)
+        direction = prefetch->direction;
+
+    /* The rows shown: the missing one should be among them, and if the
+     * last read-ahead ends among them too, the user is scrolling
+     * through it. */
+    if (first_visible > 0 && last_visible > 0) {
+        prefetch->rows[0] = first_visible;
+        n_rows = 1;
+        if (first_visible != last_visible) {
+            guint n = prefetch->walk(first_visible, 1, LBIP_MAX_VISIBLE,
+                                     &prefetch->rows[1], prefetch->data);
+            for (i = 1; i <= n; i++)
+                if (prefetch->rows[i] == last_visible) {
+                    n = i;
+                    break;
+                }
+            n_rows += n;
+        }
+        for (i = 0; i < n_rows; i++) {
+            if (prefetch->rows[i] == msgno)
+                visible = TRUE;
+            if (prefetch->rows[i] == prefetch->frontier)
+                continued = TRUE;
+        }
+    }
+
+    if (visible) {
+        for (i = 0; i < n_rows; i++)
+            lbip_add(prefetch, set, prefetch->rows[i]);
+        ahead_from = prefetch->rows[direction > 0 ? n_rows - 1 : 0];
+
+        if (continued && direction == prefetch->direction)
+            prefetch->chunk = MIN(prefetch->chunk * 2, LBIP_MAX_CHUNK);
+        else
+            prefetch->chunk = LBIP_MIN_CHUNK;
+        prefetch->direction = direction;
+        prefetch->frontier =
+            lbip_add_rows(prefetch, set, ahead_from, direction,
+                          prefetch->chunk);
+    } else {
+        /* Not a row the user is looking at, or the view has jumped
+         * away from the read-ahead: fetch the rows around it, as much
+         * as the index used to, and forget the read-ahead. */
+        prefetch->chunk = LBIP_MIN_CHUNK;
+        prefetch->frontier = 0;
+        lbip_add_rows(prefetch, set, msgno, 1, LBIP_MIN_CHUNK / 2);
+        lbip_add_rows(prefetch, set, msgno, -1, LBIP_MIN_CHUNK / 2);
+    }
+
+    g_array_sort(set, lbip_cmp_msgno);
+    for (i = 1; i < set->len; ) {
+        if (g_array_index(set, guint, i) == g_array_index(set, guint, i - 1))
+            g_array_remove_index(set, i);
+        else
+            i++;
+    }
+
+    return set;
+}
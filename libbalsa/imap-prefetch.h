@@ -0,0 +1,64 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ *
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * imap-prefetch.h
+ *
+ * Choose the messages whose envelopes are fetched together, when the
+ * index needs one that is not cached yet.
+ *
+ * The rows shown by the index are fetched at once, followed by a
+ * read-ahead in the direction of the scrolling, which doubles while the
+ * user keeps scrolling the same way and drops back when the view jumps
+ * or turns.  Rows are walked in the order of the view, so the choice
+ * does not depend on the size of the mailbox.
+ */
+
+#ifndef __LIBBALSA_IMAP_PREFETCH_H__
+#define __LIBBALSA_IMAP_PREFETCH_H__
+
+#include <glib.h>
+
+typedef struct _LibBalsaImapPrefetch LibBalsaImapPrefetch;
+
+/* Store in msgnos the messages in up to count rows following
+ * (direction > 0) or preceding (direction < 0) the row of msgno in the
+ * view, nearest first; return the number stored. */
+typedef guint (*LibBalsaImapPrefetchWalk) (guint msgno, gint direction,
+                                           guint count, guint * msgnos,
+                                           gpointer data);
+/* TRUE if the envelope of msgno is cached already. */
+typedef gboolean (*LibBalsaImapPrefetchHave) (guint msgno,
+                                              gpointer data);
+
+LibBalsaImapPrefetch *libbalsa_imap_prefetch_new(LibBalsaImapPrefetchWalk
+                                                 walk,
+                                                 LibBalsaImapPrefetchHave
+                                                 have, gpointer data);
+void libbalsa_imap_prefetch_free(LibBalsaImapPrefetch * prefetch);
+
+/* The messages to fetch, in ascending order, when msgno is needed;
+ * first_visible and last_visible are the rows shown, 0 if unknown, and
+ * direction the direction of the last scrolling. */
+GArray *libbalsa_imap_prefetch_plan(LibBalsaImapPrefetch * prefetch,
+                                    guint msgno, guint first_visible,
+                                    guint last_visible, gint direction);
+
+#endif                          /* __LIBBALSA_IMAP_PREFETCH_H__ */
@@ -781,6 +781,27 @@ gboolean libbalsa_imap_server_has_free_handles(LibBalsaImapServer *imap_server)
     return result;
 }
 
+/**
+ * libbalsa_imap_server_get_free_connections:
+ * @server: A #LibBalsaImapServer
+ *
+ * Returns the number of connections that may still be taken from
+ * @server before libbalsa_imap_server_get_handle() returns %NULL.  Like
+ * libbalsa_imap_server_has_free_handles(), this is only a hint.
+ *
+ * Return value: the number of connections not in use.
+ **/
+guint
+libbalsa_imap_server_get_free_connections(LibBalsaImapServer *imap_server)
+{
+    guint result;
+    g_mutex_lock(&imap_server->lock);
+    result = imap_server->used_connections < imap_server->max_connections
+        ? imap_server->max_connections - imap_server->used_connections : 0;
+    g_mutex_unlock(&imap_server->lock);
+    return result;
+}
+
 /**
  * libbalsa_imap_server_is_offline:
  * @server: A #LibBalsaImapServer
@@ -51,6 +51,7 @@ gboolean libbalsa_imap_server_has_persistent_cache(LibBalsaImapServer *srv);
 void libbalsa_imap_server_force_disconnect(LibBalsaImapServer *server);
 void libbalsa_imap_server_close_all_connections(void);
 gboolean libbalsa_imap_server_has_free_handles(LibBalsaImapServer *server);
+guint libbalsa_imap_server_get_free_connections(LibBalsaImapServer *server);
 gboolean libbalsa_imap_server_is_offline(LibBalsaImapServer *server);
 void libbalsa_imap_server_set_offline_mode(LibBalsaImapServer *server,
                                            gboolean offline);
@@ -184,10 +184,22 @@ imap_mbox_select_unlocked(ImapMboxHandle* handle, const char *mbox,
   gchar *mbx7;
   ImapResponse rc;
   char* cmds[3];
+  unsigned qresync_uidval;
+  guint64 qresync_modseq;
 
   IMAP_REQUIRED_STATE3_U(handle, IMHS_CONNECTED, IMHS_AUTHENTICATED,
                          IMHS_SELECTED, IMR_BAD);
 
+  /* The state for QRESYNC is good for one SELECT only. */
+  qresync_uidval = handle->qresync.uidval;
+  qresync_modseq = handle->qresync.modseq;
+  handle->qresync.uidval = 0;
+  handle->qresync.modseq = 0;
+  if (handle->qresync.vanished != NULL) {
+    g_array_free(handle->qresync.vanished, TRUE);
+    handle->qresync.vanished = NULL;
+  }
+
   if (handle->state == IMHS_SELECTED && strcmp(handle->mbox, mbox) == 0) {
     if(readonly_mbox)
       *readonly_mbox = handle->readonly_mbox;
@@ -197,10 +209,28 @@ imap_mbox_select_unlocked(ImapMboxHandle* handle, const char *mbox,
   mbox_view_dispose(&handle->mbox_view);
   handle->unseen = 0;
   handle->has_rights = 0;
+  handle->highestmodseq = 0;
+
+  /* RFC 7162: QRESYNC must be enabled before it can be used; once it
+   * is, expunged messages are reported with VANISHED responses. */
+  if (qresync_modseq != 0 &&
+      imap_mbox_handle_can_do(handle, IMCAP_QRESYNC) &&
+      imap_mbox_handle_can_do(handle, IMCAP_ENABLE) &&
+      !handle->qresync_enabled)
+    imap_cmd_exec(handle, "ENABLE QRESYNC");
 
   mbx7 = imap_utf8_to_mailbox(mbox);
 
-  cmds[0] = g_strdup_printf("SELECT \"%s\"", mbx7);
+  if (qresync_modseq != 0 && handle->qresync_enabled) {
+    cmds[0] = g_strdup_printf("SELECT \"%s\" (QRESYNC (%u %" G_GUINT64_FORMAT
+                              "))", mbx7, qresync_uidval, qresync_modseq);
+    handle->qresync.vanished =
+      g_array_new(FALSE, FALSE, sizeof(ImapUidRange));
+  } else if (imap_mbox_handle_can_do(handle, IMCAP_CONDSTORE))
+    /* Ask for HIGHESTMODSEQ, to resynchronize next time. */
+    cmds[0] = g_strdup_printf("SELECT \"%s\" (CONDSTORE)", mbx7);
+  else
+    cmds[0] = g_strdup_printf("SELECT \"%s\"", mbx7);
   if (imap_mbox_handle_can_do(handle, IMCAP_ACL)) {
     cmds[1] = g_strdup_printf("MYRIGHTS \"%s\"", mbx7);
     cmds[2] = NULL;
@@ -224,7 +254,18 @@ imap_mbox_select_unlocked(ImapMboxHandle* handle, const char *mbox,
     if(readonly_mbox) {
       *readonly_mbox = handle->readonly_mbox;
     }
-  } else { /* remove even traces of untagged responses */
+  }
+
+  /* The server ignores the QRESYNC state when UIDVALIDITY has
+   * changed. */
+  if(handle->qresync.vanished != NULL &&
+     (rc != IMR_OK || handle->uidval != qresync_uidval ||
+      handle->highestmodseq == 0)) {
+    g_array_free(handle->qresync.vanished, TRUE);
+    handle->qresync.vanished = NULL;
+  }
+
+  if(rc != IMR_OK) { /* remove even traces of untagged responses */
     g_free(handle->mbox);
     handle->mbox = NULL;
 
@@ -423,15 +464,123 @@ imap_mbox_status(ImapMboxHandle *r, const char*what,
     gchar *items = g_strjoinv(" ", (gchar**)&item_arr[0]);
     gchar *cmd = g_strdup_printf("STATUS \"%s\" (%s)", mbx7, items);
     g_mutex_lock(&r->mutex);
-    g_hash_table_insert(r->status_resps, (gpointer)what, res);
+    /* The server names the mailbox as we did. */
+    g_hash_table_insert(r->status_resps, mbx7, res);
     rc = imap_cmd_exec(r, cmd);
-    g_hash_table_remove(r->status_resps, what);
+    g_hash_table_remove(r->status_resps, mbx7);
     g_mutex_unlock(&r->mutex);
     g_free(mbx7); g_free(cmd);
     g_free(items);
   }
   return rc; 
 }
+
+/* "MESSAGES UNSEEN" for items, or NULL if there are none */
+static gchar*
+imap_status_items_string(const ImapStatusItem *items)
+{
+  const char *item_arr[G_N_ELEMENTS(imap_status_item_names)+1];
+  unsigned i;
+
+  for(i=0; items[i] != IMSTAT_NONE; i++) {
+    g_return_val_if_fail(i<G_N_ELEMENTS(imap_status_item_names), NULL);
+    g_return_val_if_fail(items[i]>=IMSTAT_MESSAGES &&
+                         items[i]<=IMSTAT_UNSEEN, NULL);
+    item_arr[i] = imap_status_item_names[items[i]];
+  }
+  item_arr[i] = NULL;
+  return i>0 ? g_strjoinv(" ", (gchar**)&item_arr[0]) : NULL;
+}
+
+/* Mailboxes per LIST-STATUS command, to keep the lines short, and
+   STATUS commands sent before their responses are read, to keep the
+   server's buffers and ours from filling up. */
+#define STATUS_LIST_CHUNK 64
+
+/* Runs cmds, reporting the STATUS responses to cb. Called with the
+   mutex locked. */
+static ImapResponse
+imap_mbox_status_exec(ImapMboxHandle *r, gchar **cmds, unsigned rc_cmd,
+                      const ImapStatusItem *items,
+                      ImapStatusCb cb, void *arg)
+{
+  ImapResponse rc;
+
+  r->status_cb = cb;
+  r->status_arg = arg;
+  r->status_items = items;
+  rc = imap_cmd_exec_cmds(r, (const char**)cmds, rc_cmd);
+  r->status_cb = NULL;
+  r->status_arg = NULL;
+  r->status_items = NULL;
+  return rc;
+}
+
+/** Asks for the status items of cnt mailboxes at once.  With RFC 5819
+    LIST-STATUS they are listed by one LIST command (or a few, for many
+    mailboxes) that returns their status as well; otherwise a STATUS
+    command is sent for each, pipelined in windows of a few dozen, so
+    that the round trips do not add up.  cb is called for each mailbox
+    the server reports; one that does not exist is just not reported.
+    Only a lost connection or a failed LIST fail the whole request. */
+ImapResponse
+imap_mbox_status_many(ImapMboxHandle *r, unsigned cnt, const char **mboxes,
+                      const ImapStatusItem *items,
+                      ImapStatusCb cb, void *arg)
+{
+  gchar *item_str, **cmds;
+  unsigned i, n;
+  ImapResponse rc;
+
+  g_return_val_if_fail(cb, IMR_BAD);
+  if(cnt == 0)
+    return IMR_OK;
+  if( (item_str = imap_status_items_string(items)) == NULL)
+    return IMR_BAD;
+
+  g_mutex_lock(&r->mutex);
+  if(!(r->state == IMHS_AUTHENTICATED || r->state == IMHS_SELECTED)) {
+    g_mutex_unlock(&r->mutex);
+    g_free(item_str);
+    return IMR_BAD;
+  }
+  if(imap_mbox_handle_can_do(r, IMCAP_LIST_STATUS)) {
+    cmds = g_new0(gchar*, (cnt+STATUS_LIST_CHUNK-1)/STATUS_LIST_CHUNK+1);
+    for(i=n=0; i<cnt; n++) {
+      GString *cmd = g_string_new("LIST \"\" (");
+      unsigned last = MIN(i+STATUS_LIST_CHUNK, cnt);
+      for(; i<last; i++) {
+        gchar *mbx7 = imap_utf8_to_mailbox(mboxes[i]);
+        g_string_append_printf(cmd, "%s\"%s\"",
+                               cmd->str[cmd->len-1] == '(' ? "" : " ", mbx7);
+        g_free(mbx7);
+      }
+      g_string_append_printf(cmd, ") RETURN (STATUS (%s))", item_str);
+      cmds[n] = g_string_free(cmd, FALSE);
+    }
+    /* A server that rejects the LIST answers NO to all of them. */
+    rc = imap_mbox_status_exec(r, cmds, 0, items, cb, arg);
+  } else {
+    /* No command is the one whose result counts: a NO only means that
+       the mailbox is not there. */
+    for(i=0, rc=IMR_OK; i<cnt && rc == IMR_OK; ) {
+      cmds = g_new0(gchar*, STATUS_LIST_CHUNK+1);
+      for(n=0; n<STATUS_LIST_CHUNK && i<cnt; n++, i++) {
+        gchar *mbx7 = imap_utf8_to_mailbox(mboxes[i]);
+        cmds[n] = g_strdup_printf("STATUS \"%s\" (%s)", mbx7, item_str);
+        g_free(mbx7);
+      }
+      rc = imap_mbox_status_exec(r, cmds, n, items, cb, arg);
+      g_strfreev(cmds);
+    }
+    cmds = NULL;
+  }
+  g_mutex_unlock(&r->mutex);
+  g_strfreev(cmds);
+  g_free(item_str);
+  return rc;
+}
+
 /* 6.3.11 APPEND Command */
 static gchar*
 enum_flag_to_str(ImapMsgFlags flg)
@@ -1113,19 +1262,22 @@ static void
 write_nstring(unsigned seqno, ImapFetchBodyType body_type,
               const char *str, size_t len, void *fl)
 {
-  if (fwrite(str, 1, len, (FILE*)fl) != len)
+  if (str && fwrite(str, 1, len, (FILE*)fl) != len)
     perror("write_nstring");
 }
 
 struct FetchBodyPassthroughData {
   ImapFetchBodyCb cb;
   void *arg;
-  char *body;
-  size_t body_length;
-  unsigned seqno;
+  GByteArray *body;   /* text received before the header */
+  unsigned seqno;     /* message of the header or text seen so far */
+  gboolean have_header;
+  gboolean have_text;
   unsigned pipeline_error;
 };
 
+/* The sections are passed in chunks, each one ending with a NULL
+   buffer. */
 static void
 fetch_body_passthrough(unsigned seqno,
 		       ImapFetchBodyType body_type,
@@ -1133,44 +1285,48 @@ fetch_body_passthrough(unsigned seqno,
 		       size_t buflen, void* arg)
 {
   struct FetchBodyPassthroughData* data = (struct FetchBodyPassthroughData*)arg;
+
+  if(body_type != IMAP_BODY_TYPE_RFC822 &&
+     data->seqno != 0 && data->seqno != seqno) {
+    /* This server sends data in a strange order that makes
+       efficient pipeline processing impossible. Just signal an
+       error. */
+    data->pipeline_error++;
+    return;
+  }
+
   switch(body_type) {
   case IMAP_BODY_TYPE_RFC822:
-    data->cb(seqno, buf, buflen, data->arg);
+    if(buf)
+      data->cb(seqno, buf, buflen, data->arg);
     break;
   case IMAP_BODY_TYPE_HEADER:
-    if(data->seqno == 0) {
-      data->seqno = seqno;
+    data->seqno = seqno;
+    if(buf) {
       data->cb(seqno, buf, buflen, data->arg);
-    } else {
-      if(data->seqno == seqno) {
-	data->cb(seqno, buf, buflen, data->arg);
-	data->cb(seqno, data->body, data->body_length, data->arg);
-	g_free(data->body);
-	data->body = NULL;
-	data->seqno = 0;
-      } else {
-	/* This server sends data in a strange order that makes
-	   efficient pipeline processing impossible. Just signal an
-	   error. */
-	data->pipeline_error++;
-      }
-    }
+    } else if(data->have_text) {
+      /* Text before header. Still, we can afford to invert it.. */
+      data->cb(seqno, (const char *) data->body->data, data->body->len,
+               data->arg);
+      g_byte_array_set_size(data->body, 0);
+      data->have_text = FALSE;
+      data->seqno = 0;
+    } else
+      data->have_header = TRUE;
     break;
   case IMAP_BODY_TYPE_TEXT:
-    if(data->seqno == seqno) {
-      data->cb(seqno, buf, buflen, data->arg);
-      data->seqno = 0;
-    } else {
-      /* Text before header. Still, we can afford to invert it.. */
-      if(data->body)
-	data->pipeline_error++; /* Unlikely... */
+    data->seqno = seqno;
+    if(data->have_header) {
+      if(buf)
+        data->cb(seqno, buf, buflen, data->arg);
       else {
-	data->body = g_malloc(buflen);
-	memcpy(data->body, buf, buflen);
-	data->body_length = buflen;
-	data->seqno = seqno;
+        data->have_header = FALSE;
+        data->seqno = 0;
       }
-    }
+    } else if(buf)
+      g_byte_array_append(data->body, (const guint8 *) buf, buflen);
+    else
+      data->have_text = TRUE;
     break;
   default:
     data->pipeline_error++;
@@ -1202,14 +1358,17 @@ imap_mbox_handle_fetch_rfc822(ImapMboxHandle* handle,
     struct FetchBodyPassthroughData passthrough_data;
     passthrough_data.cb = fetch_cb;
     passthrough_data.arg = fetch_cb_data;
-    passthrough_data.body = NULL;
+    passthrough_data.body = g_byte_array_new();
     passthrough_data.seqno = 0;
+    passthrough_data.have_header = FALSE;
+    passthrough_data.have_text = FALSE;
     passthrough_data.pipeline_error = 0;
     handle->body_cb  = fetch_cb ? fetch_body_passthrough : NULL;
     handle->body_arg = &passthrough_data;
     rc = imap_cmd_exec(handle, cmd);
     handle->body_cb  = cb;
     handle->body_arg = arg;
+    g_byte_array_unref(passthrough_data.body);
     g_free(cmd);
     g_free(seq);
     if(passthrough_data.pipeline_error){
@@ -1227,8 +1386,7 @@ imap_mbox_handle_fetch_rfc822(ImapMboxHandle* handle,
    principle undefined. */
 struct FetchBodyHeaderText {
   FILE *out_file;
-  char *body;
-  size_t length;
+  GByteArray *body;
   gboolean wrote_header;
 };
 
@@ -1242,25 +1400,28 @@ write_header_text_ordered(unsigned seqno, ImapFetchBodyType body_type,
     g_warning("Server sends unrequested RFC822 response");
     break; /* This is really unexpected response! */
   case IMAP_BODY_TYPE_HEADER:
-    if (fwrite(str, 1, len, fbht->out_file) != len)
-      perror("write_nstring");
+    if(str) {
+      if (fwrite(str, 1, len, fbht->out_file) != len)
+        perror("write_nstring");
+      break;
+    }
     fbht->wrote_header = TRUE;
-    if(fbht->body) {
-      if (fwrite(fbht->body, 1, fbht->length, fbht->out_file) != fbht->length)
+    if(fbht->body->len > 0) {
+      if (fwrite(fbht->body->data, 1, fbht->body->len, fbht->out_file)
+          != fbht->body->len)
 	perror("write_nstring");
-      g_free(fbht->body); fbht->body = NULL;
+      g_byte_array_set_size(fbht->body, 0);
     }
     break;
   case IMAP_BODY_TYPE_TEXT:
   case IMAP_BODY_TYPE_BODY:
+    if(!str)
+      break;
     if(fbht->wrote_header) {
       if (fwrite(str, 1, len, fbht->out_file) != len)
 	perror("write_nstring");
-    } else {
-      fbht->body = g_malloc(len);
-      fbht->length = len;
-      memcpy(fbht->body, str, len);
-    }
+    } else
+      g_byte_array_append(fbht->body, (const guint8 *) str, len);
     break;
   }
 }
@@ -1269,8 +1430,7 @@ write_header_text_ordered(unsigned seqno, ImapFetchBodyType body_type,
 struct PassHeaderTextOrdered {
   ImapFetchBodyCb cb;
   void *arg;
-  char *body;
-  size_t length;
+  GByteArray *body;
   gboolean wrote_header;
 };
 
@@ -1284,22 +1444,25 @@ pass_header_text_ordered(unsigned seqno, ImapFetchBodyType body_type,
     g_warning("Server sends unrequested RFC822 response");
     break; /* This is really unexpected response! */
   case IMAP_BODY_TYPE_HEADER:
-    phto->cb(seqno, str, len, phto->arg);
+    if(str) {
+      phto->cb(seqno, str, len, phto->arg);
+      break;
+    }
     phto->wrote_header = TRUE;
-    if(phto->body) {
-      phto->cb(seqno, phto->body, phto->length, phto->arg);
-      g_free(phto->body); phto->body = NULL;
+    if(phto->body->len > 0) {
+      phto->cb(seqno, (const char *) phto->body->data, phto->body->len,
+               phto->arg);
+      g_byte_array_set_size(phto->body, 0);
     }
     break;
   case IMAP_BODY_TYPE_TEXT:
   case IMAP_BODY_TYPE_BODY:
+    if(!str)
+      break;
     if(phto->wrote_header) {
       phto->cb(seqno, str, len, phto->arg);
-    } else {
-      phto->body = g_malloc(len);
-      phto->length = len;
-      memcpy(phto->body, str, len);
-    }
+    } else
+      g_byte_array_append(phto->body, (const guint8 *) str, len);
     break;
   }
 }
@@ -1326,7 +1489,7 @@ imap_mbox_handle_fetch_rfc822_uid(ImapMboxHandle* handle, unsigned uid,
   if(peek) {
     handle->body_cb  = write_header_text_ordered;
     handle->body_arg = &separate_arg;
-    separate_arg.body = NULL;
+    separate_arg.body = g_byte_array_new();
     separate_arg.wrote_header = FALSE;
     separate_arg.out_file = fl;
     cmdstr = "UID FETCH %u (BODY.PEEK[HEADER] BODY.PEEK[TEXT])";
@@ -1339,7 +1502,7 @@ imap_mbox_handle_fetch_rfc822_uid(ImapMboxHandle* handle, unsigned uid,
   snprintf(cmd, sizeof(cmd), cmdstr, uid);
   rc = imap_cmd_exec(handle, cmd);
   if(peek) {
-    g_free(separate_arg.body); /* This should never be needed. */
+    g_byte_array_unref(separate_arg.body);
   }
 
   handle->body_cb  = cb;
@@ -1362,6 +1525,8 @@ imap_binary_handler(unsigned seqno, ImapFetchBodyType body_type,
 		    const char *buf, size_t buflen, void* arg)
 {
   struct ImapBinaryData *ibd = (struct ImapBinaryData*)arg;
+  if(!buf)
+    return;
   if(ibd->first_run) {
     char *content_type = imap_body_get_content_type(ibd->body);
     char *str = g_strdup_printf("Content-Type: %s\r\n"
@@ -1420,7 +1585,7 @@ imap_mbox_handle_fetch_body(ImapMboxHandle* handle,
   handle->body_arg = &pass_ordered_data;
   pass_ordered_data.cb = body_cb;
   pass_ordered_data.arg = arg;
-  pass_ordered_data.body = NULL;
+  pass_ordered_data.body = g_byte_array_new();
   pass_ordered_data.wrote_header = FALSE;
   /* Pure IMAP without extensions */
   if(options == IMFB_NONE)
@@ -1446,7 +1611,7 @@ imap_mbox_handle_fetch_body(ImapMboxHandle* handle,
              seqno, peek_string, prefix, peek_string, section);
   }
   rc = imap_cmd_exec(handle, cmd);
-  g_free(pass_ordered_data.body);
+  g_byte_array_unref(pass_ordered_data.body);
   handle->body_cb  = fcb;
   handle->body_arg = farg;
 
@@ -1599,6 +1764,57 @@ imap_mbox_handle_copy(ImapMboxHandle* handle, unsigned cnt, unsigned *seqno,
   return rc;
 }
 
+/** imap_mbox_handle_move() moves given set of seqno from the mailbox
+    selected in handle to given mailbox on same server, using the MOVE
+    command of RFC 6851.  The server expunges the messages from the
+    selected mailbox before it completes the command, so the
+    expunge-notify signal is emitted for them.  Returns IMR_NO
+    without sending anything if the server does not support MOVE. */
+ImapResponse
+imap_mbox_handle_move(ImapMboxHandle* handle, unsigned cnt, unsigned *seqno,
+                      const gchar *dest,
+		      ImapSequence *ret_sequence)
+{
+  ImapResponse rc;
+
+  g_mutex_lock(&handle->mutex);
+  IMAP_REQUIRED_STATE1(handle, IMHS_SELECTED, IMR_BAD);
+  if(!imap_mbox_handle_can_do(handle, IMCAP_MOVE)) {
+    g_mutex_unlock(&handle->mutex);
+    return IMR_NO;
+  }
+  {
+    gchar *mbx7 = imap_utf8_to_mailbox(dest);
+    char *seq = imap_coalesce_set(cnt, seqno);
+    gchar *cmd = g_strdup_printf("MOVE %s \"%s\"", seq, mbx7);
+    unsigned cmdno;
+    gboolean use_uidplus = imap_mbox_handle_can_do(handle, IMCAP_UIDPLUS);
+
+    /* With UIDPLUS, the COPYUID code comes in an untagged OK response
+       sent before the expunges. */
+    if(ret_sequence) {
+      ret_sequence->ranges = NULL;
+      handle->uidplus.store_response = 1;
+    } else
+      handle->uidplus.store_response = 0;
+
+    rc = imap_cmd_exec_cmdno(handle, cmd, &cmdno);
+    g_free(seq); g_free(mbx7); g_free(cmd);
+    if(use_uidplus && ret_sequence) {
+      if(rc == IMR_OK) {
+	ret_sequence->uid_validity = handle->uidplus.dst_uid_validity;
+	ret_sequence->ranges = g_list_reverse(handle->uidplus.dst);
+      } else {
+	g_list_free(handle->uidplus.dst);
+      }
+      handle->uidplus.dst = NULL;
+      handle->uidplus.store_response = 0;
+    }
+  }
+  g_mutex_unlock(&handle->mutex);
+  return rc;
+}
+
 /* 6.4.8 UID Command */
 /* FIXME: implement */
 /* implemented as alternatives of the commands */
@@ -2062,7 +2278,9 @@ msgid_cb(unsigned seqno, ImapFetchBodyType body_type,
 	 const char *buf, size_t buflen, void* arg)
 {
   GPtrArray *arr = (GPtrArray*)arg;
+  if(!buf) return; /* end of the header fields */
   g_return_if_fail(seqno>=1 && seqno<=arr->len);
+  g_free(g_ptr_array_index(arr, seqno-1));
   g_ptr_array_index(arr, seqno-1) = g_strdup(buf);
 }
 
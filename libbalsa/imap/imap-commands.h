@@ -54,6 +54,14 @@ struct ImapStatusResult {
 };
 ImapResponse imap_mbox_status(ImapMboxHandle *r, const char*what, 
                               struct ImapStatusResult *res);
+/* Called for each mailbox a bulk STATUS reports, with its UTF-8 name
+   and the items asked for, in that order. */
+typedef void (*ImapStatusCb)(ImapMboxHandle *handle, const char *mbox,
+                             const struct ImapStatusResult *res, void *arg);
+ImapResponse imap_mbox_status_many(ImapMboxHandle *r, unsigned cnt,
+                                   const char **mboxes,
+                                   const ImapStatusItem *items,
+                                   ImapStatusCb cb, void *arg);
 typedef size_t (*ImapAppendFunc)(char*, size_t, void*);
 ImapResponse imap_mbox_append(ImapMboxHandle *handle, const char *mbox,
                               ImapMsgFlags flags, size_t sz, 
@@ -98,6 +106,10 @@ ImapResponse imap_mbox_handle_copy(ImapMboxHandle* handle,
 				   unsigned cnt, unsigned *seqno,
 				   const gchar *dest,
 				   ImapSequence *ret_sequence);
+ImapResponse imap_mbox_handle_move(ImapMboxHandle* handle,
+				   unsigned cnt, unsigned *seqno,
+				   const gchar *dest,
+				   ImapSequence *ret_sequence);
 
 ImapResponse imap_mbox_find_unseen(ImapMboxHandle * h, unsigned *msgcnt,
 				   unsigned **msgs);
@@ -61,6 +61,9 @@ static void imap_mbox_handle_finalize(GObject* gobject);
 static ImapResult imap_mbox_connect(ImapMboxHandle* handle);
 
 static ImapResponse ir_handle_response(ImapMboxHandle *h);
+static void ir_expunge_flush(ImapMboxHandle *h);
+static void imap_mbox_resolve_vanished(ImapMboxHandle *h);
+static void uid_ranges_normalize(GArray *ranges);
 
 static ImapAddress* imap_address_from_string(const gchar *string, gchar **n);
 static gchar*       imap_address_to_string(const ImapAddress *addr);
@@ -82,6 +85,7 @@ imap_mbox_handle_init(ImapMboxHandle *handle)
 {
   handle->timeout = -1;
   handle->flag_cache=  g_array_new(FALSE, TRUE, sizeof(ImapFlagCache));
+  handle->expunged = g_array_new(FALSE, FALSE, sizeof(unsigned));
   handle->status_resps = g_hash_table_new_full(g_str_hash, g_str_equal,
                                                NULL, NULL);
   handle->state = IMHS_DISCONNECTED;
@@ -150,7 +154,7 @@ imap_mbox_handle_class_init(ImapMboxHandleClass * klass)
                  G_SIGNAL_RUN_FIRST,
                  0, NULL, NULL,
                  NULL, G_TYPE_NONE, 1,
-		 G_TYPE_INT);
+		 G_TYPE_POINTER);
 
   imap_mbox_handle_signals[EXISTS_NOTIFY] = 
     g_signal_new("exists-notify",
@@ -310,7 +314,7 @@ async_process_real(ImapMboxHandle *h)
 	g_debug("%s: ENTER", __func__);
 	async_cmd = cmdi_get_pending(h->cmd_info);
 	g_debug("%s: enter loop, cmnd %u", __func__, async_cmd);
-	while (net_client_can_read(NET_CLIENT(h->sio))) {
+	while (net_client_siobuf_can_read(h->sio)) {
 		rc = imap_cmd_step(h, async_cmd);
 		if (h->idle_state == IDLE_RESPONSE_PENDING) {
 			int c;
@@ -338,6 +342,17 @@ async_process_real(ImapMboxHandle *h)
 			async_cmd);
 	}
 	g_debug("%s: loop left", __func__);
+	/* While idling, nothing need follow a run of EXPUNGEs. */
+	ir_expunge_flush(h);
+	if (h->vanished_unresolved) {
+		/* This leaves IDLE, and removes the socket source. */
+		imap_mbox_resolve_vanished(h);
+		if (IMAP_MBOX_IS_DISCONNECTED(h))
+			return G_SOURCE_REMOVE;
+		async_cmd = cmdi_get_pending(h->cmd_info);
+		if (async_cmd != 0)
+			socket_source_add(h);
+	}
 	if (h->idle_state == IDLE_INACTIVE && async_cmd == 0) {
 		g_debug("%s: Last async command completed.", __func__);
 		socket_source_remove(h);
@@ -508,6 +523,8 @@ imap_handle_disconnect(ImapMboxHandle *h)
 {
   gboolean G_GNUC_UNUSED dummy;
   dummy = imap_handle_idle_disable(h);
+  /* the server has expunged them, whether we hear more or not */
+  ir_expunge_flush(h);
   if(h->sio) {
     g_object_unref(h->sio); h->sio = NULL;
   }
@@ -662,6 +679,7 @@ imap_mbox_connect(ImapMboxHandle* handle)
   handle->op_cancelled = FALSE;
   handle->has_capabilities = FALSE;
   handle->can_fetch_body = TRUE;
+  handle->qresync_enabled = FALSE;
   handle->idle_state = IDLE_INACTIVE;
   if(handle->sio) {
     g_object_unref(handle->sio); handle->sio = NULL;
@@ -801,6 +819,37 @@ imap_mbox_handle_get_uidnext(ImapMboxHandle* handle)
   return handle->uidnext;
 }
 
+guint64
+imap_mbox_handle_get_highestmodseq(ImapMboxHandle* handle)
+{
+  return handle->highestmodseq;
+}
+
+/** Sets the mailbox state known to the client, from an earlier
+    session. If the server supports QRESYNC (RFC 7162), the next
+    SELECT reports only what has changed since then: the flags of
+    changed messages as untagged FETCH responses, and the expunged
+    messages, which imap_mbox_handle_get_vanished() returns. */
+void
+imap_mbox_handle_set_qresync(ImapMboxHandle* handle, unsigned uidval,
+                             guint64 modseq)
+{
+  handle->qresync.uidval = uidval;
+  handle->qresync.modseq = modseq;
+}
+
+/** Returns the UIDs of the messages expunged since the state passed to
+    imap_mbox_handle_set_qresync(), as sorted, disjoint ImapUidRange
+    items, or NULL if the last SELECT did not resynchronize. In the
+    latter case, the flags of the messages are not known either. */
+const GArray*
+imap_mbox_handle_get_vanished(ImapMboxHandle* handle)
+{
+  if(handle->qresync.vanished)
+    uid_ranges_normalize(handle->qresync.vanished);
+  return handle->qresync.vanished;
+}
+
 static void
 get_delim(ImapMboxHandle* handle, int delim, ImapMboxFlags flags,
           char *folder, int *my_delim)
@@ -884,6 +933,9 @@ imap_mbox_handle_finalize(GObject* gobject)
   imap_mbox_resize_cache(handle, 0);
   g_free(handle->msg_cache);
   g_array_free(handle->flag_cache, TRUE);
+  g_array_free(handle->expunged, TRUE);
+  if (handle->qresync.vanished != NULL)
+    g_array_free(handle->qresync.vanished, TRUE);
   g_list_foreach(handle->acls, (GFunc)imap_user_acl_free, NULL);
   g_list_free(handle->acls);
   g_free(handle->quota_root);
@@ -1646,12 +1698,40 @@ imap_message_free(ImapMessage *msg)
   g_free(msg);
 }
 
+/* imap_mbox_handle_msg_deserialize:
+   restores a message from an earlier session. When flags_current is
+   set, the server has reported all flag changes since then, so the
+   stored flags are valid, except for the session-bound \Recent. A
+   message that the server has just reported on keeps its fresh
+   flags. */
 void
 imap_mbox_handle_msg_deserialize(ImapMboxHandle *h, unsigned msgno,
-                                 void *data)
+                                 void *data, gboolean flags_current)
 {
-  if(msgno>=1 && msgno <=h->exists && !h->msg_cache[msgno-1])
-    h->msg_cache[msgno-1] = imap_message_deserialize(data);
+  ImapMessage *imsg, *old;
+  ImapFlagCache *flags;
+
+  if(msgno<1 || msgno>h->exists)
+    return;
+  old = h->msg_cache[msgno-1];
+  if(old && (old->envelope || !flags_current))
+    return;
+
+  imsg = imap_message_deserialize(data);
+  if(old) {
+    if(old->uid != 0 && old->uid != imsg->uid) {
+      imap_message_free(imsg);
+      return;
+    }
+    imsg->flags = old->flags;
+    imap_message_free(old);
+  } else if(flags_current) {
+    imsg->flags &= ~IMSGF_RECENT;
+    flags = &g_array_index(h->flag_cache, ImapFlagCache, msgno-1);
+    flags->flag_values = imsg->flags;
+    flags->known_flags = ~IMSGF_RECENT;
+  }
+  h->msg_cache[msgno-1] = imsg;
 }
 /* Serialize message itself and the envelope, and the body structure
    if available. */
@@ -1818,8 +1898,10 @@ imap_cmd_step(ImapMboxHandle* handle, unsigned lastcmd)
   }
 
   /* server demands a continuation response from us */
-  if (strcmp(tag, "+") == 0)
+  if (strcmp(tag, "+") == 0) {
+    ir_expunge_flush(handle);
     return IMR_RESPOND;
+  }
 
   /* tagged completion code is the only alternative. */
   /* our command tags are hexadecimal numbers, at most 7 chars */
@@ -1898,6 +1980,8 @@ imap_cmd_exec_cmdno(ImapMboxHandle* handle, const char* cmd,
     return IMR_SEVERED;
 
   rc = imap_cmd_process_untagged(handle, cmdno);
+  if(handle->vanished_unresolved)
+    imap_mbox_resolve_vanished(handle);
 
   imap_handle_idle_enable(handle, IDLE_TIMEOUT);
 
@@ -1956,12 +2040,37 @@ imap_cmd_exec_cmds(ImapMboxHandle* handle, const char** cmds,
     }
   }
   g_free(cmdnos);
+  if(handle->vanished_unresolved)
+    imap_mbox_resolve_vanished(handle);
       
   imap_handle_idle_enable(handle, IDLE_TIMEOUT);
 
   return ret_rc;
 }
 
+/* Read the length of a literal or literal8 starting with c, up to and
+   including the CRLF preceding its data. Returns -1 on error. */
+static int
+imap_get_literal_length(NetClientSioBuf *sio, int c)
+{
+  char buf[15];
+  int len;
+
+  if(c=='~') /* BINARY extension literal8 indicator */
+    c = sio_getc(sio);
+  if(c!='{')
+    return -1;
+
+  c = imap_get_atom(sio, buf, sizeof(buf));
+  len = strlen(buf);
+  if(len==0 || buf[len-1] != '}') return -1;
+  buf[len-1] = '\0';
+  len = strtol(buf, NULL, 10);
+  if( c != 0x0d) { g_debug("lit1:%d",c); return -1;}
+  if( (c=sio_getc(sio)) != 0x0a) { g_debug("lit1:%d",c); return -1;}
+  return len;
+}
+
 static GString*
 imap_get_string_with_lookahead(NetClientSioBuf *sio, int c)
 { /* string */  
@@ -1974,21 +2083,9 @@ imap_get_string_with_lookahead(NetClientSioBuf *sio, int c)
       g_string_append_c(res, c);
     }
   } else { /* this MUST be literal */
-    char buf[15];
-    int len;
-    if(c=='~') /* BINARY extension literal8 indicator */
-      c = sio_getc(sio);
-    if(c!='{') {
+    int len = imap_get_literal_length(sio, c);
+    if(len<0)
       return NULL; /* ERROR */
-    }
-
-    c = imap_get_atom(sio, buf, sizeof(buf));
-    len = strlen(buf); 
-    if(len==0 || buf[len-1] != '}') return NULL;
-    buf[len-1] = '\0';
-    len = strtol(buf, NULL, 10);
-    if( c != 0x0d) { g_debug("lit1:%d",c); return NULL;}
-    if( (c=sio_getc(sio)) != 0x0a) { g_debug("lit1:%d",c); return NULL;}
     res = g_string_sized_new(len+1);
     if(len>0) sio_read(sio, res->str, len);
     res->len = len;
@@ -2049,16 +2146,56 @@ imap_get_astring(NetClientSioBuf *sio, int* lookahead)
   return res;
 }
 
-/* nstring / literal8 as in the BINARY extension */
-static GString*
-imap_get_binary_string(NetClientSioBuf *sio)
+struct BodyStringSink {
+  unsigned seqno;
+  ImapFetchBodyType body_type;
+  ImapFetchBodyInternalCb body_cb;
+  void *arg;
+};
+
+static gboolean
+body_string_sink(const gchar *data, gsize count, gpointer user_data,
+                 GError **error)
+{
+  struct BodyStringSink *bss = (struct BodyStringSink*)user_data;
+  if(bss->body_cb)
+    bss->body_cb(bss->seqno, bss->body_type, data, count, bss->arg);
+  return TRUE;
+}
+
+/* Read an nstring or a literal8 as in the BINARY extension, and pass
+   it to body_cb as it is received, without collecting it first; NIL
+   is passed as an empty string. The end is signalled by passing
+   NULL. */
+static ImapResponse
+imap_get_body_string(NetClientSioBuf *sio, unsigned seqno,
+                     ImapFetchBodyType body_type,
+                     ImapFetchBodyInternalCb body_cb, void *arg)
 {
   int c = sio_getc(sio);
+
   if(toupper(c)=='N') { /* nil */
     sio_getc(sio); sio_getc(sio); /* ignore i and l */
-    return g_string_new("");
-  } else
-    return imap_get_string_with_lookahead(sio, c);
+    if(body_cb)
+      body_cb(seqno, body_type, "", 0, arg);
+  } else if(c=='"') { /* quoted */
+    GString *bs = imap_get_string_with_lookahead(sio, c);
+    if(body_cb)
+      body_cb(seqno, body_type, bs->str, bs->len, arg);
+    g_string_free(bs, TRUE);
+  } else {
+    struct BodyStringSink bss = { seqno, body_type, body_cb, arg };
+    int len = imap_get_literal_length(sio, c);
+
+    if(len<0)
+      return IMR_PROTOCOL;
+    if(len>0 && !net_client_siobuf_read_sink(sio, len, body_string_sink,
+                                             &bss, NULL))
+      return IMR_SEVERED;
+  }
+  if(body_cb)
+    body_cb(seqno, body_type, NULL, 0, arg);
+  return IMR_OK;
 }
 
 /* this file contains all the response handlers as defined in
@@ -2102,9 +2239,10 @@ ir_capability_data(ImapMboxHandle *handle)
     "IMAP4", "IMAP4rev1", "STATUS",
     "AUTH=ANONYMOUS", "AUTH=CRAM-MD5", "AUTH=GSSAPI", "AUTH=PLAIN",
     "ACL", "RIGHTS=", "BINARY", "CHILDREN",
-    "COMPRESS=DEFLATE",
-    "ESEARCH", "IDLE", "LITERAL+",
-    "LOGINDISABLED", "MULTIAPPEND", "NAMESPACE", "QUOTA", "SASL-IR",
+    "COMPRESS=DEFLATE", "CONDSTORE", "ENABLE",
+    "ESEARCH", "IDLE", "LIST-STATUS", "LITERAL+",
+    "LOGINDISABLED", "MOVE", "MULTIAPPEND", "NAMESPACE", "QRESYNC", "QUOTA",
+    "SASL-IR",
     "SCAN", "STARTTLS",
     "SORT", "THREAD=ORDEREDSUBJECT", "THREAD=REFERENCES",
     "UIDPLUS", "UNSELECT"
@@ -2224,7 +2362,7 @@ ir_resp_text_code(ImapMboxHandle *h)
   static const char* resp_text_code[] = {
     "ALERT", "BADCHARSET", "CAPABILITY","PARSE", "PERMANENTFLAGS",
     "READ-ONLY", "READ-WRITE", "TRYCREATE", "UIDNEXT", "UIDVALIDITY",
-    "UNSEEN", "APPENDUID", "COPYUID"
+    "UNSEEN", "APPENDUID", "COPYUID", "HIGHESTMODSEQ", "NOMODSEQ"
   };
   unsigned o;
   char buf[128];
@@ -2267,6 +2405,13 @@ ir_resp_text_code(ImapMboxHandle *h)
       return rc;
     c = sio_getc(h->sio);
     break;
+  case 13: /* HIGHESTMODSEQ, RFC 7162 */
+    c = imap_get_atom(h->sio, buf, sizeof(buf));
+    h->highestmodseq = g_ascii_strtoull(buf, NULL, 10);
+    break;
+  case 14: /* NOMODSEQ: the mailbox does not keep them */
+    h->highestmodseq = 0;
+    break;
   default: while( c != ']' && (c=sio_getc(h->sio)) != EOF) ; break;
   }
   if(c != ']')
@@ -2399,7 +2544,7 @@ ir_list_lsub(ImapMboxHandle *h, ImapHandleSignal signal)
 {
   const char* mbx_flags[] = {
     "Marked", "Unmarked", "Noselect", "Noinferiors",
-    "HasChildren", "HasNoChildren"
+    "HasChildren", "HasNoChildren", "NonExistent"
   };
   ImapMboxFlags flags = 0;
   char buf[LONG_STRING], *s, *mbx;
@@ -2436,6 +2581,10 @@ ir_list_lsub(ImapMboxHandle *h, ImapHandleSignal signal)
   /* mailbox */
   s = imap_get_astring(h->sio, &c);
   mbx = imap_mailbox_to_utf8(s);
+  /* RFC 5258 extended data, which we did not ask for */
+  if(c == ' ')
+    while( (c=sio_getc(h->sio)) != EOF && c != 0x0d)
+      ;
   rc = ir_check_crlf(h, c);
   g_signal_emit(h, imap_mbox_handle_signals[signal],
                 0, delim, flags, mbx);
@@ -2464,17 +2613,27 @@ ir_status(ImapMboxHandle *h)
 {
   int c;
   char *name;
-  struct ImapStatusResult *resp;
+  struct ImapStatusResult *resp, *bulk = NULL;
+  ImapResponse rc;
 
   name = imap_get_astring(h->sio, &c);
   resp = g_hash_table_lookup(h->status_resps, name);
-  if(c                != ' ') {g_free(name); return IMR_PROTOCOL;}
-  if(sio_getc(h->sio) != '(') {g_free(name); return IMR_PROTOCOL;}
+  if(!resp && h->status_cb) {
+    unsigned i;
+    for(i=0; h->status_items[i] != IMSTAT_NONE; i++)
+      ;
+    resp = bulk = g_new0(struct ImapStatusResult, i+1);
+    for(i=0; h->status_items[i] != IMSTAT_NONE; i++)
+      bulk[i].item = h->status_items[i];
+    bulk[i].item = IMSTAT_NONE;
+  }
+  if(c                != ' ') {g_free(name); g_free(bulk); return IMR_PROTOCOL;}
+  if(sio_getc(h->sio) != '(') {g_free(name); g_free(bulk); return IMR_PROTOCOL;}
   do {
     char item[13], count[13]; /* longest than UIDVALIDITY */
     c = imap_get_atom(h->sio, item, sizeof(item));
     if(c == ')') break;
-    if(c != ' ') {g_free(name); return IMR_PROTOCOL;}
+    if(c != ' ') {g_free(name); g_free(bulk); return IMR_PROTOCOL;}
     c = imap_get_atom(h->sio, count, sizeof(count));
     /* FIXME: process the response */
     if(resp) {
@@ -2486,6 +2645,7 @@ ir_status(ImapMboxHandle *h)
         if(resp[i].item == idx) {
           if (sscanf(count, "%13u", &resp[i].result) != 1) {
             g_free(name);
+            g_free(bulk);
             return IMR_PROTOCOL;
           }
           break;
@@ -2493,9 +2653,18 @@ ir_status(ImapMboxHandle *h)
       }
     }
   } while(c == ' ');
-  g_free(name);
   /* g_return_val_if-fail(c == ')', IMR_BAD) */
-  return ir_check_crlf(h, sio_getc(h->sio));
+  rc = ir_check_crlf(h, sio_getc(h->sio));
+  if(bulk) {
+    if(rc == IMR_OK) {
+      char *mbx = imap_mailbox_to_utf8(name);
+      h->status_cb(h, mbx, bulk, h->status_arg);
+      g_free(mbx);
+    }
+    g_free(bulk);
+  }
+  g_free(name);
+  return rc;
 }
 
 static void
@@ -2621,22 +2790,82 @@ ir_recent(ImapMboxHandle *h, unsigned seqno)
   return ir_check_crlf(h, sio_getc(h->sio));
 }
 
+/* ir_expunge_flush:
+   Applies the EXPUNGE responses collected since the last flush.  A
+   server sends a run of them, one per message, for an EXPUNGE or a
+   MOVE command; removing the messages one at a time from the caches
+   and from the view shifts their tails for every message, so the run
+   is collected and applied in a single pass instead, before the next
+   response that can refer to message numbers.  "expunge-notify" is
+   emitted once, with the seqnos as they were before the run, while the
+   caches still describe the removed messages. */
+static void
+ir_expunge_flush(ImapMboxHandle *h)
+{
+  GArray *expunged = h->expunged;
+  unsigned *seqnos = (unsigned*)expunged->data;
+  unsigned i, src, dest;
+
+  if(expunged->len == 0)
+    return;
+
+  g_signal_emit(h, imap_mbox_handle_signals[EXPUNGE_NOTIFY],
+		0, expunged);
+
+  for(i=0, dest=src=0; src<h->exists; src++) {
+    if(i<expunged->len && seqnos[i] == src+1) {
+      if(h->msg_cache[src] != NULL)
+        imap_message_free(h->msg_cache[src]);
+      i++;
+      continue;
+    }
+    if(dest != src) {
+      h->msg_cache[dest] = h->msg_cache[src];
+      g_array_index(h->flag_cache, ImapFlagCache, dest) =
+        g_array_index(h->flag_cache, ImapFlagCache, src);
+    }
+    dest++;
+  }
+  for(src=dest; src<h->exists; src++)
+    h->msg_cache[src] = NULL;
+  g_array_set_size(h->flag_cache, dest);
+  h->exists = dest;
+  mbox_view_expunge(&h->mbox_view, seqnos, expunged->len);
+  g_array_set_size(expunged, 0);
+}
+
+/* ir_expunge_add:
+   Queues the message that is seqno after the collected EXPUNGE
+   responses have been applied.  Its number before them is seqno plus
+   the number of queued messages that preceded it; since
+   expunged[i] - i does not decrease with i, that number is found by
+   bisection. */
+static void
+ir_expunge_add(ImapMboxHandle *h, unsigned seqno)
+{
+  GArray *expunged = h->expunged;
+  unsigned lo = 0, hi = expunged->len;
+
+  if(seqno == 0 || seqno > h->exists - expunged->len) {
+    g_warning("EXPUNGE of message %u out of %u ignored.",
+              seqno, h->exists - expunged->len);
+    return;
+  }
+  while(lo < hi) {
+    unsigned mid = lo + (hi - lo) / 2;
+    if(g_array_index(expunged, unsigned, mid) - mid <= seqno)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  g_array_insert_val(expunged, lo, seqno + lo);
+}
+
 static ImapResponse
 ir_expunge(ImapMboxHandle *h, unsigned seqno)
 {
   ImapResponse rc = ir_check_crlf(h, sio_getc(h->sio));
-  g_signal_emit(h, imap_mbox_handle_signals[EXPUNGE_NOTIFY],
-		0, seqno);
-  
-  g_array_remove_index(h->flag_cache, seqno-1);
-  if(h->msg_cache[seqno-1] != NULL)
-    imap_message_free(h->msg_cache[seqno-1]);
-  while(seqno<h->exists) {
-    h->msg_cache[seqno-1] = h->msg_cache[seqno];
-    seqno++;
-  }
-  h->exists--;
-  mbox_view_expunge(&h->mbox_view, seqno);
+  ir_expunge_add(h, seqno);
   return rc;
 }
 
@@ -3146,11 +3375,8 @@ ir_msg_att_internaldate(ImapMboxHandle *h, int c, unsigned seqno)
 static ImapResponse
 ir_msg_att_rfc822(ImapMboxHandle *h, int c, unsigned seqno)
 {
-  gchar *str = imap_get_nstring(h->sio);
-  if(str && h->body_cb)
-    h->body_cb(seqno, IMAP_BODY_TYPE_RFC822, str, strlen(str), h->body_arg);
-  g_free(str);
-  return IMR_OK;
+  return imap_get_body_string(h->sio, seqno, IMAP_BODY_TYPE_RFC822,
+                              h->body_cb, h->body_arg);
 }
 
 static ImapResponse
@@ -3836,7 +4062,6 @@ ir_body_section(NetClientSioBuf *sio, unsigned seqno,
 		ImapFetchBodyInternalCb body_cb, void *arg)
 {
   char buf[80];
-  GString *bs;
   int i, c = imap_get_atom(sio, buf, sizeof(buf));
 
   for(i=0; buf[i] && (isdigit((int)buf[i]) || buf[i] == '.'); i++)
@@ -3846,13 +4071,7 @@ ir_body_section(NetClientSioBuf *sio, unsigned seqno,
 
   if(c != ']') { puts("] expected"); return IMR_PROTOCOL; }
   if(sio_getc(sio) != ' ') { puts("space expected"); return IMR_PROTOCOL;}
-  bs = imap_get_binary_string(sio);
-  if(bs) {
-    if(bs->str && body_cb)
-      body_cb(seqno, body_type, bs->str, bs->len, arg);
-    g_string_free(bs, TRUE);
-  }
-  return IMR_OK;
+  return imap_get_body_string(sio, seqno, body_type, body_cb, arg);
 }
 
 static ImapResponse
@@ -3876,8 +4095,11 @@ ir_body_header_fields(ImapMboxHandle *h, unsigned seqno)
 
   tmp = imap_get_nstring(h->sio);
   if(h->body_cb) {
-    if(tmp) h->body_cb(seqno, IMAP_BODY_TYPE_HEADER,
-		       tmp, strlen(tmp), h->body_arg);
+    if(tmp) {
+      h->body_cb(seqno, IMAP_BODY_TYPE_HEADER,
+                 tmp, strlen(tmp), h->body_arg);
+      h->body_cb(seqno, IMAP_BODY_TYPE_HEADER, NULL, 0, h->body_arg);
+    }
     g_free(tmp);
   } else {
     CREATE_IMSG_IF_NEEDED(h, seqno);
@@ -3965,6 +4187,29 @@ ir_msg_att_uid(ImapMboxHandle *h, int c, unsigned seqno)
   return IMR_OK;
 }
 
+/* RFC 7162: MODSEQ (<mod-sequence-value>). We do not keep it per
+   message: the mailbox HIGHESTMODSEQ is all we need to resynchronize.
+   With QRESYNC, expunges are reported as VANISHED, so having seen the
+   change, we are up to date to its MODSEQ; keep HIGHESTMODSEQ current
+   for the next session. */
+static ImapResponse
+ir_msg_att_modseq(ImapMboxHandle *h, int c, unsigned seqno)
+{
+  char buf[24];
+  guint64 modseq;
+
+  if(c != ' ' || sio_getc(h->sio) != '(')
+    return IMR_PROTOCOL;
+  c = imap_get_atom(h->sio, buf, sizeof(buf));
+  if(c != ')')
+    return IMR_PROTOCOL;
+  modseq = g_ascii_strtoull(buf, NULL, 10);
+  if(h->qresync_enabled && h->highestmodseq != 0 &&
+     modseq > h->highestmodseq)
+    h->highestmodseq = modseq;
+  return IMR_OK;
+}
+
 static ImapResponse
 ir_fetch_seq(ImapMboxHandle *h, unsigned seqno)
 {
@@ -3982,7 +4227,8 @@ ir_fetch_seq(ImapMboxHandle *h, unsigned seqno)
     { "BINARY",        ir_msg_att_body }, 
     { "BODY",          ir_msg_att_body }, 
     { "BODYSTRUCTURE", ir_msg_att_bodystructure }, 
-    { "UID",           ir_msg_att_uid }
+    { "UID",           ir_msg_att_uid },
+    { "MODSEQ",        ir_msg_att_modseq }
   };
   char atom[LONG_STRING]; /* make sure LONG_STRING is longer than all */
                           /* strings above */
@@ -4111,6 +4357,251 @@ ir_thread(ImapMboxHandle *h)
 }
 
 
+/* RFC 5161: ENABLED <capability>... */
+static ImapResponse
+ir_enabled(ImapMboxHandle *h)
+{
+  char atom[LONG_STRING];
+  int c;
+
+  do {
+    c = imap_get_atom(h->sio, atom, sizeof(atom));
+    if(g_ascii_strcasecmp(atom, "QRESYNC") == 0)
+      h->qresync_enabled = TRUE;
+  } while(c == ' ');
+
+  return ir_check_crlf(h, c);
+}
+
+static void
+append_vanished_range(ImapUidRange *iur, GArray *ranges)
+{
+  ImapUidRange range;
+
+  /* "7:3" is a valid way of writing "3:7". */
+  range.lo = MIN(iur->lo, iur->hi);
+  range.hi = MAX(iur->lo, iur->hi);
+  g_array_append_val(ranges, range);
+}
+
+static gint
+uid_range_cmp(gconstpointer a, gconstpointer b)
+{
+  const ImapUidRange *ra = a, *rb = b;
+
+  return ra->lo < rb->lo ? -1 : ra->lo > rb->lo;
+}
+
+/* Sorts the ranges and merges those that overlap or touch. */
+static void
+uid_ranges_normalize(GArray *ranges)
+{
+  unsigned i, n;
+
+  if(ranges->len < 2)
+    return;
+  g_array_sort(ranges, uid_range_cmp);
+  for(i=1, n=0; i<ranges->len; i++) {
+    ImapUidRange *last = &g_array_index(ranges, ImapUidRange, n);
+    ImapUidRange *r = &g_array_index(ranges, ImapUidRange, i);
+
+    if(last->hi == G_MAXUINT || r->lo <= last->hi + 1) {
+      if(r->hi > last->hi)
+        last->hi = r->hi;
+    } else
+      g_array_index(ranges, ImapUidRange, ++n) = *r;
+  }
+  g_array_set_size(ranges, n+1);
+}
+
+static gboolean
+uid_ranges_contain(GArray *ranges, ImapUID uid)
+{
+  unsigned lo = 0, hi = ranges->len;
+
+  while(lo < hi) {
+    unsigned mid = lo + (hi-lo)/2;
+    ImapUidRange *r = &g_array_index(ranges, ImapUidRange, mid);
+
+    if(uid < r->lo)
+      hi = mid;
+    else if(uid > r->hi)
+      lo = mid + 1;
+    else
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* With QRESYNC enabled, the server reports expunged messages by UID
+   instead of sending EXPUNGE responses. */
+static ImapResponse
+ir_vanished_expunge(ImapMboxHandle *h, GArray *ranges)
+{
+  guint64 n_uids = 0;
+  unsigned i, seqno, found = 0;
+  gboolean uids_unknown = FALSE;
+
+  uid_ranges_normalize(ranges);
+  for(i=0; i<ranges->len; i++) {
+    ImapUidRange *r = &g_array_index(ranges, ImapUidRange, i);
+    n_uids += (guint64) r->hi - r->lo + 1;
+  }
+
+  /* The earlier EXPUNGE responses have been applied, so the seqnos
+     are collected in ascending order and expunged together. */
+  for(seqno=1; seqno<=h->exists; seqno++) {
+    ImapMessage *imsg = h->msg_cache[seqno-1];
+
+    if(imsg == NULL || imsg->uid == 0)
+      uids_unknown = TRUE;
+    else if(uid_ranges_contain(ranges, imsg->uid)) {
+      g_array_append_val(h->expunged, seqno);
+      found++;
+    }
+  }
+  ir_expunge_flush(h);
+
+  if(found < n_uids && uids_unknown) {
+    /* Some of the expunged messages are among those whose UIDs we
+       never fetched, and we cannot tell which ones yet: ask the
+       server for the UIDs when the current command has completed. */
+    h->vanished_unresolved = 1;
+  }
+  return IMR_OK;
+}
+
+static void
+collect_uid_cb(ImapMboxHandle *h, unsigned uid, GArray *uids)
+{
+  g_array_append_val(uids, uid);
+}
+
+static gint
+uid_cmp(gconstpointer a, gconstpointer b)
+{
+  ImapUID ua = *(const ImapUID*)a, ub = *(const ImapUID*)b;
+
+  return ua < ub ? -1 : ua > ub;
+}
+
+/* Finds the messages expunged by a VANISHED response among those
+   whose UIDs are not known. The UIDs the server still has are
+   aligned with the messages whose UIDs are known: in each run of
+   messages with unknown UIDs, as many messages as the server lacks
+   between the known ones are expunged. As nothing is known about
+   the messages in such a run, it does not matter which ones. If the
+   UIDs do not match the cache, start afresh as after BYE. */
+static void
+imap_mbox_resolve_vanished(ImapMboxHandle *h)
+{
+  ImapSearchCb cb;
+  void *arg;
+  GArray *uids;
+  ImapResponse rc;
+  unsigned cmdno, seqno, run_start, j;
+  gboolean consistent = TRUE;
+
+  do {
+    h->vanished_unresolved = 0;
+    uids = g_array_new(FALSE, FALSE, sizeof(ImapUID));
+    cb  = h->search_cb;  h->search_cb  = (ImapSearchCb)collect_uid_cb;
+    arg = h->search_arg; h->search_arg = uids;
+    /* not imap_cmd_exec(), which would call us again */
+    if(!imap_handle_idle_disable(h) ||
+       imap_cmd_start(h, "UID SEARCH ALL", &cmdno) < 0)
+      rc = IMR_SEVERED;
+    else
+      rc = imap_cmd_process_untagged(h, cmdno);
+    h->search_cb = cb; h->search_arg = arg;
+    ir_expunge_flush(h);
+    if(rc != IMR_OK || h->vanished_unresolved) {
+      /* Failed, or other messages vanished meanwhile: in the latter
+         case, the UIDs may be outdated, try again. */
+      g_array_free(uids, TRUE);
+      if(rc != IMR_OK)
+        consistent = FALSE;
+      continue;
+    }
+    g_array_sort(uids, uid_cmp);
+
+    for(seqno=1, run_start=1, j=0; consistent && seqno<=h->exists+1;
+        seqno++) {
+      ImapMessage *imsg = seqno <= h->exists ? h->msg_cache[seqno-1] : NULL;
+      unsigned k, s;
+
+      if(seqno <= h->exists) {
+        if(imsg == NULL || imsg->uid == 0)
+          continue;
+        for(k=j; k<uids->len && g_array_index(uids, ImapUID, k)<imsg->uid;
+            k++)
+          ;
+        if(k == uids->len || g_array_index(uids, ImapUID, k) != imsg->uid) {
+          consistent = FALSE;
+          break;
+        }
+      } else
+        k = uids->len;
+      /* the messages run_start..seqno-1 have unknown UIDs, and the
+         server has k-j of them left */
+      if(k-j > seqno-run_start) {
+        consistent = FALSE;
+        break;
+      }
+      for(s=run_start+(k-j); s<seqno; s++)
+        g_array_append_val(h->expunged, s);
+      j = k+1;
+      run_start = seqno+1;
+    }
+    g_array_free(uids, TRUE);
+    if(consistent)
+      ir_expunge_flush(h);
+    else
+      g_array_set_size(h->expunged, 0);
+  } while(consistent && h->vanished_unresolved);
+
+  if(!consistent && !IMAP_MBOX_IS_DISCONNECTED(h)) {
+    imap_mbox_handle_set_msg(h, _("Cannot find the messages expunged "
+                                  "from %s"), h->mbox);
+    imap_handle_disconnect(h);
+  }
+}
+
+/* RFC 7162, sect. 3.2.10: VANISHED [(EARLIER)] <known-uids> */
+static ImapResponse
+ir_vanished(ImapMboxHandle *h)
+{
+  GArray *ranges;
+  gboolean earlier = FALSE;
+  ImapResponse rc;
+  int c = sio_getc(h->sio);
+
+  if(c == '(') {
+    char atom[LONG_STRING];
+
+    c = imap_get_atom(h->sio, atom, sizeof(atom));
+    earlier = g_ascii_strcasecmp(atom, "EARLIER") == 0;
+    if(c != ')' || sio_getc(h->sio) != ' ')
+      return IMR_PROTOCOL;
+  } else
+    sio_ungetc(h->sio);
+
+  ranges = g_array_new(FALSE, FALSE, sizeof(ImapUidRange));
+  rc = imap_get_sequence(h, (ImapUidRangeCb)append_vanished_range, ranges);
+  if(rc == IMR_OK)
+    rc = ir_check_crlf(h, sio_getc(h->sio));
+  if(rc == IMR_OK) {
+    if(!earlier)
+      rc = ir_vanished_expunge(h, ranges);
+    else if(h->qresync.vanished != NULL) {
+      /* Expunged before this session: kept for the client. */
+      g_array_append_vals(h->qresync.vanished, ranges->data, ranges->len);
+    }
+  }
+  g_array_free(ranges, TRUE);
+  return rc;
+}
+
 /* response dispatch code */
 static const struct {
   const gchar *response;
@@ -4123,6 +4614,7 @@ static const struct {
   { "PREAUTH",    7, ir_preauth },
   { "BYE",        3, ir_bye },
   { "CAPABILITY",10, ir_capability },
+  { "ENABLED",    7, ir_enabled },
   { "LIST",       4, ir_list },
   { "LSUB",       4, ir_lsub },
   { "STATUS",     6, ir_status },
@@ -4135,7 +4627,8 @@ static const struct {
   { "MYRIGHTS",   8, ir_myrights },
   { "ACL",        3, ir_getacl },
   { "QUOTAROOT",  9, ir_quotaroot },
-  { "QUOTA",      5, ir_quota }
+  { "QUOTA",      5, ir_quota },
+  { "VANISHED",   8, ir_vanished }
 };
 static const struct {
   const gchar *response;
@@ -4169,6 +4662,9 @@ ir_handle_response(ImapMboxHandle *h)
     for(i=0; i<G_N_ELEMENTS(NumHandlers); i++) {
       if(g_ascii_strncasecmp(atom, NumHandlers[i].response, 
                              NumHandlers[i].keyword_len) == 0) {
+        /* a run of EXPUNGE responses is applied when it ends */
+        if(NumHandlers[i].handler != ir_expunge)
+          ir_expunge_flush(h);
         rc = NumHandlers[i].handler(h, seqno);
         break;
       }
@@ -4176,6 +4672,7 @@ ir_handle_response(ImapMboxHandle *h)
   } else {
     unsigned i;
 
+    ir_expunge_flush(h);
     if (c == 0x0d)
       sio_ungetc(h->sio);
     for(i=0; i<G_N_ELEMENTS(ResponseHandlers); i++) {
@@ -4311,17 +4808,32 @@ mbox_view_resize(MboxView *mv, unsigned old_exists, unsigned new_exists)
   }
 }
 
+/* mbox_view_expunge:
+   Drops the expunged messages, given as cnt ascending seqnos, from the
+   view and renumbers the ones that follow them. */
 void
-mbox_view_expunge(MboxView *mv, unsigned seqno)
+mbox_view_expunge(MboxView *mv, const unsigned *seqnos, unsigned cnt)
 {
-  unsigned i;
+  unsigned src, dest;
 
   if( !MBOX_VIEW_IS_ACTIVE(mv) ) return;
-  for(i=0; i<mv->entries && mv->arr[i] != seqno; i++)
-    ;
-  for(; i<mv->entries-1; i++)
-    mv->arr[i] = mv->arr[i+1];
-  mv->entries = i;
+  for(dest=src=0; src<mv->entries; src++) {
+    unsigned seqno = mv->arr[src];
+    unsigned lo = 0, hi = cnt;
+
+    /* lo becomes the number of expunged messages before seqno */
+    while(lo < hi) {
+      unsigned mid = lo + (hi - lo) / 2;
+      if(seqnos[mid] < seqno)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if(lo<cnt && seqnos[lo] == seqno)
+      continue;
+    mv->arr[dest++] = seqno - lo;
+  }
+  mv->entries = dest;
 }
 
 void
@@ -57,7 +57,7 @@ imap_handle_starttls(ImapMboxHandle *handle, GError **error)
 	if (rc != IMR_OK) {
 		return rc;
 	}
-	if (net_client_start_tls(NET_CLIENT(handle->sio), error)) {
+	if (net_client_siobuf_start_tls(handle->sio, error)) {
 		handle->has_capabilities = 0;
 		return IMR_OK;
 	} else {
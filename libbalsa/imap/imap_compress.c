@@ -24,6 +24,8 @@
 ImapResponse
 imap_compress(ImapMboxHandle *handle)
 {
+	GError *error = NULL;
+
 	if (!handle->enable_compress ||
 		!imap_mbox_handle_can_do(handle, IMCAP_COMPRESS_DEFLATE))
 		return IMR_NO;
@@ -31,10 +33,13 @@ imap_compress(ImapMboxHandle *handle)
 	if (imap_cmd_exec(handle, "COMPRESS DEFLATE") != IMR_OK)
 		return IMR_NO;
 
-	if (net_client_start_compression(NET_CLIENT(handle->sio), NULL)) {
+	if (net_client_siobuf_start_compression(handle->sio, &error)) {
 		return IMR_OK;
 	} else {
-		g_warning("%s: SIO not set!", __func__);
-		return IMR_NO;
+		/* the server expects a compressed stream now */
+		g_warning("%s: %s", __func__, error->message);
+		g_error_free(error);
+		imap_handle_disconnect(handle);
+		return IMR_BAD;
 	}
 }
@@ -35,6 +35,8 @@ typedef enum {
 } ImapFetchBodyType;
 
 
+/* Body data is passed as it is received, in chunks; the end of each
+   section is signalled by passing a NULL buf. */
 typedef void (*ImapFetchBodyInternalCb)(unsigned seqno,
 					ImapFetchBodyType body_type,
 					const char *buf,
@@ -69,10 +71,20 @@ struct _ImapMboxHandle {
   unsigned unseen; /* msgno of first unseen message */
   ImapUID  uidnext;
   ImapUID  uidval;
+  guint64  highestmodseq; /* RFC 7162; 0 if the mailbox has none */
+  struct {
+    unsigned uidval;      /* state known to the client, passed to the */
+    guint64  modseq;      /* next SELECT; modseq is 0 if there is none */
+    GArray  *vanished;    /* ImapUidRange: the messages expunged since
+                           * then, or NULL if the last SELECT did not
+                           * resynchronize */
+  } qresync;
   gchar *last_msg; /* last server message; for error reporting purposes */
 
   ImapMessage **msg_cache;
   GArray       *flag_cache;
+  GArray       *expunged; /* EXPUNGE responses not applied yet, as
+                           * ascending seqnos from before the first */
   MboxView mbox_view;
   /** cmd_info is a list of commands that serves two-fold purpose. It
       can contain task to execute when certain command completes. It
@@ -109,6 +121,9 @@ struct _ImapMboxHandle {
   void *search_arg;
 
   GHashTable *status_resps; /* A hash of STATUS responses that we wait for */
+  ImapStatusCb status_cb;   /* ...and where the others go, if anywhere */
+  void *status_arg;
+  const ImapStatusItem *status_items;
 
   GSource *sock_source;
   GMutex mutex;
@@ -128,6 +143,10 @@ struct _ImapMboxHandle {
   unsigned enable_compress:1; /**< enable compress extension */
   unsigned enable_idle:1;     /**< use IDLE - no problem with firewalls */
   unsigned has_rights:1;      /**< whether rights are up-to-date. */
+  unsigned qresync_enabled:1; /**< ENABLE QRESYNC succeeded (RFC 7162):
+                               * expunges are reported as VANISHED. */
+  unsigned vanished_unresolved:1; /**< VANISHED named messages whose
+                                   * UIDs are not known yet. */
 
   ImapAclType rights;         /**< my rights (RFC 4314) */
   GList *acls;                /**< acl's (RFC 4314) */
@@ -49,6 +49,7 @@ typedef enum {
   IMLIST_NOINFERIORS,
   IMLIST_HASCHILDREN,
   IMLIST_HASNOCHILDREN,
+  IMLIST_NONEXISTENT,           /* RFC 5258 */
   IMLIST_LAST
 } ImapMboxFlag;
 
@@ -262,7 +263,7 @@ typedef void (*ImapUserCb)(ImapUserEventType ue, void *arg, ...);
 ImapMessage *imap_message_new(void);
 void imap_message_free(ImapMessage *);
 void imap_mbox_handle_msg_deserialize(ImapMboxHandle *h, unsigned msgno,
-                                      void *data);
+                                      void *data, gboolean flags_current);
 void*        imap_message_serialize(ImapMessage *);
 ImapMessage* imap_message_deserialize(void *data);
 size_t imap_serialized_message_size(void *data);
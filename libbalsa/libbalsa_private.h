@@ -33,6 +33,9 @@
 struct LibBalsaMailboxIndexEntry_ {
     gchar *from;
     gchar *subject;
+    gchar *from_key;            /* collation keys of from and subject, */
+    gchar *subject_key;         /* for sorting */
+    gchar *message_id;          /* for the search index */
     time_t msg_date;
     time_t internal_date;
     unsigned short status_icon;
@@ -0,0 +1,161 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ *
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include "mailbox-check.h"
+
+#include "imap-server.h"
+#include "libbalsa.h"
+
+typedef struct {
+    LibBalsaMailboxCheckFunc check;
+    LibBalsaMailboxCheckDone done;
+    gpointer data;
+
+    GMutex lock;                /* protects n_done, serializes done */
+    guint n_done;
+    guint total;
+} LbmcInfo;
+
+static void
+lbmc_check(gpointer mailbox, gpointer user_data)
+{
+    LbmcInfo *info = user_data;
+
+    if (info->check != NULL)
+        info->check(mailbox, info->data);
+    else
+        libbalsa_mailbox_check(mailbox);
+
+    g_mutex_lock(&info->lock);
+    ++info->n_done;
+    if (info->done != NULL)
+        info->done(mailbox, info->n_done, info->total, info->data);
+    g_mutex_unlock(&info->lock);
+}
+
+typedef struct {
+    LibBalsaServer *server;
+    GSList *mailboxes;
+    LbmcInfo *info;
+} LbmcServer;
+
+/* Check the IMAP mailboxes of one server. */
+static gpointer
+lbmc_server_thread(gpointer data)
+{
+    LbmcServer *srv = data;
+    GThreadPool *pool;
+    GSList *list;
+    guint n_threads;
+
+    /* One bulk status request answers for all the closed mailboxes,
+     * which then need no round trip of their own. */
+    libbalsa_imap_prefetch_status(srv->server, srv->mailboxes);
+
+    /* Mailboxes that are open keep their connections, so only the
+     * spare ones may be used; a check that gets no connection at all
+     * would report no new mail. */
+    n_threads = libbalsa_imap_server_get_free_connections
+        (LIBBALSA_IMAP_SERVER(srv->server));
+    pool = g_thread_pool_new(lbmc_check, srv->info, MAX(n_threads, 1),
+                             FALSE, NULL);
+    for (list = srv->mailboxes; list != NULL; list = list->next)
+        g_thread_pool_push(pool, list->data, NULL);
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    g_slist_free(srv->mailboxes);
+    g_free(srv);
+
+    return NULL;
+}
+
+void
+libbalsa_mailbox_check_all(GSList * mailboxes, guint local_threads,
+                           LibBalsaMailboxCheckFunc check,
+                           LibBalsaMailboxCheckDone done, gpointer data)
+{
+    LbmcInfo info;
+    GHashTable *servers;
+    GSList *threads = NULL;
+    GThreadPool *local_pool;
+    GSList *local = NULL;
+    GSList *list;
+    GHashTableIter iter;
+    gpointer srv;
+
+    info.check = check;
+    info.done = done;
+    info.data = data;
+    g_mutex_init(&info.lock);
+    info.n_done = 0;
+    info.total = g_slist_length(mailboxes);
+
+    servers = g_hash_table_new(NULL, NULL);
+    for (list = mailboxes; list != NULL; list = list->next) {
+        LibBalsaMailbox *mailbox = list->data;
+        LibBalsaServer *server;
+
+        if (LIBBALSA_IS_MAILBOX_IMAP(mailbox)
+            && LIBBALSA_IS_IMAP_SERVER(server =
+                                       LIBBALSA_MAILBOX_REMOTE_GET_SERVER
+                                       (mailbox))) {
+            LbmcServer *lbmc_server = g_hash_table_lookup(servers, server);
+
+            if (lbmc_server == NULL) {
+                lbmc_server = g_new0(LbmcServer, 1);
+                lbmc_server->server = server;
+                lbmc_server->info = &info;
+                g_hash_table_insert(servers, server, lbmc_server);
+            }
+            lbmc_server->mailboxes =
+                g_slist_prepend(lbmc_server->mailboxes, mailbox);
+        } else
+            local = g_slist_prepend(local, mailbox);
+    }
+
+    g_hash_table_iter_init(&iter, servers);
+    while (g_hash_table_iter_next(&iter, NULL, &srv)) {
+        LbmcServer *lbmc_server = srv;
+
+        lbmc_server->mailboxes = g_slist_reverse(lbmc_server->mailboxes);
+        threads = g_slist_prepend(threads,
+                                  g_thread_new("mailbox-check",
+                                               lbmc_server_thread,
+                                               lbmc_server));
+    }
+    g_hash_table_destroy(servers);
+
+    local_pool = g_thread_pool_new(lbmc_check, &info,
+                                   MAX(local_threads, 1), FALSE, NULL);
+    local = g_slist_reverse(local);
+    for (list = local; list != NULL; list = list->next)
+        g_thread_pool_push(local_pool, list->data, NULL);
+    g_slist_free(local);
+
+    /* Wait for all the checks. */
+    g_thread_pool_free(local_pool, FALSE, TRUE);
+    g_slist_free_full(threads, (GDestroyNotify) g_thread_join);
+
+    g_mutex_clear(&info.lock);
+}
@@ -0,0 +1,57 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ *
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * mailbox-check.h
+ *
+ * Check a list of mailboxes for new mail concurrently.
+ *
+ * The IMAP mailboxes are grouped by their server; the status of the
+ * closed ones is asked for at once, then each server gets as many
+ * workers as it has connections to spare, so that no check fails for
+ * want of a connection.  The other mailboxes are checked by a pool of
+ * local workers.  The network checks are queued first, since
+ * they mostly wait for the servers.
+ */
+
+#ifndef __LIBBALSA_MAILBOX_CHECK_H__
+#define __LIBBALSA_MAILBOX_CHECK_H__
+
+#include "mailbox.h"
+
+/* Check one mailbox; called in a worker thread. */
+typedef void (*LibBalsaMailboxCheckFunc) (LibBalsaMailbox * mailbox,
+                                          gpointer data);
+/* Called in a worker thread after mailbox has been checked, done being
+ * the number of mailboxes checked so far out of total; the calls are
+ * serialized, and done increases by one with each. */
+typedef void (*LibBalsaMailboxCheckDone) (LibBalsaMailbox * mailbox,
+                                          guint done, guint total,
+                                          gpointer data);
+
+/* Check the mailboxes, with at most local_threads workers for the ones
+ * that are not IMAP, and return when all have been checked.  check may
+ * be NULL to just call libbalsa_mailbox_check(), done may be NULL. */
+void libbalsa_mailbox_check_all(GSList * mailboxes, guint local_threads,
+                                LibBalsaMailboxCheckFunc check,
+                                LibBalsaMailboxCheckDone done,
+                                gpointer data);
+
+#endif                          /* __LIBBALSA_MAILBOX_CHECK_H__ */
@@ -34,6 +34,8 @@
 #include "message.h"
 #include "misc.h"
 #include "filter-funcs.h"
+#include "mime.h"
+#include "search-index.h"
 #include "libbalsa_private.h"
 #include <glib/gi18n.h>
 
@@ -47,6 +49,10 @@ static gboolean
 libbalsa_mailbox_real_messages_copy(LibBalsaMailbox * mailbox,
                                     GArray * msgnos,
                                     LibBalsaMailbox * dest, GError **err);
+static gboolean
+libbalsa_mailbox_real_messages_move(LibBalsaMailbox * mailbox,
+                                    GArray * msgnos,
+                                    LibBalsaMailbox * dest, GError **err);
 static gboolean libbalsa_mailbox_real_can_do(LibBalsaMailbox* mailbox,
                                              enum LibBalsaMailboxCapability c);
 static void libbalsa_mailbox_real_sort(LibBalsaMailbox* mailbox,
@@ -73,11 +79,16 @@ static void libbalsa_mailbox_real_cache_message(LibBalsaMailbox * mailbox,
    Also when the unread message count might have changed.
    - MESSAGE_EXPUNGED: sent when a message is expunged.  This signal is
    used to update lists of msgnos when messages are renumbered.
+   - MESSAGES_EXPUNGED: sent once for messages that are expunged
+   together, after MESSAGE_EXPUNGED has been sent for each of them; the
+   argument is a GArray of their msgnos, in ascending order.  Lists of
+   msgnos are better updated on this one, in a single pass.
 */
 
 enum {
     CHANGED,
     MESSAGE_EXPUNGED,
+    MESSAGES_EXPUNGED,
     PROGRESS_NOTIFY,
     LAST_SIGNAL
 };
@@ -122,6 +133,13 @@ struct _LibBalsaMailboxPrivate {
                          * displaying/columns of GtkTreeModel interface
                          * and NOTHING else. */
     GNode *msg_tree; /* the possibly filtered tree of messages */
+    GPtrArray *msgno_2_node; /* reverse lookup: the node in msg_tree
+                              * for each msgno, or NULL if the message
+                              * is not in the view */
+    GArray *thread_dates;    /* the latest date in the subtree of each
+                              * node in msgno_2_node, by msgno */
+    GHashTable *child_indexes; /* parent node -> LbmChildIndex */
+    GHashTable *child_slots;   /* node -> its slot in its parent's index */
     LibBalsaCondition *view_filter; /* to choose a subset of messages
                                      * to be displayed, e.g., only
                                      * undeleted. */
@@ -129,6 +147,14 @@ struct _LibBalsaMailboxPrivate {
                                                 * filter that will persist 
                                                 * to the next time the
                                                 * mailbox is opened */
+    LibBalsaSearchIndex *search_index; /* words in the messages, loaded
+                                        * on first use */
+    GArray *view_rows;          /* msgnos of the rows shown by the index
+                                 * and of the rows around them, as set by
+                                 * libbalsa_mailbox_set_visible_range */
+    guint visible_first;        /* the indices in view_rows of the first */
+    guint visible_last;         /* and last rows shown */
+    gint visible_direction;
 
     /* info fields */
     glong unread_messages; /* number of unread messages in the mailbox */
@@ -174,6 +200,559 @@ struct _LibBalsaMailboxPrivate {
     ((LibBalsaMailboxIndexEntry *) (((msgno) <= (priv)->mindex->len) ? \
      g_ptr_array_index((priv)->mindex, (msgno) - 1) : NULL))
 
+/*
+ * The msgno-to-node table
+ *
+ * Every node in priv->msg_tree is entered in priv->msgno_2_node, so that
+ * finding the node for a message does not need a search of the tree.
+ */
+
+static GNode *
+lbm_node_lookup(LibBalsaMailboxPrivate * priv, guint msgno)
+{
+    if (priv->msgno_2_node == NULL || msgno == 0
+        || msgno > priv->msgno_2_node->len)
+        return NULL;
+
+    return g_ptr_array_index(priv->msgno_2_node, msgno - 1);
+}
+
+static void lbm_thread_date_init(LibBalsaMailboxPrivate * priv,
+                                 guint msgno, GNode * node);
+
+static void
+lbm_node_set(LibBalsaMailboxPrivate * priv, guint msgno, GNode * node)
+{
+    if (msgno == 0)
+        return;
+
+    if (priv->msgno_2_node == NULL)
+        priv->msgno_2_node = g_ptr_array_new();
+    if (msgno > priv->msgno_2_node->len) {
+        if (node == NULL)
+            return;
+        g_ptr_array_set_size(priv->msgno_2_node, msgno);
+    }
+
+    g_ptr_array_index(priv->msgno_2_node, msgno - 1) = node;
+    if (node != NULL)
+        lbm_thread_date_init(priv, msgno, node);
+}
+
+/* GNodeTraverseFunc for entering or clearing a subtree in the table. */
+static gboolean
+lbm_node_set_traverse_func(GNode * node, gpointer data)
+{
+    LibBalsaMailboxPrivate *priv = data;
+    guint msgno = GPOINTER_TO_UINT(node->data);
+
+    if (node->parent != NULL)
+        lbm_node_set(priv, msgno, node);
+
+    return FALSE;
+}
+
+static gboolean
+lbm_node_clear_traverse_func(GNode * node, gpointer data)
+{
+    LibBalsaMailboxPrivate *priv = data;
+    guint msgno = GPOINTER_TO_UINT(node->data);
+
+    if (lbm_node_lookup(priv, msgno) == node)
+        lbm_node_set(priv, msgno, NULL);
+
+    return FALSE;
+}
+
+/* Rebuild the table from the current tree. */
+static void
+lbm_node_table_rebuild(LibBalsaMailboxPrivate * priv)
+{
+    if (priv->msgno_2_node != NULL)
+        g_ptr_array_set_size(priv->msgno_2_node, 0);
+    if (priv->thread_dates != NULL)
+        g_array_set_size(priv->thread_dates, 0);
+
+    if (priv->msg_tree != NULL)
+        g_node_traverse(priv->msg_tree, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+                        lbm_node_set_traverse_func, priv);
+}
+
+static void
+lbm_node_table_free(LibBalsaMailboxPrivate * priv)
+{
+    if (priv->msgno_2_node != NULL) {
+        g_ptr_array_free(priv->msgno_2_node, TRUE);
+        priv->msgno_2_node = NULL;
+    }
+    if (priv->thread_dates != NULL) {
+        g_array_free(priv->thread_dates, TRUE);
+        priv->thread_dates = NULL;
+    }
+}
+
+/*
+ * Thread dates
+ *
+ * Sorting a threaded view by date orders the siblings by the latest
+ * date in their subtrees.  priv->thread_dates keeps that date for each
+ * node in the msgno table, or LBM_THREAD_DATE_UNKNOWN when it must be
+ * found again; all the ancestors of a node whose date is unknown have
+ * unknown dates too.  A message that joins a thread raises the dates of
+ * its new ancestors, and one that leaves clears them only if it may
+ * have held their latest date, so that sorting after new mail arrives
+ * looks only at the threads it joined, and not at every subtree.
+ */
+
+#define LBM_THREAD_DATE_UNKNOWN ((time_t) -1)
+
+/* The date of the message itself, or 0 if we do not know it yet. */
+static time_t
+lbm_message_date(LibBalsaMailboxPrivate * priv, guint msgno)
+{
+    LibBalsaMailboxIndexEntry *entry;
+
+    if (priv->mindex == NULL || msgno == 0
+        || (entry = LBM_GET_INDEX_ENTRY(priv, msgno)) == NULL
+        || entry->idle_pending)
+        return 0;
+
+    return entry->msg_date;
+}
+
+static time_t
+lbm_thread_date_cached(LibBalsaMailboxPrivate * priv, GNode * node)
+{
+    guint msgno = GPOINTER_TO_UINT(node->data);
+
+    /* The node of an expunged message has already left the table. */
+    if (priv->thread_dates == NULL || msgno == 0
+        || msgno > priv->thread_dates->len
+        || lbm_node_lookup(priv, msgno) != node)
+        return LBM_THREAD_DATE_UNKNOWN;
+
+    return g_array_index(priv->thread_dates, time_t, msgno - 1);
+}
+
+static void
+lbm_thread_date_store(LibBalsaMailboxPrivate * priv, guint msgno,
+                      time_t date)
+{
+    if (priv->thread_dates == NULL)
+        priv->thread_dates = g_array_new(FALSE, FALSE, sizeof(time_t));
+    if (msgno > priv->thread_dates->len) {
+        guint i = priv->thread_dates->len;
+
+        g_array_set_size(priv->thread_dates, msgno);
+        for (; i < msgno; i++)
+            g_array_index(priv->thread_dates, time_t, i) =
+                LBM_THREAD_DATE_UNKNOWN;
+    }
+
+    g_array_index(priv->thread_dates, time_t, msgno - 1) = date;
+}
+
+/* Called when node is entered in the msgno table; a new node has no
+ * children, and only its own date. */
+static void
+lbm_thread_date_init(LibBalsaMailboxPrivate * priv, guint msgno,
+                     GNode * node)
+{
+    lbm_thread_date_store(priv, msgno,
+                          node->children == NULL
+                          ? lbm_message_date(priv, msgno)
+                          : LBM_THREAD_DATE_UNKNOWN);
+}
+
+/* Forget the dates of node and its ancestors. */
+static void
+lbm_thread_date_clear(LibBalsaMailboxPrivate * priv, GNode * node)
+{
+    for (; node != NULL && node->parent != NULL; node = node->parent) {
+        if (lbm_thread_date_cached(priv, node) == LBM_THREAD_DATE_UNKNOWN)
+            break;
+        g_array_index(priv->thread_dates, time_t,
+                      GPOINTER_TO_UINT(node->data) - 1) =
+            LBM_THREAD_DATE_UNKNOWN;
+    }
+}
+
+/* A message of date date is now in the subtree of node. */
+static void
+lbm_thread_date_raise(LibBalsaMailboxPrivate * priv, GNode * node,
+                      time_t date)
+{
+    for (; node != NULL && node->parent != NULL; node = node->parent) {
+        time_t cached = lbm_thread_date_cached(priv, node);
+
+        if (cached == LBM_THREAD_DATE_UNKNOWN || cached >= date)
+            break;
+        g_array_index(priv->thread_dates, time_t,
+                      GPOINTER_TO_UINT(node->data) - 1) = date;
+    }
+}
+
+static void
+lbm_thread_date_joined(LibBalsaMailboxPrivate * priv, GNode * parent,
+                       GNode * child)
+{
+    time_t date = lbm_thread_date_cached(priv, child);
+
+    if (date == LBM_THREAD_DATE_UNKNOWN)
+        lbm_thread_date_clear(priv, parent);
+    else
+        lbm_thread_date_raise(priv, parent, date);
+}
+
+static void
+lbm_thread_date_left(LibBalsaMailboxPrivate * priv, GNode * parent,
+                     GNode * child)
+{
+    time_t date = lbm_thread_date_cached(priv, child);
+    time_t parent_date = lbm_thread_date_cached(priv, parent);
+
+    if (parent_date != LBM_THREAD_DATE_UNKNOWN
+        && (date == LBM_THREAD_DATE_UNKNOWN || date >= parent_date))
+        lbm_thread_date_clear(priv, parent);
+}
+
+/* The latest date in the subtree of node, found again if need be. */
+static time_t
+lbm_thread_date(LibBalsaMailboxPrivate * priv, GNode * node)
+{
+    guint msgno = GPOINTER_TO_UINT(node->data);
+    time_t date;
+    GNode *child;
+
+    if ((date = lbm_thread_date_cached(priv, node)) !=
+        LBM_THREAD_DATE_UNKNOWN)
+        return date;
+
+    date = lbm_message_date(priv, msgno);
+    for (child = node->children; child != NULL; child = child->next) {
+        time_t child_date = lbm_thread_date(priv, child);
+
+        if (child_date > date)
+            date = child_date;
+    }
+    if (msgno > 0 && lbm_node_lookup(priv, msgno) == node)
+        lbm_thread_date_store(priv, msgno, date);
+
+    return date;
+}
+
+/*
+ * Sibling positions
+ *
+ * A GtkTreePath needs the position of a node among its siblings, which
+ * g_node_child_position() finds by walking the list of children; in a
+ * flat view of a large mailbox that makes every path O(n).  Instead, we
+ * keep for a parent node an LbmChildIndex, in which the children occupy
+ * slots, in order, and a Fenwick tree counts the occupied slots, so that
+ * both the position of a child and the nth child are found in O(log n).
+ * priv->child_slots maps each child to its slot.
+ *
+ * Appending, prepending and removing a child update the index, using
+ * the free slots at either end; any other change to the children of a
+ * node drops its index, which is rebuilt, with fresh free slots, the next
+ * time it is needed.
+ */
+
+typedef struct {
+    GNode **nodes;              /* the child in each slot, or NULL */
+    guint *counts;              /* the Fenwick tree, indexed from 1 */
+    guint size;                 /* number of slots */
+    guint first;                /* slots before first are free */
+    guint last;                 /* slots from last on are free */
+    guint n_children;
+} LbmChildIndex;
+
+static void
+lbm_child_index_free(LbmChildIndex * index)
+{
+    g_free(index->nodes);
+    g_free(index->counts);
+    g_free(index);
+}
+
+static void
+lbm_child_index_add(LbmChildIndex * index, guint slot, gint delta)
+{
+    guint k;
+
+    for (k = slot + 1; k <= index->size; k += k & -k)
+        index->counts[k] += delta;
+}
+
+/* The number of occupied slots up to and including slot. */
+static guint
+lbm_child_index_count(LbmChildIndex * index, guint slot)
+{
+    guint k;
+    guint count = 0;
+
+    for (k = slot + 1; k > 0; k -= k & -k)
+        count += index->counts[k];
+
+    return count;
+}
+
+/* The slot of the nth child, counting from 0. */
+static guint
+lbm_child_index_find(LbmChildIndex * index, guint n)
+{
+    guint step;
+    guint k = 0;
+
+    for (step = 1; step * 2 <= index->size; step *= 2)
+        /* nothing */ ;
+
+    ++n;
+    for (; step > 0; step /= 2) {
+        if (k + step <= index->size && index->counts[k + step] < n) {
+            k += step;
+            n -= index->counts[k];
+        }
+    }
+
+    return k;
+}
+
+static LbmChildIndex *
+lbm_child_index_new(LibBalsaMailboxPrivate * priv, GNode * parent)
+{
+    LbmChildIndex *index;
+    GNode *node;
+    guint n_children;
+    guint room;
+    guint slot;
+    guint k;
+
+    n_children = g_node_n_children(parent);
+    room = n_children / 2 + 16;
+
+    index = g_new(LbmChildIndex, 1);
+    index->size = n_children + 2 * room;
+    index->nodes = g_new0(GNode *, index->size);
+    index->counts = g_new0(guint, index->size + 1);
+    index->first = room;
+    index->last = room + n_children;
+    index->n_children = n_children;
+
+    for (node = parent->children, slot = room; node != NULL;
+         node = node->next, slot++) {
+        index->nodes[slot] = node;
+        index->counts[slot + 1] = 1;
+        g_hash_table_insert(priv->child_slots, node,
+                            GUINT_TO_POINTER(slot));
+    }
+
+    /* Build the Fenwick tree in place. */
+    for (k = 1; k <= index->size; k++) {
+        guint j = k + (k & -k);
+
+        if (j <= index->size)
+            index->counts[j] += index->counts[k];
+    }
+
+    return index;
+}
+
+/* Find the index for parent's children, making it if necessary. */
+static LbmChildIndex *
+lbm_child_index_get(LibBalsaMailboxPrivate * priv, GNode * parent)
+{
+    LbmChildIndex *index;
+
+    if (priv->child_indexes == NULL) {
+        priv->child_indexes =
+            g_hash_table_new_full(NULL, NULL, NULL,
+                                  (GDestroyNotify) lbm_child_index_free);
+        priv->child_slots = g_hash_table_new(NULL, NULL);
+    }
+
+    index = g_hash_table_lookup(priv->child_indexes, parent);
+    if (index == NULL) {
+        index = lbm_child_index_new(priv, parent);
+        g_hash_table_insert(priv->child_indexes, parent, index);
+    }
+
+    return index;
+}
+
+/* The index for parent's children, if it has one. */
+static LbmChildIndex *
+lbm_child_index_lookup(LibBalsaMailboxPrivate * priv, GNode * parent)
+{
+    return priv->child_indexes != NULL ?
+        g_hash_table_lookup(priv->child_indexes, parent) : NULL;
+}
+
+/* The slot of child in index, or -1 if the index does not know it. */
+static gint
+lbm_child_index_slot(LibBalsaMailboxPrivate * priv,
+                     LbmChildIndex * index, GNode * child)
+{
+    gpointer value;
+    guint slot;
+
+    if (!g_hash_table_lookup_extended(priv->child_slots, child, NULL,
+                                      &value))
+        return -1;
+
+    slot = GPOINTER_TO_UINT(value);
+
+    return slot < index->size && index->nodes[slot] == child ? (gint) slot : -1;
+}
+
+static void
+lbm_child_index_drop(LibBalsaMailboxPrivate * priv, GNode * parent)
+{
+    if (priv->child_indexes != NULL)
+        g_hash_table_remove(priv->child_indexes, parent);
+}
+
+static void
+lbm_child_index_free_all(LibBalsaMailboxPrivate * priv)
+{
+    if (priv->child_indexes != NULL) {
+        g_hash_table_destroy(priv->child_indexes);
+        priv->child_indexes = NULL;
+        g_hash_table_destroy(priv->child_slots);
+        priv->child_slots = NULL;
+    }
+}
+
+/* The position of child among its siblings. */
+static gint
+lbm_child_position(LibBalsaMailboxPrivate * priv, GNode * child)
+{
+    LbmChildIndex *index;
+    gint slot;
+
+    index = lbm_child_index_get(priv, child->parent);
+    slot = lbm_child_index_slot(priv, index, child);
+    if (slot < 0) {
+        /* The index is out of date--this should not happen. */
+        g_warning("%s: stale sibling index", __func__);
+        lbm_child_index_drop(priv, child->parent);
+        return g_node_child_position(child->parent, child);
+    }
+
+    return lbm_child_index_count(index, slot) - 1;
+}
+
+static GNode *
+lbm_nth_child(LibBalsaMailboxPrivate * priv, GNode * parent, gint n)
+{
+    LbmChildIndex *index;
+
+    if (n < 0 || parent->children == NULL)
+        return NULL;
+
+    index = lbm_child_index_get(priv, parent);
+    if ((guint) n >= index->n_children)
+        return NULL;
+
+    return index->nodes[lbm_child_index_find(index, n)];
+}
+
+static gint
+lbm_n_children(LibBalsaMailboxPrivate * priv, GNode * parent)
+{
+    if (parent->children == NULL)
+        return 0;
+
+    return lbm_child_index_get(priv, parent)->n_children;
+}
+
+/* Called after child has been made the first or the last child of
+ * parent. */
+static void
+lbm_child_inserted(LibBalsaMailboxPrivate * priv, GNode * parent,
+                   GNode * child)
+{
+    LbmChildIndex *index;
+    guint slot;
+
+    lbm_thread_date_joined(priv, parent, child);
+
+    if ((index = lbm_child_index_lookup(priv, parent)) == NULL)
+        return;
+
+    if (child->prev == NULL && index->first > 0)
+        slot = --index->first;
+    else if (child->next == NULL && index->last < index->size)
+        slot = index->last++;
+    else {
+        lbm_child_index_drop(priv, parent);
+        return;
+    }
+
+    index->nodes[slot] = child;
+    lbm_child_index_add(index, slot, 1);
+    ++index->n_children;
+    g_hash_table_insert(priv->child_slots, child, GUINT_TO_POINTER(slot));
+}
+
+/* Called after child has been unlinked from parent. */
+static void
+lbm_child_removed(LibBalsaMailboxPrivate * priv, GNode * parent,
+                  GNode * child)
+{
+    LbmChildIndex *index;
+    gint slot;
+
+    lbm_thread_date_left(priv, parent, child);
+
+    if ((index = lbm_child_index_lookup(priv, parent)) == NULL)
+        return;
+
+    slot = lbm_child_index_slot(priv, index, child);
+    if (slot < 0) {
+        lbm_child_index_drop(priv, parent);
+        return;
+    }
+
+    index->nodes[slot] = NULL;
+    lbm_child_index_add(index, slot, -1);
+    --index->n_children;
+    g_hash_table_remove(priv->child_slots, child);
+}
+
+/* GNodeTraverseFunc for forgetting a subtree that is about to be
+ * destroyed: its nodes leave the msgno table and the sibling indexes,
+ * before their memory can be reused for other nodes. */
+static gboolean
+lbm_node_forget_traverse_func(GNode * node, gpointer data)
+{
+    LibBalsaMailboxPrivate *priv = data;
+
+    lbm_node_clear_traverse_func(node, priv);
+    if (priv->child_indexes != NULL) {
+        g_hash_table_remove(priv->child_indexes, node);
+        g_hash_table_remove(priv->child_slots, node);
+    }
+
+    return FALSE;
+}
+
+/* Destroy a node that belongs to priv->msg_tree, together with any
+ * children, removing them from the tables. */
+static void
+lbm_node_destroy(LibBalsaMailboxPrivate * priv, GNode * node)
+{
+    if (node->parent != NULL) {
+        GNode *parent = node->parent;
+
+        g_node_unlink(node);
+        lbm_child_removed(priv, parent, node);
+    }
+    g_node_traverse(node, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+                    lbm_node_forget_traverse_func, priv);
+    g_node_destroy(node);
+}
+
 G_DEFINE_ABSTRACT_TYPE_WITH_CODE(LibBalsaMailbox,
                                  libbalsa_mailbox,
                                  G_TYPE_OBJECT,
@@ -214,6 +793,16 @@ libbalsa_mailbox_class_init(LibBalsaMailboxClass * klass)
                      NULL, G_TYPE_NONE, 1,
                      G_TYPE_INT);
 
+    libbalsa_mailbox_signals[MESSAGES_EXPUNGED] =
+        g_signal_new("messages-expunged",
+                     G_TYPE_FROM_CLASS(object_class),
+                     G_SIGNAL_RUN_FIRST,
+                     G_STRUCT_OFFSET(LibBalsaMailboxClass,
+                                     messages_expunged),
+                     NULL, NULL,
+                     NULL, G_TYPE_NONE, 1,
+                     G_TYPE_POINTER);
+
     libbalsa_mailbox_signals[PROGRESS_NOTIFY] =
         g_signal_new("progress-notify",
                      G_TYPE_FROM_CLASS(object_class),
@@ -231,6 +820,7 @@ libbalsa_mailbox_class_init(LibBalsaMailboxClass * klass)
     klass->progress_notify = NULL;
     klass->changed = NULL;
     klass->message_expunged = NULL;
+    klass->messages_expunged = NULL;
 
     /* Virtual functions */
     klass->open_mailbox = NULL;
@@ -244,6 +834,7 @@ libbalsa_mailbox_class_init(LibBalsaMailboxClass * klass)
     klass->get_message_stream = NULL;
     klass->messages_change_flags = NULL;
     klass->messages_copy  = libbalsa_mailbox_real_messages_copy;
+    klass->messages_move  = libbalsa_mailbox_real_messages_move;
     klass->can_do = libbalsa_mailbox_real_can_do;
     klass->set_threading = NULL;
     klass->update_view_filter = NULL;
@@ -375,6 +966,24 @@ get_from_field(LibBalsaMailbox *mailbox, LibBalsaMessage *message)
     return from;
 }
 
+/* A key that sorts str as the user's locale would, ignoring case; the
+ * keys of two strings compare with strcmp(). */
+static gchar *
+lbm_sort_key(const gchar * str)
+{
+    gchar *folded;
+    gchar *key;
+
+    if (str == NULL || !g_utf8_validate(str, -1, NULL))
+        return g_strdup(str != NULL ? str : "");
+
+    folded = g_utf8_casefold(str, -1);
+    key = g_utf8_collate_key(folded, -1);
+    g_free(folded);
+
+    return key;
+}
+
 static void
 lbm_index_entry_populate_from_msg(LibBalsaMailboxIndexEntry * entry,
                                   LibBalsaMessage * message)
@@ -383,6 +992,11 @@ lbm_index_entry_populate_from_msg(LibBalsaMailboxIndexEntry * entry,
 
     entry->from          = get_from_field(mailbox, message);
     entry->subject       = g_strdup(LIBBALSA_MESSAGE_GET_SUBJECT(message));
+    entry->from_key      = lbm_sort_key(entry->from);
+    entry->subject_key   = entry->subject != NULL
+        ? lbm_sort_key(libbalsa_subject_skip_re(entry->subject))
+        : g_strdup("");
+    entry->message_id    = g_strdup(libbalsa_message_get_message_id(message));
     entry->msg_date      = libbalsa_message_get_headers(message)->date;
     entry->internal_date = 0; /* FIXME */
     entry->status_icon   = libbalsa_get_icon_from_flags(libbalsa_message_get_flags(message));
@@ -414,6 +1028,9 @@ lbm_index_entry_free(LibBalsaMailboxIndexEntry *entry)
         {
             g_free(entry->from);
             g_free(entry->subject);
+            g_free(entry->from_key);
+            g_free(entry->subject_key);
+            g_free(entry->message_id);
         }
         g_free(entry);
     }
@@ -432,6 +1049,7 @@ libbalsa_mailbox_index_entry_clear(LibBalsaMailbox * mailbox, guint msgno)
             & g_ptr_array_index(priv->mindex, msgno - 1);
         lbm_index_entry_free(*entry);
         *entry = NULL;
+        lbm_thread_date_clear(priv, lbm_node_lookup(priv, msgno));
 
         libbalsa_mailbox_msgno_changed(mailbox, msgno);
     }
@@ -460,9 +1078,9 @@ libbalsa_mailbox_index_set_flags(LibBalsaMailbox *mailbox,
 }
 
 static void lbm_msgno_changed_expunged_cb(LibBalsaMailbox * mailbox,
-                                          guint seqno);
+                                          GArray * expunged);
 static void lbm_get_index_entry_expunged_cb(LibBalsaMailbox * mailbox,
-                                            guint seqno);
+                                            GArray * expunged);
 
 static void
 libbalsa_mailbox_finalize(GObject * object)
@@ -497,6 +1115,12 @@ libbalsa_mailbox_finalize(GObject * object)
 
     libbalsa_mailbox_view_free(priv->view);
 
+    lbm_node_table_free(priv);
+    lbm_child_index_free_all(priv);
+    libbalsa_search_index_free(priv->search_index);
+    if (priv->view_rows != NULL)
+        g_array_free(priv->view_rows, TRUE);
+
     if (priv->changed_idle_id != 0)
         g_source_remove(priv->changed_idle_id);
 
@@ -583,68 +1207,284 @@ libbalsa_mailbox_free_mindex(LibBalsaMailbox *mailbox)
         g_ptr_array_free(priv->mindex, TRUE);
         priv->mindex = NULL;
     }
-}
+}
+
+static gboolean lbm_set_threading(LibBalsaMailbox * mailbox);
+
+gboolean
+libbalsa_mailbox_open(LibBalsaMailbox * mailbox, GError **err)
+{
+    LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
+    gboolean retval;
+
+    g_return_val_if_fail(mailbox != NULL, FALSE);
+    g_return_val_if_fail(LIBBALSA_IS_MAILBOX(mailbox), FALSE);
+
+    libbalsa_lock_mailbox(mailbox);
+
+    if (priv->open_ref > 0) {
+        priv->open_ref++;
+	libbalsa_mailbox_check(mailbox);
+        retval = TRUE;
+    } else {
+	LibBalsaMailboxState saved_state;
+
+        priv->stamp++;
+        if(priv->mindex) g_warning("mindex set - I leak memory");
+        priv->mindex =
+            g_ptr_array_new_with_free_func((GDestroyNotify) lbm_index_entry_free);
+
+	saved_state = priv->state;
+	priv->state = LB_MAILBOX_STATE_OPENING;
+        priv->messages_threaded = FALSE;
+        retval =
+            LIBBALSA_MAILBOX_GET_CLASS(mailbox)->open_mailbox(mailbox, err);
+        if(retval) {
+            priv->open_ref++;
+	    priv->state = LB_MAILBOX_STATE_OPEN;
+	} else {
+	    priv->state = saved_state;
+            libbalsa_mailbox_free_mindex(mailbox);
+	}
+    }
+
+    libbalsa_unlock_mailbox(mailbox);
+
+    return retval;
+}
+
+gboolean
+libbalsa_mailbox_is_open(LibBalsaMailbox *mailbox)
+{
+    LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
+
+    g_return_val_if_fail(mailbox != NULL, FALSE);
+    g_return_val_if_fail(LIBBALSA_IS_MAILBOX(mailbox), FALSE);
+    
+
+    return priv->open_ref>0; /* this will break unlisted mailbox types */
+}
+    
+/* Protects the rows reported by the index: they are set in the main
+ * thread, and read by backends in theirs. */
+static GMutex visible_rows_lock;
+
+/* Forget the rows reported by the index, when their msgnos change. */
+static void
+lbm_view_rows_clear(LibBalsaMailboxPrivate * priv)
+{
+    g_mutex_lock(&visible_rows_lock);
+    if (priv->view_rows != NULL)
+        g_array_set_size(priv->view_rows, 0);
+    g_mutex_unlock(&visible_rows_lock);
+}
+
+/*
+ * The search index
+ *
+ * The words in the messages of the mailbox, kept in ~/.balsa, so that
+ * a search can skip messages that cannot match without loading them.
+ * Messages are added as their bodies are loaded.  Only local mailboxes
+ * have one: a server searches its own mailboxes.
+ */
+
+static LibBalsaSearchIndex *
+lbm_search_index(LibBalsaMailbox * mailbox)
+{
+    LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
+    LibBalsaSearchIndex *search_index;
+    gchar *name;
+    gchar *encoded;
+    gchar *filename;
+
+    search_index = g_atomic_pointer_get(&priv->search_index);
+    if (search_index != NULL || priv->url == NULL
+        || !LIBBALSA_IS_MAILBOX_LOCAL(mailbox))
+        return search_index;
+
+    name = g_strconcat(priv->url, ".search", NULL);
+    encoded = libbalsa_urlencode(name);
+    filename = g_build_filename(g_get_home_dir(), ".balsa", encoded, NULL);
+    g_free(encoded);
+    g_free(name);
+    search_index = libbalsa_search_index_new(filename);
+    g_free(filename);
+
+    /* Searches may run in more than one thread. */
+    if (!g_atomic_pointer_compare_and_exchange(&priv->search_index, NULL,
+                                               search_index)) {
+        libbalsa_search_index_free(search_index);
+        search_index = g_atomic_pointer_get(&priv->search_index);
+    }
+
+    return search_index;
+}
+
+static gchar *
+lbm_search_index_key(LibBalsaMailboxIndexEntry * entry)
+{
+    return libbalsa_search_index_key(entry->message_id, entry->from,
+                                     entry->subject, entry->msg_date,
+                                     entry->size);
+}
+
+static gboolean
+lbm_search_index_excludes(LibBalsaMailbox * mailbox, guint msgno,
+                          LibBalsaCondition * cond)
+{
+    LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
+    LibBalsaMailboxIndexEntry *entry;
+    LibBalsaSearchIndex *search_index;
+    gchar *key;
+    gboolean retval;
+
+    if (priv->mindex == NULL
+        || (entry = LBM_GET_INDEX_ENTRY(priv, msgno)) == NULL
+        || entry->idle_pending
+        || (search_index = lbm_search_index(mailbox)) == NULL)
+        return FALSE;
+
+    key = lbm_search_index_key(entry);
+    retval = libbalsa_search_index_excludes(search_index, key, cond);
+    g_free(key);
+
+    return retval;
+}
+
+/* The keys of all the messages in the mailbox, or NULL if we do not
+ * know them all. */
+static GHashTable *
+lbm_search_index_live_keys(LibBalsaMailbox * mailbox)
+{
+    LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
+    GHashTable *live_keys;
+    guint total;
+    guint msgno;
+
+    if (priv->search_index == NULL || priv->mindex == NULL)
+        return NULL;
+
+    total = libbalsa_mailbox_total_messages(mailbox);
+    if (priv->mindex->len < total)
+        return NULL;
+
+    live_keys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                      NULL);
+    for (msgno = 1; msgno <= total; msgno++) {
+        LibBalsaMailboxIndexEntry *entry = LBM_GET_INDEX_ENTRY(priv, msgno);
+        gchar *key;
+
+        if (entry == NULL || entry->idle_pending) {
+            g_hash_table_destroy(live_keys);
+            return NULL;
+        }
+        if ((key = lbm_search_index_key(entry)) != NULL)
+            g_hash_table_add(live_keys, key);
+    }
+
+    return live_keys;
+}
+
+static void
+lbm_search_index_close(LibBalsaMailbox * mailbox, GHashTable * live_keys)
+{
+    LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
+    GError *err = NULL;
+
+    if (priv->search_index != NULL) {
+        if (!libbalsa_search_index_save(priv->search_index, live_keys,
+                                        &err)) {
+            g_debug("%s: could not save the search index of %s: %s",
+                    __func__, priv->url, err->message);
+            g_error_free(err);
+        }
+        libbalsa_search_index_free(priv->search_index);
+        priv->search_index = NULL;
+    }
 
-static gboolean lbm_set_threading(LibBalsaMailbox * mailbox);
+    if (live_keys != NULL)
+        g_hash_table_destroy(live_keys);
+}
 
-gboolean
-libbalsa_mailbox_open(LibBalsaMailbox * mailbox, GError **err)
+/*
+ * libbalsa_mailbox_search_index_add:
+ * Add a message, whose body is referenced, to the search index;
+ * body_text is its text as extracted by content2reply, or NULL to
+ * extract it here.
+ */
+void
+libbalsa_mailbox_search_index_add(LibBalsaMailbox * mailbox, guint msgno,
+                                  LibBalsaMessage * message,
+                                  const gchar * body_text)
 {
     LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
-    gboolean retval;
+    LibBalsaMailboxIndexEntry *entry;
+    LibBalsaSearchIndex *search_index;
+    LibBalsaMessageHeaders *headers;
+    GString *body = NULL;
+    const gchar *texts[7];
+    gchar *from = NULL, *to = NULL, *cc = NULL;
+    gchar *key;
 
-    g_return_val_if_fail(mailbox != NULL, FALSE);
-    g_return_val_if_fail(LIBBALSA_IS_MAILBOX(mailbox), FALSE);
+    g_return_if_fail(LIBBALSA_IS_MAILBOX(mailbox));
+    g_return_if_fail(LIBBALSA_IS_MESSAGE(message));
 
-    libbalsa_lock_mailbox(mailbox);
+    if (priv->mindex == NULL
+        || (entry = LBM_GET_INDEX_ENTRY(priv, msgno)) == NULL
+        || entry->idle_pending
+        || (search_index = lbm_search_index(mailbox)) == NULL)
+        return;
 
-    if (priv->open_ref > 0) {
-        priv->open_ref++;
-	libbalsa_mailbox_check(mailbox);
-        retval = TRUE;
-    } else {
-	LibBalsaMailboxState saved_state;
+    if ((key = lbm_search_index_key(entry)) == NULL)
+        return;
+    if (libbalsa_search_index_has(search_index, key)) {
+        g_free(key);
+        return;
+    }
 
-        priv->stamp++;
-        if(priv->mindex) g_warning("mindex set - I leak memory");
-        priv->mindex =
-            g_ptr_array_new_with_free_func((GDestroyNotify) lbm_index_entry_free);
+    if (body_text == NULL) {
+        LibBalsaMessageBody *body_list =
+            libbalsa_message_get_body_list(message);
 
-	saved_state = priv->state;
-	priv->state = LB_MAILBOX_STATE_OPENING;
-        priv->messages_threaded = FALSE;
-        retval =
-            LIBBALSA_MAILBOX_GET_CLASS(mailbox)->open_mailbox(mailbox, err);
-        if(retval) {
-            priv->open_ref++;
-	    priv->state = LB_MAILBOX_STATE_OPEN;
-	} else {
-	    priv->state = saved_state;
-            libbalsa_mailbox_free_mindex(mailbox);
-	}
+        if (body_list == NULL) {
+            g_free(key);
+            return;
+        }
+        body = content2reply(body_list, NULL, 0, FALSE, FALSE);
+        body_text = body != NULL ? body->str : "";
     }
 
-    libbalsa_unlock_mailbox(mailbox);
-
-    return retval;
+    headers = libbalsa_message_get_headers(message);
+    if (headers->from != NULL)
+        from = internet_address_list_to_string(headers->from, NULL, FALSE);
+    if (headers->to_list != NULL)
+        to = internet_address_list_to_string(headers->to_list, NULL, FALSE);
+    if (headers->cc_list != NULL)
+        cc = internet_address_list_to_string(headers->cc_list, NULL, FALSE);
+
+    texts[0] = entry->from;
+    texts[1] = entry->subject;
+    texts[2] = LIBBALSA_MESSAGE_GET_SUBJECT(message);
+    texts[3] = from;
+    texts[4] = to;
+    texts[5] = cc;
+    texts[6] = body_text;
+    libbalsa_search_index_add(search_index, key, texts,
+                              G_N_ELEMENTS(texts));
+
+    g_free(from);
+    g_free(to);
+    g_free(cc);
+    g_free(key);
+    if (body != NULL)
+        g_string_free(body, TRUE);
 }
 
-gboolean
-libbalsa_mailbox_is_open(LibBalsaMailbox *mailbox)
-{
-    LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
-
-    g_return_val_if_fail(mailbox != NULL, FALSE);
-    g_return_val_if_fail(LIBBALSA_IS_MAILBOX(mailbox), FALSE);
-    
-
-    return priv->open_ref>0; /* this will break unlisted mailbox types */
-}
-    
 void
 libbalsa_mailbox_close(LibBalsaMailbox * mailbox, gboolean expunge)
 {
     LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
+    GHashTable *live_keys;
 
     g_return_if_fail(mailbox != NULL);
     g_return_if_fail(LIBBALSA_IS_MAILBOX(mailbox));
@@ -657,11 +1497,16 @@ libbalsa_mailbox_close(LibBalsaMailbox * mailbox, gboolean expunge)
 	priv->state = LB_MAILBOX_STATE_CLOSING;
         /* do not try expunging read-only mailboxes, it's a waste of time */
         expunge = expunge && !priv->readonly;
+        live_keys = lbm_search_index_live_keys(mailbox);
         LIBBALSA_MAILBOX_GET_CLASS(mailbox)->close_mailbox(mailbox, expunge);
+        lbm_search_index_close(mailbox, live_keys);
+        lbm_view_rows_clear(priv);
         if(priv->msg_tree) {
             g_node_destroy(priv->msg_tree);
             priv->msg_tree = NULL;
         }
+        lbm_node_table_free(priv);
+        lbm_child_index_free_all(priv);
         libbalsa_mailbox_free_mindex(mailbox);
         priv->stamp++;
 	priv->state = LB_MAILBOX_STATE_CLOSED;
@@ -822,6 +1667,9 @@ libbalsa_mailbox_message_match(LibBalsaMailbox * mailbox,
                                         mailbox, msgno, &match))
         return match;
 
+    if (lbm_search_index_excludes(mailbox, msgno, search_iter->condition))
+        return FALSE;
+
     return LIBBALSA_MAILBOX_GET_CLASS(mailbox)->message_match(mailbox,
                                                               msgno,
                                                               search_iter);
@@ -938,6 +1786,8 @@ lbm_run_filters_on_reception_idle_cb(LibBalsaMailbox * mailbox)
 
         msgnos = g_array_new(FALSE, FALSE, sizeof(guint));
 
+        /* An earlier filter may have moved messages away. */
+        total = libbalsa_mailbox_total_messages(mailbox);
         for (msgno = 1; msgno <= total; msgno++) {
             if (libbalsa_mailbox_message_match(mailbox, msgno, search_iter))
                 g_array_append_val(msgnos, msgno);
@@ -1257,16 +2107,16 @@ lbm_node_has_unseen_child(LibBalsaMailbox * lmm, GNode * node)
 
 static GMutex msgnos_changed_lock;
 
-static void lbm_update_msgnos(LibBalsaMailbox * mailbox, guint seqno,
+static void lbm_update_msgnos(LibBalsaMailbox * mailbox, GArray * expunged,
                               GArray * msgnos);
 
 static void
-lbm_msgno_changed_expunged_cb(LibBalsaMailbox * mailbox, guint seqno)
+lbm_msgno_changed_expunged_cb(LibBalsaMailbox * mailbox, GArray * expunged)
 {
     LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
 
     g_mutex_lock(&msgnos_changed_lock);
-    lbm_update_msgnos(mailbox, seqno, priv->msgnos_changed);
+    lbm_update_msgnos(mailbox, expunged, priv->msgnos_changed);
     g_mutex_unlock(&msgnos_changed_lock);
 }
 
@@ -1278,9 +2128,7 @@ lbm_msgno_row_changed(LibBalsaMailbox * mailbox, guint msgno,
     LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
 
     if (!iter->user_data)
-        iter->user_data =
-            g_node_find(priv->msg_tree, G_PRE_ORDER, G_TRAVERSE_ALL,
-                        GUINT_TO_POINTER(msgno));
+        iter->user_data = lbm_node_lookup(priv, msgno);
 
     if (iter->user_data) {
         GtkTreePath *path;
@@ -1349,7 +2197,7 @@ lbm_msgno_changed(LibBalsaMailbox * mailbox, guint seqno,
         if (!priv->msgnos_changed) {
             priv->msgnos_changed =
                 g_array_new(FALSE, FALSE, sizeof(guint));
-            g_signal_connect(mailbox, "message-expunged",
+            g_signal_connect(mailbox, "messages-expunged",
                              G_CALLBACK(lbm_msgno_changed_expunged_cb),
                              NULL);
         }
@@ -1363,9 +2211,7 @@ lbm_msgno_changed(LibBalsaMailbox * mailbox, guint seqno,
         /* Not calling lbm_msgno_row_changed, so we must make sure
          * iter->user_data is set: */
         if (!iter->user_data)
-            iter->user_data =
-                g_node_find(priv->msg_tree, G_PRE_ORDER, G_TRAVERSE_ALL,
-                            GUINT_TO_POINTER(seqno));
+            iter->user_data = lbm_node_lookup(priv, seqno);
         return;
     }
 
@@ -1426,15 +2272,15 @@ libbalsa_mailbox_msgno_inserted(LibBalsaMailbox *mailbox, guint seqno,
     }
 #undef SANITY_CHECK
 #ifdef SANITY_CHECK
-    g_return_if_fail(!g_node_find(priv->msg_tree,
-                                  G_PRE_ORDER, G_TRAVERSE_ALL,
-                                  GUINT_TO_POINTER(seqno)));
+    g_return_if_fail(lbm_node_lookup(priv, seqno) == NULL);
 #endif
 
     /* Insert node into the message tree before getting path. */
     iter.user_data = g_node_new(GUINT_TO_POINTER(seqno));
     iter.stamp = priv->stamp;
     *sibling = g_node_insert_after(parent, *sibling, iter.user_data);
+    lbm_node_set(priv, seqno, iter.user_data);
+    lbm_child_inserted(priv, parent, iter.user_data);
 
     if (g_signal_has_handler_pending(mailbox,
                                      libbalsa_mailbox_model_signals
@@ -1469,6 +2315,8 @@ libbalsa_mailbox_msgno_filt_in(LibBalsaMailbox *mailbox, guint seqno)
     iter.user_data = g_node_new(GUINT_TO_POINTER(seqno));
     iter.stamp = priv->stamp;
     g_node_prepend(priv->msg_tree, iter.user_data);
+    lbm_node_set(priv, seqno, iter.user_data);
+    lbm_child_inserted(priv, priv->msg_tree, iter.user_data);
 
     path = gtk_tree_model_get_path(GTK_TREE_MODEL(mailbox), &iter);
     g_signal_emit(mailbox, libbalsa_mailbox_model_signals[ROW_INSERTED], 0,
@@ -1480,73 +2328,123 @@ libbalsa_mailbox_msgno_filt_in(LibBalsaMailbox *mailbox, guint seqno)
 }
 
 /*
- * libbalsa_mailbox_msgno_removed and helpers
+ * libbalsa_mailbox_msgnos_removed and helpers
  */
-struct remove_data {LibBalsaMailbox *mailbox; unsigned seqno; GNode *node; };
-static gboolean
-decrease_post(GNode *node, gpointer data)
-{
-    struct remove_data *dt = (struct remove_data*)data;
-    unsigned seqno = GPOINTER_TO_UINT(node->data);
-    if(seqno == dt->seqno) 
-        dt->node = node;
-    else if(seqno>dt->seqno) {
-        GtkTreeIter iter; 
-        node->data = GUINT_TO_POINTER(seqno-1);
-        iter.user_data = node;
-        lbm_msgno_changed(dt->mailbox, seqno, &iter);
+
+/* The number of msgnos in the ascending array msgnos that are less than
+ * msgno. */
+static guint
+lbm_msgnos_below(GArray * msgnos, guint msgno)
+{
+    guint lo = 0, hi = msgnos->len;
+
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (g_array_index(msgnos, guint, mid) < msgno)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    return FALSE;
+
+    return lo;
 }
 
-void
-libbalsa_mailbox_msgno_removed(LibBalsaMailbox * mailbox, guint seqno)
+/* Drop the expunged messages from the index in one pass. */
+static void
+lbm_index_expunge(LibBalsaMailboxPrivate * priv, GArray * msgnos)
 {
-    LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
-    GtkTreeIter iter;
-    GtkTreePath *path;
-    struct remove_data dt;
-    GNode *child;
-    GNode *parent;
+    GPtrArray *mindex = priv->mindex;
+    guint i, j, k;
 
-    g_signal_emit(mailbox, libbalsa_mailbox_signals[MESSAGE_EXPUNGED],
-                  0, seqno);
+    for (i = j = k = 0; i < mindex->len; i++) {
+        gpointer entry = g_ptr_array_index(mindex, i);
 
-    if (!priv->msg_tree) {
-        return;
+        if (k < msgnos->len && g_array_index(msgnos, guint, k) == i + 1) {
+            lbm_index_entry_free(entry);
+            k++;
+            continue;
+        }
+        g_ptr_array_index(mindex, j++) = entry;
     }
+    /* The tail now holds moved entries, which the free function must
+     * not see. */
+    for (i = j; i < mindex->len; i++)
+        g_ptr_array_index(mindex, i) = NULL;
+    g_ptr_array_set_size(mindex, j);
+}
 
-    dt.mailbox = mailbox;
-    dt.seqno = seqno;
-    dt.node = NULL;
+/* Drop the expunged messages from the msgno-to-node table in one pass,
+ * renumbering the nodes of the others; return the nodes of the expunged
+ * messages, in ascending msgno order. */
+static GPtrArray *
+lbm_node_table_expunge(LibBalsaMailbox * mailbox, GArray * msgnos)
+{
+    LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
+    GPtrArray *nodes = g_ptr_array_new();
+    GArray *dates = priv->thread_dates;
+    guint i, j, k, n_dates = 0;
 
-    g_node_traverse(priv->msg_tree, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
-                    decrease_post, &dt);
+    if (priv->msgno_2_node == NULL)
+        return nodes;
 
-    if (seqno <= priv->mindex->len)
-        g_ptr_array_remove_index(priv->mindex, seqno - 1);
+    for (i = j = k = 0; i < priv->msgno_2_node->len; i++) {
+        GNode *node = g_ptr_array_index(priv->msgno_2_node, i);
 
-    priv->msg_tree_changed = TRUE;
+        if (k < msgnos->len && g_array_index(msgnos, guint, k) == i + 1) {
+            if (node != NULL)
+                g_ptr_array_add(nodes, node);
+            k++;
+            continue;
+        }
+        if (node != NULL && j < i) {
+            GtkTreeIter iter;
 
-    if (!dt.node) {
-        /* It's ok, apparently the view did not include this message */
-        return;
+            node->data = GUINT_TO_POINTER(j + 1);
+            iter.user_data = node;
+            lbm_msgno_changed(mailbox, j + 1, &iter);
+        }
+        if (dates != NULL && i < dates->len) {
+            g_array_index(dates, time_t, j) =
+                g_array_index(dates, time_t, i);
+            n_dates = j + 1;
+        }
+        g_ptr_array_index(priv->msgno_2_node, j++) = node;
     }
+    g_ptr_array_set_size(priv->msgno_2_node, j);
+    if (dates != NULL)
+        g_array_set_size(dates, n_dates);
+
+    return nodes;
+}
 
-    iter.user_data = dt.node;
+/* Remove the node of an expunged message from the tree; it is already
+ * gone from the msgno table. */
+static void
+lbm_node_expunge(LibBalsaMailbox * mailbox, GNode * node)
+{
+    LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
+    GtkTreeIter iter;
+    GtkTreePath *path;
+    GNode *child;
+    GNode *parent;
+
+    iter.user_data = node;
     iter.stamp = priv->stamp;
     path = gtk_tree_model_get_path(GTK_TREE_MODEL(mailbox), &iter);
 
     /* First promote any children to the node's parent; we'll insert
      * them all before the current node, to keep the path calculation
      * simple. */
-    parent = dt.node->parent;
-    while ((child = dt.node->children)) {
+    parent = node->parent;
+    while ((child = node->children)) {
         /* No need to notify the tree-view about unlinking the child--it
          * will assume we already did that when we notify it about
          * destroying the parent. */
         g_node_unlink(child);
-        g_node_insert_before(parent, dt.node, child);
+        g_node_insert_before(parent, node, child);
+        lbm_child_index_drop(priv, node);
+        lbm_child_index_drop(priv, parent);
 
         /* Notify the tree-view about the new location of the child. */
         iter.user_data = child;
@@ -1559,15 +2457,8 @@ libbalsa_mailbox_msgno_removed(LibBalsaMailbox * mailbox, guint seqno)
         gtk_tree_path_next(path);
     }
 
-    libbalsa_lock_mailbox(mailbox);
-    if (priv->need_threading_idle_id == 0) {
-        priv->need_threading_idle_id =
-            g_idle_add((GSourceFunc) lbm_need_threading_idle_cb, mailbox);
-    }
-    libbalsa_unlock_mailbox(mailbox);
-
     /* Now it's safe to destroy the node. */
-    g_node_destroy(dt.node);
+    lbm_node_destroy(priv, node);
     g_signal_emit(mailbox, libbalsa_mailbox_model_signals[ROW_DELETED], 0, path);
 
     if (parent->parent && !parent->children) {
@@ -1582,6 +2473,66 @@ libbalsa_mailbox_msgno_removed(LibBalsaMailbox * mailbox, guint seqno)
     priv->stamp++;
 }
 
+/* Remove messages that have been expunged together; msgnos holds their
+ * msgnos, in ascending order, as they were before any of them went.
+ * The msgno table and the index are compacted once for all of them, and
+ * each message that stays is renumbered once, where removing the
+ * messages one at a time would shift both for every one of them. */
+void
+libbalsa_mailbox_msgnos_removed(LibBalsaMailbox * mailbox, GArray * msgnos)
+{
+    LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
+    GPtrArray *nodes;
+    guint i;
+
+    if (msgnos->len == 0)
+        return;
+
+    lbm_view_rows_clear(priv);
+
+    /* Highest first, so that each msgno is still valid when sent. */
+    for (i = msgnos->len; i > 0; i--)
+        g_signal_emit(mailbox, libbalsa_mailbox_signals[MESSAGE_EXPUNGED],
+                      0, g_array_index(msgnos, guint, i - 1));
+    g_signal_emit(mailbox, libbalsa_mailbox_signals[MESSAGES_EXPUNGED],
+                  0, msgnos);
+
+    if (!priv->msg_tree) {
+        return;
+    }
+
+    /* The index first, so that the renumbered rows find their
+     * entries. */
+    lbm_index_expunge(priv, msgnos);
+    nodes = lbm_node_table_expunge(mailbox, msgnos);
+
+    priv->msg_tree_changed = TRUE;
+
+    if (nodes->len > 0) {
+        /* Any messages not in the table were not in the view. */
+        libbalsa_lock_mailbox(mailbox);
+        if (priv->need_threading_idle_id == 0) {
+            priv->need_threading_idle_id =
+                g_idle_add((GSourceFunc) lbm_need_threading_idle_cb, mailbox);
+        }
+        libbalsa_unlock_mailbox(mailbox);
+    }
+
+    for (i = nodes->len; i > 0; i--)
+        lbm_node_expunge(mailbox, g_ptr_array_index(nodes, i - 1));
+    g_ptr_array_free(nodes, TRUE);
+}
+
+void
+libbalsa_mailbox_msgno_removed(LibBalsaMailbox * mailbox, guint seqno)
+{
+    GArray *msgnos = g_array_sized_new(FALSE, FALSE, sizeof(guint), 1);
+
+    g_array_append_val(msgnos, seqno);
+    libbalsa_mailbox_msgnos_removed(mailbox, msgnos);
+    g_array_free(msgnos, TRUE);
+}
+
 static void
 libbalsa_mailbox_msgno_filt_out(LibBalsaMailbox * mailbox, GNode * node)
 {
@@ -1608,6 +2559,8 @@ libbalsa_mailbox_msgno_filt_out(LibBalsaMailbox * mailbox, GNode * node)
          * destroying the parent. */
         g_node_unlink(child);
         g_node_insert_before(parent, node, child);
+        lbm_child_index_drop(priv, node);
+        lbm_child_index_drop(priv, parent);
 
         /* Notify the tree-view about the new location of the child. */
         iter.user_data = child;
@@ -1621,7 +2574,7 @@ libbalsa_mailbox_msgno_filt_out(LibBalsaMailbox * mailbox, GNode * node)
     }
 
     /* Now it's safe to destroy the node. */
-    g_node_destroy(node);
+    lbm_node_destroy(priv, node);
     g_signal_emit(mailbox, libbalsa_mailbox_model_signals[ROW_DELETED], 0, path);
 
     if (parent->parent && !parent->children) {
@@ -1658,8 +2611,7 @@ lbm_msgno_filt_check(LibBalsaMailbox * mailbox, guint seqno,
 
     match = search_iter ?
         libbalsa_mailbox_message_match(mailbox, seqno, search_iter) : TRUE;
-    node = g_node_find(priv->msg_tree, G_PRE_ORDER, G_TRAVERSE_ALL,
-                       GUINT_TO_POINTER(seqno));
+    node = lbm_node_lookup(priv, seqno);
     if (node) {
         if (!match) {
             gboolean filt_out = hold_selected ?
@@ -1744,6 +2696,10 @@ libbalsa_mailbox_search_iter_new(LibBalsaCondition * condition)
     if (!condition)
         return NULL;
 
+    /* Prepare the strings and compile the regexs of the condition
+     * once, rather than for each message. */
+    libbalsa_condition_compile_regexs(condition);
+
     iter = g_new(LibBalsaMailboxSearchIter, 1);
     iter->mailbox = NULL;
     iter->stamp = 0;
@@ -1845,6 +2801,113 @@ lbm_prev(GNode * node)
     return node->parent;
 }
 
+/* Collect the messages in up to count rows following (direction > 0)
+ * or preceding (direction < 0) the row of msgno, in the order of the
+ * view; returns the number of msgnos stored.
+ *
+ * Near the rows shown, only the rows that the index has reported are
+ * walked, so that the messages in collapsed threads are skipped;
+ * elsewhere, the whole message tree is. */
+guint
+libbalsa_mailbox_view_neighbours(LibBalsaMailbox * mailbox, guint msgno,
+                                 gint direction, guint count,
+                                 guint * msgnos)
+{
+    LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
+    guint total;
+    GNode *node;
+    guint n = 0;
+
+    g_return_val_if_fail(LIBBALSA_IS_MAILBOX(mailbox), 0);
+
+    total = libbalsa_mailbox_total_messages(mailbox);
+
+    g_mutex_lock(&visible_rows_lock);
+    if (priv->view_rows != NULL) {
+        guint *rows = (guint *) priv->view_rows->data;
+        guint len = priv->view_rows->len;
+        guint i;
+
+        for (i = 0; i < len && rows[i] != msgno; i++)
+            /* nothing */ ;
+        if (i < len) {
+            while (n < count && (direction > 0 ? ++i < len : i-- > 0))
+                if (rows[i] <= total)
+                    msgnos[n++] = rows[i];
+            g_mutex_unlock(&visible_rows_lock);
+            return n;
+        }
+    }
+    g_mutex_unlock(&visible_rows_lock);
+
+    libbalsa_lock_mailbox(mailbox);
+    if (priv->msg_tree != NULL
+        && (node = lbm_node_lookup(priv, msgno)) != NULL) {
+        while (n < count) {
+            node = direction > 0 ? lbm_next(node) : lbm_prev(node);
+            if (G_NODE_IS_ROOT(node))
+                break;
+            msgnos[n++] = GPOINTER_TO_UINT(node->data);
+        }
+    }
+    libbalsa_unlock_mailbox(mailbox);
+
+    return n;
+}
+
+/* The rows shown by the index, and the rows around them: rows holds
+ * the msgnos of n_rows rows in the order of the view, rows[first] to
+ * rows[last] being shown; direction is the direction in which the index
+ * was last scrolled.  Called from the main thread, while the backend
+ * reads them in its own. */
+void
+libbalsa_mailbox_set_visible_range(LibBalsaMailbox * mailbox,
+                                   const guint * rows, guint n_rows,
+                                   guint first, guint last,
+                                   gint direction)
+{
+    LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
+
+    g_return_if_fail(LIBBALSA_IS_MAILBOX(mailbox));
+    g_return_if_fail(n_rows == 0 || (first <= last && last < n_rows));
+
+    g_mutex_lock(&visible_rows_lock);
+    if (priv->view_rows == NULL)
+        priv->view_rows = g_array_new(FALSE, FALSE, sizeof(guint));
+    g_array_set_size(priv->view_rows, 0);
+    g_array_append_vals(priv->view_rows, rows, n_rows);
+    priv->visible_first = first;
+    priv->visible_last = last;
+    if (direction != 0)
+        priv->visible_direction = direction;
+    g_mutex_unlock(&visible_rows_lock);
+}
+
+gboolean
+libbalsa_mailbox_get_visible_range(LibBalsaMailbox * mailbox,
+                                   guint * first_msgno,
+                                   guint * last_msgno, gint * direction)
+{
+    LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
+    gboolean retval;
+
+    g_return_val_if_fail(LIBBALSA_IS_MAILBOX(mailbox), FALSE);
+
+    g_mutex_lock(&visible_rows_lock);
+    retval = priv->view_rows != NULL && priv->view_rows->len > 0;
+    if (retval) {
+        *first_msgno =
+            g_array_index(priv->view_rows, guint, priv->visible_first);
+        *last_msgno =
+            g_array_index(priv->view_rows, guint, priv->visible_last);
+    } else
+        *first_msgno = *last_msgno = 0;
+    *direction = priv->visible_direction;
+    g_mutex_unlock(&visible_rows_lock);
+
+    return retval;
+}
+
 /* Find a message in the tree-model, by its message number. */
 gboolean
 libbalsa_mailbox_msgno_find(LibBalsaMailbox * mailbox, guint seqno,
@@ -1856,9 +2919,8 @@ libbalsa_mailbox_msgno_find(LibBalsaMailbox * mailbox, guint seqno,
     g_return_val_if_fail(LIBBALSA_IS_MAILBOX(mailbox), FALSE);
     g_return_val_if_fail(seqno > 0, FALSE);
 
-    if (!priv->msg_tree || !(tmp_iter.user_data =
-        g_node_find(priv->msg_tree, G_PRE_ORDER, G_TRAVERSE_ALL,
-                    GINT_TO_POINTER(seqno))))
+    if (!priv->msg_tree
+        || !(tmp_iter.user_data = lbm_node_lookup(priv, seqno)))
         return FALSE;
 
     tmp_iter.stamp = priv->stamp;
@@ -2027,6 +3089,10 @@ lbm_cache_message(LibBalsaMailbox * mailbox, guint msgno,
         need_sort = FALSE;
     }
 
+    if (need_sort)
+        lbm_thread_date_raise(priv, lbm_node_lookup(priv, msgno),
+                              entry->msg_date);
+
     if (need_sort && priv->sort_idle_id == 0) {
         priv->sort_idle_id =
             g_idle_add_full(G_PRIORITY_LOW, (GSourceFunc) lbm_sort_idle_cb,
@@ -2236,18 +3302,15 @@ libbalsa_mailbox_messages_copy(LibBalsaMailbox * mailbox, GArray * msgnos,
     return retval;
 }
 
-/* Move messages with msgnos in the list from mailbox to dest. */
-gboolean
-libbalsa_mailbox_messages_move(LibBalsaMailbox * mailbox,
-                               GArray * msgnos,
-                               LibBalsaMailbox * dest, GError **err)
+/* Default method: copy the messages and mark the originals as deleted;
+ * the imap backend replaces it with a server-side move when it can. */
+static gboolean
+libbalsa_mailbox_real_messages_move(LibBalsaMailbox * mailbox,
+                                    GArray * msgnos,
+                                    LibBalsaMailbox * dest, GError **err)
 {
     gboolean retval;
 
-    g_return_val_if_fail(LIBBALSA_IS_MAILBOX(mailbox), FALSE);
-    g_return_val_if_fail(msgnos->len > 0, TRUE);
-
-    libbalsa_lock_mailbox(mailbox);
     if (libbalsa_mailbox_messages_copy(mailbox, msgnos, dest, err)) {
         retval = libbalsa_mailbox_messages_change_flags
             (mailbox, msgnos, LIBBALSA_MESSAGE_FLAG_DELETED,
@@ -2258,6 +3321,24 @@ libbalsa_mailbox_messages_move(LibBalsaMailbox * mailbox,
 			_("Removing messages from source mailbox failed"));
     } else
         retval = FALSE;
+
+    return retval;
+}
+
+/* Move messages with msgnos in the list from mailbox to dest. */
+gboolean
+libbalsa_mailbox_messages_move(LibBalsaMailbox * mailbox,
+                               GArray * msgnos,
+                               LibBalsaMailbox * dest, GError **err)
+{
+    gboolean retval;
+
+    g_return_val_if_fail(LIBBALSA_IS_MAILBOX(mailbox), FALSE);
+    g_return_val_if_fail(msgnos->len > 0, TRUE);
+
+    libbalsa_lock_mailbox(mailbox);
+    retval = LIBBALSA_MAILBOX_GET_CLASS(mailbox)->
+	messages_move(mailbox, msgnos, dest, err);
     libbalsa_unlock_mailbox(mailbox);
 
     return retval;
@@ -3042,31 +4123,38 @@ mailbox_model_get_iter(GtkTreeModel *tree_model,
 }
 
 static GtkTreePath *
-mailbox_model_get_path_helper(GNode * node, GNode * msg_tree)
+mailbox_model_get_path_helper(LibBalsaMailbox * mailbox, GNode * node)
 {
-    GtkTreePath *path = gtk_tree_path_new();
+    LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
+    GtkTreePath *path;
+    GNode *root;
+    gsize depth;
+    gsize i;
+    gint *indices;
+
+    /* Make sure that the node is in the tree before we look at any
+     * sibling positions. */
+    depth = 0;
+    for (root = node; root->parent != NULL; root = root->parent)
+        ++depth;
+    if (root != priv->msg_tree)
+        return NULL;
 
-    while (node->parent) {
-	gint i = g_node_child_position(node->parent, node);
-	if (i < 0) {
-	    gtk_tree_path_free(path);
-	    return NULL;
-	}
-	gtk_tree_path_prepend_index(path, i);
-	node = node->parent;
+    indices = g_new(gint, depth);
+    for (i = depth; i > 0; i--) {
+        indices[i - 1] = lbm_child_position(priv, node);
+        node = node->parent;
     }
+    path = gtk_tree_path_new_from_indicesv(indices, depth);
+    g_free(indices);
 
-    if (node == msg_tree)
-	return path;
-    gtk_tree_path_free(path);
-    return NULL;
+    return path;
 }
 
 static GtkTreePath *
 mailbox_model_get_path(GtkTreeModel * tree_model, GtkTreeIter * iter)
 {
     LibBalsaMailbox *mailbox = (LibBalsaMailbox *) tree_model;
-    LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
     GNode *node;
 #ifdef SANITY_CHECK
     GNode *parent_node;
@@ -3083,7 +4171,7 @@ mailbox_model_get_path(GtkTreeModel * tree_model, GtkTreeIter * iter)
 
     g_return_val_if_fail(node->parent != NULL, NULL);
 
-    return mailbox_model_get_path_helper(node, priv->msg_tree);
+    return mailbox_model_get_path_helper(mailbox, node);
 }
 
 /* mailbox_model_get_value: 
@@ -3099,12 +4187,12 @@ static GdkPixbuf *attach_icons[LIBBALSA_MESSAGE_ATTACH_ICONS_NUM];
 static GMutex get_index_entry_lock;
 
 static void
-lbm_get_index_entry_expunged_cb(LibBalsaMailbox * mailbox, guint seqno)
+lbm_get_index_entry_expunged_cb(LibBalsaMailbox * mailbox, GArray * expunged)
 {
     LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
 
     g_mutex_lock(&get_index_entry_lock);
-    lbm_update_msgnos(mailbox, seqno, priv->msgnos_pending);
+    lbm_update_msgnos(mailbox, expunged, priv->msgnos_pending);
     g_mutex_unlock(&get_index_entry_lock);
 }
 
@@ -3167,7 +4255,7 @@ lbm_get_index_entry(LibBalsaMailbox * lmm, guint msgno)
     g_mutex_lock(&get_index_entry_lock);
     if (!priv->msgnos_pending) {
         priv->msgnos_pending = g_array_new(FALSE, FALSE, sizeof(guint));
-        g_signal_connect(lmm, "message-expunged",
+        g_signal_connect(lmm, "messages-expunged",
                          G_CALLBACK(lbm_get_index_entry_expunged_cb), NULL);
     }
 
@@ -3351,7 +4439,7 @@ mailbox_model_iter_n_children(GtkTreeModel      *tree_model,
 
     node = iter ? iter->user_data : priv->msg_tree;
 
-    return node ? g_node_n_children(node) : 0;
+    return node ? lbm_n_children(priv, node) : 0;
 }
 
 static gboolean
@@ -3379,7 +4467,7 @@ mailbox_model_iter_nth_child(GtkTreeModel  * tree_model,
                * only if mailbox is closed but a view is still active. 
                */
         return FALSE;
-    node = g_node_nth_child(node, n);
+    node = lbm_nth_child(priv, node, n);
 
     if (node) {
         iter->user_data = node;
@@ -3572,56 +4660,33 @@ mailbox_sortable_init(GtkTreeSortableIface * iface)
     iface->has_default_sort_func = mailbox_has_default_sort_func;
 }
 
+/* The sort keys of the index entries are made when the entries are
+ * filled, so comparing two messages costs no more than a strcmp(); an
+ * entry without a key sorts as an empty string. */
+#define LBM_SORT_KEY(key) ((key) != NULL ? (key) : "")
+
 static gint
 mailbox_compare_from(LibBalsaMailboxIndexEntry * message_a,
                   LibBalsaMailboxIndexEntry * message_b)
 {
-    return g_ascii_strcasecmp(message_a->from, message_b->from);
+    return strcmp(LBM_SORT_KEY(message_a->from_key),
+                  LBM_SORT_KEY(message_b->from_key));
 }
 
 static gint
 mailbox_compare_subject(LibBalsaMailboxIndexEntry * message_a,
                      LibBalsaMailboxIndexEntry * message_b)
 {
-    return g_ascii_strcasecmp(message_a->subject, message_b->subject);
+    return strcmp(LBM_SORT_KEY(message_a->subject_key),
+                  LBM_SORT_KEY(message_b->subject_key));
 }
 
 static gint
 mailbox_compare_date(LibBalsaMailboxIndexEntry * message_a,
                   LibBalsaMailboxIndexEntry * message_b)
 {
-    return message_a->msg_date - message_b->msg_date;
-}
-
-/* Thread date stuff */
-
-typedef struct {
-    time_t                  thread_date;
-    LibBalsaMailboxPrivate *priv;
-} LibBalsaMailboxThreadDateInfo;
-
-static gboolean
-mailbox_get_thread_date_traverse_func(GNode   *node,
-                                      gpointer data)
-{
-    LibBalsaMailboxThreadDateInfo *info = data;
-    guint msgno;
-    LibBalsaMailboxIndexEntry *message;
-
-    if ((msgno = GPOINTER_TO_UINT(node->data)) > 0 &&
-        msgno <= info->priv->mindex->len &&
-        (message = g_ptr_array_index(info->priv->mindex, msgno - 1)) != NULL) {
-        time_t msg_date = message->msg_date;
-
-        if (msg_date > info->thread_date)
-            info->thread_date = msg_date;
-
-        return FALSE;
-    }
-
-    /* Either a bad msgno or a NULL message: stop the traversal before
-     * something bad happens. */
-    return TRUE;
+    return (message_a->msg_date > message_b->msg_date)
+        - (message_a->msg_date < message_b->msg_date);
 }
 
 static time_t
@@ -3631,14 +4696,10 @@ mailbox_get_thread_date(const SortTuple *tuple,
     LibBalsaMailboxPrivate *priv = libbalsa_mailbox_get_instance_private(mailbox);
 
     if (tuple->thread_date == 0) {
-        LibBalsaMailboxThreadDateInfo info = { 0, priv };
-
-        g_node_traverse(tuple->node, G_IN_ORDER, G_TRAVERSE_ALL, -1,
-                        mailbox_get_thread_date_traverse_func, &info);
-
         /* Cast away the 'const' qualifier so that we can cache the
          * thread date: */
-        ((SortTuple *) tuple)->thread_date = info.thread_date;
+        ((SortTuple *) tuple)->thread_date =
+            lbm_thread_date(priv, tuple->node);
     }
 
     return tuple->thread_date;
@@ -3649,16 +4710,18 @@ mailbox_compare_thread_date(const SortTuple *a,
                          const SortTuple *b,
                          LibBalsaMailbox *mailbox)
 {
-    return mailbox_get_thread_date(a, mailbox) - mailbox_get_thread_date(b, mailbox);
-}
+    time_t date_a = mailbox_get_thread_date(a, mailbox);
+    time_t date_b = mailbox_get_thread_date(b, mailbox);
 
-/* End of thread date stuff */
+    return (date_a > date_b) - (date_a < date_b);
+}
 
 static gint
 mailbox_compare_size(LibBalsaMailboxIndexEntry * message_a,
                   LibBalsaMailboxIndexEntry * message_b)
 {
-    return message_a->size - message_b->size;
+    return (message_a->size > message_b->size)
+        - (message_a->size < message_b->size);
 }
 
 static gint
@@ -3676,11 +4739,8 @@ mailbox_compare_func(const SortTuple * a,
     if (priv->view->sort_field == LB_MAILBOX_SORT_NO)
 	retval = msgno_a - msgno_b;
     else {
-	LibBalsaMailboxIndexEntry *message_a;
-	LibBalsaMailboxIndexEntry *message_b;
-
-	message_a = LBM_GET_INDEX_ENTRY(priv, msgno_a);
-	message_b = LBM_GET_INDEX_ENTRY(priv, msgno_b);
+	LibBalsaMailboxIndexEntry *message_a = a->entry;
+	LibBalsaMailboxIndexEntry *message_b = b->entry;
 
 	if (!(VALID_ENTRY(message_a) && VALID_ENTRY(message_b)))
 	    return 0;
@@ -3791,6 +4851,7 @@ lbm_sort(LibBalsaMailbox * mailbox, GNode * parent)
             /* We have the sort fields. */
             sort_tuple.offset = node_array->len;
             sort_tuple.node = tmp_node;
+            sort_tuple.entry = LBM_GET_INDEX_ENTRY(priv, msgno);
             sort_tuple.thread_date = 0;
             g_array_append_val(sort_array, sort_tuple);
         }
@@ -3825,6 +4886,7 @@ lbm_sort(LibBalsaMailbox * mailbox, GNode * parent)
             else
                 node = parent->children = tmp_node;
             tmp_node->prev = prev;
+            lbm_child_index_drop(priv, parent);
             priv->msg_tree_changed = TRUE;
         } else
             g_assert(prev == NULL || prev->next == tmp_node);
@@ -4014,9 +5076,11 @@ libbalsa_mailbox_unlink_and_prepend(LibBalsaMailbox * mailbox,
 
     iter.stamp = priv->stamp;
 
-    path = mailbox_model_get_path_helper(node, priv->msg_tree);
+    path = mailbox_model_get_path_helper(mailbox, node);
     current_parent = node->parent;
     g_node_unlink(node);
+    if (current_parent != NULL)
+        lbm_child_removed(priv, current_parent, node);
     if (path) {
         /* The node was in priv->msg_tree. */
         g_signal_emit(mailbox,
@@ -4033,12 +5097,13 @@ libbalsa_mailbox_unlink_and_prepend(LibBalsaMailbox * mailbox,
     }
 
     if (!parent) {
-        g_node_destroy(node);
+        lbm_node_destroy(priv, node);
         return;
     }
 
     g_node_prepend(parent, node);
-    path = mailbox_model_get_path_helper(parent, priv->msg_tree);
+    lbm_child_inserted(priv, parent, node);
+    path = mailbox_model_get_path_helper(mailbox, parent);
     if (path) {
         /* The parent is in priv->msg_tree. */
         if (!node->next) {
@@ -4131,8 +5196,13 @@ lbm_update_msg_tree_move(GNode * new_node,
         return FALSE;
 
     node = mti->nodes[msgno];
-    if (!node)
+    if (!node) {
+        LibBalsaMailboxPrivate *priv =
+            libbalsa_mailbox_get_instance_private(mti->mailbox);
+
         mti->nodes[msgno] = node = g_node_new(new_node->data);
+        lbm_node_set(priv, msgno, node);
+    }
 
     msgno = GPOINTER_TO_UINT(new_node->parent->data);
     if (msgno >= mti->total)
@@ -4219,6 +5289,8 @@ libbalsa_mailbox_set_msg_tree(LibBalsaMailbox * mailbox, GNode * new_tree)
         if (priv->msg_tree)
             g_node_destroy(priv->msg_tree);
         priv->msg_tree = new_tree;
+        lbm_child_index_free_all(priv);
+        lbm_node_table_rebuild(priv);
         lbm_set_msg_tree(mailbox);
     }
 
@@ -4440,19 +5512,21 @@ libbalsa_mailbox_try_reassemble(LibBalsaMailbox * mailbox,
         priv->reassemble_ids = g_slist_prepend(priv->reassemble_ids, g_strdup(id));
 }
 
-/* Use "message-expunged" signal to update an array of msgnos. */
+/* Use "messages-expunged" signal to update an array of msgnos. */
 static void
-lbm_update_msgnos(LibBalsaMailbox * mailbox, guint seqno, GArray * msgnos)
+lbm_update_msgnos(LibBalsaMailbox * mailbox, GArray * expunged,
+                  GArray * msgnos)
 {
     guint i, j;
 
     for (i = j = 0; i < msgnos->len; i++) {
         guint msgno = g_array_index(msgnos, guint, i);
-        if (msgno == seqno)
+        guint below = lbm_msgnos_below(expunged, msgno);
+
+        if (below < expunged->len
+            && g_array_index(expunged, guint, below) == msgno)
             continue;
-        if (msgno > seqno)
-            --msgno;
-        g_array_index(msgnos, guint, j) = msgno;
+        g_array_index(msgnos, guint, j) = msgno - below;
         ++j;
     }
     msgnos->len = j;
@@ -4462,7 +5536,7 @@ void
 libbalsa_mailbox_register_msgnos(LibBalsaMailbox * mailbox,
                                  GArray * msgnos)
 {
-    g_signal_connect(mailbox, "message-expunged",
+    g_signal_connect(mailbox, "messages-expunged",
                      G_CALLBACK(lbm_update_msgnos), msgnos);
 }
 
@@ -4712,9 +5786,22 @@ lbm_set_color(LibBalsaMailbox * mailbox, GArray * msgnos,
             return;
 
         entry = g_ptr_array_index(priv->mindex, msgno - 1);
-        if (!entry)
-            entry = g_ptr_array_index(priv->mindex, msgno - 1) =
-                g_new0(LibBalsaMailboxIndexEntry, 1);
+        if (!VALID_ENTRY(entry)) {
+            /* Fill the entry, sort keys and all, before coloring it;
+             * getting the message may already have done so. */
+            LibBalsaMessage *message =
+                libbalsa_mailbox_get_message(mailbox, msgno);
+
+            if (message == NULL)
+                continue;
+            entry = g_ptr_array_index(priv->mindex, msgno - 1);
+            if (entry == NULL)
+                entry = g_ptr_array_index(priv->mindex, msgno - 1) =
+                    lbm_index_entry_new_pending();
+            if (entry->idle_pending)
+                lbm_index_entry_populate_from_msg(entry, message);
+            g_object_unref(message);
+        }
 
         if (foreground) {
             g_free(entry->foreground);
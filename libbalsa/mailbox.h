@@ -77,6 +77,7 @@ typedef struct _SortTuple SortTuple;
 struct _SortTuple {
     guint offset;
     GNode *node;
+    struct LibBalsaMailboxIndexEntry_ *entry;
     time_t thread_date;
 };
 
@@ -199,6 +200,7 @@ struct _LibBalsaMailboxClass {
     /* Signals */
     void (*changed) (LibBalsaMailbox * mailbox);
     void (*message_expunged) (LibBalsaMailbox * mailbox, guint seqno);
+    void (*messages_expunged) (LibBalsaMailbox * mailbox, GArray * msgnos);
     void (*progress_notify) (LibBalsaMailbox * mailbox, gint action, gdouble fraction, gchar *message);
 
     /* Virtual Functions */
@@ -239,6 +241,8 @@ struct _LibBalsaMailboxClass {
 				       LibBalsaMessageFlag clear);
     gboolean (*messages_copy) (LibBalsaMailbox * mailbox, GArray *msgnos,
 			       LibBalsaMailbox * dest, GError **err);
+    gboolean (*messages_move) (LibBalsaMailbox * mailbox, GArray *msgnos,
+			       LibBalsaMailbox * dest, GError **err);
     /* Test message flags */
     gboolean(*msgno_has_flags) (LibBalsaMailbox * mailbox, guint msgno,
                                 LibBalsaMessageFlag set,
@@ -509,6 +513,8 @@ void libbalsa_mailbox_msgno_inserted(LibBalsaMailbox * mailbox,
                                      guint seqno, GNode * parent,
                                      GNode ** sibling);
 void libbalsa_mailbox_msgno_removed(LibBalsaMailbox  *mailbox, guint seqno);
+void libbalsa_mailbox_msgnos_removed(LibBalsaMailbox * mailbox,
+                                     GArray * msgnos);
 void libbalsa_mailbox_msgno_filt_check(LibBalsaMailbox * mailbox,
 				       guint seqno,
 				       LibBalsaMailboxSearchIter
@@ -520,6 +526,20 @@ gboolean libbalsa_mailbox_msgno_find(LibBalsaMailbox * mailbox,
 				     guint seqno,
 				     GtkTreePath ** path,
 				     GtkTreeIter * iter);
+guint libbalsa_mailbox_view_neighbours(LibBalsaMailbox * mailbox,
+                                       guint msgno, gint direction,
+                                       guint count, guint * msgnos);
+/* The rows shown by the index, and the rows around them, for backends
+ * that prefetch message data ahead of the scrolling. */
+#define LIBBALSA_MAILBOX_VIEW_ROWS_AROUND 640
+void libbalsa_mailbox_set_visible_range(LibBalsaMailbox * mailbox,
+                                        const guint * rows,
+                                        guint n_rows, guint first,
+                                        guint last, gint direction);
+gboolean libbalsa_mailbox_get_visible_range(LibBalsaMailbox * mailbox,
+                                            guint * first_msgno,
+                                            guint * last_msgno,
+                                            gint * direction);
 /* Manage message flags */
 gboolean libbalsa_mailbox_msgno_change_flags(LibBalsaMailbox * mailbox,
                                              guint msgno,
@@ -564,6 +584,10 @@ void libbalsa_mailbox_msgno_update_attach(LibBalsaMailbox * mailbox,
 					  LibBalsaMessage * message);
 void libbalsa_mailbox_cache_message(LibBalsaMailbox * mailbox, guint msgno,
                                     LibBalsaMessage * message);
+void libbalsa_mailbox_search_index_add(LibBalsaMailbox * mailbox,
+                                       guint msgno,
+                                       LibBalsaMessage * message,
+                                       const gchar * body_text);
 
 /* Set the foreground and background colors of an array of messages */
 void libbalsa_mailbox_set_foreground(LibBalsaMailbox * mailbox,
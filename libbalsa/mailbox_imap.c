@@ -19,7 +19,8 @@
 
 /* NOTES:
 
-   CACHING: persistent cache is implemented using a directory. 
+   CACHING: persistent cache is implemented using a directory; the
+   message bodies are packed in it, see imap-body-cache.h.
 
    CONNECTIONS: there is always one connection per opened mailbox to
    keep track of untagged responses. Understand idea of untagged
@@ -43,8 +44,10 @@
 
 #include "filter-funcs.h"
 #include "filter.h"
+#include "imap-body-cache.h"
 #include "imap-commands.h"
 #include "imap-handle.h"
+#include "imap-prefetch.h"
 #include "imap-server.h"
 #include "libbalsa-conf.h"
 #include "libbalsa_private.h"
@@ -59,6 +62,10 @@
 
 #define ENABLE_CLIENT_SIDE_SORT 1
 
+struct lbm_imap_status {
+    unsigned messages, unseen, uidnext, uidvalidity;
+};
+
 struct _LibBalsaMailboxImap {
     LibBalsaMailboxRemote mailbox;
     ImapMboxHandle *handle;     /* stream that has this mailbox selected */
@@ -81,6 +88,20 @@ struct _LibBalsaMailboxImap {
 
     gboolean disconnected;
     struct ImapCacheManager *icm;
+    LibBalsaImapPrefetch *prefetch; /* envelopes to fetch ahead */
+
+    /* While a MOVE runs, the msgnos and UIDs of the messages the
+     * server expunges; they are applied when it completes. */
+    GArray *expunged;
+    GArray *expunged_uids;
+
+    /* The status of the closed mailbox at the last check, and the one
+     * libbalsa_imap_prefetch_status() took for the next check. */
+    struct lbm_imap_status status;
+    struct lbm_imap_status new_status;
+    gint64 new_status_time;
+    unsigned has_status:1;
+    unsigned has_new_status:1;
 };
 
 struct message_info {
@@ -172,6 +193,12 @@ static gboolean libbalsa_mailbox_imap_messages_copy(LibBalsaMailbox *
 						    LibBalsaMailbox *
 						    dest,
                                                     GError **err);
+static gboolean libbalsa_mailbox_imap_messages_move(LibBalsaMailbox *
+						    mailbox,
+						    GArray * msgnos,
+						    LibBalsaMailbox *
+						    dest,
+                                                    GError **err);
 
 static void server_host_settings_changed_cb(LibBalsaServer * server,
 					    LibBalsaMailbox * mailbox);
@@ -259,6 +286,8 @@ libbalsa_mailbox_imap_class_init(LibBalsaMailboxImapClass * klass)
 	libbalsa_mailbox_imap_total_messages;
     libbalsa_mailbox_class->messages_copy =
 	libbalsa_mailbox_imap_messages_copy;
+    libbalsa_mailbox_class->messages_move =
+	libbalsa_mailbox_imap_messages_move;
 }
 
 static void
@@ -305,6 +334,7 @@ libbalsa_mailbox_imap_finalize(GObject * object)
     g_list_free_full(mimap->acls, (GDestroyNotify) imap_user_acl_free);
     if (mimap->icm != NULL)
         imap_cache_manager_free(mimap->icm);
+    libbalsa_imap_prefetch_free(mimap->prefetch);
 
     G_OBJECT_CLASS(libbalsa_mailbox_imap_parent_class)->finalize(object);
 }
@@ -453,104 +483,51 @@ get_header_cache_path(LibBalsaMailboxImap *mimap)
     return header_file;
 }
 
-static gchar**
-get_cache_name_pair(LibBalsaMailboxImap *mimap, const gchar *type,
-                    ImapUID uid)
+/* The key of a message body, or of its part, in the body cache. */
+static gchar*
+get_cache_key(LibBalsaMailboxImap *mimap, const gchar *type, ImapUID uid)
 {
     LibBalsaMailboxRemote *remote = LIBBALSA_MAILBOX_REMOTE(mimap);
     LibBalsaServer *server = libbalsa_mailbox_remote_get_server(remote);
-    LibBalsaImapServer *imap_server = LIBBALSA_IMAP_SERVER(server);
-    gboolean is_persistent = libbalsa_imap_server_has_persistent_cache(imap_server);
-    gchar **res = g_malloc(3*sizeof(gchar*));
-    ImapUID uid_validity = mimap->uid_validity;
-    gchar *fname;
 
-    res[0] = get_cache_dir(is_persistent);
-    fname = g_strdup_printf("%s@%s-%s-%u-%u-%s",
-                            libbalsa_server_get_user(server),
-                            libbalsa_server_get_host(server),
-                            (mimap->path != NULL ? mimap->path : "INBOX"),
-                            uid_validity, uid, type);
-    res[1] = libbalsa_urlencode(fname);
-    g_free(fname);
-    res[2] = NULL;
-
-    return res;
+    return g_strdup_printf("%s@%s-%s-%u-%u-%s",
+                           libbalsa_server_get_user(server),
+                           libbalsa_server_get_host(server),
+                           (mimap->path != NULL ? mimap->path : "INBOX"),
+                           mimap->uid_validity, uid, type);
 }
 
-/* clean_cache:
-   removes unused entries from the cache file.
-*/
-struct file_info {
-    char  *name;
-    off_t  size;
-    time_t time;
-};
-static gint
-cmp_by_time (gconstpointer  a, gconstpointer  b)
-{
-    return ((const struct file_info*)b)->time
-        -((const struct file_info*)a)->time;
-}
+/* The body caches, persistent and temporary, are shared by all the
+ * mailboxes and created when first needed. */
+static LibBalsaImapBodyCache *body_caches[2];
+G_LOCK_DEFINE_STATIC(body_caches);
 
-static void
-clean_dir(const char *dir_name, off_t cache_size)
+static LibBalsaImapBodyCache*
+get_body_cache(gboolean is_persistent)
 {
-    GDir* dir;
-    const gchar *entry;
-    GList *list, *lst;
-    off_t sz;
+    LibBalsaImapBodyCache *cache;
 
-    dir = g_dir_open(dir_name, 0U, NULL);	/* do not notify the user about errors */
-    if (!dir)
-        return;
+    G_LOCK(body_caches);
+    if ((cache = body_caches[is_persistent]) == NULL) {
+        gchar *dir = get_cache_dir(is_persistent);
 
-    list = NULL;
-    while ((entry = g_dir_read_name(dir)) != NULL) {
-        struct stat st;
-        struct file_info *fi;
-        gchar *fname = g_build_filename(dir_name, entry, NULL);
-
-        if(stat(fname, &st) == -1 || !S_ISREG(st.st_mode)) {
-	    g_free(fname);
-            continue;
-	}
-        fi = g_new(struct file_info,1);
-        fi->name = fname;
-        fi->size = st.st_size;
-        fi->time = st.st_atime;
-        list = g_list_prepend(list, fi);
-    }
-    g_dir_close(dir);
-
-    list = g_list_sort(list, cmp_by_time);
-    sz = 0;
-    for(lst = list; lst; lst = lst->next) {
-        struct file_info *fi = (struct file_info*)(lst->data);
-        sz += fi->size;
-        if(sz>cache_size) {
-            /* printf("removing %s\n", fi->name); */
-            unlink(fi->name);
-        }
-        g_free(fi->name);
-        g_free(fi);
+        cache = body_caches[is_persistent] =
+            libbalsa_imap_body_cache_new(dir, ImapCacheSize);
+        g_free(dir);
     }
-    g_list_free(list);
+    G_UNLOCK(body_caches);
+
+    return cache;
 }
 
-static gboolean
-clean_cache(LibBalsaMailbox* mailbox)
+static LibBalsaImapBodyCache*
+get_mailbox_body_cache(LibBalsaMailboxImap *mimap)
 {
-    LibBalsaServer *s= LIBBALSA_MAILBOX_REMOTE_GET_SERVER(mailbox);
-    gboolean is_persistent =
-        libbalsa_imap_server_has_persistent_cache(LIBBALSA_IMAP_SERVER(s));
-    gchar* dir;
+    LibBalsaMailboxRemote *remote = LIBBALSA_MAILBOX_REMOTE(mimap);
+    LibBalsaServer *server = libbalsa_mailbox_remote_get_server(remote);
 
-    dir = get_cache_dir(is_persistent);
-    clean_dir(dir, ImapCacheSize);
-    g_free(dir);
- 
-    return TRUE;
+    return get_body_cache(libbalsa_imap_server_has_persistent_cache
+                          (LIBBALSA_IMAP_SERVER(server)));
 }
 
 static struct ImapCacheManager*imap_cache_manager_new_from_file(const char *header_cache_path);
@@ -568,6 +545,8 @@ mi_reconnect(ImapMboxHandle *h)
     unsigned old_cnt = imap_mbox_handle_get_exists(h);
     unsigned old_next = imap_mbox_handle_get_uidnext(h);
 
+    if (icm != NULL && icm->modseq != 0)
+        imap_mbox_handle_set_qresync(h, icm->uidvalidity, icm->modseq);
     r = imap_mbox_handle_reconnect(h, NULL);
     if(r==IMAP_SUCCESS) icm_restore_from_cache(h, icm);
     imap_cache_manager_free(icm);
@@ -653,35 +632,7 @@ lbimap_update_flags(LibBalsaMessage *message, ImapMessage *imsg)
     libbalsa_message_set_flags(message, flags);
 }
 
-/* mi_get_imsg is a thin wrapper around imap_mbox_handle_get_msg().
-   We wrap around imap_mbox_handle_get_msg() in case the libimap data
-   was invalidated by eg. disconnect.
-*/
-struct collect_seq_data {
-    unsigned *msgno_arr;
-    unsigned cnt;
-    unsigned needed_msgno;
-    unsigned has_it;
-};
-
 static const unsigned MAX_CHUNK_LENGTH = 20; 
-static gboolean
-collect_seq_cb(GNode *node, gpointer data)
-{
-    /* We prefetch envelopes in chunks to save on RTTs.
-     * Try to get the messages both before and after the message. */
-    struct collect_seq_data *csd = (struct collect_seq_data*)data;
-    unsigned msgno = GPOINTER_TO_UINT(node->data);
-    if(msgno==0) /* root node */
-        return FALSE;
-    csd->msgno_arr[(csd->cnt++) % MAX_CHUNK_LENGTH] = msgno;
-    if(csd->has_it>0) csd->has_it++;
-    if(csd->needed_msgno == msgno)
-        csd->has_it = 1;
-    /* quit if we have enough messages and at least half of them are
-     * after message in question. */
-    return csd->cnt >= MAX_CHUNK_LENGTH && csd->has_it*2>MAX_CHUNK_LENGTH;
-}
 
 static int
 cmp_msgno(const void* a, const void *b)
@@ -689,31 +640,60 @@ cmp_msgno(const void* a, const void *b)
     return (*(unsigned*)a) - (*(unsigned*)b);
 }
 
+static guint
+mi_prefetch_walk(guint msgno, gint direction, guint count, guint *msgnos,
+                 gpointer data)
+{
+    return libbalsa_mailbox_view_neighbours(LIBBALSA_MAILBOX(data), msgno,
+                                            direction, count, msgnos);
+}
+
+static gboolean
+mi_prefetch_have(guint msgno, gpointer data)
+{
+    LibBalsaMailboxImap *mimap = LIBBALSA_MAILBOX_IMAP(data);
+    ImapMessage *imsg = imap_mbox_handle_get_msg(mimap->handle, msgno);
+
+    return imsg != NULL && imsg->envelope != NULL;
+}
+
+/* mi_get_imsg is a thin wrapper around imap_mbox_handle_get_msg().
+   We wrap around imap_mbox_handle_get_msg() in case the libimap data
+   was invalidated by eg. disconnect.
+*/
 static ImapMessage*
 mi_get_imsg(LibBalsaMailboxImap *mimap, unsigned msgno)
 {
     ImapMessage* imsg;
-    struct collect_seq_data csd;
+    GArray *msgnos;
     ImapResponse rc;
-    GNode *msg_tree;
 
     /* This test too weak: I can imagine unsolicited ENVELOPE
      * responses sent from server that wil create the ImapMessage
      * structure but message size or UID etc will not be available. */
     if( (imsg = imap_mbox_handle_get_msg(mimap->handle, msgno)) 
         != NULL && imsg->envelope) return imsg;
-    csd.needed_msgno = msgno;
-    csd.msgno_arr    = g_malloc(MAX_CHUNK_LENGTH*sizeof(csd.msgno_arr[0]));
-    csd.cnt          = 0;
-    csd.has_it       = 0;
-
-    msg_tree = libbalsa_mailbox_get_msg_tree(LIBBALSA_MAILBOX(mimap));
-    if (msg_tree != NULL) {
-        g_node_traverse(msg_tree,
-                        G_PRE_ORDER, G_TRAVERSE_ALL, -1, collect_seq_cb,
-                        &csd);
-        if(csd.cnt>MAX_CHUNK_LENGTH) csd.cnt = MAX_CHUNK_LENGTH;
-        qsort(csd.msgno_arr, csd.cnt, sizeof(csd.msgno_arr[0]), cmp_msgno);
+
+    if (libbalsa_mailbox_get_msg_tree(LIBBALSA_MAILBOX(mimap)) != NULL) {
+        /* We prefetch envelopes to save on RTTs: the rows the index
+         * shows, and more in the direction it is scrolled.  The
+         * prefetch state is shared by the threads reading the mailbox,
+         * so it is used under the mailbox lock. */
+        guint first, last;
+        gint direction;
+
+        libbalsa_lock_mailbox(LIBBALSA_MAILBOX(mimap));
+        if (mimap->prefetch == NULL)
+            mimap->prefetch =
+                libbalsa_imap_prefetch_new(mi_prefetch_walk,
+                                           mi_prefetch_have, mimap);
+        if (!libbalsa_mailbox_get_visible_range(LIBBALSA_MAILBOX(mimap),
+                                                &first, &last,
+                                                &direction))
+            first = last = 0;
+        msgnos = libbalsa_imap_prefetch_plan(mimap->prefetch, msgno,
+                                             first, last, direction);
+        libbalsa_unlock_mailbox(LIBBALSA_MAILBOX(mimap));
     } else {
         /* It may happen that we want to perform an automatic
            operation on a mailbox without view (like filtering on
@@ -722,19 +702,24 @@ mi_get_imsg(LibBalsaMailboxImap *mimap, unsigned msgno)
            LibBalsaMessage object are present, and these require that
            some basic information is fetched from the server.  */
         unsigned i, total_msgs = mimap->messages_info->len;
-        csd.cnt = msgno+MAX_CHUNK_LENGTH>total_msgs
+        unsigned cnt = msgno+MAX_CHUNK_LENGTH>total_msgs
             ? total_msgs-msgno+1 : MAX_CHUNK_LENGTH;
-        for(i=0; i<csd.cnt; i++) csd.msgno_arr[i] = msgno+i;
+
+        msgnos = g_array_sized_new(FALSE, FALSE, sizeof(guint), cnt);
+        for(i=0; i<cnt; i++) {
+            guint seqno = msgno + i;
+            g_array_append_val(msgnos, seqno);
+        }
     }
     II(rc,mimap->handle,
-       imap_mbox_handle_fetch_set(mimap->handle, csd.msgno_arr,
-                                  csd.cnt,
+       imap_mbox_handle_fetch_set(mimap->handle, (unsigned *) msgnos->data,
+                                  msgnos->len,
                                   IMFETCH_FLAGS |
                                   IMFETCH_UID |
                                   IMFETCH_ENV |
                                   IMFETCH_RFC822SIZE |
                                   IMFETCH_CONTENT_TYPE));
-    g_free(csd.msgno_arr);
+    g_array_free(msgnos, TRUE);
     if (rc != IMR_OK)
         return FALSE;
     return imap_mbox_handle_get_msg(mimap->handle, msgno);
@@ -845,10 +830,15 @@ imap_exists_idle(gpointer data)
                 }
                 libbalsa_mailbox_index_entry_clear(mailbox, i + 1);
             }
-            for(i=mimap->messages_info->len; i>cnt; i--) {
-                g_array_remove_index(mimap->messages_info, i-1);
-                g_ptr_array_remove_index(mimap->msgids, i-1);
-                libbalsa_mailbox_msgno_removed(mailbox, i);
+            {
+                GArray *msgnos = g_array_new(FALSE, FALSE, sizeof(guint));
+
+                for(i=cnt+1; i<=mimap->messages_info->len; i++)
+                    g_array_append_val(msgnos, i);
+                g_array_set_size(mimap->messages_info, cnt);
+                g_ptr_array_set_size(mimap->msgids, cnt);
+                libbalsa_mailbox_msgnos_removed(mailbox, msgnos);
+                g_array_free(msgnos, TRUE);
             }
         } 
 
@@ -879,58 +869,138 @@ imap_exists_cb(ImapMboxHandle *handle, LibBalsaMailboxImap *mimap)
     g_idle_add(imap_exists_idle, g_object_ref(mimap));
 }
 
+/* Record an expunge reported while a MOVE runs.  seqno counts the
+ * messages left after the earlier expunges; keep the msgno the message
+ * had before them. */
 static void
-imap_expunge_cb(ImapMboxHandle *handle, unsigned seqno,
-                LibBalsaMailboxImap *mimap)
+lbm_imap_expunged_add(LibBalsaMailboxImap *mimap, unsigned seqno)
 {
     ImapMessage *imsg;
+    guint msgno = seqno;
     guint i;
 
-    LibBalsaMailbox *mailbox = LIBBALSA_MAILBOX(mimap);
-    struct message_info *msg_info;
+    for (i = 0; i < mimap->expunged->len
+         && g_array_index(mimap->expunged, guint, i) <= msgno; i++)
+        msgno++;
+    g_array_insert_val(mimap->expunged, i, msgno);
 
-    libbalsa_lock_mailbox(mailbox);
+    if ((imsg = imap_mbox_handle_get_msg(mimap->handle, seqno)))
+        g_array_append_val(mimap->expunged_uids, imsg->uid);
+}
+
+/* Remove expunged messages, given by their msgnos in ascending order,
+ * from the view and then from our tables, in one pass. */
+static void
+lbm_imap_remove_msgnos(LibBalsaMailboxImap *mimap, GArray *msgnos)
+{
+    guint i, j, k;
+
+    if (msgnos->len == 0)
+        return;
 
-    libbalsa_mailbox_msgno_removed(mailbox, seqno);
     ++mimap->search_stamp;
     mimap->sort_field = -1;	/* Invalidate. */
 
-    /* Use imap_mbox_handle_get_msg(mimap->handle, seqno)->uid, not
-     * IMAP_MESSAGE_UID(msg_info->message), as the latter may try to
-     * fetch the message from the server. */
-    if ((imsg = imap_mbox_handle_get_msg(mimap->handle, seqno))) {
-	gchar **pair = get_cache_name_pair(mimap, "body", imsg->uid);
-        gchar *fn = g_build_filename(pair[0], pair[1], NULL);
-        unlink(fn); /* ignore error; perhaps the message 
-                     * was not in the cache.  */
-        g_free(fn);
-        g_strfreev(pair);
-    }
-
-    msg_info = message_info_from_msgno(mimap, seqno);
-    if (msg_info) {
-        if (msg_info->message)
-            g_object_unref(msg_info->message);
-        g_array_remove_index(mimap->messages_info, seqno-1);
+    libbalsa_mailbox_msgnos_removed(LIBBALSA_MAILBOX(mimap), msgnos);
+
+    for (i = j = k = 0; i < mimap->messages_info->len; i++) {
+        struct message_info *info =
+            &g_array_index(mimap->messages_info, struct message_info, i);
+
+        if (k < msgnos->len && g_array_index(msgnos, guint, k) == i + 1) {
+            if (info->message != NULL)
+                g_object_unref(info->message);
+            k++;
+            continue;
+        }
+        if (j < i) {
+            g_array_index(mimap->messages_info, struct message_info, j) =
+                *info;
+            if (info->message != NULL)
+                libbalsa_message_set_msgno(info->message, j + 1);
+        }
+        j++;
     }
+    g_array_set_size(mimap->messages_info, j);
 
-    if (seqno <= mimap->msgids->len) {
-        gchar *msgid;
+    for (i = j = k = 0; i < mimap->msgids->len; i++) {
+        gchar *msgid = g_ptr_array_index(mimap->msgids, i);
 
-        msgid = g_ptr_array_index(mimap->msgids, seqno - 1);
-        g_free(msgid);
-        g_ptr_array_remove_index(mimap->msgids, seqno - 1);
+        if (k < msgnos->len && g_array_index(msgnos, guint, k) == i + 1) {
+            g_free(msgid);
+            k++;
+            continue;
+        }
+        g_ptr_array_index(mimap->msgids, j++) = msgid;
     }
+    g_ptr_array_set_size(mimap->msgids, j);
+}
+
+/* Apply the expunges recorded while a MOVE ran. */
+static void
+lbm_imap_apply_expunged(LibBalsaMailboxImap *mimap)
+{
+    GArray *expunged = mimap->expunged;
+    GArray *uids = mimap->expunged_uids;
+    LibBalsaImapBodyCache *cache;
+    guint i;
 
-    for (i = seqno - 1; i < mimap->messages_info->len; i++) {
-	struct message_info *info =
-	    &g_array_index(mimap->messages_info, struct message_info, i);
+    mimap->expunged = NULL;
+    mimap->expunged_uids = NULL;
 
-        g_assert(info != NULL);
-        if (info->message != NULL)
-            libbalsa_message_set_msgno(info->message, i + 1);
+    cache = get_mailbox_body_cache(mimap);
+    for (i = 0; i < uids->len; i++) {
+        gchar *key =
+            get_cache_key(mimap, "body", g_array_index(uids, ImapUID, i));
+        libbalsa_imap_body_cache_remove(cache, key);
+        g_free(key);
+    }
+    g_array_free(uids, TRUE);
+
+    lbm_imap_remove_msgnos(mimap, expunged);
+    g_array_free(expunged, TRUE);
+}
+
+/* The handle reports the messages expunged by a run of EXPUNGE
+ * responses together, by their seqnos before the run. */
+static void
+imap_expunge_cb(ImapMboxHandle *handle, GArray *seqnos,
+                LibBalsaMailboxImap *mimap)
+{
+    LibBalsaMailbox *mailbox = LIBBALSA_MAILBOX(mimap);
+    LibBalsaImapBodyCache *cache;
+    guint i;
+
+    libbalsa_lock_mailbox(mailbox);
+
+    if (mimap->expunged != NULL) {
+        /* Highest first, so that each seqno counts the messages left
+         * after the earlier expunges. */
+        for (i = seqnos->len; i > 0; i--)
+            lbm_imap_expunged_add(mimap,
+                                  g_array_index(seqnos, unsigned, i - 1));
+        libbalsa_unlock_mailbox(mailbox);
+        return;
+    }
+
+    /* Use imap_mbox_handle_get_msg(mimap->handle, seqno)->uid, not
+     * IMAP_MESSAGE_UID(msg_info->message), as the latter may try to
+     * fetch the message from the server. */
+    cache = get_mailbox_body_cache(mimap);
+    for (i = 0; i < seqnos->len; i++) {
+        ImapMessage *imsg =
+            imap_mbox_handle_get_msg(handle,
+                                     g_array_index(seqnos, unsigned, i));
+
+        if (imsg != NULL) {
+            gchar *key = get_cache_key(mimap, "body", imsg->uid);
+            libbalsa_imap_body_cache_remove(cache, key);
+            g_free(key);
+        }
     }
 
+    lbm_imap_remove_msgnos(mimap, seqnos);
+
     libbalsa_unlock_mailbox(mailbox);
 }
 
@@ -973,6 +1043,11 @@ libbalsa_mailbox_imap_get_selected_handle(LibBalsaMailboxImap *mimap,
         if (!mimap->handle)
             return NULL;
     }
+    /* Let the server tell us what has changed since the cached state. */
+    if (mimap->icm != NULL && mimap->icm->modseq != 0)
+        imap_mbox_handle_set_qresync(mimap->handle,
+                                     mimap->icm->uidvalidity,
+                                     mimap->icm->modseq);
     II(rc,mimap->handle,
        imap_mbox_select(mimap->handle, mimap->path, &readonly));
     libbalsa_mailbox_set_readonly(LIBBALSA_MAILBOX(mimap), readonly);
@@ -1060,6 +1135,12 @@ libbalsa_mailbox_imap_open(LibBalsaMailbox * mailbox, GError **err)
 
     mimap = LIBBALSA_MAILBOX_IMAP(mailbox);
 
+    if (mimap->icm == NULL) { /* Try restoring from file... */
+	gchar *header_cache_path = get_header_cache_path(mimap);
+	mimap->icm = imap_cache_manager_new_from_file(header_cache_path);
+	g_free(header_cache_path);
+    }
+
     mimap->handle = libbalsa_mailbox_imap_get_selected_handle(mimap, err);
     if (!mimap->handle) {
         mimap->opened       = FALSE;
@@ -1069,6 +1150,7 @@ libbalsa_mailbox_imap_open(LibBalsaMailbox * mailbox, GError **err)
 
     mimap->opened       = TRUE;
     mimap->disconnected = FALSE;
+    mimap->has_status   = FALSE;
     total_messages = imap_mbox_handle_get_exists(mimap->handle);
     mimap->messages_info = g_array_sized_new(FALSE, TRUE,
 					     sizeof(struct message_info),
@@ -1079,11 +1161,6 @@ libbalsa_mailbox_imap_open(LibBalsaMailbox * mailbox, GError **err)
 	g_array_append_val(mimap->messages_info, a);
 	g_ptr_array_add(mimap->msgids, NULL);
     }
-    if (mimap->icm == NULL) { /* Try restoring from file... */
-	gchar *header_cache_path = get_header_cache_path(mimap);
-	mimap->icm = imap_cache_manager_new_from_file(header_cache_path);
-	g_free(header_cache_path);
-    }
     if (mimap->icm != NULL) {
         icm_restore_from_cache(mimap->handle, mimap->icm);
         imap_cache_manager_free(mimap->icm);
@@ -1162,53 +1239,58 @@ libbalsa_mailbox_imap_close(LibBalsaMailbox * mailbox, gboolean expunge)
 	icm_save_to_file(mimap->icm, header_file);
 	g_free(header_file);
     }
-    clean_cache(mailbox);
+    libbalsa_imap_body_cache_sync(get_mailbox_body_cache(mimap));
 
 
     free_messages_info(mimap);
+    libbalsa_imap_prefetch_free(mimap->prefetch);
+    mimap->prefetch = NULL;
     libbalsa_mailbox_imap_release_handle(mimap);
     mimap->sort_field = -1;	/* Invalidate. */
 
     libbalsa_mailbox_set_view_filter(mailbox, NULL, FALSE);
 }
 
-static FILE*
+static GMimeStream*
 get_cache_stream(LibBalsaMailboxImap *mimap, guint uid, gboolean peek)
 {
-    FILE *stream;
-    gchar **pair, *path;
+    LibBalsaImapBodyCache *cache = get_mailbox_body_cache(mimap);
+    GMimeStream *stream;
+    gchar *key;
 
-    pair = get_cache_name_pair(mimap, "body", uid);
-    path = g_build_filename(pair[0], pair[1], NULL);
-    stream = fopen(path, "rb");
+    key = get_cache_key(mimap, "body", uid);
+    stream = libbalsa_imap_body_cache_lookup(cache, key);
     if(!stream) {
-        FILE *cache;
+        FILE *tmp;
 	ImapResponse rc;
 
-        g_mkdir_with_parents(pair[0], S_IRUSR|S_IWUSR|S_IXUSR);
 #if 0
         if(msg->length>(signed)SizeMsgThreshold)
             libbalsa_information(LIBBALSA_INFORMATION_MESSAGE, 
                                  _("Downloading %ld kB"),
                                  msg->length/1024);
 #endif
-        cache = fopen(path, "wb");
-        if(cache) {
-	    int ferr;
+        tmp = tmpfile();
+        if(tmp) {
             II(rc,mimap->handle,
                imap_mbox_handle_fetch_rfc822_uid(mimap->handle, uid, peek,
-						 cache));
-	    ferr = ferror(cache);
-            fclose(cache);
-	    if(ferr || rc != IMR_OK) {
-		printf("Error fetching RFC822 message, removing cache.\n");
-		unlink(path);
-	    }
+						 tmp));
+	    if(ferror(tmp) || rc != IMR_OK) {
+		printf("Error fetching RFC822 message, not caching it.\n");
+                fclose(tmp);
+            } else {
+                if(libbalsa_imap_body_cache_add_file(cache, key, tmp))
+                    stream = libbalsa_imap_body_cache_lookup(cache, key);
+                if(stream == NULL && fseek(tmp, 0, SEEK_SET) == 0) {
+                    /* Not cached: read the fetched copy; the stream
+                     * owns tmp from now on. */
+                    stream = g_mime_stream_file_new(tmp);
+                } else
+                    fclose(tmp);
+            }
         }
-	stream = fopen(path,"rb");
     }
-    g_free(path); 
-    g_strfreev(pair);
+    g_free(key);
     return stream;
 }
 
@@ -1221,7 +1303,7 @@ static GMimeStream *
 libbalsa_mailbox_imap_get_message_stream(LibBalsaMailbox * mailbox,
 					 guint msgno, gboolean peek)
 {
-    FILE *stream;
+    GMimeStream *stream;
     ImapMessage *imsg;
     LibBalsaMailboxImap *mimap;
 
@@ -1241,7 +1323,7 @@ libbalsa_mailbox_imap_get_message_stream(LibBalsaMailbox * mailbox,
 
     libbalsa_unlock_mailbox(mailbox);
 
-    return stream ? g_mime_stream_file_new(stream) : NULL;
+    return stream;
 }
 
 /* libbalsa_mailbox_imap_check:
@@ -1277,12 +1359,15 @@ lbm_imap_check(LibBalsaMailbox * mailbox)
 	return FALSE;
 
     if(libbalsa_imap_server_get_use_status(LIBBALSA_IMAP_SERVER(server))) {
-        static struct ImapStatusResult info[] = {
+        /* Not static: mailboxes are checked in several threads. */
+        struct ImapStatusResult info[] = {
             { IMSTAT_UNSEEN, 0 }, { IMSTAT_NONE, 0 } };
         /* cannot do status on an open mailbox */
         g_return_val_if_fail(!mimap->opened, FALSE);
-        if(imap_mbox_status(handle, mimap->path, info) != IMR_OK)
+        if(imap_mbox_status(handle, mimap->path, info) != IMR_OK) {
+            libbalsa_mailbox_imap_release_handle(mimap);
             return FALSE;
+        }
         libbalsa_mailbox_imap_release_handle(mimap);
         return info[0].result > 0;
     } else {
@@ -1305,17 +1390,54 @@ lbm_imap_check(LibBalsaMailbox * mailbox)
     }
 }
 
+/* How long a prefetched status may be used, in microseconds. */
+#define LBM_IMAP_STATUS_LIFETIME (30 * G_USEC_PER_SEC)
+
+/* Use the status libbalsa_imap_prefetch_status() took: a mailbox
+ * whose status has not changed since the last check, and whose flag
+ * still agrees with it, needs nothing. */
+static void
+lbm_imap_check_new_status(LibBalsaMailboxImap * mimap)
+{
+    LibBalsaMailbox *mailbox = LIBBALSA_MAILBOX(mimap);
+    gboolean has_unread = mimap->new_status.unseen > 0;
+
+    mimap->has_new_status = FALSE;
+    if (mimap->has_status
+        && memcmp(&mimap->status, &mimap->new_status,
+                  sizeof mimap->status) == 0
+        && !libbalsa_mailbox_get_has_unread_messages(mailbox) == !has_unread)
+        return;
+
+    mimap->status = mimap->new_status;
+    mimap->has_status = TRUE;
+    libbalsa_mailbox_set_unread_messages_flag(mailbox, has_unread);
+}
+
 static void
 libbalsa_mailbox_imap_check(LibBalsaMailbox * mailbox)
 {
+    LibBalsaMailboxImap *mimap;
+
     g_assert(LIBBALSA_IS_MAILBOX_IMAP(mailbox));
 
+    mimap = LIBBALSA_MAILBOX_IMAP(mailbox);
     if (!MAILBOX_OPEN(mailbox)) {
+        /* A status taken for a check that skipped the mailbox is not
+         * used later. */
+        if (mimap->has_new_status
+            && g_get_monotonic_time() - mimap->new_status_time
+            < LBM_IMAP_STATUS_LIFETIME) {
+            lbm_imap_check_new_status(mimap);
+            return;
+        }
+        mimap->has_status = FALSE;
         libbalsa_mailbox_set_unread_messages_flag(mailbox,
                                                   lbm_imap_check(mailbox));
 	return;
 
     }
+    mimap->has_new_status = FALSE;
 
     if (LIBBALSA_MAILBOX_IMAP(mailbox)->handle)
 	libbalsa_mailbox_imap_noop(LIBBALSA_MAILBOX_IMAP(mailbox));
@@ -1323,6 +1445,85 @@ libbalsa_mailbox_imap_check(LibBalsaMailbox * mailbox)
 	g_warning("mailbox has open_ref>0 but no handle!\n");
 }
 
+/* libbalsa_imap_prefetch_status:
+   asks the server for the status of all the closed mailboxes among
+   mailboxes at once, so that checking them takes no round trip of its
+   own.  A server without LIST-STATUS gets pipelined STATUS commands,
+   unless STATUS is not to be used with it at all.
+*/
+static void
+lbm_imap_prefetch_status_cb(ImapMboxHandle * handle, const char *mbox,
+                            const struct ImapStatusResult *res,
+                            gpointer data)
+{
+    GHashTable *found = data;
+    struct lbm_imap_status *status = g_new(struct lbm_imap_status, 1);
+
+    /* In the order of the items asked for. */
+    status->messages    = res[0].result;
+    status->unseen      = res[1].result;
+    status->uidnext     = res[2].result;
+    status->uidvalidity = res[3].result;
+    g_hash_table_replace(found, g_strdup(mbox), status);
+}
+
+void
+libbalsa_imap_prefetch_status(LibBalsaServer * server, GSList * mailboxes)
+{
+    static const ImapStatusItem items[] = {
+        IMSTAT_MESSAGES, IMSTAT_UNSEEN, IMSTAT_UIDNEXT, IMSTAT_UIDVALIDITY,
+        IMSTAT_NONE
+    };
+    LibBalsaImapServer *imap_server;
+    ImapMboxHandle *handle;
+    GPtrArray *paths;
+    GHashTable *found;
+    GSList *list;
+
+    g_return_if_fail(LIBBALSA_IS_IMAP_SERVER(server));
+
+    imap_server = LIBBALSA_IMAP_SERVER(server);
+    handle = libbalsa_imap_server_get_handle(imap_server, NULL);
+    if (!handle)
+        return;
+    if (!imap_mbox_handle_can_do(handle, IMCAP_LIST_STATUS)
+        && !libbalsa_imap_server_get_use_status(imap_server)) {
+        libbalsa_imap_server_release_handle(imap_server, handle);
+        return;
+    }
+
+    paths = g_ptr_array_new();
+    for (list = mailboxes; list != NULL; list = list->next) {
+        LibBalsaMailboxImap *mimap = LIBBALSA_MAILBOX_IMAP(list->data);
+
+        /* cannot do status on an open mailbox */
+        if (!MAILBOX_OPEN(list->data) && mimap->path != NULL)
+            g_ptr_array_add(paths, mimap->path);
+    }
+
+    found = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    imap_mbox_status_many(handle, paths->len, (const char **) paths->pdata,
+                          items, lbm_imap_prefetch_status_cb, found);
+    libbalsa_imap_server_release_handle(imap_server, handle);
+    g_ptr_array_free(paths, TRUE);
+
+    for (list = mailboxes; list != NULL; list = list->next) {
+        LibBalsaMailbox *mailbox = list->data;
+        LibBalsaMailboxImap *mimap = LIBBALSA_MAILBOX_IMAP(mailbox);
+        struct lbm_imap_status *status;
+
+        if (mimap->path == NULL
+            || (status = g_hash_table_lookup(found, mimap->path)) == NULL)
+            continue;
+        libbalsa_lock_mailbox(mailbox);
+        mimap->new_status = *status;
+        mimap->new_status_time = g_get_monotonic_time();
+        mimap->has_new_status = TRUE;
+        libbalsa_unlock_mailbox(mailbox);
+    }
+    g_hash_table_destroy(found);
+}
+
 /* Search iters */
 
 static ImapSearchKey *lbmi_build_imap_query(const LibBalsaCondition * cond,
@@ -2142,8 +2343,7 @@ get_struct_from_cache(LibBalsaMailbox *mailbox, LibBalsaMessage *message,
     LibBalsaMessageHeaders *headers;
 
     if ((mime_msg = libbalsa_message_get_mime_message(message)) == NULL) {
-        gchar **pair, *filename;
-        int fd;
+        gchar *key;
         GMimeStream *stream, *fstream;
         GMimeFilter *filter;
         GMimeParser *mime_parser;
@@ -2153,16 +2353,13 @@ get_struct_from_cache(LibBalsaMailbox *mailbox, LibBalsaMessage *message,
 	if (imsg == NULL)
 	    return FALSE;
 
-        pair = get_cache_name_pair(mimap, "body", imsg->uid);
-
-        filename = g_build_filename(pair[0], pair[1], NULL);
-        g_strfreev(pair);
-        fd = open(filename, O_RDONLY);
-        g_free(filename);
-        if (fd == -1)
+        key = get_cache_key(mimap, "body", imsg->uid);
+        stream = libbalsa_imap_body_cache_lookup(get_mailbox_body_cache(mimap),
+                                                 key);
+        g_free(key);
+        if (stream == NULL)
             return FALSE;
 
-        stream = g_mime_stream_fs_new(fd);
         fstream = g_mime_stream_filter_new(stream);
         g_object_unref(stream);
 
@@ -2417,10 +2614,10 @@ lbm_imap_get_msg_part_from_cache(LibBalsaMessage * message,
                                  GError **err)
 {
     GMimeStream *partstream = NULL;
-    gchar **pair, *part_name;
+    gchar *key, *part_key;
     LibBalsaMailbox *mailbox = libbalsa_message_get_mailbox(message);
     LibBalsaMailboxImap *mimap = LIBBALSA_MAILBOX_IMAP(mailbox);
-    FILE *fp;
+    LibBalsaImapBodyCache *cache = get_mailbox_body_cache(mimap);
     gchar *section;
     glong msgno = libbalsa_message_get_msgno(message);
     ImapMessage *imsg = mi_get_imsg(mimap, msgno);
@@ -2435,16 +2632,17 @@ lbm_imap_get_msg_part_from_cache(LibBalsaMessage * message,
 
    /* look for a part cache */
     section = get_section_for(message, part);
-    pair = get_cache_name_pair(mimap, "part", imsg->uid);
-    part_name   = g_strconcat(pair[0], G_DIR_SEPARATOR_S,
-                              pair[1], "-", section, NULL);
-    fp = fopen(part_name,"rb+");
+    key = get_cache_key(mimap, "part", imsg->uid);
+    part_key = g_strconcat(key, "-", section, NULL);
+    g_free(key);
+    partstream = libbalsa_imap_body_cache_lookup(cache, part_key);
     
-    if(!fp) { /* no cache element */
+    if(!partstream) { /* no cache element */
         struct part_data dt;
         ImapFetchBodyOptions ifbo;
         ImapResponse rc;
         LibBalsaMessageBody *parent;
+        GByteArray *data;
 
         libbalsa_lock_mailbox(mailbox);
         mimap = LIBBALSA_MAILBOX_IMAP(mailbox);
@@ -2456,7 +2654,7 @@ lbm_imap_get_msg_part_from_cache(LibBalsaMessage * message,
                message. This can be simulated by randomly
                disconnecting from the IMAP server. */
             fprintf(stderr, "Cannot find data for section %s\n", section);
-            g_strfreev(pair);
+            g_free(part_key);
             return FALSE;
         }
         dt.block = g_malloc(dt.body->octets+1);
@@ -2495,51 +2693,33 @@ lbm_imap_get_msg_part_from_cache(LibBalsaMessage * message,
                         imap_mbox_handle_get_last_msg(mimap->handle));
             g_free(dt.block);
             g_free(section);
-            g_free(part_name);
-            g_strfreev(pair);
-            return FALSE;
-        }
-        g_mkdir_with_parents(pair[0], S_IRUSR|S_IWUSR|S_IXUSR);
-        fp = fopen(part_name, "wb+");
-        if(!fp) {
-            g_set_error(err,
-                        LIBBALSA_MAILBOX_ERROR, LIBBALSA_MAILBOX_ACCESS_ERROR,
-                        _("Cannot create temporary file"));
-            g_free(dt.block);
-            g_free(section);
-            g_free(part_name);
-            g_strfreev(pair);
+            g_free(part_key);
             return FALSE;
         }
+        data = g_byte_array_new();
         if(ifbo == IMFB_NONE || dt.body->octets == 0) {
-            fprintf(fp,"MIME-version: 1.0\r\ncontent-type: %s\r\n"
-                    "Content-Transfer-Encoding: %s\r\n\r\n",
-                    part->content_type ? part->content_type : "text/plain",
-                    encoding_names(dt.body->encoding));
+            gchar *headers =
+                g_strdup_printf("MIME-version: 1.0\r\ncontent-type: %s\r\n"
+                                "Content-Transfer-Encoding: %s\r\n\r\n",
+                                part->content_type ?
+                                part->content_type : "text/plain",
+                                encoding_names(dt.body->encoding));
+            g_byte_array_append(data, (guint8 *) headers, strlen(headers));
+            g_free(headers);
         }
         /* Carefully save number of bytes actually read from the file. */
-	if (dt.pos) {
-            if(fwrite(dt.block, 1, dt.pos, fp) != dt.pos
-               || fflush(fp) != 0) {
-            fclose(fp);
-            /* we do not want to have an incomplete part in the cache
-               so that the user still can try again later when the
-               problem with writing (disk space?) is removed */
-            unlink(part_name);
-            g_set_error(err,
-                        LIBBALSA_MAILBOX_ERROR, LIBBALSA_MAILBOX_ACCESS_ERROR,
-                        _("Cannot write to temporary file %s"), part_name);
-            g_free(dt.block);
-            g_free(section);
-            g_free(part_name);
-            g_strfreev(pair);
-            return FALSE; /* something better ? */
-            }
-        }
+        g_byte_array_append(data, (guint8 *) dt.block, dt.pos);
         g_free(dt.block);
-	fseek(fp, 0, SEEK_SET);
+
+        if (libbalsa_imap_body_cache_add(cache, part_key, data->data,
+                                         data->len))
+            partstream = libbalsa_imap_body_cache_lookup(cache, part_key);
+        /* If the part could not be cached, we still have it. */
+        if (partstream == NULL)
+            partstream = g_mime_stream_mem_new_with_byte_array(data);
+        else
+            g_byte_array_free(data, TRUE);
     }
-    partstream = g_mime_stream_file_new (fp);
 
     {
         GMimeParser *parser =  
@@ -2550,8 +2730,7 @@ lbm_imap_get_msg_part_from_cache(LibBalsaMessage * message,
     }
     g_object_unref (partstream);
     g_free(section);
-    g_free(part_name);
-    g_strfreev(pair);
+    g_free(part_key);
 
     return TRUE;
 }
@@ -2889,42 +3068,12 @@ multi_append_cb(char * buf, size_t buflen,
 }
 
 struct append_to_cache_data {
-    const gchar *user, *host, *path, *cache_dir;
+    const gchar *user, *host, *path;
+    LibBalsaImapBodyCache *cache;
     GList *curr_name;
     unsigned uid_validity;
 };
 
-static void
-create_cache_copy(const gchar *src, const gchar *cache_dir, const gchar *name)
-{
-    gchar *fname = libbalsa_urlencode(name);
-    gchar *dst = g_build_filename(cache_dir, fname, NULL);
-    if(link(src, dst) != 0) {
-	/* Link failed possibly because the two caches reside on
-	   different file systems. We attempt to copy the cache instead. */
-	FILE *in  = fopen(src, "r");
-
-	if(in) {
-	    FILE *out = fopen(dst, "w");
-	    if(out) {
-	        size_t sz;
-	        char buf[65536];
-		gboolean err;
-		while( (sz=fread(buf, 1, sizeof(buf), in)) > 0)
-		    if(fwrite(buf, 1, sz, out) != sz)
-			break;
-		err = ferror(in) || ferror(out);
-		fclose(out);
-		if(err)
-		    unlink(dst);
-	    }
-	    fclose(in);
-	}
-    }
-    g_free(fname);
-    g_free(dst);
-}
-
 static void
 append_to_cache(unsigned uid, void *arg)
 {
@@ -2934,12 +3083,16 @@ append_to_cache(unsigned uid, void *arg)
 				  atcd->uid_validity,
 				  uid, "body");
     gchar *msg = atcd->curr_name->data;
+    FILE *in;
 
     atcd->curr_name = g_list_next(atcd->curr_name);
 
     g_return_if_fail(msg);
 
-    create_cache_copy(msg, atcd->cache_dir, name);
+    if ((in = fopen(msg, "rb")) != NULL) {
+        libbalsa_imap_body_cache_add_file(atcd->cache, name, in);
+        fclose(in);
+    }
     g_free(name);
 }
 
@@ -2980,18 +3133,16 @@ libbalsa_mailbox_imap_add_messages(LibBalsaMailbox * mailbox,
 	LibBalsaImapServer *imap_server = LIBBALSA_IMAP_SERVER(server);
 	gboolean is_persistent = libbalsa_imap_server_has_persistent_cache(imap_server);
 	struct append_to_cache_data atcd;
-	gchar *cache_dir;
 
 	atcd.user = libbalsa_server_get_user(server);
 	atcd.host = libbalsa_server_get_host(server);
 	atcd.path = mimap->path != NULL ? mimap->path : "INBOX";
-	atcd.cache_dir = cache_dir = get_cache_dir(is_persistent);
+	atcd.cache = get_body_cache(is_persistent);
 	atcd.curr_name = macd.outfiles;
 	atcd.uid_validity = uid_sequence.uid_validity;
 
 	imap_sequence_foreach(&uid_sequence, append_to_cache, &atcd);
 	imap_sequence_release(&uid_sequence);
-	g_free(cache_dir);
     }
 
     macd_destroy(&macd);
@@ -3287,6 +3438,39 @@ libbalsa_mailbox_imap_total_messages(LibBalsaMailbox * mailbox)
     return cnt;
 }
 
+/* Copy the cached bodies of the messages with the given uids to the
+ * cache keys of their copies in dest, which the server reported in
+ * uid_sequence. */
+static void
+lbm_imap_copy_cached_bodies(LibBalsaMailboxImap * mimap,
+                            LibBalsaMailboxImap * mimap_dest,
+                            const unsigned *uids, unsigned cnt,
+                            ImapSequence * uid_sequence)
+{
+    LibBalsaServer *server = LIBBALSA_MAILBOX_REMOTE_GET_SERVER(mimap);
+    LibBalsaImapBodyCache *cache = get_mailbox_body_cache(mimap);
+    unsigned im, nth;
+
+    for(im = 0; im<cnt; im++) {
+	if(uids[im] != 0 &&
+	   (nth = imap_sequence_nth(uid_sequence, im)) != 0) {
+	    gchar *src = get_cache_key(mimap, "body", uids[im]);
+	    gchar *dst =
+		g_strdup_printf("%s@%s-%s-%u-%u-%s",
+				libbalsa_server_get_user(server),
+				libbalsa_server_get_host(server),
+				(mimap_dest->path != NULL ?
+				 mimap_dest->path : "INBOX"),
+				uid_sequence->uid_validity,
+				nth, "body");
+
+	    libbalsa_imap_body_cache_copy(cache, src, dst);
+	    g_free(src);
+	    g_free(dst);
+	}
+    }
+}
+
 /* Copy messages in the list to dest; use server-side copy if mailbox
  * and dest are on the same server, fall back to parent method
  * otherwise.
@@ -3328,58 +3512,9 @@ libbalsa_mailbox_imap_messages_copy(LibBalsaMailbox * mailbox,
                         LIBBALSA_MAILBOX_COPY_ERROR,
                         "%s", msg);
             g_free(msg);
-        } else if(!imap_sequence_empty(&uid_sequence)) {
-	    /* Copy cache files. */
-	    GDir *dir;
-	    LibBalsaImapServer *imap_server = LIBBALSA_IMAP_SERVER(server);
-	    gboolean is_persistent =
-		libbalsa_imap_server_has_persistent_cache(imap_server);
-	    gchar *dir_name = get_cache_dir(is_persistent);
-	    gchar *src_prefix = g_strdup_printf("%s@%s-%s-%u-",
-						libbalsa_server_get_user(server),
-                                                libbalsa_server_get_host(server),
-						(mimap->path
-						 ? mimap->path : "INBOX"),
-						mimap->uid_validity);
-	    gchar *encoded_path = libbalsa_urlencode(src_prefix);
-	    g_free(src_prefix);
-	    dir = g_dir_open(dir_name, 0, NULL);
-	    if (dir != NULL) {
-		const gchar *filename;
-		size_t prefix_length = strlen(encoded_path);
-		unsigned nth;
-		while ((filename = g_dir_read_name(dir)) != NULL) {
-		    unsigned msg_uid;
-		    gchar *tail;
-		    if(strncmp(encoded_path, filename, prefix_length))
-			continue;
-		    msg_uid = strtol(filename + prefix_length, &tail, 10);
-		    for(im = 0; im<msgnos->len; im++) {
-			if(uids[im]>msg_uid) break;
-			else if(uids[im]==msg_uid &&
-				(nth = imap_sequence_nth(&uid_sequence, im))
-				 ) {
-			    gchar *src =
-				g_build_filename(dir_name, filename, NULL);
-			    gchar *dst_prefix =
-				g_strdup_printf("%s@%s-%s-%u-%u%s",
-						libbalsa_server_get_user(server),
-                                                libbalsa_server_get_host(server),
-						(mimap_dest->path != NULL ?
-						 mimap_dest->path : "INBOX"),
-						uid_sequence.uid_validity,
-						nth, tail);
-
-			    create_cache_copy(src, dir_name, dst_prefix);
-			    g_free(dst_prefix);
-			    break;
-			}
-		    }
-		}
-		g_dir_close(dir);
-	    }
-	    g_free(dir_name);
-	}
+        } else if(!imap_sequence_empty(&uid_sequence))
+	    lbm_imap_copy_cached_bodies(mimap, mimap_dest, uids,
+	                                msgnos->len, &uid_sequence);
 	g_free(uids);
 	imap_sequence_release(&uid_sequence);
         return ret;
@@ -3390,20 +3525,106 @@ libbalsa_mailbox_imap_messages_copy(LibBalsaMailbox * mailbox,
         messages_copy(mailbox, msgnos, dest, err);
 }
 
+/* Move messages in the list to dest; use the MOVE command (RFC 6851)
+ * if dest is on the same server and the server has it, fall back to
+ * copying and flagging the messages as deleted otherwise.  The server
+ * expunges the messages as part of the command; the expunges are
+ * applied together once it completes.
+ */
+static gboolean
+libbalsa_mailbox_imap_messages_move(LibBalsaMailbox * mailbox,
+				    GArray * msgnos,
+				    LibBalsaMailbox * dest, GError **err)
+{
+    LibBalsaMailboxImap *mimap = LIBBALSA_MAILBOX_IMAP(mailbox);
+    LibBalsaServer *server = LIBBALSA_MAILBOX_REMOTE_GET_SERVER(mimap);
+    ImapMboxHandle *handle = mimap->handle;
+
+    if (LIBBALSA_IS_MAILBOX_IMAP(dest)
+        && LIBBALSA_MAILBOX_REMOTE_GET_SERVER(dest) == server
+        && handle != NULL && imap_mbox_handle_can_do(handle, IMCAP_MOVE)) {
+        LibBalsaMailboxImap *mimap_dest = (LibBalsaMailboxImap *) dest;
+        gboolean ret;
+	ImapSequence uid_sequence;
+	unsigned *seqno = (unsigned*)msgnos->data, *uids;
+	unsigned im, cnt = msgnos->len;
+
+	imap_sequence_init(&uid_sequence);
+	g_array_sort(msgnos, cmp_msgno);
+	uids = g_new(unsigned, cnt);
+	for(im=0; im<cnt; im++) {
+	    ImapMessage * imsg = imap_mbox_handle_get_msg(handle, seqno[im]);
+	    uids[im] = imsg ? imsg->uid : 0;
+	}
+
+	mimap->expunged = g_array_new(FALSE, FALSE, sizeof(guint));
+	mimap->expunged_uids = g_array_new(FALSE, FALSE, sizeof(ImapUID));
+	ret = imap_mbox_handle_move(handle, cnt, seqno, mimap_dest->path,
+				    &uid_sequence)
+	    == IMR_OK;
+        if(!ret) {
+            gchar *msg = imap_mbox_handle_get_last_msg(handle);
+            g_set_error(err, LIBBALSA_MAILBOX_ERROR,
+                        LIBBALSA_MAILBOX_COPY_ERROR,
+                        "%s", msg);
+            g_free(msg);
+        } else if(!imap_sequence_empty(&uid_sequence))
+	    /* Before the expunges drop the source entries. */
+	    lbm_imap_copy_cached_bodies(mimap, mimap_dest, uids, cnt,
+	                                &uid_sequence);
+	/* msgnos may shrink here, if it is registered with the
+	 * mailbox. */
+	lbm_imap_apply_expunged(mimap);
+	g_free(uids);
+	imap_sequence_release(&uid_sequence);
+	if (ret)
+	    libbalsa_mailbox_changed(mailbox);
+        return ret;
+    }
+
+    return LIBBALSA_MAILBOX_CLASS(libbalsa_mailbox_imap_parent_class)->
+        messages_move(mailbox, msgnos, dest, err);
+}
+
 void
 libbalsa_imap_set_cache_size(off_t cache_size)
 {
+    guint i;
+
+    G_LOCK(body_caches);
     ImapCacheSize = cache_size;
+    for (i = 0; i < G_N_ELEMENTS(body_caches); i++)
+        if (body_caches[i] != NULL)
+            libbalsa_imap_body_cache_set_max_size(body_caches[i],
+                                                  cache_size);
+    G_UNLOCK(body_caches);
 }
 
-/** Purges the temporary directory used for non-persistent message
+/** Purges the temporary cache used for non-persistent message
    caching. */
 void
 libbalsa_imap_purge_temp_dir(off_t cache_size)
 {
-    gchar *dir_name = get_cache_dir(FALSE);
-    clean_dir(dir_name, cache_size);
-    g_free(dir_name);
+    LibBalsaImapBodyCache *cache = get_body_cache(FALSE);
+
+    libbalsa_imap_body_cache_trim(cache, cache_size);
+    libbalsa_imap_body_cache_sync(cache);
+}
+
+/** Syncs and frees the body caches; called at shutdown, when no
+   mailbox is open any more. */
+void
+libbalsa_imap_free_body_caches(void)
+{
+    guint i;
+
+    G_LOCK(body_caches);
+    for (i = 0; i < G_N_ELEMENTS(body_caches); i++)
+        if (body_caches[i] != NULL) {
+            libbalsa_imap_body_cache_free(body_caches[i]);
+            body_caches[i] = NULL;
+        }
+    G_UNLOCK(body_caches);
 }
 
 /* ===================================================================
@@ -3432,6 +3653,9 @@ libbalsa_imap_purge_temp_dir(off_t cache_size)
      Current implementation stores the information in memory but an
      implementation storing data on disk is possible, too.
 
+   With servers that support QRESYNC (RFC 7162), the cache also keeps
+   the HIGHESTMODSEQ of the mailbox, so that SELECT reports only the
+   messages changed or expunged since the cache was stored.
  */
 struct ImapCacheManager {
     GHashTable *headers;
@@ -3439,8 +3663,13 @@ struct ImapCacheManager {
     uint32_t    uidvalidity;
     uint32_t    uidnext;
     uint32_t    exists;
+    guint64     modseq;
 };
 
+/* HIGHESTMODSEQ is saved after the messages, as a record with this
+   UID, which no server hands out in practice. */
+#define ICM_MODSEQ_UID G_MAXUINT32
+
 static struct ImapCacheManager*
 imap_cache_manager_new(guint cnt)
 {
@@ -3487,9 +3716,16 @@ imap_cache_manager_new_from_file(const char *header_cache_path)
 	    gchar *s;
 	    if(fread(&slen, sizeof(slen), 1, f) != 1)
 		break;
+            if(uid == ICM_MODSEQ_UID && slen == sizeof(guint64)) {
+                if(fread(&icm->modseq, sizeof(guint64), 1, f) != 1)
+                    icm->modseq = 0;
+                break;
+            }
 	    s = g_malloc(slen+1); /* slen would be sufficient? */
-	    if(fread(s, 1, slen, f) != slen)
+	    if(fread(s, 1, slen, f) != slen) {
+                g_free(s);
                 break;
+            }
 	    s[slen] = '\0'; /* Unneeded? */
 	    g_hash_table_insert(icm->headers, GUINT_TO_POINTER(uid), s);
 	}
@@ -3523,11 +3759,52 @@ set_uid(ImapMboxHandle *handle, unsigned seqno, void *arg)
     g_array_append_val(a, seqno);
 }
 
+/* QRESYNC told us which of the cached messages have been expunged:
+ * the others keep their order, and any new messages follow them.
+ * Returns NULL if the map cannot be built that way, because the UIDs
+ * of some cached messages were never known. */
+static GArray*
+icm_apply_vanished(struct ImapCacheManager *icm, const GArray *vanished,
+                   unsigned exists, unsigned uidnext)
+{
+    GArray *uidmap = g_array_sized_new(FALSE, TRUE,
+                                       sizeof(uint32_t), icm->exists);
+    unsigned i, r = 0;
+
+    for(i=0; i<icm->exists && i<icm->uidmap->len; i++) {
+        uint32_t uid = g_array_index(icm->uidmap, uint32_t, i);
+
+        if(uid == 0) {
+            g_array_free(uidmap, TRUE);
+            return NULL;
+        }
+        /* Both the map and the ranges are in ascending order. */
+        while(r<vanished->len &&
+              g_array_index(vanished, ImapUidRange, r).hi < uid)
+            r++;
+        if(r<vanished->len &&
+           g_array_index(vanished, ImapUidRange, r).lo <= uid)
+            continue;
+        g_array_append_val(uidmap, uid);
+    }
+
+    /* New messages get UIDs from the old UIDNEXT on. */
+    if(i<icm->exists || uidmap->len>exists ||
+       exists - uidmap->len > uidnext - icm->uidnext) {
+        g_array_free(uidmap, TRUE);
+        return NULL;
+    }
+
+    return uidmap;
+}
+
 static void
 icm_restore_from_cache(ImapMboxHandle *h, struct ImapCacheManager *icm)
 {
     unsigned exists, uidvalidity, uidnext;
     unsigned i;
+    const GArray *vanished;
+    GArray *uidmap;
 
     if(!icm || ! h)
         return;
@@ -3540,6 +3817,15 @@ icm_restore_from_cache(ImapMboxHandle *h, struct ImapCacheManager *icm)
         return;
     }
 
+    /* With QRESYNC, the server has sent the flags that changed and the
+     * UIDs of the expunged messages, so neither has to be asked for. */
+    vanished = imap_mbox_handle_get_vanished(h);
+    if(vanished != NULL &&
+       (uidmap = icm_apply_vanished(icm, vanished, exists, uidnext))
+       != NULL) {
+        g_array_free(icm->uidmap, TRUE); icm->uidmap = uidmap;
+        icm->exists = uidmap->len;
+    } else
     /* There were some modifications to the mailbox but the situation
      * is not hopeless, we just need to get the seqnos of messages in
      * the cache. */
@@ -3574,12 +3860,12 @@ icm_restore_from_cache(ImapMboxHandle *h, struct ImapCacheManager *icm)
     /* One way or another, we have a valid uid->seqno map now;
      * The mailbox data can be resynced easily. */
 
-    for(i=1; i<=icm->exists; i++) {
+    for(i=1; i<=icm->exists && i<=icm->uidmap->len; i++) {
         uint32_t uid = g_array_index(icm->uidmap, uint32_t, i-1);
         void *data = g_hash_table_lookup(icm->headers,
                                          GUINT_TO_POINTER(uid));
         if(data) /* if uid known */
-            imap_mbox_handle_msg_deserialize(h, i, data);
+            imap_mbox_handle_msg_deserialize(h, i, data, vanished != NULL);
     }
 }
 
@@ -3599,6 +3885,7 @@ icm_store_cached_data(ImapMboxHandle *handle)
     icm = imap_cache_manager_new(cnt);
     icm->uidvalidity = imap_mbox_handle_get_validity(handle);
     icm->uidnext     = imap_mbox_handle_get_uidnext(handle);
+    icm->modseq      = imap_mbox_handle_get_highestmodseq(handle);
 
     for(i=0; i<cnt; i++) {
         void *ptr;
@@ -3652,6 +3939,14 @@ icm_save_to_file(struct ImapCacheManager *icm, const gchar *file_name)
                     break;
                 }
             }
+            if(success && icm->modseq != 0) {
+                uint32_t uid = ICM_MODSEQ_UID;
+                uint32_t slen = sizeof(guint64);
+                if(fwrite(&uid, sizeof(uid), 1, f) != 1 ||
+                   fwrite(&slen, sizeof(slen), 1, f) != 1 ||
+                   fwrite(&icm->modseq, sizeof(guint64), 1, f) != 1)
+                    success = FALSE;
+            }
         }
 	fclose(f);
     }
@@ -44,6 +44,8 @@ GHashTable * libbalsa_mailbox_imap_get_matchings(LibBalsaMailboxImap* mbox,
 						 gboolean * err);
 
 void libbalsa_mailbox_imap_noop(LibBalsaMailboxImap* mbox);
+void libbalsa_imap_prefetch_status(LibBalsaServer * server,
+                                   GSList * mailboxes);
 
 void libbalsa_mailbox_imap_force_disconnect(LibBalsaMailboxImap* mimap);
 gboolean libbalsa_mailbox_imap_is_connected(LibBalsaMailboxImap* mimap);
@@ -72,4 +74,5 @@ gchar *libbalsa_imap_url(LibBalsaServer * server, const gchar * path);
 
 void libbalsa_imap_set_cache_size(off_t cache_size);
 void libbalsa_imap_purge_temp_dir(off_t cache_size);
+void libbalsa_imap_free_body_caches(void);
 #endif				/* __LIBBALSA_MAILBOX_IMAP_H__ */
@@ -24,6 +24,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
@@ -34,8 +35,12 @@
 #include "filter-funcs.h"
 #include "mailbox-filter.h"
 #include "misc.h"
+#include <gmime/gmime-stream-mmap.h>
 #include <glib/gi18n.h>
 
+typedef struct _ThreadingInfo ThreadingInfo;
+typedef struct _ThreadingSubject ThreadingSubject;
+
 typedef struct _LibBalsaMailboxLocalPrivate LibBalsaMailboxLocalPrivate;
 struct _LibBalsaMailboxLocalPrivate {
     guint sync_id;  /* id of the idle mailbox sync job  */
@@ -48,6 +53,8 @@ struct _LibBalsaMailboxLocalPrivate {
     guint load_messages_id; /* id of the idle load-messages job */
     guint set_threading_id; /* id of the idle set-threading job */
     GPtrArray *threading_info;
+    ThreadingInfo *threading; /* kept while the mailbox is open and
+                               * threaded, see lbml_thread_messages */
     LibBalsaMailboxLocalPool message_pool[LBML_POOL_SIZE];
     guint pool_seqno;
     gboolean messages_loaded;
@@ -185,9 +192,10 @@ libbalsa_mailbox_local_class_init(LibBalsaMailboxLocalClass * klass)
     libbalsa_mailbox_class->check =
         libbalsa_mailbox_local_check;
 
-    klass->check_files  = NULL;
-    klass->set_path     = NULL;
-    klass->remove_files = lbm_local_real_remove_files;
+    klass->check_files   = NULL;
+    klass->set_path      = NULL;
+    klass->remove_files  = lbm_local_real_remove_files;
+    klass->load_envelope = NULL;
 }
 
 static void
@@ -313,6 +321,7 @@ lbm_local_get_message_with_msg_info(LibBalsaMailboxLocal * local,
                                     msg_info)
 {
     LibBalsaMessage *message;
+    LibBalsaMailboxLocalClass *klass;
 
     msg_info->message = message = libbalsa_message_new();
     g_object_add_weak_pointer(G_OBJECT(message),
@@ -321,7 +330,11 @@ lbm_local_get_message_with_msg_info(LibBalsaMailboxLocal * local,
     libbalsa_message_set_flags(message, msg_info->flags & LIBBALSA_MESSAGE_FLAGS_REAL);
     libbalsa_message_set_mailbox(message, LIBBALSA_MAILBOX(local));
     libbalsa_message_set_msgno(message, msgno);
-    libbalsa_message_load_envelope(message);
+
+    klass = LIBBALSA_MAILBOX_LOCAL_GET_CLASS(local);
+    if (klass->load_envelope == NULL
+        || !klass->load_envelope(local, msgno, message))
+        libbalsa_message_load_envelope(message);
     lbm_local_cache_message(local, msgno, message);
     lbml_message_pool_take_message(local, message);
 }
@@ -375,8 +388,20 @@ typedef struct {
     gchar *message_id;
     GList *refs_for_threading;
     gchar *sender;
+    gchar *subject;
+    guint msgno;                /* kept up to date as messages go */
+    GNode *container;           /* in the threading id tree, or NULL */
+    ThreadingSubject *gathered; /* the root messages with the same
+                                 * subject, or NULL */
+    guint placed;               /* the threading pass that placed it */
 } LibBalsaMailboxLocalInfo;
 
+static void lbml_threading_add(LibBalsaMailboxLocal * local,
+                               LibBalsaMailboxLocalInfo * info);
+static void lbml_threading_remove(LibBalsaMailboxLocal * local,
+                                  guint msgno);
+static void lbml_threading_free(LibBalsaMailboxLocal * local);
+
 static void
 lbm_local_free_info(LibBalsaMailboxLocalInfo * info)
 {
@@ -384,6 +409,7 @@ lbm_local_free_info(LibBalsaMailboxLocalInfo * info)
         g_free(info->message_id);
         g_list_free_full(info->refs_for_threading, g_free);
         g_free(info->sender);
+        g_free(info->subject);
         g_free(info);
     }
 }
@@ -770,6 +796,7 @@ libbalsa_mailbox_local_close_mailbox(LibBalsaMailbox * mailbox,
         priv->save_tree_id = 0;
     }
     lbm_local_save_tree(local);
+    lbml_threading_free(local);
 
     if (priv->threading_info) {
         guint msgno;
@@ -853,6 +880,7 @@ message_match_real(LibBalsaMailbox *mailbox, guint msgno,
 
     switch (cond->type) {
     case CONDITION_STRING:
+    case CONDITION_REGEX:
         if (CONDITION_CHKMATCH(cond, (CONDITION_MATCH_TO |
                                       CONDITION_MATCH_CC |
                                       CONDITION_MATCH_BODY))) {
@@ -880,22 +908,20 @@ message_match_real(LibBalsaMailbox *mailbox, guint msgno,
                 gchar *str =
                     internet_address_list_to_string(headers->to_list, NULL, FALSE);
                 match =
-                    libbalsa_utf8_strstr(str, cond->match.string.string);
+                    libbalsa_condition_match_string(cond, str);
                 g_free(str);
                 if (match)
                     break;
             }
 	}
         if (CONDITION_CHKMATCH(cond, CONDITION_MATCH_FROM)) {
-	    if (libbalsa_utf8_strstr(info->sender,
-                                     cond->match.string.string)) { 
+	    if (libbalsa_condition_match_string(cond, info->sender)) { 
                 match = TRUE;
                 break;
             }
         }
 	if (CONDITION_CHKMATCH(cond,CONDITION_MATCH_SUBJECT)) {
-	    if (libbalsa_utf8_strstr(entry->subject,
-                                     cond->match.string.string)) { 
+	    if (libbalsa_condition_match_string(cond, entry->subject)) { 
                 match = TRUE;
                 break;
             }
@@ -909,7 +935,7 @@ message_match_real(LibBalsaMailbox *mailbox, guint msgno,
                 gchar *str =
                     internet_address_list_to_string(headers->cc_list, NULL, FALSE);
                 match =
-                    libbalsa_utf8_strstr(str, cond->match.string.string);
+                    libbalsa_condition_match_string(cond, str);
                 g_free(str);
                 if (match)
                     break;
@@ -927,8 +953,7 @@ message_match_real(LibBalsaMailbox *mailbox, guint msgno,
                     libbalsa_message_get_user_header(message,
                                                      cond->match.string.
                                                      user_header);
-                if (libbalsa_utf8_strstr(header,
-                                         cond->match.string.string)) {
+                if (libbalsa_condition_match_string(cond, header)) {
                     match = TRUE;
                     break;
                 }
@@ -944,16 +969,15 @@ message_match_real(LibBalsaMailbox *mailbox, guint msgno,
             }
             body = content2reply(libbalsa_message_get_body_list(message),
                                  NULL, 0, FALSE, FALSE);
+            libbalsa_mailbox_search_index_add(mailbox, msgno, message,
+                                              body != NULL ? body->str : "");
 	    if (body) {
 		if (body->str)
-                    match = libbalsa_utf8_strstr(body->str,
-                                                 cond->match.string.string);
+                    match = libbalsa_condition_match_string(cond, body->str);
 		g_string_free(body,TRUE);
 	    }
 	}
 	break;
-    case CONDITION_REGEX:
-        break;
     case CONDITION_DATE:
         match = 
             entry->msg_date >= cond->match.date.date_low &&
@@ -1022,11 +1046,12 @@ lbm_local_cache_message(LibBalsaMailboxLocal * local,
     if (g_ptr_array_index(priv->threading_info, msgno - 1) != NULL)
         return FALSE;
 
-    info = g_new(LibBalsaMailboxLocalInfo, 1);
+    info = g_new0(LibBalsaMailboxLocalInfo, 1);
     info->message_id = g_strdup(libbalsa_message_get_message_id(message));
     info->refs_for_threading =
         libbalsa_message_refs_for_threading(message);
-    info->sender = NULL;
+    info->subject = g_strdup(LIBBALSA_MESSAGE_GET_SUBJECT(message));
+    info->msgno = msgno;
 
     headers = libbalsa_message_get_headers(message);
     if (headers->from != NULL)
@@ -1035,6 +1060,7 @@ lbm_local_cache_message(LibBalsaMailboxLocal * local,
         info->sender = g_strdup("");
 
     g_ptr_array_index(priv->threading_info, msgno - 1) = info;
+    lbml_threading_add(local, info);
 
     /* Rethread with the new info */
     if (priv->set_threading_id == 0) {
@@ -1055,6 +1081,10 @@ libbalsa_mailbox_local_cache_message(LibBalsaMailbox * mailbox,
         LIBBALSA_MAILBOX_CLASS(libbalsa_mailbox_local_parent_class)->
             cache_message(mailbox, msgno, message);
     }
+
+    /* Index the words of a message whose body has been loaded anyway. */
+    if (message != NULL && libbalsa_message_get_body_list(message) != NULL)
+        libbalsa_mailbox_search_index_add(mailbox, msgno, message, NULL);
 }
 
 static gboolean
@@ -1156,6 +1186,7 @@ lbml_set_threading(LibBalsaMailbox * mailbox,
         lbml_thread_messages(mailbox, FALSE);
         break;
     case LB_MAILBOX_THREADING_FLAT:
+        lbml_threading_free(LIBBALSA_MAILBOX_LOCAL(mailbox));
         lbml_threading_flat(mailbox);
         break;
     }
@@ -1265,11 +1296,25 @@ libbalsa_mailbox_local_msgno_removed(LibBalsaMailbox * mailbox,
     LibBalsaMailboxLocalPrivate *priv =
         libbalsa_mailbox_local_get_instance_private(local);
 
+    /* The threads must let go of the message while its info and its
+     * msgno are still valid. */
+    lbml_threading_remove(local, msgno);
+
     /* local might not have a threading-info array, and even if it does,
      * it might not be populated; we check both. */
     if (priv->threading_info != NULL &&
-        msgno > 0 && msgno <= priv->threading_info->len)
+        msgno > 0 && msgno <= priv->threading_info->len) {
+        guint i;
+
 	g_ptr_array_remove_index(priv->threading_info, msgno - 1);
+        for (i = msgno - 1; i < priv->threading_info->len; i++) {
+            LibBalsaMailboxLocalInfo *info =
+                g_ptr_array_index(priv->threading_info, i);
+
+            if (info != NULL)
+                info->msgno = i + 1;
+        }
+    }
 
     libbalsa_mailbox_msgno_removed(mailbox, msgno);
 }
@@ -1305,6 +1350,11 @@ lbm_local_update_view_filter(LibBalsaMailbox * mailbox,
     libbalsa_progress_set_text(&progress, NULL, 0);
     libbalsa_mailbox_search_iter_unref(iter_view);
 
+    /* Messages have come into and gone out of the view, which the
+     * threads do not follow; the rethreading that comes next starts
+     * over. */
+    lbml_threading_free(LIBBALSA_MAILBOX_LOCAL(mailbox));
+
     /* If this is not a flags-only filter, the new mailbox tree is
      * temporary, so we don't want to save it. */
     if (is_flag_only)
@@ -1451,153 +1501,458 @@ libbalsa_mailbox_local_get_msg_part(LibBalsaMessage *msg,
  * ymnk@jcraft.com
  */
 
+/*
+ * The threads are kept while the mailbox is open, rather than built
+ * again whenever a message comes or goes.  The id tree of the
+ * algorithm (the containers: GNodes under ti->root, whose data is the
+ * info of a message, or NULL for a message that we only know by
+ * reference) grows as the info of new messages is cached.
+ *
+ * The containers fall into sets: a message joins the set of every
+ * container that its Message-ID and References name, and only ever
+ * touches the containers of its own set, so the id tree of a set does
+ * not depend on the rest of the mailbox.  A message with a higher msgno
+ * than any threaded one is therefore just added to the tree, as if the
+ * whole mailbox had been threaded with it, and when a message goes
+ * away, the other messages of its set are threaded again on their own.
+ * Anything else--info for a message older than some threaded one,
+ * another threading type, another view filter--starts over.
+ *
+ * The tree is never pruned: the parent of a message is its nearest
+ * ancestor that is a message in the view, which is where pruning would
+ * put it.  The subject gather deals with the messages in the view that
+ * have no such parent.  Only the messages of the sets and subjects that
+ * changed are moved in the mailbox's msg_tree, and only if their parent
+ * changed.
+ */
+
+typedef struct {
+    GPtrArray *infos;
+    GPtrArray *nodes;
+} ThreadingSet;
+
 struct _ThreadingInfo {
     LibBalsaMailbox *mailbox;
+    gboolean subject_gather;
     GNode *root;
-    GHashTable *id_table;
-    GHashTable *subject_table;
-    gboolean missing_info;
+    GHashTable *id_table;       /* message-id -> container */
+    GHashTable *sets;           /* container -> ThreadingSet */
+    ThreadingSet *set;          /* of the message being threaded */
+    GHashTable *dirty_sets;
+    GHashTable *subject_table;  /* chopped subject -> ThreadingSubject */
+    GHashTable *dirty_subjects;
+    GPtrArray *pending;         /* infos cached since the last pass */
+    guint last_msgno;           /* no threaded message is higher */
+    guint threaded;             /* the number of threaded messages */
+    guint pass;
     gboolean missing_parent;
 };
-typedef struct _ThreadingInfo ThreadingInfo;
 
-static gboolean lbml_set_parent(GNode * node, ThreadingInfo * ti);
-static GNode *lbml_insert_node(GNode * node,
-                               LibBalsaMailboxLocalInfo * info,
+struct _ThreadingSubject {
+    gchar *subject;
+    GPtrArray *infos;           /* root messages with the subject */
+    LibBalsaMailboxLocalInfo *head;
+};
+
+static void lbml_insert(ThreadingInfo * ti,
+                        LibBalsaMailboxLocalInfo * info);
+static void lbml_set_parent(LibBalsaMailboxLocalInfo * info,
+                            ThreadingInfo * ti);
+static GNode *lbml_insert_node(LibBalsaMailboxLocalInfo * info,
                                ThreadingInfo * ti);
 static GNode *lbml_find_parent(LibBalsaMailboxLocalInfo * info,
 			       ThreadingInfo * ti);
-static gboolean lbml_prune(GNode * node, ThreadingInfo * ti);
-static void lbml_subject_gather(GNode * node, ThreadingInfo * ti);
-static void lbml_subject_merge(GNode * node, ThreadingInfo * ti);
-static const gchar *lbml_chop_re(const gchar * str);
-static gboolean lbml_construct(GNode * node, ThreadingInfo * ti);
-#ifdef MAKE_EMPTY_CONTAINER_FOR_MISSING_PARENT
-static void lbml_clear_empty(GNode * root);
-#endif				/* MAKE_EMPTY_CONTAINER_FOR_MISSING_PARENT */
+static void lbml_place_changed(ThreadingInfo * ti);
+
+static ThreadingSet *
+lbml_set_new(void)
+{
+    ThreadingSet *set = g_new(ThreadingSet, 1);
+
+    set->infos = g_ptr_array_new();
+    set->nodes = g_ptr_array_new();
+
+    return set;
+}
+
+static void
+lbml_set_free(ThreadingSet * set)
+{
+    g_ptr_array_free(set->infos, TRUE);
+    g_ptr_array_free(set->nodes, TRUE);
+    g_free(set);
+}
 
 static void
-lbml_info_setup(LibBalsaMailbox * mailbox, ThreadingInfo * ti)
+lbml_subject_free(ThreadingSubject * gathered)
 {
+    g_free(gathered->subject);
+    g_ptr_array_free(gathered->infos, TRUE);
+    g_free(gathered);
+}
+
+static ThreadingInfo *
+lbml_info_new(LibBalsaMailbox * mailbox, gboolean subject_gather)
+{
+    ThreadingInfo *ti = g_new0(ThreadingInfo, 1);
+
     ti->mailbox = mailbox;
-    ti->root = g_node_new(libbalsa_mailbox_get_msg_tree(mailbox));
+    ti->subject_gather = subject_gather;
+    ti->root = g_node_new(NULL);
     ti->id_table = g_hash_table_new(g_str_hash, g_str_equal);
-    ti->subject_table = NULL;
-    ti->missing_info = FALSE;
-    ti->missing_parent = FALSE;
+    ti->sets = g_hash_table_new(NULL, NULL);
+    ti->dirty_sets = g_hash_table_new(NULL, NULL);
+    ti->subject_table =
+        g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                              (GDestroyNotify) lbml_subject_free);
+    ti->dirty_subjects = g_hash_table_new(NULL, NULL);
+    ti->pending = g_ptr_array_new();
+
+    return ti;
 }
 
 static void
-lbml_info_free(ThreadingInfo * ti)
+lbml_threading_free(LibBalsaMailboxLocal * local)
 {
+    LibBalsaMailboxLocalPrivate *priv =
+        libbalsa_mailbox_local_get_instance_private(local);
+    ThreadingInfo *ti = priv->threading;
+    GHashTable *sets;
+    GHashTableIter iter;
+    gpointer set;
+    guint i;
+
+    if (ti == NULL)
+        return;
+    priv->threading = NULL;
+
+    /* The infos outlive the threads. */
+    for (i = 0; i < priv->threading_info->len; i++) {
+        LibBalsaMailboxLocalInfo *info =
+            g_ptr_array_index(priv->threading_info, i);
+
+        if (info != NULL) {
+            info->container = NULL;
+            info->gathered = NULL;
+            info->placed = 0;
+        }
+    }
+
+    /* A set is the value of each of its containers. */
+    sets = g_hash_table_new(NULL, NULL);
+    g_hash_table_iter_init(&iter, ti->sets);
+    while (g_hash_table_iter_next(&iter, NULL, &set))
+        g_hash_table_add(sets, set);
+    g_hash_table_iter_init(&iter, sets);
+    while (g_hash_table_iter_next(&iter, &set, NULL))
+        lbml_set_free(set);
+    g_hash_table_destroy(sets);
+
+    g_hash_table_destroy(ti->sets);
+    g_hash_table_destroy(ti->dirty_sets);
     g_hash_table_destroy(ti->id_table);
-    if (ti->subject_table)
-	g_hash_table_destroy(ti->subject_table);
+    g_hash_table_destroy(ti->subject_table);
+    g_hash_table_destroy(ti->dirty_subjects);
+    g_ptr_array_free(ti->pending, TRUE);
     g_node_destroy(ti->root);
+    g_free(ti);
+}
+
+static gint
+lbml_compare_msgnos(LibBalsaMailboxLocalInfo ** a,
+                    LibBalsaMailboxLocalInfo ** b)
+{
+    return (*a)->msgno < (*b)->msgno ? -1 : (*a)->msgno > (*b)->msgno;
 }
 
 static void
 lbml_thread_messages(LibBalsaMailbox * mailbox, gboolean subject_gather)
 {
     /* This implementation of JWZ's algorithm uses a second tree, rooted
-     * at ti.root, for the message IDs.  Each node in the second tree
+     * at ti->root, for the message IDs.  Each node in the second tree
      * that corresponds to a real message has a pointer to the
-     * corresponding msg_tree node in its data field.  Nodes in the
-     * mailbox's msg_tree have names beginning with msg_; all other
-     * GNodes are in the second tree.  The ti.id_table maps message-id
-     * to a node in the second tree. */
-    ThreadingInfo ti;
-
-    lbml_info_setup(mailbox, &ti);
-
-    /* Traverse the mailbox's msg_tree, to build the second tree. */
-    g_node_traverse(libbalsa_mailbox_get_msg_tree(mailbox),
-                    G_POST_ORDER, G_TRAVERSE_ALL, -1,
-		    (GNodeTraverseFunc) lbml_set_parent, &ti);
-    /* Prune the second tree. */
-    g_node_traverse(ti.root, G_POST_ORDER, G_TRAVERSE_ALL, -1,
-		    (GNodeTraverseFunc) lbml_prune, &ti);
+     * message's info in its data field.  Nodes in the mailbox's
+     * msg_tree have names beginning with msg_; all other GNodes are in
+     * the second tree.  The ti->id_table maps message-id to a node in
+     * the second tree. */
+    LibBalsaMailboxLocal *local = LIBBALSA_MAILBOX_LOCAL(mailbox);
+    LibBalsaMailboxLocalPrivate *priv =
+        libbalsa_mailbox_local_get_instance_private(local);
+    ThreadingInfo *ti = priv->threading;
+    guint i;
 
-    if (subject_gather) {
-        /* Do the evil subject gather and merge on the second tree. */
-        ti.subject_table = g_hash_table_new(g_str_hash, g_str_equal);
-        g_node_children_foreach(ti.root, G_TRAVERSE_ALL,
-                                (GNodeForeachFunc) lbml_subject_gather, &ti);
-        g_node_children_foreach(ti.root, G_TRAVERSE_ALL,
-                                (GNodeForeachFunc) lbml_subject_merge, &ti);
+    if (ti != NULL) {
+        g_ptr_array_sort(ti->pending, (GCompareFunc) lbml_compare_msgnos);
+        if (ti->subject_gather != subject_gather
+            || (ti->pending->len > 0
+                && ((LibBalsaMailboxLocalInfo *)
+                    g_ptr_array_index(ti->pending, 0))->msgno <=
+                ti->last_msgno)) {
+            lbml_threading_free(local);
+            ti = NULL;
+        }
     }
 
-    /* Traverse the second tree and reparent corresponding nodes in the
-     * mailbox's msg_tree. */
-    g_node_traverse(ti.root, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
-                    (GNodeTraverseFunc) lbml_construct, &ti);
+    if (ti == NULL) {
+        /* Thread every message we have the info for, in mailbox
+         * order. */
+        priv->threading = ti = lbml_info_new(mailbox, subject_gather);
+        for (i = 0; i < priv->threading_info->len; i++) {
+            LibBalsaMailboxLocalInfo *info =
+                g_ptr_array_index(priv->threading_info, i);
 
-#ifdef MAKE_EMPTY_CONTAINER_FOR_MISSING_PARENT
-    lbml_clear_empty(ti.root);
-#endif				/* MAKE_EMPTY_CONTAINER_FOR_MISSING_PARENT */
+            if (info != NULL)
+                lbml_insert(ti, info);
+        }
+    } else {
+        for (i = 0; i < ti->pending->len; i++)
+            lbml_insert(ti, g_ptr_array_index(ti->pending, i));
+    }
+    g_ptr_array_set_size(ti->pending, 0);
 
-    lbml_info_free(&ti);
+    /* Reparent the nodes in the mailbox's msg_tree whose threads
+     * changed. */
+    lbml_place_changed(ti);
 
-    if (ti.missing_parent && ti.missing_info) {
+    if (ti->missing_parent
+        && ti->threaded < libbalsa_mailbox_total_messages(mailbox)) {
         /* We need to completely rethread.
          * If any new info is found, a rethreading will be scheduled. */
+        ti->missing_parent = FALSE;
         libbalsa_mailbox_prepare_threading(mailbox, 0);
     }
+    ti->missing_parent = FALSE;
 }
 
-static LibBalsaMailboxLocalInfo *
-lbml_get_info(GNode * node, ThreadingInfo * ti)
+/* The info of a message cached while the mailbox is threaded is added
+ * to the threads in the next pass. */
+static void
+lbml_threading_add(LibBalsaMailboxLocal * local,
+                   LibBalsaMailboxLocalInfo * info)
 {
-    LibBalsaMailboxLocal *local = LIBBALSA_MAILBOX_LOCAL(ti->mailbox);
     LibBalsaMailboxLocalPrivate *priv =
         libbalsa_mailbox_local_get_instance_private(local);
-    guint msgno = GPOINTER_TO_UINT(node->data);
-    LibBalsaMailboxLocalInfo *info;
 
-    if (msgno == 0 || msgno > priv->threading_info->len)
-        return NULL;
+    if (priv->threading != NULL)
+        g_ptr_array_add(priv->threading->pending, info);
+}
 
-    info = g_ptr_array_index(priv->threading_info, msgno - 1);
+/*
+ * Sets of containers
+ */
+
+static GNode *
+lbml_new_node(ThreadingInfo * ti, LibBalsaMailboxLocalInfo * info)
+{
+    GNode *node = g_node_new(info);
+
+    g_ptr_array_add(ti->set->nodes, node);
+    g_hash_table_insert(ti->sets, node, ti->set);
+    if (info != NULL)
+        info->container = node;
+
+    return node;
+}
+
+static ThreadingSet *
+lbml_set_merge(ThreadingInfo * ti, ThreadingSet * set1,
+               ThreadingSet * set2)
+{
+    guint i;
+
+    if (set1->nodes->len < set2->nodes->len) {
+        ThreadingSet *tmp = set1;
+
+        set1 = set2;
+        set2 = tmp;
+    }
+
+    for (i = 0; i < set2->nodes->len; i++) {
+        GNode *node = g_ptr_array_index(set2->nodes, i);
+
+        g_ptr_array_add(set1->nodes, node);
+        g_hash_table_insert(ti->sets, node, set1);
+    }
+    for (i = 0; i < set2->infos->len; i++)
+        g_ptr_array_add(set1->infos, g_ptr_array_index(set2->infos, i));
+
+    if (g_hash_table_remove(ti->dirty_sets, set2))
+        g_hash_table_add(ti->dirty_sets, set1);
+    lbml_set_free(set2);
+
+    return set1;
+}
+
+/* The set of the container for id, merged with set. */
+static ThreadingSet *
+lbml_set_join(ThreadingInfo * ti, ThreadingSet * set, const gchar * id)
+{
+    GNode *node;
+    ThreadingSet *other;
 
-    return info;
+    if (id == NULL
+        || (node = g_hash_table_lookup(ti->id_table, id)) == NULL)
+        return set;
+
+    other = g_hash_table_lookup(ti->sets, node);
+    if (set == NULL || set == other)
+        return other;
+
+    return lbml_set_merge(ti, set, other);
 }
 
 static void
-lbml_unlink_and_prepend(GNode * node, GNode * parent)
+lbml_insert(ThreadingInfo * ti, LibBalsaMailboxLocalInfo * info)
 {
-    g_node_unlink(node);
-    g_node_prepend(parent, node);
+    ThreadingSet *set;
+    GList *reference;
+
+    set = lbml_set_join(ti, NULL, info->message_id);
+    for (reference = info->refs_for_threading; reference != NULL;
+         reference = reference->next)
+        set = lbml_set_join(ti, set, reference->data);
+    if (set == NULL)
+        set = lbml_set_new();
+
+    ti->set = set;
+    lbml_set_parent(info, ti);
+    ti->set = NULL;
+
+    g_ptr_array_add(set->infos, info);
+    g_hash_table_add(ti->dirty_sets, set);
+    ti->last_msgno = MAX(ti->last_msgno, info->msgno);
+    ++ti->threaded;
 }
 
+/* Drop from the id table the ids of info that lead into set. */
 static void
-lbml_move_children(GNode * node, GNode * parent)
+lbml_forget_ids(ThreadingInfo * ti, ThreadingSet * set,
+                LibBalsaMailboxLocalInfo * info)
 {
-    GNode *child;
+    GList *reference = info->refs_for_threading;
+    const gchar *id = info->message_id;
+
+    for (;;) {
+        GNode *node;
 
-    while ((child = node->children))
-	lbml_unlink_and_prepend(child, parent);
+        if (id != NULL
+            && (node = g_hash_table_lookup(ti->id_table, id)) != NULL
+            && g_hash_table_lookup(ti->sets, node) == set)
+            g_hash_table_remove(ti->id_table, id);
+
+        if (reference == NULL)
+            break;
+        id = reference->data;
+        reference = reference->next;
+    }
 }
 
-static gboolean
-lbml_set_parent(GNode * msg_node, ThreadingInfo * ti)
+/* Thread the messages of set again from scratch, in mailbox order,
+ * without gone, which has been taken out of set->infos; they may fall
+ * into several sets now. */
+static void
+lbml_set_rethread(ThreadingInfo * ti, ThreadingSet * set,
+                  LibBalsaMailboxLocalInfo * gone)
 {
-    LibBalsaMailboxLocalInfo *info;
-    GNode *node;
-    GNode *parent;
-    GNode *child;
+    GPtrArray *roots = g_ptr_array_new();
+    guint i;
 
-    if (!msg_node->parent)
-	return FALSE;
+    lbml_forget_ids(ti, set, gone);
+    gone->container = NULL;
+    for (i = 0; i < set->infos->len; i++) {
+        LibBalsaMailboxLocalInfo *info = g_ptr_array_index(set->infos, i);
+
+        lbml_forget_ids(ti, set, info);
+        info->container = NULL;
+    }
 
-    info = lbml_get_info(msg_node, ti);
+    /* The containers of the set are the whole subtrees of some
+     * children of the root. */
+    for (i = 0; i < set->nodes->len; i++) {
+        GNode *node = g_ptr_array_index(set->nodes, i);
 
-    if (info == NULL) {
-        /* We may not need the info; just note that it is missing. */
-        ti->missing_info = TRUE;
-	return FALSE;
+        g_hash_table_remove(ti->sets, node);
+        if (node->parent == ti->root)
+            g_ptr_array_add(roots, node);
+    }
+    for (i = 0; i < roots->len; i++)
+        g_node_destroy(g_ptr_array_index(roots, i));
+    g_ptr_array_free(roots, TRUE);
+    g_hash_table_remove(ti->dirty_sets, set);
+
+    ti->threaded -= set->infos->len;
+    g_ptr_array_sort(set->infos, (GCompareFunc) lbml_compare_msgnos);
+    for (i = 0; i < set->infos->len; i++)
+        lbml_insert(ti, g_ptr_array_index(set->infos, i));
+
+    lbml_set_free(set);
+}
+
+static void lbml_subject_remove(ThreadingInfo * ti,
+                                LibBalsaMailboxLocalInfo * info);
+
+/* Take message msgno out of the threads, before it goes. */
+static void
+lbml_threading_remove(LibBalsaMailboxLocal * local, guint msgno)
+{
+    LibBalsaMailboxLocalPrivate *priv =
+        libbalsa_mailbox_local_get_instance_private(local);
+    ThreadingInfo *ti = priv->threading;
+    LibBalsaMailboxLocalInfo *info = NULL;
+
+    if (ti == NULL)
+        return;
+
+    if (msgno > 0 && msgno <= priv->threading_info->len)
+        info = g_ptr_array_index(priv->threading_info, msgno - 1);
+
+    if (info != NULL && info->container != NULL) {
+        ThreadingSet *set = g_hash_table_lookup(ti->sets, info->container);
+
+        lbml_subject_remove(ti, info);
+        g_ptr_array_remove_fast(set->infos, info);
+        lbml_set_rethread(ti, set, info);
+        --ti->threaded;
+
+        if (priv->set_threading_id == 0) {
+            priv->set_threading_id =
+                g_idle_add((GSourceFunc) lbml_set_threading_idle_cb, local);
+        }
+    } else if (info != NULL) {
+        /* Not threaded yet. */
+        g_ptr_array_remove(ti->pending, info);
     }
 
-    node = lbml_insert_node(msg_node, info, ti);
+    if (ti->last_msgno >= msgno)
+        --ti->last_msgno;
+}
+
+/*
+ * Building the id tree
+ */
+
+static gboolean
+lbml_is_replied(LibBalsaMailboxLocalInfo * info, ThreadingInfo * ti)
+{
+    return libbalsa_mailbox_msgno_get_status(ti->mailbox, info->msgno)
+	== LIBBALSA_MESSAGE_STATUS_REPLIED;
+}
+
+static void
+lbml_unlink_and_prepend(GNode * node, GNode * parent)
+{
+    g_node_unlink(node);
+    g_node_prepend(parent, node);
+}
+
+static void
+lbml_set_parent(LibBalsaMailboxLocalInfo * info, ThreadingInfo * ti)
+{
+    GNode *node;
+    GNode *parent;
+    GNode *child;
+
+    node = lbml_insert_node(info, ti);
 
     /*
      * Set the parent of this message to be the last element in References.
@@ -1626,7 +1981,7 @@ lbml_set_parent(GNode * msg_node, ThreadingInfo * ti)
 	/* Nothing to do... */
 	|| node == parent)
 	/* This message listed itself as its parent! Oh well... */
-	return FALSE;
+	return;
 
     child = node->children;
     while (child) {
@@ -1644,8 +1999,6 @@ lbml_set_parent(GNode * msg_node, ThreadingInfo * ti)
     }
 
     lbml_unlink_and_prepend(node, parent);
-
-    return FALSE;
 }
 
 static GNode *
@@ -1678,7 +2031,7 @@ lbml_find_parent(LibBalsaMailboxLocalInfo * info, ThreadingInfo * ti)
 	if (foo != NULL) {
             has_real_parent = TRUE;
         } else {
-	    foo = g_node_new(NULL);
+	    foo = lbml_new_node(ti, NULL);
 	    g_hash_table_insert(id_table, id, foo);
 	}
 
@@ -1699,17 +2052,8 @@ lbml_find_parent(LibBalsaMailboxLocalInfo * info, ThreadingInfo * ti)
     return parent;
 }
 
-static gboolean
-lbml_is_replied(GNode * msg_node, ThreadingInfo * ti)
-{
-    guint msgno = GPOINTER_TO_UINT(msg_node->data);
-    return libbalsa_mailbox_msgno_get_status(ti->mailbox, msgno)
-	== LIBBALSA_MESSAGE_STATUS_REPLIED;
-}
-
 static GNode *
-lbml_insert_node(GNode * msg_node, LibBalsaMailboxLocalInfo * info,
-		 ThreadingInfo * ti)
+lbml_insert_node(LibBalsaMailboxLocalInfo * info, ThreadingInfo * ti)
 {
     /*
      * If id_table contains an *empty* Container for this ID:
@@ -1728,22 +2072,23 @@ lbml_insert_node(GNode * msg_node, LibBalsaMailboxLocalInfo * info,
 	node = g_hash_table_lookup(id_table, id);
 
     if (node) {
-	GNode *prev_msg_node = node->data;
+	LibBalsaMailboxLocalInfo *prev_info = node->data;
 	/* If this message has not been replied to, or if the container
 	 * is empty, store it in the container. If there was a message
 	 * in the container already, swap it with this one, otherwise
 	 * set the current one to NULL. */
-	if (!lbml_is_replied(msg_node, ti) || !prev_msg_node) {
-	    node->data = msg_node;
-	    msg_node = prev_msg_node;
+	if (!lbml_is_replied(info, ti) || !prev_info) {
+	    node->data = info;
+            info->container = node;
+	    info = prev_info;
 	}
     }
     /* If we already stored the message in a previously empty container,
-     * msg_node is NULL. If either the previous message or the current
-     * one has been replied to, msg_node now points to a replied-to
+     * info is NULL. If either the previous message or the current
+     * one has been replied to, info now points to a replied-to
      * message. */
-    if (msg_node)
-	node = g_node_new(msg_node);
+    if (info)
+	node = lbml_new_node(ti, info);
 
     if (id)
 	g_hash_table_insert(id_table, id, node);
@@ -1751,291 +2096,251 @@ lbml_insert_node(GNode * msg_node, LibBalsaMailboxLocalInfo * info,
     return node;
 }
 
-static gboolean
-lbml_prune(GNode * node, ThreadingInfo * ti)
+/*
+ * Placing the messages
+ */
+
+/* The node of a message in the mailbox's msg_tree, or NULL if it is
+ * not in the view. */
+static GNode *
+lbml_get_msg_node(ThreadingInfo * ti, LibBalsaMailboxLocalInfo * info)
 {
-    /*
-     * Recursively walk all containers under the root set. For each container: 
-     *
-     * + If it is an empty container with no children, nuke it. 
-     * + If the Container has no Message, but does have children, 
-     *   remove this container but promote its children to this level 
-     *  (that is, splice them in to the current child list.) 
-     *
-     * Do not promote the children if doing so would promote them to 
-     * the root set -- unless there is only one child, in which case, do. 
-     */
+    GtkTreeIter iter;
 
-    if (node->data != NULL || node == ti->root)
-	return FALSE;
+    return libbalsa_mailbox_msgno_find(ti->mailbox, info->msgno, NULL,
+                                       &iter) ? iter.user_data : NULL;
+}
+
+/* The info of a node in the mailbox's msg_tree, or NULL if it has not
+ * been threaded. */
+static LibBalsaMailboxLocalInfo *
+lbml_get_info(GNode * msg_node, ThreadingInfo * ti)
+{
+    LibBalsaMailboxLocal *local = LIBBALSA_MAILBOX_LOCAL(ti->mailbox);
+    LibBalsaMailboxLocalPrivate *priv =
+        libbalsa_mailbox_local_get_instance_private(local);
+    guint msgno = GPOINTER_TO_UINT(msg_node->data);
+    LibBalsaMailboxLocalInfo *info;
 
-#ifdef MAKE_EMPTY_CONTAINER_FOR_MISSING_PARENT
-    if (node->children != NULL
-	&& (node->parent != ti->root || node->children->next == NULL))
-	lbml_move_children(node, node->parent);
+    if (msgno == 0 || msgno > priv->threading_info->len)
+        return NULL;
 
-    if (node->children == NULL)
-	g_node_destroy(node);
-#else				/* MAKE_EMPTY_CONTAINER_FOR_MISSING_PARENT */
-    lbml_move_children(node, node->parent);
-    g_node_destroy(node);
-#endif				/* MAKE_EMPTY_CONTAINER_FOR_MISSING_PARENT */
+    info = g_ptr_array_index(priv->threading_info, msgno - 1);
 
-    return FALSE;
+    return info != NULL && info->container != NULL ? info : NULL;
+}
+
+/* The parent of a message in the pruned tree: its nearest ancestor
+ * that is a message in the view, or NULL. */
+static LibBalsaMailboxLocalInfo *
+lbml_get_parent(ThreadingInfo * ti, LibBalsaMailboxLocalInfo * info)
+{
+    GNode *node;
+
+    for (node = info->container->parent; node != ti->root;
+         node = node->parent) {
+        LibBalsaMailboxLocalInfo *parent = node->data;
+
+        if (parent != NULL && lbml_get_msg_node(ti, parent) != NULL)
+            return parent;
+    }
+
+    return NULL;
 }
 
-static const gchar *
-lbml_get_subject(GNode * node, ThreadingInfo * ti)
+static gboolean
+lbml_is_reply(LibBalsaMailboxLocalInfo * info)
 {
-    guint msgno = GPOINTER_TO_UINT(((GNode *) node->data)->data);
-    return libbalsa_mailbox_msgno_get_subject(ti->mailbox, msgno);
+    return libbalsa_subject_skip_re(info->subject) != info->subject;
 }
 
 static void
-lbml_subject_gather(GNode * node, ThreadingInfo * ti)
+lbml_subject_remove(ThreadingInfo * ti, LibBalsaMailboxLocalInfo * info)
 {
-    const gchar *subject = NULL, *old_subject;
-    const gchar *chopped_subject = NULL;
-    GNode *old;
-    GHashTable *subject_table = ti->subject_table;
+    if (info->gathered != NULL) {
+        g_ptr_array_remove_fast(info->gathered->infos, info);
+        g_hash_table_add(ti->dirty_subjects, info->gathered);
+        info->gathered = NULL;
+    }
+}
 
+static void
+lbml_subject_update(ThreadingInfo * ti, LibBalsaMailboxLocalInfo * info)
+{
     /*
      * If any two members of the root set have the same subject, merge them. 
      * This is so that messages which don't have References headers at all 
      * still get threaded (to the extent possible, at least.) 
      *
-     * + Construct a new hash table, subject_table, which associates subject 
-     *   strings with Container objects. 
-     *
-     * + For each Container in the root set: 
-     *
-     *   Find the subject of that sub-tree: 
-     *   + If there is a message in the Container, the subject is the subject of
-     *     that message. 
-     *   + If there is no message in the Container, then the Container will have
-     *     at least one child Container, and that Container will have a message.
-     *     Use the subject of that message instead. 
-     *   + Strip ``Re:'', ``RE:'', ``RE[5]:'', ``Re: Re[4]: Re:'' and so on. 
-     *   + If the subject is now "", give up on this 
-     *   + Add this Container to the subject_table if: Container. 
-     *     + There is no container in the table with this subject, or 
-     *     + This one is an empty container and the old one is not: the empty 
-     *       one is more interesting as a root, so put it in the table instead. 
-     *     + The container in the table has a ``Re:'' version of this subject,
-     *       and this container has a non-``Re:'' version of this subject.
-     *       The non-re version is the more interesting of the two. 
-     *
-     * + Now the subject_table is populated with one entry for each subject 
-     *   which occurs in the root set. Now iterate over the root set, 
-     *   and gather together the difference. 
-     * 
-     *   For each Container in the root set: 
-     * 
-     *   Find the subject of this Container (as above.) 
-     *   Look up the Container of that subject in the table. 
-     *   If it is null, or if it is this container, continue. 
-     *   Otherwise, we want to group together this Container and the one 
-     *   in the table. There are a few possibilities: 
-     *     + If both are dummies, prepend one's children to the other, and 
-     *       remove the now-empty container. 
-     * 
-     *     + If one container is a empty and the other is not, make the 
-     *       non-empty one be a child of the empty, and a sibling of the 
-     *       other ``real'' messages with the
-     *       same subject (the empty's children.) 
-     *     + If that container is a non-empty, and that message's subject 
-     *       does not begin with ``Re:'', but this message's subject does,
-     *       then make this be a child of the other. 
-     *     + If that container is a non-empty, and that message's subject 
-     *       begins with ``Re:'', but this message's subject does not, 
-     *       then make that be a child of this one -- they were misordered. 
-     *       (This happens somewhat implicitly, since if there are two 
-     *       messages, one with Re: and one without, the one without
-     *       will be in the hash table, regardless of the order in which 
-     *       they were seen.) 
-     * 
-     *     + Otherwise, make a new empty container and make both msgs be
-     *       a child of it. This catches the both-are-replies and 
-     *       neither-are-replies cases, and makes them be siblings instead of
-     *       asserting a hierarchical relationship which might not be true. 
-     * 
-     *     (People who reply to messages without using ``Re:'' and without
-     *     using a References line will break this slightly. Those people suck.) 
-     * 
-     *     (It has occurred to me that taking the date or message number into
-     *     account would be one way of resolving some of the ambiguous cases,
-     *     but that's not altogether straightforward either.) 
+     * The subject_table associates each subject, with ``Re:'', ``RE:'',
+     * ``RE[5]:'', ``Re: Re[4]: Re:'' and so on stripped, with the
+     * messages of the root set--the messages in the view with no
+     * parent--that have it.
      */
+    const gchar *chopped_subject;
+    ThreadingSubject *gathered;
 
-    subject = lbml_get_subject(node, ti);
-    if (subject == NULL)
-	return;
-    chopped_subject = lbml_chop_re(subject);
-    if (chopped_subject == NULL
-	|| !strcmp(chopped_subject, _("(No subject)")))
-	return;
+    lbml_subject_remove(ti, info);
 
-    old = g_hash_table_lookup(subject_table, chopped_subject);
-#ifdef MAKE_EMPTY_CONTAINER_FOR_MISSING_PARENT
-    if (old == NULL || (node->data == NULL && old->data != NULL)) {
-	g_hash_table_insert(subject_table, (char *) chopped_subject,
-			    node);
-	return;
-    }
-#else				/* MAKE_EMPTY_CONTAINER_FOR_MISSING_PARENT */
-    if (old == NULL) {
-	g_hash_table_insert(subject_table, (char *) chopped_subject,
-			    node);
-	return;
-    }
-#endif				/* MAKE_EMPTY_CONTAINER_FOR_MISSING_PARENT */
+    if (info->subject == NULL
+        || lbml_get_msg_node(ti, info) == NULL
+        || lbml_get_parent(ti, info) != NULL)
+        return;
 
-    old_subject = lbml_get_subject(old, ti);
+    chopped_subject = libbalsa_subject_skip_re(info->subject);
+    if (!strcmp(chopped_subject, _("(No subject)")))
+        return;
 
-    if (old_subject != lbml_chop_re(old_subject)
-	&& subject == chopped_subject)
-	g_hash_table_insert(subject_table, (gchar *) chopped_subject,
-			    node);
+    gathered = g_hash_table_lookup(ti->subject_table, chopped_subject);
+    if (gathered == NULL) {
+        gathered = g_new(ThreadingSubject, 1);
+        gathered->subject = g_strdup(chopped_subject);
+        gathered->infos = g_ptr_array_new();
+        gathered->head = NULL;
+        g_hash_table_insert(ti->subject_table, gathered->subject,
+                            gathered);
+    }
+    g_ptr_array_add(gathered->infos, info);
+    info->gathered = gathered;
+    g_hash_table_add(ti->dirty_subjects, gathered);
 }
 
-/* Swap data and children. */
 static void
-lbml_swap(GNode * node1, GNode * node2, ThreadingInfo * ti)
+lbml_subject_set_head(ThreadingSubject * gathered)
 {
-    GNode *tmp_node = g_node_new(NULL);
-    gpointer tmp_data;
+    /*
+     * For each message in the root set with a ``Re:'' version of the
+     * subject, make it a child of the first message, in mailbox order,
+     * with the non-``Re:'' version, if there is one.  Messages with the
+     * same version of the subject stay siblings, rather than asserting
+     * a hierarchical relationship which might not be true.
+     *
+     * (People who reply to messages without using ``Re:'' and without
+     * using a References line will break this slightly. Those people
+     * suck.)
+     */
+    guint i;
 
-    lbml_move_children(node1, tmp_node);
-    lbml_move_children(node2, node1);
-    lbml_move_children(tmp_node, node2);
-    g_node_destroy(tmp_node);
+    gathered->head = NULL;
+    for (i = 0; i < gathered->infos->len; i++) {
+        LibBalsaMailboxLocalInfo *info =
+            g_ptr_array_index(gathered->infos, i);
 
-    tmp_data = node1->data;
-    node1->data = node2->data;
-    node2->data = tmp_data;
+        if (!lbml_is_reply(info)
+            && (gathered->head == NULL
+                || info->msgno < gathered->head->msgno))
+            gathered->head = info;
+    }
 }
 
-static void
-lbml_subject_merge(GNode * node, ThreadingInfo * ti)
+/* Where a message belongs in the mailbox's msg_tree: under the returned
+ * message, or at the top if it is NULL. */
+static LibBalsaMailboxLocalInfo *
+lbml_get_target(ThreadingInfo * ti, LibBalsaMailboxLocalInfo * info)
 {
-    const gchar *subject, *subject2;
-    const gchar *chopped_subject, *chopped_subject2;
-    GNode *node2;
+    LibBalsaMailboxLocalInfo *parent = lbml_get_parent(ti, info);
 
-    subject = lbml_get_subject(node, ti);
-    if (subject == NULL)
-	return;
-    chopped_subject = lbml_chop_re(subject);
-    if (chopped_subject == NULL)
-	return;
+    if (parent == NULL && info->gathered != NULL
+        && info->gathered->head != NULL && info->gathered->head != info
+        && lbml_is_reply(info))
+        parent = info->gathered->head;
 
-    node2 = g_hash_table_lookup(ti->subject_table, chopped_subject);
-    if (node2 == NULL || node2 == node)
-	return;
+    return parent;
+}
 
-#ifdef MAKE_EMPTY_CONTAINER_FOR_MISSING_PARENT
-    if (node->data == NULL && node2->data == NULL) {
-	lbml_move_children(node, node2);
-	g_node_destroy(node);
-	return;
-    }
+static void
+lbml_move(ThreadingInfo * ti, LibBalsaMailboxLocalInfo * info)
+{
+    GNode *msg_node;
+    GNode *msg_parent;
+    LibBalsaMailboxLocalInfo *parent;
 
-    if (node->data == NULL)
-	/* node2 should be made a child of node, but unlinking node2
-	 * could mess up the foreach, so we'll swap them and fall
-	 * through to the next case. */
-	lbml_swap(node, node2, ti);
+    if ((msg_node = lbml_get_msg_node(ti, info)) == NULL)
+        return;
 
-    if (node2->data == NULL) {
-	lbml_unlink_and_prepend(node, node2);
-	return;
-    }
-#endif				/* MAKE_EMPTY_CONTAINER_FOR_MISSING_PARENT */
-
-    subject2 = lbml_get_subject(node2, ti);
-    chopped_subject2 = lbml_chop_re(subject2);
-
-    if ((subject2 == chopped_subject2) && subject != chopped_subject)
-	/* Make node a child of node2. */
-	lbml_unlink_and_prepend(node, node2);
-    else if ((subject2 != chopped_subject2)
-	     && subject == chopped_subject) {
-	/* Make node2 a child of node; as above, swap them to avoid
-	 * unlinking node2. */
-	lbml_swap(node, node2, ti);
-	lbml_unlink_and_prepend(node, node2);
-#ifdef MAKE_EMPTY_CONTAINER_FOR_MISSING_PARENT
+    if ((parent = lbml_get_target(ti, info)) != NULL) {
+        msg_parent = lbml_get_msg_node(ti, parent);
     } else {
-	/* Make both node and node2 children of a new empty node; as
-	 * above, swap node2 and the new node to avoid unlinking node2.
-	 */
-	GNode *new_node = g_node_new(NULL);
-
-	lbml_move_children(node2, new_node);
-	new_node->data = node2->data;
-	node2->data = NULL;
-	lbml_unlink_and_prepend(node, node2);
-	lbml_unlink_and_prepend(new_node, node2);
-#endif				/* MAKE_EMPTY_CONTAINER_FOR_MISSING_PARENT */
-    }
-}
-
-/* The more heuristics should be added. */
-static const gchar *
-lbml_chop_re(const gchar * str)
-{
-    const gchar *p = str;
-    while (*p) {
-	while (*p && g_ascii_isspace((int) *p))
-	    p++;
-	if (!*p)
-	    break;
-
-	if (g_ascii_strncasecmp(p, "re:", 3) == 0
-	    || g_ascii_strncasecmp(p, "aw:", 3) == 0) {
-	    p += 3;
-	    continue;
-	} else if (g_ascii_strncasecmp(p, _("Re:"), strlen(_("Re:"))) == 0) {
-	    /* should "re" be localized ? */
-	    p += strlen(_("Re:"));
-	    continue;
-	}
-	break;
+        msg_parent = libbalsa_mailbox_get_msg_tree(ti->mailbox);
+        /* A message under one that has not been threaded stays there,
+         * as the saved tree had it. */
+        if (msg_node->parent != msg_parent
+            && lbml_get_info(msg_node->parent, ti) == NULL)
+            return;
     }
-    return p;
+
+    if (msg_parent != NULL && msg_node->parent != msg_parent
+        && !g_node_is_ancestor(msg_node, msg_parent))
+        libbalsa_mailbox_unlink_and_prepend(ti->mailbox, msg_node,
+                                            msg_parent);
 }
 
-static gboolean
-lbml_construct(GNode * node, ThreadingInfo * ti)
+/* Move a message, after the messages it is to go under, so that it
+ * never has to go under one of its own descendants. */
+static void
+lbml_place(ThreadingInfo * ti, LibBalsaMailboxLocalInfo * info)
 {
-    GNode *msg_node;
+    GSList *chain = NULL;
+    GSList *list;
 
-    if (node->parent && (msg_node = node->data)) {
-        GNode *msg_parent = node->parent->data;
-
-        if (msg_parent && msg_node->parent != msg_parent
-            && !g_node_is_ancestor(msg_node, msg_parent))
-            libbalsa_mailbox_unlink_and_prepend(ti->mailbox, msg_node,
-                                                msg_parent);
+    for (; info != NULL && info->placed != ti->pass;
+         info = lbml_get_target(ti, info)) {
+        info->placed = ti->pass;
+        chain = g_slist_prepend(chain, info);
     }
 
-    return FALSE;
+    for (list = chain; list != NULL; list = list->next)
+        lbml_move(ti, list->data);
+    g_slist_free(chain);
 }
 
-
-#ifdef MAKE_EMPTY_CONTAINER_FOR_MISSING_PARENT
 static void
-lbml_clear_empty(GNode * msg_tree)
+lbml_place_changed(ThreadingInfo * ti)
 {
-    GNode *node = msg_tree->children;
-    while (node) {
-	GNode *next = node->next;
-	if (!node->data && !node->children)
-	    g_node_destroy(node);
-	node = next;
+    GPtrArray *infos = g_ptr_array_new();
+    GHashTableIter iter;
+    gpointer key;
+    guint i;
+
+    g_hash_table_iter_init(&iter, ti->dirty_sets);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        ThreadingSet *set = key;
+
+        for (i = 0; i < set->infos->len; i++)
+            g_ptr_array_add(infos, g_ptr_array_index(set->infos, i));
     }
+    g_hash_table_remove_all(ti->dirty_sets);
+
+    if (ti->subject_gather) {
+        guint len = infos->len;
+
+        /* The messages whose threads changed may have joined or left
+         * the root set; all messages of the subjects they had and have
+         * may need to move. */
+        for (i = 0; i < len; i++)
+            lbml_subject_update(ti, g_ptr_array_index(infos, i));
+
+        g_hash_table_iter_init(&iter, ti->dirty_subjects);
+        while (g_hash_table_iter_next(&iter, &key, NULL)) {
+            ThreadingSubject *gathered = key;
+
+            if (gathered->infos->len == 0) {
+                g_hash_table_remove(ti->subject_table, gathered->subject);
+                continue;
+            }
+            lbml_subject_set_head(gathered);
+            for (i = 0; i < gathered->infos->len; i++)
+                g_ptr_array_add(infos,
+                                g_ptr_array_index(gathered->infos, i));
+        }
+        g_hash_table_remove_all(ti->dirty_subjects);
+    }
+
+    ++ti->pass;
+    for (i = 0; i < infos->len; i++)
+        lbml_place(ti, g_ptr_array_index(infos, i));
+    g_ptr_array_free(infos, TRUE);
 }
-#endif				/* MAKE_EMPTY_CONTAINER_FOR_MISSING_PARENT */
 
 /*------------------------------*/
 /*       Flat threading         */
@@ -2106,7 +2411,12 @@ libbalsa_mailbox_local_get_message_stream(LibBalsaMailbox * mailbox,
 
     fd = open(filename, O_RDONLY);
     if (fd != -1) {
-	stream = g_mime_stream_fs_new(fd);
+        /* Message files are never rewritten in place, so we can read
+         * them through a mapping, and fall back to reading the file
+         * only if mapping fails (for example, if it is empty). */
+        stream = g_mime_stream_mmap_new(fd, PROT_READ, MAP_PRIVATE);
+        if (!stream)
+            stream = g_mime_stream_fs_new(fd);
 	if (!stream)
 	    libbalsa_information(LIBBALSA_INFORMATION_ERROR,
 				 _("Open of %s failed. Errno = %d, "),
@@ -61,6 +61,11 @@ struct _LibBalsaMailboxLocalClass {
     LibBalsaMailboxLocalMessageInfo *(*get_info)(LibBalsaMailboxLocal * local,
                                                  guint msgno);
     LibBalsaMailboxLocalAddMessageFunc *add_message;
+    /* Optional: fill the envelope of message from data cached by the
+     * backend; return FALSE to fall back to parsing the message. */
+    gboolean (*load_envelope)(LibBalsaMailboxLocal * local,
+                              guint msgno,
+                              LibBalsaMessage * message);
 };
 
 LibBalsaMailbox *libbalsa_mailbox_local_new(const gchar * path,
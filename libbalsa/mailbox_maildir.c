@@ -37,6 +37,21 @@
 #include "mime-stream-shared.h"
 #include <glib/gi18n.h>
 
+/* Envelope data cached in the envelope cache, so that a message can be
+ * shown in the index and threaded without reading its file. */
+struct message_envelope {
+    gint64 date;
+    gint64 length;              /* Size of the message file */
+    gchar *from;                /* RFC 2822 address lists */
+    gchar *to;
+    gchar *dispnotify_to;       /* Disposition-Notification-To */
+    gchar *subject;
+    gchar *content_type;        /* Content-Type header value */
+    gchar *message_id;
+    GList *references;
+    GList *in_reply_to;
+};
+
 struct message_info {
     LibBalsaMailboxLocalMessageInfo local_info;
     LibBalsaMessageFlag orig_flags;     /* Has only real flags */
@@ -48,6 +63,7 @@ struct message_info {
      * tree in a form that will match the msgnos when the mailbox is
      * reopened. */
     guint fileno;
+    struct message_envelope *envelope;
 };
 #define REAL_FLAGS(flags) ((flags) & LIBBALSA_MESSAGE_FLAGS_REAL)
 #define FLAGS_REALLY_DIFFER(orig_flags, flags) \
@@ -91,6 +107,9 @@ static guint lbm_maildir_fileno(LibBalsaMailboxLocal * local, guint msgno);
 static LibBalsaMailboxLocalMessageInfo
     *lbm_maildir_get_info(LibBalsaMailboxLocal * local, guint msgno);
 static LibBalsaMailboxLocalAddMessageFunc lbm_maildir_add_message;
+static gboolean lbm_maildir_load_envelope(LibBalsaMailboxLocal * local,
+                                          guint msgno,
+                                          LibBalsaMessage * message);
 
 /* util functions */
 static struct message_info *message_info_from_msgno(LibBalsaMailboxMaildir
@@ -109,6 +128,15 @@ struct _LibBalsaMailboxMaildir {
     gchar *curdir;
     gchar *newdir;
     gchar *tmpdir;
+
+    /* Modification times of cur and new when they were last listed. */
+    time_t cur_mtime;
+    time_t new_mtime;
+
+    /* Envelopes read from the cache file, by key, while the mailbox is
+     * being opened. */
+    GHashTable *cached_envelopes;
+    gboolean envelopes_changed;
 };
 
 G_DEFINE_TYPE(LibBalsaMailboxMaildir,
@@ -150,6 +178,7 @@ libbalsa_mailbox_maildir_class_init(LibBalsaMailboxMaildirClass * klass)
     libbalsa_mailbox_local_class->fileno       = lbm_maildir_fileno;
     libbalsa_mailbox_local_class->get_info     = lbm_maildir_get_info;
     libbalsa_mailbox_local_class->add_message  = lbm_maildir_add_message;
+    libbalsa_mailbox_local_class->load_envelope = lbm_maildir_load_envelope;
 }
 
 static void
@@ -298,13 +327,38 @@ libbalsa_mailbox_maildir_get_message_stream(LibBalsaMailbox * mailbox,
 						     msg_info->filename);
 }
 
+static gchar *
+lbm_maildir_get_cache_filename(LibBalsaMailboxMaildir * mdir)
+{
+    gchar *encoded_path;
+    gchar *filename;
+    gchar *basename;
+
+    encoded_path =
+        libbalsa_urlencode(libbalsa_mailbox_local_get_path
+                           (LIBBALSA_MAILBOX_LOCAL(mdir)));
+    basename = g_strconcat("maildir", encoded_path, NULL);
+    g_free(encoded_path);
+    filename =
+        g_build_filename(g_get_home_dir(), ".balsa", basename, NULL);
+    g_free(basename);
+
+    return filename;
+}
+
 static void
 lbm_maildir_remove_files(LibBalsaMailboxLocal *mailbox)
 {
     const gchar* path;
+    gchar *filename;
 
     g_return_if_fail(LIBBALSA_IS_MAILBOX_MAILDIR(mailbox));
 
+    filename =
+        lbm_maildir_get_cache_filename(LIBBALSA_MAILBOX_MAILDIR(mailbox));
+    unlink(filename);
+    g_free(filename);
+
     path = libbalsa_mailbox_local_get_path((LibBalsaMailboxLocal *) mailbox);
     g_print("DELETE MAILDIR\n");
 
@@ -361,7 +415,376 @@ static LibBalsaMessageFlag parse_filename(const gchar *subdir,
     return flags;
 }
 
+/*
+ * The envelope cache.
+ *
+ * The file in ~/.balsa holds the envelope of every message of the
+ * maildir that has been read, keyed by the unique part of the message's
+ * file name; the file of a message never changes while it keeps its
+ * key, so the envelope stays valid until the file is removed.  Only the
+ * files that have no entry are read when the mailbox is opened.
+ *
+ * All integers are stored in network (big-endian) byte order.  The file
+ * begins with a header:
+ *
+ *   magic        8 bytes, LBM_MAILDIR_CACHE_MAGIC
+ *   version      guint32
+ *   count        guint32, number of records
+ *
+ * followed by one record per message:
+ *
+ *   key                                            string
+ *   date, length                                   gint64
+ *   from, to, dispnotify_to, subject,
+ *   content_type, message_id                       string
+ *   references, in_reply_to                        string list
+ *
+ * A string is a guint32 length followed by that many bytes, with
+ * G_MAXUINT32 standing for NULL; a string list is a guint32 count
+ * followed by that many strings.
+ */
+
+#define LBM_MAILDIR_CACHE_MAGIC   "BalsaMdr"
+#define LBM_MAILDIR_CACHE_VERSION 2
+#define LBM_MAILDIR_NULL_STRING   G_MAXUINT32
+
+static void
+lbm_maildir_envelope_free(struct message_envelope *envelope)
+{
+    if (envelope == NULL)
+        return;
+
+    g_free(envelope->from);
+    g_free(envelope->to);
+    g_free(envelope->dispnotify_to);
+    g_free(envelope->subject);
+    g_free(envelope->content_type);
+    g_free(envelope->message_id);
+    g_list_free_full(envelope->references, g_free);
+    g_list_free_full(envelope->in_reply_to, g_free);
+    g_free(envelope);
+}
+
+/* Save the envelope data of a message just read from its file. */
+static struct message_envelope *
+lbm_maildir_envelope_new(LibBalsaMessage * message)
+{
+    struct message_envelope *envelope;
+    LibBalsaMessageHeaders *headers;
+
+    headers = libbalsa_message_get_headers(message);
+
+    envelope = g_new0(struct message_envelope, 1);
+    envelope->date = headers->date;
+    envelope->length = libbalsa_message_get_length(message);
+    if (headers->from != NULL)
+        envelope->from =
+            internet_address_list_to_string(headers->from, NULL, TRUE);
+    if (headers->to_list != NULL)
+        envelope->to =
+            internet_address_list_to_string(headers->to_list, NULL, TRUE);
+    if (headers->dispnotify_to != NULL)
+        envelope->dispnotify_to =
+            internet_address_list_to_string(headers->dispnotify_to, NULL,
+                                            TRUE);
+    if (headers->content_type != NULL)
+        envelope->content_type =
+            g_mime_content_type_encode(headers->content_type, NULL);
+    envelope->subject = g_strdup(libbalsa_message_get_subject_raw(message));
+    envelope->message_id =
+        g_strdup(libbalsa_message_get_message_id(message));
+    envelope->references =
+        g_list_copy_deep(libbalsa_message_get_references(message),
+                         (GCopyFunc) g_strdup, NULL);
+    envelope->in_reply_to =
+        g_list_copy_deep(libbalsa_message_get_in_reply_to(message),
+                         (GCopyFunc) g_strdup, NULL);
+
+    return envelope;
+}
+
+/* Writing the cache. */
+
+static void
+lbm_maildir_cache_put_uint32(GByteArray * data, guint32 value)
+{
+    value = GUINT32_TO_BE(value);
+    g_byte_array_append(data, (guint8 *) &value, sizeof value);
+}
+
+static void
+lbm_maildir_cache_put_int64(GByteArray * data, gint64 value)
+{
+    guint64 tmp = GUINT64_TO_BE((guint64) value);
+    g_byte_array_append(data, (guint8 *) &tmp, sizeof tmp);
+}
+
+static void
+lbm_maildir_cache_put_string(GByteArray * data, const gchar * str)
+{
+    guint32 len;
+
+    if (str == NULL) {
+        lbm_maildir_cache_put_uint32(data, LBM_MAILDIR_NULL_STRING);
+        return;
+    }
+
+    len = strlen(str);
+    lbm_maildir_cache_put_uint32(data, len);
+    g_byte_array_append(data, (guint8 *) str, len);
+}
+
+static void
+lbm_maildir_cache_put_list(GByteArray * data, GList * list)
+{
+    lbm_maildir_cache_put_uint32(data, g_list_length(list));
+    for (; list != NULL; list = list->next)
+        lbm_maildir_cache_put_string(data, list->data);
+}
+
+static void
+lbm_maildir_cache_put_record(GByteArray * data,
+                             struct message_info *msg_info)
+{
+    struct message_envelope *envelope = msg_info->envelope;
+
+    lbm_maildir_cache_put_string(data, msg_info->key);
+    lbm_maildir_cache_put_int64(data, envelope->date);
+    lbm_maildir_cache_put_int64(data, envelope->length);
+    lbm_maildir_cache_put_string(data, envelope->from);
+    lbm_maildir_cache_put_string(data, envelope->to);
+    lbm_maildir_cache_put_string(data, envelope->dispnotify_to);
+    lbm_maildir_cache_put_string(data, envelope->subject);
+    lbm_maildir_cache_put_string(data, envelope->content_type);
+    lbm_maildir_cache_put_string(data, envelope->message_id);
+    lbm_maildir_cache_put_list(data, envelope->references);
+    lbm_maildir_cache_put_list(data, envelope->in_reply_to);
+}
+
+/* Reading the cache; any attempt to read beyond the end of the data
+ * sets reader->error, after which all reads return zero or NULL. */
+
+typedef struct {
+    const guint8 *pos;
+    const guint8 *end;
+    gboolean error;
+} LbmMaildirCacheReader;
+
+static gboolean
+lbm_maildir_cache_has(LbmMaildirCacheReader * reader, gsize len)
+{
+    if (reader->error || (gsize) (reader->end - reader->pos) < len)
+        reader->error = TRUE;
+
+    return !reader->error;
+}
+
+static guint32
+lbm_maildir_cache_get_uint32(LbmMaildirCacheReader * reader)
+{
+    guint32 value;
+
+    if (!lbm_maildir_cache_has(reader, sizeof value))
+        return 0;
+
+    memcpy(&value, reader->pos, sizeof value);
+    reader->pos += sizeof value;
+
+    return GUINT32_FROM_BE(value);
+}
+
+static gint64
+lbm_maildir_cache_get_int64(LbmMaildirCacheReader * reader)
+{
+    guint64 value;
+
+    if (!lbm_maildir_cache_has(reader, sizeof value))
+        return 0;
+
+    memcpy(&value, reader->pos, sizeof value);
+    reader->pos += sizeof value;
+
+    return (gint64) GUINT64_FROM_BE(value);
+}
+
+/* Returns a newly allocated string, or NULL. */
+static gchar *
+lbm_maildir_cache_get_string(LbmMaildirCacheReader * reader)
+{
+    guint32 len;
+    gchar *str;
+
+    len = lbm_maildir_cache_get_uint32(reader);
+    if (len == LBM_MAILDIR_NULL_STRING
+        || !lbm_maildir_cache_has(reader, len))
+        return NULL;
+
+    str = g_strndup((const gchar *) reader->pos, len);
+    reader->pos += len;
+
+    return str;
+}
+
+static GList *
+lbm_maildir_cache_get_list(LbmMaildirCacheReader * reader)
+{
+    guint32 count;
+    GList *list = NULL;
+
+    count = lbm_maildir_cache_get_uint32(reader);
+    while (count-- > 0 && !reader->error) {
+        gchar *str = lbm_maildir_cache_get_string(reader);
+
+        if (str != NULL)
+            list = g_list_prepend(list, str);
+    }
+
+    return g_list_reverse(list);
+}
+
+/* Read the cache file into mdir->cached_envelopes; a file that cannot
+ * be read, or was written by another version, is ignored, and the
+ * envelopes are then read from the message files. */
+static void
+lbm_maildir_cache_load(LibBalsaMailboxMaildir * mdir)
+{
+    gchar *filename;
+    gchar *contents;
+    gsize length;
+    LbmMaildirCacheReader reader;
+    guint32 count;
+
+    mdir->cached_envelopes =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                              (GDestroyNotify) lbm_maildir_envelope_free);
+
+    filename = lbm_maildir_get_cache_filename(mdir);
+    if (!g_file_get_contents(filename, &contents, &length, NULL)) {
+        g_free(filename);
+        return;
+    }
+    g_free(filename);
+
+    reader.pos   = (const guint8 *) contents;
+    reader.end   = reader.pos + length;
+    reader.error = FALSE;
+
+    if (!lbm_maildir_cache_has(&reader, strlen(LBM_MAILDIR_CACHE_MAGIC))
+        || memcmp(reader.pos, LBM_MAILDIR_CACHE_MAGIC,
+                  strlen(LBM_MAILDIR_CACHE_MAGIC)) != 0) {
+        g_free(contents);
+        return;
+    }
+    reader.pos += strlen(LBM_MAILDIR_CACHE_MAGIC);
+
+    if (lbm_maildir_cache_get_uint32(&reader) != LBM_MAILDIR_CACHE_VERSION) {
+        g_free(contents);
+        return;
+    }
+
+    count = lbm_maildir_cache_get_uint32(&reader);
+    while (count-- > 0 && !reader.error) {
+        struct message_envelope *envelope;
+        gchar *key;
+
+        key = lbm_maildir_cache_get_string(&reader);
+        envelope = g_new0(struct message_envelope, 1);
+        envelope->date         = lbm_maildir_cache_get_int64(&reader);
+        envelope->length       = lbm_maildir_cache_get_int64(&reader);
+        envelope->from         = lbm_maildir_cache_get_string(&reader);
+        envelope->to           = lbm_maildir_cache_get_string(&reader);
+        envelope->dispnotify_to = lbm_maildir_cache_get_string(&reader);
+        envelope->subject      = lbm_maildir_cache_get_string(&reader);
+        envelope->content_type = lbm_maildir_cache_get_string(&reader);
+        envelope->message_id   = lbm_maildir_cache_get_string(&reader);
+        envelope->references   = lbm_maildir_cache_get_list(&reader);
+        envelope->in_reply_to  = lbm_maildir_cache_get_list(&reader);
+
+        if (reader.error || key == NULL) {
+            g_free(key);
+            lbm_maildir_envelope_free(envelope);
+            break;
+        }
+        g_hash_table_insert(mdir->cached_envelopes, key, envelope);
+    }
+
+    g_free(contents);
+}
+
+/* Take the cached envelope of the message with this key, if any. */
+static struct message_envelope *
+lbm_maildir_cache_take(LibBalsaMailboxMaildir * mdir, const gchar * key)
+{
+    gpointer orig_key;
+    gpointer envelope;
+
+    if (mdir->cached_envelopes == NULL
+        || !g_hash_table_lookup_extended(mdir->cached_envelopes, key,
+                                         &orig_key, &envelope))
+        return NULL;
+
+    g_hash_table_steal(mdir->cached_envelopes, key);
+    g_free(orig_key);
+
+    return envelope;
+}
+
 static void
+lbm_maildir_cache_save(LibBalsaMailboxMaildir * mdir)
+{
+    gchar *filename;
+    GByteArray *data;
+    guint msgno;
+    guint count = 0;
+    GError *err = NULL;
+
+    if (!mdir->envelopes_changed)
+        return;
+
+    mdir->envelopes_changed = FALSE;
+
+    filename = lbm_maildir_get_cache_filename(mdir);
+
+    data = g_byte_array_new();
+    g_byte_array_append(data, (guint8 *) LBM_MAILDIR_CACHE_MAGIC,
+                        strlen(LBM_MAILDIR_CACHE_MAGIC));
+    lbm_maildir_cache_put_uint32(data, LBM_MAILDIR_CACHE_VERSION);
+    /* The count is filled in below. */
+    lbm_maildir_cache_put_uint32(data, 0);
+
+    for (msgno = 1; msgno <= mdir->msgno_2_msg_info->len; msgno++) {
+        struct message_info *msg_info =
+            message_info_from_msgno(mdir, msgno);
+
+        if (msg_info->envelope != NULL) {
+            lbm_maildir_cache_put_record(data, msg_info);
+            ++count;
+        }
+    }
+
+    if (count > 0) {
+        guint32 be_count = GUINT32_TO_BE(count);
+
+        memcpy(data->data + strlen(LBM_MAILDIR_CACHE_MAGIC)
+               + sizeof(guint32), &be_count, sizeof be_count);
+        if (!g_file_set_contents(filename, (gchar *) data->data,
+                                 data->len, &err)) {
+            libbalsa_information(LIBBALSA_INFORMATION_WARNING,
+                                 _("Failed to save cache file “%s”: %s."),
+                                 filename, err->message);
+            g_error_free(err);
+        }
+    } else if (unlink(filename) < 0 && errno != ENOENT)
+        libbalsa_information(LIBBALSA_INFORMATION_WARNING,
+                             _("Could not unlink file %s: %s"),
+                             filename, strerror(errno));
+
+    g_byte_array_free(data, TRUE);
+    g_free(filename);
+}
+
+/* List subdir; returns FALSE if it could not be read. */
+static gboolean
 lbm_maildir_parse(LibBalsaMailboxMaildir *mdir,
                   const gchar            *subdir,
                   guint                  *fileno)
@@ -382,7 +805,7 @@ lbm_maildir_parse(LibBalsaMailboxMaildir *mdir,
     dir = g_dir_open(path, 0, NULL);
     g_free(path);
     if (dir == NULL)
-	return;
+	return FALSE;
 
     messages_info = mdir->messages_info;
     msgno_2_msg_info = mdir->msgno_2_msg_info;
@@ -419,6 +842,7 @@ lbm_maildir_parse(LibBalsaMailboxMaildir *mdir,
 	    msg_info->filename=g_strdup(filename);
 	    msg_info->local_info.flags = msg_info->orig_flags = flags;
 	    msg_info->fileno = 0;
+	    msg_info->envelope = lbm_maildir_cache_take(mdir, key);
 	}
 	msg_info->subdir = subdir;
         if (!msg_info->fileno)
@@ -426,12 +850,18 @@ lbm_maildir_parse(LibBalsaMailboxMaildir *mdir,
 	    msg_info->fileno = ++*fileno;
     }
     g_dir_close(dir);
+
+    return TRUE;
 }
 
-static void
+/* List cur and new; every message still there gets a nonzero fileno.
+ * Returns FALSE if either could not be read. */
+static gboolean
 lbm_maildir_parse_subdirs(LibBalsaMailboxMaildir * mdir)
 {
     guint msgno, fileno = 0;
+    struct stat st;
+    gboolean retval;
 
     for (msgno = mdir->msgno_2_msg_info->len; msgno > 0; --msgno) {
         struct message_info *msg_info =
@@ -439,13 +869,21 @@ lbm_maildir_parse_subdirs(LibBalsaMailboxMaildir * mdir)
         msg_info->fileno = 0;
     }
 
-    lbm_maildir_parse(mdir, "cur", &fileno);
+    /* Take the times before listing, so that a change made while we
+     * list is seen by the next check. */
+    mdir->cur_mtime = stat(mdir->curdir, &st) == 0 ? st.st_mtime : 0;
+    mdir->new_mtime = stat(mdir->newdir, &st) == 0 ? st.st_mtime : 0;
+
+    retval = lbm_maildir_parse(mdir, "cur", &fileno);
     /* We parse "new" after "cur", so that any recent messages will have
      * higher msgnos than any current messages. That ensures that the
      * message tree saved by LibBalsaMailboxLocal is still valid, and
      * that the new messages will be inserted correctly into the tree by
      * libbalsa_mailbox_local_add_messages. */
-    lbm_maildir_parse(mdir, "new", &fileno);
+    if (!lbm_maildir_parse(mdir, "new", &fileno))
+        retval = FALSE;
+
+    return retval;
 }
 
 static gboolean
@@ -479,7 +917,14 @@ libbalsa_mailbox_maildir_open(LibBalsaMailbox * mailbox, GError **err)
           access(mdir->tmpdir, W_OK) == 0));
 
     libbalsa_mailbox_clear_unread_messages(mailbox);
-    lbm_maildir_parse_subdirs(mdir);
+    lbm_maildir_cache_load(mdir);
+    if (lbm_maildir_parse_subdirs(mdir)
+        && g_hash_table_size(mdir->cached_envelopes) > 0)
+        /* Drop the envelopes of messages removed since the cache was
+         * saved. */
+        mdir->envelopes_changed = TRUE;
+    g_hash_table_destroy(mdir->cached_envelopes);
+    mdir->cached_envelopes = NULL;
 #ifdef DEBUG
     g_print(_("%s: Opening %s Refcount: %d\n"),
 	    "LibBalsaMailboxMaildir", libbalsa_mailbox_get_name(mailbox),
@@ -521,8 +966,7 @@ libbalsa_mailbox_maildir_check(LibBalsaMailbox * mailbox)
     LibBalsaMailboxMaildir *mdir;
     guint renumber, msgno;
     struct message_info *msg_info;
-    const gchar *path;
-    time_t mtime;
+    time_t mtime, tmp_mtime, cur_mtime, new_mtime;
 
     g_assert(LIBBALSA_IS_MAILBOX_MAILDIR(mailbox));
 
@@ -530,18 +974,29 @@ libbalsa_mailbox_maildir_check(LibBalsaMailbox * mailbox)
 
     if (stat(mdir->tmpdir, &st) == -1)
 	return;
+    tmp_mtime = st.st_mtime;
+    cur_mtime = stat(mdir->curdir, &st) == 0 ? st.st_mtime : 0;
+    new_mtime = stat(mdir->newdir, &st) == 0 ? st.st_mtime : 0;
 
     if ((mtime = libbalsa_mailbox_get_mtime(mailbox)) == 0) {
-	/* First check--just cache the mtime. */
-	libbalsa_mailbox_set_mtime(mailbox, st.st_mtime);
+	/* First check--just cache the mtimes. */
+	libbalsa_mailbox_set_mtime(mailbox, tmp_mtime);
+        mdir->cur_mtime = cur_mtime;
+        mdir->new_mtime = new_mtime;
         return;
     }
-    if (st.st_mtime == mtime)
+    /* Messages are delivered through tmp, and other clients move them
+     * from new to cur or remove them; unless one of the directories
+     * changed, there is nothing to list. */
+    if (tmp_mtime == mtime && cur_mtime == mdir->cur_mtime
+        && new_mtime == mdir->new_mtime)
 	return;
 
-    libbalsa_mailbox_set_mtime(mailbox, st.st_mtime);
+    libbalsa_mailbox_set_mtime(mailbox, tmp_mtime);
 
     if (!MAILBOX_OPEN(mailbox)) {
+        mdir->cur_mtime = cur_mtime;
+        mdir->new_mtime = new_mtime;
 	libbalsa_mailbox_set_unread_messages_flag(mailbox,
 						  lbm_maildir_check(mdir->
 								    newdir)
@@ -551,35 +1006,34 @@ libbalsa_mailbox_maildir_check(LibBalsaMailbox * mailbox)
 	return;
     }
 
-    /* Was any message removed? */
-    path = libbalsa_mailbox_local_get_path((LibBalsaMailboxLocal *) mailbox);
-    renumber = mdir->msgno_2_msg_info->len + 1;
-    for (msgno = 1; msgno <= mdir->msgno_2_msg_info->len; ) {
-	gchar *filename;
-
-        msg_info = message_info_from_msgno(mdir, msgno);
-	filename = g_build_filename(path, msg_info->subdir,
-				    msg_info->filename, NULL);
-	if (access(filename, F_OK) == 0)
-	    msgno++;
-	else {
-	    g_ptr_array_remove(mdir->msgno_2_msg_info, msg_info);
-	    g_hash_table_remove(mdir->messages_info, msg_info->key);
-	    libbalsa_mailbox_local_msgno_removed(mailbox, msgno);
-	    if (renumber > msgno)
-		/* First message that needs renumbering. */
-		renumber = msgno;
-	}
-	g_free(filename);
-    }
-    for (msgno = renumber; msgno <= mdir->msgno_2_msg_info->len; msgno++) {
-	msg_info = message_info_from_msgno(mdir, msgno);
-	if (msg_info->local_info.message != NULL)
-            libbalsa_message_set_msgno(msg_info->local_info.message, msgno);
+    /* Was any message removed?  Its file is no longer listed, so it
+     * was given no fileno; if a directory could not be listed, we
+     * cannot tell. */
+    if (lbm_maildir_parse_subdirs(mdir)) {
+        renumber = mdir->msgno_2_msg_info->len + 1;
+        for (msgno = 1; msgno <= mdir->msgno_2_msg_info->len; ) {
+            msg_info = message_info_from_msgno(mdir, msgno);
+            if (msg_info->fileno != 0)
+                msgno++;
+            else {
+                g_ptr_array_remove(mdir->msgno_2_msg_info, msg_info);
+                g_hash_table_remove(mdir->messages_info, msg_info->key);
+                libbalsa_mailbox_local_msgno_removed(mailbox, msgno);
+                mdir->envelopes_changed = TRUE;
+                if (renumber > msgno)
+                    /* First message that needs renumbering. */
+                    renumber = msgno;
+            }
+        }
+        for (msgno = renumber; msgno <= mdir->msgno_2_msg_info->len;
+             msgno++) {
+            msg_info = message_info_from_msgno(mdir, msgno);
+            if (msg_info->local_info.message != NULL)
+                libbalsa_message_set_msgno(msg_info->local_info.message,
+                                           msgno);
+        }
     }
 
-    lbm_maildir_parse_subdirs(mdir);
-
     if (LIBBALSA_MAILBOX_CLASS(libbalsa_mailbox_maildir_parent_class)->check != NULL)
         LIBBALSA_MAILBOX_CLASS(libbalsa_mailbox_maildir_parent_class)->check(mailbox);
 }
@@ -591,6 +1045,7 @@ free_message_info(struct message_info *msg_info)
 	return;
     g_free(msg_info->key);
     g_free(msg_info->filename);
+    lbm_maildir_envelope_free(msg_info->envelope);
     if (msg_info->local_info.message != NULL) {
         libbalsa_message_set_mailbox(msg_info->local_info.message, NULL);
         libbalsa_message_set_msgno(msg_info->local_info.message, 0);
@@ -783,6 +1238,7 @@ libbalsa_mailbox_maildir_sync(LibBalsaMailbox * mailbox, gboolean expunge)
 	libbalsa_mailbox_local_msgno_removed(mailbox, msgno);
 	/* This will free removed: */
 	g_hash_table_remove(mdir->messages_info, msg_info->key);
+	mdir->envelopes_changed = TRUE;
     }
     g_slist_free(removed_list);
     for (msgno = renumber; msgno <= mdir->msgno_2_msg_info->len; msgno++) {
@@ -802,6 +1258,8 @@ libbalsa_mailbox_maildir_sync(LibBalsaMailbox * mailbox, gboolean expunge)
             libbalsa_mailbox_set_mtime(mailbox, st.st_mtime);
     }
 
+    lbm_maildir_cache_save(mdir);
+
     return TRUE;
 }
 
@@ -867,6 +1325,63 @@ lbm_maildir_get_info(LibBalsaMailboxLocal * local, guint msgno)
     return &msg_info->local_info;
 }
 
+/* LibBalsaMailboxLocal load_envelope method: populate the message
+ * from its cached envelope, or read its file and cache the envelope. */
+static gboolean
+lbm_maildir_load_envelope(LibBalsaMailboxLocal * local,
+                          guint msgno,
+                          LibBalsaMessage * message)
+{
+    LibBalsaMailboxMaildir *mdir = LIBBALSA_MAILBOX_MAILDIR(local);
+    struct message_info *msg_info = message_info_from_msgno(mdir, msgno);
+    struct message_envelope *envelope = msg_info->envelope;
+    LibBalsaMessageHeaders *headers;
+
+    if (envelope == NULL) {
+        libbalsa_message_load_envelope(message);
+        /* The length is set only if the header was read to its end;
+         * otherwise the file is read again next time. */
+        if (libbalsa_message_get_length(message) > 0) {
+            msg_info->envelope = lbm_maildir_envelope_new(message);
+            mdir->envelopes_changed = TRUE;
+        }
+        return TRUE;
+    }
+
+    headers = libbalsa_message_get_headers(message);
+    headers->date = envelope->date;
+    if (envelope->from != NULL)
+        headers->from =
+            internet_address_list_parse(libbalsa_parser_options(),
+                                        envelope->from);
+    if (envelope->to != NULL)
+        headers->to_list =
+            internet_address_list_parse(libbalsa_parser_options(),
+                                        envelope->to);
+    if (envelope->dispnotify_to != NULL)
+        headers->dispnotify_to =
+            internet_address_list_parse(libbalsa_parser_options(),
+                                        envelope->dispnotify_to);
+    if (envelope->content_type != NULL)
+        headers->content_type =
+            g_mime_content_type_parse(libbalsa_parser_options(),
+                                      envelope->content_type);
+
+    libbalsa_message_set_subject(message, envelope->subject);
+    libbalsa_message_set_message_id(message, envelope->message_id);
+    libbalsa_message_set_references(message,
+                                    g_list_copy_deep(envelope->references,
+                                                     (GCopyFunc) g_strdup,
+                                                     NULL));
+    libbalsa_message_set_in_reply_to(message,
+                                     g_list_copy_deep(envelope->in_reply_to,
+                                                      (GCopyFunc) g_strdup,
+                                                      NULL));
+    libbalsa_message_set_length(message, envelope->length);
+
+    return TRUE;
+}
+
 /* Called with mailbox locked. */
 static gboolean
 lbm_maildir_add_message(LibBalsaMailboxLocal * local,
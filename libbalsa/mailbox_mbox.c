@@ -24,6 +24,7 @@
 
 
 #include <gmime/gmime-stream-fs.h>
+#include <gmime/gmime-stream-mmap.h>
 
 #include <stdlib.h>
 #include <unistd.h>
@@ -33,6 +34,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "libbalsa.h"
 #include "libbalsa_private.h"
@@ -46,6 +48,20 @@
 
 /* #define DEBUG_SEEK TRUE */
 
+/* Envelope data cached in the index file, so that a message can be
+ * shown in the index and threaded without parsing it. */
+struct message_envelope {
+    gint64 date;
+    gchar *from;                /* RFC 2822 address lists */
+    gchar *to;
+    gchar *dispnotify_to;       /* Disposition-Notification-To */
+    gchar *subject;
+    gchar *content_type;        /* Content-Type header value */
+    gchar *message_id;
+    GList *references;
+    GList *in_reply_to;
+};
+
 struct message_info {
     LibBalsaMailboxLocalMessageInfo local_info;
     LibBalsaMessageFlag orig_flags;     /* Has only real flags */
@@ -55,6 +71,7 @@ struct message_info {
     off_t mime_version;		/* Offset of the "MIME-Version:" header. */
     off_t end;
     size_t from_len;
+    struct message_envelope *envelope;
 };
 
 #define REAL_FLAGS(flags) ((flags) & LIBBALSA_MESSAGE_FLAGS_REAL)
@@ -82,6 +99,12 @@ static gboolean libbalsa_mailbox_mbox_sync(LibBalsaMailbox * mailbox,
 static LibBalsaMailboxLocalMessageInfo
     *lbm_mbox_get_info(LibBalsaMailboxLocal * local, guint msgno);
 static LibBalsaMailboxLocalAddMessageFunc lbm_mbox_add_message;
+static guint lbm_mbox_add_messages(LibBalsaMailbox * mailbox,
+                                   LibBalsaAddMessageIterator msg_iterator,
+                                   gpointer iter_data, GError ** err);
+static gboolean lbm_mbox_load_envelope(LibBalsaMailboxLocal * local,
+                                       guint msgno,
+                                       LibBalsaMessage * message);
 
 static gboolean
 libbalsa_mailbox_mbox_fetch_message_structure(LibBalsaMailbox * mailbox,
@@ -99,6 +122,9 @@ struct _LibBalsaMailboxMbox {
     GMimeStream *gmime_stream;
     off_t size;
     gboolean messages_info_changed;
+
+    GMimeStream *map_stream;    /* Mapping of the file for reading */
+    GSList *map_streams;        /* All mappings that may be in use */
 };
 
 G_DEFINE_TYPE(LibBalsaMailboxMbox,
@@ -130,6 +156,7 @@ libbalsa_mailbox_mbox_class_init(LibBalsaMailboxMboxClass * klass)
     libbalsa_mailbox_class->total_messages =
 	libbalsa_mailbox_mbox_total_messages;
     libbalsa_mailbox_class->lock_store = libbalsa_mailbox_mbox_lock_store;
+    libbalsa_mailbox_class->add_messages = lbm_mbox_add_messages;
 
     libbalsa_mailbox_local_class->check_files  = lbm_mbox_check_files;
     libbalsa_mailbox_local_class->remove_files =
@@ -137,6 +164,7 @@ libbalsa_mailbox_mbox_class_init(LibBalsaMailboxMboxClass * klass)
 
     libbalsa_mailbox_local_class->get_info = lbm_mbox_get_info;
     libbalsa_mailbox_local_class->add_message = lbm_mbox_add_message;
+    libbalsa_mailbox_local_class->load_envelope = lbm_mbox_load_envelope;
     object_class->dispose = libbalsa_mailbox_mbox_dispose;
 }
 
@@ -251,22 +279,180 @@ message_info_from_msgno(LibBalsaMailboxMbox * mbox, guint msgno)
                                                      msgno - 1);
 }
 
+/*
+ * Memory-mapped access.
+ *
+ * Messages are read through substreams of a read-only mapping of the
+ * mbox file, so that readers neither copy the data nor contend for the
+ * lock on the shared stream.  A mapping covers the file as it was when
+ * it was made; when a message lies beyond it, we make a new one, and the
+ * old one lives on as long as any substream of it does.
+ *
+ * When the file is rewritten or truncated, every page beyond the first
+ * changed offset in every mapping that is still in use is replaced by
+ * an anonymous zero page: a stale substream then reads garbage instead
+ * of faulting on a page beyond the end of the file.  The current mapping
+ * is dropped, and the rewritten messages get streams on a new one.
+ *
+ * Another program may truncate the file behind our back, so a mapping
+ * is handed out only with the mailbox locked, after checking the size
+ * of the file: when it has shrunk, the mappings are treated as above,
+ * and messages are read through the shared stream, which just comes up
+ * short, until the mailbox has been checked again.
+ */
+
+static GMutex lbm_mbox_map_mutex;
+
+/* Forget mappings that nobody but us is using; call with the mutex
+ * held. */
+static void
+lbm_mbox_map_prune(LibBalsaMailboxMbox * mbox)
+{
+    GSList *list;
+
+    list = mbox->map_streams;
+    while (list != NULL) {
+        GSList *next = list->next;
+        GObject *object = list->data;
+
+        if (object != (GObject *) mbox->map_stream
+            && g_atomic_int_get(&object->ref_count) == 1) {
+            mbox->map_streams = g_slist_delete_link(mbox->map_streams, list);
+            g_object_unref(object);
+        }
+        list = next;
+    }
+}
+
+static void lbm_mbox_map_invalidate(LibBalsaMailboxMbox * mbox,
+                                    off_t offset);
+
+/* Return a new reference to a mapping that includes offset end, or
+ * NULL if the file cannot be mapped; call with the mailbox locked. */
+static GMimeStream *
+lbm_mbox_map_get(LibBalsaMailboxMbox * mbox, off_t end)
+{
+    GMimeStream *stream;
+    struct stat st;
+
+    if (fstat(GMIME_STREAM_FS(mbox->gmime_stream)->fd, &st) != 0)
+        return NULL;
+    if (st.st_size < mbox->size) {
+        /* Another program has truncated the file. */
+        lbm_mbox_map_invalidate(mbox, st.st_size);
+        return NULL;
+    }
+
+    g_mutex_lock(&lbm_mbox_map_mutex);
+
+    if (mbox->map_stream != NULL
+        && (off_t) GMIME_STREAM_MMAP(mbox->map_stream)->maplen < end)
+        /* The file has grown since we mapped it. */
+        mbox->map_stream = NULL;
+
+    if (mbox->map_stream == NULL && end <= mbox->size) {
+        int fd;
+
+        lbm_mbox_map_prune(mbox);
+        /* The mmap stream owns its file descriptor. */
+        fd = dup(GMIME_STREAM_FS(mbox->gmime_stream)->fd);
+        if (fd >= 0) {
+            mbox->map_stream =
+                g_mime_stream_mmap_new_with_bounds(fd, PROT_READ, MAP_SHARED,
+                                                   0, mbox->size);
+            if (mbox->map_stream != NULL)
+                mbox->map_streams =
+                    g_slist_prepend(mbox->map_streams, mbox->map_stream);
+            else
+                close(fd);
+        }
+    }
+
+    stream = mbox->map_stream != NULL ?
+        g_object_ref(mbox->map_stream) : NULL;
+
+    g_mutex_unlock(&lbm_mbox_map_mutex);
+
+    return stream;
+}
+
+/* The file is about to be changed from offset onwards: make sure that
+ * no mapping can fault, and stop using the current one. */
+static void
+lbm_mbox_map_invalidate(LibBalsaMailboxMbox * mbox, off_t offset)
+{
+    gsize page_size = sysconf(_SC_PAGESIZE);
+    GSList *list;
+
+    g_mutex_lock(&lbm_mbox_map_mutex);
+
+    mbox->map_stream = NULL;
+    lbm_mbox_map_prune(mbox);
+
+    for (list = mbox->map_streams; list != NULL; list = list->next) {
+        GMimeStreamMmap *mstream = list->data;
+        gsize start = (offset + page_size - 1) / page_size * page_size;
+
+        if (start < mstream->maplen
+            && mmap(mstream->map + start, mstream->maplen - start,
+                    PROT_READ, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS,
+                    -1, 0) == MAP_FAILED)
+            g_warning("%s: could not replace mapping: %s", __func__,
+                      g_strerror(errno));
+    }
+
+    g_mutex_unlock(&lbm_mbox_map_mutex);
+}
+
+static void
+lbm_mbox_map_free(LibBalsaMailboxMbox * mbox)
+{
+    g_mutex_lock(&lbm_mbox_map_mutex);
+    mbox->map_stream = NULL;
+    g_slist_free_full(mbox->map_streams, g_object_unref);
+    mbox->map_streams = NULL;
+    g_mutex_unlock(&lbm_mbox_map_mutex);
+}
+
 static GMimeStream *
 libbalsa_mailbox_mbox_get_message_stream(LibBalsaMailbox * mailbox,
                                          guint msgno, gboolean peek)
 {
     LibBalsaMailboxMbox *mbox;
     struct message_info *msg_info;
+    GMimeStream *map_stream;
+    GMimeStream *stream;
 
     mbox = LIBBALSA_MAILBOX_MBOX(mailbox);
     msg_info = message_info_from_msgno(mbox, msgno);
 
-    if (!msg_info || !lbm_mbox_seek_to_message(mbox, msg_info->start))
+    if (!msg_info)
         return NULL;
 
-    return g_mime_stream_substream(mbox->gmime_stream,
-                                   msg_info->start + msg_info->from_len,
-                                   msg_info->end);
+    libbalsa_lock_mailbox(mailbox);
+    map_stream = lbm_mbox_map_get(mbox, msg_info->end);
+    if (map_stream == NULL) {
+        libbalsa_unlock_mailbox(mailbox);
+        /* Fall back to the shared stream. */
+        if (!lbm_mbox_seek_to_message(mbox, msg_info->start))
+            return NULL;
+
+        return g_mime_stream_substream(mbox->gmime_stream,
+                                       msg_info->start + msg_info->from_len,
+                                       msg_info->end);
+    }
+
+    if (strncmp(GMIME_STREAM_MMAP(map_stream)->map + msg_info->start,
+                "From ", 5) != 0)
+        stream = NULL;
+    else
+        stream = g_mime_stream_substream(map_stream,
+                                         msg_info->start + msg_info->from_len,
+                                         msg_info->end);
+    libbalsa_unlock_mailbox(mailbox);
+    g_object_unref(map_stream);
+
+    return stream;
 }
 
 static void
@@ -343,6 +529,333 @@ lbm_mbox_get_cache_filename(LibBalsaMailboxMbox * mbox)
     return filename;
 }
 
+/*
+ * The index file.
+ *
+ * All integers are stored in network (big-endian) byte order, so the
+ * file can be shared between architectures.  The file begins with a
+ * header:
+ *
+ *   magic        8 bytes, LBM_MBOX_INDEX_MAGIC
+ *   version      guint32
+ *   count        guint32, number of records
+ *   mbox size    gint64, size of the mbox file when the index was saved
+ *   mbox mtime   gint64, its modification time
+ *
+ * followed by one record per message:
+ *
+ *   start, end, status, x_status, mime_version     gint64
+ *   from_len, orig_flags, flags                    guint32
+ *   has_envelope                                   guint32
+ *   and if has_envelope is nonzero:
+ *     date                                         gint64
+ *     from, to, dispnotify_to, subject,
+ *     content_type, message_id                     string
+ *     references, in_reply_to                      string list
+ *
+ * A string is a guint32 length followed by that many bytes, with
+ * G_MAXUINT32 standing for NULL; a string list is a guint32 count
+ * followed by that many strings.
+ */
+
+#define LBM_MBOX_INDEX_MAGIC   "BalsaMbx"
+#define LBM_MBOX_INDEX_VERSION 2
+#define LBM_MBOX_NULL_STRING   G_MAXUINT32
+
+static void
+lbm_mbox_envelope_free(struct message_envelope *envelope)
+{
+    if (envelope == NULL)
+        return;
+
+    g_free(envelope->from);
+    g_free(envelope->to);
+    g_free(envelope->dispnotify_to);
+    g_free(envelope->subject);
+    g_free(envelope->content_type);
+    g_free(envelope->message_id);
+    g_list_free_full(envelope->references, g_free);
+    g_list_free_full(envelope->in_reply_to, g_free);
+    g_free(envelope);
+}
+
+/* Save the envelope data of a freshly parsed message. */
+static struct message_envelope *
+lbm_mbox_envelope_new(LibBalsaMessage * message)
+{
+    struct message_envelope *envelope;
+    LibBalsaMessageHeaders *headers;
+
+    headers = libbalsa_message_get_headers(message);
+
+    envelope = g_new0(struct message_envelope, 1);
+    envelope->date = headers->date;
+    if (headers->from != NULL)
+        envelope->from =
+            internet_address_list_to_string(headers->from, NULL, TRUE);
+    if (headers->to_list != NULL)
+        envelope->to =
+            internet_address_list_to_string(headers->to_list, NULL, TRUE);
+    if (headers->dispnotify_to != NULL)
+        envelope->dispnotify_to =
+            internet_address_list_to_string(headers->dispnotify_to, NULL,
+                                            TRUE);
+    if (headers->content_type != NULL)
+        envelope->content_type =
+            g_mime_content_type_encode(headers->content_type, NULL);
+    envelope->subject = g_strdup(libbalsa_message_get_subject_raw(message));
+    envelope->message_id =
+        g_strdup(libbalsa_message_get_message_id(message));
+    envelope->references =
+        g_list_copy_deep(libbalsa_message_get_references(message),
+                         (GCopyFunc) g_strdup, NULL);
+    envelope->in_reply_to =
+        g_list_copy_deep(libbalsa_message_get_in_reply_to(message),
+                         (GCopyFunc) g_strdup, NULL);
+
+    return envelope;
+}
+
+/* Writing the index. */
+
+static void
+lbm_mbox_index_put_uint32(GByteArray * data, guint32 value)
+{
+    value = GUINT32_TO_BE(value);
+    g_byte_array_append(data, (guint8 *) &value, sizeof value);
+}
+
+static void
+lbm_mbox_index_put_int64(GByteArray * data, gint64 value)
+{
+    guint64 tmp = GUINT64_TO_BE((guint64) value);
+    g_byte_array_append(data, (guint8 *) &tmp, sizeof tmp);
+}
+
+static void
+lbm_mbox_index_put_string(GByteArray * data, const gchar * str)
+{
+    guint32 len;
+
+    if (str == NULL) {
+        lbm_mbox_index_put_uint32(data, LBM_MBOX_NULL_STRING);
+        return;
+    }
+
+    len = strlen(str);
+    lbm_mbox_index_put_uint32(data, len);
+    g_byte_array_append(data, (guint8 *) str, len);
+}
+
+static void
+lbm_mbox_index_put_list(GByteArray * data, GList * list)
+{
+    lbm_mbox_index_put_uint32(data, g_list_length(list));
+    for (; list != NULL; list = list->next)
+        lbm_mbox_index_put_string(data, list->data);
+}
+
+static void
+lbm_mbox_index_put_record(GByteArray * data,
+                          struct message_info *msg_info)
+{
+    struct message_envelope *envelope = msg_info->envelope;
+
+    lbm_mbox_index_put_int64(data, msg_info->start);
+    lbm_mbox_index_put_int64(data, msg_info->end);
+    lbm_mbox_index_put_int64(data, msg_info->status);
+    lbm_mbox_index_put_int64(data, msg_info->x_status);
+    lbm_mbox_index_put_int64(data, msg_info->mime_version);
+    lbm_mbox_index_put_uint32(data, msg_info->from_len);
+    lbm_mbox_index_put_uint32(data, msg_info->orig_flags);
+    lbm_mbox_index_put_uint32(data, msg_info->local_info.flags);
+
+    lbm_mbox_index_put_uint32(data, envelope != NULL);
+    if (envelope == NULL)
+        return;
+
+    lbm_mbox_index_put_int64(data, envelope->date);
+    lbm_mbox_index_put_string(data, envelope->from);
+    lbm_mbox_index_put_string(data, envelope->to);
+    lbm_mbox_index_put_string(data, envelope->dispnotify_to);
+    lbm_mbox_index_put_string(data, envelope->subject);
+    lbm_mbox_index_put_string(data, envelope->content_type);
+    lbm_mbox_index_put_string(data, envelope->message_id);
+    lbm_mbox_index_put_list(data, envelope->references);
+    lbm_mbox_index_put_list(data, envelope->in_reply_to);
+}
+
+/* Reading the index; any attempt to read beyond the end of the data
+ * sets reader->error, after which all reads return zero or NULL. */
+
+typedef struct {
+    const guint8 *pos;
+    const guint8 *end;
+    gboolean error;
+} LbmMboxIndexReader;
+
+static gboolean
+lbm_mbox_index_has(LbmMboxIndexReader * reader, gsize len)
+{
+    if (reader->error || (gsize) (reader->end - reader->pos) < len)
+        reader->error = TRUE;
+
+    return !reader->error;
+}
+
+static guint32
+lbm_mbox_index_get_uint32(LbmMboxIndexReader * reader)
+{
+    guint32 value;
+
+    if (!lbm_mbox_index_has(reader, sizeof value))
+        return 0;
+
+    memcpy(&value, reader->pos, sizeof value);
+    reader->pos += sizeof value;
+
+    return GUINT32_FROM_BE(value);
+}
+
+static gint64
+lbm_mbox_index_get_int64(LbmMboxIndexReader * reader)
+{
+    guint64 value;
+
+    if (!lbm_mbox_index_has(reader, sizeof value))
+        return 0;
+
+    memcpy(&value, reader->pos, sizeof value);
+    reader->pos += sizeof value;
+
+    return (gint64) GUINT64_FROM_BE(value);
+}
+
+/* Returns a newly allocated string, or NULL; if str is NULL, the
+ * string is just skipped. */
+static void
+lbm_mbox_index_get_string(LbmMboxIndexReader * reader, gchar ** str)
+{
+    guint32 len;
+
+    len = lbm_mbox_index_get_uint32(reader);
+    if (len == LBM_MBOX_NULL_STRING || !lbm_mbox_index_has(reader, len)) {
+        if (str != NULL)
+            *str = NULL;
+        return;
+    }
+
+    if (str != NULL)
+        *str = g_strndup((const gchar *) reader->pos, len);
+    reader->pos += len;
+}
+
+static void
+lbm_mbox_index_get_list(LbmMboxIndexReader * reader, GList ** list)
+{
+    guint32 count;
+
+    count = lbm_mbox_index_get_uint32(reader);
+    if (list != NULL)
+        *list = NULL;
+
+    while (count-- > 0 && !reader->error) {
+        gchar *str;
+
+        lbm_mbox_index_get_string(reader, list != NULL ? &str : NULL);
+        if (list != NULL && str != NULL)
+            *list = g_list_prepend(*list, str);
+    }
+
+    if (list != NULL)
+        *list = g_list_reverse(*list);
+}
+
+/* Read one record into msg_info; the envelope is read only if
+ * want_envelope is TRUE, otherwise msg_info->envelope is NULL. */
+static gboolean
+lbm_mbox_index_get_record(LbmMboxIndexReader * reader,
+                          struct message_info *msg_info,
+                          gboolean want_envelope)
+{
+    struct message_envelope *envelope = NULL;
+
+    msg_info->local_info.message = NULL;
+    msg_info->local_info.loaded  = FALSE;
+    msg_info->start        = lbm_mbox_index_get_int64(reader);
+    msg_info->end          = lbm_mbox_index_get_int64(reader);
+    msg_info->status       = lbm_mbox_index_get_int64(reader);
+    msg_info->x_status     = lbm_mbox_index_get_int64(reader);
+    msg_info->mime_version = lbm_mbox_index_get_int64(reader);
+    msg_info->from_len     = lbm_mbox_index_get_uint32(reader);
+    msg_info->orig_flags   = lbm_mbox_index_get_uint32(reader);
+    msg_info->local_info.flags = lbm_mbox_index_get_uint32(reader);
+
+    if (lbm_mbox_index_get_uint32(reader) != 0) {
+        GList **references = NULL;
+        GList **in_reply_to = NULL;
+        gint64 date;
+
+        if (want_envelope) {
+            envelope = g_new0(struct message_envelope, 1);
+            references = &envelope->references;
+            in_reply_to = &envelope->in_reply_to;
+        }
+
+        date = lbm_mbox_index_get_int64(reader);
+        lbm_mbox_index_get_string(reader, envelope ? &envelope->from : NULL);
+        lbm_mbox_index_get_string(reader, envelope ? &envelope->to : NULL);
+        lbm_mbox_index_get_string(reader,
+                                  envelope ? &envelope->dispnotify_to : NULL);
+        lbm_mbox_index_get_string(reader,
+                                  envelope ? &envelope->subject : NULL);
+        lbm_mbox_index_get_string(reader,
+                                  envelope ? &envelope->content_type : NULL);
+        lbm_mbox_index_get_string(reader,
+                                  envelope ? &envelope->message_id : NULL);
+        lbm_mbox_index_get_list(reader, references);
+        lbm_mbox_index_get_list(reader, in_reply_to);
+
+        if (envelope != NULL)
+            envelope->date = date;
+    }
+
+    if (reader->error) {
+        lbm_mbox_envelope_free(envelope);
+        envelope = NULL;
+    }
+    msg_info->envelope = envelope;
+
+    return !reader->error;
+}
+
+/* Check the header of the index file; on success, reader is positioned
+ * at the first record. */
+static gboolean
+lbm_mbox_index_get_header(LbmMboxIndexReader * reader,
+                          const gchar * contents, gsize length,
+                          guint * count, off_t * size, time_t * mtime)
+{
+    reader->pos   = (const guint8 *) contents;
+    reader->end   = reader->pos + length;
+    reader->error = FALSE;
+
+    if (!lbm_mbox_index_has(reader, strlen(LBM_MBOX_INDEX_MAGIC))
+        || memcmp(reader->pos, LBM_MBOX_INDEX_MAGIC,
+                  strlen(LBM_MBOX_INDEX_MAGIC)) != 0)
+        return FALSE;
+    reader->pos += strlen(LBM_MBOX_INDEX_MAGIC);
+
+    if (lbm_mbox_index_get_uint32(reader) != LBM_MBOX_INDEX_VERSION)
+        return FALSE;
+
+    *count = lbm_mbox_index_get_uint32(reader);
+    *size  = lbm_mbox_index_get_int64(reader);
+    *mtime = lbm_mbox_index_get_int64(reader);
+
+    return !reader->error;
+}
+
 static void
 lbm_mbox_save(LibBalsaMailboxMbox * mbox)
 {
@@ -359,25 +872,29 @@ lbm_mbox_save(LibBalsaMailboxMbox * mbox)
     filename = lbm_mbox_get_cache_filename(mbox);
 
     if (mbox->msgno_2_msg_info->len > 0) {
-        GArray *messages_info =
-            g_array_sized_new(FALSE, FALSE, sizeof(struct message_info), 
-                              mbox->msgno_2_msg_info->len);
+        GByteArray *data = g_byte_array_new();
         guint msgno;
 #if defined(__APPLE__)
         gchar *template;
         gint fd;
 #endif                          /* !defined(__APPLE__) */
 
-        for (msgno = 1; msgno <= mbox->msgno_2_msg_info->len; msgno++) {
-            struct message_info *msg_info =
-                message_info_from_msgno(mbox, msgno);
-            g_array_append_val(messages_info, *msg_info);
-        }
+        g_byte_array_append(data, (guint8 *) LBM_MBOX_INDEX_MAGIC,
+                            strlen(LBM_MBOX_INDEX_MAGIC));
+        lbm_mbox_index_put_uint32(data, LBM_MBOX_INDEX_VERSION);
+        lbm_mbox_index_put_uint32(data, mbox->msgno_2_msg_info->len);
+        lbm_mbox_index_put_int64(data, mbox->size);
+        lbm_mbox_index_put_int64(data,
+                                 libbalsa_mailbox_get_mtime
+                                 (LIBBALSA_MAILBOX(mbox)));
+
+        for (msgno = 1; msgno <= mbox->msgno_2_msg_info->len; msgno++)
+            lbm_mbox_index_put_record(data,
+                                      message_info_from_msgno(mbox, msgno));
 
 #if !defined(__APPLE__)
-        if (!g_file_set_contents(filename, messages_info->data,
-                                 messages_info->len
-                                 * sizeof(struct message_info), &err)) {
+        if (!g_file_set_contents(filename, (gchar *) data->data,
+                                 data->len, &err)) {
             libbalsa_information(LIBBALSA_INFORMATION_WARNING,
                                  _("Could not write file %s: %s"),
                                  filename, err->message);
@@ -386,17 +903,15 @@ lbm_mbox_save(LibBalsaMailboxMbox * mbox)
 #else                           /* !defined(__APPLE__) */
         template = g_strconcat(filename, ":XXXXXX", NULL);
         fd = g_mkstemp(template);
-        if (fd < 0 || write(fd, messages_info->data,
-                            messages_info->len *
-                            sizeof(struct message_info)) <
-            (ssize_t) messages_info->len) {
+        if (fd < 0 || write(fd, data->data, data->len) <
+            (ssize_t) data->len) {
             libbalsa_information(LIBBALSA_INFORMATION_WARNING,
                                  _("Failed to create temporary file "
                                    "“%s”: %s"), template,
                                  strerror(errno));
             g_free(template);
             g_free(filename);
-            g_array_free(messages_info, TRUE);
+            g_byte_array_free(data, TRUE);
             return;
         }
         if (close(fd) != 0
@@ -408,8 +923,8 @@ lbm_mbox_save(LibBalsaMailboxMbox * mbox)
                                  filename, strerror(errno), template);
         g_free(template);
 #endif                          /* !defined(__APPLE__) */
-        g_array_free(messages_info, TRUE);
-    } else if (unlink(filename) < 0)
+        g_byte_array_free(data, TRUE);
+    } else if (unlink(filename) < 0 && errno != ENOENT)
         libbalsa_information(LIBBALSA_INFORMATION_WARNING,
                              _("Could not unlink file %s: %s"),
                              filename, strerror(errno));
@@ -496,6 +1011,7 @@ parse_mailbox(LibBalsaMailboxMbox * mbox)
             continue;
 
         msg_info.local_info.flags = msg_info.orig_flags;
+        msg_info.envelope = lbm_mbox_envelope_new(msg);
         g_ptr_array_add(mbox->msgno_2_msg_info,
                         g_memdup(&msg_info, sizeof(msg_info)));
         mbox->messages_info_changed = TRUE;
@@ -520,88 +1036,96 @@ parse_mailbox(LibBalsaMailboxMbox * mbox)
     }
 
     g_object_unref(gmime_parser);
-    lbm_mbox_save(mbox);
 }
 
+/* Restore the message info from the index file.
+ *
+ * If the mbox file has not changed since the index was saved, every
+ * record is used as is.  If the file has grown, we assume that
+ * messages were appended, check that each indexed message is still
+ * where we expect, and the caller parses only the new tail.  If the
+ * file has shrunk or was rewritten in place, the index is useless.
+ */
 static void
 lbm_mbox_restore(LibBalsaMailboxMbox * mbox)
 {
     gchar *filename;
-    struct stat st;
     gchar *contents;
     gsize length;
+    LbmMboxIndexReader reader;
+    guint count;
+    guint i;
+    off_t index_size;
+    time_t index_mtime;
+    gboolean unchanged;
     off_t end;
-    struct message_info *msg_info;
     GMimeStream *mbox_stream;
 
     filename = lbm_mbox_get_cache_filename(mbox);
-    if (stat(filename, &st) < 0 
-        || st.st_mtime < libbalsa_mailbox_get_mtime(LIBBALSA_MAILBOX(mbox))
-        || !g_file_get_contents(filename, &contents, &length, NULL)) {
-        /* No cache file, stale cache, or read error. */
+    if (!g_file_get_contents(filename, &contents, &length, NULL)) {
+        /* No cache file, or read error. */
         g_free(filename);
         return;
     }
 
     g_free(filename);
 
-    if (length < sizeof(struct message_info)) {
-        /* Error: file always contains at least one record. */
+    if (!lbm_mbox_index_get_header(&reader, contents, length,
+                                   &count, &index_size, &index_mtime)
+        || index_size > mbox->size
+        || (index_size == mbox->size
+            && index_mtime != libbalsa_mailbox_get_mtime(LIBBALSA_MAILBOX(mbox)))) {
+        /* Old format, or the file was truncated or rewritten. */
         g_free(contents);
+        mbox->messages_info_changed = TRUE;
         return;
     }
+    unchanged = index_size == mbox->size;
 
 #ifdef DEBUG
-    g_print("%s: %s file has %zd messages\n", __func__,
-            LIBBALSA_MAILBOX(mbox)->name,
-            length / sizeof(struct message_info));
+    g_print("%s: %s file has %u messages\n", __func__,
+            LIBBALSA_MAILBOX(mbox)->name, count);
 #endif
 
-    msg_info = (struct message_info *) contents;
-
-    if (msg_info->start != 0) {
-        /* Error: first message should start at 0. */
-        g_free(contents);
-        return;
-    }
-
     end = 0;
-    do {
-        msg_info->local_info.message = NULL;
-        msg_info->local_info.loaded  = FALSE;
-        if (msg_info->start != end)
+    for (i = 0; i < count; i++) {
+        struct message_info msg_info;
+
+        if (!lbm_mbox_index_get_record(&reader, &msg_info, TRUE))
+            /* Error: truncated file. */
+            break;
+        if (msg_info.start != end
             /* Error: this message doesn't start at the end of the
              * previous one. */
-            break;
-        end = msg_info->end;
-        if (msg_info->from_len < 6
-            || (off_t) (msg_info->start + msg_info->from_len) >= end
-            || end > mbox->size)
+            || msg_info.from_len < 6
+            || (off_t) (msg_info.start + msg_info.from_len) >= msg_info.end
+            || msg_info.end > mbox->size
             /* Error: various. */
-            break;
-        if (end < mbox->size
-            && !lbm_mbox_seek_to_message(mbox, msg_info->end))
+            || (!unchanged && msg_info.end < mbox->size
+                && !lbm_mbox_seek_to_message(mbox, msg_info.end))) {
             /* Error: no message following this one. */
+            lbm_mbox_envelope_free(msg_info.envelope);
             break;
+        }
+        end = msg_info.end;
         g_ptr_array_add(mbox->msgno_2_msg_info,
-                        g_memdup(msg_info, sizeof *msg_info));
-    } while (++msg_info < (struct message_info *) (contents + length));
+                        g_memdup(&msg_info, sizeof msg_info));
+    }
+
+    if (i < count)
+        /* We did not use the whole file. */
+        mbox->messages_info_changed = TRUE;
 
 #ifdef DEBUG
-    g_print("%s: %s restored %zd messages\n", __func__,
-            LIBBALSA_MAILBOX(mbox)->name,
-            msg_info - (struct message_info *) contents);
+    g_print("%s: %s restored %u messages\n", __func__,
+            LIBBALSA_MAILBOX(mbox)->name, mbox->msgno_2_msg_info->len);
 #endif
 
     mbox_stream = mbox->gmime_stream;
     libbalsa_mime_stream_shared_lock(mbox_stream);
-    /* Position the stream for parsing; msg_info is pointing either one
-     * message beyond the end of the array, or at the offending message,
-     * so we just seek to the end of the previous message. */
-    g_mime_stream_seek(mbox_stream,
-                       msg_info > (struct message_info *) contents ?
-                       (--msg_info)->end : 0,
-                       GMIME_STREAM_SEEK_SET);
+    /* Position the stream for parsing at the end of the last restored
+     * message. */
+    g_mime_stream_seek(mbox_stream, end, GMIME_STREAM_SEEK_SET);
 
     /* GMimeParser seems to have issues with a file that has no From_
      * line, so we'll step forward until we find one. */
@@ -634,6 +1158,7 @@ free_message_info(struct message_info *msg_info)
         msg_info->local_info.message = NULL;
     }
 
+    lbm_mbox_envelope_free(msg_info->envelope);
     g_free(msg_info);
 }
 
@@ -703,6 +1228,7 @@ libbalsa_mailbox_mbox_open(LibBalsaMailbox * mailbox, GError **err)
         lbm_mbox_restore(mbox);
         parse_mailbox(mbox);
     }
+    lbm_mbox_save(mbox);
 
     mbox_unlock(mailbox, gmime_stream);
     libbalsa_mime_stream_shared_unlock(gmime_stream);
@@ -785,7 +1311,11 @@ lbm_mbox_check_cache(LibBalsaMailboxMbox * mbox,
     gboolean tmp;
     gchar *contents;
     gsize length;
-    struct message_info *msg_info;
+    LbmMboxIndexReader reader;
+    guint count;
+    off_t index_size;
+    time_t index_mtime;
+    off_t end;
     gboolean retval = FALSE;
 
     filename = lbm_mbox_get_cache_filename(mbox);
@@ -794,28 +1324,42 @@ lbm_mbox_check_cache(LibBalsaMailboxMbox * mbox,
     if (!tmp)
         return retval;
 
-    for (msg_info = (struct message_info *) contents;
-         msg_info < (struct message_info *) (contents + length);
-         msg_info++) {
-        if (lbm_mbox_seek(buffer, msg_info->status) >= 0
+    if (!lbm_mbox_index_get_header(&reader, contents, length,
+                                   &count, &index_size, &index_mtime)) {
+        g_free(contents);
+        return retval;
+    }
+
+    end = 0;
+    while (count-- > 0) {
+        struct message_info msg_info;
+
+        if (!lbm_mbox_index_get_record(&reader, &msg_info, FALSE))
+            break;
+
+        if (lbm_mbox_seek(buffer, msg_info.status) >= 0
             && lbm_mbox_readln(buffer, line)) {
             if (g_ascii_strncasecmp((gchar *) line->data,
                                     "Status: ", 8) != 0)
                 /* Bad cache. */
                 break;
-            if (strchr((gchar *) line->data + 8, 'R'))
+            if (strchr((gchar *) line->data + 8, 'R')) {
                 /* Message has been read. */
+                end = msg_info.end;
                 continue;
+            }
         }
-        if (lbm_mbox_seek(buffer, msg_info->x_status) >= 0
+        if (lbm_mbox_seek(buffer, msg_info.x_status) >= 0
             && lbm_mbox_readln(buffer, line)) {
             if (g_ascii_strncasecmp((gchar *) line->data,
                                     "X-Status: ", 10) != 0)
                 /* Bad cache. */
                 break;
-            if (strchr((gchar *) line->data + 10, 'D'))
+            if (strchr((gchar *) line->data + 10, 'D')) {
                 /* Message has been read. */
+                end = msg_info.end;
                 continue;
+            }
         }
         /* Message is unread and undeleted. */
         retval = TRUE;
@@ -823,10 +1367,8 @@ lbm_mbox_check_cache(LibBalsaMailboxMbox * mbox,
     }
     if (!retval)
         /* Seek to the end of the last message we checked. */
-        lbm_mbox_seek(buffer, msg_info > (struct message_info *) contents ?
-                      (msg_info-1)->end : 0);
-    g_free(contents); /* msg_info points to contents, cannot free too early */
-
+        lbm_mbox_seek(buffer, end);
+    g_free(contents);
 
     return retval;
 }
@@ -969,6 +1511,10 @@ libbalsa_mailbox_mbox_check(LibBalsaMailbox * mailbox)
 
     libbalsa_mailbox_set_mtime(mailbox, st.st_mtime);
 
+    if (st.st_size < mbox->size)
+        /* Another program has truncated the file. */
+        lbm_mbox_map_invalidate(mbox, st.st_size);
+
     if (!MAILBOX_OPEN(mailbox)) {
 	libbalsa_mailbox_set_unread_messages_flag(mailbox,
 						  lbm_mbox_check(mailbox,
@@ -1070,6 +1616,7 @@ libbalsa_mailbox_mbox_check(LibBalsaMailbox * mailbox)
     g_print("%s %s set size from tell %d\n", __func__, mailbox->name,
             mbox->size);
 #endif
+    lbm_mbox_save(mbox);
     libbalsa_mime_stream_shared_unlock(mbox_stream);
     mbox_unlock(mailbox, mbox_stream);
 
@@ -1097,6 +1644,7 @@ libbalsa_mailbox_mbox_close_mailbox(LibBalsaMailbox * mailbox,
                                                             expunge);
 
     /* Now it's safe to close the stream and free the message info. */
+    lbm_mbox_map_free(mbox);
     if (mbox->gmime_stream) {
         g_object_unref(mbox->gmime_stream);
         mbox->gmime_stream = NULL;
@@ -1566,6 +2114,7 @@ libbalsa_mailbox_mbox_sync(LibBalsaMailbox * mailbox, gboolean expunge)
     }
 
     save_failed = TRUE;
+    lbm_mbox_map_invalidate(mbox, offset);
     libbalsa_mime_stream_shared_lock(mbox_stream);
     if (g_mime_stream_reset(temp_stream) == -1) {
         g_warning("mbox_sync: can't rewind temporary copy.\n");
@@ -1727,6 +2276,57 @@ lbm_mbox_get_info(LibBalsaMailboxLocal * local, guint msgno)
     return &msg_info->local_info;
 }
 
+/* LibBalsaMailboxLocal load_envelope method: populate the message
+ * from the envelope data in the index file, if we have it. */
+static gboolean
+lbm_mbox_load_envelope(LibBalsaMailboxLocal * local,
+                       guint msgno,
+                       LibBalsaMessage * message)
+{
+    LibBalsaMailboxMbox *mbox = LIBBALSA_MAILBOX_MBOX(local);
+    struct message_info *msg_info = message_info_from_msgno(mbox, msgno);
+    struct message_envelope *envelope = msg_info->envelope;
+    LibBalsaMessageHeaders *headers;
+
+    if (envelope == NULL)
+        return FALSE;
+
+    headers = libbalsa_message_get_headers(message);
+    headers->date = envelope->date;
+    if (envelope->from != NULL)
+        headers->from =
+            internet_address_list_parse(libbalsa_parser_options(),
+                                        envelope->from);
+    if (envelope->to != NULL)
+        headers->to_list =
+            internet_address_list_parse(libbalsa_parser_options(),
+                                        envelope->to);
+    if (envelope->dispnotify_to != NULL)
+        headers->dispnotify_to =
+            internet_address_list_parse(libbalsa_parser_options(),
+                                        envelope->dispnotify_to);
+    if (envelope->content_type != NULL)
+        headers->content_type =
+            g_mime_content_type_parse(libbalsa_parser_options(),
+                                      envelope->content_type);
+
+    libbalsa_message_set_subject(message, envelope->subject);
+    libbalsa_message_set_message_id(message, envelope->message_id);
+    libbalsa_message_set_references(message,
+                                    g_list_copy_deep(envelope->references,
+                                                     (GCopyFunc) g_strdup,
+                                                     NULL));
+    libbalsa_message_set_in_reply_to(message,
+                                     g_list_copy_deep(envelope->in_reply_to,
+                                                      (GCopyFunc) g_strdup,
+                                                      NULL));
+    libbalsa_message_set_length(message,
+                                msg_info->end - (msg_info->start +
+                                                 msg_info->from_len));
+
+    return TRUE;
+}
+
 static gboolean
 libbalsa_mailbox_mbox_fetch_message_structure(LibBalsaMailbox * mailbox,
 					      LibBalsaMessage * message,
@@ -1849,28 +2449,18 @@ lbm_mbox_armored_stream(GMimeStream * stream)
     return fstream;
 }
 
-/* Called with mailbox locked. */
-static gboolean
-lbm_mbox_add_message(LibBalsaMailboxLocal * local,
-                     GMimeStream          * stream,
-                     LibBalsaMessageFlag    flags,
-                     GError              ** err)
+/* The From_ line for a message: the sender's address and the date of
+ * the message. */
+static gchar *
+lbm_mbox_from_line(GMimeStream * stream)
 {
-    LibBalsaMailbox *mailbox = (LibBalsaMailbox *) local;
     LibBalsaMessage *message;
     LibBalsaMessageHeaders *headers;
     gchar date_string[27];
     gchar *sender;
     gchar *address;
     gchar *brack;
-    gchar *from = NULL;
-    const char *path;
-    int fd;
-    GMimeObject *armored_object;
-    GMimeStream *armored_dest;
-    GMimeStream *dest;
-    off_t retval;
-    off_t orig_length;
+    gchar *from;
 
     message = libbalsa_message_new();
     libbalsa_message_load_envelope_from_stream(message, stream);
@@ -1896,7 +2486,19 @@ lbm_mbox_add_message(LibBalsaMailboxLocal * local,
     }
     from = g_strdup_printf ("From %s %s", address, date_string );
     g_free(address);
-    
+
+    return from;
+}
+
+/* Open the mbox file for appending, and check that it is an mbox. */
+static GMimeStream *
+lbm_mbox_append_stream(LibBalsaMailboxLocal * local, GError ** err)
+{
+    const char *path;
+    int fd;
+    GMimeStream *dest;
+    off_t orig_length;
+
     path = libbalsa_mailbox_local_get_path(local);
     /* open in read-write mode */
     fd = open(path, O_RDWR);
@@ -1904,20 +2506,18 @@ lbm_mbox_add_message(LibBalsaMailboxLocal * local,
         g_set_error(err, LIBBALSA_MAILBOX_ERROR,
                     LIBBALSA_MAILBOX_APPEND_ERROR,
                     _("%s: could not open %s."), "MBOX", path);
-        g_free(from);
-        return FALSE;
+        return NULL;
     }
     
     orig_length = lseek (fd, 0, SEEK_END);
     lseek (fd, 0, SEEK_SET);
     dest = g_mime_stream_fs_new (fd);
     if (!dest) {
-	g_free(from);
         g_set_error(err, LIBBALSA_MAILBOX_ERROR,
                     LIBBALSA_MAILBOX_APPEND_ERROR,
                     _("%s: could not get new MIME stream."),
                     "MBOX");
-	return FALSE;
+	return NULL;
     }
     if (orig_length > 0 && !lbm_mbox_stream_seek_to_message(dest, 0)) {
 	g_object_unref(dest);
@@ -1925,10 +2525,27 @@ lbm_mbox_add_message(LibBalsaMailboxLocal * local,
                     LIBBALSA_MAILBOX_APPEND_ERROR,
                     _("%s: %s is not in mbox format."),
                     "MBOX", path);
-	g_free(from);
-	return FALSE;
+	return NULL;
     }
-    mbox_lock ( mailbox, dest );
+
+    return dest;
+}
+
+/* Append one message to dest, which is locked; on failure, truncate the
+ * file to its length before the message. */
+static gboolean
+lbm_mbox_append_message(GMimeStream        * dest,
+                        GMimeStream        * stream,
+                        LibBalsaMessageFlag  flags,
+                        GError            ** err)
+{
+    gchar *from;
+    GMimeObject *armored_object;
+    GMimeStream *armored_dest;
+    off_t retval;
+    off_t orig_length;
+
+    from = lbm_mbox_from_line(stream);
 
     /* From_ armor */
     libbalsa_mime_stream_shared_lock(stream);
@@ -1940,7 +2557,7 @@ lbm_mbox_add_message(LibBalsaMailboxLocal * local,
                                   flags | LIBBALSA_MESSAGE_FLAG_RECENT);
     armored_dest = lbm_mbox_armored_stream(dest);
 
-    retval = g_mime_stream_seek(dest, 0, GMIME_STREAM_SEEK_END);
+    retval = orig_length = g_mime_stream_seek(dest, 0, GMIME_STREAM_SEEK_END);
     if (retval > 0)
         retval = lbm_mbox_newline(dest);
     if (retval < 0
@@ -1955,12 +2572,89 @@ lbm_mbox_add_message(LibBalsaMailboxLocal * local,
     libbalsa_mime_stream_shared_unlock(stream);
     g_object_unref(armored_dest);
 
-    if (retval < 0 && truncate(path, orig_length) < 0)
+    if (retval < 0 && orig_length >= 0
+        && ftruncate(GMIME_STREAM_FS(dest)->fd, orig_length) < 0)
         retval = -2;
+
+    return retval >= 0;
+}
+
+/* Called with mailbox locked. */
+static gboolean
+lbm_mbox_add_message(LibBalsaMailboxLocal * local,
+                     GMimeStream          * stream,
+                     LibBalsaMessageFlag    flags,
+                     GError              ** err)
+{
+    LibBalsaMailbox *mailbox = (LibBalsaMailbox *) local;
+    GMimeStream *dest;
+    gboolean retval;
+
+    if ((dest = lbm_mbox_append_stream(local, err)) == NULL)
+        return FALSE;
+
+    mbox_lock ( mailbox, dest );
+    retval = lbm_mbox_append_message(dest, stream, flags, err);
     mbox_unlock (mailbox, dest);
     g_object_unref(dest);
 
-    return retval >= 0;
+    return retval;
+}
+
+/* LibBalsaMailbox::add_messages: open and lock the file once for all the
+ * messages, and flush it to disk once, when they have all been written.
+ * Messages written before a failure stay in the mailbox; the count of
+ * them is returned.  If they cannot be flushed, none of them is known to
+ * be in the mailbox: they are removed, and 0 is returned.
+ *
+ * Called with mailbox locked. */
+static guint
+lbm_mbox_add_messages(LibBalsaMailbox          * mailbox,
+                      LibBalsaAddMessageIterator msg_iterator,
+                      gpointer                   iter_data,
+                      GError                  ** err)
+{
+    LibBalsaMailboxLocal *local = (LibBalsaMailboxLocal *) mailbox;
+    LibBalsaMessageFlag flags;
+    GMimeStream *stream;
+    GMimeStream *dest;
+    guint cnt = 0;
+    off_t orig_length;
+
+    if ((dest = lbm_mbox_append_stream(local, err)) == NULL)
+        return 0;
+
+    mbox_lock(mailbox, dest);
+    orig_length = g_mime_stream_seek(dest, 0, GMIME_STREAM_SEEK_END);
+    while (msg_iterator(&flags, &stream, iter_data)) {
+        gboolean success;
+
+        success = lbm_mbox_append_message(dest, stream, flags, err);
+        g_object_unref(stream);
+        if (!success)
+            break;
+        cnt++;
+    }
+    if (cnt > 0 && fsync(GMIME_STREAM_FS(dest)->fd) < 0) {
+        int fsync_errno = errno;
+
+        g_clear_error(err);
+        g_set_error(err, LIBBALSA_MAILBOX_ERROR,
+                    LIBBALSA_MAILBOX_APPEND_ERROR,
+                    _("%s: could not flush %s: %s"), "MBOX",
+                    libbalsa_mailbox_local_get_path(local),
+                    g_strerror(fsync_errno));
+        if (orig_length >= 0
+            && ftruncate(GMIME_STREAM_FS(dest)->fd, orig_length) < 0)
+            g_warning("%s: could not truncate %s: %s", __func__,
+                      libbalsa_mailbox_local_get_path(local),
+                      g_strerror(errno));
+        cnt = 0;
+    }
+    mbox_unlock(mailbox, dest);
+    g_object_unref(dest);
+
+    return cnt;
 }
 
 static guint
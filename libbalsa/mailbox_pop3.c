@@ -34,6 +34,7 @@
 #include "misc.h"
 #include "mailbox.h"
 #include "mailbox_pop3.h"
+#include "pop3-uid-store.h"
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
 
@@ -53,6 +54,7 @@ struct _LibBalsaMailboxPOP3 {
     gboolean disable_apop; /* Some servers claim to support it but
                               * they do not. */
     gboolean enable_pipe;  /* ditto */
+    LibBalsaPop3UidStore *uid_store; /* kept open between checks */
 };
 
 static void libbalsa_mailbox_pop3_finalize(GObject * object);
@@ -116,6 +118,7 @@ libbalsa_mailbox_pop3_finalize(GObject * object)
     LibBalsaMailboxPOP3 *mailbox_pop3 = LIBBALSA_MAILBOX_POP3(object);
 
     g_free(mailbox_pop3->filter_cmd);
+    libbalsa_pop3_uid_store_free(mailbox_pop3->uid_store);
 
     G_OBJECT_CLASS(libbalsa_mailbox_pop3_parent_class)->finalize(object);
 }
@@ -142,103 +145,28 @@ libbalsa_mailbox_pop3_open(LibBalsaMailbox * mailbox, GError **err)
 }
 
 
-#define POP_UID_FILE	"/.balsa/pop-uids"
-static GMutex uid_mutex;
-
-
-static GHashTable *
-mp_load_uids(const gchar *prefix)
+/* The UID store of the account, kept open as long as the account stays
+ * the same. */
+static LibBalsaPop3UidStore *
+mp_get_uid_store(LibBalsaMailboxPOP3 *mailbox_pop3,
+                 LibBalsaServer      *server,
+                 GError             **error)
 {
-	GHashTable *res;
-	gboolean read_res;
-	gchar *fname;
-	gchar *contents;
-
-	res = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
-
-	fname = g_strconcat(g_get_home_dir(), POP_UID_FILE, NULL);
-	g_mutex_lock(&uid_mutex);
-	read_res = g_file_get_contents(fname, &contents, NULL, NULL);
-	g_mutex_unlock(&uid_mutex);
-	g_free(fname);
+	gchar *account;
 
-	if (read_res) {
-		gchar **lines;
-		size_t prefix_len;
-		guint n;
-
-		lines = g_strsplit(contents, "\n", -1);
-		g_free(contents);
-		prefix_len = strlen(prefix);
-		for (n = 0; lines[n] != NULL; n++) {
-			if (strncmp(lines[n], prefix, prefix_len) == 0) {
-				g_hash_table_insert(res, g_strdup(lines[n]), GINT_TO_POINTER(1));
-			}
-		}
-
-		g_strfreev(lines);
+	account = g_strconcat(libbalsa_server_get_user(server), "@",
+                              libbalsa_server_get_host(server), NULL);
+	if ((mailbox_pop3->uid_store != NULL) &&
+		(strcmp(libbalsa_pop3_uid_store_get_account(mailbox_pop3->uid_store), account) != 0)) {
+		libbalsa_pop3_uid_store_free(mailbox_pop3->uid_store);
+		mailbox_pop3->uid_store = NULL;
 	}
-
-	return res;
-}
-
-
-static void
-mp_save_uid(gpointer key, gpointer G_GNUC_UNUSED value, gpointer user_data)
-{
-	FILE *out = (FILE *) user_data;
-
-	fputs((const gchar *) key, out);
-	fputc('\n', out);
-}
-
-
-static gboolean
-mp_save_uids(GHashTable *uids, const gchar *prefix, GError **error)
-{
-	gchar *fname;
-	gboolean read_res;
-	gchar *contents = NULL;
-	FILE *out;
-	gboolean result;
-
-	fname = g_strconcat(g_get_home_dir(), POP_UID_FILE, NULL);
-
-	g_mutex_lock(&uid_mutex);
-	read_res = g_file_get_contents(fname, &contents, NULL, NULL);
-	out = fopen(fname, "w");
-	g_free(fname);
-	if (out != NULL) {
-		if (read_res) {
-			gchar **lines;
-			size_t prefix_len;
-			guint n;
-
-			lines = g_strsplit(contents, "\n", -1);
-			g_free(contents);
-			prefix_len = strlen(prefix);
-			for (n = 0; lines[n] != NULL; n++) {
-				if ((lines[n][0] != '\0') && (strncmp(lines[n], prefix, prefix_len) != 0)) {
-					fputs(lines[n], out);
-					fputc('\n', out);
-				}
-			}
-
-			g_strfreev(lines);
-		}
-
-		if (uids != NULL) {
-			g_hash_table_foreach(uids, mp_save_uid, out);
-		}
-		fclose(out);
-		result = TRUE;
-	} else {
-		g_set_error(error, MBOX_POP3_ERROR, errno, _("Saving the POP3 message UID list failed: %s"), g_strerror(errno));
-		result = FALSE;
+	if (mailbox_pop3->uid_store == NULL) {
+		mailbox_pop3->uid_store = libbalsa_pop3_uid_store_open(account, error);
 	}
+	g_free(account);
 
-	g_mutex_unlock(&uid_mutex);
-	return result;
+	return mailbox_pop3->uid_store;
 }
 
 
@@ -335,6 +263,18 @@ pop_handler_close(pop_handler_t *handler,
 /* ===================================================================
    Functions supporting asynchronous retrieval of messages.
 */
+/* Retrieved messages are added to the inbox in batches of at most
+ * POP_BATCH_MESSAGES messages or POP_BATCH_SIZE bytes, and the UIDs of
+ * the messages added are committed to the UID store after each batch. */
+#define POP_BATCH_MESSAGES	100U
+#define POP_BATCH_SIZE		(8U * 1024U * 1024U)
+
+typedef struct {
+	GMimeStream *stream;
+	guint id;
+	gchar *uid;
+} pop_spooled_t;
+
 struct fetch_data {
     LibBalsaMailbox *mailbox;
     const gchar *filter_path;				/* filter path, NULL for storing the message without filtering */
@@ -345,8 +285,130 @@ struct fetch_data {
     gsize received;
     pop_handler_t *handler;
     gint64 next_notify;
+    LibBalsaPop3UidStore *uid_store;		/* NULL if messages are deleted on the server */
+    GPtrArray *batch;						/* pop_spooled_t messages not yet in the inbox */
+    gsize batch_size;
+    guint unrecorded;						/* filtered messages whose UIDs are not committed */
+    gboolean uid_store_failed;
 };
 
+
+static void
+pop_spooled_free(pop_spooled_t *spooled)
+{
+	g_object_unref(spooled->stream);
+	g_free(spooled->uid);
+	g_free(spooled);
+}
+
+
+typedef struct {
+	GPtrArray *batch;
+	guint next;
+} pop_batch_iter_t;
+
+
+static gboolean
+pop_batch_iterator(LibBalsaMessageFlag *flags,
+				   GMimeStream        **stream,
+				   void                *arg)
+{
+	pop_batch_iter_t *iter = (pop_batch_iter_t *) arg;
+	pop_spooled_t *spooled;
+
+	if (iter->next >= iter->batch->len) {
+		return FALSE;
+	}
+	spooled = (pop_spooled_t *) g_ptr_array_index(iter->batch, iter->next++);
+	*flags = LIBBALSA_MESSAGE_FLAG_NEW | LIBBALSA_MESSAGE_FLAG_RECENT;
+	g_mime_stream_reset(spooled->stream);
+	/* ::add_messages drops the reference */
+	*stream = g_object_ref(spooled->stream);
+	return TRUE;
+}
+
+
+/* Add the spooled messages to the inbox, and commit the UIDs of those
+ * which were added; a crash can thus at worst retrieve the messages of
+ * one batch again. */
+static gboolean
+pop_batch_flush(struct fetch_data *fd,
+				GError           **error)
+{
+	gboolean result = TRUE;
+
+	if (fd->batch->len > 0U) {
+		LibBalsaMailbox *inbox;
+		pop_batch_iter_t iter;
+		GError *add_err = NULL;
+		guint added;
+		guint n;
+
+		inbox = LIBBALSA_MAILBOX_POP3(fd->mailbox)->inbox;
+		iter.batch = fd->batch;
+		iter.next = 0U;
+		added = libbalsa_mailbox_add_messages(inbox, pop_batch_iterator, &iter, &add_err);
+		if (added > 0U) {
+			libbalsa_mailbox_set_unread_messages_flag(inbox, TRUE);
+		}
+		if (added < fd->batch->len) {
+			const pop_spooled_t *failed = (const pop_spooled_t *) g_ptr_array_index(fd->batch, added);
+
+			libbalsa_information(LIBBALSA_INFORMATION_WARNING, _("Error appending message %d from %s to %s: %s"),
+				failed->id,
+				libbalsa_mailbox_get_name(fd->mailbox),
+				libbalsa_mailbox_get_name(inbox),
+				add_err != NULL ? add_err->message : "?");
+			g_clear_error(&add_err);
+			result = FALSE;
+		}
+
+		if (fd->uid_store != NULL) {
+			for (n = 0U; n < added; n++) {
+				const pop_spooled_t *spooled = (const pop_spooled_t *) g_ptr_array_index(fd->batch, n);
+
+				if (spooled->uid != NULL) {
+					libbalsa_pop3_uid_store_add(fd->uid_store, spooled->uid);
+				}
+			}
+		}
+		g_ptr_array_set_size(fd->batch, 0U);
+		fd->batch_size = 0U;
+	}
+
+	if ((fd->uid_store != NULL) && !fd->uid_store_failed && !libbalsa_pop3_uid_store_commit(fd->uid_store, error)) {
+		fd->uid_store_failed = TRUE;
+		result = FALSE;
+	}
+	fd->unrecorded = 0U;
+
+	return result;
+}
+
+
+/* Spool a retrieved message, and add the batch to the inbox when it is
+ * full. */
+static gboolean
+pop_batch_add(struct fetch_data              *fd,
+			  GMimeStream                    *stream,
+			  const NetClientPopMessageInfo  *info,
+			  GError                        **error)
+{
+	pop_spooled_t *spooled;
+
+	spooled = g_new(pop_spooled_t, 1U);
+	spooled->stream = g_object_ref(stream);
+	spooled->id = info->id;
+	spooled->uid = g_strdup(info->uid);
+	g_ptr_array_add(fd->batch, spooled);
+	fd->batch_size += g_mime_stream_length(stream);
+
+	if ((fd->batch->len >= POP_BATCH_MESSAGES) || (fd->batch_size >= POP_BATCH_SIZE)) {
+		return pop_batch_flush(fd, error);
+	}
+	return TRUE;
+}
+
 static void
 notify_progress(const struct fetch_data *fd)
 {
@@ -404,33 +466,21 @@ message_cb(const gchar                    *buffer,
 
 		notify_progress(fd);
 		if (fd->filter_path == NULL) {
-                    GError *add_err = NULL;
-                    LibBalsaMailbox *mailbox;
-                    LibBalsaMailbox *inbox;
-
-                    mailbox = fd->mailbox;
-                    inbox = LIBBALSA_MAILBOX_POP3(mailbox)->inbox;
-
-		    g_mime_stream_reset(fd->handler->mbx_stream);
-		    result =
-                        libbalsa_mailbox_add_message(inbox, fd->handler->mbx_stream,
-                                                     LIBBALSA_MESSAGE_FLAG_NEW |
-                                                     LIBBALSA_MESSAGE_FLAG_RECENT,
-                                                     &add_err);
-		    if (!result) {
-		        libbalsa_information(LIBBALSA_INFORMATION_WARNING, _("Error appending message %d from %s to %s: %s"),
-		        	info->id,
-                                libbalsa_mailbox_get_name(mailbox),
-                                libbalsa_mailbox_get_name(inbox),
-                                add_err != NULL ? add_err->message : "?");
-		        g_clear_error(&add_err);
-		    }
+			result = pop_batch_add(fd, fd->handler->mbx_stream, info, error);
 		}
 
 		/* current message done */
 		close_res = pop_handler_close(fd->handler, error);
 		fd->handler = NULL;
 		result = close_res & result;
+
+		/* the filter has the message now: record its UID */
+		if (result && (fd->filter_path != NULL) && (fd->uid_store != NULL) && (info->uid != NULL)) {
+			libbalsa_pop3_uid_store_add(fd->uid_store, info->uid);
+			if (++fd->unrecorded >= POP_BATCH_MESSAGES) {
+				result = pop_batch_flush(fd, error);
+			}
+		}
 	} else {
 		/* count < 0: error; note that the handler may already be NULL if the error occurred for count == 0 */
 		if (fd->handler != NULL) {
@@ -533,21 +583,14 @@ libbalsa_mailbox_pop3_startup(LibBalsaServer      *server,
 static GList *
 update_msg_list(struct fetch_data         *fd,
                 const LibBalsaMailboxPOP3 *mailbox_pop3,
+                LibBalsaPop3UidStore      *uid_store,
                 GHashTable               **current_uids,
-                LibBalsaServer            *server,
                 GList                     *msg_list)
 {
-	GHashTable *uids = NULL;
-	gchar *uid_prefix = NULL;
-	size_t prefix_len = 0U;
 	GList *p;
 
-	/* load uid's if messages shall be left on the server */
-	if (!mailbox_pop3->delete_from_server) {
-		uid_prefix = g_strconcat(libbalsa_server_get_user(server), "@",
-                                         libbalsa_server_get_host(server), NULL);
-		prefix_len = strlen(uid_prefix);
-		uids = mp_load_uids(uid_prefix);
+	/* remember the uid's on the server if messages shall be left there */
+	if (uid_store != NULL) {
 		*current_uids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 	}
 
@@ -573,11 +616,9 @@ update_msg_list(struct fetch_data         *fd,
 		}
 
 		/* check if we already know this message */
-		if (!skip && !mailbox_pop3->delete_from_server) {
-			gchar *full_uid = g_strconcat(uid_prefix, " ", msg_info->uid, NULL);
-
-			g_hash_table_insert(*current_uids, full_uid, GINT_TO_POINTER(1));
-			if (g_hash_table_lookup(uids, full_uid) != NULL) {
+		if (!skip && (uid_store != NULL)) {
+			g_hash_table_add(*current_uids, g_strdup(msg_info->uid));
+			if (libbalsa_pop3_uid_store_contains(uid_store, msg_info->uid)) {
 				skip = TRUE;
 			}
 		}
@@ -593,24 +634,6 @@ update_msg_list(struct fetch_data         *fd,
 		p = next;
 	}
 
-	/* copy all keys /not/ starting with the prefix from the old to the current hash table, and drop the old table */
-	if (!mailbox_pop3->delete_from_server && (msg_list != NULL)) {
-		GHashTableIter iter;
-		gpointer key;
-
-		g_hash_table_iter_init(&iter, uids);
-		while (g_hash_table_iter_next(&iter, &key, NULL)) {
-			if (strncmp((const char *) key, uid_prefix, prefix_len) != 0) {
-				g_hash_table_insert(*current_uids, key, GINT_TO_POINTER(1));
-			}
-		}
-	}
-
-	g_free(uid_prefix);
-	if (uids != NULL) {
-		g_hash_table_destroy(uids);
-	}
-
 	return msg_list;
 }
 
@@ -636,6 +659,7 @@ libbalsa_mailbox_pop3_check(LibBalsaMailbox * mailbox)
 	/* proceed on success only */
 	if (pop != NULL) {
 		struct fetch_data fd;
+		LibBalsaPop3UidStore *uid_store = NULL;
 		GHashTable *current_uids = NULL;
 		gboolean result = TRUE;
 		GError *err = NULL;
@@ -644,15 +668,19 @@ libbalsa_mailbox_pop3_check(LibBalsaMailbox * mailbox)
 			_("Connected to %s"), net_client_get_host(NET_CLIENT(pop)));
 		memset(&fd, 0, sizeof(fd));
 
+		/* load uid's if messages shall be left on the server */
+		if (!mailbox_pop3->delete_from_server) {
+			uid_store = mp_get_uid_store(mailbox_pop3, server, &err);
+			result = (uid_store != NULL);
+		}
+
 		/* nothing to do if no messages are on the server */
-		if (msg_list != NULL) {
-			/* load uid's if messages shall be left on the server */
-			msg_list = update_msg_list(&fd, mailbox_pop3, &current_uids,
-                                                   server, msg_list);
+		if (result && (msg_list != NULL)) {
+			msg_list = update_msg_list(&fd, mailbox_pop3, uid_store, &current_uids, msg_list);
 		}
 
 		/* download messages unless the list is empty */
-		if (fd.total_messages > 0U) {
+		if (result && (fd.total_messages > 0U)) {
 			fd.mailbox = mailbox;
 			fd.total_size_msg = libbalsa_size_to_gchar(fd.total_size);
 
@@ -664,8 +692,19 @@ libbalsa_mailbox_pop3_check(LibBalsaMailbox * mailbox)
 				fd.filter_path = mailbox_pop3->filter_cmd;
 			}
 
+			fd.uid_store = uid_store;
+			fd.batch = g_ptr_array_new_with_free_func((GDestroyNotify) pop_spooled_free);
+
 			if (result) {
 				result = net_client_pop_retr(pop, msg_list, message_cb, &fd, &err);
+				/* add what is left, also if the retrieval failed, so the messages received are kept */
+				result = pop_batch_flush(&fd, (err == NULL) ? &err : NULL) && result;
+				if (fd.uid_store_failed) {
+					/* drop the changes not stored; the next check reloads the file */
+					libbalsa_pop3_uid_store_free(uid_store);
+					mailbox_pop3->uid_store = NULL;
+					uid_store = NULL;
+				}
 				if (result && mailbox_pop3->delete_from_server) {
 					libbalsa_mailbox_progress_notify(mailbox, LIBBALSA_NTFY_UPDATE, INFINITY,
 						_("Deleting messages on server…"));
@@ -674,21 +713,32 @@ libbalsa_mailbox_pop3_check(LibBalsaMailbox * mailbox)
 			}
 
 			/* clean up */
+			g_ptr_array_free(fd.batch, TRUE);
 			g_free(fd.total_size_msg);
-			g_list_free_full(msg_list, (GDestroyNotify) net_client_pop_msg_info_free);
 		}
+		g_list_free_full(msg_list, (GDestroyNotify) net_client_pop_msg_info_free);
 
-		/* store uid list */
-		if (result && !mailbox_pop3->delete_from_server) {
-			gchar *uid_prefix =
-                            g_strconcat(libbalsa_server_get_user(server), "@",
-                                        libbalsa_server_get_host(server), NULL);
-
-			mp_save_uids(current_uids, uid_prefix, &err);
-			g_free(uid_prefix);
+		/* store uid list: add the new ones, forget those no longer on the server */
+		if (result && (uid_store != NULL)) {
 			if (current_uids != NULL) {
-				g_hash_table_destroy(current_uids);
+				GHashTableIter iter;
+				gpointer uid;
+
+				g_hash_table_iter_init(&iter, current_uids);
+				while (g_hash_table_iter_next(&iter, &uid, NULL)) {
+					libbalsa_pop3_uid_store_add(uid_store, (const gchar *) uid);
+				}
 			}
+			libbalsa_pop3_uid_store_prune(uid_store, current_uids);
+			if (!libbalsa_pop3_uid_store_commit(uid_store, &err)) {
+				/* drop the changes not stored; the next check reloads the file */
+				libbalsa_pop3_uid_store_free(uid_store);
+				mailbox_pop3->uid_store = NULL;
+				result = FALSE;
+			}
+		}
+		if (current_uids != NULL) {
+			g_hash_table_destroy(current_uids);
 		}
 
 		if (!result) {
@@ -1674,6 +1674,21 @@ libbalsa_message_get_subtype(LibBalsaMessage *message)
 }
 
 
+/* The subject itself, NULL if the message has none, where
+ * LIBBALSA_MESSAGE_GET_SUBJECT() shows a placeholder; for the caches of
+ * the mailboxes. */
+const gchar *
+libbalsa_message_get_subject_raw(LibBalsaMessage *message)
+{
+    g_return_val_if_fail(LIBBALSA_IS_MESSAGE(message), NULL);
+
+    /* Read the subject from the MIME message, if not done yet. */
+    (void) libbalsa_message_get_subject(message);
+
+    return message->subj;
+}
+
+
 guint
 libbalsa_message_get_gpg_mode(LibBalsaMessage *message)
 {
@@ -282,6 +282,7 @@ GList                  *libbalsa_message_get_references(LibBalsaMessage *message
 LibBalsaIdentity       *libbalsa_message_get_identity(LibBalsaMessage *message);
 GList                  *libbalsa_message_get_parameters(LibBalsaMessage *message);
 const gchar            *libbalsa_message_get_subtype(LibBalsaMessage *message);
+const gchar            *libbalsa_message_get_subject_raw(LibBalsaMessage *message);
 guint                   libbalsa_message_get_gpg_mode(LibBalsaMessage *message);
 GList                  *libbalsa_message_get_in_reply_to(LibBalsaMessage *message);
 gboolean                libbalsa_message_get_attach_pubkey(LibBalsaMessage *message);
@@ -146,6 +146,40 @@ gboolean libbalsa_find_word(const gchar * word, const gchar * str)
     return FALSE;
 }
 
+/* libbalsa_subject_skip_re:
+   skips the reply prefixes ("Re:", "Aw:", "Re[2]:", the translated
+   "Re:") of a subject, and the white space around them; sorting by
+   subject and gathering threads by subject both use it, so that they
+   agree on what a reply is.
+*/
+const gchar *
+libbalsa_subject_skip_re(const gchar * subject)
+{
+    const gchar *p = subject;
+
+    while (*p != '\0') {
+        while (g_ascii_isspace(*p))
+            p++;
+        if (g_ascii_strncasecmp(p, "re:", 3) == 0
+            || g_ascii_strncasecmp(p, "aw:", 3) == 0)
+            p += 3;
+        else if (g_ascii_strncasecmp(p, _("Re:"), strlen(_("Re:"))) == 0)
+            p += strlen(_("Re:"));
+        else if (g_ascii_strncasecmp(p, "re[", 3) == 0) {
+            const gchar *q = p + 3;
+
+            while (g_ascii_isdigit(*q))
+                q++;
+            if (q == p + 3 || q[0] != ']' || q[1] != ':')
+                break;
+            p = q + 2;
+        } else
+            break;
+    }
+
+    return p;
+}
+
 /* libbalsa_wrap_string
    wraps given string replacing spaces with '\n'.  do changes in place.
    lnbeg - line beginning position, sppos - space position, 
@@ -339,43 +373,271 @@ libbalsa_utf8_sanitize(gchar **text, gboolean fallback,
     return FALSE;
 }
 
+/* Case insensitive substring search.
+ *
+ * A needle is prepared once, and then matched against many haystacks,
+ * as when a filter or search condition is tested on each message of a
+ * mailbox.  Characters are compared through g_unichar_toupper.
+ *
+ * An ASCII needle is searched for byte by byte: we look for its rarest
+ * byte, in both cases, with memchr, which libc vectorizes, and compare
+ * the rest of the needle at each hit.  In that case an ASCII letter
+ * matches only an ASCII letter, although U+0131 (dotless i) and U+017F
+ * (long s) would otherwise match "i" and "s".
+ *
+ * Other needles are compared character by character, but with the
+ * needle decoded and case mapped in advance.
+ */
+
+struct _LibBalsaUtf8Needle {
+    gint      ref_count;   /* Atomic: a needle may be shared by the
+                            * threads that search and filter. */
+    gchar    *text;        /* The needle as given, or NULL. */
+    gboolean  ascii;
+    gsize     len;         /* In bytes if ascii, else in characters. */
+    guchar   *folded;      /* ascii: the needle, in lower case. */
+    gsize     anchor;      /* ascii: offset of the rarest byte... */
+    guchar    anchors[2];  /* ...and its forms, */
+    guint     n_anchors;   /* of which there are one or two. */
+    gunichar *chars;       /* !ascii: the characters, in upper case. */
+};
+
+#define LBN_ASCII_FOLD(c) ((c) >= 'A' && (c) <= 'Z' ? (c) | 0x20 : (c))
+
+/* ASCII characters, roughly from the most to the least common in mail;
+ * characters that are not listed are rarer still. */
+static const gchar lbn_common_chars[] =
+    " etaoinsrhldcumfpgwyb,.v\nk-'\"x>jqz0123456789";
+
+static gsize
+lbn_rarity(guchar c)
+{
+    const gchar *p = strchr(lbn_common_chars, c);
+
+    return p != NULL ? (gsize) (p - lbn_common_chars)
+        : sizeof lbn_common_chars;
+}
+
+/* libbalsa_utf8_needle_new() prepares needle for
+ * libbalsa_utf8_needle_match(); a NULL or empty needle matches
+ * anything. */
+LibBalsaUtf8Needle *
+libbalsa_utf8_needle_new(const gchar * needle)
+{
+    LibBalsaUtf8Needle *n = g_new0(LibBalsaUtf8Needle, 1);
+    const gchar *p;
+    gsize i;
+
+    n->ref_count = 1;
+    n->text = g_strdup(needle);
+    if (needle == NULL)
+        return n;
+
+    for (p = needle; *p != '\0' && !(*p & 0x80); p++)
+        /* nothing */ ;
+    n->ascii = *p == '\0';
+
+    if (n->ascii) {
+        gsize rarity = 0;
+
+        n->len = p - needle;
+        n->folded = g_malloc(n->len + 1);
+        for (i = 0; i < n->len; i++) {
+            guchar c = LBN_ASCII_FOLD((guchar) needle[i]);
+            gsize r = lbn_rarity(c);
+
+            n->folded[i] = c;
+            if (i == 0 || r > rarity) {
+                n->anchor = i;
+                rarity = r;
+            }
+        }
+        n->folded[n->len] = '\0';
+
+        if (n->len > 0) {
+            guchar c = n->folded[n->anchor];
+
+            n->anchors[n->n_anchors++] = c;
+            if (c >= 'a' && c <= 'z')
+                n->anchors[n->n_anchors++] = c & ~0x20;
+        }
+    } else {
+        glong len;
+
+        n->chars = g_utf8_to_ucs4_fast(needle, -1, &len);
+        n->len = len;
+        for (i = 0; i < n->len; i++)
+            n->chars[i] = g_unichar_toupper(n->chars[i]);
+    }
+
+    return n;
+}
+
+LibBalsaUtf8Needle *
+libbalsa_utf8_needle_ref(LibBalsaUtf8Needle * needle)
+{
+    g_atomic_int_inc(&needle->ref_count);
+
+    return needle;
+}
+
+void
+libbalsa_utf8_needle_unref(LibBalsaUtf8Needle * needle)
+{
+    if (needle == NULL || !g_atomic_int_dec_and_test(&needle->ref_count))
+        return;
+
+    g_free(needle->text);
+    g_free(needle->folded);
+    g_free(needle->chars);
+    g_free(needle);
+}
+
+/* The needle as it was given to libbalsa_utf8_needle_new(). */
+const gchar *
+libbalsa_utf8_needle_get_text(const LibBalsaUtf8Needle * needle)
+{
+    return needle->text;
+}
+
+static const guchar *
+lbn_memchr(const guchar * p, const guchar * end, guchar c)
+{
+    return p < end ? memchr(p, c, end - p) : NULL;
+}
+
+/* The next position, at or after p and before end, of either form of
+ * the anchor byte; hits[] holds the next position of each form, so that
+ * memchr goes over each byte of the haystack once for each form. */
+static const guchar *
+lbn_next_anchor(const LibBalsaUtf8Needle * needle, const guchar * p,
+                const guchar * end, const guchar ** hits)
+{
+    const guchar *next = NULL;
+    guint i;
+
+    for (i = 0; i < needle->n_anchors; i++) {
+        if (hits[i] != NULL && hits[i] < p)
+            hits[i] = lbn_memchr(p, end, needle->anchors[i]);
+        if (hits[i] != NULL && (next == NULL || hits[i] < next))
+            next = hits[i];
+    }
+
+    return next;
+}
+
+static gboolean
+lbn_match_ascii(const LibBalsaUtf8Needle * needle, const gchar * haystack)
+{
+    const guchar *hay = (const guchar *) haystack;
+    gsize hay_len = strlen(haystack);
+    const guchar *hits[2];
+    const guchar *p, *end, *hit;
+    guint i;
+
+    if (hay_len < needle->len)
+        return FALSE;
+
+    /* The anchor byte of a match lies in [p, end). */
+    p = hay + needle->anchor;
+    end = p + (hay_len - needle->len) + 1;
+    for (i = 0; i < needle->n_anchors; i++)
+        hits[i] = lbn_memchr(p, end, needle->anchors[i]);
+
+    while ((hit = lbn_next_anchor(needle, p, end, hits)) != NULL) {
+        const guchar *start = hit - needle->anchor;
+        gsize j;
+
+        for (j = 0; j < needle->len; j++)
+            if (LBN_ASCII_FOLD(start[j]) != needle->folded[j])
+                break;
+        if (j == needle->len)
+            return TRUE;
+        p = hit + 1;
+    }
+
+    return FALSE;
+}
+
+static inline gunichar
+lbn_toupper(const gchar * p)
+{
+    guchar c = *p;
+
+    if (c < 0x80)
+        return c >= 'a' && c <= 'z' ? c & ~0x20 : c;
+
+    return g_unichar_toupper(g_utf8_get_char(p));
+}
+
+static gboolean
+lbn_match_unicode(const LibBalsaUtf8Needle * needle,
+                  const gchar * haystack)
+{
+    const gunichar first = needle->chars[0];
+    const gchar *s;
+
+    for (s = haystack; *s != '\0'; s = g_utf8_next_char(s)) {
+        const gchar *q;
+        gsize i;
+
+        if (lbn_toupper(s) != first)
+            continue;
+
+        q = g_utf8_next_char(s);
+        for (i = 1; i < needle->len && *q != '\0'; i++) {
+            if (lbn_toupper(q) != needle->chars[i])
+                break;
+            q = g_utf8_next_char(q);
+        }
+        if (i == needle->len)
+            return TRUE;
+        if (*q == '\0')
+            /* The rest of the haystack is too short. */
+            return FALSE;
+    }
+
+    return FALSE;
+}
+
+/* libbalsa_utf8_needle_match() returns TRUE if the prepared needle is a
+ * substring of haystack, ignoring case. */
+gboolean
+libbalsa_utf8_needle_match(const LibBalsaUtf8Needle * needle,
+                           const gchar * haystack)
+{
+    /* convention : NULL string is contained in anything */
+    if (needle->text == NULL)
+        return TRUE;
+    if (haystack == NULL)
+        return FALSE;
+    if (needle->len == 0)
+        return TRUE;
+
+    return needle->ascii ? lbn_match_ascii(needle, haystack)
+        : lbn_match_unicode(needle, haystack);
+}
+
 /* libbalsa_utf8_strstr() returns TRUE if s2 is a substring of s1.
  * libbalsa_utf8_strstr is case insensitive
  * this functions understands utf8 strings (as you might have guessed ;-)
+ * To match the same s2 many times, prepare it with
+ * libbalsa_utf8_needle_new().
  */
 gboolean
 libbalsa_utf8_strstr(const gchar *s1, const gchar *s2)
 {
-    const gchar * p,* q;
+    LibBalsaUtf8Needle *needle;
+    gboolean match;
 
-    /* convention : NULL string is contained in anything */
     if (!s2) return TRUE;
-    /* s2 is non-NULL, so if s1==NULL we return FALSE :)*/
     if (!s1) return FALSE;
-    /* OK both are non-NULL now*/
-    /* If s2 is the empty string return TRUE */
-    if (!*s2) return TRUE;
-    while (*s1) {
-	/* We look for the first char of s2*/
-	for (;*s1 &&
-		 g_unichar_toupper(g_utf8_get_char(s2))!=g_unichar_toupper(g_utf8_get_char(s1));
-	     s1 = g_utf8_next_char(s1));
-	if (*s1) {
-	    /* We found the first char let see if this potential match is an actual one */
-	    s1 = g_utf8_next_char(s1);
-	    q = s1;
-	    p = g_utf8_next_char(s2);
-	    while (*q && *p && 
-		   g_unichar_toupper(g_utf8_get_char(p))
-		   ==g_unichar_toupper(g_utf8_get_char(q))) {
-		p = g_utf8_next_char(p);
-		q = g_utf8_next_char(q);
-	    }
-	    /* We have a match if p has reached the end of s2, ie *p==0 */
-	    if (!*p) return TRUE;
-	}
-    }
-    return FALSE;
+
+    needle = libbalsa_utf8_needle_new(s2);
+    match = libbalsa_utf8_needle_match(needle, s1);
+    libbalsa_utf8_needle_unref(needle);
+
+    return match;
 }
 
 /* The LibBalsaCodeset enum is not used for anything currently, but this
@@ -77,6 +77,9 @@ struct _LibBalsaCodesetInfo {
 typedef void (*libbalsa_url_cb_t) (GtkTextBuffer *, GtkTextIter *,
 				   const gchar *, guint, gpointer);
 typedef struct _LibBalsaUrlInsertInfo LibBalsaUrlInsertInfo;
+
+typedef struct _LibBalsaUtf8Needle LibBalsaUtf8Needle;
+
 struct _LibBalsaUrlInsertInfo {
     libbalsa_url_cb_t callback;
     gpointer callback_data;
@@ -96,6 +99,7 @@ gchar *libbalsa_get_domainname(void);
 #define libbalsa_urldecode(str) (g_uri_unescape_string((str), NULL))
 
 gboolean libbalsa_find_word(const gchar * word, const gchar * str);
+const gchar *libbalsa_subject_skip_re(const gchar * subject);
 void libbalsa_wrap_string(gchar * str, int width);
 GString *libbalsa_process_text_rfc2646(gchar * par, gint width,
 				       gboolean from_screen,
@@ -115,6 +119,13 @@ LibBalsaCodeset libbalsa_set_fallback_codeset(LibBalsaCodeset codeset);
 gboolean libbalsa_utf8_sanitize(gchar ** text, gboolean fallback,
                                 gchar const **target);
 gboolean libbalsa_utf8_strstr(const gchar *s1,const gchar *s2);
+LibBalsaUtf8Needle *libbalsa_utf8_needle_new(const gchar * needle);
+LibBalsaUtf8Needle *libbalsa_utf8_needle_ref(LibBalsaUtf8Needle * needle);
+void libbalsa_utf8_needle_unref(LibBalsaUtf8Needle * needle);
+const gchar *libbalsa_utf8_needle_get_text(const LibBalsaUtf8Needle *
+                                           needle);
+gboolean libbalsa_utf8_needle_match(const LibBalsaUtf8Needle * needle,
+                                    const gchar * haystack);
 gboolean libbalsa_insert_with_url(GtkTextBuffer * buffer,
 				  const char *chars,
 				  guint len,
@@ -0,0 +1,338 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ *
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include "pop3-uid-store.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+
+/* The file starts with a header line naming the account; each record
+ * is a line, '+' or '-' and the UID.  RFC 1939 UIDs contain neither
+ * blanks nor line breaks. */
+#define LBPUS_MAGIC      "BalsaPopUids1"
+#define LBPUS_DIR        ".balsa/pop-uids.d"
+#define LBPUS_LEGACY     ".balsa/pop-uids"
+/* Rewrite the file when it holds that many more records than UIDs. */
+#define LBPUS_SLACK      1024
+
+struct _LibBalsaPop3UidStore {
+    gchar *account;
+    gchar *path;
+    GHashTable *uids;           /* the set of UIDs */
+    GString *pending;           /* records not written yet */
+    gint fd;                    /* the file, opened for appending */
+    guint n_records;            /* in the file, and pending */
+};
+
+static gboolean
+lbpus_set_error(GError ** error, const gchar * path)
+{
+    int errsv = errno;
+
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+                _("Cannot write POP3 UID file %s: %s"), path,
+                g_strerror(errsv));
+
+    return FALSE;
+}
+
+static gboolean
+lbpus_open_fd(LibBalsaPop3UidStore * store, GError ** error)
+{
+    if (store->fd >= 0)
+        close(store->fd);
+    store->fd = g_open(store->path, O_WRONLY | O_APPEND, 0);
+    if (store->fd < 0)
+        return lbpus_set_error(error, store->path);
+
+    return TRUE;
+}
+
+/* Replace the file by one holding the current UIDs only. */
+static gboolean
+lbpus_rewrite(LibBalsaPop3UidStore * store, GError ** error)
+{
+    GString *contents;
+    GHashTableIter iter;
+    gpointer uid;
+    gboolean ok;
+
+    contents = g_string_new(LBPUS_MAGIC " ");
+    g_string_append(contents, store->account);
+    g_string_append_c(contents, '\n');
+    g_hash_table_iter_init(&iter, store->uids);
+    while (g_hash_table_iter_next(&iter, &uid, NULL)) {
+        g_string_append_c(contents, '+');
+        g_string_append(contents, uid);
+        g_string_append_c(contents, '\n');
+    }
+
+    /* g_file_set_contents() writes a new file and renames it, so either
+     * the old or the new file survives a crash. */
+    ok = g_file_set_contents(store->path, contents->str, contents->len,
+                             error);
+    g_string_free(contents, TRUE);
+    if (!ok)
+        return FALSE;
+
+    g_string_truncate(store->pending, 0);
+    store->n_records = g_hash_table_size(store->uids);
+
+    return lbpus_open_fd(store, error);
+}
+
+/* Take over the UIDs of the account from the file shared by all
+ * accounts, where each line is "user@host uid". */
+static void
+lbpus_import_legacy(LibBalsaPop3UidStore * store)
+{
+    gchar *fname;
+    gchar *contents;
+    gchar **lines;
+    gsize prefix_len;
+    guint n;
+
+    fname = g_build_filename(g_get_home_dir(), LBPUS_LEGACY, NULL);
+    if (!g_file_get_contents(fname, &contents, NULL, NULL)) {
+        g_free(fname);
+        return;
+    }
+    g_free(fname);
+
+    prefix_len = strlen(store->account);
+    lines = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+    for (n = 0; lines[n] != NULL; n++) {
+        if (strncmp(lines[n], store->account, prefix_len) == 0
+            && lines[n][prefix_len] == ' '
+            && lines[n][prefix_len + 1] != '\0')
+            g_hash_table_add(store->uids,
+                             g_strdup(&lines[n][prefix_len + 1]));
+    }
+    g_strfreev(lines);
+}
+
+static gboolean
+lbpus_load(LibBalsaPop3UidStore * store, GError ** error)
+{
+    GError *err = NULL;
+    gchar *contents;
+    gsize length;
+    gchar *header;
+    gsize header_len;
+    gchar *p, *end;
+    gboolean cut_short;
+
+    if (!g_file_get_contents(store->path, &contents, &length, &err)) {
+        if (!g_error_matches(err, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            g_propagate_error(error, err);
+            return FALSE;
+        }
+        g_error_free(err);
+        lbpus_import_legacy(store);
+        return lbpus_rewrite(store, error);
+    }
+
+    header = g_strconcat(LBPUS_MAGIC " ", store->account, "\n", NULL);
+    header_len = strlen(header);
+    if (length < header_len || memcmp(contents, header, header_len) != 0) {
+        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                    _("%s is not a POP3 UID file of %s"), store->path,
+                    store->account);
+        g_free(header);
+        g_free(contents);
+        return FALSE;
+    }
+    g_free(header);
+
+    p = contents + header_len;
+    end = contents + length;
+    while (p < end) {
+        gchar *nl = memchr(p, '\n', end - p);
+
+        if (nl == NULL)
+            break;
+        *nl = '\0';
+        if (*p == '+' && p[1] != '\0')
+            g_hash_table_add(store->uids, g_strdup(p + 1));
+        else if (*p == '-')
+            g_hash_table_remove(store->uids, p + 1);
+        store->n_records++;
+        p = nl + 1;
+    }
+    cut_short = p < end;
+    g_free(contents);
+
+    /* Appending after a partial record would corrupt the next one. */
+    if (cut_short)
+        return lbpus_rewrite(store, error);
+
+    return lbpus_open_fd(store, error);
+}
+
+LibBalsaPop3UidStore *
+libbalsa_pop3_uid_store_open(const gchar * account, GError ** error)
+{
+    LibBalsaPop3UidStore *store;
+    gchar *dir;
+    gchar *name;
+
+    g_return_val_if_fail(account != NULL, NULL);
+
+    dir = g_build_filename(g_get_home_dir(), LBPUS_DIR, NULL);
+    if (g_mkdir_with_parents(dir, 0700) != 0) {
+        lbpus_set_error(error, dir);
+        g_free(dir);
+        return NULL;
+    }
+
+    store = g_new0(LibBalsaPop3UidStore, 1);
+    store->account = g_strdup(account);
+    name = g_uri_escape_string(account, "@", FALSE);
+    store->path = g_build_filename(dir, name, NULL);
+    g_free(name);
+    g_free(dir);
+    store->uids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                        NULL);
+    store->pending = g_string_new(NULL);
+    store->fd = -1;
+
+    if (!lbpus_load(store, error)) {
+        libbalsa_pop3_uid_store_free(store);
+        return NULL;
+    }
+
+    return store;
+}
+
+void
+libbalsa_pop3_uid_store_free(LibBalsaPop3UidStore * store)
+{
+    if (store == NULL)
+        return;
+
+    if (store->fd >= 0)
+        close(store->fd);
+    g_string_free(store->pending, TRUE);
+    g_hash_table_destroy(store->uids);
+    g_free(store->path);
+    g_free(store->account);
+    g_free(store);
+}
+
+const gchar *
+libbalsa_pop3_uid_store_get_account(LibBalsaPop3UidStore * store)
+{
+    return store->account;
+}
+
+gboolean
+libbalsa_pop3_uid_store_contains(LibBalsaPop3UidStore * store,
+                                 const gchar * uid)
+{
+    return g_hash_table_contains(store->uids, uid);
+}
+
+void
+libbalsa_pop3_uid_store_add(LibBalsaPop3UidStore * store,
+                            const gchar * uid)
+{
+    g_return_if_fail(uid != NULL && *uid != '\0');
+
+    if (!g_hash_table_add(store->uids, g_strdup(uid)))
+        return;
+
+    g_string_append_c(store->pending, '+');
+    g_string_append(store->pending, uid);
+    g_string_append_c(store->pending, '\n');
+    store->n_records++;
+}
+
+void
+libbalsa_pop3_uid_store_prune(LibBalsaPop3UidStore * store,
+                              GHashTable * on_server)
+{
+    GHashTableIter iter;
+    gpointer uid;
+
+    g_hash_table_iter_init(&iter, store->uids);
+    while (g_hash_table_iter_next(&iter, &uid, NULL)) {
+        if (on_server != NULL && g_hash_table_contains(on_server, uid))
+            continue;
+        g_string_append_c(store->pending, '-');
+        g_string_append(store->pending, uid);
+        g_string_append_c(store->pending, '\n');
+        store->n_records++;
+        g_hash_table_iter_remove(&iter);
+    }
+}
+
+gboolean
+libbalsa_pop3_uid_store_commit(LibBalsaPop3UidStore * store,
+                               GError ** error)
+{
+    const gchar *p;
+    gsize left;
+
+    if (store->n_records > 2 * g_hash_table_size(store->uids) + LBPUS_SLACK)
+        return lbpus_rewrite(store, error);
+
+    if (store->pending->len == 0)
+        return TRUE;
+
+    p = store->pending->str;
+    left = store->pending->len;
+    while (left > 0) {
+        ssize_t written = write(store->fd, p, left);
+
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        p += written;
+        left -= written;
+    }
+
+    if (left > 0 || fsync(store->fd) != 0) {
+        GError *err = NULL;
+
+        /* The file may end in a partial record now; writing it anew
+         * keeps the changes, if that works. */
+        lbpus_set_error(&err, store->path);
+        if (lbpus_rewrite(store, NULL)) {
+            g_error_free(err);
+            return TRUE;
+        }
+        g_propagate_error(error, err);
+        return FALSE;
+    }
+    g_string_truncate(store->pending, 0);
+
+    return TRUE;
+}
@@ -0,0 +1,63 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ *
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * pop3-uid-store.h
+ *
+ * The UIDs of the messages left on a POP3 server that have been
+ * retrieved already.
+ *
+ * Each account, user@host, has a file of its own, which is a journal of
+ * added and removed UIDs: changes are appended and synced when they are
+ * committed, and the file is rewritten only when the removed UIDs
+ * outweigh the others.  A record cut short by a crash is dropped the
+ * next time the file is opened.
+ */
+
+#ifndef __LIBBALSA_POP3_UID_STORE_H__
+#define __LIBBALSA_POP3_UID_STORE_H__
+
+#include <glib.h>
+
+typedef struct _LibBalsaPop3UidStore LibBalsaPop3UidStore;
+
+/* Open the store of account, creating it if needed; the UIDs of account
+ * in the file shared by all accounts in older versions are taken
+ * over. */
+LibBalsaPop3UidStore *libbalsa_pop3_uid_store_open(const gchar * account,
+                                                   GError ** error);
+/* Changes not committed are lost. */
+void libbalsa_pop3_uid_store_free(LibBalsaPop3UidStore * store);
+
+const gchar *libbalsa_pop3_uid_store_get_account(LibBalsaPop3UidStore *
+                                                 store);
+gboolean libbalsa_pop3_uid_store_contains(LibBalsaPop3UidStore * store,
+                                          const gchar * uid);
+void libbalsa_pop3_uid_store_add(LibBalsaPop3UidStore * store,
+                                 const gchar * uid);
+/* Remove the UIDs not in on_server, a set of UIDs, or all of them if
+ * on_server is NULL. */
+void libbalsa_pop3_uid_store_prune(LibBalsaPop3UidStore * store,
+                                   GHashTable * on_server);
+/* Write the changes to disk. */
+gboolean libbalsa_pop3_uid_store_commit(LibBalsaPop3UidStore * store,
+                                        GError ** error);
+
+#endif                          /* __LIBBALSA_POP3_UID_STORE_H__ */
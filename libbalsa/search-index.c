@@ -0,0 +1,831 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ *
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include "search-index.h"
+
+#include <string.h>
+
+#include "filter-private.h"
+#include "misc.h"
+
+#ifdef G_LOG_DOMAIN
+#  undef G_LOG_DOMAIN
+#endif
+#define G_LOG_DOMAIN "mailbox-search"
+
+/*
+ * Words are runs of alphanumeric characters, folded with
+ * g_unichar_toupper as libbalsa_utf8_strstr compares them.  A string
+ * condition can only match a message that contains, for each word of
+ * the condition's string, an indexed word that the condition's word can
+ * be part of: a word in the middle of the string must appear whole, the
+ * first one must end an indexed word, the last one must begin one.
+ *
+ * Messages with words longer than LBSI_MAX_WORD bytes are indexed as
+ * partial, and never ruled out.
+ *
+ * The words that a first or last word of a string can be part of are
+ * found in a sorted array of all the suffixes of the indexed words, as
+ * the range of suffixes that begin with the string's word; it is built
+ * on the first such query, and dropped when words are added or
+ * removed.
+ */
+
+#define LBSI_MAGIC         "BalsaSix"
+#define LBSI_MAGIC_LEN     8
+#define LBSI_VERSION       2
+#define LBSI_MAX_WORD      64
+#define LBSI_MAX_RESULTS   32
+
+#define LBSI_DOC_PARTIAL   (1 << 0)
+
+typedef struct {
+    gchar *key;
+    guint8 flags;
+} LbsiDoc;
+
+/* A suffix of an indexed word, whole if it is the word itself. */
+typedef struct {
+    const gchar *suffix;        /* belongs to the key in words */
+    GArray *postings;
+    gboolean whole;
+} LbsiSuffix;
+
+/* The messages that a string may match, when the index held n_docs. */
+typedef struct {
+    guint n_docs;
+    guint8 *may_match;          /* bit per document, or NULL for all */
+} LbsiResult;
+
+struct _LibBalsaSearchIndex {
+    GMutex lock;
+    gchar *filename;
+    gboolean changed;
+
+    GArray *docs;               /* LbsiDoc, by document number */
+    GHashTable *doc_numbers;    /* key -> document number + 1; the keys
+                                 * belong to docs */
+    GHashTable *words;          /* word -> GArray of guint32 document
+                                 * numbers, in ascending order */
+    GArray *suffixes;           /* LbsiSuffix, sorted, or NULL */
+    GHashTable *results;        /* string -> LbsiResult */
+};
+
+static void
+lbsi_result_free(LbsiResult * result)
+{
+    g_free(result->may_match);
+    g_free(result);
+}
+
+static void
+lbsi_postings_free(GArray * postings)
+{
+    g_array_free(postings, TRUE);
+}
+
+static void
+lbsi_drop_suffixes(LibBalsaSearchIndex * index)
+{
+    if (index->suffixes != NULL) {
+        g_array_free(index->suffixes, TRUE);
+        index->suffixes = NULL;
+    }
+}
+
+/* Words. */
+
+typedef void (*LbsiWordFunc) (const gchar * word, gsize len,
+                              gboolean first, gboolean last,
+                              gpointer data);
+
+static void
+lbsi_foreach_word(const gchar * text, LbsiWordFunc func, gpointer data)
+{
+    GString *word = g_string_sized_new(LBSI_MAX_WORD + 8);
+    const gchar *p = text;
+    gboolean first = TRUE;
+
+    while (*p) {
+        gunichar c;
+
+        if ((guchar) *p < 0x80) {
+            c = g_ascii_toupper(*p);
+            if (!g_ascii_isalnum(c)) {
+                ++p;
+                c = 0;
+            }
+        } else {
+            c = g_unichar_toupper(g_utf8_get_char(p));
+            if (!g_unichar_isalnum(c)) {
+                p = g_utf8_next_char(p);
+                c = 0;
+            }
+        }
+
+        if (c == 0) {
+            if (word->len > 0) {
+                func(word->str, word->len, first, FALSE, data);
+                g_string_truncate(word, 0);
+                first = FALSE;
+            } else if (p > text)
+                first = FALSE;
+            continue;
+        }
+
+        g_string_append_unichar(word, c);
+        p = g_utf8_next_char(p);
+    }
+
+    if (word->len > 0)
+        func(word->str, word->len, first, TRUE, data);
+    g_string_free(word, TRUE);
+}
+
+/* Loading and saving. */
+
+static void
+lbsi_put_uint32(GByteArray * buf, guint32 val)
+{
+    guint8 bytes[4];
+
+    bytes[0] = val >> 24;
+    bytes[1] = val >> 16;
+    bytes[2] = val >> 8;
+    bytes[3] = val;
+    g_byte_array_append(buf, bytes, 4);
+}
+
+static void
+lbsi_put_varint(GByteArray * buf, guint32 val)
+{
+    guint8 byte;
+
+    while (val >= 0x80) {
+        byte = (val & 0x7f) | 0x80;
+        g_byte_array_append(buf, &byte, 1);
+        val >>= 7;
+    }
+    byte = val;
+    g_byte_array_append(buf, &byte, 1);
+}
+
+typedef struct {
+    const guint8 *p;
+    const guint8 *end;
+} LbsiReader;
+
+static gboolean
+lbsi_get_uint32(LbsiReader * reader, guint32 * val)
+{
+    if (reader->end - reader->p < 4)
+        return FALSE;
+    *val = ((guint32) reader->p[0] << 24) | ((guint32) reader->p[1] << 16)
+        | ((guint32) reader->p[2] << 8) | reader->p[3];
+    reader->p += 4;
+
+    return TRUE;
+}
+
+static gboolean
+lbsi_get_varint(LbsiReader * reader, guint32 * val)
+{
+    guint shift;
+
+    *val = 0;
+    for (shift = 0; shift < 35; shift += 7) {
+        if (reader->p >= reader->end)
+            return FALSE;
+        *val |= (guint32) (*reader->p & 0x7f) << shift;
+        if (!(*reader->p++ & 0x80))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Takes ownership of key. */
+static void
+lbsi_add_doc(LibBalsaSearchIndex * index, gchar * key, guint8 flags)
+{
+    LbsiDoc doc;
+
+    doc.key = key;
+    doc.flags = flags;
+    g_array_append_val(index->docs, doc);
+    g_hash_table_insert(index->doc_numbers, key,
+                        GUINT_TO_POINTER(index->docs->len));
+}
+
+static void
+lbsi_doc_clear(LbsiDoc * doc)
+{
+    g_free(doc->key);
+}
+
+static gboolean
+lbsi_load(LibBalsaSearchIndex * index, const guint8 * data, gsize length)
+{
+    LbsiReader reader = { data, data + length };
+    guint32 version, n_docs, n_words, i;
+
+    if (length < LBSI_MAGIC_LEN
+        || memcmp(data, LBSI_MAGIC, LBSI_MAGIC_LEN) != 0)
+        return FALSE;
+    reader.p += LBSI_MAGIC_LEN;
+    if (!lbsi_get_uint32(&reader, &version) || version != LBSI_VERSION
+        || !lbsi_get_uint32(&reader, &n_docs)
+        || n_docs > (gsize) (reader.end - reader.p) / 3)
+        return FALSE;
+
+    for (i = 0; i < n_docs; i++) {
+        guint32 len;
+        gchar *key;
+
+        if (!lbsi_get_varint(&reader, &len) || len == 0
+            || len >= (gsize) (reader.end - reader.p))
+            return FALSE;
+        key = g_strndup((const gchar *) reader.p, len);
+        reader.p += len;
+        if (g_hash_table_contains(index->doc_numbers, key)) {
+            g_free(key);
+            return FALSE;
+        }
+        lbsi_add_doc(index, key, *reader.p++);
+    }
+
+    if (!lbsi_get_uint32(&reader, &n_words))
+        return FALSE;
+    for (i = 0; i < n_words; i++) {
+        guint32 len, count, delta, docno, j;
+        GArray *postings;
+
+        if (!lbsi_get_varint(&reader, &len) || len == 0
+            || len > (gsize) (reader.end - reader.p))
+            return FALSE;
+        postings = g_array_new(FALSE, FALSE, sizeof(guint32));
+        g_hash_table_insert(index->words,
+                            g_strndup((const gchar *) reader.p, len),
+                            postings);
+        reader.p += len;
+
+        if (!lbsi_get_varint(&reader, &count) || count == 0
+            || count > (gsize) (reader.end - reader.p))
+            return FALSE;
+        for (j = 0, docno = 0; j < count; j++) {
+            if (!lbsi_get_varint(&reader, &delta)
+                || (j > 0 && delta == 0)
+                || delta >= n_docs - docno)
+                return FALSE;
+            docno += delta;
+            g_array_append_val(postings, docno);
+        }
+    }
+
+    return reader.p == reader.end;
+}
+
+static void
+lbsi_clear(LibBalsaSearchIndex * index)
+{
+    g_hash_table_remove_all(index->doc_numbers);
+    g_array_set_size(index->docs, 0);
+    g_hash_table_remove_all(index->words);
+    lbsi_drop_suffixes(index);
+    g_hash_table_remove_all(index->results);
+}
+
+LibBalsaSearchIndex *
+libbalsa_search_index_new(const gchar * filename)
+{
+    LibBalsaSearchIndex *index;
+    gchar *contents;
+    gsize length;
+
+    g_return_val_if_fail(filename != NULL, NULL);
+
+    index = g_new0(LibBalsaSearchIndex, 1);
+    g_mutex_init(&index->lock);
+    index->filename = g_strdup(filename);
+    index->docs = g_array_new(FALSE, FALSE, sizeof(LbsiDoc));
+    g_array_set_clear_func(index->docs, (GDestroyNotify) lbsi_doc_clear);
+    index->doc_numbers = g_hash_table_new(g_str_hash, g_str_equal);
+    index->words =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                              (GDestroyNotify) lbsi_postings_free);
+    index->results =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                              (GDestroyNotify) lbsi_result_free);
+
+    if (g_file_get_contents(filename, &contents, &length, NULL)) {
+        if (!lbsi_load(index, (const guint8 *) contents, length)) {
+            g_debug("%s: ignoring damaged search index %s", __func__,
+                    filename);
+            lbsi_clear(index);
+        }
+        g_free(contents);
+    }
+
+    return index;
+}
+
+void
+libbalsa_search_index_free(LibBalsaSearchIndex * index)
+{
+    if (index == NULL)
+        return;
+
+    g_mutex_clear(&index->lock);
+    g_free(index->filename);
+    g_hash_table_destroy(index->doc_numbers);
+    g_array_free(index->docs, TRUE);
+    g_hash_table_destroy(index->words);
+    lbsi_drop_suffixes(index);
+    g_hash_table_destroy(index->results);
+    g_free(index);
+}
+
+/* Drop the documents whose keys are not in live_keys, and renumber the
+ * rest. */
+static void
+lbsi_collect(LibBalsaSearchIndex * index, GHashTable * live_keys)
+{
+    guint32 *new_numbers;
+    GArray *docs;
+    GHashTableIter iter;
+    gpointer word, postings;
+    guint i;
+
+    new_numbers = g_new(guint32, index->docs->len);
+    docs = g_array_new(FALSE, FALSE, sizeof(LbsiDoc));
+    for (i = 0; i < index->docs->len; i++) {
+        LbsiDoc *doc = &g_array_index(index->docs, LbsiDoc, i);
+
+        if (g_hash_table_contains(live_keys, doc->key)) {
+            new_numbers[i] = docs->len;
+            g_array_append_val(docs, *doc);
+        } else
+            new_numbers[i] = G_MAXUINT32;
+    }
+
+    if (docs->len == index->docs->len) {
+        g_array_free(docs, TRUE);
+        g_free(new_numbers);
+        return;
+    }
+
+    /* The kept documents move to the new array with their keys. */
+    g_hash_table_remove_all(index->doc_numbers);
+    for (i = 0; i < index->docs->len; i++)
+        if (new_numbers[i] != G_MAXUINT32)
+            g_array_index(index->docs, LbsiDoc, i).key = NULL;
+    g_array_set_size(index->docs, 0);
+    for (i = 0; i < docs->len; i++) {
+        LbsiDoc *doc = &g_array_index(docs, LbsiDoc, i);
+
+        lbsi_add_doc(index, doc->key, doc->flags);
+    }
+    g_array_free(docs, TRUE);
+
+    g_hash_table_iter_init(&iter, index->words);
+    while (g_hash_table_iter_next(&iter, &word, &postings)) {
+        GArray *array = postings;
+        guint j, n = 0;
+
+        for (j = 0; j < array->len; j++) {
+            guint32 docno = new_numbers[g_array_index(array, guint32, j)];
+
+            if (docno != G_MAXUINT32)
+                g_array_index(array, guint32, n++) = docno;
+        }
+        if (n == 0)
+            g_hash_table_iter_remove(&iter);
+        else
+            g_array_set_size(array, n);
+    }
+    g_free(new_numbers);
+
+    lbsi_drop_suffixes(index);
+    g_hash_table_remove_all(index->results);
+    index->changed = TRUE;
+}
+
+gboolean
+libbalsa_search_index_save(LibBalsaSearchIndex * index,
+                           GHashTable * live_keys, GError ** error)
+{
+    GByteArray *buf;
+    GHashTableIter iter;
+    gpointer word, postings;
+    gboolean retval;
+    guint i;
+
+    g_return_val_if_fail(index != NULL, FALSE);
+
+    g_mutex_lock(&index->lock);
+
+    if (live_keys != NULL)
+        lbsi_collect(index, live_keys);
+    if (!index->changed) {
+        g_mutex_unlock(&index->lock);
+        return TRUE;
+    }
+
+    buf = g_byte_array_new();
+    g_byte_array_append(buf, (const guint8 *) LBSI_MAGIC, LBSI_MAGIC_LEN);
+    lbsi_put_uint32(buf, LBSI_VERSION);
+    lbsi_put_uint32(buf, index->docs->len);
+    for (i = 0; i < index->docs->len; i++) {
+        LbsiDoc *doc = &g_array_index(index->docs, LbsiDoc, i);
+        gsize len = strlen(doc->key);
+
+        lbsi_put_varint(buf, len);
+        g_byte_array_append(buf, (const guint8 *) doc->key, len);
+        g_byte_array_append(buf, &doc->flags, 1);
+    }
+
+    lbsi_put_uint32(buf, g_hash_table_size(index->words));
+    g_hash_table_iter_init(&iter, index->words);
+    while (g_hash_table_iter_next(&iter, &word, &postings)) {
+        GArray *array = postings;
+        gsize len = strlen(word);
+        guint32 last = 0;
+        guint j;
+
+        lbsi_put_varint(buf, len);
+        g_byte_array_append(buf, word, len);
+        lbsi_put_varint(buf, array->len);
+        for (j = 0; j < array->len; j++) {
+            guint32 docno = g_array_index(array, guint32, j);
+
+            lbsi_put_varint(buf, docno - last);
+            last = docno;
+        }
+    }
+
+    libbalsa_assure_balsa_dir();
+    retval = g_file_set_contents(index->filename, (const gchar *) buf->data,
+                                 buf->len, error);
+    if (retval)
+        index->changed = FALSE;
+    g_byte_array_free(buf, TRUE);
+
+    g_mutex_unlock(&index->lock);
+
+    return retval;
+}
+
+/* Documents. */
+
+/* Each string is preceded by its length, so that different messages
+ * cannot have the same key. */
+gchar *
+libbalsa_search_index_key(const gchar * message_id, const gchar * from,
+                          const gchar * subject, time_t date, gulong size)
+{
+    const gchar *strings[3];
+    GString *key;
+    guint i;
+
+    if (message_id == NULL || *message_id == '\0')
+        return NULL;
+
+    strings[0] = message_id;
+    strings[1] = from != NULL ? from : "";
+    strings[2] = subject != NULL ? subject : "";
+    key = g_string_new(NULL);
+    for (i = 0; i < G_N_ELEMENTS(strings); i++)
+        g_string_append_printf(key, "%" G_GSIZE_FORMAT ":%s",
+                               strlen(strings[i]), strings[i]);
+    g_string_append_printf(key, "%" G_GINT64_FORMAT ":%lu", (gint64) date,
+                           size);
+
+    return g_string_free(key, FALSE);
+}
+
+gboolean
+libbalsa_search_index_has(LibBalsaSearchIndex * index, const gchar * key)
+{
+    gboolean retval;
+
+    g_return_val_if_fail(index != NULL, FALSE);
+    g_return_val_if_fail(key != NULL, FALSE);
+
+    g_mutex_lock(&index->lock);
+    retval = g_hash_table_contains(index->doc_numbers, key);
+    g_mutex_unlock(&index->lock);
+
+    return retval;
+}
+
+typedef struct {
+    LibBalsaSearchIndex *index;
+    guint32 docno;
+    gboolean partial;
+} LbsiAddInfo;
+
+static void
+lbsi_add_word(const gchar * word, gsize len, gboolean first,
+              gboolean last, gpointer data)
+{
+    LbsiAddInfo *info = data;
+    GArray *postings;
+
+    if (len > LBSI_MAX_WORD) {
+        info->partial = TRUE;
+        return;
+    }
+
+    postings = g_hash_table_lookup(info->index->words, word);
+    if (postings == NULL) {
+        postings = g_array_new(FALSE, FALSE, sizeof(guint32));
+        g_hash_table_insert(info->index->words, g_strndup(word, len),
+                            postings);
+        lbsi_drop_suffixes(info->index);
+    } else if (g_array_index(postings, guint32, postings->len - 1)
+               == info->docno)
+        return;
+
+    g_array_append_val(postings, info->docno);
+}
+
+void
+libbalsa_search_index_add(LibBalsaSearchIndex * index, const gchar * key,
+                          const gchar * const *texts, guint n_texts)
+{
+    LbsiAddInfo info;
+    guint i;
+
+    g_return_if_fail(index != NULL);
+    g_return_if_fail(key != NULL);
+
+    g_mutex_lock(&index->lock);
+
+    if (g_hash_table_contains(index->doc_numbers, key)) {
+        g_mutex_unlock(&index->lock);
+        return;
+    }
+
+    info.index = index;
+    info.docno = index->docs->len;
+    info.partial = FALSE;
+    for (i = 0; i < n_texts; i++) {
+        if (texts[i] == NULL)
+            continue;
+        if (g_utf8_validate(texts[i], -1, NULL))
+            lbsi_foreach_word(texts[i], lbsi_add_word, &info);
+        else
+            info.partial = TRUE;
+    }
+    lbsi_add_doc(index, g_strdup(key), info.partial ? LBSI_DOC_PARTIAL : 0);
+    index->changed = TRUE;
+
+    g_mutex_unlock(&index->lock);
+}
+
+/* Queries. */
+
+typedef struct {
+    gchar *word;
+    gsize len;
+    gboolean first;
+    gboolean last;
+} LbsiQueryWord;
+
+static void
+lbsi_query_word(const gchar * word, gsize len, gboolean first,
+                gboolean last, gpointer data)
+{
+    GArray *query = data;
+    LbsiQueryWord query_word;
+
+    query_word.word = g_strndup(word, len);
+    query_word.len = len;
+    query_word.first = first;
+    query_word.last = last;
+    g_array_append_val(query, query_word);
+}
+
+static gint
+lbsi_suffix_compare(const LbsiSuffix * a, const LbsiSuffix * b)
+{
+    return strcmp(a->suffix, b->suffix);
+}
+
+/* The suffixes begin at character boundaries: a query word, being valid
+ * UTF-8, cannot begin anywhere else. */
+static void
+lbsi_build_suffixes(LibBalsaSearchIndex * index)
+{
+    GHashTableIter iter;
+    gpointer word, postings;
+
+    index->suffixes = g_array_new(FALSE, FALSE, sizeof(LbsiSuffix));
+    g_hash_table_iter_init(&iter, index->words);
+    while (g_hash_table_iter_next(&iter, &word, &postings)) {
+        const gchar *p;
+
+        for (p = word; *p; p = g_utf8_next_char(p)) {
+            LbsiSuffix suffix;
+
+            suffix.suffix = p;
+            suffix.postings = postings;
+            suffix.whole = p == word;
+            g_array_append_val(index->suffixes, suffix);
+        }
+    }
+    g_array_sort(index->suffixes, (GCompareFunc) lbsi_suffix_compare);
+}
+
+/* The first suffix that does not sort before the query word; the
+ * suffixes that begin with it follow. */
+static guint
+lbsi_suffix_range(GArray * suffixes, const LbsiQueryWord * query_word)
+{
+    guint lo = 0, hi = suffixes->len;
+
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (strncmp(g_array_index(suffixes, LbsiSuffix, mid).suffix,
+                    query_word->word, query_word->len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/* Can the query word be part of an indexed word that has this suffix,
+ * given that the suffix begins with it? */
+static gboolean
+lbsi_suffix_matches(const LbsiSuffix * suffix,
+                    const LbsiQueryWord * query_word)
+{
+    if (!query_word->first)     /* must begin the word */
+        return suffix->whole;
+    if (!query_word->last)      /* must end the word */
+        return suffix->suffix[query_word->len] == '\0';
+    return TRUE;
+}
+
+static void
+lbsi_mark_postings(guint8 * bits, GArray * postings)
+{
+    guint i;
+
+    for (i = 0; i < postings->len; i++) {
+        guint32 docno = g_array_index(postings, guint32, i);
+
+        bits[docno / 8] |= 1 << (docno % 8);
+    }
+}
+
+static LbsiResult *
+lbsi_lookup(LibBalsaSearchIndex * index, const gchar * string)
+{
+    LbsiResult *result;
+    GArray *query;
+    guint8 *word_bits;
+    gsize n_bytes;
+    guint i;
+
+    result = g_hash_table_lookup(index->results, string);
+    if (result != NULL)
+        return result;
+
+    if (g_hash_table_size(index->results) >= LBSI_MAX_RESULTS)
+        g_hash_table_remove_all(index->results);
+    result = g_new0(LbsiResult, 1);
+    result->n_docs = index->docs->len;
+    g_hash_table_insert(index->results, g_strdup(string), result);
+
+    query = g_array_new(FALSE, FALSE, sizeof(LbsiQueryWord));
+    if (g_utf8_validate(string, -1, NULL))
+        lbsi_foreach_word(string, lbsi_query_word, query);
+    if (query->len == 0) {
+        g_array_free(query, TRUE);
+        return result;
+    }
+
+    n_bytes = (result->n_docs + 7) / 8;
+    result->may_match = g_malloc(n_bytes);
+    memset(result->may_match, 0xff, n_bytes);
+    word_bits = g_malloc(n_bytes);
+
+    for (i = 0; i < query->len; i++) {
+        LbsiQueryWord *query_word =
+            &g_array_index(query, LbsiQueryWord, i);
+        gsize j;
+
+        memset(word_bits, 0, n_bytes);
+        if (query_word->first || query_word->last) {
+            guint k;
+
+            if (index->suffixes == NULL)
+                lbsi_build_suffixes(index);
+            for (k = lbsi_suffix_range(index->suffixes, query_word);
+                 k < index->suffixes->len; k++) {
+                LbsiSuffix *suffix =
+                    &g_array_index(index->suffixes, LbsiSuffix, k);
+
+                if (strncmp(suffix->suffix, query_word->word,
+                            query_word->len) != 0)
+                    break;
+                if (lbsi_suffix_matches(suffix, query_word))
+                    lbsi_mark_postings(word_bits, suffix->postings);
+            }
+        } else {
+            GArray *postings =
+                g_hash_table_lookup(index->words, query_word->word);
+
+            if (postings != NULL)
+                lbsi_mark_postings(word_bits, postings);
+        }
+
+        for (j = 0; j < n_bytes; j++)
+            result->may_match[j] &= word_bits[j];
+        g_free(query_word->word);
+    }
+
+    g_free(word_bits);
+    g_array_free(query, TRUE);
+
+    return result;
+}
+
+static gboolean
+lbsi_excludes(LibBalsaSearchIndex * index, guint32 docno,
+              LibBalsaCondition * cond)
+{
+    LbsiResult *result;
+
+    if (cond->negate)
+        return FALSE;
+
+    switch (cond->type) {
+    case CONDITION_STRING:
+        if (CONDITION_CHKMATCH(cond, CONDITION_MATCH_US_HEAD)
+            || cond->match.string.string == NULL)
+            return FALSE;
+        result = lbsi_lookup(index, cond->match.string.string);
+        return result->may_match != NULL && docno < result->n_docs
+            && !(result->may_match[docno / 8] & (1 << (docno % 8)));
+    case CONDITION_AND:
+        return lbsi_excludes(index, docno, cond->match.andor.left)
+            || lbsi_excludes(index, docno, cond->match.andor.right);
+    case CONDITION_OR:
+        return lbsi_excludes(index, docno, cond->match.andor.left)
+            && lbsi_excludes(index, docno, cond->match.andor.right);
+    default:
+        return FALSE;
+    }
+}
+
+gboolean
+libbalsa_search_index_excludes(LibBalsaSearchIndex * index,
+                               const gchar * key, LibBalsaCondition * cond)
+{
+    gpointer value;
+    gboolean retval = FALSE;
+
+    g_return_val_if_fail(index != NULL, FALSE);
+
+    if (key == NULL || cond == NULL)
+        return FALSE;
+
+    g_mutex_lock(&index->lock);
+    value = g_hash_table_lookup(index->doc_numbers, key);
+    if (value != NULL) {
+        guint32 docno = GPOINTER_TO_UINT(value) - 1;
+
+        if (!(g_array_index(index->docs, LbsiDoc, docno).flags
+              & LBSI_DOC_PARTIAL))
+            retval = lbsi_excludes(index, docno, cond);
+    }
+    g_mutex_unlock(&index->lock);
+
+    return retval;
+}
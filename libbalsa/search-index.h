@@ -0,0 +1,76 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ *
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * search-index.h
+ *
+ * A persistent inverted index of the words in the messages of a
+ * mailbox, used to skip messages that cannot match a string condition
+ * without loading them.
+ *
+ * A message is identified by a key made of its Message-ID, sender,
+ * subject, date and size, so that the index does not depend on message
+ * numbers; messages without a Message-ID are not indexed.  The index is
+ * only ever used to rule messages out: a message that is not in the
+ * index, or a condition that the index cannot decide, falls back to the
+ * normal match.
+ */
+
+#ifndef __LIBBALSA_SEARCH_INDEX_H__
+#define __LIBBALSA_SEARCH_INDEX_H__
+
+#include <glib.h>
+#include <time.h>
+
+#include "filter.h"
+
+typedef struct _LibBalsaSearchIndex LibBalsaSearchIndex;
+
+LibBalsaSearchIndex *libbalsa_search_index_new(const gchar * filename);
+void libbalsa_search_index_free(LibBalsaSearchIndex * index);
+
+/* Write the index back to its file, if it has changed; when live_keys
+ * is not NULL, messages whose keys are not in it are dropped. */
+gboolean libbalsa_search_index_save(LibBalsaSearchIndex * index,
+                                    GHashTable * live_keys,
+                                    GError ** error);
+
+/* The key of a message, or NULL if it has no Message-ID. */
+gchar *libbalsa_search_index_key(const gchar * message_id,
+                                 const gchar * from,
+                                 const gchar * subject,
+                                 time_t date, gulong size);
+
+gboolean libbalsa_search_index_has(LibBalsaSearchIndex * index,
+                                   const gchar * key);
+/* Index the words of a message; texts holds everything a string
+ * condition may look at, headers and body text; NULL texts are
+ * skipped. */
+void libbalsa_search_index_add(LibBalsaSearchIndex * index,
+                               const gchar * key,
+                               const gchar * const *texts,
+                               guint n_texts);
+
+/* TRUE if the message with this key certainly does not match cond. */
+gboolean libbalsa_search_index_excludes(LibBalsaSearchIndex * index,
+                                        const gchar * key,
+                                        LibBalsaCondition * cond);
+
+#endif                          /* __LIBBALSA_SEARCH_INDEX_H__ */
@@ -57,14 +57,29 @@ struct _MessageQueueItem {
     LibBalsaMessage *orig;
     GMimeStream *stream;
     NetClientSmtpMessage *smtp_msg;
+    guint attempts;             /* # of transient failures so far */
+    gint64 not_before;          /* monotonic time of the next attempt */
+    gint64 sent;                /* bytes sent in this attempt */
 };
 
+/* The queued messages for one SMTP server are sent by a pool of up to
+ * libbalsa_smtp_server_get_connections() worker threads, each with its
+ * own session.  The workers take the messages from a shared queue; a
+ * message which failed with a transient error is put back, to be
+ * retried after a delay, so it does not hold up the others. */
 struct _SendMessageInfo {
 	LibBalsaSmtpServer *smtp_server;
     LibBalsaMailbox *outbox;
-    NetClientSmtp *session;
+    NetClientSmtp *session;     /* session for the first worker */
     LibBalsaFccboxFinder finder;
     GList *items;               /* of MessageQueueItem */
+    GMutex queue_lock;          /* protects the members below, and the progress */
+    GCond queue_cond;
+    GQueue queue;               /* of MessageQueueItem, not sent yet */
+    guint in_flight;            /* # of messages being sent */
+    guint workers;              /* # of running workers */
+    gboolean session_failed;    /* a worker could not set up its session */
+    gboolean result;
     gboolean no_dialog;
     gchar *progress_id;
     gint64 total_size;
@@ -94,6 +109,10 @@ static gint retrigger_send = 0;		/* # of messages added to outbox while the smtp
 
 static ProgressDialog send_progress_dialog;
 
+/* Retrying messages which failed with a transient error. */
+#define LBS_SEND_MAX_ATTEMPTS   3
+#define LBS_SEND_RETRY_DELAY    10      /* seconds, doubled for each retry */
+
 
 /* end of state variables section */
 
@@ -207,6 +226,10 @@ send_message_info_new(LibBalsaSmtpServer   *smtp_server,
     smi->finder = finder;
     smi->smtp_server = g_object_ref(smtp_server);
     smi->progress_id = g_strdup_printf(_("SMTP server %s"), libbalsa_smtp_server_get_name(smtp_server));
+    g_mutex_init(&smi->queue_lock);
+    g_cond_init(&smi->queue_cond);
+    g_queue_init(&smi->queue);
+    smi->result = TRUE;
     return smi;
 }
 
@@ -226,6 +249,9 @@ send_message_info_destroy(SendMessageInfo *smi)
     if (smi->progress_id != NULL) {
     	g_free(smi->progress_id);
     }
+    g_queue_clear(&smi->queue);
+    g_mutex_clear(&smi->queue_lock);
+    g_cond_clear(&smi->queue_cond);
     g_object_unref(smi->smtp_server);
     g_free(smi);
 }
@@ -595,6 +621,27 @@ add_recipients(NetClientSmtpMessage *message,
 }
 
 
+/* Check if the message to send contains 8-bit data, which is the case
+ * if it has been composed with 8bit transfer encoding. */
+static gboolean
+lbs_stream_has_8bit(GMimeStream *stream)
+{
+    GByteArray *data;
+    guint i;
+
+    if (!GMIME_IS_STREAM_MEM(stream))
+        return FALSE;
+
+    data = g_mime_stream_mem_get_byte_array(GMIME_STREAM_MEM(stream));
+    for (i = 0; i < data->len; i++) {
+        if ((data->data[i] & 0x80) != 0)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+
 static gssize
 send_message_data_cb(gchar   *buffer,
                      gsize    count,
@@ -610,6 +657,8 @@ send_message_data_cb(gchar   *buffer,
         gdouble fraction;
         gint ipercent;
 
+        g_mutex_lock(&smi->queue_lock);
+    	mqi->sent += read_res;
     	smi->total_sent += read_res;
     	fraction = (gdouble) smi->total_sent / (gdouble) smi->total_size;
     	g_debug("%s: s=%lu t=%lu %g", __func__, (unsigned long) smi->total_sent, (unsigned long) smi->total_size, fraction);
@@ -622,6 +671,7 @@ send_message_data_cb(gchar   *buffer,
     			_("Message %u of %u"), smi->curr_msg, smi->msg_count);
     		smi->last_report = ipercent;
         }
+        g_mutex_unlock(&smi->queue_lock);
     }
     return read_res;
 }
@@ -765,6 +815,9 @@ lbs_process_queue_msg(guint 		   msgno,
 		/* Estimate the size of the message.  This need not be exact but it's better to err
 		 * on the large side since some message headers may be altered during the transfer. */
 		send_message_info->total_size += g_mime_stream_length(new_message->stream);
+		net_client_smtp_msg_set_size(new_message->smtp_msg,
+					     (gsize) g_mime_stream_length(new_message->stream),
+					     lbs_stream_has_8bit(new_message->stream));
 		send_message_info->msg_count++;
 	}
 	g_object_unref(msg);
@@ -772,7 +825,8 @@ lbs_process_queue_msg(guint 		   msgno,
 
 
 static NetClientSmtp *
-lbs_process_queue_init_session(LibBalsaServer* server)
+lbs_process_queue_init_session(LibBalsaServer *server,
+                               GError        **error)
 {
         NetClientCryptMode security;
         const gchar *host;
@@ -794,17 +848,14 @@ lbs_process_queue_init_session(LibBalsaServer* server)
 	/* load client certificate if configured */
 	if (libbalsa_server_get_client_cert(server)) {
                 const gchar *cert_file = libbalsa_server_get_cert_file(server);
-		GError* error = NULL;
 
 		g_signal_connect(session, "cert-pass", G_CALLBACK(libbalsa_server_get_cert_pass), server);
-		if (!net_client_set_cert_from_file(NET_CLIENT(session), cert_file, &error)) {
-			libbalsa_information(LIBBALSA_INFORMATION_ERROR, _("Cannot load certificate file %s: %s"), cert_file,
-				error->message);
+		if (!net_client_set_cert_from_file(NET_CLIENT(session), cert_file, error)) {
 			/* bad certificate private key password: clear it */
-			if (error->code == NET_CLIENT_ERROR_CERT_KEY_PASS) {
+			if (g_error_matches(*error, NET_CLIENT_ERROR_QUARK, NET_CLIENT_ERROR_CERT_KEY_PASS)) {
 				libbalsa_server_set_password(server, NULL, TRUE);
 			}
-			g_error_free(error);
+			g_prefix_error(error, _("Cannot load certificate file %s: "), cert_file);
 			g_object_unref(session);
 			session = NULL;
 		}
@@ -833,10 +884,14 @@ lbs_process_queue_real(LibBalsaSmtpServer *smtp_server, SendQueueInfo *send_info
 
     if (libbalsa_mailbox_open(send_info->outbox, NULL)) {
     	NetClientSmtp *session;
+    	GError *error = NULL;
 
     	/* create the SMTP session */
-    	session = lbs_process_queue_init_session(LIBBALSA_SERVER(smtp_server));
-    	if (session != NULL) {
+    	session = lbs_process_queue_init_session(LIBBALSA_SERVER(smtp_server), &error);
+    	if (session == NULL) {
+    		libbalsa_information(LIBBALSA_INFORMATION_ERROR, "%s", error->message);
+    		g_error_free(error);
+    	} else {
         	SendMessageInfo *send_message_info;
         	guint msgno;
 
@@ -849,7 +904,11 @@ lbs_process_queue_real(LibBalsaSmtpServer *smtp_server, SendQueueInfo *send_info
     		/* launch the thread for sending the messages only if we collected any */
     		if (send_message_info->items != NULL) {
     			GThread *send_mail;
+    			GList *item;
 
+    			for (item = send_message_info->items; item != NULL; item = item->next) {
+    				g_queue_push_tail(&send_message_info->queue, item->data);
+    			}
     			if (send_info->parent != NULL) {
     				libbalsa_progress_dialog_ensure(&send_progress_dialog, _("Sending Mail"), send_info->parent,
     					send_message_info->progress_id);
@@ -858,6 +917,8 @@ lbs_process_queue_real(LibBalsaSmtpServer *smtp_server, SendQueueInfo *send_info
     				send_message_info->no_dialog = TRUE;
     			}
     			g_atomic_int_inc(&sending_threads);
+    			/* the first worker starts the others when it has connected */
+    			send_message_info->workers = 1U;
     			send_mail = g_thread_new("balsa_send_message_real", (GThreadFunc) balsa_send_message_real, send_message_info);
     			g_thread_unref(send_mail);
     			thread_started = TRUE;
@@ -915,12 +976,6 @@ libbalsa_process_queue(LibBalsaMailbox     *outbox,
 }
 
 
-/* balsa_send_message_real:
-   does the actual message sending.
-   This function may be called as a thread.
-   Also, structure info should be freed before exiting.
- */
-
 static gboolean
 balsa_send_message_real_idle_cb(LibBalsaMailbox *outbox)
 {
@@ -1029,111 +1084,292 @@ balsa_send_message_syslog(const gchar            *smtp_server,
 	}
 }
 
-static gpointer
-balsa_send_message_real(SendMessageInfo *info)
+/* Take the next message to send from the queue, waiting until a
+ * deferred message is due or another worker puts a message back.
+ * Returns NULL when there is nothing left to do. */
+static MessageQueueItem *
+lbs_send_queue_next(SendMessageInfo *info)
+{
+    MessageQueueItem *mqi = NULL;
+
+    g_mutex_lock(&info->queue_lock);
+    for (;;) {
+        GList *item;
+        gint64 now = g_get_monotonic_time();
+        gint64 next_due = G_MAXINT64;
+
+        for (item = info->queue.head; item != NULL; item = item->next) {
+            MessageQueueItem *this_mqi = (MessageQueueItem *) item->data;
+
+            if (this_mqi->not_before <= now) {
+                mqi = this_mqi;
+                g_queue_delete_link(&info->queue, item);
+                break;
+            }
+            next_due = MIN(next_due, this_mqi->not_before);
+        }
+        if (mqi != NULL) {
+            info->in_flight++;
+            break;
+        }
+        if (g_queue_is_empty(&info->queue)) {
+            if (info->in_flight == 0U) {
+                break;
+            }
+            /* another worker may put its message back */
+            g_cond_wait(&info->queue_cond, &info->queue_lock);
+        } else {
+            g_cond_wait_until(&info->queue_cond, &info->queue_lock, next_due);
+        }
+    }
+    g_mutex_unlock(&info->queue_lock);
+
+    return mqi;
+}
+
+
+/* Done with a message taken from the queue; if retry is TRUE, put it
+ * back, to be sent again after a delay. */
+static void
+lbs_send_queue_done(SendMessageInfo  *info,
+                    MessageQueueItem *mqi,
+                    gboolean          retry)
+{
+    g_mutex_lock(&info->queue_lock);
+    info->in_flight--;
+    if (retry) {
+        mqi->not_before = g_get_monotonic_time() +
+            (gint64) (LBS_SEND_RETRY_DELAY << (mqi->attempts - 1U)) * G_USEC_PER_SEC;
+        g_queue_push_tail(&info->queue, mqi);
+    }
+    g_cond_broadcast(&info->queue_cond);
+    g_mutex_unlock(&info->queue_lock);
+}
+
+
+static NetClientSmtp *
+lbs_send_connect(SendMessageInfo *info,
+                 NetClientSmtp   *session,
+                 GError         **error)
 {
-    gboolean result;
-    GError *error = NULL;
     gchar *greeting = NULL;
+    gboolean result;
 
-    g_debug("%s: starting", __func__);
+    if (session == NULL) {
+        session = lbs_process_queue_init_session(LIBBALSA_SERVER(info->smtp_server), error);
+        if (session == NULL) {
+            /* not worth retrying, but the messages have not been tried */
+            g_mutex_lock(&info->queue_lock);
+            info->session_failed = TRUE;
+            g_mutex_unlock(&info->queue_lock);
+            return NULL;
+        }
+    }
 
-    /* connect the SMTP server */
     if (!info->no_dialog) {
 		libbalsa_progress_dialog_update(&send_progress_dialog, info->progress_id, FALSE, INFINITY,
-			_("Connecting %s…"), net_client_get_host(NET_CLIENT(info->session)));
+			_("Connecting %s…"), net_client_get_host(NET_CLIENT(session)));
     }
-    result = net_client_smtp_connect(info->session, &greeting, &error);
-    g_debug("%s: connect = %d [%p]: '%s'", __func__, result, info->items, greeting);
+    result = net_client_smtp_connect(session, &greeting, error);
+    g_debug("%s: connect = %d: '%s'", __func__, result, greeting);
     g_free(greeting);
-    if (result) {
-        GList *this_msg;
+    if (!result) {
+        g_object_unref(session);
+        return NULL;
+    }
 
-        if (!info->no_dialog) {
-    		libbalsa_progress_dialog_update(&send_progress_dialog, info->progress_id, FALSE, 0.0,
-    			_("Connected to %s"), net_client_get_host(NET_CLIENT(info->session)));
-        }
+    if (!info->no_dialog) {
+		libbalsa_progress_dialog_update(&send_progress_dialog, info->progress_id, FALSE, 0.0,
+			_("Connected to %s"), net_client_get_host(NET_CLIENT(session)));
+    }
 
-        for (this_msg = info->items; this_msg != NULL; this_msg = this_msg->next) {
+    return session;
+}
+
+
+/* Send one message; returns TRUE if it shall be retried later. */
+static gboolean
+lbs_send_one(SendMessageInfo  *info,
+             NetClientSmtp    *session,
+             MessageQueueItem *mqi,
+             GError          **error)
+{
+    gboolean send_res;
+    gchar *server_reply = NULL;
+    LibBalsaMailbox *mailbox;
+
+    mailbox = mqi->orig != NULL ? libbalsa_message_get_mailbox(mqi->orig) : NULL;
+
+    g_mutex_lock(&info->queue_lock);
+    if (mqi->attempts == 0U) {
+        info->curr_msg++;
+    }
+    /* count a message sent again only once in the progress */
+    info->total_sent -= mqi->sent;
+    mqi->sent = 0;
+    g_debug("%s: %u/%u mqi = %p", __func__, info->msg_count, info->curr_msg, mqi);
+    g_mutex_unlock(&info->queue_lock);
+
+    /* send the message */
+    g_mime_stream_reset(mqi->stream);
+    send_res = net_client_smtp_send_msg(session, mqi->smtp_msg, &server_reply, error);
+    balsa_send_message_syslog(net_client_get_host(NET_CLIENT(session)), mqi, send_res, server_reply, *error);
+    g_free(server_reply);
+
+    if (!send_res && ERROR_IS_TRANSIENT(*error) && (++mqi->attempts < LBS_SEND_MAX_ATTEMPTS)) {
+        g_debug("%s: mqi = %p, attempt %u failed: %s", __func__, mqi, mqi->attempts, (*error)->message);
+        return TRUE;
+    }
+
+    g_mutex_lock(&send_messages_lock);
+    if (mailbox != NULL) {
+        libbalsa_message_change_flags(mqi->orig, 0, LIBBALSA_MESSAGE_FLAG_FLAGGED);
+    } else {
+        g_message("mqi: %p mqi->orig: %p mailbox: %p\n",
+                  mqi, mqi->orig, mailbox);
+    }
+
+    if (send_res) {
+        /* sending message successful */
+		balsa_send_message_success(mqi, info);
+    } else {
+        /* sending message failed */
+		balsa_send_message_error(mqi, *error);
+        info->result = FALSE;
+    }
+
+    /* free data */
+    g_mutex_unlock(&send_messages_lock);
+
+    return FALSE;
+}
+
+
+/* The last worker could not connect the server: report the error, and
+ * leave the messages which have not been sent in the outbox. */
+static void
+lbs_send_connect_failed(SendMessageInfo *info,
+                        GError          *error)
+{
+    if (ERROR_IS_TRANSIENT(error) || info->session_failed ||
+        g_error_matches(error, NET_CLIENT_SMTP_ERROR_QUARK, NET_CLIENT_ERROR_SMTP_AUTHFAIL)) {
+        GList *this_msg;
+
+        /* Mark all messages as neither flagged nor deleted, so they can be resent later
+         * without changing flags. */
+        for (this_msg = info->queue.head; this_msg != NULL; this_msg = this_msg->next) {
             MessageQueueItem *mqi = (MessageQueueItem *) this_msg->data;
-            gboolean send_res;
-            gchar *server_reply = NULL;
             LibBalsaMailbox *mailbox;
 
-            mailbox = mqi->orig != NULL ? libbalsa_message_get_mailbox(mqi->orig) : NULL;
-
-            info->curr_msg++;
-            g_debug("%s: %u/%u mqi = %p", __func__, info->msg_count, info->curr_msg, mqi);
-            /* send the message */
-            send_res = net_client_smtp_send_msg(info->session, mqi->smtp_msg, &server_reply, &error);
-            balsa_send_message_syslog(net_client_get_host(NET_CLIENT(info->session)), mqi, send_res, server_reply, error);
-            g_free(server_reply);
+            mailbox = mqi->orig != NULL ?
+                libbalsa_message_get_mailbox(mqi->orig) : NULL;
 
-            g_mutex_lock(&send_messages_lock);
             if (mailbox != NULL) {
-                libbalsa_message_change_flags(mqi->orig, 0, LIBBALSA_MESSAGE_FLAG_FLAGGED);
-            } else {
-                g_message("mqi: %p mqi->orig: %p mailbox: %p\n",
-                          mqi, mqi->orig, mailbox);
+                libbalsa_message_change_flags(mqi->orig,
+                                              0,
+                                              LIBBALSA_MESSAGE_FLAG_FLAGGED |
+                                              LIBBALSA_MESSAGE_FLAG_DELETED);
             }
+        }
+    	if (g_error_matches(error, NET_CLIENT_SMTP_ERROR_QUARK, NET_CLIENT_ERROR_SMTP_AUTHFAIL)) {
+    		/* authentication failed: clear password */
+    		libbalsa_server_set_password(LIBBALSA_SERVER(info->smtp_server), NULL, FALSE);
+    	}
+    }
+    libbalsa_information(LIBBALSA_INFORMATION_ERROR,
+                         _("Connecting SMTP server %s (%s) failed: %s"),
+                         libbalsa_smtp_server_get_name(info->smtp_server),
+                         libbalsa_server_get_host(LIBBALSA_SERVER(info->smtp_server)),
+                         error->message);
+    info->result = FALSE;
+}
 
-            if (send_res) {
-                /* sending message successful */
-				balsa_send_message_success(mqi, info);
-            } else {
-                /* sending message failed */
-				balsa_send_message_error(mqi, error);
-                g_clear_error(&error);
-                result = FALSE;
-            }
 
-            /* free data */
-            g_mutex_unlock(&send_messages_lock);
+/* balsa_send_message_real:
+   a sending worker; the first one is started by lbs_process_queue_real,
+   and starts the others when it has connected the server.  The last
+   worker to finish cleans up.
+ */
+static gpointer
+balsa_send_message_real(SendMessageInfo *info)
+{
+    NetClientSmtp *session;
+    MessageQueueItem *mqi = NULL;
+    GError *error = NULL;
+    gboolean first;
+    gboolean last;
+
+    g_debug("%s: starting", __func__);
+
+    /* connect the SMTP server; only the first worker finds a session */
+    g_mutex_lock(&info->queue_lock);
+    session = info->session;
+    info->session = NULL;
+    g_mutex_unlock(&info->queue_lock);
+    first = (session != NULL);
+    session = lbs_send_connect(info, session, &error);
+
+    /* start the other workers, now that we know the server accepts us */
+    if (first && (session != NULL)) {
+        guint workers;
+        guint n;
+
+        g_mutex_lock(&info->queue_lock);
+        workers = MIN(libbalsa_smtp_server_get_connections(info->smtp_server), g_queue_get_length(&info->queue));
+        for (n = 1U; n < workers; n++) {
+            GThread *send_mail;
+
+            info->workers++;
+            send_mail = g_thread_new("balsa_send_message_real", (GThreadFunc) balsa_send_message_real, info);
+            g_thread_unref(send_mail);
         }
-    } else {
-        if (ERROR_IS_TRANSIENT(error) || (error->code == NET_CLIENT_ERROR_SMTP_AUTHFAIL)) {
-            GList *this_msg;
-
-            /* Mark all messages as neither flagged nor deleted, so they can be resent later
-             * without changing flags. */
-            for (this_msg = info->items; this_msg != NULL; this_msg = this_msg->next) {
-                MessageQueueItem *mqi = (MessageQueueItem *) this_msg->data;
-                LibBalsaMailbox *mailbox;
-
-                mailbox = mqi->orig != NULL ?
-                    libbalsa_message_get_mailbox(mqi->orig) : NULL;
-
-                if (mailbox != NULL) {
-                    libbalsa_message_change_flags(mqi->orig,
-                                                  0,
-                                                  LIBBALSA_MESSAGE_FLAG_FLAGGED |
-                                                  LIBBALSA_MESSAGE_FLAG_DELETED);
-                }
-            }
-        	if (error->code == NET_CLIENT_ERROR_SMTP_AUTHFAIL) {
-        		/* authentication failed: clear password */
-        		libbalsa_server_set_password(LIBBALSA_SERVER(info->smtp_server), NULL, FALSE);
-        	}
+        g_mutex_unlock(&info->queue_lock);
+    }
+
+    while ((session != NULL) && ((mqi = lbs_send_queue_next(info)) != NULL)) {
+        gboolean retry;
+
+        retry = lbs_send_one(info, session, mqi, &error);
+        lbs_send_queue_done(info, mqi, retry);
+
+        /* a lost connection is re-established for the next message */
+        if ((error != NULL) && g_error_matches(error, NET_CLIENT_ERROR_QUARK, NET_CLIENT_ERROR_CONNECTION_LOST)) {
+            g_clear_error(&error);
+            g_object_unref(session);
+            session = lbs_send_connect(info, NULL, &error);
+        } else {
+            g_clear_error(&error);
+        }
+    }
+
+    /* finalise the SMTP session (which may be slow) */
+    if (session != NULL) {
+        g_object_unref(session);
+    }
+
+    g_mutex_lock(&info->queue_lock);
+    last = (--info->workers == 0U);
+    g_cond_broadcast(&info->queue_cond);
+    g_mutex_unlock(&info->queue_lock);
+    if (error != NULL) {
+        if (last && !g_queue_is_empty(&info->queue)) {
+            lbs_send_connect_failed(info, error);
+        } else {
+            g_debug("%s: worker gives up: %s", __func__, error->message);
         }
-        libbalsa_information(LIBBALSA_INFORMATION_ERROR,
-                             _("Connecting SMTP server %s (%s) failed: %s"),
-                             libbalsa_smtp_server_get_name(info->smtp_server),
-                             net_client_get_host(NET_CLIENT(info->session)),
-                             error->message);
         g_error_free(error);
     }
+    if (!last) {
+        return NULL;
+    }
 
     /* close outbox in an idle callback, as it might affect the display */
     g_idle_add((GSourceFunc) balsa_send_message_real_idle_cb, g_object_ref(info->outbox));
 
-    /* finalise the SMTP session (which may be slow) */
-    g_object_unref(info->session);
-    info->session = NULL;
-
     /* clean up */
     if (!info->no_dialog) {
 		libbalsa_progress_dialog_update(&send_progress_dialog, info->progress_id, TRUE, 1.0, _("Finished"));
-    } else if (result) {
+    } else if (info->result) {
     	libbalsa_information(LIBBALSA_INFORMATION_MESSAGE,
     		ngettext("Transmitted %u message to %s", "Transmitted %u messages to %s", info->msg_count),
 			info->msg_count, libbalsa_smtp_server_get_name(info->smtp_server));
@@ -1728,16 +1964,11 @@ libbalsa_fill_msg_queue_item_from_queu(LibBalsaMessage  *message,
         g_mime_stream_filter_add(GMIME_STREAM_FILTER(filter_stream), filter);
         g_object_unref(filter);
 
-        /* add CRLF */
+        /* add CRLF; the SMTP client does the dot-stuffing if needed */
         filter = g_mime_filter_unix2dos_new(FALSE);
         g_mime_stream_filter_add(GMIME_STREAM_FILTER(filter_stream), filter);
         g_object_unref(filter);
 
-        /* encode dot */
-        filter = g_mime_filter_smtp_data_new();
-        g_mime_stream_filter_add(GMIME_STREAM_FILTER(filter_stream), filter);
-        g_object_unref(filter);
-
         /* write to a new stream */
         mqi->stream = g_mime_stream_mem_new();
         g_mime_stream_write_to_stream(filter_stream, mqi->stream);
@@ -40,6 +40,7 @@ struct _LibBalsaSmtpServer {
 
     gchar *name;
     guint big_message; /* size of partial messages; in kB; 0 disables splitting */
+    guint connections; /* max. number of parallel sessions when sending the queue */
     gint lock_state;	/* 0 means unlocked; access via atomic operations */
 };
 
@@ -77,6 +78,7 @@ static void
 libbalsa_smtp_server_init(LibBalsaSmtpServer * smtp_server)
 {
     libbalsa_server_set_protocol(LIBBALSA_SERVER(smtp_server), "smtp");
+    smtp_server->connections = 1U;
 }
 
 /* Public methods */
@@ -114,6 +116,9 @@ libbalsa_smtp_server_new_from_config(const gchar * name)
     libbalsa_server_load_config(LIBBALSA_SERVER(smtp_server));
 
     smtp_server->big_message = libbalsa_conf_get_int("BigMessage=0");
+    smtp_server->connections =
+        CLAMP(libbalsa_conf_get_int("Connections=1"), 1,
+              LIBBALSA_SMTP_SERVER_MAX_CONNECTIONS);
 
     return smtp_server;
 }
@@ -124,6 +129,7 @@ libbalsa_smtp_server_save_config(LibBalsaSmtpServer * smtp_server)
     libbalsa_server_save_config(LIBBALSA_SERVER(smtp_server));
 
     libbalsa_conf_set_int("BigMessage", smtp_server->big_message);
+    libbalsa_conf_set_int("Connections", smtp_server->connections);
 }
 
 void
@@ -147,6 +153,12 @@ libbalsa_smtp_server_get_big_message(LibBalsaSmtpServer * smtp_server)
     return smtp_server->big_message * 1024;
 }
 
+guint
+libbalsa_smtp_server_get_connections(LibBalsaSmtpServer * smtp_server)
+{
+    return smtp_server->connections;
+}
+
 static gint
 smtp_server_compare(gconstpointer a, gconstpointer b)
 {
@@ -208,6 +220,7 @@ struct smtp_server_dialog_info {
     LibBalsaServerCfg *notebook;
     GtkWidget *split_button;
     GtkWidget *big_message;
+    GtkWidget *connections;
 };
 
 /* GDestroyNotify for smtp_server_dialog_info. */
@@ -258,6 +271,8 @@ smtp_server_response(GtkDialog * dialog, gint response,
         } else {
         	sdi->smtp_server->big_message = 0U;
         }
+        sdi->smtp_server->connections =
+            gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(sdi->connections));
         break;
     default:
         break;
@@ -365,6 +380,14 @@ libbalsa_smtp_server_dialog(LibBalsaSmtpServer * smtp_server,
     g_signal_connect(sdi->split_button, "toggled", G_CALLBACK(smtp_server_changed), sdi);
     g_signal_connect(sdi->big_message, "changed", G_CALLBACK(smtp_server_changed), sdi);
 
+    /* parallel sessions when sending the queue */
+    sdi->connections =
+        gtk_spin_button_new_with_range(1, LIBBALSA_SMTP_SERVER_MAX_CONNECTIONS, 1);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(sdi->connections),
+                              smtp_server->connections);
+    libbalsa_server_cfg_add_item(sdi->notebook, FALSE,
+                                 _("_Max number of connections:"), sdi->connections);
+
     smtp_server_changed(NULL, sdi);
 
     gtk_widget_show_all(dialog);
@@ -41,6 +41,10 @@ const gchar *libbalsa_smtp_server_get_name(LibBalsaSmtpServer *
                                            smtp_server);
 guint libbalsa_smtp_server_get_big_message(LibBalsaSmtpServer *
                                            smtp_server);
+/* Sessions opened in parallel to send the queued messages. */
+#define LIBBALSA_SMTP_SERVER_MAX_CONNECTIONS 8
+guint libbalsa_smtp_server_get_connections(LibBalsaSmtpServer *
+                                           smtp_server);
 void libbalsa_smtp_server_add_to_list(LibBalsaSmtpServer * smtp_server,
                                       GSList ** server_list);
 
@@ -0,0 +1,317 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * abook-completion-bench: time address completion in a large vCard
+ * address book, as the recipient entry asks for it on every keystroke.
+ *
+ * A synthetic book is written to a temporary file.  Names, nick names
+ * and address local parts of random entries are typed one character at
+ * a time, and each prefix is completed:
+ *   - by the address book, through its completion index;
+ *   - by a LibBalsaCompletion over the same items, walking all of them
+ *     as the book used to.
+ * The benchmark fails if the two disagree, or if an address added to
+ * the book is not found afterwards.
+ *
+ * Usage: abook-completion-bench [number-of-entries]
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "libbalsa.h"
+#include "abook-completion.h"
+#include "completion.h"
+
+#define BENCH_DEFAULT_ENTRIES 40000
+#define BENCH_QUERIES         300
+
+static const gchar *const first_names[] = {
+    "Anna", "Bernd", "Carla", "Dieter", "Emma", "Felix", "Greta", "Hans",
+    "Ines", "Jonas", "Klara", "Lukas", "Marie", "Niklas", "Olga", "Paul",
+    "Rita", "Stefan", "Tina", "Uwe", "Vera", "Walter", "Xenia", "Yusuf",
+    "Zoe"
+};
+static const gchar *const last_names[] = {
+    "Adler", "Becker", "Conrad", "Dietrich", "Engel", "Fischer", "Graf",
+    "Hoffmann", "Jansen", "Keller", "Lange", "Meyer", "Neumann", "Otto",
+    "Peters", "Richter", "Schmidt", "Vogel", "Weber", "Zimmermann"
+};
+
+static gchar *
+bench_first(guint n)
+{
+    return g_strdup(first_names[n % G_N_ELEMENTS(first_names)]);
+}
+
+static gchar *
+bench_last(guint n)
+{
+    return g_strdup_printf("%s%u",
+                           last_names[(n / G_N_ELEMENTS(first_names))
+                                      % G_N_ELEMENTS(last_names)],
+                           n % 97);
+}
+
+static gboolean
+bench_write_card(FILE * stream, guint n)
+{
+    gchar *first = bench_first(n);
+    gchar *last = bench_last(n);
+    gboolean ok;
+
+    ok = fprintf(stream,
+                 "BEGIN:VCARD\n"
+                 "FN:%s %s\n"
+                 "N:%s;%s\n"
+                 "NICKNAME:%c%c%u\n"
+                 "EMAIL;INTERNET:%s.%s.%u@example.org\n"
+                 "END:VCARD\n\n",
+                 first, last, last, first, first[0], last[0], n,
+                 first, last, n) > 0;
+    g_free(first);
+    g_free(last);
+
+    return ok;
+}
+
+static gchar *
+bench_casefold(const gchar * str)
+{
+    gchar *str_n = g_utf8_normalize(str, -1, G_NORMALIZE_ALL);
+    gchar *str_f = g_utf8_casefold(str_n, -1);
+
+    g_free(str_n);
+
+    return str_f;
+}
+
+/* The reference: the items the book used to complete with, in the
+ * order it loads them. */
+static LibBalsaABErr
+bench_load_cb(LibBalsaAddressBook * ab, LibBalsaAddress * address,
+              gpointer data)
+{
+    GList **items = data;
+    guint n_addrs, n;
+
+    if (address == NULL)
+        return LBABERR_OK;
+
+    n_addrs = libbalsa_address_get_n_addrs(address);
+    for (n = 0; n < n_addrs; ++n) {
+        InternetAddress *ia =
+            internet_address_mailbox_new(libbalsa_address_get_full_name
+                                         (address),
+                                         libbalsa_address_get_nth_addr
+                                         (address, n));
+
+        *items = g_list_prepend(*items,
+                                completion_data_new(ia,
+                                                    libbalsa_address_get_nick_name
+                                                    (address)));
+        g_object_unref(ia);
+    }
+
+    return LBABERR_OK;
+}
+
+static gboolean
+bench_same(GList * found, GList * expected, const gchar * prefix)
+{
+    for (; found != NULL && expected != NULL;
+         found = found->next, expected = expected->next) {
+        InternetAddress *ia = found->data;
+        CompletionData *data = expected->data;
+
+        if (ia != data->ia) {
+            gchar *a = internet_address_to_string(ia, NULL, FALSE);
+            gchar *b = internet_address_to_string(data->ia, NULL, FALSE);
+            gboolean same = strcmp(a, b) == 0;
+
+            g_free(a);
+            g_free(b);
+            if (!same)
+                break;
+        }
+    }
+
+    if (found != NULL || expected != NULL) {
+        g_printerr("completions of “%s” differ\n", prefix);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* What to type: a word of a random entry. */
+static gchar *
+bench_query(GRand * rand, guint n_entries)
+{
+    guint n = g_rand_int_range(rand, 0, n_entries);
+    gchar *first = bench_first(n);
+    gchar *last = bench_last(n);
+    gchar *query;
+
+    switch (g_rand_int_range(rand, 0, 4)) {
+    case 0:
+        query = g_strdup(first);
+        break;
+    case 1:
+        query = g_strdup(last);
+        break;
+    case 2:
+        query = g_strdup_printf("%c%c%u", first[0], last[0], n);
+        break;
+    default:
+        query = g_strdup_printf("%s.%s.%u", first, last, n);
+        break;
+    }
+    g_free(first);
+    g_free(last);
+
+    return query;
+}
+
+int
+main(int argc, char *argv[])
+{
+    guint n_entries;
+    gchar *dir, *path;
+    FILE *stream;
+    LibBalsaAddressBook *ab;
+    LibBalsaCompletion *reference;
+    GList *items = NULL;
+    GRand *rand;
+    gint64 start, book_time = 0, reference_time = 0;
+    guint keystrokes = 0;
+    guint q, n;
+    gboolean ok = TRUE;
+    GList *found;
+
+    n_entries = argc > 1 ? strtoul(argv[1], NULL, 10)
+        : BENCH_DEFAULT_ENTRIES;
+    if (n_entries == 0) {
+        g_printerr("usage: %s [number-of-entries]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    libbalsa_init();
+
+    if ((dir = g_dir_make_tmp("balsa-abook-XXXXXX", NULL)) == NULL) {
+        g_printerr("could not create a temporary directory\n");
+        return EXIT_FAILURE;
+    }
+    path = g_build_filename(dir, "addressbook.vcf", NULL);
+    if ((stream = fopen(path, "w")) == NULL) {
+        g_printerr("could not create %s\n", path);
+        return EXIT_FAILURE;
+    }
+    for (n = 0; n < n_entries; n++)
+        if (!bench_write_card(stream, n)) {
+            g_printerr("could not write %s\n", path);
+            return EXIT_FAILURE;
+        }
+    fclose(stream);
+
+    ab = libbalsa_address_book_vcard_new("bench", path);
+    libbalsa_address_book_set_expand_aliases(ab, TRUE);
+
+    /* The first completion loads the book. */
+    start = g_get_monotonic_time();
+    found = libbalsa_address_book_alias_complete(ab, "a");
+    g_print("%-24s %8u entries %10.3f s\n", "load", n_entries,
+            (g_get_monotonic_time() - start) / 1e6);
+    g_list_free_full(found, g_object_unref);
+
+    libbalsa_address_book_load(ab, NULL, bench_load_cb, &items);
+    items = g_list_reverse(items);
+    reference = libbalsa_completion_new((LibBalsaCompletionFunc)
+                                        completion_data_extract);
+    libbalsa_completion_set_compare(reference, strncmp_word);
+    libbalsa_completion_add_items(reference, items);
+
+    rand = g_rand_new_with_seed(42);
+    for (q = 0; q < BENCH_QUERIES && ok; q++) {
+        gchar *query = bench_query(rand, n_entries);
+        glong len = g_utf8_strlen(query, -1);
+        glong i;
+
+        for (i = 1; i <= len && ok; i++) {
+            gchar *typed = g_utf8_substring(query, 0, i);
+            gchar *prefix = bench_casefold(typed);
+            GList *expected;
+
+            start = g_get_monotonic_time();
+            found = libbalsa_address_book_alias_complete(ab, prefix);
+            book_time += g_get_monotonic_time() - start;
+
+            start = g_get_monotonic_time();
+            expected = libbalsa_completion_complete(reference, prefix);
+            reference_time += g_get_monotonic_time() - start;
+
+            ok = bench_same(found, expected, prefix);
+            g_list_free_full(found, g_object_unref);
+            g_free(prefix);
+            g_free(typed);
+            keystrokes++;
+        }
+        g_free(query);
+    }
+    g_rand_free(rand);
+
+    g_print("%-24s %8u keystrokes %10.3f s\n", "index", keystrokes,
+            book_time / 1e6);
+    g_print("%-24s %8u keystrokes %10.3f s\n", "walk all items",
+            keystrokes, reference_time / 1e6);
+
+    /* A change to the book is seen by the next completion. */
+    if (ok) {
+        stream = fopen(path, "a");
+        ok = stream != NULL
+            && fprintf(stream, "BEGIN:VCARD\nFN:Quentin Quokka\n"
+                       "EMAIL;INTERNET:quentin@example.org\n"
+                       "END:VCARD\n") > 0;
+        if (stream != NULL)
+            fclose(stream);
+        found = libbalsa_address_book_alias_complete(ab, "quokka");
+        if (g_list_length(found) != 1) {
+            g_printerr("the address added to the book was not found\n");
+            ok = FALSE;
+        }
+        g_list_free_full(found, g_object_unref);
+    }
+
+    g_list_foreach(items, (GFunc) completion_data_free, NULL);
+    g_list_free(items);
+    libbalsa_completion_free(reference);
+    g_object_unref(ab);
+    g_unlink(path);
+    g_rmdir(dir);
+    g_free(path);
+    g_free(dir);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+#
+# Compare two result files of mail-suite-bench --results, for instance
+# from builds of two commits:
+#
+#   bench-compare.py before.tsv after.tsv [threshold-percent]
+#
+# Each benchmark in both files is printed with both times and their
+# ratio; a benchmark that is slower by more than the threshold (10% by
+# default) is marked, and makes the exit status 1.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2, or (at your option)
+# any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+import sys
+
+
+def load(filename):
+    results = {}
+    with open(filename) as f:
+        for line in f:
+            fields = line.rstrip('\n').split('\t')
+            if len(fields) != 4:
+                continue
+            suite, what, count, seconds = fields
+            results[(suite, what)] = (int(count), float(seconds))
+    return results
+
+
+def main(argv):
+    if len(argv) < 3:
+        sys.stderr.write('usage: %s before after [threshold-percent]\n'
+                         % argv[0])
+        return 2
+    before = load(argv[1])
+    after = load(argv[2])
+    threshold = 1.0 + (float(argv[3]) if len(argv) > 3 else 10.0) / 100.0
+    slower = 0
+
+    for key in sorted(before.keys() & after.keys()):
+        count, old = before[key]
+        new_count, new = after[key]
+        if new_count != count:
+            print('%-32s counts differ: %d, %d' % (' '.join(key), count,
+                                                  new_count))
+            continue
+        ratio = new / old if old > 0 else 1.0
+        mark = ''
+        if ratio > threshold:
+            mark = ' slower'
+            slower += 1
+        print('%-32s %10.3f s %10.3f s %7.2fx%s'
+              % (' '.join(key), old, new, ratio, mark))
+
+    return 1 if slower > 0 else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,726 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include "bench-corpus.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <glib/gstdio.h>
+
+#define BENCH_CORPUS_REPLY_PERCENT  60
+#define BENCH_CORPUS_NEEDLE_PERCENT 1
+#define BENCH_CORPUS_RECENT         50  /* messages a reply may answer */
+#define BENCH_CORPUS_QUOTED_LINES   3
+#define BENCH_CORPUS_EPOCH          G_GINT64_CONSTANT(1704067200)
+#define BENCH_CORPUS_NEEDLE         "needle"
+
+/* The words and names of the messages. */
+
+static const gchar *const ascii_words[] = {
+    "mail", "meeting", "report", "budget", "release", "server", "client",
+    "patch", "review", "draft", "schedule", "invoice", "project",
+    "update", "question", "answer", "holiday", "lunch", "thread",
+    "index", "folder", "filter", "search", "message", "attachment",
+    "weekend", "status", "plan", "team", "deadline", "the", "a", "of",
+    "for", "and", "to", "with", "about", "next", "new"
+};
+
+static const gchar *const ascii_names[] = {
+    "Alice Archer", "Bob Baker", "Carol Carter", "Dave Dalton",
+    "Eve Evans", "Frank Fisher", "Grace Gordon", "Heidi Hughes"
+};
+
+static const gchar *const latin1_words[] = {
+    "Grüße", "café", "naïve", "über", "señor", "déjà", "Straße", "garçon"
+};
+
+static const gchar *const latin1_names[] = {
+    "François Müller", "Åsa Ørsted", "José Núñez"
+};
+
+static const gchar *const koi8_words[] = {
+    "привет", "письмо", "отчет", "встреча", "проект", "сервер"
+};
+
+static const gchar *const koi8_names[] = {
+    "Иван Петров", "Мария Смирнова"
+};
+
+static const gchar *const utf8_words[] = {
+    "ünïcödé", "日本語", "Ελληνικά", "привет", "café", "中文"
+};
+
+static const gchar *const utf8_names[] = {
+    "Jürgen Ωmega", "山田 太郎", "Zoë Łukasiewicz"
+};
+
+typedef struct {
+    const gchar *charset;       /* NULL for US-ASCII */
+    const gchar *encoding;      /* Content-Transfer-Encoding */
+    const gchar *const *words;
+    guint n_words;
+    const gchar *const *names;
+    guint n_names;
+} BenchCharset;
+
+static const BenchCharset charsets[] = {
+    { NULL, "7bit", ascii_words, G_N_ELEMENTS(ascii_words),
+      ascii_names, G_N_ELEMENTS(ascii_names) },
+    { "ISO-8859-1", "quoted-printable", latin1_words,
+      G_N_ELEMENTS(latin1_words), latin1_names,
+      G_N_ELEMENTS(latin1_names) },
+    { "KOI8-R", "quoted-printable", koi8_words, G_N_ELEMENTS(koi8_words),
+      koi8_names, G_N_ELEMENTS(koi8_names) },
+    { "UTF-8", "8bit", utf8_words, G_N_ELEMENTS(utf8_words),
+      utf8_names, G_N_ELEMENTS(utf8_names) }
+};
+
+static const gchar *const week_days[] = {
+    "Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"
+};
+
+static const gchar *const months[] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+/* What a reply needs to know about the message it answers. */
+typedef struct {
+    gchar *message_id;
+    gchar *references;
+    gchar *subject;             /* UTF-8, without "Re: " */
+    gchar *sender;
+    gchar *quote;               /* its first lines */
+    guint depth;
+} BenchCorpusParent;
+
+struct _BenchCorpus {
+    GPtrArray *messages;
+    GArray *lengths;
+    guint threads;
+    guint subject_needles;
+};
+
+static void
+bench_corpus_parent_free(BenchCorpusParent * parent)
+{
+    g_free(parent->message_id);
+    g_free(parent->references);
+    g_free(parent->subject);
+    g_free(parent->sender);
+    g_free(parent->quote);
+    g_free(parent);
+}
+
+static const gchar *
+bench_word(GRand * rand, const BenchCharset * charset)
+{
+    /* Mostly ASCII words, even in other charsets. */
+    if (charset->charset != NULL && g_rand_int_range(rand, 0, 4) == 0)
+        return charset->words[g_rand_int_range(rand, 0, charset->n_words)];
+
+    return ascii_words[g_rand_int_range(rand, 0,
+                                        G_N_ELEMENTS(ascii_words))];
+}
+
+/* Convert UTF-8 text to charset; NULL if it cannot be. */
+static gchar *
+bench_convert(const gchar * text, const BenchCharset * charset,
+              gsize * len)
+{
+    if (charset->charset == NULL
+        || g_ascii_strcasecmp(charset->charset, "UTF-8") == 0) {
+        *len = strlen(text);
+        return g_strdup(text);
+    }
+
+    return g_convert(text, -1, charset->charset, "UTF-8", NULL, len, NULL);
+}
+
+static gboolean
+bench_is_ascii(const gchar * text)
+{
+    for (; *text != '\0'; text++)
+        if (*text & 0x80)
+            return FALSE;
+
+    return TRUE;
+}
+
+/* A header value, as an RFC 2047 encoded word if it is not ASCII. */
+static void
+bench_append_header(GString * message, const gchar * name,
+                    const gchar * prefix, const gchar * value,
+                    const BenchCharset * charset)
+{
+    gchar *converted, *base64;
+    gsize len;
+
+    if (bench_is_ascii(value)) {
+        g_string_append_printf(message, "%s: %s%s\n", name, prefix, value);
+        return;
+    }
+
+    /* A reply may quote a subject its charset cannot show. */
+    if (charset->charset == NULL
+        || (converted = bench_convert(value, charset, &len)) == NULL) {
+        charset = &charsets[G_N_ELEMENTS(charsets) - 1];
+        converted = bench_convert(value, charset, &len);
+    }
+
+    base64 = g_base64_encode((guchar *) converted, len);
+    g_string_append_printf(message, "%s: %s=?%s?B?%s?=\n", name, prefix,
+                           charset->charset, base64);
+    g_free(base64);
+    g_free(converted);
+}
+
+static void
+bench_append_qp(GString * message, const gchar * text, gsize len)
+{
+    gsize i, column = 0;
+
+    for (i = 0; i < len; i++) {
+        guchar c = text[i];
+
+        if (c == '\n') {
+            g_string_append_c(message, '\n');
+            column = 0;
+            continue;
+        }
+        if (column >= 72) {
+            g_string_append(message, "=\n");
+            column = 0;
+        }
+        if (c >= 0x80 || c == '=') {
+            g_string_append_printf(message, "=%02X", c);
+            column += 3;
+        } else {
+            g_string_append_c(message, c);
+            column++;
+        }
+    }
+}
+
+/* A text part: the headers, a blank line and the encoded text. */
+static void
+bench_append_text_part(GString * message, const gchar * subtype,
+                       const gchar * text, const BenchCharset * charset)
+{
+    gchar *converted;
+    gsize len;
+
+    /* A reply may quote text its charset cannot show. */
+    if ((charset->charset == NULL && !bench_is_ascii(text))
+        || (converted = bench_convert(text, charset, &len)) == NULL) {
+        charset = &charsets[G_N_ELEMENTS(charsets) - 1];
+        converted = bench_convert(text, charset, &len);
+    }
+
+    g_string_append_printf(message,
+                           "Content-Type: text/%s; charset=%s\n"
+                           "Content-Transfer-Encoding: %s\n\n",
+                           subtype,
+                           charset->charset != NULL ? charset->charset
+                           : "us-ascii", charset->encoding);
+    if (strcmp(charset->encoding, "quoted-printable") == 0)
+        bench_append_qp(message, converted, len);
+    else
+        g_string_append_len(message, converted, len);
+    g_free(converted);
+}
+
+static gchar *
+bench_html(const gchar * text)
+{
+    GString *html = g_string_new("<html><body>\n");
+    gchar **lines = g_strsplit(text, "\n", -1);
+    guint i;
+
+    for (i = 0; lines[i] != NULL; i++) {
+        gchar *escaped;
+
+        if (lines[i][0] == '\0')
+            continue;
+        escaped = g_markup_escape_text(lines[i], -1);
+        g_string_append_printf(html, "<p>%s</p>\n", escaped);
+        g_free(escaped);
+    }
+    g_strfreev(lines);
+    g_string_append(html, "</body></html>\n");
+
+    return g_string_free(html, FALSE);
+}
+
+static void
+bench_append_attachment(GString * message, GRand * rand, guint n, guint k)
+{
+    guint size = g_rand_int_range(rand, 512, 4096);
+    guchar *data = g_malloc(size);
+    gchar *base64;
+    gsize i, len;
+    guint j;
+
+    for (j = 0; j < size; j++)
+        data[j] = g_rand_int_range(rand, 0, 256);
+    base64 = g_base64_encode(data, size);
+    g_free(data);
+
+    g_string_append_printf(message,
+                           "Content-Type: application/octet-stream; "
+                           "name=\"file%u-%u.bin\"\n"
+                           "Content-Disposition: attachment; "
+                           "filename=\"file%u-%u.bin\"\n"
+                           "Content-Transfer-Encoding: base64\n\n",
+                           n, k, n, k);
+    len = strlen(base64);
+    for (i = 0; i < len; i += 76) {
+        g_string_append_len(message, base64 + i, MIN(76, len - i));
+        g_string_append_c(message, '\n');
+    }
+    g_free(base64);
+}
+
+static gchar *
+bench_date(gint64 t)
+{
+    GDateTime *date = g_date_time_new_from_unix_utc(t);
+    gchar *text;
+
+    text = g_strdup_printf("%s, %02d %s %d %02d:%02d:%02d +0000",
+                           week_days[g_date_time_get_day_of_week(date) - 1],
+                           g_date_time_get_day_of_month(date),
+                           months[g_date_time_get_month(date) - 1],
+                           g_date_time_get_year(date),
+                           g_date_time_get_hour(date),
+                           g_date_time_get_minute(date),
+                           g_date_time_get_second(date));
+    g_date_time_unref(date);
+
+    return text;
+}
+
+/* Pick an earlier message to reply to, or NULL to start a thread. */
+static BenchCorpusParent *
+bench_pick_parent(GRand * rand, const BenchCorpusSpec * spec,
+                  GPtrArray * parents)
+{
+    guint tries;
+
+    if (spec->thread_depth == 0 || parents->len == 0
+        || g_rand_int_range(rand, 0, 100) >= BENCH_CORPUS_REPLY_PERCENT)
+        return NULL;
+
+    for (tries = 0; tries < 4; tries++) {
+        guint recent = MIN(parents->len, BENCH_CORPUS_RECENT);
+        BenchCorpusParent *parent =
+            g_ptr_array_index(parents,
+                              parents->len - 1 -
+                              g_rand_int_range(rand, 0, recent));
+
+        if (parent->depth < spec->thread_depth)
+            return parent;
+    }
+
+    return NULL;
+}
+
+static gchar *
+bench_message(BenchCorpus * corpus, const BenchCorpusSpec * spec,
+              GRand * rand, guint n, GPtrArray * parents)
+{
+    const BenchCharset *charset = &charsets[0];
+    BenchCorpusParent *parent, *self;
+    GString *message, *text, *quote;
+    const gchar *name;
+    gchar *date, *address;
+    guint n_parts, n_lines, i;
+
+    if (g_rand_int_range(rand, 0, 100) < (gint) spec->charset_mix)
+        charset = &charsets[g_rand_int_range(rand, 1,
+                                             G_N_ELEMENTS(charsets))];
+    parent = bench_pick_parent(rand, spec, parents);
+
+    self = g_new0(BenchCorpusParent, 1);
+    self->message_id = g_strdup_printf("<%u.%u@corpus.example>", n,
+                                       spec->seed);
+    name = charset->names[g_rand_int_range(rand, 0, charset->n_names)];
+    address = g_strdup_printf("user%u@example.org",
+                              g_rand_int_range(rand, 0, 64));
+    self->sender = g_strdup(name);
+
+    if (parent != NULL) {
+        self->subject = g_strdup(parent->subject);
+        self->references = parent->references != NULL
+            ? g_strconcat(parent->references, " ", parent->message_id,
+                          NULL)
+            : g_strdup(parent->message_id);
+        self->depth = parent->depth + 1;
+    } else {
+        GString *subject = g_string_new(NULL);
+        guint n_words = g_rand_int_range(rand, 2, 7);
+
+        for (i = 0; i < n_words; i++) {
+            if (i > 0)
+                g_string_append_c(subject, ' ');
+            g_string_append(subject, bench_word(rand, charset));
+        }
+        if (g_rand_int_range(rand, 0, 100) < BENCH_CORPUS_NEEDLE_PERCENT)
+            g_string_append(subject, " " BENCH_CORPUS_NEEDLE);
+        self->subject = g_string_free(subject, FALSE);
+        corpus->threads++;
+    }
+    if (strstr(self->subject, BENCH_CORPUS_NEEDLE) != NULL)
+        corpus->subject_needles++;
+
+    /* The text; its first lines are quoted by replies. */
+    text = g_string_new(NULL);
+    quote = g_string_new(NULL);
+    if (parent != NULL) {
+        g_string_append_printf(text, "%s wrote:\n", parent->sender);
+        g_string_append(text, parent->quote);
+        g_string_append_c(text, '\n');
+    }
+    n_lines = g_rand_int_range(rand, 3, 21);
+    for (i = 0; i < n_lines; i++) {
+        guint n_words = g_rand_int_range(rand, 6, 13);
+        gsize start = text->len;
+        guint j;
+
+        for (j = 0; j < n_words; j++) {
+            if (j > 0)
+                g_string_append_c(text, ' ');
+            g_string_append(text, bench_word(rand, charset));
+        }
+        if (g_rand_int_range(rand, 0, 100) < BENCH_CORPUS_NEEDLE_PERCENT)
+            g_string_append(text, " " BENCH_CORPUS_NEEDLE);
+        g_string_append_c(text, '\n');
+
+        if (i < BENCH_CORPUS_QUOTED_LINES) {
+            g_string_append(quote, "> ");
+            g_string_append(quote, text->str + start);
+        }
+    }
+    self->quote = g_string_free(quote, FALSE);
+
+    /* The headers. */
+    message = g_string_new(NULL);
+    bench_append_header(message, "From", "", name, charset);
+    /* The address follows the (possibly encoded) display name. */
+    g_string_truncate(message, message->len - 1);
+    g_string_append_printf(message, " <%s>\n", address);
+    g_string_append(message, "To: rcpt@example.org\n");
+    bench_append_header(message, "Subject", parent != NULL ? "Re: " : "",
+                        self->subject, charset);
+    date = bench_date(BENCH_CORPUS_EPOCH + (gint64) n * 600
+                      + g_rand_int_range(rand, 0, 600));
+    g_string_append_printf(message, "Date: %s\n", date);
+    g_free(date);
+    g_string_append_printf(message, "Message-ID: %s\n", self->message_id);
+    if (parent != NULL)
+        g_string_append_printf(message, "In-Reply-To: %s\n"
+                               "References: %s\n", parent->message_id,
+                               self->references);
+    g_string_append(message, "MIME-Version: 1.0\n");
+
+    /* The body. */
+    n_parts = spec->mime_parts > 1
+        ? g_rand_int_range(rand, 1, spec->mime_parts + 1) : 1;
+    if (n_parts == 1) {
+        bench_append_text_part(message, "plain", text->str, charset);
+    } else {
+        gchar *html = bench_html(text->str);
+        /* Neither boundary may begin with the other. */
+        gchar *boundary = g_strdup_printf("=-alternative-%u", n);
+        gchar *mixed = g_strdup_printf("=-mixed-%u", n);
+
+        if (n_parts > 2)
+            g_string_append_printf(message,
+                                   "Content-Type: multipart/mixed; "
+                                   "boundary=\"%s\"\n\n"
+                                   "--%s\n", mixed, mixed);
+        g_string_append_printf(message,
+                               "Content-Type: multipart/alternative; "
+                               "boundary=\"%s\"\n\n--%s\n", boundary,
+                               boundary);
+        bench_append_text_part(message, "plain", text->str, charset);
+        g_string_append_printf(message, "\n--%s\n", boundary);
+        bench_append_text_part(message, "html", html, charset);
+        g_string_append_printf(message, "\n--%s--\n", boundary);
+        for (i = 2; i < n_parts; i++) {
+            g_string_append_printf(message, "\n--%s\n", mixed);
+            bench_append_attachment(message, rand, n, i);
+        }
+        if (n_parts > 2)
+            g_string_append_printf(message, "\n--%s--\n", mixed);
+        g_free(mixed);
+        g_free(boundary);
+        g_free(html);
+    }
+    if (message->str[message->len - 1] != '\n')
+        g_string_append_c(message, '\n');
+
+    g_string_free(text, TRUE);
+    g_free(address);
+    g_ptr_array_add(parents, self);
+
+    return g_string_free(message, FALSE);
+}
+
+BenchCorpus *
+bench_corpus_new(const BenchCorpusSpec * spec)
+{
+    BenchCorpus *corpus;
+    GPtrArray *parents;
+    GRand *rand;
+    guint n;
+
+    corpus = g_new0(BenchCorpus, 1);
+    corpus->messages = g_ptr_array_new_with_free_func(g_free);
+    corpus->lengths = g_array_new(FALSE, FALSE, sizeof(gsize));
+    parents = g_ptr_array_new_with_free_func((GDestroyNotify)
+                                             bench_corpus_parent_free);
+    rand = g_rand_new_with_seed(spec->seed);
+
+    for (n = 0; n < spec->messages; n++) {
+        gchar *message = bench_message(corpus, spec, rand, n, parents);
+        gsize len = strlen(message);
+
+        g_ptr_array_add(corpus->messages, message);
+        g_array_append_val(corpus->lengths, len);
+    }
+
+    g_rand_free(rand);
+    g_ptr_array_free(parents, TRUE);
+
+    return corpus;
+}
+
+void
+bench_corpus_free(BenchCorpus * corpus)
+{
+    g_ptr_array_free(corpus->messages, TRUE);
+    g_array_free(corpus->lengths, TRUE);
+    g_free(corpus);
+}
+
+const gchar *
+bench_corpus_get_message(BenchCorpus * corpus, guint n, gsize * len)
+{
+    g_return_val_if_fail(n < corpus->messages->len, NULL);
+
+    if (len != NULL)
+        *len = g_array_index(corpus->lengths, gsize, n);
+
+    return g_ptr_array_index(corpus->messages, n);
+}
+
+guint
+bench_corpus_get_length(BenchCorpus * corpus)
+{
+    return corpus->messages->len;
+}
+
+guint
+bench_corpus_get_threads(BenchCorpus * corpus)
+{
+    return corpus->threads;
+}
+
+guint
+bench_corpus_get_subject_needles(BenchCorpus * corpus)
+{
+    return corpus->subject_needles;
+}
+
+const gchar *
+bench_corpus_format_name(BenchCorpusFormat format)
+{
+    static const gchar *const names[] = { "mbox", "maildir", "mh" };
+
+    g_return_val_if_fail(format < BENCH_CORPUS_N_FORMATS, NULL);
+
+    return names[format];
+}
+
+/* Writing mailboxes. */
+
+static gboolean
+bench_set_error(GError ** err, const gchar * path)
+{
+    gint errsv = errno;
+
+    g_set_error(err, G_FILE_ERROR, g_file_error_from_errno(errsv),
+                "%s: %s", path, g_strerror(errsv));
+
+    return FALSE;
+}
+
+static gboolean
+bench_write_mbox(BenchCorpus * corpus, const gchar * path, guint first,
+                 guint count, GError ** err)
+{
+    FILE *file;
+    guint n;
+
+    if ((file = fopen(path, "ab")) == NULL)
+        return bench_set_error(err, path);
+
+    for (n = first; n < first + count; n++) {
+        const gchar *message = bench_corpus_get_message(corpus, n, NULL);
+        const gchar *line;
+
+        fprintf(file, "From user@example.org Mon Jan  1 00:00:00 2024\n");
+        for (line = message; *line != '\0';) {
+            const gchar *end = strchr(line, '\n');
+            gsize len = end != NULL ? (gsize) (end - line + 1)
+                : strlen(line);
+
+            if (g_str_has_prefix(line, "From "))
+                fputc('>', file);
+            fwrite(line, 1, len, file);
+            line += len;
+        }
+        fputc('\n', file);
+    }
+
+    if (fclose(file) != 0)
+        return bench_set_error(err, path);
+
+    return TRUE;
+}
+
+/* Deliver to new/ through tmp/, as a delivery agent does. */
+static gboolean
+bench_write_maildir(BenchCorpus * corpus, const gchar * path, guint first,
+                    guint count, GError ** err)
+{
+    static const gchar *const subdirs[] = { "cur", "new", "tmp" };
+    guint i, n;
+
+    for (i = 0; i < G_N_ELEMENTS(subdirs); i++) {
+        gchar *subdir = g_build_filename(path, subdirs[i], NULL);
+        gint rc = g_mkdir_with_parents(subdir, 0700);
+
+        if (rc != 0) {
+            bench_set_error(err, subdir);
+            g_free(subdir);
+            return FALSE;
+        }
+        g_free(subdir);
+    }
+
+    for (n = first; n < first + count; n++) {
+        const gchar *message;
+        gchar *name, *tmp, *new;
+        gsize len;
+        gboolean ok;
+
+        message = bench_corpus_get_message(corpus, n, &len);
+        name = g_strdup_printf("%" G_GINT64_FORMAT ".M%uP1.bench",
+                               BENCH_CORPUS_EPOCH, n);
+        tmp = g_build_filename(path, "tmp", name, NULL);
+        new = g_build_filename(path, "new", name, NULL);
+        ok = g_file_set_contents(tmp, message, len, err);
+        if (ok && g_rename(tmp, new) != 0)
+            ok = bench_set_error(err, new);
+        g_free(new);
+        g_free(tmp);
+        g_free(name);
+        if (!ok)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Number the messages after the last one there. */
+static gboolean
+bench_write_mh(BenchCorpus * corpus, const gchar * path, guint first,
+               guint count, GError ** err)
+{
+    gchar *sequences;
+    GDir *dir;
+    const gchar *name;
+    guint last = 0, n;
+
+    if (g_mkdir_with_parents(path, 0700) != 0)
+        return bench_set_error(err, path);
+
+    sequences = g_build_filename(path, ".mh_sequences", NULL);
+    if (!g_file_test(sequences, G_FILE_TEST_EXISTS)
+        && !g_file_set_contents(sequences, "", 0, err)) {
+        g_free(sequences);
+        return FALSE;
+    }
+    g_free(sequences);
+
+    if ((dir = g_dir_open(path, 0, err)) == NULL)
+        return FALSE;
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        gchar *end;
+        guint64 number = g_ascii_strtoull(name, &end, 10);
+
+        if (*end == '\0' && number > last)
+            last = number;
+    }
+    g_dir_close(dir);
+
+    for (n = first; n < first + count; n++) {
+        const gchar *message;
+        gchar *filename, *number;
+        gsize len;
+        gboolean ok;
+
+        message = bench_corpus_get_message(corpus, n, &len);
+        number = g_strdup_printf("%u", ++last);
+        filename = g_build_filename(path, number, NULL);
+        ok = g_file_set_contents(filename, message, len, err);
+        g_free(filename);
+        g_free(number);
+        if (!ok)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+gboolean
+bench_corpus_write(BenchCorpus * corpus, BenchCorpusFormat format,
+                   const gchar * path, guint first, guint count,
+                   GError ** err)
+{
+    g_return_val_if_fail(first + count <= corpus->messages->len, FALSE);
+
+    switch (format) {
+    case BENCH_CORPUS_MBOX:
+        return bench_write_mbox(corpus, path, first, count, err);
+    case BENCH_CORPUS_MAILDIR:
+        return bench_write_maildir(corpus, path, first, count, err);
+    case BENCH_CORPUS_MH:
+        return bench_write_mh(corpus, path, first, count, err);
+    default:
+        g_return_val_if_reached(FALSE);
+    }
+}
@@ -0,0 +1,80 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * bench-corpus.h
+ *
+ * A synthetic mail corpus for the benchmarks.
+ *
+ * The messages are made up from a seeded random number generator, so
+ * the same spec always gives the same corpus, byte for byte.  Some
+ * messages reply to earlier ones, in threads no deeper than the spec
+ * allows; some are multipart, with alternative HTML and binary
+ * attachments; some are in ISO-8859-1, KOI8-R or UTF-8, with encoded
+ * headers.  A few have the word "needle" in their subject or body, for
+ * searches to find.
+ */
+
+#ifndef __BENCH_CORPUS_H__
+#define __BENCH_CORPUS_H__
+
+#include <glib.h>
+
+typedef enum {
+    BENCH_CORPUS_MBOX,
+    BENCH_CORPUS_MAILDIR,
+    BENCH_CORPUS_MH,
+    BENCH_CORPUS_N_FORMATS
+} BenchCorpusFormat;
+
+typedef struct {
+    guint messages;
+    guint thread_depth;         /* of the longest chain of replies; 0 for
+                                 * no replies */
+    guint mime_parts;           /* the most parts in a message; 1 for
+                                 * plain text only */
+    guint charset_mix;          /* percentage of messages that are not
+                                 * in US-ASCII */
+    guint32 seed;
+} BenchCorpusSpec;
+
+typedef struct _BenchCorpus BenchCorpus;
+
+BenchCorpus *bench_corpus_new(const BenchCorpusSpec * spec);
+void bench_corpus_free(BenchCorpus * corpus);
+
+/* The text of message n, counting from 0, with LF line ends. */
+const gchar *bench_corpus_get_message(BenchCorpus * corpus, guint n,
+                                      gsize * len);
+guint bench_corpus_get_length(BenchCorpus * corpus);
+/* The number of messages that reply to no other. */
+guint bench_corpus_get_threads(BenchCorpus * corpus);
+/* The number of messages with "needle" in the subject. */
+guint bench_corpus_get_subject_needles(BenchCorpus * corpus);
+
+/* Write messages first to first + count - 1 to a mailbox at path, in
+ * format, creating it if needed; messages are appended to an existing
+ * mailbox, as a delivery agent would. */
+gboolean bench_corpus_write(BenchCorpus * corpus, BenchCorpusFormat format,
+                            const gchar * path, guint first, guint count,
+                            GError ** err);
+
+const gchar *bench_corpus_format_name(BenchCorpusFormat format);
+
+#endif                          /* __BENCH_CORPUS_H__ */
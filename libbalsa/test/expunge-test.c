@@ -0,0 +1,317 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * expunge-test: check that messages expunged together are removed in
+ * one batch:
+ *   - the IMAP handle collects a run of EXPUNGE responses from a
+ *     stand-in server, reports it once with the seqnos the messages had
+ *     before the run, and keeps the cached messages of the others;
+ *   - libbalsa_mailbox_msgnos_removed() emits "messages-expunged" once,
+ *     and leaves the view, the index and the registered msgno arrays
+ *     renumbered.
+ *
+ * Usage: expunge-test
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libbalsa.h"
+#include "mailbox.h"
+#include "imap-commands.h"
+#include "imap-handle.h"
+#include "imap-stand-in.h"
+
+#define TEST_MESSAGES 10
+
+static gboolean
+test_fail(const gchar * test, const gchar * what)
+{
+    g_printerr("%s: %s\n", test, what);
+
+    return FALSE;
+}
+
+/* Whether array holds the count values of expected. */
+static gboolean
+test_same(GArray * array, const guint * expected, guint count)
+{
+    return array != NULL && array->len == count
+        && memcmp(array->data, expected, count * sizeof(guint)) == 0;
+}
+
+/* The IMAP handle. */
+
+/* What the server sends, each seqno counted after the previous ones are
+ * gone, and which messages they are. */
+static const guint test_imap_sent[] = { 3, 3, 6, 1, 6 };
+static const guint test_imap_expunged[] = { 1, 3, 4, 9, 10 };
+static const guint test_imap_left[] = { 2, 5, 6, 7, 8 };
+
+static void
+test_expunge_notify(ImapMboxHandle * handle, GArray * seqnos,
+                    GArray ** notified)
+{
+    if (*notified != NULL) {
+        g_array_set_size(*notified, 0);  /* more than once */
+        return;
+    }
+    *notified = g_array_new(FALSE, FALSE, sizeof(guint));
+    g_array_append_vals(*notified, seqnos->data, seqnos->len);
+}
+
+static gboolean
+test_imap(void)
+{
+    ImapStandIn server;
+    ImapMboxHandle *handle;
+    GArray *notified = NULL;
+    gchar *host;
+    guint16 port;
+    gboolean readonly;
+    gboolean ok = TRUE;
+    guint i;
+
+    memset(&server, 0, sizeof server);
+    server.messages = TEST_MESSAGES;
+    server.expunged = test_imap_sent;
+    server.n_expunged = G_N_ELEMENTS(test_imap_sent);
+    if ((port = imap_stand_in_start(&server)) == 0)
+        return test_fail("imap", "could not start the server");
+
+    handle = imap_mbox_handle_new();
+    imap_handle_set_tls_mode(handle, NET_CLIENT_CRYPT_NONE);
+    host = g_strdup_printf("127.0.0.1:%u", port);
+    if (imap_mbox_handle_connect(handle, host) != IMAP_SUCCESS
+        || imap_mbox_select(handle, "INBOX", &readonly) != IMR_OK
+        || imap_mbox_handle_fetch_range(handle, 1, TEST_MESSAGES,
+                                        IMFETCH_UID) != IMR_OK) {
+        g_free(host);
+        g_object_unref(handle);
+        return test_fail("imap", "could not open the mailbox");
+    }
+    g_free(host);
+
+    g_signal_connect(handle, "expunge-notify",
+                     G_CALLBACK(test_expunge_notify), &notified);
+    if (imap_mbox_expunge(handle) != IMR_OK)
+        ok = test_fail("imap", "EXPUNGE failed");
+    else if (notified == NULL)
+        ok = test_fail("imap", "no expunge-notify");
+    else if (!test_same(notified, test_imap_expunged,
+                        G_N_ELEMENTS(test_imap_expunged)))
+        ok = test_fail("imap", "wrong seqnos, or notified more than once");
+    else if (imap_mbox_handle_get_exists(handle)
+             != G_N_ELEMENTS(test_imap_left))
+        ok = test_fail("imap", "wrong number of messages left");
+
+    for (i = 0; ok && i < G_N_ELEMENTS(test_imap_left); i++) {
+        ImapMessage *imsg = imap_mbox_handle_get_msg(handle, i + 1);
+
+        if (imsg == NULL || imsg->uid != test_imap_left[i])
+            ok = test_fail("imap", "wrong message cached after EXPUNGE");
+    }
+
+    if (notified != NULL)
+        g_array_free(notified, TRUE);
+    g_object_unref(handle);
+
+    return ok;
+}
+
+/* The mailbox. */
+
+#define TEST_TYPE_MAILBOX test_mailbox_get_type()
+G_DECLARE_FINAL_TYPE(TestMailbox, test_mailbox, TEST, MAILBOX,
+                     LibBalsaMailbox)
+
+struct _TestMailbox {
+    LibBalsaMailbox parent;
+};
+
+G_DEFINE_TYPE(TestMailbox, test_mailbox, LIBBALSA_TYPE_MAILBOX)
+
+static gboolean
+test_mailbox_open(LibBalsaMailbox * mailbox, GError ** err)
+{
+    return TRUE;
+}
+
+static void
+test_mailbox_close(LibBalsaMailbox * mailbox, gboolean expunge)
+{
+}
+
+static guint
+test_mailbox_total_messages(LibBalsaMailbox * mailbox)
+{
+    return TEST_MESSAGES;
+}
+
+/* The subject of a message tells its msgno before the expunge. */
+static LibBalsaMessage *
+test_mailbox_get_message(LibBalsaMailbox * mailbox, guint msgno)
+{
+    LibBalsaMessage *message = libbalsa_message_new();
+    gchar *subject;
+
+    libbalsa_message_set_mailbox(message, mailbox);
+    libbalsa_message_set_msgno(message, msgno);
+    subject = g_strdup_printf("Message %u", msgno);
+    libbalsa_message_set_subject(message, subject);
+    g_free(subject);
+
+    return message;
+}
+
+static gboolean
+test_mailbox_prepare_threading(LibBalsaMailbox * mailbox, guint start)
+{
+    return TRUE;
+}
+
+static void
+test_mailbox_class_init(TestMailboxClass * klass)
+{
+    LibBalsaMailboxClass *mailbox_class = LIBBALSA_MAILBOX_CLASS(klass);
+
+    mailbox_class->open_mailbox = test_mailbox_open;
+    mailbox_class->close_mailbox = test_mailbox_close;
+    mailbox_class->total_messages = test_mailbox_total_messages;
+    mailbox_class->get_message = test_mailbox_get_message;
+    mailbox_class->prepare_threading = test_mailbox_prepare_threading;
+}
+
+static void
+test_mailbox_init(TestMailbox * mailbox)
+{
+}
+
+static const guint test_removed[] = { 3, 4, 9 };
+static const guint test_kept[] = { 1, 2, 5, 6, 7, 8, 10 };
+/* A registered array, before and after. */
+static const guint test_selected[] = { 2, 5, 9, 10 };
+static const guint test_selected_after[] = { 2, 3, 7 };
+
+static void
+test_messages_expunged(LibBalsaMailbox * mailbox, GArray * msgnos,
+                       guint * emissions)
+{
+    if (test_same(msgnos, test_removed, G_N_ELEMENTS(test_removed)))
+        ++*emissions;
+    else
+        *emissions += 100;      /* wrong msgnos */
+}
+
+static gboolean
+test_mailbox(void)
+{
+    LibBalsaMailbox *mailbox;
+    LibBalsaMailboxView *view;
+    GtkTreeModel *model;
+    GArray *removed, *selected;
+    GNode *tree;
+    guint emissions = 0;
+    guint msgno, i;
+    gboolean ok = TRUE;
+
+    mailbox = g_object_new(TEST_TYPE_MAILBOX, NULL);
+    view = libbalsa_mailbox_view_new();
+    view->position = 0;         /* shown, so that entries are cached */
+    libbalsa_mailbox_set_view(mailbox, view);
+    if (!libbalsa_mailbox_open(mailbox, NULL)) {
+        g_object_unref(mailbox);
+        return test_fail("mailbox", "could not open the mailbox");
+    }
+
+    tree = g_node_new(NULL);
+    for (msgno = TEST_MESSAGES; msgno > 0; msgno--)
+        g_node_prepend_data(tree, GUINT_TO_POINTER(msgno));
+    libbalsa_mailbox_set_msg_tree(mailbox, tree);
+    for (msgno = 1; msgno <= TEST_MESSAGES; msgno++)
+        g_object_unref(libbalsa_mailbox_get_message(mailbox, msgno));
+
+    selected = g_array_new(FALSE, FALSE, sizeof(guint));
+    g_array_append_vals(selected, test_selected,
+                        G_N_ELEMENTS(test_selected));
+    libbalsa_mailbox_register_msgnos(mailbox, selected);
+    g_signal_connect(mailbox, "messages-expunged",
+                     G_CALLBACK(test_messages_expunged), &emissions);
+
+    removed = g_array_new(FALSE, FALSE, sizeof(guint));
+    g_array_append_vals(removed, test_removed, G_N_ELEMENTS(test_removed));
+    libbalsa_mailbox_msgnos_removed(mailbox, removed);
+    g_array_free(removed, TRUE);
+
+    if (emissions != 1)
+        ok = test_fail("mailbox", "messages-expunged not emitted once "
+                       "with the removed msgnos");
+    if (!test_same(selected, test_selected_after,
+                   G_N_ELEMENTS(test_selected_after)))
+        ok = test_fail("mailbox", "registered msgnos not renumbered");
+
+    /* The rows of the view, and their index entries, are the kept
+     * messages, renumbered in order. */
+    model = GTK_TREE_MODEL(mailbox);
+    if (gtk_tree_model_iter_n_children(model, NULL)
+        != G_N_ELEMENTS(test_kept))
+        ok = test_fail("mailbox", "wrong number of rows");
+    for (i = 0; ok && i < G_N_ELEMENTS(test_kept); i++) {
+        GtkTreeIter iter;
+        const gchar *subject;
+        gchar *expected;
+
+        if (!gtk_tree_model_iter_nth_child(model, &iter, NULL, i)
+            || GPOINTER_TO_UINT(((GNode *) iter.user_data)->data)
+            != i + 1) {
+            ok = test_fail("mailbox", "row not renumbered");
+            break;
+        }
+        subject = libbalsa_mailbox_msgno_get_subject(mailbox, i + 1);
+        expected = g_strdup_printf("Message %u", test_kept[i]);
+        if (g_strcmp0(subject, expected) != 0)
+            ok = test_fail("mailbox", "wrong index entry for a row");
+        g_free(expected);
+    }
+
+    libbalsa_mailbox_unregister_msgnos(mailbox, selected);
+    g_array_free(selected, TRUE);
+    libbalsa_mailbox_close(mailbox, FALSE);
+    g_object_unref(mailbox);
+
+    return ok;
+}
+
+int
+main(int argc, char *argv[])
+{
+    gboolean ok;
+
+    libbalsa_init();
+
+    ok = test_imap();
+    ok = test_mailbox() && ok;
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,273 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * html-to-text-bench: check the HTML to text conversion against a
+ * corpus, and time it.
+ *
+ * Each NAME.html in the corpus directory is converted at once, and
+ * streamed through the filter a few bytes at a time; both results must
+ * be NAME.txt.  The corpus is then converted repeatedly, and, if one of
+ * the html2text tools Balsa used to run is installed, run through it
+ * once per message, as the conversion used to be done.  With 0
+ * iterations, only the check is done, as under "meson test".
+ *
+ * Usage: html-to-text-bench corpus-directory [iterations]
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libbalsa.h"
+#include "html-to-text.h"
+
+#define BENCH_DEFAULT_ITERATIONS 200
+#define BENCH_TOOL_ITERATIONS    3
+#define BENCH_CHUNK              7
+
+typedef struct {
+    gchar *name;
+    gchar *path;
+    gchar *html;
+    gsize html_len;
+    gchar *text;
+} BenchCase;
+
+static void
+bench_case_free(BenchCase * bench_case)
+{
+    g_free(bench_case->name);
+    g_free(bench_case->path);
+    g_free(bench_case->html);
+    g_free(bench_case->text);
+    g_free(bench_case);
+}
+
+static GPtrArray *
+bench_load(const gchar * dir_name)
+{
+    GDir *dir;
+    const gchar *name;
+    GPtrArray *cases;
+    GError *err = NULL;
+
+    if ((dir = g_dir_open(dir_name, 0, &err)) == NULL) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        return NULL;
+    }
+
+    cases = g_ptr_array_new_with_free_func((GDestroyNotify)
+                                           bench_case_free);
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        BenchCase *bench_case;
+        gchar *txt_name, *txt_path;
+        gboolean ok;
+
+        if (!g_str_has_suffix(name, ".html"))
+            continue;
+
+        bench_case = g_new0(BenchCase, 1);
+        bench_case->name = g_strndup(name, strlen(name) - strlen(".html"));
+        bench_case->path = g_build_filename(dir_name, name, NULL);
+        txt_name = g_strconcat(bench_case->name, ".txt", NULL);
+        txt_path = g_build_filename(dir_name, txt_name, NULL);
+        ok = g_file_get_contents(bench_case->path, &bench_case->html,
+                                 &bench_case->html_len, &err)
+            && g_file_get_contents(txt_path, &bench_case->text, NULL,
+                                   &err);
+        g_free(txt_name);
+        g_free(txt_path);
+        g_ptr_array_add(cases, bench_case);
+
+        if (!ok) {
+            g_printerr("%s\n", err->message);
+            g_error_free(err);
+            g_ptr_array_free(cases, TRUE);
+            cases = NULL;
+            break;
+        }
+    }
+    g_dir_close(dir);
+
+    return cases;
+}
+
+/* Stream the HTML through the filter in small chunks. */
+static gchar *
+bench_stream(BenchCase * bench_case)
+{
+    GByteArray *array;
+    GMimeStream *stream, *filter_stream;
+    GMimeFilter *filter;
+    gsize i;
+    guint8 zero = 0;
+
+    array = g_byte_array_new();
+    stream = g_mime_stream_mem_new_with_byte_array(array);
+    g_mime_stream_mem_set_owner(GMIME_STREAM_MEM(stream), FALSE);
+    filter_stream = g_mime_stream_filter_new(stream);
+    g_object_unref(stream);
+    filter = libbalsa_html_to_text_new();
+    g_mime_stream_filter_add(GMIME_STREAM_FILTER(filter_stream), filter);
+    g_object_unref(filter);
+
+    for (i = 0; i < bench_case->html_len; i += BENCH_CHUNK)
+        g_mime_stream_write(filter_stream, bench_case->html + i,
+                            MIN(BENCH_CHUNK, bench_case->html_len - i));
+    g_mime_stream_flush(filter_stream);
+    g_object_unref(filter_stream);
+
+    g_byte_array_append(array, &zero, 1);
+
+    return (gchar *) g_byte_array_free(array, FALSE);
+}
+
+static gboolean
+bench_check(BenchCase * bench_case)
+{
+    gchar *text;
+    gboolean ok;
+
+    text = libbalsa_html_to_text_convert(bench_case->html,
+                                         bench_case->html_len);
+    ok = strcmp(text, bench_case->text) == 0;
+    if (!ok)
+        g_printerr("%s: converted to\n%s", bench_case->name, text);
+    g_free(text);
+    if (!ok)
+        return FALSE;
+
+    text = bench_stream(bench_case);
+    ok = strcmp(text, bench_case->text) == 0;
+    if (!ok)
+        g_printerr("%s: streamed to\n%s", bench_case->name, text);
+    g_free(text);
+
+    return ok;
+}
+
+/* The first of the tools configure used to look for. */
+static gchar *
+bench_find_tool(void)
+{
+    static const gchar *const tools[] = {
+        "python-html2text", "html2markdown", "html2markdown.py2",
+        "html2markdown.py3", "html2text"
+    };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(tools); i++) {
+        gchar *path = g_find_program_in_path(tools[i]);
+
+        if (path != NULL)
+            return path;
+    }
+
+    return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    GPtrArray *cases;
+    guint iterations;
+    guint i, n;
+    gsize bytes = 0;
+    gint64 start;
+    gdouble seconds;
+    gchar *tool;
+    gboolean ok = TRUE;
+
+    if (argc < 2) {
+        g_printerr("usage: %s corpus-directory [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    iterations = argc > 2 ? strtoul(argv[2], NULL, 10)
+        : BENCH_DEFAULT_ITERATIONS;
+
+    libbalsa_init();
+
+    if ((cases = bench_load(argv[1])) == NULL)
+        return EXIT_FAILURE;
+    if (cases->len == 0) {
+        g_printerr("no HTML files in %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < cases->len; i++)
+        if (!bench_check(g_ptr_array_index(cases, i)))
+            ok = FALSE;
+    if (!ok) {
+        g_ptr_array_free(cases, TRUE);
+        return EXIT_FAILURE;
+    }
+
+    start = g_get_monotonic_time();
+    for (n = 0; n < iterations; n++)
+        for (i = 0; i < cases->len; i++) {
+            BenchCase *bench_case = g_ptr_array_index(cases, i);
+
+            g_free(libbalsa_html_to_text_convert(bench_case->html,
+                                                 bench_case->html_len));
+            bytes += bench_case->html_len;
+        }
+    seconds = (g_get_monotonic_time() - start) / 1e6;
+    g_print("%-24s %8u messages %10.3f s %8.1f MB/s\n", "in process",
+            iterations * cases->len, seconds,
+            seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+
+    if (iterations == 0) {
+        /* Checking only. */
+    } else if ((tool = bench_find_tool()) != NULL) {
+        GError *err = NULL;
+
+        start = g_get_monotonic_time();
+        for (n = 0; n < BENCH_TOOL_ITERATIONS && ok; n++)
+            for (i = 0; i < cases->len && ok; i++) {
+                BenchCase *bench_case = g_ptr_array_index(cases, i);
+                gchar *tool_argv[] = { tool, bench_case->path, NULL };
+                gchar *result = NULL;
+
+                ok = g_spawn_sync(NULL, tool_argv, NULL,
+                                  G_SPAWN_STDERR_TO_DEV_NULL, NULL, NULL,
+                                  &result, NULL, NULL, &err);
+                g_free(result);
+            }
+        seconds = (g_get_monotonic_time() - start) / 1e6;
+
+        if (ok)
+            g_print("%-24s %8u messages %10.3f s\n", tool,
+                    BENCH_TOOL_ITERATIONS * cases->len, seconds);
+        else {
+            g_print("%-24s failed: %s\n", tool, err->message);
+            g_error_free(err);
+        }
+        g_free(tool);
+    } else
+        g_print("%-24s not installed\n", "html2text");
+
+    g_ptr_array_free(cases, TRUE);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,273 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * imap-body-cache-test: check that the IMAP body cache finds its data
+ * again after it was reopened: the index written at a checkpoint, the
+ * journal appended to it, a journal torn by a crash, and the segments
+ * rewritten by the compaction.
+ *
+ * Usage: imap-body-cache-test
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "imap-body-cache.h"
+#include "misc.h"
+
+#define TEST_MAX_SIZE (64 * 1024 * 1024)
+#define TEST_BIG_SIZE (5 * 1024 * 1024)
+#define TEST_WAIT     (10 * G_USEC_PER_SEC)
+
+static gchar *test_dir;
+
+static gboolean
+test_fail(const gchar * test, const gchar * what)
+{
+    g_printerr("%s: %s\n", test, what);
+
+    return FALSE;
+}
+
+static LibBalsaImapBodyCache *
+test_open(void)
+{
+    return libbalsa_imap_body_cache_new(test_dir, TEST_MAX_SIZE);
+}
+
+/* Whether key is cached with data, or not cached if data is NULL. */
+static gboolean
+test_lookup(LibBalsaImapBodyCache * cache, const gchar * key,
+            const gchar * data, gsize length)
+{
+    GMimeStream *stream, *mem;
+    GByteArray *array;
+    gboolean ok;
+
+    stream = libbalsa_imap_body_cache_lookup(cache, key);
+    if (stream == NULL)
+        return data == NULL;
+    if (data == NULL) {
+        g_object_unref(stream);
+        return FALSE;
+    }
+
+    array = g_byte_array_new();
+    mem = g_mime_stream_mem_new_with_byte_array(array);
+    g_mime_stream_mem_set_owner(GMIME_STREAM_MEM(mem), FALSE);
+    g_mime_stream_write_to_stream(stream, mem);
+    g_object_unref(mem);
+    g_object_unref(stream);
+
+    ok = array->len == length && memcmp(array->data, data, length) == 0;
+    g_byte_array_free(array, TRUE);
+
+    return ok;
+}
+
+static gboolean
+test_add(LibBalsaImapBodyCache * cache, const gchar * key,
+         const gchar * data)
+{
+    return libbalsa_imap_body_cache_add(cache, key, data, strlen(data));
+}
+
+/* Added, removed and copied entries survive a reopen. */
+static gboolean
+test_journal(void)
+{
+    LibBalsaImapBodyCache *cache;
+    FILE *tmp;
+    gboolean ok;
+
+    cache = test_open();
+    ok = test_add(cache, "a", "first body")
+        && test_add(cache, "b", "second body")
+        && libbalsa_imap_body_cache_copy(cache, "b", "c");
+    if (ok && (tmp = tmpfile()) != NULL) {
+        fputs("third body", tmp);
+        ok = libbalsa_imap_body_cache_add_file(cache, "d", tmp);
+        fclose(tmp);
+    }
+    libbalsa_imap_body_cache_remove(cache, "a");
+    libbalsa_imap_body_cache_free(cache);
+    if (!ok)
+        return test_fail("journal", "could not add");
+
+    cache = test_open();
+    ok = test_lookup(cache, "a", NULL, 0)
+        && test_lookup(cache, "b", "second body", 11)
+        && test_lookup(cache, "c", "second body", 11)
+        && test_lookup(cache, "d", "third body", 10);
+    libbalsa_imap_body_cache_free(cache);
+
+    return ok || test_fail("journal", "wrong data after reopening");
+}
+
+/* A record cut short does not hide the ones appended after it. */
+static gboolean
+test_torn_journal(void)
+{
+    LibBalsaImapBodyCache *cache;
+    gchar *path;
+    FILE *index;
+    gboolean ok;
+
+    cache = test_open();
+    ok = test_add(cache, "e", "before the crash");
+    libbalsa_imap_body_cache_free(cache);
+    if (!ok)
+        return test_fail("torn journal", "could not add");
+
+    path = g_build_filename(test_dir, "packed-index", NULL);
+    index = g_fopen(path, "ab");
+    g_free(path);
+    if (index == NULL)
+        return test_fail("torn journal", "no index");
+    fwrite("+\001\000", 1, 3, index);
+    fclose(index);
+
+    cache = test_open();
+    ok = test_lookup(cache, "e", "before the crash", 16)
+        && test_add(cache, "f", "after the crash");
+    libbalsa_imap_body_cache_free(cache);
+    if (!ok)
+        return test_fail("torn journal", "lost the entries before");
+
+    cache = test_open();
+    ok = test_lookup(cache, "e", "before the crash", 16)
+        && test_lookup(cache, "f", "after the crash", 15);
+    libbalsa_imap_body_cache_free(cache);
+
+    return ok || test_fail("torn journal", "lost the entries after");
+}
+
+static gboolean
+test_long_key(void)
+{
+    LibBalsaImapBodyCache *cache;
+    gchar *key;
+    gboolean ok;
+
+    key = g_strnfill(5000, 'k');
+    cache = test_open();
+    ok = test_add(cache, "b", "data")
+        && !test_add(cache, key, "data")
+        && !libbalsa_imap_body_cache_copy(cache, "b", key)
+        && test_lookup(cache, key, NULL, 0);
+    libbalsa_imap_body_cache_free(cache);
+    g_free(key);
+
+    return ok || test_fail("long key", "accepted");
+}
+
+/* Fill a segment, evict most of it, and check that the rest was moved
+ * out of it before it was removed. */
+static gboolean
+test_compaction(void)
+{
+    LibBalsaImapBodyCache *cache;
+    gchar *big, *path;
+    gint64 start;
+    gboolean ok;
+
+    big = g_malloc(TEST_BIG_SIZE);
+    memset(big, 'x', TEST_BIG_SIZE);
+    memcpy(big, "keep", 4);
+
+    cache = test_open();
+    ok = libbalsa_imap_body_cache_add(cache, "drop", big, TEST_BIG_SIZE)
+        && libbalsa_imap_body_cache_add(cache, "keep", big,
+                                         TEST_BIG_SIZE - 1024 * 1024)
+        /* Seals the first segment... */
+        && test_add(cache, "small", "small body");
+    if (!ok)
+        test_fail("compaction", "could not add");
+    /* ...which is then mostly dead. */
+    libbalsa_imap_body_cache_remove(cache, "drop");
+
+    /* The compaction runs in the background. */
+    path = g_build_filename(test_dir, "packed-00000001", NULL);
+    start = g_get_monotonic_time();
+    while (g_file_test(path, G_FILE_TEST_EXISTS)
+           && g_get_monotonic_time() - start < TEST_WAIT)
+        g_usleep(G_USEC_PER_SEC / 100);
+    if (ok && g_file_test(path, G_FILE_TEST_EXISTS))
+        ok = test_fail("compaction", "segment was not removed");
+    g_free(path);
+    libbalsa_imap_body_cache_free(cache);
+    if (!ok) {
+        g_free(big);
+        return FALSE;
+    }
+
+    cache = test_open();
+    ok = test_lookup(cache, "drop", NULL, 0)
+        && test_lookup(cache, "keep", big, TEST_BIG_SIZE - 1024 * 1024)
+        && test_lookup(cache, "small", "small body", 10);
+    libbalsa_imap_body_cache_free(cache);
+    g_free(big);
+
+    return ok || test_fail("compaction", "wrong data after reopening");
+}
+
+/* Each test starts with an empty cache. */
+static gboolean
+test_run(gboolean (*test) (void))
+{
+    GError *err = NULL;
+    gboolean ok;
+
+    if ((test_dir = g_dir_make_tmp("balsa-cache-XXXXXX", &err)) == NULL) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        return FALSE;
+    }
+
+    ok = test();
+
+    libbalsa_delete_directory_contents(test_dir);
+    g_rmdir(test_dir);
+    g_free(test_dir);
+
+    return ok;
+}
+
+int
+main(int argc, char *argv[])
+{
+    gboolean ok;
+
+    g_mime_init();
+
+    ok = test_run(test_journal);
+    ok = test_run(test_torn_journal) && ok;
+    ok = test_run(test_long_key) && ok;
+    ok = test_run(test_compaction) && ok;
+
+    g_mime_shutdown();
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
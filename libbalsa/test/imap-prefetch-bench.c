@@ -0,0 +1,250 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * imap-prefetch-bench: count the FETCH round trips needed to show the
+ * envelopes of an IMAP mailbox while the index is scrolled.
+ *
+ * A stand-in server on the loopback interface serves a mailbox of
+ * synthetic messages and counts the FETCH commands it receives.  The
+ * same scripted scrolling of a flat view is played twice:
+ *   - fetching a fixed chunk of 20 rows around each missing row, as
+ *     the IMAP mailbox did before;
+ *   - fetching what libbalsa_imap_prefetch_plan() chooses.
+ * The benchmark fails if the read-ahead needs more round trips.
+ *
+ * Usage: imap-prefetch-bench [number-of-messages]
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "imap-commands.h"
+#include "imap-handle.h"
+#include "imap-prefetch.h"
+#include "imap-stand-in.h"
+
+#define BENCH_DEFAULT_MESSAGES 10000
+#define BENCH_VISIBLE_ROWS     40
+#define BENCH_WHEEL_ROWS       3
+#define BENCH_OLD_CHUNK        20
+
+#define BENCH_FETCH_TYPE \
+    (IMFETCH_FLAGS | IMFETCH_UID | IMFETCH_ENV | IMFETCH_RFC822SIZE)
+
+/* The client. */
+
+typedef struct {
+    ImapMboxHandle *handle;
+    guint total;
+    guint first_visible;
+    guint last_visible;
+    gint direction;
+    LibBalsaImapPrefetch *prefetch;
+} BenchClient;
+
+/* A flat view: the rows are in message number order. */
+static guint
+bench_walk(guint msgno, gint direction, guint count, guint * msgnos,
+           gpointer data)
+{
+    BenchClient *client = data;
+    guint n = 0;
+
+    while (n < count) {
+        if (direction > 0 ? msgno >= client->total : msgno <= 1)
+            break;
+        msgno += direction > 0 ? 1 : -1;
+        msgnos[n++] = msgno;
+    }
+
+    return n;
+}
+
+static gboolean
+bench_have(guint msgno, gpointer data)
+{
+    BenchClient *client = data;
+    ImapMessage *imsg = imap_mbox_handle_get_msg(client->handle, msgno);
+
+    return imsg != NULL && imsg->envelope != NULL;
+}
+
+/* What the IMAP mailbox used to fetch: 20 rows of the view, mostly
+ * following msgno. */
+static GArray *
+bench_old_plan(BenchClient * client, guint msgno)
+{
+    GArray *set;
+    guint lo, hi, i;
+
+    lo = msgno > BENCH_OLD_CHUNK / 2 ? msgno - BENCH_OLD_CHUNK / 2 + 1 : 1;
+    hi = MIN(msgno + BENCH_OLD_CHUNK / 2, client->total);
+    set = g_array_sized_new(FALSE, FALSE, sizeof(guint), hi - lo + 1);
+    for (i = lo; i <= hi; i++)
+        g_array_append_val(set, i);
+
+    return set;
+}
+
+static gboolean
+bench_show(BenchClient * client, guint first)
+{
+    guint last = MIN(first + BENCH_VISIBLE_ROWS - 1, client->total);
+    guint msgno;
+
+    if (client->first_visible > 0)
+        client->direction = first < client->first_visible ? -1
+            : first > client->first_visible ? 1 : client->direction;
+    client->first_visible = first;
+    client->last_visible = last;
+
+    /* The index asks for the rows in the order it draws them. */
+    for (msgno = first; msgno <= last; msgno++) {
+        GArray *set;
+        ImapResponse rc;
+
+        if (bench_have(msgno, client))
+            continue;
+
+        set = client->prefetch != NULL
+            ? libbalsa_imap_prefetch_plan(client->prefetch, msgno, first,
+                                          last, client->direction)
+            : bench_old_plan(client, msgno);
+        rc = imap_mbox_handle_fetch_set(client->handle,
+                                        (unsigned *) set->data, set->len,
+                                        BENCH_FETCH_TYPE);
+        g_array_free(set, TRUE);
+        if (rc != IMR_OK || !bench_have(msgno, client)) {
+            g_printerr("message %u not fetched\n", msgno);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/* Scroll down with the wheel, back up a little, jump and scroll down
+ * again; return FALSE on error. */
+static gboolean
+bench_scroll(BenchClient * client)
+{
+    guint total = client->total;
+    guint down = total * 3 / 10;
+    guint up = total / 20;
+    guint jump = total * 7 / 10;
+    guint first;
+
+    for (first = 1; first <= down; first += BENCH_WHEEL_ROWS)
+        if (!bench_show(client, first))
+            return FALSE;
+    for (; first > down - up && first > BENCH_WHEEL_ROWS;
+         first -= BENCH_WHEEL_ROWS)
+        if (!bench_show(client, first))
+            return FALSE;
+    for (first = jump; first <= jump + down / 3 && first <= total;
+         first += BENCH_WHEEL_ROWS)
+        if (!bench_show(client, first))
+            return FALSE;
+
+    return TRUE;
+}
+
+static gboolean
+bench_run(const gchar * what, ImapStandIn * server, guint16 port,
+          gboolean read_ahead, guint * fetches)
+{
+    BenchClient client;
+    gchar *host;
+    gboolean readonly;
+    gint64 start;
+    gdouble seconds;
+    gboolean ok;
+
+    memset(&client, 0, sizeof client);
+    client.total = server->messages;
+    client.direction = 1;
+    client.handle = imap_mbox_handle_new();
+    imap_handle_set_tls_mode(client.handle, NET_CLIENT_CRYPT_NONE);
+
+    host = g_strdup_printf("127.0.0.1:%u", port);
+    if (imap_mbox_handle_connect(client.handle, host) != IMAP_SUCCESS
+        || imap_mbox_select(client.handle, "INBOX", &readonly) != IMR_OK) {
+        g_printerr("could not open the mailbox on %s\n", host);
+        g_free(host);
+        g_object_unref(client.handle);
+        return FALSE;
+    }
+    g_free(host);
+
+    if (read_ahead)
+        client.prefetch =
+            libbalsa_imap_prefetch_new(bench_walk, bench_have, &client);
+
+    g_atomic_int_set(&server->fetches, 0);
+    start = g_get_monotonic_time();
+    ok = bench_scroll(&client);
+    seconds = (g_get_monotonic_time() - start) / 1e6;
+    *fetches = g_atomic_int_get(&server->fetches);
+
+    g_print("%-24s %8u fetches %10.3f s\n", what, *fetches, seconds);
+
+    libbalsa_imap_prefetch_free(client.prefetch);
+    g_object_unref(client.handle);
+
+    return ok;
+}
+
+int
+main(int argc, char *argv[])
+{
+    ImapStandIn server;
+    guint16 port;
+    guint old_fetches, new_fetches;
+
+    memset(&server, 0, sizeof server);
+    server.messages = argc > 1 ? strtoul(argv[1], NULL, 10)
+        : BENCH_DEFAULT_MESSAGES;
+    if (server.messages < 2 * BENCH_VISIBLE_ROWS) {
+        g_printerr("usage: %s [number-of-messages >= %u]\n", argv[0],
+                   2 * BENCH_VISIBLE_ROWS);
+        return EXIT_FAILURE;
+    }
+
+    if ((port = imap_stand_in_start(&server)) == 0) {
+        g_printerr("could not start the server\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!bench_run("fixed chunk", &server, port, FALSE, &old_fetches)
+        || !bench_run("read-ahead", &server, port, TRUE, &new_fetches))
+        return EXIT_FAILURE;
+
+    if (new_fetches > old_fetches) {
+        g_printerr("read-ahead needs %u round trips, fixed chunk %u\n",
+                   new_fetches, old_fetches);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
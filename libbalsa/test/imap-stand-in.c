@@ -0,0 +1,315 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include "imap-stand-in.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    ImapStandIn *server;
+    GSocket *socket;
+} ImapStandInConnection;
+
+guint
+imap_stand_in_unseen(const gchar * mailbox)
+{
+    const gchar *p = mailbox + strlen(mailbox);
+
+    while (p > mailbox && g_ascii_isdigit(p[-1]))
+        --p;
+
+    return strtoul(p, NULL, 10) % 2;
+}
+
+static void
+imap_stand_in_fetch(ImapStandIn * server, GString * reply,
+                    const gchar * seq)
+{
+    gchar **ranges;
+    guint i;
+
+    ranges = g_strsplit(seq, ",", -1);
+    for (i = 0; ranges[i] != NULL; i++) {
+        gchar *end;
+        guint lo, hi, msgno;
+
+        lo = strtoul(ranges[i], &end, 10);
+        hi = *end == ':' ? strtoul(end + 1, NULL, 10) : lo;
+        if (hi > server->messages)
+            hi = server->messages;
+        for (msgno = lo; msgno <= hi; msgno++)
+            g_string_append_printf(reply,
+                                   "* %u FETCH (UID %u FLAGS (\\Seen) "
+                                   "RFC822.SIZE %u ENVELOPE "
+                                   "(\"Mon, 01 Jan 2024 00:00:00 +0000\" "
+                                   "\"Message %u\" "
+                                   "((\"Sender\" NIL \"sender\" \"example.org\")) "
+                                   "((\"Sender\" NIL \"sender\" \"example.org\")) "
+                                   "((\"Sender\" NIL \"sender\" \"example.org\")) "
+                                   "((NIL NIL \"rcpt\" \"example.org\")) "
+                                   "NIL NIL NIL \"<%u@example.org>\"))\r\n",
+                                   msgno, msgno, 1000 + msgno, msgno,
+                                   msgno);
+    }
+    g_strfreev(ranges);
+}
+
+static void
+imap_stand_in_status_of(ImapStandIn * server, GString * reply,
+                        const gchar * mailbox)
+{
+    g_string_append_printf(reply,
+                           "* STATUS \"%s\" (MESSAGES %u UNSEEN %u "
+                           "UIDNEXT %u UIDVALIDITY 1)\r\n",
+                           mailbox, server->messages,
+                           imap_stand_in_unseen(mailbox),
+                           server->messages + 1);
+}
+
+static void
+imap_stand_in_status(ImapStandIn * server, GString * reply,
+                     const gchar * args)
+{
+    gchar *mailbox;
+
+    if (*args == '"')
+        mailbox = g_strndup(args + 1, strcspn(args + 1, "\""));
+    else
+        mailbox = g_strndup(args, strcspn(args, " "));
+
+    imap_stand_in_status_of(server, reply, mailbox);
+    g_free(mailbox);
+}
+
+/* LIST "" ("a" "b" ...) RETURN (STATUS (...)): every quoted name in the
+ * parentheses is listed, with its status. */
+static void
+imap_stand_in_list_status(ImapStandIn * server, GString * reply,
+                          const gchar * args)
+{
+    const gchar *p = strchr(args, '(');
+    const gchar *end = p != NULL ? strchr(p, ')') : NULL;
+
+    while (p != NULL && (p = strchr(p, '"')) != NULL && p < end) {
+        gchar *mailbox = g_strndup(p + 1, strcspn(p + 1, "\""));
+
+        g_string_append_printf(reply, "* LIST () \"/\" \"%s\"\r\n",
+                               mailbox);
+        imap_stand_in_status_of(server, reply, mailbox);
+        p += strlen(mailbox) + 2;
+        g_free(mailbox);
+    }
+}
+
+/* Answer one command; return FALSE when the client has logged out.
+ * *status is set when the command asks for a status. */
+static gboolean
+imap_stand_in_command(ImapStandIn * server, const gchar * line,
+                      GString * reply, gboolean * status)
+{
+    gchar **words;
+    const gchar *tag;
+    const gchar *command;
+    gboolean go_on = TRUE;
+
+    words = g_strsplit(line, " ", 3);
+    tag = words[0] != NULL ? words[0] : "*";
+    command = words[0] != NULL ? words[1] : NULL;
+
+    if (command == NULL) {
+        g_string_append_printf(reply, "%s BAD empty command\r\n", tag);
+    } else if (g_ascii_strcasecmp(command, "CAPABILITY") == 0) {
+        g_string_append_printf(reply, "* CAPABILITY IMAP4rev1%s\r\n"
+                               "%s OK done\r\n",
+                               server->list_status ? " LIST-STATUS" : "",
+                               tag);
+    } else if (g_ascii_strcasecmp(command, "SELECT") == 0
+               || g_ascii_strcasecmp(command, "EXAMINE") == 0) {
+        g_string_append_printf(reply,
+                               "* FLAGS (\\Seen \\Deleted)\r\n"
+                               "* %u EXISTS\r\n"
+                               "* 0 RECENT\r\n"
+                               "* OK [UIDVALIDITY 1] ok\r\n"
+                               "* OK [UIDNEXT %u] ok\r\n"
+                               "%s OK [READ-WRITE] done\r\n",
+                               server->messages, server->messages + 1,
+                               tag);
+    } else if (g_ascii_strcasecmp(command, "FETCH") == 0
+               && words[2] != NULL) {
+        gchar *seq = g_strndup(words[2], strcspn(words[2], " "));
+
+        g_atomic_int_inc(&server->fetches);
+        imap_stand_in_fetch(server, reply, seq);
+        g_string_append_printf(reply, "%s OK done\r\n", tag);
+        g_free(seq);
+    } else if (g_ascii_strcasecmp(command, "STATUS") == 0
+               && words[2] != NULL) {
+        g_atomic_int_inc(&server->statuses);
+        imap_stand_in_status(server, reply, words[2]);
+        g_string_append_printf(reply, "%s OK done\r\n", tag);
+        *status = TRUE;
+    } else if (g_ascii_strcasecmp(command, "LIST") == 0
+               && words[2] != NULL && server->list_status
+               && strstr(words[2], "RETURN (STATUS") != NULL) {
+        g_atomic_int_inc(&server->list_statuses);
+        imap_stand_in_list_status(server, reply, words[2]);
+        g_string_append_printf(reply, "%s OK done\r\n", tag);
+        *status = TRUE;
+    } else if (g_ascii_strcasecmp(command, "EXPUNGE") == 0) {
+        guint i;
+
+        for (i = 0; i < server->n_expunged; i++)
+            g_string_append_printf(reply, "* %u EXPUNGE\r\n",
+                                   server->expunged[i]);
+        g_string_append_printf(reply, "%s OK done\r\n", tag);
+    } else if (g_ascii_strcasecmp(command, "LOGOUT") == 0) {
+        g_string_append_printf(reply, "* BYE bye\r\n%s OK done\r\n", tag);
+        go_on = FALSE;
+    } else {
+        g_string_append_printf(reply, "%s OK done\r\n", tag);
+    }
+    g_strfreev(words);
+
+    return go_on;
+}
+
+static void
+imap_stand_in_count_connection(ImapStandIn * server)
+{
+    gint open = g_atomic_int_add(&server->connections, 1) + 1;
+    gint max;
+
+    do {
+        max = g_atomic_int_get(&server->max_connections);
+    } while (open > max
+             && !g_atomic_int_compare_and_exchange(&server->max_connections,
+                                                   max, open));
+}
+
+static gpointer
+imap_stand_in_connection_thread(gpointer data)
+{
+    ImapStandInConnection *conn = data;
+    ImapStandIn *server = conn->server;
+    GSocketConnection *connection;
+    GDataInputStream *input;
+    GOutputStream *output;
+    GString *reply;
+    gchar *line;
+    gboolean status = FALSE;
+
+    connection = g_socket_connection_factory_create_connection(conn->socket);
+    input =
+        g_data_input_stream_new(g_io_stream_get_input_stream
+                                (G_IO_STREAM(connection)));
+    g_data_input_stream_set_newline_type(input,
+                                         G_DATA_STREAM_NEWLINE_TYPE_CR_LF);
+    output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+
+    reply = g_string_new("* PREAUTH [CAPABILITY IMAP4rev1] ready\r\n");
+    g_output_stream_write_all(output, reply->str, reply->len, NULL, NULL,
+                              NULL);
+    g_string_truncate(reply, 0);
+    while ((line = g_data_input_stream_read_line(input, NULL, NULL, NULL))
+           != NULL) {
+        gboolean go_on;
+
+        go_on = imap_stand_in_command(server, line, reply, &status);
+        g_free(line);
+        /* Answer when the client waits for us, which is when it has
+         * sent all it had to send. */
+        if (go_on
+            && g_buffered_input_stream_get_available
+            (G_BUFFERED_INPUT_STREAM(input)) > 0)
+            continue;
+        if (status && server->status_latency > 0)
+            g_usleep(server->status_latency);
+        status = FALSE;
+        if (!g_output_stream_write_all(output, reply->str, reply->len,
+                                       NULL, NULL, NULL) || !go_on)
+            break;
+        g_string_truncate(reply, 0);
+    }
+    g_string_free(reply, TRUE);
+    g_object_unref(input);
+    g_io_stream_close(G_IO_STREAM(connection), NULL, NULL);
+    g_object_unref(connection);
+    g_object_unref(conn->socket);
+    g_free(conn);
+
+    g_atomic_int_add(&server->connections, -1);
+
+    return NULL;
+}
+
+static gpointer
+imap_stand_in_thread(gpointer data)
+{
+    ImapStandIn *server = data;
+    GSocket *socket;
+
+    while ((socket = g_socket_accept(server->socket, NULL, NULL)) != NULL) {
+        ImapStandInConnection *conn = g_new(ImapStandInConnection, 1);
+
+        conn->server = server;
+        conn->socket = socket;
+        imap_stand_in_count_connection(server);
+        g_thread_unref(g_thread_new("imap-connection",
+                                    imap_stand_in_connection_thread,
+                                    conn));
+    }
+
+    return NULL;
+}
+
+guint16
+imap_stand_in_start(ImapStandIn * server)
+{
+    GInetAddress *loopback;
+    GSocketAddress *address;
+    guint16 port;
+
+    server->socket =
+        g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM,
+                     G_SOCKET_PROTOCOL_TCP, NULL);
+    loopback = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+    address = g_inet_socket_address_new(loopback, 0);
+    g_object_unref(loopback);
+    if (server->socket == NULL
+        || !g_socket_bind(server->socket, address, TRUE, NULL)
+        || !g_socket_listen(server->socket, NULL)) {
+        g_object_unref(address);
+        return 0;
+    }
+    g_object_unref(address);
+
+    address = g_socket_get_local_address(server->socket, NULL);
+    port = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(address));
+    g_object_unref(address);
+
+    g_thread_unref(g_thread_new("imap-server", imap_stand_in_thread,
+                                server));
+
+    return port;
+}
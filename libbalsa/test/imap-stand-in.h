@@ -0,0 +1,65 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * imap-stand-in.h
+ *
+ * A stand-in IMAP server on the loopback interface, for the benchmarks.
+ *
+ * Connections are preauthenticated and served by a thread each.  Every
+ * mailbox holds the same number of synthetic messages, and a mailbox
+ * whose name ends in a number has that number modulo 2 unseen
+ * messages.  Pipelined commands are answered together, after a single
+ * delay.  EXPUNGE is answered with a scripted run of EXPUNGE responses,
+ * which do not change the mailboxes.  The server counts what it is
+ * asked for.
+ */
+
+#ifndef __IMAP_STAND_IN_H__
+#define __IMAP_STAND_IN_H__
+
+#include <gio/gio.h>
+
+typedef struct {
+    /* Set before imap_stand_in_start(). */
+    guint messages;             /* in every mailbox */
+    gulong status_latency;      /* in microseconds, for each round
+                                 * trip that asks for a status */
+    gboolean list_status;       /* offer LIST-STATUS (RFC 5819) */
+    const guint *expunged;      /* the seqnos sent, in this order, in
+                                 * answer to EXPUNGE */
+    guint n_expunged;
+
+    /* Counted while serving, atomic. */
+    gint fetches;               /* FETCH commands */
+    gint statuses;              /* STATUS commands */
+    gint list_statuses;         /* LIST-STATUS commands */
+    gint connections;           /* open now */
+    gint max_connections;       /* open at once, at most */
+
+    GSocket *socket;
+} ImapStandIn;
+
+/* Start serving; return the port, or 0 on error. */
+guint16 imap_stand_in_start(ImapStandIn * server);
+
+/* The number of unseen messages the server reports for mailbox. */
+guint imap_stand_in_unseen(const gchar * mailbox);
+
+#endif                          /* __IMAP_STAND_IN_H__ */
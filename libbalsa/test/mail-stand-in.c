@@ -0,0 +1,340 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include "mail-stand-in.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    MailStandIn *server;
+    GSocket *socket;
+    gboolean in_data;           /* SMTP: reading a message */
+} MailStandInConnection;
+
+/* The scripted reply to verb, if any. */
+static gboolean
+mail_stand_in_script(MailStandIn * server, const gchar * verb,
+                     GString * reply)
+{
+    const gchar *const *line;
+
+    if (server->script == NULL)
+        return FALSE;
+
+    for (line = server->script; *line != NULL; line++) {
+        gsize len = strcspn(*line, " ");
+
+        if (len == strlen(verb)
+            && g_ascii_strncasecmp(*line, verb, len) == 0) {
+            g_string_append(reply, (*line)[len] == ' ' ? *line + len + 1
+                            : "");
+            g_string_append(reply, "\r\n");
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/* SMTP */
+
+static gboolean
+mail_stand_in_smtp(MailStandInConnection * conn, const gchar * line,
+                   GString * reply)
+{
+    MailStandIn *server = conn->server;
+    gchar *verb;
+    gboolean go_on = TRUE;
+
+    if (conn->in_data) {
+        if (strcmp(line, ".") != 0) {
+            /* Undo the dot-stuffing, and count the CRLF. */
+            g_atomic_int_add(&server->bytes_received,
+                             strlen(line[0] == '.' ? line + 1 : line) + 2);
+            return TRUE;
+        }
+        conn->in_data = FALSE;
+        g_atomic_int_inc(&server->messages_received);
+        if (!mail_stand_in_script(server, ".", reply))
+            g_string_append(reply, "250 2.0.0 accepted\r\n");
+        return TRUE;
+    }
+
+    g_atomic_int_inc(&server->commands);
+    verb = g_strndup(line, strcspn(line, " "));
+    if (mail_stand_in_script(server, verb, reply)) {
+        /* Scripted. */
+    } else if (g_ascii_strcasecmp(verb, "EHLO") == 0) {
+        g_string_append_printf(reply, "250-stand-in\r\n%s"
+                               "250 8BITMIME\r\n",
+                               server->pipelining ? "250-PIPELINING\r\n"
+                               : "");
+    } else if (g_ascii_strcasecmp(verb, "HELO") == 0
+               || g_ascii_strcasecmp(verb, "MAIL") == 0
+               || g_ascii_strcasecmp(verb, "RCPT") == 0
+               || g_ascii_strcasecmp(verb, "RSET") == 0
+               || g_ascii_strcasecmp(verb, "NOOP") == 0) {
+        g_string_append(reply, "250 2.0.0 ok\r\n");
+    } else if (g_ascii_strcasecmp(verb, "DATA") == 0) {
+        conn->in_data = TRUE;
+        g_string_append(reply, "354 go ahead\r\n");
+    } else if (g_ascii_strcasecmp(verb, "QUIT") == 0) {
+        g_string_append(reply, "221 2.0.0 bye\r\n");
+        go_on = FALSE;
+    } else {
+        g_string_append(reply, "502 5.5.1 not implemented\r\n");
+    }
+    g_free(verb);
+
+    return go_on;
+}
+
+/* POP3 */
+
+/* The size of a message as sent, with CRLF line ends. */
+static gsize
+mail_stand_in_size(const gchar * message)
+{
+    gsize size = 0;
+
+    for (; *message != '\0'; message++)
+        size += *message == '\n' ? 2 : 1;
+
+    return size;
+}
+
+static void
+mail_stand_in_retr(MailStandIn * server, GString * reply,
+                   const gchar * message)
+{
+    const gchar *line = message;
+
+    g_string_append_printf(reply, "+OK %" G_GSIZE_FORMAT " octets\r\n",
+                           mail_stand_in_size(message));
+    while (*line != '\0') {
+        const gchar *end = strchr(line, '\n');
+        gsize len = end != NULL ? (gsize) (end - line) : strlen(line);
+
+        if (line[0] == '.')
+            g_string_append_c(reply, '.');
+        g_string_append_len(reply, line, len);
+        g_string_append(reply, "\r\n");
+        line += end != NULL ? len + 1 : len;
+    }
+    g_string_append(reply, ".\r\n");
+    g_atomic_int_inc(&server->messages_sent);
+}
+
+/* The message a command argument names, or NULL. */
+static const gchar *
+mail_stand_in_message(MailStandIn * server, const gchar * arg)
+{
+    guint n = arg != NULL ? strtoul(arg, NULL, 10) : 0;
+
+    if (server->messages == NULL || n == 0 || n > server->messages->len)
+        return NULL;
+
+    return g_ptr_array_index(server->messages, n - 1);
+}
+
+static gboolean
+mail_stand_in_pop3(MailStandInConnection * conn, const gchar * line,
+                   GString * reply)
+{
+    MailStandIn *server = conn->server;
+    guint count = server->messages != NULL ? server->messages->len : 0;
+    gchar **words;
+    const gchar *verb, *message;
+    gboolean go_on = TRUE;
+    guint i;
+
+    g_atomic_int_inc(&server->commands);
+    words = g_strsplit(line, " ", 2);
+    verb = words[0] != NULL ? words[0] : "";
+    message = mail_stand_in_message(server, words[0] != NULL ? words[1]
+                                    : NULL);
+
+    if (mail_stand_in_script(server, verb, reply)) {
+        /* Scripted. */
+    } else if (g_ascii_strcasecmp(verb, "CAPA") == 0) {
+        g_string_append_printf(reply, "+OK\r\nUSER\r\nUIDL\r\n%s.\r\n",
+                               server->pipelining ? "PIPELINING\r\n" : "");
+    } else if (g_ascii_strcasecmp(verb, "USER") == 0
+               || g_ascii_strcasecmp(verb, "PASS") == 0
+               || g_ascii_strcasecmp(verb, "NOOP") == 0
+               || g_ascii_strcasecmp(verb, "RSET") == 0) {
+        g_string_append(reply, "+OK\r\n");
+    } else if (g_ascii_strcasecmp(verb, "STAT") == 0) {
+        gsize total = 0;
+
+        for (i = 0; i < count; i++)
+            total += mail_stand_in_size(g_ptr_array_index(server->messages,
+                                                          i));
+        g_string_append_printf(reply, "+OK %u %" G_GSIZE_FORMAT "\r\n",
+                               count, total);
+    } else if (g_ascii_strcasecmp(verb, "LIST") == 0) {
+        g_string_append(reply, "+OK\r\n");
+        for (i = 0; i < count; i++)
+            g_string_append_printf(reply, "%u %" G_GSIZE_FORMAT "\r\n",
+                                   i + 1,
+                                   mail_stand_in_size(g_ptr_array_index
+                                                      (server->messages,
+                                                       i)));
+        g_string_append(reply, ".\r\n");
+    } else if (g_ascii_strcasecmp(verb, "UIDL") == 0) {
+        g_string_append(reply, "+OK\r\n");
+        for (i = 0; i < count; i++)
+            g_string_append_printf(reply, "%u stand-in-%u\r\n", i + 1,
+                                   i + 1);
+        g_string_append(reply, ".\r\n");
+    } else if (g_ascii_strcasecmp(verb, "RETR") == 0 && message != NULL) {
+        gint drop_after = g_atomic_int_get(&server->drop_after);
+
+        /* Dropping: what was answered so far is still sent. */
+        if (drop_after > 0
+            && g_atomic_int_get(&server->messages_sent) >= drop_after)
+            go_on = FALSE;
+        else
+            mail_stand_in_retr(server, reply, message);
+    } else if (g_ascii_strcasecmp(verb, "DELE") == 0 && message != NULL) {
+        g_atomic_int_inc(&server->deletions);
+        g_string_append(reply, "+OK\r\n");
+    } else if (g_ascii_strcasecmp(verb, "QUIT") == 0) {
+        g_string_append(reply, "+OK bye\r\n");
+        go_on = FALSE;
+    } else {
+        g_string_append(reply, "-ERR not implemented\r\n");
+    }
+    g_strfreev(words);
+
+    return go_on;
+}
+
+static gpointer
+mail_stand_in_connection_thread(gpointer data)
+{
+    MailStandInConnection *conn = data;
+    MailStandIn *server = conn->server;
+    GSocketConnection *connection;
+    GDataInputStream *input;
+    GOutputStream *output;
+    GString *reply;
+    gchar *line;
+
+    connection = g_socket_connection_factory_create_connection(conn->socket);
+    input =
+        g_data_input_stream_new(g_io_stream_get_input_stream
+                                (G_IO_STREAM(connection)));
+    g_data_input_stream_set_newline_type(input,
+                                         G_DATA_STREAM_NEWLINE_TYPE_CR_LF);
+    output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+
+    reply = g_string_new(server->protocol == MAIL_STAND_IN_SMTP
+                         ? "220 stand-in ESMTP ready\r\n"
+                         : "+OK stand-in ready\r\n");
+    g_output_stream_write_all(output, reply->str, reply->len, NULL, NULL,
+                              NULL);
+    g_string_truncate(reply, 0);
+    while ((line = g_data_input_stream_read_line(input, NULL, NULL, NULL))
+           != NULL) {
+        gboolean go_on;
+
+        go_on = server->protocol == MAIL_STAND_IN_SMTP
+            ? mail_stand_in_smtp(conn, line, reply)
+            : mail_stand_in_pop3(conn, line, reply);
+        g_free(line);
+        /* Answer when the client waits for us, which is when it has
+         * sent all it had to send. */
+        if (go_on
+            && (reply->len == 0
+                || g_buffered_input_stream_get_available
+                (G_BUFFERED_INPUT_STREAM(input)) > 0))
+            continue;
+        g_atomic_int_inc(&server->round_trips);
+        if (server->latency > 0)
+            g_usleep(server->latency);
+        if (!g_output_stream_write_all(output, reply->str, reply->len,
+                                       NULL, NULL, NULL) || !go_on)
+            break;
+        g_string_truncate(reply, 0);
+    }
+    g_string_free(reply, TRUE);
+    g_object_unref(input);
+    g_io_stream_close(G_IO_STREAM(connection), NULL, NULL);
+    g_object_unref(connection);
+    g_object_unref(conn->socket);
+    g_free(conn);
+
+    return NULL;
+}
+
+static gpointer
+mail_stand_in_thread(gpointer data)
+{
+    MailStandIn *server = data;
+    GSocket *socket;
+
+    while ((socket = g_socket_accept(server->socket, NULL, NULL)) != NULL) {
+        MailStandInConnection *conn = g_new0(MailStandInConnection, 1);
+
+        conn->server = server;
+        conn->socket = socket;
+        g_thread_unref(g_thread_new("mail-connection",
+                                    mail_stand_in_connection_thread,
+                                    conn));
+    }
+
+    return NULL;
+}
+
+guint16
+mail_stand_in_start(MailStandIn * server)
+{
+    GInetAddress *loopback;
+    GSocketAddress *address;
+    guint16 port;
+
+    server->socket =
+        g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM,
+                     G_SOCKET_PROTOCOL_TCP, NULL);
+    loopback = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+    address = g_inet_socket_address_new(loopback, 0);
+    g_object_unref(loopback);
+    if (server->socket == NULL
+        || !g_socket_bind(server->socket, address, TRUE, NULL)
+        || !g_socket_listen(server->socket, NULL)) {
+        g_object_unref(address);
+        return 0;
+    }
+    g_object_unref(address);
+
+    address = g_socket_get_local_address(server->socket, NULL);
+    port = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(address));
+    g_object_unref(address);
+
+    g_thread_unref(g_thread_new("mail-server", mail_stand_in_thread,
+                                server));
+
+    return port;
+}
@@ -0,0 +1,74 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * mail-stand-in.h
+ *
+ * A stand-in SMTP or POP3 server on the loopback interface, for the
+ * benchmarks; imap-stand-in.h has its IMAP counterpart.
+ *
+ * Connections need no authentication and are served by a thread each.
+ * The SMTP server accepts every message and throws it away; the POP3
+ * server offers the same messages to every connection, and forgets
+ * deletions.  Pipelined commands are answered together, after a single
+ * delay.  The replies to some commands may be scripted, to try how the
+ * client copes with errors, and a POP3 server may drop the connection
+ * after some messages.  The server counts what it is asked for.
+ */
+
+#ifndef __MAIL_STAND_IN_H__
+#define __MAIL_STAND_IN_H__
+
+#include <gio/gio.h>
+
+typedef enum {
+    MAIL_STAND_IN_SMTP,
+    MAIL_STAND_IN_POP3
+} MailStandInProtocol;
+
+typedef struct {
+    /* Set before mail_stand_in_start(). */
+    MailStandInProtocol protocol;
+    gulong latency;             /* in microseconds, for each round trip */
+    gboolean pipelining;        /* offer PIPELINING */
+    GPtrArray *messages;        /* POP3: the texts of the messages, with
+                                 * LF line ends */
+    const gchar *const *script; /* NULL-terminated "VERB reply" lines:
+                                 * VERB is answered with reply instead
+                                 * of the usual one */
+    gint drop_after;            /* POP3: drop the connection when asked
+                                 * for a message once this many have
+                                 * been sent, 0 for never; atomic, may
+                                 * be changed between connections */
+
+    /* Counted while serving, atomic. */
+    gint commands;
+    gint round_trips;
+    gint messages_received;     /* SMTP: messages sent to the server */
+    gint bytes_received;        /* SMTP: in their DATA */
+    gint messages_sent;         /* POP3: messages retrieved */
+    gint deletions;             /* POP3: DELE commands */
+
+    GSocket *socket;
+} MailStandIn;
+
+/* Start serving; return the port, or 0 on error. */
+guint16 mail_stand_in_start(MailStandIn * server);
+
+#endif                          /* __MAIL_STAND_IN_H__ */
@@ -0,0 +1,855 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * mail-suite-bench: time the everyday operations on a synthetic corpus.
+ *
+ * The corpus (see bench-corpus.h) is written as an mbox, a maildir and
+ * an MH mailbox in a temporary directory, and each mailbox is:
+ *   - opened, cold and warm;
+ *   - sorted by date, subject and sender;
+ *   - threaded, with and without gathering subjects, and sorted by
+ *     thread date;
+ *   - searched for a subject, a sender and a body text;
+ *   - filtered, as on reception, by two colouring filters;
+ *   - checked for new mail, after some has been delivered.
+ * Then the corpus is sent to a stand-in SMTP server, and retrieved from
+ * a stand-in POP3 server (see mail-stand-in.h), once by itself and
+ * into a local inbox by POP3 mailbox checks, also when the server drops
+ * the connection half way.
+ *
+ * The benchmark fails if a mailbox does not hold the corpus, if sorting
+ * by subject separates a reply from its original, if the threads or the
+ * subject search do not match it, if a server does not see every
+ * message, or if the inbox does not get each message exactly once.
+ * The same options give the same corpus, so the results of two builds
+ * can be compared: --results writes them as tab-separated "suite,
+ * benchmark, count, seconds" lines, which bench-compare.py reads.
+ *
+ * Usage: mail-suite-bench [--messages=N] [--depth=N] [--parts=N]
+ *                         [--charsets=PERCENT] [--seed=N]
+ *                         [--format=mbox|maildir|mh] [--results=FILE]
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "libbalsa.h"
+#include "filter.h"
+#include "filter-funcs.h"
+#include "net-client-smtp.h"
+#include "net-client-pop.h"
+#include "bench-corpus.h"
+#include "mail-stand-in.h"
+
+#define BENCH_DEFAULT_MESSAGES 2000
+#define BENCH_DEFAULT_DEPTH    6
+#define BENCH_DEFAULT_PARTS    3
+#define BENCH_DEFAULT_CHARSETS 30
+#define BENCH_LATENCY          500     /* microseconds per round trip */
+
+static gint opt_messages = BENCH_DEFAULT_MESSAGES;
+static gint opt_depth = BENCH_DEFAULT_DEPTH;
+static gint opt_parts = BENCH_DEFAULT_PARTS;
+static gint opt_charsets = BENCH_DEFAULT_CHARSETS;
+static gint opt_seed = 1;
+static gchar *opt_format = NULL;
+static gchar *opt_results = NULL;
+
+static GOptionEntry bench_options[] = {
+    {"messages", 'n', 0, G_OPTION_ARG_INT, &opt_messages,
+     "Messages in the corpus", "N"},
+    {"depth", 'd', 0, G_OPTION_ARG_INT, &opt_depth,
+     "Deepest thread", "N"},
+    {"parts", 'p', 0, G_OPTION_ARG_INT, &opt_parts,
+     "Most MIME parts in a message", "N"},
+    {"charsets", 'c', 0, G_OPTION_ARG_INT, &opt_charsets,
+     "Percentage of messages not in US-ASCII", "PERCENT"},
+    {"seed", 's', 0, G_OPTION_ARG_INT, &opt_seed,
+     "Seed of the corpus", "N"},
+    {"format", 'f', 0, G_OPTION_ARG_STRING, &opt_format,
+     "Only this mailbox format", "mbox|maildir|mh"},
+    {"results", 'r', 0, G_OPTION_ARG_FILENAME, &opt_results,
+     "Write the results to FILE", "FILE"},
+    {NULL}
+};
+
+/* The results, one tab-separated line each. */
+static GString *bench_results;
+
+static void
+bench_result(const gchar * suite, const gchar * what, guint count,
+             gdouble seconds)
+{
+    gchar *name = g_strconcat(suite, " ", what, NULL);
+
+    g_print("%-24s %8u messages %10.3f s\n", name, count, seconds);
+    g_string_append_printf(bench_results, "%s\t%s\t%u\t%.6f\n", suite,
+                           what, count, seconds);
+    g_free(name);
+}
+
+static void
+bench_remove_tree(const gchar * path)
+{
+    GDir *dir;
+
+    if ((dir = g_dir_open(path, 0, NULL)) != NULL) {
+        const gchar *name;
+
+        while ((name = g_dir_read_name(dir)) != NULL) {
+            gchar *child = g_build_filename(path, name, NULL);
+
+            if (g_file_test(child, G_FILE_TEST_IS_DIR))
+                bench_remove_tree(child);
+            else
+                g_unlink(child);
+            g_free(child);
+        }
+        g_dir_close(dir);
+    }
+    g_rmdir(path);
+}
+
+static LibBalsaMailbox *
+bench_mailbox_new(BenchCorpusFormat format, const gchar * path)
+{
+    switch (format) {
+    case BENCH_CORPUS_MBOX:
+        return libbalsa_mailbox_mbox_new(path, FALSE);
+    case BENCH_CORPUS_MAILDIR:
+        return libbalsa_mailbox_maildir_new(path, FALSE);
+    case BENCH_CORPUS_MH:
+        return libbalsa_mailbox_mh_new(path, FALSE);
+    default:
+        g_return_val_if_reached(NULL);
+    }
+}
+
+static gboolean
+bench_check_total(LibBalsaMailbox * mailbox, const gchar * what,
+                  guint expected)
+{
+    guint total = libbalsa_mailbox_total_messages(mailbox);
+
+    if (total != expected) {
+        g_printerr("%s: %u messages, not %u\n", what, total, expected);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+bench_open(LibBalsaMailbox * mailbox, const gchar * suite,
+           const gchar * what, guint expected)
+{
+    GError *err = NULL;
+    gint64 start;
+    gboolean ok;
+
+    start = g_get_monotonic_time();
+    ok = libbalsa_mailbox_open(mailbox, &err);
+    if (ok)
+        bench_result(suite, what, expected,
+                     (g_get_monotonic_time() - start) / 1e6);
+    else {
+        g_printerr("%s: could not open: %s\n", suite,
+                   err != NULL ? err->message : "?");
+        g_clear_error(&err);
+    }
+
+    return ok && bench_check_total(mailbox, suite, expected);
+}
+
+static void
+bench_sort(LibBalsaMailbox * mailbox, const gchar * suite,
+           const gchar * what, gint column)
+{
+    gint64 start;
+
+    start = g_get_monotonic_time();
+    gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(mailbox),
+                                         column, GTK_SORT_ASCENDING);
+    bench_result(suite, what, libbalsa_mailbox_total_messages(mailbox),
+                 (g_get_monotonic_time() - start) / 1e6);
+}
+
+/* The subject of a message, without "Re: " and case, for comparing. */
+static gchar *
+bench_subject(LibBalsaMailbox * mailbox, guint msgno)
+{
+    const gchar *subject = libbalsa_mailbox_msgno_get_subject(mailbox, msgno);
+
+    if (subject == NULL)
+        return g_strdup("");
+    while (g_str_has_prefix(subject, "Re: "))
+        subject += 4;
+
+    return g_utf8_casefold(subject, -1);
+}
+
+/* Check that the view, sorted by subject, has the messages of each
+ * subject together, replies or not. */
+static gboolean
+bench_check_subjects(LibBalsaMailbox * mailbox, const gchar * suite)
+{
+    GtkTreeModel *model = GTK_TREE_MODEL(mailbox);
+    GHashTable *seen;
+    GtkTreeIter iter;
+    gchar *current = NULL;
+    gboolean valid, ok = TRUE;
+
+    seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    for (valid = gtk_tree_model_get_iter_first(model, &iter);
+         valid && ok; valid = gtk_tree_model_iter_next(model, &iter)) {
+        guint msgno;
+        gchar *subject;
+
+        gtk_tree_model_get(model, &iter, LB_MBOX_MSGNO_COL, &msgno, -1);
+        subject = bench_subject(mailbox, msgno);
+        if (current != NULL && strcmp(subject, current) == 0) {
+            g_free(subject);
+            continue;
+        }
+        if (g_hash_table_contains(seen, subject)) {
+            g_printerr("%s: message %u sorted apart from its subject\n",
+                       suite, msgno);
+            ok = FALSE;
+        }
+        g_hash_table_add(seen, subject);
+        current = subject;
+    }
+    g_hash_table_destroy(seen);
+
+    return ok;
+}
+
+/* Thread the mailbox; return the number of threads. */
+static guint
+bench_thread(LibBalsaMailbox * mailbox, const gchar * suite,
+             const gchar * what, LibBalsaMailboxThreadingType type)
+{
+    gint64 start;
+
+    start = g_get_monotonic_time();
+    libbalsa_mailbox_set_threading_type(mailbox, type);
+    bench_result(suite, what, libbalsa_mailbox_total_messages(mailbox),
+                 (g_get_monotonic_time() - start) / 1e6);
+
+    return gtk_tree_model_iter_n_children(GTK_TREE_MODEL(mailbox), NULL);
+}
+
+/* Search the mailbox; return the number of matches.  The condition is
+ * consumed. */
+static guint
+bench_search(LibBalsaMailbox * mailbox, const gchar * suite,
+             const gchar * what, LibBalsaCondition * condition)
+{
+    LibBalsaMailboxSearchIter *search_iter;
+    guint msgno, total, matches = 0;
+    gint64 start;
+
+    search_iter = libbalsa_mailbox_search_iter_new(condition);
+    libbalsa_condition_unref(condition);
+
+    start = g_get_monotonic_time();
+    total = libbalsa_mailbox_total_messages(mailbox);
+    for (msgno = 1; msgno <= total; msgno++)
+        if (libbalsa_mailbox_message_match(mailbox, msgno, search_iter))
+            matches++;
+    bench_result(suite, what, total,
+                 (g_get_monotonic_time() - start) / 1e6);
+
+    libbalsa_mailbox_search_iter_unref(search_iter);
+
+    return matches;
+}
+
+static LibBalsaFilter *
+bench_filter_new(const gchar * name, unsigned fields, const gchar * text,
+                 const gchar * colour)
+{
+    LibBalsaFilter *filter = libbalsa_filter_new();
+
+    filter->name = g_strdup(name);
+    filter->condition =
+        libbalsa_condition_new_string(FALSE, fields, g_strdup(text), NULL);
+    filter->action = FILTER_COLOR;
+    filter->action_string = g_strdup(colour);
+    FILTER_SETFLAG(filter, FILTER_VALID);
+
+    return filter;
+}
+
+/* Run the filters as libbalsa_mailbox_run_filters_on_reception() does. */
+static gboolean
+bench_filter(LibBalsaMailbox * mailbox, const gchar * suite)
+{
+    GSList *filters = NULL, *list;
+    guint msgno, total;
+    gint64 start;
+    gboolean ok = TRUE;
+
+    filters = g_slist_prepend(filters,
+                              bench_filter_new("needles",
+                                               CONDITION_MATCH_SUBJECT,
+                                               "needle",
+                                               "foreground:red"));
+    filters = g_slist_prepend(filters,
+                              bench_filter_new("Bob",
+                                               CONDITION_MATCH_FROM,
+                                               "Bob",
+                                               "background:yellow"));
+    if (!filters_prepare_to_run(filters)) {
+        g_printerr("%s: invalid filters\n", suite);
+        ok = FALSE;
+    }
+
+    start = g_get_monotonic_time();
+    total = libbalsa_mailbox_total_messages(mailbox);
+    for (list = filters; ok && list != NULL; list = list->next) {
+        LibBalsaFilter *filter = list->data;
+        LibBalsaMailboxSearchIter *search_iter;
+        GArray *msgnos;
+
+        search_iter = libbalsa_mailbox_search_iter_new(filter->condition);
+        msgnos = g_array_new(FALSE, FALSE, sizeof(guint));
+        for (msgno = 1; msgno <= total; msgno++)
+            if (libbalsa_mailbox_message_match(mailbox, msgno, search_iter))
+                g_array_append_val(msgnos, msgno);
+
+        libbalsa_mailbox_register_msgnos(mailbox, msgnos);
+        libbalsa_filter_mailbox_messages(filter, mailbox, msgnos);
+        libbalsa_mailbox_unregister_msgnos(mailbox, msgnos);
+
+        g_array_free(msgnos, TRUE);
+        libbalsa_mailbox_search_iter_unref(search_iter);
+    }
+    if (ok)
+        bench_result(suite, "filter", total,
+                     (g_get_monotonic_time() - start) / 1e6);
+
+    for (list = filters; list != NULL; list = list->next)
+        libbalsa_filter_free(list->data, GINT_TO_POINTER(TRUE));
+    g_slist_free(filters);
+
+    return ok;
+}
+
+static gboolean
+bench_check(LibBalsaMailbox * mailbox, const gchar * suite,
+            BenchCorpusFormat format, const gchar * path,
+            BenchCorpus * delivery, guint total)
+{
+    guint count = bench_corpus_get_length(delivery);
+    GError *err = NULL;
+    gint64 start;
+
+    if (!bench_corpus_write(delivery, format, path, 0, count, &err)) {
+        g_printerr("%s: could not deliver: %s\n", suite, err->message);
+        g_error_free(err);
+        return FALSE;
+    }
+
+    /* The delivery may have been made within the second the mailbox
+     * was opened. */
+    libbalsa_mailbox_set_mtime(mailbox, 1);
+
+    start = g_get_monotonic_time();
+    libbalsa_mailbox_check(mailbox);
+    bench_result(suite, "check", count,
+                 (g_get_monotonic_time() - start) / 1e6);
+
+    return bench_check_total(mailbox, suite, total + count);
+}
+
+static gboolean
+bench_mailbox(BenchCorpus * corpus, BenchCorpus * delivery,
+              BenchCorpusFormat format, const gchar * dir)
+{
+    const gchar *suite = bench_corpus_format_name(format);
+    guint total = bench_corpus_get_length(corpus);
+    LibBalsaMailbox *mailbox;
+    LibBalsaCondition *condition;
+    GError *err = NULL;
+    gchar *path;
+    guint threads, matches;
+    gboolean ok;
+
+    path = g_build_filename(dir, suite, NULL);
+    if (!bench_corpus_write(corpus, format, path, 0, total, &err)) {
+        g_printerr("%s: %s\n", suite, err->message);
+        g_error_free(err);
+        g_free(path);
+        return FALSE;
+    }
+
+    if ((mailbox = bench_mailbox_new(format, path)) == NULL) {
+        g_printerr("%s: could not create the mailbox\n", suite);
+        g_free(path);
+        return FALSE;
+    }
+
+    ok = bench_open(mailbox, suite, "open cold", total);
+    if (ok) {
+        libbalsa_mailbox_close(mailbox, FALSE);
+        ok = bench_open(mailbox, suite, "open warm", total);
+    }
+    if (!ok) {
+        g_object_unref(mailbox);
+        g_free(path);
+        return FALSE;
+    }
+
+    bench_sort(mailbox, suite, "sort date", LB_MBOX_DATE_COL);
+    bench_sort(mailbox, suite, "sort subject", LB_MBOX_SUBJECT_COL);
+    ok = bench_check_subjects(mailbox, suite);
+    bench_sort(mailbox, suite, "sort sender", LB_MBOX_FROM_COL);
+
+    threads = bench_thread(mailbox, suite, "thread simple",
+                           LB_MAILBOX_THREADING_SIMPLE);
+    if (threads != bench_corpus_get_threads(corpus)) {
+        g_printerr("%s: %u threads, not %u\n", suite, threads,
+                   bench_corpus_get_threads(corpus));
+        ok = FALSE;
+    }
+    /* Gathering subjects may only join threads. */
+    threads = bench_thread(mailbox, suite, "thread jwz",
+                           LB_MAILBOX_THREADING_JWZ);
+    if (threads > bench_corpus_get_threads(corpus)) {
+        g_printerr("%s: %u gathered threads, more than %u\n", suite,
+                   threads, bench_corpus_get_threads(corpus));
+        ok = FALSE;
+    }
+    bench_sort(mailbox, suite, "sort thread date", LB_MBOX_DATE_COL);
+
+    condition = libbalsa_condition_new_string(FALSE,
+                                              CONDITION_MATCH_SUBJECT,
+                                              g_strdup("needle"), NULL);
+    matches = bench_search(mailbox, suite, "search subject", condition);
+    if (matches != bench_corpus_get_subject_needles(corpus)) {
+        g_printerr("%s: %u subjects found, not %u\n", suite, matches,
+                   bench_corpus_get_subject_needles(corpus));
+        ok = FALSE;
+    }
+    condition = libbalsa_condition_new_string(FALSE, CONDITION_MATCH_FROM,
+                                              g_strdup("Alice"), NULL);
+    bench_search(mailbox, suite, "search sender", condition);
+    condition = libbalsa_condition_new_string(FALSE, CONDITION_MATCH_BODY,
+                                              g_strdup("needle"), NULL);
+    bench_search(mailbox, suite, "search body", condition);
+
+    ok = bench_filter(mailbox, suite) && ok;
+    ok = bench_check(mailbox, suite, format, path, delivery, total) && ok;
+
+    libbalsa_mailbox_close(mailbox, FALSE);
+    g_object_unref(mailbox);
+    g_free(path);
+
+    return ok;
+}
+
+/* Sending */
+
+typedef struct {
+    GString *data;              /* with CRLF line ends */
+    gsize offset;
+} BenchSendData;
+
+static gssize
+bench_send_cb(gchar * buffer, gsize count, gpointer user_data,
+              GError ** error)
+{
+    BenchSendData *send_data = user_data;
+    gsize len = MIN(count, send_data->data->len - send_data->offset);
+
+    memcpy(buffer, send_data->data->str + send_data->offset, len);
+    send_data->offset += len;
+
+    return len;
+}
+
+static void
+bench_send_data_set(BenchSendData * send_data, const gchar * message)
+{
+    const gchar *p;
+
+    g_string_truncate(send_data->data, 0);
+    send_data->offset = 0;
+    for (p = message; *p != '\0'; p++) {
+        if (*p == '\n')
+            g_string_append_c(send_data->data, '\r');
+        g_string_append_c(send_data->data, *p);
+    }
+}
+
+static gboolean
+bench_send(BenchCorpus * corpus)
+{
+    static MailStandIn stand_in;  /* served until the end */
+    NetClientSmtp *client;
+    BenchSendData send_data;
+    GError *err = NULL;
+    guint16 port;
+    guint n, count = bench_corpus_get_length(corpus);
+    gint64 start;
+    gboolean ok;
+
+    stand_in.protocol = MAIL_STAND_IN_SMTP;
+    stand_in.latency = BENCH_LATENCY;
+    stand_in.pipelining = TRUE;
+    if ((port = mail_stand_in_start(&stand_in)) == 0) {
+        g_printerr("could not start the SMTP server\n");
+        return FALSE;
+    }
+
+    send_data.data = g_string_new(NULL);
+    start = g_get_monotonic_time();
+    client = net_client_smtp_new("127.0.0.1", port, NET_CLIENT_CRYPT_NONE);
+    ok = net_client_smtp_connect(client, NULL, &err);
+    for (n = 0; ok && n < count; n++) {
+        NetClientSmtpMessage *message;
+
+        bench_send_data_set(&send_data,
+                            bench_corpus_get_message(corpus, n, NULL));
+        message = net_client_smtp_msg_new(bench_send_cb, &send_data);
+        net_client_smtp_msg_set_sender(message, "user@example.org");
+        net_client_smtp_msg_add_recipient(message, "rcpt@example.org",
+                                          NET_CLIENT_SMTP_DSN_NEVER);
+        ok = net_client_smtp_send_msg(client, message, NULL, &err);
+        net_client_smtp_msg_free(message);
+    }
+    g_object_unref(client);
+    g_string_free(send_data.data, TRUE);
+
+    if (!ok) {
+        g_printerr("send: %s\n", err != NULL ? err->message : "?");
+        g_clear_error(&err);
+        return FALSE;
+    }
+    bench_result("smtp", "send", count,
+                 (g_get_monotonic_time() - start) / 1e6);
+
+    if ((guint) g_atomic_int_get(&stand_in.messages_received) != count) {
+        g_printerr("send: the server received %d messages, not %u\n",
+                   g_atomic_int_get(&stand_in.messages_received), count);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Retrieving */
+
+static gboolean
+bench_retr_cb(const gchar * buffer, gssize count, gsize lines,
+              const NetClientPopMessageInfo * info, gpointer user_data,
+              GError ** error)
+{
+    guint *retrieved = user_data;
+
+    if (count == 0)
+        ++*retrieved;
+
+    return TRUE;
+}
+
+static gboolean
+bench_retrieve(BenchCorpus * corpus)
+{
+    static MailStandIn stand_in;  /* served until the end */
+    NetClientPop *client;
+    GList *list = NULL;
+    GError *err = NULL;
+    guint16 port;
+    guint n, count = bench_corpus_get_length(corpus);
+    guint retrieved = 0;
+    gint64 start;
+    gboolean ok;
+
+    stand_in.protocol = MAIL_STAND_IN_POP3;
+    stand_in.latency = BENCH_LATENCY;
+    stand_in.pipelining = TRUE;
+    stand_in.messages = g_ptr_array_sized_new(count);
+    for (n = 0; n < count; n++)
+        g_ptr_array_add(stand_in.messages,
+                        (gpointer) bench_corpus_get_message(corpus, n,
+                                                            NULL));
+    if ((port = mail_stand_in_start(&stand_in)) == 0) {
+        g_printerr("could not start the POP3 server\n");
+        return FALSE;
+    }
+
+    start = g_get_monotonic_time();
+    client = net_client_pop_new("127.0.0.1", port, NET_CLIENT_CRYPT_NONE,
+                                TRUE);
+    ok = net_client_pop_connect(client, NULL, &err)
+        && net_client_pop_list(client, &list, TRUE, &err)
+        && (list == NULL
+            || net_client_pop_retr(client, list, bench_retr_cb,
+                                   &retrieved, &err));
+    g_list_free_full(list, (GDestroyNotify) net_client_pop_msg_info_free);
+    g_object_unref(client);
+
+    if (!ok) {
+        g_printerr("retrieve: %s\n", err != NULL ? err->message : "?");
+        g_clear_error(&err);
+        return FALSE;
+    }
+    bench_result("pop3", "retrieve", count,
+                 (g_get_monotonic_time() - start) / 1e6);
+
+    if (retrieved != count) {
+        g_printerr("retrieve: %u messages, not %u\n", retrieved, count);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Check that the inbox holds each message of the corpus once. */
+static gboolean
+bench_check_inbox(LibBalsaMailbox * inbox, guint count)
+{
+    GHashTable *ids;
+    GError *err = NULL;
+    guint msgno, total;
+    gboolean ok = TRUE;
+
+    if (!libbalsa_mailbox_open(inbox, &err)) {
+        g_printerr("could not open the inbox: %s\n",
+                   err != NULL ? err->message : "?");
+        g_clear_error(&err);
+        return FALSE;
+    }
+
+    total = libbalsa_mailbox_total_messages(inbox);
+    if (total != count) {
+        g_printerr("check: the inbox has %u messages, not %u\n", total,
+                   count);
+        ok = FALSE;
+    }
+
+    ids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    for (msgno = 1; msgno <= total && ok; msgno++) {
+        LibBalsaMessage *message;
+        const gchar *id;
+
+        message = libbalsa_mailbox_get_message(inbox, msgno);
+        id = message != NULL ? libbalsa_message_get_message_id(message)
+            : NULL;
+        if (id == NULL || !g_hash_table_add(ids, g_strdup(id))) {
+            g_printerr("check: message %u is %s\n", msgno,
+                       id != NULL ? "in the inbox twice" : "unreadable");
+            ok = FALSE;
+        }
+        g_clear_object(&message);
+    }
+    g_hash_table_destroy(ids);
+    libbalsa_mailbox_close(inbox, FALSE);
+
+    return ok;
+}
+
+/* Checking a POP3 mailbox, which adds the messages to a local inbox.  If
+ * drop_after is not 0, the server drops the connection after that many
+ * messages; the messages received must stay in the inbox, and the next
+ * check must retrieve only the others.  A last check must find nothing
+ * new. */
+static gboolean
+bench_pop3_inbox(BenchCorpus * corpus, const gchar * dir,
+                 const gchar * name, guint drop_after)
+{
+    MailStandIn *stand_in;
+    LibBalsaMailboxPOP3 *pop3;
+    LibBalsaMailbox *inbox;
+    LibBalsaServer *server;
+    guint16 port;
+    guint n, count = bench_corpus_get_length(corpus);
+    gchar *host, *path;
+    gint64 start;
+    gboolean ok = TRUE;
+
+    stand_in = g_new0(MailStandIn, 1);  /* served until the end */
+    stand_in->protocol = MAIL_STAND_IN_POP3;
+    stand_in->latency = BENCH_LATENCY;
+    stand_in->pipelining = TRUE;
+    stand_in->drop_after = drop_after;
+    stand_in->messages = g_ptr_array_sized_new(count);
+    for (n = 0; n < count; n++)
+        g_ptr_array_add(stand_in->messages,
+                        (gpointer) bench_corpus_get_message(corpus, n,
+                                                            NULL));
+    if ((port = mail_stand_in_start(stand_in)) == 0) {
+        g_printerr("could not start the POP3 server\n");
+        return FALSE;
+    }
+
+    path = g_build_filename(dir, name, NULL);
+    inbox = libbalsa_mailbox_mbox_new(path, TRUE);
+    g_free(path);
+    if (inbox == NULL) {
+        g_printerr("could not create the inbox\n");
+        return FALSE;
+    }
+
+    /* The UIDs are stored per user@host:port, so each server has a
+     * store of its own. */
+    pop3 = libbalsa_mailbox_pop3_new();
+    libbalsa_mailbox_pop3_set_inbox(LIBBALSA_MAILBOX(pop3), inbox);
+    libbalsa_mailbox_pop3_set_check(pop3, TRUE);
+    libbalsa_mailbox_pop3_set_enable_pipe(pop3, TRUE);
+    server = LIBBALSA_MAILBOX_REMOTE_GET_SERVER(pop3);
+    host = g_strdup_printf("127.0.0.1:%u", port);
+    libbalsa_server_set_host(server, host, NET_CLIENT_CRYPT_NONE);
+    libbalsa_server_set_username(server, "bench");
+    libbalsa_server_set_password(server, "bench", FALSE);
+    g_free(host);
+
+    start = g_get_monotonic_time();
+    libbalsa_mailbox_check(LIBBALSA_MAILBOX(pop3));
+    if (drop_after == 0)
+        bench_result("pop3", "check", count,
+                     (g_get_monotonic_time() - start) / 1e6);
+    else {
+        if ((guint) g_atomic_int_get(&stand_in->messages_sent)
+            != MIN(drop_after, count)) {
+            g_printerr("%s: the server sent %d messages before dropping, "
+                       "not %u\n", name,
+                       g_atomic_int_get(&stand_in->messages_sent),
+                       MIN(drop_after, count));
+            ok = FALSE;
+        }
+        g_atomic_int_set(&stand_in->drop_after, 0);
+        libbalsa_mailbox_check(LIBBALSA_MAILBOX(pop3));
+    }
+
+    /* The UIDs of all messages are known now. */
+    libbalsa_mailbox_check(LIBBALSA_MAILBOX(pop3));
+    if ((guint) g_atomic_int_get(&stand_in->messages_sent) != count) {
+        g_printerr("%s: the server sent %d messages, not %u\n", name,
+                   g_atomic_int_get(&stand_in->messages_sent), count);
+        ok = FALSE;
+    }
+
+    if (!bench_check_inbox(inbox, count))
+        ok = FALSE;
+
+    g_object_unref(pop3);
+    g_object_unref(inbox);
+
+    return ok;
+}
+
+int
+main(int argc, char *argv[])
+{
+    GOptionContext *context;
+    GError *err = NULL;
+    BenchCorpusSpec spec;
+    BenchCorpus *corpus, *delivery;
+    BenchCorpusFormat format;
+    gchar *dir, *home;
+    gboolean ok = TRUE;
+
+    context = g_option_context_new(NULL);
+    g_option_context_add_main_entries(context, bench_options, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &err)) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        g_option_context_free(context);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    if (opt_messages < 1 || opt_depth < 0 || opt_parts < 1
+        || opt_charsets < 0 || opt_charsets > 100) {
+        g_printerr("bad corpus options\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((dir = g_dir_make_tmp("balsa-suite-XXXXXX", NULL)) == NULL) {
+        g_printerr("could not create a temporary directory\n");
+        return EXIT_FAILURE;
+    }
+    /* Keep the caches of the mailboxes out of the user's home. */
+    home = g_build_filename(dir, "home", NULL);
+    g_mkdir(home, 0700);
+    g_setenv("HOME", home, TRUE);
+    g_free(home);
+
+    libbalsa_init();
+
+    spec.messages = opt_messages;
+    spec.thread_depth = opt_depth;
+    spec.mime_parts = opt_parts;
+    spec.charset_mix = opt_charsets;
+    spec.seed = opt_seed;
+    corpus = bench_corpus_new(&spec);
+    /* The new mail for the check: a tenth more, in threads of its
+     * own. */
+    spec.messages = MAX(opt_messages / 10, 1);
+    spec.seed = opt_seed + 1;
+    delivery = bench_corpus_new(&spec);
+
+    bench_results = g_string_new(NULL);
+
+    for (format = 0; format < BENCH_CORPUS_N_FORMATS; format++) {
+        if (opt_format != NULL
+            && strcmp(opt_format, bench_corpus_format_name(format)) != 0)
+            continue;
+        if (!bench_mailbox(corpus, delivery, format, dir))
+            ok = FALSE;
+    }
+
+    if (opt_format == NULL) {
+        if (!bench_send(corpus))
+            ok = FALSE;
+        if (!bench_retrieve(corpus))
+            ok = FALSE;
+        if (!bench_pop3_inbox(corpus, dir, "pop3-inbox", 0))
+            ok = FALSE;
+        /* Not at a batch boundary. */
+        if (!bench_pop3_inbox(corpus, dir, "pop3-dropped",
+                              bench_corpus_get_length(corpus) / 2 + 1))
+            ok = FALSE;
+    }
+
+    if (opt_results != NULL
+        && !g_file_set_contents(opt_results, bench_results->str,
+                                bench_results->len, &err)) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        ok = FALSE;
+    }
+
+    g_string_free(bench_results, TRUE);
+    bench_corpus_free(delivery);
+    bench_corpus_free(corpus);
+    bench_remove_tree(dir);
+    g_free(dir);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
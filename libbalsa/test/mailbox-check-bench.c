@@ -0,0 +1,317 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * mailbox-check-bench: time checking many mailboxes for new mail.
+ *
+ * The mailboxes are maildirs in a temporary directory, some with a new
+ * message, and IMAP mailboxes spread over a few stand-in servers that
+ * answer STATUS with some latency; the first server offers LIST-STATUS.
+ * The same check is done twice:
+ *   - one mailbox after the other, as the main window used to;
+ *   - with libbalsa_mailbox_check_all().
+ * The benchmark fails if a mailbox is found with or without new mail
+ * wrongly, if the progress is not reported once per mailbox in order,
+ * if a server sees more connections than it allows, or if the server
+ * with LIST-STATUS is sent a STATUS command by the scheduled check.
+ *
+ * Usage: mailbox-check-bench [mailboxes-per-server [local-mailboxes]]
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glib/gstdio.h>
+
+#include "libbalsa.h"
+#include "imap-server.h"
+#include "mailbox-check.h"
+#include "imap-stand-in.h"
+
+#define BENCH_SERVERS            3
+#define BENCH_DEFAULT_IMAP       50
+#define BENCH_DEFAULT_LOCAL      150
+#define BENCH_CONNECTIONS        4
+#define BENCH_STATUS_LATENCY     2000
+
+typedef struct {
+    LibBalsaMailbox *mailbox;
+    gboolean has_new;
+} BenchMailbox;
+
+typedef struct {
+    guint last_done;
+    guint total;
+    gboolean in_order;
+} BenchProgress;
+
+/* Deliver a message the way an MDA does: write it to tmp/, then move it
+ * to new/. */
+static gboolean
+bench_deliver(const gchar * path, guint n)
+{
+    gchar *name, *tmp, *new;
+    gchar *text;
+    gboolean ok;
+
+    name = g_strdup_printf("%u.%u.bench", (guint) time(NULL), n);
+    tmp = g_build_filename(path, "tmp", name, NULL);
+    new = g_build_filename(path, "new", name, NULL);
+    text = g_strdup_printf("From: sender@example.org\n"
+                           "To: rcpt@example.org\n"
+                           "Subject: Message %u\n"
+                           "Message-ID: <%u@example.org>\n"
+                           "\n"
+                           "Body of message %u.\n", n, n, n);
+    ok = g_file_set_contents(tmp, text, -1, NULL)
+        && g_rename(tmp, new) == 0;
+    g_free(text);
+    g_free(new);
+    g_free(tmp);
+    g_free(name);
+
+    return ok;
+}
+
+static void
+bench_remove_tree(const gchar * path)
+{
+    GDir *dir;
+
+    if ((dir = g_dir_open(path, 0, NULL)) != NULL) {
+        const gchar *name;
+
+        while ((name = g_dir_read_name(dir)) != NULL) {
+            gchar *child = g_build_filename(path, name, NULL);
+
+            if (g_file_test(child, G_FILE_TEST_IS_DIR))
+                bench_remove_tree(child);
+            else
+                g_unlink(child);
+            g_free(child);
+        }
+        g_dir_close(dir);
+    }
+    g_rmdir(path);
+}
+
+static void
+bench_done(LibBalsaMailbox * mailbox, guint done, guint total,
+           gpointer data)
+{
+    BenchProgress *progress = data;
+
+    if (done != progress->last_done + 1 || total != progress->total)
+        progress->in_order = FALSE;
+    progress->last_done = done;
+}
+
+/* The status requests the servers have answered. */
+static guint
+bench_requests(ImapStandIn * stand_in)
+{
+    guint s, requests = 0;
+
+    for (s = 0; s < BENCH_SERVERS; s++)
+        requests += g_atomic_int_get(&stand_in[s].statuses)
+            + g_atomic_int_get(&stand_in[s].list_statuses);
+
+    return requests;
+}
+
+/* Check all the mailboxes; return FALSE if any is found wrongly. */
+static gboolean
+bench_run(const gchar * what, GArray * boxes, GSList * list,
+          ImapStandIn * stand_in, gboolean scheduled)
+{
+    BenchProgress progress;
+    gint64 start;
+    gdouble seconds;
+    guint i, wrong = 0;
+    guint requests, statuses;
+
+    /* Make every mailbox look at its contents again, and start from the
+     * wrong answer. */
+    for (i = 0; i < boxes->len; i++) {
+        BenchMailbox *box = &g_array_index(boxes, BenchMailbox, i);
+
+        if (LIBBALSA_IS_MAILBOX_LOCAL(box->mailbox))
+            libbalsa_mailbox_set_mtime(box->mailbox, 1);
+        libbalsa_mailbox_set_unread_messages_flag(box->mailbox,
+                                                  !box->has_new);
+    }
+
+    progress.last_done = 0;
+    progress.total = boxes->len;
+    progress.in_order = TRUE;
+
+    requests = bench_requests(stand_in);
+    statuses = g_atomic_int_get(&stand_in[0].statuses);
+    start = g_get_monotonic_time();
+    if (scheduled)
+        libbalsa_mailbox_check_all(list, g_get_num_processors(), NULL,
+                                   bench_done, &progress);
+    else
+        g_slist_foreach(list, (GFunc) libbalsa_mailbox_check, NULL);
+    seconds = (g_get_monotonic_time() - start) / 1e6;
+    requests = bench_requests(stand_in) - requests;
+    statuses = g_atomic_int_get(&stand_in[0].statuses) - statuses;
+
+    for (i = 0; i < boxes->len; i++) {
+        BenchMailbox *box = &g_array_index(boxes, BenchMailbox, i);
+
+        if (!libbalsa_mailbox_get_has_unread_messages(box->mailbox)
+            != !box->has_new) {
+            g_printerr("%s: %s found %s new mail\n", what,
+                       libbalsa_mailbox_get_url(box->mailbox),
+                       box->has_new ? "without" : "with");
+            wrong++;
+        }
+    }
+
+    g_print("%-24s %8u mailboxes %10.3f s %8u requests\n", what,
+            boxes->len, seconds, requests);
+
+    if (scheduled && (!progress.in_order
+                      || progress.last_done != boxes->len)) {
+        g_printerr("%s: progress reported out of order\n", what);
+        return FALSE;
+    }
+
+    if (scheduled && statuses > 0) {
+        g_printerr("%s: %u STATUS commands despite LIST-STATUS\n", what,
+                   statuses);
+        return FALSE;
+    }
+
+    return wrong == 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    ImapStandIn stand_in[BENCH_SERVERS];
+    GArray *boxes;
+    GSList *list = NULL;
+    gchar *dir;
+    guint n_imap, n_local;
+    guint i, s;
+    gboolean ok;
+
+    n_imap = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_IMAP;
+    n_local = argc > 2 ? strtoul(argv[2], NULL, 10) : BENCH_DEFAULT_LOCAL;
+
+    libbalsa_init();
+
+    if ((dir = g_dir_make_tmp("balsa-check-XXXXXX", NULL)) == NULL) {
+        g_printerr("could not create a temporary directory\n");
+        return EXIT_FAILURE;
+    }
+
+    boxes = g_array_new(FALSE, FALSE, sizeof(BenchMailbox));
+
+    for (i = 0; i < n_local; i++) {
+        BenchMailbox box;
+        gchar *path;
+
+        path = g_strdup_printf("%s/box%u", dir, i);
+        box.mailbox = libbalsa_mailbox_maildir_new(path, TRUE);
+        box.has_new = i % 3 == 0;
+        if (box.mailbox == NULL
+            || (box.has_new && !bench_deliver(path, i))) {
+            g_printerr("could not create %s\n", path);
+            return EXIT_FAILURE;
+        }
+        g_free(path);
+        g_array_append_val(boxes, box);
+    }
+
+    memset(stand_in, 0, sizeof stand_in);
+    for (s = 0; s < BENCH_SERVERS; s++) {
+        LibBalsaImapServer *imap_server;
+        LibBalsaServer *server;
+        guint16 port;
+        gchar *host;
+
+        stand_in[s].status_latency = BENCH_STATUS_LATENCY;
+        stand_in[s].list_status = s == 0;
+        if ((port = imap_stand_in_start(&stand_in[s])) == 0) {
+            g_printerr("could not start the server\n");
+            return EXIT_FAILURE;
+        }
+
+        host = g_strdup_printf("127.0.0.1:%u", port);
+        imap_server = libbalsa_imap_server_new("bench", host);
+        server = LIBBALSA_SERVER(imap_server);
+        libbalsa_server_set_username(server, "bench");
+        libbalsa_server_set_host(server, host, NET_CLIENT_CRYPT_NONE);
+        libbalsa_imap_server_set_use_status(imap_server, TRUE);
+        libbalsa_imap_server_set_max_connections(imap_server,
+                                                 BENCH_CONNECTIONS);
+        g_free(host);
+
+        for (i = 0; i < n_imap; i++) {
+            BenchMailbox box;
+            gchar *path;
+
+            path = g_strdup_printf("box%u", s * n_imap + i);
+            box.mailbox = libbalsa_mailbox_imap_new();
+            libbalsa_mailbox_remote_set_server(LIBBALSA_MAILBOX_REMOTE
+                                               (box.mailbox), server);
+            libbalsa_mailbox_imap_set_path(LIBBALSA_MAILBOX_IMAP
+                                           (box.mailbox), path);
+            box.has_new = imap_stand_in_unseen(path) > 0;
+            g_free(path);
+            g_array_append_val(boxes, box);
+        }
+        g_object_unref(imap_server);
+    }
+
+    /* The order in which the main window finds them. */
+    for (i = boxes->len; i > 0; i--)
+        list = g_slist_prepend(list,
+                               g_array_index(boxes, BenchMailbox,
+                                             i - 1).mailbox);
+
+    ok = bench_run("one after the other", boxes, list, stand_in, FALSE)
+        && bench_run("scheduled", boxes, list, stand_in, TRUE);
+
+    for (s = 0; s < BENCH_SERVERS; s++) {
+        gint max = g_atomic_int_get(&stand_in[s].max_connections);
+
+        if (max > BENCH_CONNECTIONS) {
+            g_printerr("server %u saw %d connections at once, "
+                       "allows %d\n", s, max, BENCH_CONNECTIONS);
+            ok = FALSE;
+        }
+    }
+
+    g_slist_free(list);
+    for (i = 0; i < boxes->len; i++)
+        g_object_unref(g_array_index(boxes, BenchMailbox, i).mailbox);
+    g_array_free(boxes, TRUE);
+    bench_remove_tree(dir);
+    g_free(dir);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,275 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * mailbox-model-bench: time the GtkTreeModel implementation of
+ * LibBalsaMailbox on a synthetic flat view.
+ *
+ * The mailbox is a minimal subclass with no backend; its message tree is
+ * a flat list of messages, as in an unthreaded view.  We time:
+ *   - scrolling: getting the iter and path of every row, in order;
+ *   - random access to rows;
+ *   - updating rows, as when flags change on many messages;
+ *   - expunging messages at the end of the mailbox;
+ *   - expunging messages scattered through the mailbox, one at a time
+ *     and as a batch, as when the server reports many expunges at once.
+ *
+ * Usage: mailbox-model-bench [number-of-messages]
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+
+#include "libbalsa.h"
+#include "mailbox.h"
+
+#define BENCH_DEFAULT_MESSAGES 250000
+#define BENCH_RANDOM_ROWS      100000
+#define BENCH_CHANGED_ROWS     100000
+#define BENCH_EXPUNGED_ROWS    1000
+#define BENCH_SCATTERED_ROWS   200
+#define BENCH_BATCH_FRACTION   10   /* a tenth of the messages */
+
+/* The mailbox. */
+
+#define BENCH_TYPE_MAILBOX bench_mailbox_get_type()
+G_DECLARE_FINAL_TYPE(BenchMailbox, bench_mailbox, BENCH, MAILBOX,
+                     LibBalsaMailbox)
+
+struct _BenchMailbox {
+    LibBalsaMailbox parent;
+
+    guint total;
+};
+
+G_DEFINE_TYPE(BenchMailbox, bench_mailbox, LIBBALSA_TYPE_MAILBOX)
+
+static gboolean
+bench_mailbox_open(LibBalsaMailbox * mailbox, GError ** err)
+{
+    return TRUE;
+}
+
+static void
+bench_mailbox_close(LibBalsaMailbox * mailbox, gboolean expunge)
+{
+}
+
+static guint
+bench_mailbox_total_messages(LibBalsaMailbox * mailbox)
+{
+    return BENCH_MAILBOX(mailbox)->total;
+}
+
+static void
+bench_mailbox_class_init(BenchMailboxClass * klass)
+{
+    LibBalsaMailboxClass *mailbox_class = LIBBALSA_MAILBOX_CLASS(klass);
+
+    mailbox_class->open_mailbox = bench_mailbox_open;
+    mailbox_class->close_mailbox = bench_mailbox_close;
+    mailbox_class->total_messages = bench_mailbox_total_messages;
+}
+
+static void
+bench_mailbox_init(BenchMailbox * mailbox)
+{
+}
+
+/* Timing. */
+
+static gint64 bench_start;
+
+static void
+bench_begin(void)
+{
+    bench_start = g_get_monotonic_time();
+}
+
+static void
+bench_end(const gchar * what, guint count)
+{
+    gdouble seconds = (g_get_monotonic_time() - bench_start) / 1e6;
+
+    g_print("%-24s %8u ops %10.3f s %12.0f ops/s\n", what, count, seconds,
+            seconds > 0 ? count / seconds : 0);
+}
+
+/* Check that the view is still the flat list of messages 1..total. */
+static gboolean
+bench_check_view(BenchMailbox * bench)
+{
+    GtkTreeModel *model = GTK_TREE_MODEL(bench);
+    guint i;
+
+    if (gtk_tree_model_iter_n_children(model, NULL) != (gint) bench->total) {
+        g_printerr("view has %d rows, expected %u\n",
+                   gtk_tree_model_iter_n_children(model, NULL),
+                   bench->total);
+        return FALSE;
+    }
+
+    for (i = 0; i < bench->total; i++) {
+        GtkTreeIter iter;
+
+        gtk_tree_model_iter_nth_child(model, &iter, NULL, i);
+        if (GPOINTER_TO_UINT(((GNode *) iter.user_data)->data) != i + 1) {
+            g_printerr("row %u has msgno %u\n", i,
+                       GPOINTER_TO_UINT(((GNode *) iter.user_data)->data));
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static void
+row_changed_cb(GtkTreeModel * model, GtkTreePath * path,
+               GtkTreeIter * iter, guint * count)
+{
+    ++*count;
+}
+
+int
+main(int argc, char *argv[])
+{
+    BenchMailbox *bench;
+    LibBalsaMailbox *mailbox;
+    GtkTreeModel *model;
+    GNode *tree;
+    GRand *rand;
+    guint total;
+    guint changed = 0;
+    guint i;
+
+    total = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_MESSAGES;
+    if (total == 0) {
+        g_printerr("usage: %s [number-of-messages]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    libbalsa_init();
+
+    bench = g_object_new(BENCH_TYPE_MAILBOX, NULL);
+    bench->total = total;
+    mailbox = LIBBALSA_MAILBOX(bench);
+    model = GTK_TREE_MODEL(mailbox);
+    rand = g_rand_new_with_seed(1);
+
+    if (!libbalsa_mailbox_open(mailbox, NULL)) {
+        g_printerr("could not open the mailbox\n");
+        return EXIT_FAILURE;
+    }
+
+    bench_begin();
+    tree = g_node_new(NULL);
+    for (i = total; i > 0; i--)
+        g_node_prepend_data(tree, GUINT_TO_POINTER(i));
+    libbalsa_mailbox_set_msg_tree(mailbox, tree);
+    bench_end("build flat view", total);
+
+    bench_begin();
+    for (i = 0; i < total; i++) {
+        GtkTreeIter iter;
+        GtkTreePath *path;
+
+        if (!gtk_tree_model_iter_nth_child(model, &iter, NULL, i)) {
+            g_printerr("row %u missing\n", i);
+            return EXIT_FAILURE;
+        }
+        path = gtk_tree_model_get_path(model, &iter);
+        if (gtk_tree_path_get_indices(path)[0] != (gint) i) {
+            g_printerr("row %u has the wrong path\n", i);
+            return EXIT_FAILURE;
+        }
+        gtk_tree_path_free(path);
+    }
+    bench_end("scroll", total);
+
+    bench_begin();
+    for (i = 0; i < BENCH_RANDOM_ROWS; i++) {
+        GtkTreeIter iter;
+        GtkTreePath *path;
+        gint row = g_rand_int_range(rand, 0, total);
+
+        gtk_tree_model_iter_nth_child(model, &iter, NULL, row);
+        path = gtk_tree_model_get_path(model, &iter);
+        gtk_tree_path_free(path);
+    }
+    bench_end("random access", BENCH_RANDOM_ROWS);
+
+    g_signal_connect(mailbox, "row-changed", G_CALLBACK(row_changed_cb),
+                     &changed);
+    bench_begin();
+    for (i = 0; i < BENCH_CHANGED_ROWS; i++)
+        libbalsa_mailbox_msgno_changed(mailbox,
+                                       g_rand_int_range(rand, 1, total + 1));
+    bench_end("update rows", BENCH_CHANGED_ROWS);
+    if (changed != BENCH_CHANGED_ROWS) {
+        g_printerr("%u rows changed, expected %u\n", changed,
+                   BENCH_CHANGED_ROWS);
+        return EXIT_FAILURE;
+    }
+
+    bench_begin();
+    for (i = 0; i < BENCH_EXPUNGED_ROWS && bench->total > 0; i++)
+        libbalsa_mailbox_msgno_removed(mailbox, bench->total--);
+    bench_end("expunge at end", i);
+
+    if (!bench_check_view(bench))
+        return EXIT_FAILURE;
+
+    bench_begin();
+    for (i = 0; i < BENCH_SCATTERED_ROWS && bench->total > 0; i++)
+        libbalsa_mailbox_msgno_removed(mailbox,
+                                       g_rand_int_range(rand, 1,
+                                                        bench->total-- + 1));
+    bench_end("expunge scattered", i);
+
+    if (!bench_check_view(bench))
+        return EXIT_FAILURE;
+
+    if (bench->total > 0) {
+        GArray *msgnos = g_array_new(FALSE, FALSE, sizeof(guint));
+        guint msgno;
+
+        /* Every tenth message, from a random start. */
+        for (msgno = g_rand_int_range(rand, 1, BENCH_BATCH_FRACTION + 1);
+             msgno <= bench->total; msgno += BENCH_BATCH_FRACTION)
+            g_array_append_val(msgnos, msgno);
+
+        bench_begin();
+        bench->total -= msgnos->len;
+        libbalsa_mailbox_msgnos_removed(mailbox, msgnos);
+        bench_end("expunge batch", msgnos->len);
+        g_array_free(msgnos, TRUE);
+
+        if (!bench_check_view(bench))
+            return EXIT_FAILURE;
+    }
+
+    libbalsa_mailbox_close(mailbox, FALSE);
+    g_object_unref(mailbox);
+    g_rand_free(rand);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,203 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * mailbox-sort-test: check that the view of a mailbox sorts by sender
+ * and by subject on the collation keys of the index entries: ignoring
+ * case and a leading "Re:", and with an entry that was only colored
+ * before the sort, as a filter does.
+ *
+ * Usage: mailbox-sort-test
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libbalsa.h"
+#include "mailbox.h"
+
+/* The messages, by msgno. */
+static const struct {
+    const gchar *from;
+    const gchar *subject;
+} test_messages[] = {
+    {"Dave <dave@example.org>",   "delta"},
+    {"bob <bob@example.org>",     "Re: beta"},
+    {"Carol <carol@example.org>", "Alpha"},
+    {"alice <alice@example.org>", "charlie"}
+};
+
+/* The last one is only colored before sorting. */
+#define TEST_COLORED G_N_ELEMENTS(test_messages)
+
+/* The mailbox. */
+
+#define TEST_TYPE_MAILBOX test_mailbox_get_type()
+G_DECLARE_FINAL_TYPE(TestMailbox, test_mailbox, TEST, MAILBOX,
+                     LibBalsaMailbox)
+
+struct _TestMailbox {
+    LibBalsaMailbox parent;
+};
+
+G_DEFINE_TYPE(TestMailbox, test_mailbox, LIBBALSA_TYPE_MAILBOX)
+
+static gboolean
+test_mailbox_open(LibBalsaMailbox * mailbox, GError ** err)
+{
+    return TRUE;
+}
+
+static void
+test_mailbox_close(LibBalsaMailbox * mailbox, gboolean expunge)
+{
+}
+
+static guint
+test_mailbox_total_messages(LibBalsaMailbox * mailbox)
+{
+    return G_N_ELEMENTS(test_messages);
+}
+
+static LibBalsaMessage *
+test_mailbox_get_message(LibBalsaMailbox * mailbox, guint msgno)
+{
+    LibBalsaMessage *message = libbalsa_message_new();
+    LibBalsaMessageHeaders *headers = libbalsa_message_get_headers(message);
+
+    libbalsa_message_set_mailbox(message, mailbox);
+    libbalsa_message_set_msgno(message, msgno);
+    libbalsa_message_set_subject(message,
+                                 test_messages[msgno - 1].subject);
+    headers->from =
+        internet_address_list_parse(NULL, test_messages[msgno - 1].from);
+
+    return message;
+}
+
+static gboolean
+test_mailbox_prepare_threading(LibBalsaMailbox * mailbox, guint start)
+{
+    return TRUE;
+}
+
+static void
+test_mailbox_class_init(TestMailboxClass * klass)
+{
+    LibBalsaMailboxClass *mailbox_class = LIBBALSA_MAILBOX_CLASS(klass);
+
+    mailbox_class->open_mailbox = test_mailbox_open;
+    mailbox_class->close_mailbox = test_mailbox_close;
+    mailbox_class->total_messages = test_mailbox_total_messages;
+    mailbox_class->get_message = test_mailbox_get_message;
+    mailbox_class->prepare_threading = test_mailbox_prepare_threading;
+}
+
+static void
+test_mailbox_init(TestMailbox * mailbox)
+{
+}
+
+/* Whether the rows of the view are the msgnos in order. */
+static gboolean
+test_check_order(LibBalsaMailbox * mailbox, const gchar * what,
+                 const guint * order)
+{
+    GtkTreeModel *model = GTK_TREE_MODEL(mailbox);
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(test_messages); i++) {
+        GtkTreeIter iter;
+        guint msgno;
+
+        if (!gtk_tree_model_iter_nth_child(model, &iter, NULL, i)) {
+            g_printerr("%s: row %u missing\n", what, i);
+            return FALSE;
+        }
+        msgno = GPOINTER_TO_UINT(((GNode *) iter.user_data)->data);
+        if (msgno != order[i]) {
+            g_printerr("%s: row %u has message %u, not %u\n", what, i,
+                       msgno, order[i]);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const guint by_from[] = { 4, 2, 3, 1 };
+    static const guint by_subject[] = { 3, 2, 4, 1 };
+    LibBalsaMailbox *mailbox;
+    LibBalsaMailboxView *view;
+    GArray *msgnos;
+    GNode *tree;
+    guint msgno;
+    gboolean ok;
+
+    libbalsa_init();
+
+    mailbox = g_object_new(TEST_TYPE_MAILBOX, NULL);
+    view = libbalsa_mailbox_view_new();
+    view->position = 0;         /* shown, so that entries are cached */
+    libbalsa_mailbox_set_view(mailbox, view);
+
+    if (!libbalsa_mailbox_open(mailbox, NULL)) {
+        g_printerr("could not open the mailbox\n");
+        return EXIT_FAILURE;
+    }
+
+    tree = g_node_new(NULL);
+    for (msgno = G_N_ELEMENTS(test_messages); msgno > 0; msgno--)
+        g_node_prepend_data(tree, GUINT_TO_POINTER(msgno));
+    libbalsa_mailbox_set_msg_tree(mailbox, tree);
+
+    for (msgno = 1; msgno < TEST_COLORED; msgno++) {
+        LibBalsaMessage *message =
+            libbalsa_mailbox_get_message(mailbox, msgno);
+
+        g_object_unref(message);
+    }
+    msgnos = g_array_new(FALSE, FALSE, sizeof(guint));
+    msgno = TEST_COLORED;
+    g_array_append_val(msgnos, msgno);
+    libbalsa_mailbox_set_foreground(mailbox, msgnos, "red");
+    g_array_free(msgnos, TRUE);
+
+    gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(mailbox),
+                                         LB_MBOX_FROM_COL,
+                                         GTK_SORT_ASCENDING);
+    ok = test_check_order(mailbox, "sender", by_from);
+
+    gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(mailbox),
+                                         LB_MBOX_SUBJECT_COL,
+                                         GTK_SORT_ASCENDING);
+    ok = test_check_order(mailbox, "subject", by_subject) && ok;
+
+    libbalsa_mailbox_close(mailbox, FALSE);
+    g_object_unref(mailbox);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,312 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * mailbox-threading-bench: time the threading of new mail in a local
+ * mailbox, and check it against threading from scratch.
+ *
+ * Most of a synthetic corpus (see bench-corpus.h) is written to an mbox
+ * and threaded with subject gathering; the rest is delivered in
+ * batches, each picked up by a mailbox check.  The threads are then
+ * recorded, the mailbox is threaded again from scratch, and the two
+ * must agree, message for message.  The same is done after some
+ * messages have been expunged.
+ *
+ * Usage: mailbox-threading-bench [--messages=N] [--batches=N]
+ *                                [--seed=N]
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <glib/gstdio.h>
+
+#include "libbalsa.h"
+#include "bench-corpus.h"
+
+#define BENCH_DEFAULT_MESSAGES 5000
+#define BENCH_DEFAULT_BATCHES  20
+#define BENCH_DEPTH            6
+#define BENCH_EXPUNGE_EVERY    7
+
+static gint opt_messages = BENCH_DEFAULT_MESSAGES;
+static gint opt_batches = BENCH_DEFAULT_BATCHES;
+static gint opt_seed = 1;
+
+static GOptionEntry bench_options[] = {
+    {"messages", 'n', 0, G_OPTION_ARG_INT, &opt_messages,
+     "Messages in the corpus", "N"},
+    {"batches", 'b', 0, G_OPTION_ARG_INT, &opt_batches,
+     "Deliveries of new mail", "N"},
+    {"seed", 's', 0, G_OPTION_ARG_INT, &opt_seed,
+     "Seed of the corpus", "N"},
+    {NULL}
+};
+
+static void
+bench_result(const gchar * what, guint count, gdouble seconds)
+{
+    g_print("%-24s %8u messages %10.3f s\n", what, count, seconds);
+}
+
+static void
+bench_remove_tree(const gchar * path)
+{
+    GDir *dir;
+
+    if ((dir = g_dir_open(path, 0, NULL)) != NULL) {
+        const gchar *name;
+
+        while ((name = g_dir_read_name(dir)) != NULL) {
+            gchar *child = g_build_filename(path, name, NULL);
+
+            if (g_file_test(child, G_FILE_TEST_IS_DIR))
+                bench_remove_tree(child);
+            else
+                g_unlink(child);
+            g_free(child);
+        }
+        g_dir_close(dir);
+    }
+    g_rmdir(path);
+}
+
+/* Local mailboxes thread in idle callbacks. */
+static void
+bench_idle(void)
+{
+    while (g_main_context_iteration(NULL, FALSE));
+}
+
+/* The parent of each message, by msgno; 0 for a thread root. */
+static guint *
+bench_parents(LibBalsaMailbox * mailbox)
+{
+    GtkTreeModel *model = GTK_TREE_MODEL(mailbox);
+    guint total = libbalsa_mailbox_total_messages(mailbox);
+    guint *parents = g_new0(guint, total + 1);
+    guint msgno;
+
+    for (msgno = 1; msgno <= total; msgno++) {
+        GtkTreeIter iter, parent;
+
+        if (libbalsa_mailbox_msgno_find(mailbox, msgno, NULL, &iter)
+            && gtk_tree_model_iter_parent(model, &parent, &iter))
+            gtk_tree_model_get(model, &parent, LB_MBOX_MSGNO_COL,
+                               &parents[msgno], -1);
+    }
+
+    return parents;
+}
+
+/* Thread the mailbox from scratch, and compare with the threads it
+ * had. */
+static gboolean
+bench_compare(LibBalsaMailbox * mailbox, const gchar * what)
+{
+    guint total = libbalsa_mailbox_total_messages(mailbox);
+    guint *incremental, *scratch;
+    guint msgno, mismatches = 0;
+    gint64 start;
+
+    incremental = bench_parents(mailbox);
+
+    libbalsa_mailbox_set_threading_type(mailbox,
+                                        LB_MAILBOX_THREADING_FLAT);
+    bench_idle();
+    start = g_get_monotonic_time();
+    libbalsa_mailbox_set_threading_type(mailbox,
+                                        LB_MAILBOX_THREADING_JWZ);
+    bench_idle();
+    bench_result(what, total, (g_get_monotonic_time() - start) / 1e6);
+
+    scratch = bench_parents(mailbox);
+    for (msgno = 1; msgno <= total; msgno++)
+        if (incremental[msgno] != scratch[msgno]) {
+            if (mismatches++ < 10)
+                g_printerr("%s: message %u under %u, not %u\n", what,
+                           msgno, incremental[msgno], scratch[msgno]);
+        }
+    if (mismatches > 0)
+        g_printerr("%s: %u messages threaded differently\n", what,
+                   mismatches);
+
+    g_free(incremental);
+    g_free(scratch);
+
+    return mismatches == 0;
+}
+
+/* Deliver the rest of the corpus in batches. */
+static gboolean
+bench_deliver(LibBalsaMailbox * mailbox, BenchCorpus * corpus,
+              const gchar * path, guint first)
+{
+    guint total = bench_corpus_get_length(corpus);
+    guint batch = MAX((total - first) / opt_batches, 1);
+    GError *err = NULL;
+    gint64 elapsed = 0;
+
+    while (first < total) {
+        guint count = MIN(batch, total - first);
+        gint64 start;
+
+        if (!bench_corpus_write(corpus, BENCH_CORPUS_MBOX, path, first,
+                                count, &err)) {
+            g_printerr("could not deliver: %s\n", err->message);
+            g_error_free(err);
+            return FALSE;
+        }
+        first += count;
+
+        /* The delivery may have been made within the second of the
+         * last check. */
+        libbalsa_mailbox_set_mtime(mailbox, 1);
+
+        start = g_get_monotonic_time();
+        libbalsa_mailbox_check(mailbox);
+        bench_idle();
+        elapsed += g_get_monotonic_time() - start;
+
+        if (libbalsa_mailbox_total_messages(mailbox) != first) {
+            g_printerr("%u messages, not %u\n",
+                       libbalsa_mailbox_total_messages(mailbox), first);
+            return FALSE;
+        }
+    }
+    bench_result("deliver", total, elapsed / 1e6);
+
+    return TRUE;
+}
+
+static void
+bench_expunge(LibBalsaMailbox * mailbox)
+{
+    guint total = libbalsa_mailbox_total_messages(mailbox);
+    GArray *msgnos = g_array_new(FALSE, FALSE, sizeof(guint));
+    guint msgno;
+    gint64 start;
+
+    for (msgno = 1; msgno <= total; msgno += BENCH_EXPUNGE_EVERY)
+        g_array_append_val(msgnos, msgno);
+    libbalsa_mailbox_messages_change_flags(mailbox, msgnos,
+                                           LIBBALSA_MESSAGE_FLAG_DELETED,
+                                           0);
+
+    start = g_get_monotonic_time();
+    libbalsa_mailbox_sync_storage(mailbox, TRUE);
+    bench_idle();
+    bench_result("expunge", msgnos->len,
+                 (g_get_monotonic_time() - start) / 1e6);
+
+    g_array_free(msgnos, TRUE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    GOptionContext *context;
+    GError *err = NULL;
+    BenchCorpusSpec spec;
+    BenchCorpus *corpus;
+    LibBalsaMailbox *mailbox;
+    gchar *dir, *home, *path;
+    guint first;
+    gint64 start;
+    gboolean ok;
+
+    context = g_option_context_new(NULL);
+    g_option_context_add_main_entries(context, bench_options, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &err)) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        g_option_context_free(context);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    if (opt_messages < 2 || opt_batches < 1) {
+        g_printerr("bad options\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((dir = g_dir_make_tmp("balsa-threading-XXXXXX", NULL)) == NULL) {
+        g_printerr("could not create a temporary directory\n");
+        return EXIT_FAILURE;
+    }
+    /* Keep the cache of the mailbox out of the user's home. */
+    home = g_build_filename(dir, "home", NULL);
+    g_mkdir(home, 0700);
+    g_setenv("HOME", home, TRUE);
+    g_free(home);
+
+    libbalsa_init();
+
+    spec.messages = opt_messages;
+    spec.thread_depth = BENCH_DEPTH;
+    spec.mime_parts = 1;
+    spec.charset_mix = 0;
+    spec.seed = opt_seed;
+    corpus = bench_corpus_new(&spec);
+
+    /* A fifth of the corpus comes as new mail. */
+    first = opt_messages - MAX(opt_messages / 5, 1);
+    path = g_build_filename(dir, "mbox", NULL);
+    ok = bench_corpus_write(corpus, BENCH_CORPUS_MBOX, path, 0, first,
+                            &err);
+    if (!ok) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+    }
+
+    mailbox = ok ? libbalsa_mailbox_mbox_new(path, FALSE) : NULL;
+    if (ok && !libbalsa_mailbox_open(mailbox, &err)) {
+        g_printerr("could not open: %s\n",
+                   err != NULL ? err->message : "?");
+        g_clear_error(&err);
+        ok = FALSE;
+    }
+
+    if (ok) {
+        start = g_get_monotonic_time();
+        libbalsa_mailbox_set_threading_type(mailbox,
+                                            LB_MAILBOX_THREADING_JWZ);
+        bench_idle();
+        bench_result("thread", first,
+                     (g_get_monotonic_time() - start) / 1e6);
+
+        ok = bench_deliver(mailbox, corpus, path, first)
+            && bench_compare(mailbox, "rethread");
+        if (ok) {
+            bench_expunge(mailbox);
+            ok = bench_compare(mailbox, "rethread expunged");
+        }
+        libbalsa_mailbox_close(mailbox, FALSE);
+    }
+
+    g_clear_object(&mailbox);
+    bench_corpus_free(corpus);
+    bench_remove_tree(dir);
+    g_free(path);
+    g_free(dir);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,344 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * mbox-index-test: check that an mbox mailbox finds its messages again
+ * through the index it saved: the envelopes read back after a reopen,
+ * a message without a subject staying without one, and an index that
+ * no longer matches the mbox file because messages were appended, the
+ * file was rewritten, or the index was torn.
+ *
+ * Usage: mbox-index-test
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <string.h>
+#include <utime.h>
+#include <glib/gstdio.h>
+
+#include "libbalsa.h"
+#include "mailbox_mbox.h"
+#include "misc.h"
+
+static gchar *test_dir;
+static gchar *test_path;
+
+/* The messages, by msgno; the subject of the second one is changed in
+ * place to check where the envelopes come from. */
+static const gchar *test_subjects[] = { "one", "two", NULL, "four" };
+
+#define TEST_CHANGED_FROM "Subject: two\n"
+#define TEST_CHANGED_TO   "Subject: TWO\n"
+
+static gboolean
+test_fail(const gchar * test, const gchar * what)
+{
+    g_printerr("%s: %s\n", test, what);
+
+    return FALSE;
+}
+
+static GString *
+test_message(guint msgno)
+{
+    GString *text = g_string_new(NULL);
+
+    g_string_append(text, "From sender@example.org Mon Jan  1 00:00:00 2024\n");
+    g_string_append_printf(text, "From: sender@example.org\n"
+                           "To: rcpt@example.org\n"
+                           "Message-ID: <%u@example.org>\n", msgno);
+    if (test_subjects[msgno - 1] != NULL)
+        g_string_append_printf(text, "Subject: %s\n",
+                               test_subjects[msgno - 1]);
+    g_string_append_printf(text, "\nBody of message %u.\n\n", msgno);
+
+    return text;
+}
+
+/* Write the first count messages to the mbox file. */
+static gboolean
+test_write(guint count)
+{
+    GString *text = g_string_new(NULL);
+    guint msgno;
+    gboolean ok;
+
+    for (msgno = 1; msgno <= count; msgno++) {
+        GString *message = test_message(msgno);
+
+        g_string_append_len(text, message->str, message->len);
+        g_string_free(message, TRUE);
+    }
+    ok = g_file_set_contents(test_path, text->str, text->len, NULL);
+    g_string_free(text, TRUE);
+
+    return ok;
+}
+
+/* Set the modification time of the mbox file. */
+static void
+test_set_mtime(time_t mtime)
+{
+    struct utimbuf times;
+
+    times.actime = times.modtime = mtime;
+    g_utime(test_path, &times);
+}
+
+static time_t
+test_get_mtime(void)
+{
+    GStatBuf st;
+
+    return g_stat(test_path, &st) == 0 ? st.st_mtime : 0;
+}
+
+/* Change the subject of the second message without changing the size
+ * of the file. */
+static gboolean
+test_change_subject(void)
+{
+    gchar *contents;
+    gchar *subject;
+    gsize length;
+    gboolean ok;
+
+    if (!g_file_get_contents(test_path, &contents, &length, NULL))
+        return FALSE;
+    if ((subject = strstr(contents, TEST_CHANGED_FROM)) != NULL)
+        memcpy(subject, TEST_CHANGED_TO, strlen(TEST_CHANGED_TO));
+    ok = subject != NULL
+        && g_file_set_contents(test_path, contents, length, NULL);
+    g_free(contents);
+
+    return ok;
+}
+
+/* The index file of the mailbox: the only file in the cache
+ * directory. */
+static gchar *
+test_index_filename(void)
+{
+    gchar *cache_dir;
+    GDir *dir;
+    const gchar *name;
+    gchar *filename = NULL;
+
+    cache_dir = g_build_filename(test_dir, "home", ".balsa", NULL);
+    if ((dir = g_dir_open(cache_dir, 0, NULL)) != NULL) {
+        if ((name = g_dir_read_name(dir)) != NULL)
+            filename = g_build_filename(cache_dir, name, NULL);
+        g_dir_close(dir);
+    }
+    g_free(cache_dir);
+
+    return filename;
+}
+
+/* Open the mailbox and check that it has count messages with the
+ * subjects of test_subjects, except that the second one is
+ * second_subject; then close it, which leaves its index behind. */
+static gboolean
+test_check(const gchar * test, guint count, const gchar * second_subject)
+{
+    LibBalsaMailbox *mailbox;
+    GError *err = NULL;
+    guint msgno;
+    gboolean ok = TRUE;
+
+    mailbox = libbalsa_mailbox_mbox_new(test_path, FALSE);
+    if (!libbalsa_mailbox_open(mailbox, &err)) {
+        g_printerr("%s: could not open: %s\n", test,
+                   err != NULL ? err->message : "?");
+        g_clear_error(&err);
+        g_object_unref(mailbox);
+        return FALSE;
+    }
+
+    if (libbalsa_mailbox_total_messages(mailbox) != count)
+        ok = test_fail(test, "wrong number of messages");
+
+    for (msgno = 1; ok && msgno <= count; msgno++) {
+        LibBalsaMessage *message;
+        const gchar *expected;
+        const gchar *subject;
+
+        expected = msgno == 2 ? second_subject : test_subjects[msgno - 1];
+        message = libbalsa_mailbox_get_message(mailbox, msgno);
+        subject = libbalsa_message_get_subject_raw(message);
+        if (g_strcmp0(subject, expected) != 0) {
+            g_printerr("%s: message %u has subject “%s”, not “%s”\n",
+                       test, msgno, subject != NULL ? subject : "(null)",
+                       expected != NULL ? expected : "(null)");
+            ok = FALSE;
+        }
+        g_object_unref(message);
+    }
+
+    libbalsa_mailbox_close(mailbox, FALSE);
+    g_object_unref(mailbox);
+
+    return ok;
+}
+
+/* The envelopes are read back from the index as they were saved: a
+ * change to the file that the index cannot see goes unnoticed. */
+static gboolean
+test_round_trip(void)
+{
+    time_t mtime;
+
+    if (!test_write(3) || !test_check("round trip", 3, "two"))
+        return FALSE;
+
+    mtime = test_get_mtime();
+    if (!test_change_subject())
+        return test_fail("round trip", "could not change the mbox file");
+    test_set_mtime(mtime);
+
+    return test_check("round trip", 3, "two");
+}
+
+/* Messages appended to the file are parsed after the indexed ones. */
+static gboolean
+test_appended(void)
+{
+    GString *message;
+    gchar *contents;
+    gsize length;
+    gboolean ok;
+
+    if (!test_write(3) || !test_check("appended", 3, "two"))
+        return FALSE;
+
+    if (!g_file_get_contents(test_path, &contents, &length, NULL))
+        return test_fail("appended", "could not read the mbox file");
+    message = test_message(4);
+    g_string_prepend_len(message, contents, length);
+    g_free(contents);
+    ok = g_file_set_contents(test_path, message->str, message->len, NULL);
+    g_string_free(message, TRUE);
+    if (!ok)
+        return test_fail("appended", "could not append to the mbox file");
+
+    return test_check("appended", 4, "two")
+        && test_check("appended, reopened", 4, "two");
+}
+
+/* A file rewritten in place, with its size unchanged, is parsed again
+ * from the start. */
+static gboolean
+test_rewritten(void)
+{
+    time_t mtime;
+
+    if (!test_write(3) || !test_check("rewritten", 3, "two"))
+        return FALSE;
+
+    mtime = test_get_mtime();
+    if (!test_change_subject())
+        return test_fail("rewritten", "could not change the mbox file");
+    test_set_mtime(mtime + 10);
+
+    return test_check("rewritten", 3, "TWO");
+}
+
+/* An index cut short keeps its whole records, and the rest of the
+ * file is parsed; the index is then saved whole again. */
+static gboolean
+test_torn(void)
+{
+    gchar *filename;
+    gchar *contents;
+    gsize length;
+    gboolean ok;
+
+    if (!test_write(3) || !test_check("torn", 3, "two"))
+        return FALSE;
+
+    if ((filename = test_index_filename()) == NULL)
+        return test_fail("torn", "no index was saved");
+    ok = g_file_get_contents(filename, &contents, &length, NULL);
+    if (ok) {
+        ok = g_file_set_contents(filename, contents, length - 10, NULL);
+        g_free(contents);
+    }
+    g_free(filename);
+    if (!ok)
+        return test_fail("torn", "could not tear the index");
+
+    return test_check("torn", 3, "two")
+        && test_check("torn, reopened", 3, "two");
+}
+
+/* Each test starts with a new mbox file and no index. */
+static gboolean
+test_run(gboolean (*test) (void))
+{
+    gchar *cache_dir;
+    gboolean ok;
+
+    cache_dir = g_build_filename(test_dir, "home", ".balsa", NULL);
+    g_mkdir_with_parents(cache_dir, 0700);
+
+    ok = test();
+
+    libbalsa_delete_directory_contents(cache_dir);
+    g_free(cache_dir);
+    g_unlink(test_path);
+
+    return ok;
+}
+
+int
+main(int argc, char *argv[])
+{
+    GError *err = NULL;
+    gchar *home;
+    gboolean ok;
+
+    if ((test_dir = g_dir_make_tmp("balsa-mbox-XXXXXX", &err)) == NULL) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        return EXIT_FAILURE;
+    }
+    /* Keep the index out of the user's home. */
+    home = g_build_filename(test_dir, "home", NULL);
+    g_setenv("HOME", home, TRUE);
+    g_free(home);
+    test_path = g_build_filename(test_dir, "mbox", NULL);
+
+    libbalsa_init();
+
+    ok = test_run(test_round_trip);
+    ok = test_run(test_appended) && ok;
+    ok = test_run(test_rewritten) && ok;
+    ok = test_run(test_torn) && ok;
+
+    libbalsa_delete_directory_contents(test_dir);
+    g_rmdir(test_dir);
+    g_free(test_path);
+    g_free(test_dir);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
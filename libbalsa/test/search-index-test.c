@@ -0,0 +1,209 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * search-index-test: check which messages the search index rules out
+ * for a string condition: a word in the middle of the string must be
+ * indexed whole, the first one must end an indexed word, the last one
+ * begin one, and a single word may be anywhere in one.  A message with
+ * a word too long to index is never ruled out.  The same must hold
+ * after the index is saved and loaded again, after messages are added
+ * to it, and after dropped messages are collected.
+ *
+ * Usage: search-index-test
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "search-index.h"
+#include "filter-funcs.h"
+#include "misc.h"
+
+/* The messages, by number; the last one has a word that is too long to
+ * index. */
+static const struct {
+    const gchar *key;
+    const gchar *texts[2];
+} test_docs[] = {
+    {"alpha",   {"Meeting tomorrow", "Please bring the quarterly report."}},
+    {"beta",    {"Lunch plans",      "Pizza or sushi?"}},
+    {"gamma",   {"Quarterly numbers", "Reporting period ends Friday."}},
+    {"partial", {"Long", "Pneumonoultramicroscopicsilicovolcanoconiosis"
+                         "Pneumonoultramicroscopicsilicovolcanoconiosis"}}
+};
+
+/* Added after the first queries. */
+static const gchar *test_late_key = "delta";
+static const gchar *test_late_texts[] = { "Reports due", NULL };
+
+#define TEST_DOC(n)   (1 << ((n) - 1))
+#define TEST_PARTIAL  TEST_DOC(G_N_ELEMENTS(test_docs))
+#define TEST_LATE     TEST_DOC(G_N_ELEMENTS(test_docs) + 1)
+
+/* The strings, and the messages that each one may match. */
+static const struct {
+    const gchar *string;
+    guint may_match;
+} test_queries[] = {
+    {"report",              TEST_DOC(1) | TEST_DOC(3)},
+    {"PORT",                TEST_DOC(1) | TEST_DOC(3)},
+    {"sushi",               TEST_DOC(2)},
+    {"quarterly rep",       TEST_DOC(1) | TEST_DOC(3)},
+    {"arterly report",      TEST_DOC(1) | TEST_DOC(3)},
+    {"terly ing",           0},
+    {"lunch pla",           TEST_DOC(2)},
+    {"ort tomorrow please", TEST_DOC(1)},
+    {"ort tomorr please",   0},
+    {"xyzzy",               0}
+};
+
+static gchar *test_filename;
+
+static LibBalsaCondition *
+test_condition(const gchar * string)
+{
+    return libbalsa_condition_new_string(FALSE,
+                                         CONDITION_MATCH_SUBJECT |
+                                         CONDITION_MATCH_BODY,
+                                         g_strdup(string), NULL);
+}
+
+/* Whether the index rules out exactly the messages of n_docs that are
+ * not in may_match; a message that is not indexed is never ruled
+ * out. */
+static gboolean
+test_query(LibBalsaSearchIndex * index, const gchar * test,
+           const gchar * string, guint may_match, guint n_docs)
+{
+    LibBalsaCondition *cond = test_condition(string);
+    gboolean ok = TRUE;
+    guint n;
+
+    may_match |= TEST_PARTIAL;
+    for (n = 1; n <= n_docs; n++) {
+        const gchar *key = n <= G_N_ELEMENTS(test_docs) ?
+            test_docs[n - 1].key : test_late_key;
+        gboolean expected = !(may_match & TEST_DOC(n))
+            && libbalsa_search_index_has(index, key);
+
+        if (libbalsa_search_index_excludes(index, key, cond) != expected) {
+            g_printerr("%s: “%s” %s message %u\n", test, string,
+                       expected ? "does not rule out" : "rules out", n);
+            ok = FALSE;
+        }
+    }
+    libbalsa_condition_unref(cond);
+
+    return ok;
+}
+
+static gboolean
+test_queries_all(LibBalsaSearchIndex * index, const gchar * test)
+{
+    gboolean ok = TRUE;
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(test_queries); i++)
+        ok = test_query(index, test, test_queries[i].string,
+                        test_queries[i].may_match,
+                        G_N_ELEMENTS(test_docs)) && ok;
+
+    return ok;
+}
+
+int
+main(int argc, char *argv[])
+{
+    gchar *dir;
+    gchar *home;
+    LibBalsaSearchIndex *index;
+    GHashTable *live_keys;
+    GError *err = NULL;
+    guint i;
+    gboolean ok;
+
+    if ((dir = g_dir_make_tmp("balsa-index-XXXXXX", &err)) == NULL) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        return EXIT_FAILURE;
+    }
+    /* libbalsa_search_index_save() makes sure that ~/.balsa exists. */
+    home = g_build_filename(dir, "home", NULL);
+    g_setenv("HOME", home, TRUE);
+    g_free(home);
+    test_filename = g_build_filename(dir, "search-index", NULL);
+
+    index = libbalsa_search_index_new(test_filename);
+    for (i = 0; i < G_N_ELEMENTS(test_docs); i++)
+        libbalsa_search_index_add(index, test_docs[i].key,
+                                  test_docs[i].texts,
+                                  G_N_ELEMENTS(test_docs[i].texts));
+    ok = test_queries_all(index, "new");
+
+    /* Saved and loaded again. */
+    if (!libbalsa_search_index_save(index, NULL, &err)) {
+        g_printerr("save: %s\n", err->message);
+        g_clear_error(&err);
+        ok = FALSE;
+    }
+    libbalsa_search_index_free(index);
+    index = libbalsa_search_index_new(test_filename);
+    ok = test_queries_all(index, "loaded") && ok;
+
+    /* A message added after the first queries brings new words. */
+    libbalsa_search_index_add(index, test_late_key, test_late_texts,
+                              G_N_ELEMENTS(test_late_texts));
+    ok = test_query(index, "added", "repo",
+                    TEST_DOC(1) | TEST_DOC(3) | TEST_LATE,
+                    G_N_ELEMENTS(test_docs) + 1) && ok;
+    ok = test_query(index, "added", "due", TEST_LATE,
+                    G_N_ELEMENTS(test_docs) + 1) && ok;
+
+    /* A dropped message is no longer indexed, and the words of the
+     * others remain. */
+    live_keys = g_hash_table_new(g_str_hash, g_str_equal);
+    for (i = 0; i < G_N_ELEMENTS(test_docs); i++)
+        if (strcmp(test_docs[i].key, "alpha") != 0)
+            g_hash_table_add(live_keys, (gpointer) test_docs[i].key);
+    g_hash_table_add(live_keys, (gpointer) test_late_key);
+    if (!libbalsa_search_index_save(index, live_keys, &err)) {
+        g_printerr("collect: %s\n", err->message);
+        g_clear_error(&err);
+        ok = FALSE;
+    }
+    g_hash_table_destroy(live_keys);
+    ok = test_query(index, "collected", "reports", TEST_LATE,
+                    G_N_ELEMENTS(test_docs) + 1) && ok;
+    ok = test_query(index, "collected", "tomorrow", 0,
+                    G_N_ELEMENTS(test_docs) + 1) && ok;
+    libbalsa_search_index_free(index);
+
+    libbalsa_delete_directory_contents(dir);
+    g_rmdir(dir);
+    g_free(test_filename);
+    g_free(dir);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,291 @@
+/* -*-mode:c; c-style:k&r; c-basic-offset:4; -*- */
+/* Balsa E-Mail Client
+ * Copyright (C) 1997-2020 Stuart Parmenter and others,
+ *                         See the file AUTHORS for a list.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * utf8-strstr-bench: time the case insensitive substring search used by
+ * filters and searches, against the character by character search it
+ * replaced.
+ *
+ * The haystacks are mail bodies: the messages in the given mbox files
+ * and maildir or MH directories, or, with no arguments, a synthetic
+ * corpus.  Each needle is searched for in every haystack, as a body
+ * search over a mailbox does.
+ *
+ * Usage: utf8-strstr-bench [mbox-file | mail-directory]...
+ */
+
+#if defined(HAVE_CONFIG_H) && HAVE_CONFIG_H
+# include "config.h"
+#endif                          /* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "misc.h"
+
+#define BENCH_SYNTHETIC_MESSAGES 20000
+#define BENCH_MIN_SECONDS        0.5
+
+static const gchar *const bench_needles[] = {
+    "the",
+    "Balsa",
+    "unsubscribe",
+    "Content-Transfer-Encoding",
+    "zyzzyva",
+    "gr\xc3\xbc\xc3\x9f" "e",   /* non-ASCII */
+    "na\xc3\xafve"
+};
+
+/* The search that libbalsa_utf8_strstr used to do. */
+static gboolean
+reference_utf8_strstr(const gchar * s1, const gchar * s2)
+{
+    const gchar *p, *q;
+
+    if (!s2)
+        return TRUE;
+    if (!s1)
+        return FALSE;
+    if (!*s2)
+        return TRUE;
+    while (*s1) {
+        for (; *s1 &&
+             g_unichar_toupper(g_utf8_get_char(s2)) !=
+             g_unichar_toupper(g_utf8_get_char(s1));
+             s1 = g_utf8_next_char(s1));
+        if (*s1) {
+            s1 = g_utf8_next_char(s1);
+            q = s1;
+            p = g_utf8_next_char(s2);
+            while (*q && *p &&
+                   g_unichar_toupper(g_utf8_get_char(p))
+                   == g_unichar_toupper(g_utf8_get_char(q))) {
+                p = g_utf8_next_char(p);
+                q = g_utf8_next_char(q);
+            }
+            if (!*p)
+                return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* The corpus. */
+
+static void
+bench_add_body(GPtrArray * bodies, const gchar * text, gssize len)
+{
+    const gchar *body;
+    gchar *copy;
+
+    /* Skip the headers, as content2reply does. */
+    body = g_strstr_len(text, len, "\n\n");
+    if (body != NULL) {
+        len -= body + 2 - text;
+        text = body + 2;
+    }
+
+    copy = g_strndup(text, len);
+    libbalsa_utf8_sanitize(&copy, FALSE, NULL);
+    g_ptr_array_add(bodies, copy);
+}
+
+static void
+bench_load_mbox(GPtrArray * bodies, const gchar * contents, gsize length)
+{
+    const gchar *start = contents;
+    const gchar *end = contents + length;
+
+    while (start < end) {
+        const gchar *next = g_strstr_len(start, end - start, "\nFrom ");
+
+        next = next != NULL ? next + 1 : end;
+        bench_add_body(bodies, start, next - start);
+        start = next;
+    }
+}
+
+static void
+bench_load(GPtrArray * bodies, const gchar * path)
+{
+    gchar *contents;
+    gsize length;
+
+    if (g_file_test(path, G_FILE_TEST_IS_DIR)) {
+        static const gchar *const subdirs[] = { "cur", "new", NULL };
+        const gchar *const *subdir;
+        GDir *dir;
+        const gchar *name;
+
+        /* A maildir: load its cur and new directories. */
+        for (subdir = subdirs; *subdir != NULL; subdir++) {
+            gchar *sub = g_build_filename(path, *subdir, NULL);
+
+            if (g_file_test(sub, G_FILE_TEST_IS_DIR))
+                bench_load(bodies, sub);
+            g_free(sub);
+        }
+
+        if ((dir = g_dir_open(path, 0, NULL)) == NULL)
+            return;
+        while ((name = g_dir_read_name(dir)) != NULL) {
+            gchar *file = g_build_filename(path, name, NULL);
+
+            /* An MH or maildir message. */
+            if (g_file_test(file, G_FILE_TEST_IS_REGULAR)
+                && name[0] != '.'
+                && g_file_get_contents(file, &contents, &length, NULL)) {
+                bench_add_body(bodies, contents, length);
+                g_free(contents);
+            }
+            g_free(file);
+        }
+        g_dir_close(dir);
+    } else if (g_file_get_contents(path, &contents, &length, NULL)) {
+        bench_load_mbox(bodies, contents, length);
+        g_free(contents);
+    } else
+        g_printerr("cannot read %s\n", path);
+}
+
+static void
+bench_synthesize(GPtrArray * bodies)
+{
+    static const gchar *const words[] = {
+        "the", "of", "and", "to", "a", "in", "is", "that", "for", "it",
+        "mail", "message", "folder", "filter", "thread", "server", "patch",
+        "Balsa", "GNOME", "GTK", "reply", "quoted", "attachment", "IMAP",
+        "caf\xc3\xa9", "\xc3\xa9t\xc3\xa9", "stra\xc3\x9f" "e",
+        "\xce\xb1\xce\xb2\xce\xb3", ">", "--", "http://example.org/"
+    };
+    GRand *rand = g_rand_new_with_seed(1);
+    guint i;
+
+    for (i = 0; i < BENCH_SYNTHETIC_MESSAGES; i++) {
+        GString *body = g_string_new(NULL);
+        guint n_words = g_rand_int_range(rand, 50, 2000);
+        guint j;
+
+        for (j = 0; j < n_words; j++) {
+            g_string_append(body,
+                            words[g_rand_int_range(rand, 0,
+                                                   G_N_ELEMENTS(words))]);
+            g_string_append_c(body, j % 12 == 11 ? '\n' : ' ');
+        }
+        g_ptr_array_add(bodies, g_string_free(body, FALSE));
+    }
+    g_rand_free(rand);
+}
+
+/* Timing: repeat each run until it has taken long enough to measure. */
+
+typedef guint (*BenchFunc) (GPtrArray * bodies, const gchar * needle);
+
+static guint
+bench_reference(GPtrArray * bodies, const gchar * needle)
+{
+    guint i, matches = 0;
+
+    for (i = 0; i < bodies->len; i++)
+        matches += reference_utf8_strstr(g_ptr_array_index(bodies, i),
+                                         needle);
+
+    return matches;
+}
+
+static guint
+bench_prepared(GPtrArray * bodies, const gchar * needle)
+{
+    LibBalsaUtf8Needle *prepared = libbalsa_utf8_needle_new(needle);
+    guint i, matches = 0;
+
+    for (i = 0; i < bodies->len; i++)
+        matches +=
+            libbalsa_utf8_needle_match(prepared,
+                                       g_ptr_array_index(bodies, i));
+    libbalsa_utf8_needle_unref(prepared);
+
+    return matches;
+}
+
+static gdouble
+bench_time(BenchFunc func, GPtrArray * bodies, const gchar * needle,
+           guint * matches)
+{
+    gint64 start = g_get_monotonic_time();
+    gdouble seconds;
+    guint runs = 0;
+
+    do {
+        *matches = func(bodies, needle);
+        ++runs;
+        seconds = (g_get_monotonic_time() - start) / 1e6;
+    } while (seconds < BENCH_MIN_SECONDS);
+
+    return seconds / runs;
+}
+
+int
+main(int argc, char *argv[])
+{
+    GPtrArray *bodies = g_ptr_array_new_with_free_func(g_free);
+    guint64 bytes = 0;
+    guint i;
+    gboolean ok = TRUE;
+
+    for (i = 1; i < (guint) argc; i++)
+        bench_load(bodies, argv[i]);
+    if (argc == 1)
+        bench_synthesize(bodies);
+    if (bodies->len == 0) {
+        g_printerr("usage: %s [mbox-file | mail-directory]...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < bodies->len; i++)
+        bytes += strlen(g_ptr_array_index(bodies, i));
+    g_print("%u bodies, %.1f MB\n", bodies->len, bytes / 1e6);
+    g_print("%-28s %8s %10s %10s %8s\n", "needle", "matches",
+            "old MB/s", "new MB/s", "speedup");
+
+    for (i = 0; i < G_N_ELEMENTS(bench_needles); i++) {
+        const gchar *needle = bench_needles[i];
+        guint old_matches, new_matches;
+        gdouble old_time, new_time;
+
+        old_time = bench_time(bench_reference, bodies, needle, &old_matches);
+        new_time = bench_time(bench_prepared, bodies, needle, &new_matches);
+        g_print("%-28s %8u %10.1f %10.1f %7.1fx\n", needle, new_matches,
+                bytes / 1e6 / old_time, bytes / 1e6 / new_time,
+                old_time / new_time);
+
+        /* The ASCII search does not let U+0131 and U+017F match "i" and
+         * "s", so real mail may, rarely, give different counts. */
+        if (new_matches != old_matches) {
+            g_print("%-28s %8u matches with the old search\n", "",
+                    old_matches);
+            if (argc == 1)
+                ok = FALSE;
+        }
+    }
+
+    g_ptr_array_unref(bodies);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -19,12 +19,18 @@
 #include "net-client-siobuf.h"
 
 
+/* Size of the blocks read from the remote server, and the initial size of the read buffer. */
+#define SIOBUF_BLOCK_SIZE			16384U
+
+
 /*lint -esym(754,_NetClientSioBuf::parent)	required field, not referenced directly */
 struct _NetClientSioBuf {
     NetClient parent;
 
-	GString *buffer;		/**< hold a line read from the remote server, including the terminating CRLF */
-	gchar *read_ptr;		/**< point to the next char which shall be read in buffer's GString::str. */
+	gchar *buffer;			/**< data read from the remote server, in blocks */
+	gsize size;				/**< allocated size of buffer */
+	gsize start;			/**< offset of the next byte which shall be read in buffer */
+	gsize end;				/**< offset behind the last byte received in buffer */
 	GString *writebuf;		/**< buffer for buffered write functions */
 };
 
@@ -35,6 +41,10 @@ G_DEFINE_TYPE(NetClientSioBuf, net_client_siobuf, NET_CLIENT_TYPE)
 
 static void net_client_siobuf_finalise(GObject *object);
 static gboolean net_client_siobuf_fill(NetClientSioBuf *client, GError **error);
+static gboolean net_client_siobuf_avail(NetClientSioBuf *client, GError **error);
+static gboolean net_client_siobuf_scan_line(NetClientSioBuf *client, gsize max_len, gsize *line_len, GError **error);
+static const gchar *net_client_siobuf_find_eol(const NetClientSioBuf *client, gsize from, gsize to);
+static gboolean net_client_siobuf_check_empty(NetClientSioBuf *client, const gchar *message, GError **error);
 
 
 NetClientSioBuf *
@@ -50,8 +60,10 @@ net_client_siobuf_new(const gchar *host, guint16 port)
 			g_object_unref(client);
 			client = NULL;
 		} else {
-			client->buffer = g_string_sized_new(1024U);
-			client->read_ptr = NULL;
+			client->size = SIOBUF_BLOCK_SIZE;
+			client->buffer = g_malloc(client->size);
+			client->start = 0U;
+			client->end = 0U;
 			client->writebuf = g_string_sized_new(1024U);
 		}
 	}
@@ -63,33 +75,38 @@ net_client_siobuf_new(const gchar *host, guint16 port)
 gint
 net_client_siobuf_read(NetClientSioBuf *client, void *buffer, gsize count, GError **error)
 {
-	gboolean fill_res;
 	gchar *dest;
 	gsize left;
+	gboolean read_res;
 
 	g_return_val_if_fail(NET_IS_CLIENT_SIOBUF(client) && (buffer != NULL) && (count > 0U), -1);
 
 	dest = (gchar *) buffer;	/*lint !e9079	sane pointer conversion (MISRA C:2012 Rule 11.5) */
 	left = count;
-	fill_res = net_client_siobuf_fill(client, error);
-	while (fill_res && (left > 0U)) {
-		gsize avail;
+	read_res = TRUE;
+	while (read_res && (left > 0U)) {
 		gsize chunk;
 
-		/*lint -e{737,946,947,9029}		allowed exception according to MISRA C:2012 Rules 18.2, 18.3 */
-		avail = client->buffer->len - (client->read_ptr - client->buffer->str);
-		if (avail > left) {
-			chunk = left;
+		if (client->start < client->end) {
+			/* use buffered data first */
+			chunk = MIN(client->end - client->start, left);
+			memcpy(dest, &client->buffer[client->start], chunk);
+			client->start += chunk;
+		} else if (left >= SIOBUF_BLOCK_SIZE) {
+			/* large amounts, i. e. literals, go straight into the destination buffer, keeping the last byte for ungetc */
+			read_res = net_client_read_buffer(NET_CLIENT(client), dest, left, &chunk, error);
+			if (read_res) {
+				client->buffer[0] = dest[chunk - 1U];
+				client->start = 1U;
+				client->end = 1U;
+			}
 		} else {
-			chunk = avail;
+			chunk = 0U;
+			read_res = net_client_siobuf_fill(client, error);
 		}
-
-		memcpy(dest, client->read_ptr, chunk);
-		dest += chunk;
-		client->read_ptr += chunk;
-		left -= chunk;
-		if (left > 0U) {
-			fill_res = net_client_siobuf_fill(client, error);
+		if (read_res) {
+			dest += chunk;
+			left -= chunk;
 		}
 	}
 
@@ -97,6 +114,32 @@ net_client_siobuf_read(NetClientSioBuf *client, void *buffer, gsize count, GErro
 }
 
 
+gboolean
+net_client_siobuf_read_sink(NetClientSioBuf *client, gsize count, NetClientSioBufSink sink, gpointer user_data, GError **error)
+{
+	gsize left;
+	gboolean result;
+
+	g_return_val_if_fail(NET_IS_CLIENT_SIOBUF(client) && (sink != NULL), FALSE);
+
+	left = count;
+	result = TRUE;
+	while (result && (left > 0U)) {
+		result = net_client_siobuf_avail(client, error);
+		if (result) {
+			gsize chunk;
+
+			chunk = MIN(client->end - client->start, left);
+			result = sink(&client->buffer[client->start], chunk, user_data, error);
+			client->start += chunk;
+			left -= chunk;
+		}
+	}
+
+	return result;
+}
+
+
 gint
 net_client_siobuf_getc(NetClientSioBuf *client, GError **error)
 {
@@ -104,8 +147,8 @@ net_client_siobuf_getc(NetClientSioBuf *client, GError **error)
 
 	g_return_val_if_fail(NET_IS_CLIENT_SIOBUF(client), -1);
 
-	if (net_client_siobuf_fill(client, error)) {
-		retval = (gint) *client->read_ptr++;
+	if (net_client_siobuf_avail(client, error)) {
+		retval = (gint) (guchar) client->buffer[client->start++];
 	} else {
 		retval = -1;
 	}
@@ -120,9 +163,8 @@ net_client_siobuf_ungetc(NetClientSioBuf *client)
 
 	g_return_val_if_fail(NET_IS_CLIENT_SIOBUF(client), -1);
 
-	/*lint -e{946}		allowed exception according to MISRA C:2012 Rules 18.2 and 18.3 */
-	if ((client->buffer->len != 0U) && (client->read_ptr > client->buffer->str)) {
-		client->read_ptr--;
+	if (client->start > 0U) {
+		client->start--;
 		retval = 0;
 	} else {
 		retval = -1;
@@ -135,22 +177,13 @@ gchar *
 net_client_siobuf_gets(NetClientSioBuf *client, gchar *buffer, gsize buflen, GError **error)
 {
 	gchar *result;
+	gsize chunk;
 
 	g_return_val_if_fail(NET_IS_CLIENT_SIOBUF(client) && (buffer != NULL) && (buflen > 0U), NULL);
 
-	if (net_client_siobuf_fill(client, error)) {
-		gsize avail;
-		gsize chunk;
-
-		/*lint -e{737,946,947,9029}		allowed exception according to MISRA C:2012 Rules 18.2 and 18.3 */
-		avail = client->buffer->len - (client->read_ptr - client->buffer->str);
-		if (avail > (buflen - 1U)) {
-			chunk = buflen - 1U;
-		} else {
-			chunk = avail;
-		}
-		memcpy(buffer, client->read_ptr, chunk);
-		client->read_ptr += chunk;
+	if (net_client_siobuf_avail(client, error) && net_client_siobuf_scan_line(client, buflen - 1U, &chunk, error)) {
+		memcpy(buffer, &client->buffer[client->start], chunk);
+		client->start += chunk;
 		buffer[chunk] = '\0';
 		result = buffer;
 	} else {
@@ -165,20 +198,23 @@ gchar *
 net_client_siobuf_get_line(NetClientSioBuf *client, GError **error)
 {
 	gchar *result;
+	gsize line_len;
 
 	g_return_val_if_fail(NET_IS_CLIENT_SIOBUF(client), NULL);
 
-	if (net_client_siobuf_fill(client, error)) {
-		gsize avail;
+	if (net_client_siobuf_scan_line(client, G_MAXSIZE, &line_len, error)) {
+		const gchar *line = &client->buffer[client->start];
+		gsize length = line_len;
 
-		/*lint -e{737,946,947,9029}		allowed exception according to MISRA C:2012 Rules 18.2 and 18.3 */
-		avail = client->buffer->len - (client->read_ptr - client->buffer->str);
-		if (avail > 2U) {
-			result = g_strndup(client->read_ptr, avail - 2U);
-		} else {
-			result = g_strdup("");
+		/* strip the CRLF, or what is left of it */
+		if ((length > 0U) && (line[length - 1U] == '\n')) {
+			length--;
+			if ((length > 0U) && (line[length - 1U] == '\r')) {
+				length--;
+			}
 		}
-		client->buffer->len = 0U;
+		result = g_strndup(line, length);
+		client->start += line_len;
 	} else {
 		result = NULL;
 	}
@@ -194,8 +230,23 @@ net_client_siobuf_discard_line(NetClientSioBuf *client, GError **error)
 
 	g_return_val_if_fail(NET_IS_CLIENT_SIOBUF(client), -1);
 
-	if (net_client_siobuf_fill(client, error)) {
-		client->buffer->len = 0U;
+	if (net_client_siobuf_avail(client, error)) {
+		gboolean done = FALSE;
+
+		/* drop data block by block, as the line may be too long for keeping it */
+		while (!done) {
+			const gchar *eol;
+
+			eol = net_client_siobuf_find_eol(client, client->start, client->end);
+			if (eol != NULL) {
+				/*lint -e{737,946,947,9029}		allowed exception according to MISRA C:2012 Rules 18.2 and 18.3 */
+				client->start = (eol - client->buffer) + 1U;
+				done = TRUE;
+			} else {
+				client->start = client->end;
+				done = !net_client_siobuf_fill(client, NULL);
+			}
+		}
 		result = (gint) '\n';
 	} else {
 		result = -1;
@@ -205,6 +256,15 @@ net_client_siobuf_discard_line(NetClientSioBuf *client, GError **error)
 }
 
 
+gboolean
+net_client_siobuf_can_read(NetClientSioBuf *client)
+{
+	g_return_val_if_fail(NET_IS_CLIENT_SIOBUF(client), FALSE);
+
+	return (client->start < client->end) || net_client_can_read(NET_CLIENT(client));
+}
+
+
 void
 net_client_siobuf_write(NetClientSioBuf *client, const void *buffer, gsize count)
 {
@@ -247,6 +307,26 @@ net_client_siobuf_flush(NetClientSioBuf *client, GError **error)
 }
 
 
+gboolean
+net_client_siobuf_start_tls(NetClientSioBuf *client, GError **error)
+{
+	g_return_val_if_fail(NET_IS_CLIENT_SIOBUF(client), FALSE);
+
+	return net_client_siobuf_check_empty(client, _("unexpected data received before starting TLS"), error) &&
+		net_client_start_tls(NET_CLIENT(client), error);
+}
+
+
+gboolean
+net_client_siobuf_start_compression(NetClientSioBuf *client, GError **error)
+{
+	g_return_val_if_fail(NET_IS_CLIENT_SIOBUF(client), FALSE);
+
+	return net_client_siobuf_check_empty(client, _("unexpected data received before starting compression"), error) &&
+		net_client_start_compression(NET_CLIENT(client), error);
+}
+
+
 /* == local functions =========================================================================================================== */
 
 static void
@@ -265,22 +345,67 @@ net_client_siobuf_init(G_GNUC_UNUSED NetClientSioBuf *self)
 }
 
 
+/* Append the next block of data received from the remote server to the read buffer.  The unread data and the byte before it, which
+ * net_client_siobuf_ungetc() may need, are first moved to the start of the buffer, so the buffer slides instead of wrapping around
+ * and a line in it is always contiguous.  The buffer grows if it is full, i. e. only for a line which does not fit into it. */
 static gboolean
 net_client_siobuf_fill(NetClientSioBuf *client, GError **error)
 {
 	gboolean result;
+	gsize bytes_read;
 
-	if ((client->buffer->len == 0U) || (client->read_ptr == NULL) || (*client->read_ptr == '\0')) {
-		gchar *read_buf;
+	if (client->start > 1U) {
+		gsize keep = client->start - 1U;
 
-		result = net_client_read_line(NET_CLIENT(client), &read_buf, error);
-		if (result) {
-			(void) g_string_assign(client->buffer, read_buf);
-			(void) g_string_append(client->buffer, "\r\n");
-			client->read_ptr = client->buffer->str;
-			g_free(read_buf);
-		}
+		memmove(client->buffer, &client->buffer[keep], client->end - keep);
+		client->start -= keep;
+		client->end -= keep;
+	}
+	if (client->end == client->size) {
+		client->size *= 2U;
+		client->buffer = g_realloc(client->buffer, client->size);
+	}
+
+	result = net_client_read_buffer(NET_CLIENT(client), &client->buffer[client->end], client->size - client->end, &bytes_read,
+		error);
+	if (result) {
+		client->end += bytes_read;
+	}
+
+	return result;
+}
+
+
+/* Make sure at least one unread byte is in the read buffer. */
+static gboolean
+net_client_siobuf_avail(NetClientSioBuf *client, GError **error)
+{
+	gboolean result;
+
+	if (client->start < client->end) {
+		result = TRUE;
 	} else {
+		result = net_client_siobuf_fill(client, error);
+	}
+
+	return result;
+}
+
+
+/* Fail if the read buffer contains data which has not been read yet, i. e. which the server sent before the response to the
+ * command starting TLS or compression, as it would otherwise be taken as part of the new stream (see CVE-2020-14954).  Otherwise
+ * drop the byte kept for net_client_siobuf_ungetc(), which belongs to the old stream. */
+static gboolean
+net_client_siobuf_check_empty(NetClientSioBuf *client, const gchar *message, GError **error)
+{
+	gboolean result;
+
+	if (client->start < client->end) {
+		g_set_error_literal(error, NET_CLIENT_ERROR_QUARK, (gint) NET_CLIENT_ERROR_DATA_PENDING, message);
+		result = FALSE;
+	} else {
+		client->start = 0U;
+		client->end = 0U;
 		result = TRUE;
 	}
 
@@ -288,13 +413,82 @@ net_client_siobuf_fill(NetClientSioBuf *client, GError **error)
 }
 
 
+/* Return the LF of the first CRLF sequence ending between the offsets from and to of the read buffer, or NULL if there is none.
+ * The CR may be the byte before from. */
+static const gchar *
+net_client_siobuf_find_eol(const NetClientSioBuf *client, gsize from, gsize to)
+{
+	const gchar *eol = NULL;
+
+	while ((eol == NULL) && (from < to)) {
+		const gchar *lf;
+
+		lf = memchr(&client->buffer[from], '\n', to - from);
+		if (lf == NULL) {
+			from = to;
+		} else if ((lf > client->buffer) && (lf[-1] == '\r')) {
+			eol = lf;
+		} else {
+			/*lint -e{737,946,947,9029}		allowed exception according to MISRA C:2012 Rules 18.2 and 18.3 */
+			from = (lf - client->buffer) + 1U;
+		}
+	}
+
+	return eol;
+}
+
+
+/* Read data until the unread part of the read buffer contains the end of the current line, including the terminating CRLF, or at
+ * least max_len bytes, and return the length of the line, but at most max_len.  The bytes which have been scanned already are not
+ * scanned again after reading more data.  If the connection is lost, the data read so far is the line, and only if there is none
+ * the function fails. */
+static gboolean
+net_client_siobuf_scan_line(NetClientSioBuf *client, gsize max_len, gsize *line_len, GError **error)
+{
+	gsize scanned = 0U;
+	gboolean result = TRUE;
+	gboolean done = FALSE;
+
+	while (!done) {
+		gsize avail = client->end - client->start;
+		const gchar *eol;
+
+		eol = net_client_siobuf_find_eol(client, client->start + scanned, client->start + MIN(avail, max_len));
+		if (eol != NULL) {
+			/*lint -e{737,946,947,9029}		allowed exception according to MISRA C:2012 Rules 18.2 and 18.3 */
+			*line_len = (eol - &client->buffer[client->start]) + 1U;
+			done = TRUE;
+		} else if (avail >= max_len) {
+			*line_len = max_len;
+			done = TRUE;
+		} else {
+			GError *fill_err = NULL;
+
+			scanned = avail;
+			if (!net_client_siobuf_fill(client, &fill_err)) {
+				if (avail > 0U) {
+					g_error_free(fill_err);
+					*line_len = avail;
+				} else {
+					g_propagate_error(error, fill_err);
+					result = FALSE;
+				}
+				done = TRUE;
+			}
+		}
+	}
+
+	return result;
+}
+
+
 static void
 net_client_siobuf_finalise(GObject *object)
 {
 	const NetClientSioBuf *client = NET_CLIENT_SIOBUF(object);
 	const GObjectClass *parent_class = G_OBJECT_CLASS(net_client_siobuf_parent_class);
 
-	(void) g_string_free(client->buffer, TRUE);
+	g_free(client->buffer);
 	(void) g_string_free(client->writebuf, TRUE);
 	(*parent_class->finalize)(object);
 }
@@ -29,6 +29,19 @@ G_DECLARE_FINAL_TYPE(NetClientSioBuf, net_client_siobuf, NET, CLIENT_SIOBUF, Net
 #define NET_CLIENT_SIOBUF_ERROR_QUARK		(g_quark_from_static_string("net-client-siobuf"))
 
 
+/** @brief Sink for data read from a SIOBUF network client object
+ *
+ * @param data data read from the remote server, @em not NUL-terminated
+ * @param count number of bytes in data
+ * @param user_data user data passed to net_client_siobuf_read_sink()
+ * @param error filled with error information on error
+ * @return TRUE on success, FALSE to stop reading
+ *
+ * The data is valid only while the function runs.
+ */
+typedef gboolean (*NetClientSioBufSink)(const gchar *data, gsize count, gpointer user_data, GError **error);
+
+
 /** @brief Create a new SIOBUF network client
  *
  * @param host host name or IP address to connect
@@ -47,18 +60,36 @@ NetClientSioBuf *net_client_siobuf_new(const gchar *host, guint16 port);
  * @return the number of bytes actually read, or -1 if nothing could be read
  *
  * Read a number of bytes, including the CRLF line terminations if applicable, from the remote server.  Note that the error location
- * may be filled on a short read (i. e. when the number of bytes read is smaller than the requested count).
+ * may be filled on a short read (i. e. when the number of bytes read is smaller than the requested count).  Large amounts are read
+ * from the remote server directly into the destination buffer.
  */
 gint net_client_siobuf_read(NetClientSioBuf *client, void *buffer, gsize count, GError **error);
 
 
+/** @brief Pass a number of bytes from a SIOBUF network client object to a sink
+ *
+ * @param client SIOBUF network client object
+ * @param count number of bytes which shall be read
+ * @param sink function receiving the data
+ * @param user_data additional data passed to the sink
+ * @param error filled with error information on error
+ * @return TRUE if all data has been read and accepted by the sink, FALSE on error
+ *
+ * Read exactly the passed number of bytes, e. g. an IMAP literal, from the remote server, and pass them to the sink in the chunks
+ * in which they are received, without copying them.  The data may contain NUL characters.
+ */
+gboolean net_client_siobuf_read_sink(NetClientSioBuf *client, gsize count, NetClientSioBufSink sink, gpointer user_data,
+	GError **error);
+
+
 /** @brief Read a character from a SIOBUF network client object
  *
  * @param client SIOBUF network client object
  * @param error filled with error information on error
  * @return the next character, or -1 if reading more data from the remote server failed
  *
- * Read the next character from the remote server.  This includes the terminating CR and LF characters of each line.
+ * Read the next character from the remote server.  This includes the terminating CR and LF characters of each line.  The
+ * character is returned as unsigned char, so 8-bit data and NUL characters are not mistaken for an error.
  */
 gint net_client_siobuf_getc(NetClientSioBuf *client, GError **error);
 
@@ -68,8 +99,8 @@ gint net_client_siobuf_getc(NetClientSioBuf *client, GError **error);
  * @param client SIOBUF network client object
  * @return 0 on success, or ä1 on error
  *
- * Put back the last character read from the remote server.  The function fails if no data is available or if the start of the
- * internal buffer has been reached.
+ * Put back the last character read from the remote server.  The function fails if no data has been read yet.  Only one
+ * character can be put back reliably, as the internal buffer keeps only the last character read when it is refilled.
  */
 gint net_client_siobuf_ungetc(NetClientSioBuf *client);
 
@@ -83,7 +114,8 @@ gint net_client_siobuf_ungetc(NetClientSioBuf *client);
  * @return the passed buffer on success, or NULL on error
  *
  * Fill the passed buffer with data from the remote server until either the end of the line is reached, or the buffer is full.  The
- * CRLF termination sequence is included in the buffer.  The buffer is always NUL-terminated.
+ * CRLF termination sequence is included in the buffer.  The buffer is always NUL-terminated.  A line ends only with a CRLF
+ * sequence, not with a single LF.
  */
 gchar *net_client_siobuf_gets(NetClientSioBuf *client, gchar *buffer, gsize buflen, GError **error);
 
@@ -94,9 +126,9 @@ gchar *net_client_siobuf_gets(NetClientSioBuf *client, gchar *buffer, gsize bufl
  * @param error filled with error information on error
  * @return a line of data, excluding the terminating CRLF on success, or NULL on error
  *
- * Return a newly allocated buffer, containing data from the remote server, but excluding the terminating CRLF sequence.  If the
- * read buffer contains only 1 or 2 characters (i. e. the terminating CRLF or only LF), the function returns an empty string.  The
- * internal read buffer is empty after calling this function.
+ * Return a newly allocated buffer, containing the rest of the current line from the remote server, but excluding the
+ * terminating CRLF sequence.  If only the terminating CRLF or only LF is left of the line, the function returns an empty string.
+ * The line is scanned in the internal read buffer, and copied only once.
  *
  * @note The caller must free the returned buffer when it is not needed any more.
  */
@@ -110,11 +142,23 @@ gchar *net_client_siobuf_get_line(NetClientSioBuf *client, GError **error)
  * @param error filled with error information on error
  * @return '\n' on success, or -1 on error
  *
- * Discard all pending data in the read buffer.  If the read buffer is empty, the function reads the next line and discards it.
+ * Discard the rest of the current line, including the terminating CRLF.  If the current line has been read completely, the
+ * function reads the next line and discards it.
  */
 gint net_client_siobuf_discard_line(NetClientSioBuf *client, GError **error);
 
 
+/** @brief Check if data can be read from a SIOBUF network client object
+ *
+ * @param client SIOBUF network client object
+ * @return TRUE if data is ready for reading
+ *
+ * Like net_client_can_read(), but also considers the data which has been received already, but not read yet.  As the data is
+ * received in blocks, it may contain more than one line.
+ */
+gboolean net_client_siobuf_can_read(NetClientSioBuf *client);
+
+
 /** @brief Write data to the SIOBUF output buffer
  *
  * @param client SIOBUF network client object
@@ -151,11 +195,37 @@ void net_client_siobuf_printf(NetClientSioBuf *client, const gchar *format, ...)
 gboolean net_client_siobuf_flush(NetClientSioBuf *client, GError **error);
 
 
+/** @brief Start encryption of a SIOBUF network client object
+ *
+ * @param client SIOBUF network client object
+ * @param error filled with error information on error
+ * @return TRUE if the connection is now encrypted
+ *
+ * Like net_client_start_tls(), but fail with @ref NET_CLIENT_ERROR_DATA_PENDING if the internal read buffer contains data which
+ * has not been read yet, as it has been received before the connection was encrypted.  The caller shall close the connection on
+ * error.
+ */
+gboolean net_client_siobuf_start_tls(NetClientSioBuf *client, GError **error);
+
+
+/** @brief Start compression of a SIOBUF network client object
+ *
+ * @param client SIOBUF network client object
+ * @param error filled with error information on error
+ * @return TRUE if the connection is now compressed
+ *
+ * Like net_client_start_compression(), but fail with @ref NET_CLIENT_ERROR_DATA_PENDING if the internal read buffer contains data
+ * which has not been read yet.  The caller shall close the connection on error.
+ */
+gboolean net_client_siobuf_start_compression(NetClientSioBuf *client, GError **error);
+
+
 /** @file
  *
  * This module implements a glue layer client class for Balsa's imap implementation.  In addition to the base class, it implements
- * an internal input line buffer which provides reading single characters and lines, reading an exact amount of bytes, and buffered
- * write operations.
+ * an internal input buffer which provides reading single characters and lines, reading an exact amount of bytes, and buffered
+ * write operations.  Data is received in blocks rather than line by line, and lines are found by scanning the buffer, so data
+ * passes through it with at most one copy, and may contain NUL characters.
  */
 
 #endif /* NET_CLIENT_SIOBUF_H_ */
@@ -25,6 +25,11 @@ struct _NetClientSmtp {
 	NetClientCryptMode crypt_mode;
 	guint auth_allowed[2];			/** 0: encrypted, 1: unencrypted */
 	gboolean can_dsn;
+	gboolean can_pipelining;		/** RFC 2920 */
+	gboolean can_chunking;			/** RFC 3030 */
+	gboolean can_8bitmime;			/** RFC 6152 */
+	gboolean can_size;				/** RFC 1870 */
+	guint64 max_size;				/** 0: no limit announced */
 	gboolean data_state;
 };
 
@@ -35,6 +40,8 @@ struct _NetClientSmtpMessage {
 	gchar *dsn_envid;
 	gboolean dsn_ret_full;
 	gboolean have_dsn_rcpt;
+	gsize size;
+	gboolean body_8bit;
 	NetClientSmtpSendCb data_callback;
 	gpointer user_data;
 };
@@ -50,6 +57,8 @@ typedef struct {
  * 12288 octets as safe maximum length for SASL authentication. */
 #define MAX_SMTP_LINE_LEN			12288U
 #define SMTP_DATA_BUF_SIZE			8192U
+/* Size of the chunks sent with BDAT (RFC 3030). */
+#define SMTP_BDAT_CHUNK_SIZE		(1024U * 1024U)
 
 
 /*lint -esym(528,net_client_smtp_get_instance_private)		auto-generated function, not referenced */
@@ -68,6 +77,14 @@ static gboolean net_client_smtp_auth_login(NetClientSmtp *client, const gchar *u
 static gboolean net_client_smtp_auth_cram(NetClientSmtp *client, GChecksumType chksum_type, const gchar *user, const gchar *passwd,
 										  GError **error);
 static gboolean net_client_smtp_auth_gssapi(NetClientSmtp *client, const gchar *user, GError **error);
+static gboolean net_client_smtp_envelope(NetClientSmtp *client, const NetClientSmtpMessage *message, GError **error);
+static gchar *net_client_smtp_mail_from(const NetClientSmtp *client, const NetClientSmtpMessage *message);
+static gboolean net_client_smtp_send_data(NetClientSmtp *client, const NetClientSmtpMessage *message, gchar **server_stat,
+										  GError **error);
+static gboolean net_client_smtp_send_bdat(NetClientSmtp *client, const NetClientSmtpMessage *message, gchar **server_stat,
+										  GError **error);
+static gboolean net_client_smtp_read_replies(NetClientSmtp *client, guint count, gchar **last_reply, GError **error);
+static gsize net_client_smtp_stuff(const gchar *buffer, gsize count, gchar *stuffed, gboolean *line_start);
 static gboolean net_client_smtp_read_reply(NetClientSmtp *client, gint expect_code, gchar **last_reply, GError **error);
 static gboolean net_client_smtp_eval_rescode(gint res_code, const gchar *reply, GError **error);
 static gchar *net_client_smtp_dsn_to_string(const NetClientSmtp *client, NetClientSmtpDsnMode dsn_mode);
@@ -199,76 +216,29 @@ net_client_smtp_can_dsn(NetClientSmtp *client)
 gboolean
 net_client_smtp_send_msg(NetClientSmtp *client, const NetClientSmtpMessage *message, gchar **server_stat, GError **error)
 {
-	NetClient *netclient;
 	gboolean result;
-	const GList *rcpt;
 
 	/* paranoia checks */
 	g_return_val_if_fail(NET_IS_CLIENT_SMTP(client) && (message != NULL) && (message->sender != NULL) &&
 		(message->recipients != NULL) && (message->data_callback != NULL), FALSE);
 
-	/* set the RFC 5321 sender and recipient(s) */
-	netclient = NET_CLIENT(client);		/* convenience pointer */
-	(void) net_client_set_timeout(netclient, 5U * 60U);	/* RFC 5321, Sect. 4.5.3.2.2., 4.5.3.2.3.: 5 minutes timeout */
-	if (client->can_dsn && message->have_dsn_rcpt) {
-		if (message->dsn_envid != NULL) {
-			result = net_client_smtp_execute(client, "MAIL FROM:<%s> RET=%s ENVID=%s", NULL, error, message->sender,
-											 (message->dsn_ret_full) ? "FULL" : "HDRS", message->dsn_envid);
-		} else {
-			result = net_client_smtp_execute(client, "MAIL FROM:<%s> RET=%s", NULL, error, message->sender,
-											 (message->dsn_ret_full) ? "FULL" : "HDRS");
-		}
-	} else {
-		result = net_client_smtp_execute(client, "MAIL FROM:<%s>", NULL, error, message->sender);
+	/* refuse messages the server announced it will not accept (RFC 1870, Sect. 6.) */
+	if (client->can_size && (client->max_size > 0U) && (message->size > client->max_size)) {
+		g_set_error(error, NET_CLIENT_SMTP_ERROR_QUARK, (gint) NET_CLIENT_ERROR_SMTP_PERMANENT,
+			_("message size %lu exceeds the server limit %lu"), (unsigned long) message->size, (unsigned long) client->max_size);
+		return FALSE;
 	}
-	rcpt = message->recipients;
-	while (result && (rcpt != NULL)) {
-		const smtp_rcpt_t *this_rcpt = (const smtp_rcpt_t *) rcpt->data;	/*lint !e9079 !e9087 (MISRA C:2012 Rules 11.3, 11.5) */
-		gchar *dsn_opts;
 
-		/* create the RFC 3461 DSN string */
-		dsn_opts = net_client_smtp_dsn_to_string(client, this_rcpt->dsn_mode);
-		result = net_client_smtp_execute(client, "RCPT TO:<%s>%s", NULL, error, this_rcpt->rfc5321_addr, dsn_opts);
-		g_free(dsn_opts);
-		rcpt = rcpt->next;
-	}
-
-	/* initialise sending the message data */
-	if (result) {
-		(void) net_client_set_timeout(netclient, 2U * 60U);	/* RFC 5321, Sect. 4.5.3.2.4.: 2 minutes timeout */
-		result = net_client_smtp_execute(client, "DATA", NULL, error);
-	}
-
-	/* call the data callback until all data has been transmitted or an error occurs */
-	if (result) {
-		gchar buffer[SMTP_DATA_BUF_SIZE];
-		gssize count;
-		gchar last_char = '\0';
-
-		(void) net_client_set_timeout(netclient, 3U * 60U);	/* RFC 5321, Sect. 4.5.3.2.5.: 3 minutes timeout */
-		client->data_state = TRUE;
-		do {
-			count = message->data_callback(buffer, SMTP_DATA_BUF_SIZE, message->user_data, error);
-			if (count < 0) {
-				result = FALSE;
-			} else if (count > 0) {
-				result = net_client_write_buffer(netclient, buffer, (gsize) count, error);
-				last_char = buffer[count - 1];
-			} else {
-				/* write termination */
-				if (last_char == '\n') {
-					result = net_client_write_buffer(netclient, ".\r\n", 3U, error);
-				} else {
-					result = net_client_write_buffer(netclient, "\r\n.\r\n", 5U, error);
-				}
-			}
-		} while (result && (count > 0));
-	}
+	/* set the RFC 5321 sender and recipient(s) */
+	result = net_client_smtp_envelope(client, message, error);
 
+	/* send the message data, in chunks if the server supports it */
 	if (result) {
-		(void) net_client_set_timeout(netclient, 10U * 60U);	/* RFC 5321, Sect 4.5.3.2.6.: 10 minutes timeout */
-		result = net_client_smtp_read_reply(client, -1, server_stat, error);
-		client->data_state = FALSE;
+		if (client->can_chunking) {
+			result = net_client_smtp_send_bdat(client, message, server_stat, error);
+		} else {
+			result = net_client_smtp_send_data(client, message, server_stat, error);
+		}
 	}
 
 	return result;
@@ -316,6 +286,17 @@ net_client_smtp_msg_set_sender(NetClientSmtpMessage *smtp_msg, const gchar *rfc5
 }
 
 
+gboolean
+net_client_smtp_msg_set_size(NetClientSmtpMessage *smtp_msg, gsize size, gboolean body_8bit)
+{
+	g_return_val_if_fail(smtp_msg != NULL, FALSE);
+
+	smtp_msg->size = size;
+	smtp_msg->body_8bit = body_8bit;
+	return TRUE;
+}
+
+
 gboolean
 net_client_smtp_msg_add_recipient(NetClientSmtpMessage *smtp_msg, const gchar *rfc5321_rcpt, NetClientSmtpDsnMode dsn_mode)
 {
@@ -552,6 +533,265 @@ net_client_smtp_auth_gssapi(NetClientSmtp G_GNUC_UNUSED *client, const gchar G_G
 #endif  /* HAVE_GSSAPI */
 
 
+/* Send MAIL FROM and RCPT TO for all recipients.  If the server supports pipelining (RFC 2920), all commands are sent at once, and
+ * the replies are collected afterwards.  On error, the transaction is reset, so the session can be used for the next message. */
+static gboolean
+net_client_smtp_envelope(NetClientSmtp *client, const NetClientSmtpMessage *message, GError **error)
+{
+	NetClient *netclient;
+	gchar *mail_from;
+	gboolean result;
+	const GList *rcpt;
+
+	netclient = NET_CLIENT(client);		/* convenience pointer */
+	(void) net_client_set_timeout(netclient, 5U * 60U);	/* RFC 5321, Sect. 4.5.3.2.2., 4.5.3.2.3.: 5 minutes timeout */
+	mail_from = net_client_smtp_mail_from(client, message);
+
+	if (client->can_pipelining) {
+		GString *commands;
+		guint replies;
+
+		commands = g_string_new(mail_from);
+		commands = g_string_append(commands, "\r\n");
+		replies = 1U;
+		for (rcpt = message->recipients; rcpt != NULL; rcpt = rcpt->next) {
+			const smtp_rcpt_t *this_rcpt = (const smtp_rcpt_t *) rcpt->data;	/*lint !e9079 !e9087 (MISRA C:2012 Rules 11.3, 11.5) */
+			gchar *dsn_opts;
+
+			dsn_opts = net_client_smtp_dsn_to_string(client, this_rcpt->dsn_mode);
+			g_string_append_printf(commands, "RCPT TO:<%s>%s\r\n", this_rcpt->rfc5321_addr, dsn_opts);
+			g_free(dsn_opts);
+			replies++;
+		}
+		result = net_client_write_buffer(netclient, commands->str, commands->len, error);
+		(void) g_string_free(commands, TRUE);
+		if (result) {
+			result = net_client_smtp_read_replies(client, replies, NULL, error);
+		}
+	} else {
+		result = net_client_smtp_execute(client, "%s", NULL, error, mail_from);
+		rcpt = message->recipients;
+		while (result && (rcpt != NULL)) {
+			const smtp_rcpt_t *this_rcpt = (const smtp_rcpt_t *) rcpt->data;	/*lint !e9079 !e9087 (MISRA C:2012 Rules 11.3, 11.5) */
+			gchar *dsn_opts;
+
+			/* create the RFC 3461 DSN string */
+			dsn_opts = net_client_smtp_dsn_to_string(client, this_rcpt->dsn_mode);
+			result = net_client_smtp_execute(client, "RCPT TO:<%s>%s", NULL, error, this_rcpt->rfc5321_addr, dsn_opts);
+			g_free(dsn_opts);
+			rcpt = rcpt->next;
+		}
+	}
+	g_free(mail_from);
+
+	return result;
+}
+
+
+static gchar *
+net_client_smtp_mail_from(const NetClientSmtp *client, const NetClientSmtpMessage *message)
+{
+	GString *mail_from;
+
+	mail_from = g_string_new(NULL);
+	g_string_printf(mail_from, "MAIL FROM:<%s>", message->sender);
+	if (client->can_size && (message->size > 0U)) {
+		g_string_append_printf(mail_from, " SIZE=%lu", (unsigned long) message->size);
+	}
+	if (client->can_8bitmime && message->body_8bit) {
+		mail_from = g_string_append(mail_from, " BODY=8BITMIME");
+	}
+	if (client->can_dsn && message->have_dsn_rcpt) {
+		g_string_append_printf(mail_from, " RET=%s", (message->dsn_ret_full) ? "FULL" : "HDRS");
+		if (message->dsn_envid != NULL) {
+			g_string_append_printf(mail_from, " ENVID=%s", message->dsn_envid);
+		}
+	}
+	return g_string_free(mail_from, FALSE);
+}
+
+
+static gboolean
+net_client_smtp_send_data(NetClientSmtp *client, const NetClientSmtpMessage *message, gchar **server_stat, GError **error)
+{
+	NetClient *netclient;
+	gboolean result;
+
+	/* initialise sending the message data */
+	netclient = NET_CLIENT(client);		/* convenience pointer */
+	(void) net_client_set_timeout(netclient, 2U * 60U);	/* RFC 5321, Sect. 4.5.3.2.4.: 2 minutes timeout */
+	result = net_client_smtp_execute(client, "DATA", NULL, error);
+
+	/* call the data callback until all data has been transmitted or an error occurs, and dot-stuff the data */
+	if (result) {
+		gchar *buffer;
+		gchar *stuffed;
+		gssize count;
+		gchar last_char = '\0';
+		gboolean line_start = TRUE;
+
+		/* stuffing at most doubles the size of the data */
+		stuffed = g_malloc(3U * SMTP_DATA_BUF_SIZE);
+		buffer = &stuffed[2U * SMTP_DATA_BUF_SIZE];
+		(void) net_client_set_timeout(netclient, 3U * 60U);	/* RFC 5321, Sect. 4.5.3.2.5.: 3 minutes timeout */
+		client->data_state = TRUE;
+		do {
+			count = message->data_callback(buffer, SMTP_DATA_BUF_SIZE, message->user_data, error);
+			if (count < 0) {
+				result = FALSE;
+			} else if (count > 0) {
+				result = net_client_write_buffer(netclient, stuffed,
+					net_client_smtp_stuff(buffer, (gsize) count, stuffed, &line_start), error);
+				last_char = buffer[count - 1];
+			} else {
+				/* write termination */
+				if (last_char == '\n') {
+					result = net_client_write_buffer(netclient, ".\r\n", 3U, error);
+				} else {
+					result = net_client_write_buffer(netclient, "\r\n.\r\n", 5U, error);
+				}
+			}
+		} while (result && (count > 0));
+		g_free(stuffed);
+	}
+
+	if (result) {
+		(void) net_client_set_timeout(netclient, 10U * 60U);	/* RFC 5321, Sect 4.5.3.2.6.: 10 minutes timeout */
+		result = net_client_smtp_read_reply(client, -1, server_stat, error);
+		client->data_state = FALSE;
+	}
+
+	return result;
+}
+
+
+/* Send the message data in BDAT chunks (RFC 3030), as the data callback delivers it.  With pipelining, the replies to all chunks are
+ * collected at the end. */
+static gboolean
+net_client_smtp_send_bdat(NetClientSmtp *client, const NetClientSmtpMessage *message, gchar **server_stat, GError **error)
+{
+	NetClient *netclient;
+	gchar *buffer;
+	gsize fill;
+	gssize count;
+	gboolean result;
+	gchar last_char;
+	guint replies;
+
+	netclient = NET_CLIENT(client);		/* convenience pointer */
+	(void) net_client_set_timeout(netclient, 3U * 60U);	/* RFC 5321, Sect. 4.5.3.2.5.: 3 minutes timeout */
+	buffer = g_malloc(SMTP_BDAT_CHUNK_SIZE);
+	fill = 0U;
+	last_char = '\0';
+	replies = 0U;
+	client->data_state = TRUE;
+	do {
+		/* keep space for the terminating CRLF */
+		count = message->data_callback(&buffer[fill], SMTP_BDAT_CHUNK_SIZE - 2U - fill, message->user_data, error);
+		if (count < 0) {
+			result = FALSE;
+		} else {
+			if (count > 0) {
+				fill += (gsize) count;
+				last_char = buffer[fill - 1U];
+			} else if (last_char != '\n') {
+				/* the message must end with CRLF */
+				buffer[fill++] = '\r';
+				buffer[fill++] = '\n';
+			} else {
+				/* nothing to do (see MISRA C:2012, Rule 15.7) */
+			}
+
+			if ((count == 0) || (fill == SMTP_BDAT_CHUNK_SIZE - 2U)) {
+				result = net_client_write_line(netclient, "BDAT %lu%s", error, (unsigned long) fill, (count == 0) ? " LAST" : "");
+				if (result && (fill > 0U)) {
+					result = net_client_write_buffer(netclient, buffer, fill, error);
+				}
+				fill = 0U;
+				replies++;
+				if (result && (count > 0) && !client->can_pipelining) {
+					result = net_client_smtp_read_replies(client, replies, NULL, error);
+					replies = 0U;
+				}
+			} else {
+				result = TRUE;
+			}
+		}
+	} while (result && (count > 0));
+	g_free(buffer);
+
+	/* collect the replies to the outstanding chunks, the last one being the final reply */
+	if (result) {
+		(void) net_client_set_timeout(netclient, 10U * 60U);	/* RFC 5321, Sect 4.5.3.2.6.: 10 minutes timeout */
+		result = net_client_smtp_read_replies(client, replies, server_stat, error);
+		client->data_state = FALSE;
+	}
+
+	return result;
+}
+
+
+/* Read the replies to count pipelined commands, even after a negative one, so we stay in sync with the server, and report the first
+ * failure.  If supplied, last_reply is filled with the text of the last reply on success.  After a negative reply, the transaction is
+ * reset, so the session can be used for the next message. */
+static gboolean
+net_client_smtp_read_replies(NetClientSmtp *client, guint count, gchar **last_reply, GError **error)
+{
+	GError *first_err = NULL;
+	gboolean result = TRUE;
+	guint n;
+
+	for (n = 1U; result && (n <= count); n++) {
+		GError *this_err = NULL;
+
+		if (!net_client_smtp_read_reply(client, -1, ((n == count) && (first_err == NULL)) ? last_reply : NULL, &this_err)) {
+			if ((this_err->domain == NET_CLIENT_SMTP_ERROR_QUARK) && (this_err->code != (gint) NET_CLIENT_ERROR_SMTP_PROTOCOL)) {
+				if (first_err == NULL) {
+					first_err = this_err;
+				} else {
+					g_error_free(this_err);
+				}
+			} else {
+				g_propagate_error(error, this_err);
+				result = FALSE;
+			}
+		}
+	}
+
+	if (first_err != NULL) {
+		if (result) {
+			client->data_state = FALSE;
+			(void) net_client_smtp_execute(client, "RSET", NULL, NULL);
+			g_propagate_error(error, first_err);
+			result = FALSE;
+		} else {
+			g_error_free(first_err);
+		}
+	}
+
+	return result;
+}
+
+
+/* Dot-stuff (RFC 5321, Sect. 4.5.2.) count bytes from buffer into stuffed, which must be able to hold twice as many, and return the
+ * new count.  The flag line_start keeps track of line starts across calls. */
+static gsize
+net_client_smtp_stuff(const gchar *buffer, gsize count, gchar *stuffed, gboolean *line_start)
+{
+	gsize src;
+	gsize dst;
+
+	for (src = 0U, dst = 0U; src < count; src++) {
+		if (*line_start && (buffer[src] == '.')) {
+			stuffed[dst++] = '.';
+		}
+		stuffed[dst++] = buffer[src];
+		*line_start = (buffer[src] == '\n');
+	}
+	return dst;
+}
+
+
 /* note: if supplied, last_reply is never NULL on success */
 static gboolean
 net_client_smtp_execute(NetClientSmtp *client, const gchar *request_fmt, gchar **last_reply, GError **error, ...)
@@ -582,6 +822,11 @@ net_client_smtp_ehlo(NetClientSmtp *client, guint *auth_supported, gboolean *can
 	/* clear all capability flags */
 	*auth_supported = 0U;
 	client->can_dsn = FALSE;
+	client->can_pipelining = FALSE;
+	client->can_chunking = FALSE;
+	client->can_8bitmime = FALSE;
+	client->can_size = FALSE;
+	client->max_size = 0U;
 	*can_starttls = FALSE;
 
 	/* evaluate the response */
@@ -602,6 +847,17 @@ net_client_smtp_ehlo(NetClientSmtp *client, guint *auth_supported, gboolean *can
 			} else {
 				if (strcmp(&endptr[1], "DSN") == 0) {
 					client->can_dsn = TRUE;
+				} else if (strcmp(&endptr[1], "PIPELINING") == 0) {
+					client->can_pipelining = TRUE;
+				} else if (strcmp(&endptr[1], "CHUNKING") == 0) {
+					client->can_chunking = TRUE;
+				} else if (strcmp(&endptr[1], "8BITMIME") == 0) {
+					client->can_8bitmime = TRUE;
+				} else if ((strcmp(&endptr[1], "SIZE") == 0) || (strncmp(&endptr[1], "SIZE ", 5U) == 0)) {
+					client->can_size = TRUE;
+					if (endptr[5] == ' ') {
+						client->max_size = g_ascii_strtoull(&endptr[6], NULL, 10);
+					}
 				} else if (strcmp(&endptr[1], "STARTTLS") == 0) {
 					*can_starttls = TRUE;
 				} else if ((strncmp(&endptr[1], "AUTH ", 5U) == 0) || (strncmp(&endptr[1], "AUTH=", 5U) == 0)) {
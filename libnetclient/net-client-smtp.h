@@ -92,6 +92,10 @@ enum _NetClientSmtpDsnMode {
  * - return value: a value > 0 indicating the number of bytes written to @em buffer, or 0 to indicate that all data has been
  *   transferred, or a value < 0 to indicate an error in the callback function.
  *
+ * The message data shall use CRLF line endings, but shall @em not be dot-stuffed (see
+ * <a href="https://tools.ietf.org/html/rfc5321">RFC 5321</a>, Sect. 4.5.2.): it is sent unmodified using BDAT if the server supports
+ * it, and stuffed by the client otherwise.
+ *
  * @note The callback function is responsible for properly formatting the message body according to
  *       <a href="https://tools.ietf.org/html/rfc5321">RFC 5321</a>, <a href="https://tools.ietf.org/html/rfc5322">RFC 5322</a> and
  *       further relevant standards, e.g. by using <a href="http://spruce.sourceforge.net/gmime/">GMime</a>.
@@ -165,7 +169,8 @@ gboolean net_client_smtp_can_dsn(NetClientSmtp *client);
  * @param error filled with error information if the connection fails
  * @return TRUE on success or FALSE if sending the message failed
  *
- * Send the passed SMTP message to the connected SMTP server.
+ * Send the passed SMTP message to the connected SMTP server.  If the server supports pipelining, the sender and all recipients are
+ * sent at once.  If the server supports chunking, the message data is sent using BDAT instead of DATA.
  */
 gboolean net_client_smtp_send_msg(NetClientSmtp *client, const NetClientSmtpMessage *message, gchar **server_stat, GError **error);
 
@@ -209,6 +214,21 @@ gboolean net_client_smtp_msg_set_sender(NetClientSmtpMessage *smtp_msg, const gc
 gboolean net_client_smtp_msg_set_dsn_opts(NetClientSmtpMessage *smtp_msg, const gchar *envid, gboolean ret_full);
 
 
+/** @brief Set the size and body type of a SMTP message
+ *
+ * @param smtp_msg SMTP message returned by net_client_smtp_msg_new()
+ * @param size estimated size of the message in bytes, 0 if unknown
+ * @param body_8bit TRUE if the message contains 8-bit MIME parts
+ * @return TRUE on success or FALSE on error
+ *
+ * If the server supports the <a href="https://tools.ietf.org/html/rfc1870">RFC 1870</a> SIZE extension, the size is declared in the
+ * "MAIL FROM" command, and the message is refused without sending it if it exceeds the maximum size announced by the server.  If
+ * the server supports the <a href="https://tools.ietf.org/html/rfc6152">RFC 6152</a> 8BITMIME extension, 8-bit messages are
+ * declared as such.
+ */
+gboolean net_client_smtp_msg_set_size(NetClientSmtpMessage *smtp_msg, gsize size, gboolean body_8bit);
+
+
 /** @brief Add a recipient to a SMTP message
  *
  * @param smtp_msg SMTP message returned by net_client_smtp_msg_new()
@@ -245,6 +265,10 @@ void net_client_smtp_msg_free(NetClientSmtpMessage *smtp_msg);
  *   - GSSAPI according to <a href="https://tools.ietf.org/html/rfc4752">RFC 4752</a> (if configured with gssapi support)
  * - STARTTLS encryption according to <a href="https://tools.ietf.org/html/rfc3207">RFC 3207</a>
  * - Delivery Status Notifications (DSNs) according to <a href="https://tools.ietf.org/html/rfc3461">RFC 3461</a>
+ * - Command pipelining according to <a href="https://tools.ietf.org/html/rfc2920">RFC 2920</a>
+ * - Message transmission in chunks (BDAT) according to <a href="https://tools.ietf.org/html/rfc3030">RFC 3030</a>
+ * - 8-bit MIME transport according to <a href="https://tools.ietf.org/html/rfc6152">RFC 6152</a>
+ * - Message size declaration according to <a href="https://tools.ietf.org/html/rfc1870">RFC 1870</a>
  */
 
 
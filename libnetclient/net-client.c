@@ -298,6 +298,36 @@ net_client_read_line(NetClient *client, gchar **recv_line, GError **error)
 }
 
 
+gboolean
+net_client_read_buffer(NetClient *client, gchar *buffer, gsize count, gsize *bytes_read, GError **error)
+{
+	/*lint -e{9079}		(MISRA C:2012 Rule 11.5) intended use of this function */
+	const NetClientPrivate *priv = net_client_get_instance_private(client);
+	gboolean result = FALSE;
+
+	g_return_val_if_fail(NET_IS_CLIENT(client) && (buffer != NULL) && (count > 0U) && (bytes_read != NULL), FALSE);
+
+	if (priv->istream == NULL) {
+		g_set_error(error, NET_CLIENT_ERROR_QUARK, (gint) NET_CLIENT_ERROR_NOT_CONNECTED, _("network client is not connected"));
+	} else {
+		gssize length;
+
+		length = g_input_stream_read(G_INPUT_STREAM(priv->istream), buffer, count, NULL, error);
+		if (length > 0) {
+			g_debug("R '%.*s'", (int) length, buffer);
+			*bytes_read = (gsize) length;
+			result = TRUE;
+		} else if (length == 0) {
+			g_set_error(error, NET_CLIENT_ERROR_QUARK, (gint) NET_CLIENT_ERROR_CONNECTION_LOST, _("connection lost"));
+		} else {
+			/* error has been filled by g_input_stream_read() */
+		}
+	}
+
+	return result;
+}
+
+
 gboolean
 net_client_write_buffer(NetClient *client, const gchar *buffer, gsize count, GError **error)
 {
@@ -535,6 +565,10 @@ net_client_start_tls(NetClient *client, GError **error)
 		g_set_error(error, NET_CLIENT_ERROR_QUARK, (gint) NET_CLIENT_ERROR_NOT_CONNECTED, _("not connected"));
 	} else if (priv->tls_conn != NULL) {
 		g_set_error(error, NET_CLIENT_ERROR_QUARK, (gint) NET_CLIENT_ERROR_TLS_ACTIVE, _("connection is already encrypted"));
+	} else if (g_buffered_input_stream_get_available(G_BUFFERED_INPUT_STREAM(priv->istream)) > 0U) {
+		/* data received in plain text must not be taken as part of the encrypted session */
+		g_set_error(error, NET_CLIENT_ERROR_QUARK, (gint) NET_CLIENT_ERROR_DATA_PENDING,
+			_("unexpected data received before starting TLS"));
 	} else {
 		priv->tls_conn = g_tls_client_connection_new(G_IO_STREAM(priv->plain_conn), priv->remote_address, error);
 		if (priv->tls_conn != NULL) {
@@ -574,6 +608,9 @@ net_client_start_compression(NetClient *client, GError **error)
 		g_set_error(error, NET_CLIENT_ERROR_QUARK, (gint) NET_CLIENT_ERROR_NOT_CONNECTED, _("not connected"));
 	} else if (priv->comp != NULL) {
 		g_set_error(error, NET_CLIENT_ERROR_QUARK, (gint) NET_CLIENT_ERROR_COMP_ACTIVE, _("connection is already compressed"));
+	} else if (g_buffered_input_stream_get_available(G_BUFFERED_INPUT_STREAM(priv->istream)) > 0U) {
+		g_set_error(error, NET_CLIENT_ERROR_QUARK, (gint) NET_CLIENT_ERROR_DATA_PENDING,
+			_("unexpected data received before starting compression"));
 	} else {
 		priv->comp = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW, -1);
 		priv->decomp = g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW);
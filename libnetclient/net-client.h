@@ -59,7 +59,8 @@ enum _NetClientError {
 	NET_CLIENT_ERROR_LINE_TOO_LONG,			/**< The line is too long. */
 	NET_CLIENT_ERROR_GNUTLS,				/**< A GnuTLS error occurred (bad certificate or key data, or internal error). */
 	NET_CLIENT_ERROR_CERT_KEY_PASS,			/**< GnuTLS could not decrypt the user certificate's private key. */
-	NET_CLIENT_ERROR_GSSAPI					/**< A GSSAPI error occurred. */
+	NET_CLIENT_ERROR_GSSAPI,				/**< A GSSAPI error occurred. */
+	NET_CLIENT_ERROR_DATA_PENDING			/**< Data has been received before starting TLS or compression. */
 };
 
 
@@ -176,6 +177,7 @@ gboolean net_client_set_cert_from_file(NetClient *client, const gchar *pem_path,
  * @return TRUE if the connection is now TLS encrypted, FALSE on error
  *
  * Try to negotiate TLS encryption.  If the remote server presents an untrusted certificate, the signal @ref cert-check is emitted.
+ * The function fails with @ref NET_CLIENT_ERROR_DATA_PENDING if data has been received, but not read yet.
  */
 gboolean net_client_start_tls(NetClient *client, GError **error);
 
@@ -186,7 +188,8 @@ gboolean net_client_start_tls(NetClient *client, GError **error);
  * @param error filled with error information on error
  * @return TRUE if the connection is now compressed, FALSE on error
  *
- * Enable deflate compression of the connection, as defined by e. g. RFC 4978 <em>The IMAP COMPRESS Extension</em>.
+ * Enable deflate compression of the connection, as defined by e. g. RFC 4978 <em>The IMAP COMPRESS Extension</em>.  The function
+ * fails with @ref NET_CLIENT_ERROR_DATA_PENDING if data has been received, but not read yet.
  */
 gboolean net_client_start_compression(NetClient *client, GError **error);
 
@@ -206,6 +209,22 @@ gboolean net_client_start_compression(NetClient *client, GError **error);
 gboolean net_client_read_line(NetClient *client, gchar **recv_line, GError **error);
 
 
+/** @brief Read a block of data from a network client
+ *
+ * @param client network client
+ * @param buffer destination buffer
+ * @param count size of the destination buffer
+ * @param bytes_read filled with the number of bytes read on success
+ * @param error filled with error information on error
+ * @return TRUE is the read operation was successful, FALSE on error
+ *
+ * Read whatever data up to the passed count is available from the remote server, waiting only until at least one byte has
+ * arrived.  The data is passed on unchanged, i. e. it is neither split into lines nor NUL-terminated.  If the remote server closed
+ * the connection, the function returns FALSE.
+ */
+gboolean net_client_read_buffer(NetClient *client, gchar *buffer, gsize count, gsize *bytes_read, GError **error);
+
+
 /** @brief Write data to a network client
  *
  * @param client network client
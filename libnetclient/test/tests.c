@@ -30,8 +30,11 @@
 static void test_basic(void);
 static void test_basic_crypt(void);
 static void test_smtp(void);
+static void test_smtp_extensions(void);
 static void test_pop3(void);
 static void test_siobuf(void);
+static void test_siobuf_throughput(void);
+static void test_data_pending(void);
 static void test_utils(void);
 
 
@@ -57,12 +60,17 @@ main(G_GNUC_UNUSED int argc, G_GNUC_UNUSED char **argv)
 
 	sput_enter_suite("test SMTP");
 	sput_run_test(test_smtp);
+	sput_run_test(test_smtp_extensions);
 
 	sput_enter_suite("test POP3");
 	sput_run_test(test_pop3);
 
 	sput_enter_suite("test SIOBUF (libbalsa/imap compatibility layer)");
 	sput_run_test(test_siobuf);
+	sput_run_test(test_siobuf_throughput);
+
+	sput_enter_suite("test data received before starting TLS or compression");
+	sput_run_test(test_data_pending);
 
 	sput_enter_suite("test utility functions");
 	sput_run_test(test_utils);
@@ -424,6 +432,8 @@ test_smtp(void)
 
 	sput_fail_unless(net_client_smtp_msg_set_dsn_opts(NULL, NULL, FALSE) == FALSE, "set dsn opts, no message");
 	sput_fail_unless(net_client_smtp_msg_set_dsn_opts(msg, NULL, FALSE) == TRUE, "set dsn opts ok");
+	sput_fail_unless(net_client_smtp_msg_set_size(NULL, 0U, FALSE) == FALSE, "set size, no message");
+	sput_fail_unless(net_client_smtp_msg_set_size(msg, strlen(MSG_TEXT), FALSE) == TRUE, "set size ok");
 
 
 	// smtp stuff - test various failures
@@ -566,6 +576,342 @@ test_smtp(void)
 	net_client_smtp_msg_free(msg);
 }
 
+/* Stand-in SMTP server for the extension tests, serving one session: it announces the extensions in caps, and records the commands
+ * and the message data it receives, the dot-stuffing of DATA undone.  With PIPELINING, it does not reply to MAIL FROM before it has
+ * received the RCPT TO commands for all rcpts recipients, nor to a BDAT chunk before it has received the last one, so a client which
+ * waits for each reply runs into the timeout of the server. */
+typedef struct {
+	GSocketListener *listener;
+	const gchar * const *caps;
+	guint rcpts;
+	GString *commands;				/* command lines, each terminated by '\n' */
+	GString *data;
+} smtp_stand_in_t;
+
+
+static gboolean
+smtp_stand_in_reply(GOutputStream *ostream, const gchar *reply, guint count)
+{
+	gboolean result = TRUE;
+
+	for (; result && (count > 0U); count--) {
+		result = g_output_stream_write_all(ostream, reply, strlen(reply), NULL, NULL, NULL);
+	}
+	return result;
+}
+
+static gchar *
+smtp_stand_in_command(GDataInputStream *istream, smtp_stand_in_t *stand_in)
+{
+	gchar *line;
+
+	line = g_data_input_stream_read_line(istream, NULL, NULL, NULL);
+	if (line != NULL) {
+		g_string_append_printf(stand_in->commands, "%s\n", line);
+	}
+	return line;
+}
+
+static gboolean
+smtp_stand_in_data(GDataInputStream *istream, GOutputStream *ostream, smtp_stand_in_t *stand_in)
+{
+	gboolean ok;
+	gboolean done = FALSE;
+
+	ok = smtp_stand_in_reply(ostream, "354 go ahead\r\n", 1U);
+	while (ok && !done) {
+		gchar *line;
+
+		line = g_data_input_stream_read_line(istream, NULL, NULL, NULL);
+		if (line == NULL) {
+			ok = FALSE;
+		} else if (strcmp(line, ".") == 0) {
+			done = TRUE;
+		} else {
+			g_string_append_printf(stand_in->data, "%s\r\n", (line[0] == '.') ? &line[1] : line);
+		}
+		g_free(line);
+	}
+	return ok && smtp_stand_in_reply(ostream, "250 queued\r\n", 1U);
+}
+
+/* receive the chunk announced by cmd, and the following ones up to the last */
+static gboolean
+smtp_stand_in_bdat(GDataInputStream *istream, GOutputStream *ostream, const gchar *cmd, gboolean pipelining,
+	smtp_stand_in_t *stand_in)
+{
+	gchar *next = NULL;
+	guint replies = 0U;
+	gboolean last;
+	gboolean ok;
+
+	do {
+		gchar *endptr;
+		gchar *buffer;
+		gsize size;
+		gsize bytes_read;
+
+		size = strtoul(&cmd[5], &endptr, 10);
+		last = (strcmp(endptr, " LAST") == 0);
+		buffer = g_malloc(size + 1U);
+		ok = g_input_stream_read_all(G_INPUT_STREAM(istream), buffer, size, &bytes_read, NULL, NULL) && (bytes_read == size);
+		if (ok) {
+			g_string_append_len(stand_in->data, buffer, size);
+		}
+		g_free(buffer);
+		replies++;
+		if (ok && (!pipelining || last)) {
+			ok = smtp_stand_in_reply(ostream, "250 OK\r\n", replies);
+			replies = 0U;
+		}
+		if (ok && !last) {
+			g_free(next);
+			next = smtp_stand_in_command(istream, stand_in);
+			ok = (next != NULL) && (strncmp(next, "BDAT ", 5U) == 0);
+			cmd = next;
+		}
+	} while (ok && !last);
+	g_free(next);
+
+	return ok;
+}
+
+static gpointer
+smtp_stand_in_server(gpointer data)
+{
+	smtp_stand_in_t *stand_in = (smtp_stand_in_t *) data;
+	GSocketConnection *conn;
+
+	conn = g_socket_listener_accept(stand_in->listener, NULL, NULL, NULL);
+	if (conn != NULL) {
+		GDataInputStream *istream;
+		GOutputStream *ostream;
+		gboolean pipelining = FALSE;
+		gboolean done = FALSE;
+		gboolean ok;
+		guint n;
+
+		g_socket_set_timeout(g_socket_connection_get_socket(conn), 5U);
+		istream = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(conn)));
+		g_data_input_stream_set_newline_type(istream, G_DATA_STREAM_NEWLINE_TYPE_CR_LF);
+		ostream = g_io_stream_get_output_stream(G_IO_STREAM(conn));
+		for (n = 0U; stand_in->caps[n] != NULL; n++) {
+			pipelining = pipelining || (strcmp(stand_in->caps[n], "PIPELINING") == 0);
+		}
+
+		ok = smtp_stand_in_reply(ostream, "220 localhost ready\r\n", 1U);
+		while (ok && !done) {
+			gchar *line;
+
+			line = smtp_stand_in_command(istream, stand_in);
+			if (line == NULL) {
+				ok = FALSE;
+			} else if (strncmp(line, "EHLO ", 5U) == 0) {
+				ok = smtp_stand_in_reply(ostream, "250-localhost\r\n", 1U);
+				for (n = 0U; ok && (stand_in->caps[n] != NULL); n++) {
+					gchar *reply = g_strdup_printf("250-%s\r\n", stand_in->caps[n]);
+
+					ok = smtp_stand_in_reply(ostream, reply, 1U);
+					g_free(reply);
+				}
+				ok = ok && smtp_stand_in_reply(ostream, "250 HELP\r\n", 1U);
+			} else if (strncmp(line, "MAIL FROM:", 10U) == 0) {
+				guint replies = 1U;
+
+				if (pipelining) {
+					for (; ok && (replies <= stand_in->rcpts); replies++) {
+						gchar *rcpt = smtp_stand_in_command(istream, stand_in);
+
+						ok = (rcpt != NULL);
+						g_free(rcpt);
+					}
+				}
+				ok = ok && smtp_stand_in_reply(ostream, "250 OK\r\n", replies);
+			} else if (strcmp(line, "DATA") == 0) {
+				ok = smtp_stand_in_data(istream, ostream, stand_in);
+			} else if (strncmp(line, "BDAT ", 5U) == 0) {
+				ok = smtp_stand_in_bdat(istream, ostream, line, pipelining, stand_in);
+			} else if (strcmp(line, "QUIT") == 0) {
+				(void) smtp_stand_in_reply(ostream, "221 bye\r\n", 1U);
+				done = TRUE;
+			} else {
+				ok = smtp_stand_in_reply(ostream, "250 OK\r\n", 1U);
+			}
+			g_free(line);
+		}
+
+		g_object_unref(istream);
+		(void) g_io_stream_close(G_IO_STREAM(conn), NULL, NULL);
+		g_object_unref(conn);
+	}
+
+	return NULL;
+}
+
+/* Send msg_text to the stand-in server announcing caps, with rcpts recipients, and the passed size and body type.  The commands
+ * and the data received are left in stand_in. */
+static gboolean
+smtp_stand_in_send(smtp_stand_in_t *stand_in, const gchar * const *caps, guint rcpts, const gchar *msg_text, gsize size,
+	gboolean body_8bit, GError **error)
+{
+	GThread *server;
+	guint16 port;
+	msg_data_t msg_buf;
+	NetClientSmtp *smtp;
+	NetClientSmtpMessage *msg;
+	gboolean result;
+	guint n;
+
+	stand_in->caps = caps;
+	stand_in->rcpts = rcpts;
+	stand_in->commands = g_string_new(NULL);
+	stand_in->data = g_string_new(NULL);
+	stand_in->listener = g_socket_listener_new();
+	port = g_socket_listener_add_any_inet_port(stand_in->listener, NULL, NULL);
+	server = g_thread_new("smtp", smtp_stand_in_server, stand_in);
+
+	msg_buf.msg_text = msg_buf.read_ptr = (gchar *) msg_text;
+	msg_buf.sim_error = FALSE;
+	msg = net_client_smtp_msg_new(msg_data_cb, &msg_buf);
+	(void) net_client_smtp_msg_set_sender(msg, "me@here.com");
+	for (n = 1U; n <= rcpts; n++) {
+		gchar *rcpt = g_strdup_printf("you%u@there.com", n);
+
+		(void) net_client_smtp_msg_add_recipient(msg, rcpt, NET_CLIENT_SMTP_DSN_NEVER);
+		g_free(rcpt);
+	}
+	(void) net_client_smtp_msg_set_size(msg, size, body_8bit);
+
+	smtp = net_client_smtp_new("127.0.0.1", port, NET_CLIENT_CRYPT_NONE);
+	result = net_client_smtp_connect(smtp, NULL, error) && net_client_smtp_send_msg(smtp, msg, NULL, error);
+	g_object_unref(smtp);
+	net_client_smtp_msg_free(msg);
+
+	g_thread_join(server);
+	g_object_unref(stand_in->listener);
+	return result;
+}
+
+static void
+smtp_stand_in_clear(smtp_stand_in_t *stand_in)
+{
+	(void) g_string_free(stand_in->commands, TRUE);
+	(void) g_string_free(stand_in->data, TRUE);
+}
+
+/* Check the BDAT commands received: all but the last one without LAST, and chunk sizes adding up to length */
+static gboolean
+smtp_bdat_framing_ok(const gchar *commands, gsize length, guint *chunks)
+{
+	gchar **lines;
+	gsize total = 0U;
+	gboolean last = FALSE;
+	gboolean result = TRUE;
+	guint n;
+
+	*chunks = 0U;
+	lines = g_strsplit(commands, "\n", -1);
+	for (n = 0U; result && (lines[n] != NULL); n++) {
+		if (strncmp(lines[n], "BDAT ", 5U) == 0) {
+			gchar *endptr;
+
+			result = !last;
+			total += strtoul(&lines[n][5], &endptr, 10);
+			last = (strcmp(endptr, " LAST") == 0);
+			result = result && (last || (*endptr == '\0'));
+			(*chunks)++;
+		}
+	}
+	g_strfreev(lines);
+
+	return result && last && (total == length);
+}
+
+
+#define DOT_MSG_TEXT									\
+	MSG_TEXT											\
+	".A line starting with a dot\r\n"					\
+	"..and one with two\r\n"							\
+	".\r\n"												\
+	"That was a line with a single dot.\r\n"
+
+static void
+test_smtp_extensions(void)
+{
+	static const gchar * const caps_pipelining[] = { "PIPELINING", NULL };
+	static const gchar * const caps_chunking[] = { "CHUNKING", NULL };
+	static const gchar * const caps_pipelining_chunking[] = { "PIPELINING", "CHUNKING", NULL };
+	static const gchar * const caps_size_8bit[] = { "SIZE 1000", "8BITMIME", NULL };
+	static const gchar * const caps_none[] = { NULL };
+	smtp_stand_in_t stand_in;
+	GError *error = NULL;
+	GString *big_msg;
+	gchar *expect;
+	gboolean op_res;
+	guint chunks;
+	guint n;
+
+	// PIPELINING: the envelope in one batch, DATA dot-stuffed by the client
+	op_res = smtp_stand_in_send(&stand_in, caps_pipelining, 3U, DOT_MSG_TEXT, 0U, FALSE, NULL);
+	sput_fail_unless(op_res == TRUE, "pipelining: send msg ok");
+	sput_fail_unless(strstr(stand_in.commands->str,
+		"MAIL FROM:<me@here.com>\nRCPT TO:<you1@there.com>\nRCPT TO:<you2@there.com>\nRCPT TO:<you3@there.com>\nDATA\n") != NULL,
+		"pipelining: envelope ok");
+	sput_fail_unless(strcmp(stand_in.data->str, DOT_MSG_TEXT) == 0, "pipelining: data ok");
+	smtp_stand_in_clear(&stand_in);
+
+	// CHUNKING: the data in a single BDAT LAST chunk, not dot-stuffed
+	op_res = smtp_stand_in_send(&stand_in, caps_chunking, 1U, DOT_MSG_TEXT, 0U, FALSE, NULL);
+	sput_fail_unless(op_res == TRUE, "chunking: send msg ok");
+	expect = g_strdup_printf("BDAT %lu LAST\n", (unsigned long) strlen(DOT_MSG_TEXT));
+	sput_fail_unless(strstr(stand_in.commands->str, expect) != NULL, "chunking: single BDAT LAST");
+	g_free(expect);
+	sput_fail_unless(strstr(stand_in.commands->str, "DATA") == NULL, "chunking: no DATA");
+	sput_fail_unless(strcmp(stand_in.data->str, DOT_MSG_TEXT) == 0, "chunking: data not dot-stuffed");
+	smtp_stand_in_clear(&stand_in);
+
+	// PIPELINING and CHUNKING: a large message in several pipelined chunks
+	big_msg = g_string_new(MSG_TEXT);
+	for (n = 0U; big_msg->len < 5U * 512U * 1024U; n++) {
+		if ((n % 10U) == 0U) {
+			g_string_append_printf(big_msg, ".dotted line %u\r\n", n);
+		} else {
+			g_string_append_printf(big_msg, "Line %u of the body of a large message\r\n", n);
+		}
+	}
+	op_res = smtp_stand_in_send(&stand_in, caps_pipelining_chunking, 2U, big_msg->str, big_msg->len, FALSE, NULL);
+	sput_fail_unless(op_res == TRUE, "pipelined chunks: send msg ok");
+	sput_fail_unless(smtp_bdat_framing_ok(stand_in.commands->str, big_msg->len, &chunks) && (chunks >= 3U),
+		"pipelined chunks: BDAT framing ok");
+	sput_fail_unless((stand_in.data->len == big_msg->len) && (memcmp(stand_in.data->str, big_msg->str, big_msg->len) == 0),
+		"pipelined chunks: data ok");
+	smtp_stand_in_clear(&stand_in);
+	(void) g_string_free(big_msg, TRUE);
+
+	// SIZE and 8BITMIME: declared in MAIL FROM
+	op_res = smtp_stand_in_send(&stand_in, caps_size_8bit, 1U, MSG_TEXT, strlen(MSG_TEXT), TRUE, NULL);
+	sput_fail_unless(op_res == TRUE, "size, 8bitmime: send msg ok");
+	expect = g_strdup_printf("MAIL FROM:<me@here.com> SIZE=%lu BODY=8BITMIME\n", (unsigned long) strlen(MSG_TEXT));
+	sput_fail_unless(strstr(stand_in.commands->str, expect) != NULL, "size, 8bitmime: declared");
+	g_free(expect);
+	smtp_stand_in_clear(&stand_in);
+
+	// SIZE: a message exceeding the limit is refused before it is sent
+	op_res = smtp_stand_in_send(&stand_in, caps_size_8bit, 1U, MSG_TEXT, 2000U, FALSE, &error);
+	sput_fail_unless((op_res == FALSE) && (error != NULL) && (error->code == NET_CLIENT_ERROR_SMTP_PERMANENT),
+		"size: too large, refused");
+	sput_fail_unless(strstr(stand_in.commands->str, "MAIL FROM") == NULL, "size: nothing sent");
+	g_clear_error(&error);
+	smtp_stand_in_clear(&stand_in);
+
+	// no extensions: neither declared
+	op_res = smtp_stand_in_send(&stand_in, caps_none, 1U, MSG_TEXT, strlen(MSG_TEXT), TRUE, NULL);
+	sput_fail_unless(op_res == TRUE, "no extensions: send msg ok");
+	sput_fail_unless(strstr(stand_in.commands->str, "MAIL FROM:<me@here.com>\nRCPT TO:<you1@there.com>\nDATA\n") != NULL,
+		"no extensions: nothing declared");
+	smtp_stand_in_clear(&stand_in);
+}
+
 static gboolean
 msg_cb(const gchar *buffer, gssize count, gsize lines, const NetClientPopMessageInfo *info, gpointer user_data, GError **error)
 {
@@ -862,6 +1208,8 @@ test_siobuf(void)
 	recv_data = net_client_siobuf_get_line(siobuf, NULL);
 	sput_fail_unless(strcmp(recv_data, "bcd") == 0, "get line #1 ok");
 	g_free(recv_data);
+	sput_fail_unless(net_client_siobuf_can_read(NULL) == FALSE, "can read w/o client");
+	sput_fail_unless(net_client_siobuf_can_read(siobuf) == TRUE, "buffered data ready");
 	recv_data = net_client_siobuf_get_line(siobuf, NULL);
 	sput_fail_unless(strcmp(recv_data, "1234") == 0, "get line #2 ok");
 	g_free(recv_data);
@@ -876,9 +1224,257 @@ test_siobuf(void)
 	sput_fail_unless(net_client_siobuf_discard_line(siobuf, NULL) == -1, "discard line w/o data");
 	sput_fail_unless(net_client_siobuf_get_line(siobuf, NULL) == NULL, "get line w/o data");
 
+	sput_fail_unless(net_client_write_buffer(NET_CLIENT(siobuf), "x\0\377\r\n", 5U, NULL) == TRUE, "write 8-bit data");
+	sput_fail_unless(net_client_siobuf_getc(siobuf, NULL) == 'x', "getc ok");
+	sput_fail_unless(net_client_siobuf_getc(siobuf, NULL) == 0, "getc NUL ok");
+	sput_fail_unless(net_client_siobuf_getc(siobuf, NULL) == 0xff, "getc 8-bit ok");
+	sput_fail_unless(net_client_siobuf_discard_line(siobuf, NULL) == '\n', "discard line ok");
+
 	g_object_unref(siobuf);
 }
 
+/* Stand-in server for the SIOBUF throughput test: it sends THROUGHPUT_MSGS IMAP FETCH responses, each with a literal of random
+ * data of up to THROUGHPUT_LIT_MAX bytes, including NUL characters and bare CR and LF, on the connection it accepts. */
+#define THROUGHPUT_MSGS					2000U
+#define THROUGHPUT_LIT_MAX				65536U
+#define THROUGHPUT_SEED					4711U
+
+static void
+throughput_literal(GRand *rand, GByteArray *literal)
+{
+	guint n;
+
+	g_byte_array_set_size(literal, g_rand_int_range(rand, 1, THROUGHPUT_LIT_MAX + 1));
+	for (n = 0U; n < literal->len; n++) {
+		literal->data[n] = (guint8) g_rand_int_range(rand, 0, 256);
+	}
+}
+
+static gpointer
+throughput_server(gpointer data)
+{
+	GSocketListener *listener = G_SOCKET_LISTENER(data);
+	GSocketConnection *conn;
+
+	conn = g_socket_listener_accept(listener, NULL, NULL, NULL);
+	if (conn != NULL) {
+		GOutputStream *ostream = g_io_stream_get_output_stream(G_IO_STREAM(conn));
+		GRand *rand = g_rand_new_with_seed(THROUGHPUT_SEED);
+		GByteArray *literal = g_byte_array_new();
+		guint n;
+		gboolean ok = TRUE;
+
+		for (n = 1U; ok && (n <= THROUGHPUT_MSGS); n++) {
+			gchar *head;
+
+			throughput_literal(rand, literal);
+			head = g_strdup_printf("* %u FETCH (BODY[] {%u}\r\n", n, literal->len);
+			ok = g_output_stream_write_all(ostream, head, strlen(head), NULL, NULL, NULL) &&
+				g_output_stream_write_all(ostream, literal->data, literal->len, NULL, NULL, NULL) &&
+				g_output_stream_write_all(ostream, ")\r\n", 3U, NULL, NULL, NULL);
+			g_free(head);
+		}
+		(void) g_output_stream_write_all(ostream, "A001 OK done\r\n", 14U, NULL, NULL, NULL);
+		g_byte_array_unref(literal);
+		g_rand_free(rand);
+		(void) g_io_stream_close(G_IO_STREAM(conn), NULL, NULL);
+		g_object_unref(conn);
+	}
+
+	return NULL;
+}
+
+static gboolean
+throughput_sink(const gchar *data, gsize count, gpointer user_data, GError G_GNUC_UNUSED **error)
+{
+	(void) g_byte_array_append((GByteArray *) user_data, (const guint8 *) data, count);
+	return TRUE;
+}
+
+static void
+test_siobuf_throughput(void)
+{
+	GSocketListener *listener;
+	GThread *server;
+	guint16 port;
+	NetClientSioBuf *siobuf;
+	GRand *rand;
+	GByteArray *expected;
+	GByteArray *received;
+	gchar line[64];
+	gchar *recv_data;
+	guint64 total = 0U;
+	gint64 start;
+	gdouble seconds;
+	guint n;
+	gboolean lines_ok = TRUE;
+	gboolean data_ok = TRUE;
+
+	listener = g_socket_listener_new();
+	port = g_socket_listener_add_any_inet_port(listener, NULL, NULL);
+	sput_fail_unless(port != 0U, "listen on local port");
+	server = g_thread_new("throughput", throughput_server, listener);
+
+	siobuf = net_client_siobuf_new("127.0.0.1", port);
+	sput_fail_unless(net_client_connect(NET_CLIENT(siobuf), NULL) == TRUE, "connect to local server");
+
+	rand = g_rand_new_with_seed(THROUGHPUT_SEED);
+	expected = g_byte_array_new();
+	received = g_byte_array_sized_new(THROUGHPUT_LIT_MAX);
+	start = g_get_monotonic_time();
+	for (n = 1U; lines_ok && data_ok && (n <= THROUGHPUT_MSGS); n++) {
+		gchar *head;
+
+		throughput_literal(rand, expected);
+		head = g_strdup_printf("* %u FETCH (BODY[] {%u}\r\n", n, expected->len);
+		lines_ok = (net_client_siobuf_gets(siobuf, line, sizeof(line), NULL) == line) && (strcmp(line, head) == 0);
+		g_free(head);
+
+		/* odd messages through the sink, even ones through read, after reading the first bytes one by one */
+		g_byte_array_set_size(received, 0U);
+		if ((n & 1U) != 0U) {
+			data_ok = net_client_siobuf_read_sink(siobuf, expected->len, throughput_sink, received, NULL);
+		} else {
+			guint first = MIN(expected->len, 4U);
+			guint k;
+
+			for (k = 0U; data_ok && (k < first); k++) {
+				guint8 c = (guint8) net_client_siobuf_getc(siobuf, NULL);
+
+				data_ok = (net_client_siobuf_getc(siobuf, NULL) >= 0) && (net_client_siobuf_ungetc(siobuf) == 0);
+				g_byte_array_append(received, &c, 1U);
+			}
+			if (data_ok && (expected->len > first)) {
+				g_byte_array_set_size(received, expected->len);
+				data_ok = net_client_siobuf_read(siobuf, &received->data[first], expected->len - first, NULL) ==
+					(gint) (expected->len - first);
+			}
+		}
+		data_ok = data_ok && (received->len == expected->len) && (memcmp(received->data, expected->data, expected->len) == 0);
+		recv_data = net_client_siobuf_get_line(siobuf, NULL);
+		lines_ok = lines_ok && (recv_data != NULL) && (strcmp(recv_data, ")") == 0);
+		g_free(recv_data);
+		total += expected->len;
+	}
+	seconds = (gdouble) (g_get_monotonic_time() - start) / 1e6;
+	sput_fail_unless(lines_ok, "response lines ok");
+	sput_fail_unless(data_ok, "literals ok, including NUL, CR and LF");
+
+	recv_data = net_client_siobuf_get_line(siobuf, NULL);
+	sput_fail_unless((recv_data != NULL) && (strcmp(recv_data, "A001 OK done") == 0), "tagged response ok");
+	g_free(recv_data);
+	sput_fail_unless(net_client_siobuf_getc(siobuf, NULL) == -1, "connection closed by the server");
+
+	g_print("\nSIOBUF throughput: %" G_GUINT64_FORMAT " bytes in %u literals, %.3f s, %.1f MB/s\n", total, THROUGHPUT_MSGS,
+		seconds, (seconds > 0.0) ? ((gdouble) total / seconds / 1e6) : 0.0);
+
+	g_byte_array_unref(received);
+	g_byte_array_unref(expected);
+	g_rand_free(rand);
+	g_object_unref(siobuf);
+	g_thread_join(server);
+	g_object_unref(listener);
+}
+
+
+/* Stand-in server for the pending data test: on each of the DATA_PENDING_CONNS connections it accepts, it sends the response to
+ * a STARTTLS or COMPRESS command and an injected line in one block, as in CVE-2020-14954, and waits until the client closes the
+ * connection. */
+#define DATA_PENDING_CONNS				4U
+#define DATA_PENDING_RESPONSE			"A001 OK begin now\r\n* injected\r\n"
+
+static gpointer
+data_pending_server(gpointer data)
+{
+	GSocketListener *listener = G_SOCKET_LISTENER(data);
+	guint n;
+
+	for (n = 0U; n < DATA_PENDING_CONNS; n++) {
+		GSocketConnection *conn;
+
+		conn = g_socket_listener_accept(listener, NULL, NULL, NULL);
+		if (conn != NULL) {
+			gchar buffer[64];
+
+			if (g_output_stream_write_all(g_io_stream_get_output_stream(G_IO_STREAM(conn)), DATA_PENDING_RESPONSE,
+				strlen(DATA_PENDING_RESPONSE), NULL, NULL, NULL)) {
+				while (g_input_stream_read(g_io_stream_get_input_stream(G_IO_STREAM(conn)), buffer, sizeof(buffer), NULL,
+					NULL) > 0) {
+					/* wait for the client */
+				}
+			}
+			(void) g_io_stream_close(G_IO_STREAM(conn), NULL, NULL);
+			g_object_unref(conn);
+		}
+	}
+
+	return NULL;
+}
+
+static void
+test_data_pending(void)
+{
+	GSocketListener *listener;
+	GThread *server;
+	guint16 port;
+	guint n;
+
+	listener = g_socket_listener_new();
+	port = g_socket_listener_add_any_inet_port(listener, NULL, NULL);
+	sput_fail_unless(port != 0U, "listen on local port");
+	server = g_thread_new("data pending", data_pending_server, listener);
+
+	/* SIOBUF: TLS and compression */
+	for (n = 0U; n < 2U; n++) {
+		NetClientSioBuf *siobuf;
+		gchar *recv_data;
+		GError *error = NULL;
+		gboolean op_res;
+
+		siobuf = net_client_siobuf_new("127.0.0.1", port);
+		sput_fail_unless(net_client_connect(NET_CLIENT(siobuf), NULL) == TRUE, "SIOBUF: connect to local server");
+		recv_data = net_client_siobuf_get_line(siobuf, NULL);
+		sput_fail_unless((recv_data != NULL) && (strcmp(recv_data, "A001 OK begin now") == 0), "SIOBUF: response ok");
+		g_free(recv_data);
+		if (n == 0U) {
+			op_res = net_client_siobuf_start_tls(siobuf, &error);
+		} else {
+			op_res = net_client_siobuf_start_compression(siobuf, &error);
+		}
+		sput_fail_unless((op_res == FALSE) && g_error_matches(error, NET_CLIENT_ERROR_QUARK, NET_CLIENT_ERROR_DATA_PENDING),
+			(n == 0U) ? "SIOBUF: start TLS fails, data pending" : "SIOBUF: start compression fails, data pending");
+		g_clear_error(&error);
+		g_object_unref(siobuf);
+	}
+
+	/* line-based client: TLS and compression */
+	for (n = 0U; n < 2U; n++) {
+		NetClient *basic;
+		gchar *recv_data = NULL;
+		GError *error = NULL;
+		gboolean op_res;
+
+		basic = net_client_new("127.0.0.1", port, 1024U);
+		sput_fail_unless(net_client_connect(basic, NULL) == TRUE, "basic: connect to local server");
+		op_res = net_client_read_line(basic, &recv_data, NULL);
+		sput_fail_unless(op_res && (strcmp(recv_data, "A001 OK begin now") == 0), "basic: response ok");
+		g_free(recv_data);
+		if (n == 0U) {
+			op_res = net_client_start_tls(basic, &error);
+		} else {
+			op_res = net_client_start_compression(basic, &error);
+		}
+		sput_fail_unless((op_res == FALSE) && g_error_matches(error, NET_CLIENT_ERROR_QUARK, NET_CLIENT_ERROR_DATA_PENDING),
+			(n == 0U) ? "basic: start TLS fails, data pending" : "basic: start compression fails, data pending");
+		g_clear_error(&error);
+		g_object_unref(basic);
+	}
+
+	g_thread_join(server);
+	g_object_unref(listener);
+}
+
+
 static void
 test_utils(void)
 {
@@ -87,6 +87,8 @@ static void bndx_row_activated(GtkTreeView * tree_view, GtkTreePath * path,
                                gpointer user_data);
 static void bndx_column_resize(GtkWidget * widget,
                                GtkAllocation * allocation, gpointer data);
+static gboolean bndx_draw_cb(GtkWidget * widget, cairo_t * cr,
+                             gpointer data);
 static void bndx_tree_expand_cb(GtkTreeView * tree_view,
                                 GtkTreeIter * iter, GtkTreePath * path,
                                 gpointer user_data);
@@ -179,6 +181,12 @@ struct _BalsaIndex {
     /* Ephemera: used by idle handlers */
     GtkTreeRowReference *reference;
     guint row_inserted_msgno;
+
+    /* The rows shown when last drawn, first and last */
+    GtkTreePath *first_visible_path;
+    GtkTreePath *last_visible_path;
+    guint first_visible_msgno;
+    guint last_visible_msgno;
 };
 
 /* Class type. */
@@ -270,6 +278,15 @@ bndx_destroy(GObject * obj)
     g_free(bindex->filter_string);
     bindex->filter_string = NULL;
 
+    if (bindex->first_visible_path != NULL) {
+        gtk_tree_path_free(bindex->first_visible_path);
+        bindex->first_visible_path = NULL;
+    }
+    if (bindex->last_visible_path != NULL) {
+        gtk_tree_path_free(bindex->last_visible_path);
+        bindex->last_visible_path = NULL;
+    }
+
     if (bindex->reference != NULL) {
         gtk_tree_row_reference_free(bindex->reference);
         bindex->reference = NULL;
@@ -477,6 +494,10 @@ balsa_index_init(BalsaIndex * index)
     g_signal_connect_after(tree_view, "size-allocate",
                            G_CALLBACK(bndx_column_resize),
                            NULL);
+    /* Tell the mailbox which rows are about to be drawn, so that it can
+     * fetch them, and those that will follow, together */
+    g_signal_connect(tree_view, "draw",
+                     G_CALLBACK(bndx_draw_cb), NULL);
     gtk_tree_view_set_enable_search(tree_view, FALSE);
 
     gtk_drag_source_set(GTK_WIDGET (index),
@@ -740,6 +761,180 @@ bndx_tree_collapse_cb(GtkTreeView * tree_view, GtkTreeIter * iter,
     bndx_changed_find_row(index);
 }
 
+/* Move path and iter to the next row shown, or to the previous one,
+ * skipping the messages in collapsed threads. */
+static gboolean
+bndx_next_row(GtkTreeView * tree_view, GtkTreeModel * model,
+              GtkTreePath * path, GtkTreeIter * iter)
+{
+    GtkTreeIter tmp_iter;
+
+    if (gtk_tree_view_row_expanded(tree_view, path)
+        && gtk_tree_model_iter_children(model, &tmp_iter, iter)) {
+        *iter = tmp_iter;
+        gtk_tree_path_down(path);
+        return TRUE;
+    }
+
+    for (;;) {
+        tmp_iter = *iter;
+        if (gtk_tree_model_iter_next(model, &tmp_iter)) {
+            *iter = tmp_iter;
+            gtk_tree_path_next(path);
+            return TRUE;
+        }
+        if (!gtk_tree_model_iter_parent(model, &tmp_iter, iter))
+            return FALSE;
+        *iter = tmp_iter;
+        gtk_tree_path_up(path);
+    }
+}
+
+static gboolean
+bndx_prev_row(GtkTreeView * tree_view, GtkTreeModel * model,
+              GtkTreePath * path, GtkTreeIter * iter)
+{
+    GtkTreeIter tmp_iter;
+    gint n;
+
+    if (!gtk_tree_path_prev(path)) {
+        if (gtk_tree_path_get_depth(path) <= 1
+            || !gtk_tree_model_iter_parent(model, &tmp_iter, iter))
+            return FALSE;
+        *iter = tmp_iter;
+        gtk_tree_path_up(path);
+        return TRUE;
+    }
+
+    /* The last row shown in the thread of the previous sibling. */
+    if (!gtk_tree_model_get_iter(model, iter, path))
+        return FALSE;
+    while (gtk_tree_view_row_expanded(tree_view, path)
+           && (n = gtk_tree_model_iter_n_children(model, iter)) > 0
+           && gtk_tree_model_iter_nth_child(model, &tmp_iter, iter, n - 1)) {
+        *iter = tmp_iter;
+        gtk_tree_path_append_index(path, n - 1);
+    }
+
+    return TRUE;
+}
+
+/* Append the msgnos of up to count rows after (direction > 0) or before
+ * the row at path. */
+static void
+bndx_collect_rows(GtkTreeView * tree_view, GtkTreeModel * model,
+                  GtkTreePath * start, gint direction, guint count,
+                  GArray * rows)
+{
+    GtkTreePath *path;
+    GtkTreeIter iter;
+
+    if (!gtk_tree_model_get_iter(model, &iter, start))
+        return;
+
+    path = gtk_tree_path_copy(start);
+    while (count-- > 0
+           && (direction > 0 ? bndx_next_row(tree_view, model, path, &iter)
+               : bndx_prev_row(tree_view, model, path, &iter))) {
+        guint msgno;
+
+        gtk_tree_model_get(model, &iter, LB_MBOX_MSGNO_COL, &msgno, -1);
+        g_array_append_val(rows, msgno);
+    }
+    gtk_tree_path_free(path);
+}
+
+/* Before the rows are drawn, pass the rows shown, the rows around them,
+ * and the direction in which the view has moved, to the mailbox, so
+ * that it reads ahead only rows the user can scroll to.  Most draws do
+ * not scroll, so nothing is passed while the first and last rows shown
+ * are the same rows, with the same messages, as last time. */
+static gboolean
+bndx_draw_cb(GtkWidget * widget, cairo_t * cr, gpointer data)
+{
+    BalsaIndex *bindex = BALSA_INDEX(widget);
+    GtkTreeView *tree_view = GTK_TREE_VIEW(widget);
+    GtkTreeModel *model;
+    GtkTreePath *start_path, *end_path, *path;
+    GtkTreeIter iter, end_iter;
+    GArray *before, *rows;
+    guint msgno, first_msgno, last_msgno, first, last, i;
+    gint direction = 0;
+
+    if (bindex->mailbox_node == NULL
+        || (model = gtk_tree_view_get_model(tree_view)) == NULL
+        || !gtk_tree_view_get_visible_range(tree_view, &start_path,
+                                            &end_path))
+        return FALSE;
+
+    if (!gtk_tree_model_get_iter(model, &iter, start_path)
+        || !gtk_tree_model_get_iter(model, &end_iter, end_path)) {
+        gtk_tree_path_free(start_path);
+        gtk_tree_path_free(end_path);
+        return FALSE;
+    }
+
+    gtk_tree_model_get(model, &iter, LB_MBOX_MSGNO_COL, &first_msgno, -1);
+    gtk_tree_model_get(model, &end_iter, LB_MBOX_MSGNO_COL, &last_msgno,
+                       -1);
+    if (bindex->first_visible_path != NULL
+        && bindex->last_visible_path != NULL
+        && first_msgno == bindex->first_visible_msgno
+        && last_msgno == bindex->last_visible_msgno
+        && gtk_tree_path_compare(start_path,
+                                 bindex->first_visible_path) == 0
+        && gtk_tree_path_compare(end_path,
+                                 bindex->last_visible_path) == 0) {
+        gtk_tree_path_free(start_path);
+        gtk_tree_path_free(end_path);
+        return FALSE;
+    }
+
+    /* The rows before the first one shown, nearest last... */
+    before = g_array_new(FALSE, FALSE, sizeof(guint));
+    bndx_collect_rows(tree_view, model, start_path, -1,
+                      LIBBALSA_MAILBOX_VIEW_ROWS_AROUND, before);
+    rows = g_array_sized_new(FALSE, FALSE, sizeof(guint), before->len
+                             + 2 * LIBBALSA_MAILBOX_VIEW_ROWS_AROUND);
+    for (i = before->len; i > 0; i--)
+        g_array_append_val(rows, g_array_index(before, guint, i - 1));
+    g_array_free(before, TRUE);
+
+    /* ...the rows shown... */
+    first = rows->len;
+    path = gtk_tree_path_copy(start_path);
+    do {
+        gtk_tree_model_get(model, &iter, LB_MBOX_MSGNO_COL, &msgno, -1);
+        g_array_append_val(rows, msgno);
+    } while (gtk_tree_path_compare(path, end_path) < 0
+             && bndx_next_row(tree_view, model, path, &iter));
+    gtk_tree_path_free(path);
+    last = rows->len - 1;
+
+    /* ...and the rows after the last one. */
+    bndx_collect_rows(tree_view, model, end_path, 1,
+                      LIBBALSA_MAILBOX_VIEW_ROWS_AROUND, rows);
+
+    if (bindex->first_visible_path != NULL) {
+        direction =
+            gtk_tree_path_compare(start_path, bindex->first_visible_path);
+        gtk_tree_path_free(bindex->first_visible_path);
+    }
+    if (bindex->last_visible_path != NULL)
+        gtk_tree_path_free(bindex->last_visible_path);
+    bindex->first_visible_path = start_path;
+    bindex->last_visible_path = end_path;
+    bindex->first_visible_msgno = first_msgno;
+    bindex->last_visible_msgno = last_msgno;
+
+    libbalsa_mailbox_set_visible_range(LIBBALSA_MAILBOX(model),
+                                       (const guint *) rows->data,
+                                       rows->len, first, last, direction);
+    g_array_free(rows, TRUE);
+
+    return FALSE;
+}
+
 /* When a column is resized, store the new size for later use */
 static void
 bndx_column_resize(GtkWidget * widget, GtkAllocation * allocation,
@@ -38,6 +38,7 @@
 #include "application-helpers.h"
 #include "imap-server.h"
 #include "libbalsa.h"
+#include "mailbox-check.h"
 #include "misc.h"
 #include "html.h"
 #include <glib/gi18n.h>
@@ -3510,23 +3511,33 @@ bw_mailbox_check(LibBalsaMailbox * mailbox, struct check_messages_thread_info *i
             if (!priv->network_available)
                 return;
         }
-
-    	if (info->with_progress_dialog) {
-    		libbalsa_progress_dialog_update(&progress_dialog, _("Mailboxes"), FALSE, INFINITY,
-    			_("IMAP mailbox: %s"), libbalsa_mailbox_get_url(mailbox));
-    	}
-    } else if (LIBBALSA_IS_MAILBOX_LOCAL(mailbox)) {
-    	if (info->with_progress_dialog) {
-    		libbalsa_progress_dialog_update(&progress_dialog, _("Mailboxes"), FALSE, INFINITY,
-    			_("Local mailbox: %s"), libbalsa_mailbox_get_name(mailbox));
-    	}
-    } else {
+    } else if (!LIBBALSA_IS_MAILBOX_LOCAL(mailbox)) {
     	g_assert_not_reached();
     }
 
     libbalsa_mailbox_check(mailbox);
 }
 
+/* Called in the threaded code after each mailbox has been checked; the
+ * calls are serialized, so the fraction only grows. */
+static void
+bw_mailbox_check_done(LibBalsaMailbox * mailbox, guint done, guint total,
+                      struct check_messages_thread_info *info)
+{
+    gdouble fraction = (gdouble) done / (gdouble) total;
+
+    if (!info->with_progress_dialog)
+        return;
+
+    if (LIBBALSA_IS_MAILBOX_IMAP(mailbox)) {
+    	libbalsa_progress_dialog_update(&progress_dialog, _("Mailboxes"), FALSE, fraction,
+    		_("IMAP mailbox: %s"), libbalsa_mailbox_get_url(mailbox));
+    } else {
+    	libbalsa_progress_dialog_update(&progress_dialog, _("Mailboxes"), FALSE, fraction,
+    		_("Local mailbox: %s"), libbalsa_mailbox_get_name(mailbox));
+    }
+}
+
 static gboolean
 bw_check_messages_thread_idle_cb(BalsaWindow * window)
 {
@@ -3552,7 +3563,10 @@ bw_check_messages_thread(struct check_messages_thread_info *info)
     	if (info->with_progress_dialog) {
     		libbalsa_progress_dialog_ensure(&progress_dialog, _("Checking Mail…"), GTK_WINDOW(info->window), _("Mailboxes"));
     	}
-    	g_slist_foreach(list, (GFunc) bw_mailbox_check, info);
+    	libbalsa_mailbox_check_all(list, g_get_num_processors(),
+    	                           (LibBalsaMailboxCheckFunc) bw_mailbox_check,
+    	                           (LibBalsaMailboxCheckDone) bw_mailbox_check_done,
+    	                           info);
     	g_slist_free_full(list, g_object_unref);
     	if (info->with_progress_dialog) {
     		libbalsa_progress_dialog_update(&progress_dialog, _("Mailboxes"), TRUE, 1.0, NULL);